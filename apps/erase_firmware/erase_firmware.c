@@ -28,7 +28,9 @@
 #include "board_api.h"
 
 /* This is an application that erases whole application firmware by
- * writing the erase magic and reset to let bootloader do its work
+ * writing the erase magic and reset to let bootloader do its work.
+ * Depending on the port, bootloader only erases blocks that hold data
+ * and logs the time it took (e.g espressif)
  */
 
 //--------------------------------------------------------------------+
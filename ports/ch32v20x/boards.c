@@ -200,8 +200,25 @@ int board_uart_write(void const* buf, int len) {
 //--------------------------------------------------------------------+
 // Flash
 //--------------------------------------------------------------------+
+// Consecutive pages are written under one unlock, flash is locked again on flush
+static bool _flash_unlocked = false;
+static uint32_t _flash_next_addr = 0;
+
+static void flash_lock(void) {
+  if (_flash_unlocked) {
+    FLASH_Lock_Fast();
+    _flash_unlocked = false;
+  }
+}
+
+// hardware CRC unit, data is word aligned
+static uint32_t flash_crc(void const* data, uint32_t len) {
+  CRC_ResetDR();
+  return CRC_CalcBlockCRC((uint32_t*) (uintptr_t) data, len / 4);
+}
+
 void board_flash_init(void) {
-  // nothing to do
+  RCC_AHBPeriphClockCmd(RCC_AHBPeriph_CRC, ENABLE);
 }
 
 uint32_t board_flash_size(void) {
@@ -213,7 +230,7 @@ void board_flash_read(uint32_t addr, void* buffer, uint32_t len) {
 }
 
 void board_flash_flush(void) {
-  // nothing to do
+  flash_lock();
 }
 
 bool board_flash_write(uint32_t addr, void const* data, uint32_t len) {
@@ -221,15 +238,21 @@ bool board_flash_write(uint32_t addr, void const* data, uint32_t len) {
 
   addr = ADDR_ABS(addr);
 
-  FLASH_Unlock_Fast();
+  // skip unchanged page
+  if (memcmp((void*) addr, data, len) == 0) return true;
+
+  if (addr != _flash_next_addr) flash_lock();
+  if (!_flash_unlocked) {
+    FLASH_Unlock_Fast();
+    _flash_unlocked = true;
+  }
+  _flash_next_addr = addr + len;
 
   FLASH_ErasePage_Fast(addr);
   FLASH_ProgramPage_Fast(addr, (uint32_t*) (uintptr_t ) data);
 
-  FLASH_Lock_Fast();
-
   // verify contents
-  if (memcmp((void*) addr, data, len) != 0) {
+  if (flash_crc((void*) addr, len) != flash_crc(data, len)) {
     TUF2_LOG1("Failed to write\r\n");
   }
 
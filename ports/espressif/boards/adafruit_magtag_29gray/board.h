@@ -60,6 +60,19 @@
 #define LED_PIN               13
 #define LED_STATE_ON          1
 
+//--------------------------------------------------------------------+
+// E-Paper status display
+//--------------------------------------------------------------------+
+
+// 2.9" 296x128 panel with IL0373 controller on SPI2, see EPD_PIN_SCK in boards.c
+#define EPD_PIN_SCK           36
+#define EPD_PIN_MOSI          35
+#define EPD_PIN_MISO          37
+#define EPD_PIN_CS            8
+#define EPD_PIN_DC            7
+#define EPD_PIN_RST           6
+#define EPD_PIN_BUSY          5
+
 //--------------------------------------------------------------------+
 // USB UF2
 //--------------------------------------------------------------------+
@@ -22,124 +22,3254 @@
  * THE SOFTWARE.
  */
 
+#include <stddef.h>
 #include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
 #include "esp_log.h"
 #include "esp_system.h"
 #include "esp_partition.h"
 #include "esp_ota_ops.h"
+#include "esp_app_format.h"
+#include "esp_image_format.h"
+#include "esp_rom_crc.h"
+#include "esp_rom_md5.h"
+#include "esp_timer.h"
+#include "esp_flash.h"
+#include "esp_rom_sys.h"
+#include "esp_heap_caps.h"
+#include "esp_task_wdt.h"
+#include "nvs.h"
+#include "nvs_flash.h"
 
 #include "spi_flash_chip_driver.h"
 #include "board_api.h"
+#include "tusb_config.h"
+#include "scratch.h"
+#include "compress.h"
+#include "decompress.h"
+
+#include "mbedtls/sha256.h"
+
+#ifdef BOARD_UF2_SIGN_PUBKEY
+#include "uECC.h"
+#endif
+
+#if FLASH_CALIBRATE
+#include "hal/spi_flash_hal.h"
+#endif
+
+#if BOARD_APP_CHECK && CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC
+#include "bootloader_common.h"
+#include "bootimage.h"
+#endif
+
+#ifdef BOARD_UF2_STAGE_FAMILY
+#include "bootloader_common.h"
+#include "bootstage.h"
+#endif
 
 #define FLASH_CACHE_SIZE          (64*1024)
+#define FLASH_SECTOR_SIZE         4096
+#define FLASH_PAGE_SIZE           256
+#define FLASH_BLOCK_SIZE          (64*1024)
 #define FLASH_CACHE_INVALID_ADDR  0xffffffff
 
-static uint32_t _fl_addr = FLASH_CACHE_INVALID_ADDR;
+// Erase the next write window of ota0 in the background while usbd is filling the current one
+#ifndef FLASH_ERASE_AHEAD
+#define FLASH_ERASE_AHEAD         1
+#endif
+
+// Persist progress of the uf2 download to NVS after each flushed window, so that an
+// interrupted update of the same image resumes where it stopped
+#ifndef FLASH_RESUME_JOURNAL
+#define FLASH_RESUME_JOURNAL      1
+#endif
+
+// board_flash_erase_app() also erases measurement data (ota1 or the measurement partitions)
+#ifndef FLASH_ERASE_APP_MEASUREMENT
+#define FLASH_ERASE_APP_MEASUREMENT  0
+#endif
+
+// Label prefix of data partitions holding measurement data (e.g meas0, meas1 of partitions-16MB-meas.csv),
+// in partition table order. First one backs MEASDAT, ota1 is used if there is none
+#ifndef FLASH_MEASUREMENT_LABEL
+#define FLASH_MEASUREMENT_LABEL   "meas"
+#endif
+
+// Max number of measurement data partitions
+#ifndef FLASH_MEASUREMENT_PARTITIONS
+#define FLASH_MEASUREMENT_PARTITIONS  4
+#endif
+
+// A/B staging: if ota1 exists, is as large as ota0 and does not hold measurement data, the uf2 is
+// written to the slot that does not boot while the other one stays intact. Boot target switches
+// through otadata once the image is verified
+#ifndef FLASH_AB_SLOTS
+#define FLASH_AB_SLOTS            0
+#endif
+
+// Try faster SPI1 clock and IO modes for the DFU session, see flash_calibrate(). 2nd stage bootloader
+// and the app keep the configuration of sdkconfig
+#ifndef FLASH_CALIBRATE
+#define FLASH_CALIBRATE           0
+#endif
+
+// Map ota0, the active A/B slot and the measurement partitions into the data cache once and serve reads by
+// memcpy from the mapping: sequential reads then hit the cache instead of issuing SPI commands per 256 or 512
+// bytes. A partition that does not fit the MMU is read with esp_partition_read() as before
+#ifndef FLASH_READ_MMAP
+#define FLASH_READ_MMAP           1
+#endif
+
+// Largest erase issued at once by the flash task, a multiple of FLASH_SECTOR_SIZE. Cache and the USB
+// interrupt are off while a single erase command runs, usbd only gets to run between slices. Sector slices
+// bound that to one sector erase (~45ms) instead of a block erase (~150ms, worst case seconds) but erase
+// 64KB about twice as slow
+#ifndef FLASH_ERASE_SLICE
+#define FLASH_ERASE_SLICE         FLASH_BLOCK_SIZE
+#endif
+
+// For this many ms after a host READ10 (board_flash_read_hint()) the flash task erases and programs one sector
+// at a time whatever FLASH_ERASE_SLICE is: a read during a flush or erase then waits one sector erase (~45ms)
+// at most, a burst of reads of INFO or STATS files during an update is served between sectors. 0 keeps
+// FLASH_ERASE_SLICE and whole runs of pages
+#ifndef FLASH_READ_ACTIVE_MS
+#define FLASH_READ_ACTIVE_MS      500
+#endif
+
+// BOARD_FLASH_SCRUB hashes once the host has neither read nor written for this many ms, 1KB at a time so
+// that the next command waits for one SPI read at most
+#ifndef FLASH_SCRUB_IDLE_MS
+#define FLASH_SCRUB_IDLE_MS       1000
+#endif
+
+// Longest erase & program work between two yields of the task issuing it. The task watchdog checks the idle
+// tasks, which a long batch of slices (erase app, replay of a staged image, sweep of measurement data) would
+// otherwise starve for seconds. A task subscribed to the watchdog itself is fed as well
+#ifndef FLASH_YIELD_MS
+#define FLASH_YIELD_MS            500
+#endif
+
+// Longest a busy WRITE10 blocks usbd, woken as soon as the flash task frees a window
+#ifndef FLASH_WRITE_WAIT_MS
+#define FLASH_WRITE_WAIT_MS       10
+#endif
+
+// Longest board_flash_detach() programs windows received so far after the host went away mid-image
+#ifndef FLASH_DETACH_MS
+#define FLASH_DETACH_MS           1000
+#endif
+
+// Supply governor, active if the board has board_supply_mv(): below FLASH_SUPPLY_LOW_MV erase-ahead stops,
+// erase & program go one sector at a time with FLASH_SUPPLY_PAUSE_MS in between until the supply is back
+// at FLASH_SUPPLY_OK_MV. Resume journal still advances per window, a brownout costs at most the one in progress
+#ifndef FLASH_SUPPLY_LOW_MV
+#define FLASH_SUPPLY_LOW_MV       4400
+#endif
+
+#ifndef FLASH_SUPPLY_OK_MV
+#define FLASH_SUPPLY_OK_MV        4600
+#endif
+
+#ifndef FLASH_SUPPLY_PAUSE_MS
+#define FLASH_SUPPLY_PAUSE_MS     20
+#endif
+
+// Store-then-flash: the uf2 is received into a PSRAM copy of the target slot without waiting for flash, then replayed
+// window by window through the write windows once complete (board_flash_flush()). Needs CONFIG_SPIRAM with
+// CONFIG_SPIRAM_USE_CAPS_ALLOC, writes go straight to the windows as before if PSRAM can not hold the slot
+#ifndef FLASH_PSRAM_STAGE
+#define FLASH_PSRAM_STAGE         0
+#endif
+
+// Data partition holding the last-known-good app with CFG_UF2_LKG_SNAPSHOT, e.g lkg of partitions-16MB-lkg.csv.
+// Compressed windows take less room than ota0 but how much less depends on the app, an update without room for
+// all of them drops the snapshot and goes on
+#ifndef FLASH_LKG_LABEL
+#define FLASH_LKG_LABEL           "lkg"
+#endif
+
+// Up to this many write windows of FLASH_CACHE_SIZE, the first is static, the others are taken from heap at
+// init while FLASH_HEAP_RESERVE stays free (down to the static one only). usbd fills several at once so that
+// hosts writing out of order (macOS, some Windows versions) do not flush and re-open a window for every jump,
+// each is submitted once all of it is received or as least recently used when a window is needed for another
+// part of the image. ESP32-S3 has 512KB of SRAM, ESP32-S2 320KB
+#ifndef FLASH_CACHE_WINDOWS
+  #if CONFIG_IDF_TARGET_ESP32S3
+    #define FLASH_CACHE_WINDOWS     4
+  #else
+    #define FLASH_CACHE_WINDOWS     3
+  #endif
+#endif
+
+// Heap left to the rest of the session (wear counters, measurement sector cache, NVS)
+// when write windows are allocated
+#ifndef FLASH_HEAP_RESERVE
+#define FLASH_HEAP_RESERVE        (48*1024)
+#endif
+
+// Size of each of the 2 read-ahead buffers used for sequential reads of CURRENT.UF2 (ota0) and
+// MEASDAT.CSV (ota1), must be power of 2. Static RAM. A read is only served from a single buffer, so
+// it holds at least one READ10 callback (CFG_TUD_MSC_BUFSIZE in tusb_config.h)
+#ifndef FLASH_READ_AHEAD_SIZE
+#define FLASH_READ_AHEAD_SIZE     CFG_TUD_MSC_BUFSIZE
+#endif
+
+enum {
+  FL_FREE = 0,
+  FL_FILLING,  // being filled by usbd task
+  FL_FLUSHING, // queued or being erased & programmed by flash task
+};
+
+typedef struct {
+  uint32_t addr;
+  uint32_t seq;      // submit order, older windows are flushed first
+  uint32_t used;     // last write while filling, least recent one is submitted under pressure
+  uint32_t received; // bytes written while filling, window is submitted once all of it is received
+  uint32_t dirty;    // sectors written with data flash does not hold, see cache_fill()
+  volatile uint8_t state;
+  bool erased;       // window was erased ahead, flash is all 0xff
+  uint8_t* buf;
+} flash_cache_t;
+
+_Static_assert(FLASH_CACHE_SIZE / FLASH_SECTOR_SIZE <= 32, "dirty has a bit per sector of a window");
+_Static_assert(FLASH_READ_AHEAD_SIZE >= CFG_TUD_MSC_BUFSIZE, "read-ahead buffer holds a whole READ10 callback");
+_Static_assert((FLASH_READ_AHEAD_SIZE & (FLASH_READ_AHEAD_SIZE - 1)) == 0, "read-ahead size must be power of 2");
+
+// Write-back cache: usbd fills windows while others are flushed.
+// ESP32s2 can only statically allocate DRAM up to 160KB, other windows are allocated from heap.
 static uint8_t _fl_buf[FLASH_CACHE_SIZE] __attribute__((aligned(4)));
+static flash_cache_t _fl_cache[FLASH_CACHE_WINDOWS];
+static flash_cache_t* _fl_cur = NULL;  // window of the last write
+static uint32_t _fl_seq = 0;
+static uint32_t _fl_used = 0;
 
-// uf2 will always write to ota0 partition
-static esp_partition_t const* _part_ota0 = NULL;
-// measurment data write to ata1 partition
-static esp_partition_t const* _part_measurement_data = NULL;
+static TaskHandle_t _fl_task = NULL;
+static SemaphoreHandle_t _fl_done = NULL;
+static StaticSemaphore_t _fl_done_def;
 
-void board_flash_init(void) {
-  _fl_addr = FLASH_CACHE_INVALID_ADDR;
+// incremented before erasing and after programming ota0, used to detect stale read-ahead data
+static volatile uint32_t _fl_gen = 0;
+
+// same for the measurement data, incremented by each block of board_measurement_erase()
+static volatile uint32_t _me_gen = 0;
+
+enum {
+  EA_NONE = 0,
+  EA_ERASING,
+  EA_ERASED,
+};
+
+// Erase-ahead: flash task erases the window after the one most recently opened by usbd,
+// but only if it is entirely covered by the uf2 image being written
+static volatile uint32_t _ea_end = 0;
+static volatile uint32_t _ea_addr = FLASH_CACHE_INVALID_ADDR;
+static volatile uint8_t _ea_state = EA_NONE;
+static volatile uint32_t _fl_last_addr = FLASH_CACHE_INVALID_ADDR;
+// end of the highest window opened since the last flush: one below it may already hold data of this image
+// that would not be written again (out of order host), it is never erased ahead
+static volatile uint32_t _ea_floor = 0;
+
+// Verification: running crc32 of windows as they are programmed, only valid if
+// windows are flushed in ascending contiguous order (normal uf2 download)
+static uint32_t _vf_crc = 0;
+static uint32_t _vf_start = FLASH_CACHE_INVALID_ADDR;
+static uint32_t _vf_end = FLASH_CACHE_INVALID_ADDR;
+static bool _vf_valid = true;
+
+#ifdef BOARD_UF2_SIGN_PUBKEY
+// Signed images: sha256 of [0, _sg_len) of ota0 is computed from the windows as they are flushed,
+// overlapping the transfer. Not possible if windows are not flushed from 0 in contiguous order, or
+// before the signature (and the signed length) is known: board_flash_verify() reads the image then.
+static uint8_t const _sg_pubkey[64] = BOARD_UF2_SIGN_PUBKEY;
+static mbedtls_sha256_context _sg_sha;
+static uint8_t _sg_signature[64];
+static uint32_t _sg_len = 0;            // 0 if no signature was received
+static uint32_t _sg_hashed = 0;         // windows below are in _sg_sha
+static bool _sg_stream = true;
 
-  _part_ota0 = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, NULL);
-  assert(_part_ota0 != NULL);
-  _part_measurement_data = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, NULL);
-  assert(_part_measurement_data != NULL);
+static void sign_consume(flash_cache_t const* fc);
+#endif
+
+#if FLASH_RESUME_JOURNAL
+// Image identity and end of windows flushed contiguously from address 0, stored as one NVS blob
+typedef struct {
+  uint32_t image_id;
+  uint32_t num_blocks;
+  uint32_t flushed;
+} flash_journal_t;
+
+static flash_journal_t _jr = { .flushed = FLASH_CACHE_INVALID_ADDR };
+#endif
+
+#if BOARD_APP_CHECK
+// Cheap identity of the image in ota0: length from header & segment table and its last 32 bytes
+// (the appended sha256 if any). Stored as NVS blob once flash content is known to be good
+typedef struct {
+  uint32_t len;
+  uint8_t tail[32];
+} app_valid_t;
+
+static bool _av_cleared = false;
+static void app_valid_save(bool valid);
+#endif
+
+#ifdef BOARD_UF2_ROUTES
+// write back sector caches of families routed to other partitions
+static void route_flush(void);
+#endif
+
+#ifdef BOARD_UF2_STAGE_FAMILY
+// tinyuf2 image of a bundle is complete and valid, return false if it was written but is not
+static bool stage_check(void);
+#endif
+
+// erase the next block of a pending board_measurement_erase(), return true if there are more
+static bool measurement_erase_step(void);
+
+#if TINYUF2_DATA_LUN
+// erase the next sector unmapped by board_data_lun_unmap(), return true if there are more
+static bool unmap_erase_step(void);
+#endif
+
+// uf2 is written to ota0, or to the inactive slot with FLASH_AB_SLOTS
+static esp_partition_t const* _part_target = NULL;
+// slot the app boots from, same as _part_target without A/B staging
+static esp_partition_t const* _part_active = NULL;
+
+#if FLASH_AB_SLOTS
+// Windows of the target slot opened since the last verify. Reads of the others come from the active
+// slot, so that board_flash_read() sees the image patched in place as without A/B staging
+// (CURRENT.UF2, delta copies and its base check)
+#define FLASH_AB_WINDOWS_MAX      256
+static uint32_t _ab_written[FLASH_AB_WINDOWS_MAX / 32];
+
+static inline bool ab_written(uint32_t addr) {
+  uint32_t const w = addr / FLASH_CACHE_SIZE;
+  return (w >= FLASH_AB_WINDOWS_MAX) || (_ab_written[w / 32] & (1UL << (w % 32)));
 }
 
-uint32_t board_flash_size(void) {
-  return _part_ota0->size;
+static inline void ab_mark(uint32_t addr) {
+  uint32_t const w = addr / FLASH_CACHE_SIZE;
+  if (w < FLASH_AB_WINDOWS_MAX) _ab_written[w / 32] |= 1UL << (w % 32);
 }
+#endif
 
+#if FLASH_PSRAM_STAGE
+// PSRAM image of the target slot, windows staged since the last flush hold the new data
+#define FLASH_PSRAM_WINDOWS_MAX   256
+static uint8_t* _ps_buf = NULL;
+static uint32_t _ps_staged[FLASH_PSRAM_WINDOWS_MAX / 32];
+static uint32_t _ps_received[FLASH_PSRAM_WINDOWS_MAX]; // bytes written into each staged window
+static uint32_t _ps_count = 0;
 
-void board_flash_read(uint32_t addr, void* buffer, uint32_t len) {
-  esp_partition_read(_part_ota0, addr, buffer, len);
+static inline bool ps_staged(uint32_t addr) {
+  uint32_t const w = addr / FLASH_CACHE_SIZE;
+  return _ps_staged[w / 32] & (1UL << (w % 32));
 }
 
-void board_measuremnt_data_read(uint32_t addr, void* buffer, uint32_t len) {
-  esp_partition_read(_part_measurement_data, addr, buffer, len);
-}
+static void psram_replay(void);
+#endif
 
+// measurment data write to ata1 partition, or to the labeled data partitions
+static esp_partition_t const* _part_measurement_data = NULL;
+static esp_partition_t const* _part_measurement[FLASH_MEASUREMENT_PARTITIONS];
+static uint32_t _part_measurement_count = 0;
 
+#if CFG_UF2_FLASH_BIN && !CFG_UF2_READBACK_PROTECT
+// The whole chip for FLASH.BIN, a partition of its own so that it is read like the others with read-ahead.
+// Not mapped: all of the chip would take the data MMU space of the real partitions
+static esp_partition_t _part_chip;
+#endif
 
-void board_flash_flush(void) {
-  if (_fl_addr == FLASH_CACHE_INVALID_ADDR) return;
+#if FLASH_READ_MMAP
+// Writes go through esp_partition_erase_range/write(), which invalidate cache lines of the main flash chip
+// in any mapping, so a read after a flush never sees stale data
+typedef struct {
+  esp_partition_t const* part;
+  uint8_t const* ptr;
+  esp_partition_mmap_handle_t hdl;
+} flash_map_t;
 
-  TUF2_LOG1("Erase and Write at 0x%08lX", _fl_addr);
+static flash_map_t _fl_map[2 + FLASH_MEASUREMENT_PARTITIONS];
+static uint32_t _fl_map_count = 0;
 
-  // Check if contents already matched
-  bool content_matches = true;
-  uint32_t const verify_sz = 4096;
-  uint8_t* verify_buf = malloc(verify_sz);
+static void part_map(esp_partition_t const* part) {
+  for (uint32_t i = 0; i < _fl_map_count; i++) {
+    if (_fl_map[i].part == part) return;
+  }
 
-  for (uint32_t count = 0; count < FLASH_CACHE_SIZE; count += verify_sz) {
-    board_flash_read(_fl_addr + count, verify_buf, verify_sz);
-    if (0 != memcmp(_fl_buf + count, verify_buf, verify_sz)) {
-      content_matches = false;
-      break;
+  flash_map_t* map = &_fl_map[_fl_map_count];
+  void const* ptr;
+  if (ESP_OK != esp_partition_mmap(part, 0, part->size, ESP_PARTITION_MMAP_DATA, &ptr, &map->hdl)) {
+    TUF2_LOG1("%s not mapped, read by SPI commands", part->label);
+    return;
+  }
+  map->part = part;
+  map->ptr = (uint8_t const*) ptr;
+  _fl_map_count++;
+}
+#endif
+
+static void part_read(esp_partition_t const* part, uint32_t addr, void* buffer, uint32_t len) {
+#if FLASH_READ_MMAP
+  for (uint32_t i = 0; i < _fl_map_count; i++) {
+    if (_fl_map[i].part == part) {
+      if (addr + len <= part->size) memcpy(buffer, _fl_map[i].ptr + addr, len);
+      return;
     }
   }
-  free(verify_buf);
+#endif
+  esp_partition_read(part, addr, buffer, len);
+}
+
+// Find measurement data partitions by FLASH_MEASUREMENT_LABEL, fall back to ota1. Return their count
+static uint32_t measurement_partitions_find(esp_partition_t const* parts[FLASH_MEASUREMENT_PARTITIONS]) {
+  uint32_t count = 0;
+  size_t const prefix_len = strlen(FLASH_MEASUREMENT_LABEL);
+
+  esp_partition_iterator_t it = esp_partition_find(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, NULL);
+  while (it != NULL && count < FLASH_MEASUREMENT_PARTITIONS) {
+    esp_partition_t const* part = esp_partition_get(it);
+    if (0 == strncmp(part->label, FLASH_MEASUREMENT_LABEL, prefix_len)) parts[count++] = part;
+    it = esp_partition_next(it);
+  }
+  esp_partition_iterator_release(it);
 
-  // skip erase & write if content already matches
-  if (!content_matches) {
-    esp_partition_erase_range(_part_ota0, _fl_addr, FLASH_CACHE_SIZE);
-    esp_partition_write(_part_ota0, _fl_addr, _fl_buf, FLASH_CACHE_SIZE);
+  if (count == 0) {
+    parts[0] = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, NULL);
+    if (parts[0] != NULL) count = 1;
   }
 
-  _fl_addr = FLASH_CACHE_INVALID_ADDR;
+  return count;
 }
 
-bool board_flash_write(uint32_t addr, void const* data, uint32_t len) {
-  uint32_t new_addr = addr & ~(FLASH_CACHE_SIZE - 1);
+// Slot the app boots from and the one uf2 writes to, both ota0 unless A/B staging is possible
+static void app_slots(esp_partition_t const** active, esp_partition_t const** target) {
+  esp_partition_t const* ota0 = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, NULL);
+  *active = *target = ota0;
+
+#if FLASH_AB_SLOTS
+  esp_partition_t const* ota1 = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, NULL);
+  esp_partition_t const* meas[FLASH_MEASUREMENT_PARTITIONS];
+  if (ota0 == NULL || ota1 == NULL || ota1->size != ota0->size) return;
+  if (measurement_partitions_find(meas) && meas[0] == ota1) return;
+
+  bool const ota1_boots = (esp_ota_get_boot_partition() == ota1);
+  *active = ota1_boots ? ota1 : ota0;
+  *target = ota1_boots ? ota0 : ota1;
+#endif
+}
+
+//--------------------------------------------------------------------+
+// Read-ahead
+// Buffers are only scheduled and consumed by the usbd task, read-ahead task
+// only fills buffers that are pending.
+//--------------------------------------------------------------------+
+
+enum {
+  RA_EMPTY = 0,
+  RA_PENDING,
+  RA_READY,
+};
 
-  if (new_addr != _fl_addr) {
-    board_flash_flush();
+typedef struct {
+  esp_partition_t const* part;
+  uint32_t addr;
+  uint32_t len;
+  uint32_t gen;
+  volatile uint8_t state;
+  uint8_t buf[FLASH_READ_AHEAD_SIZE] __attribute__((aligned(4)));
+} read_ahead_t;
 
-    _fl_addr = new_addr;
-    board_flash_read(new_addr, _fl_buf, FLASH_CACHE_SIZE);
+static read_ahead_t _ra[2];
+static TaskHandle_t _ra_task = NULL;
+static SemaphoreHandle_t _ra_done = NULL;
+static StaticSemaphore_t _ra_done_def;
+
+static void read_ahead_wait(read_ahead_t* ra) {
+  while (ra->state == RA_PENDING) {
+    xSemaphoreTake(_ra_done, portMAX_DELAY);
   }
+}
 
-  memcpy(_fl_buf + (addr & (FLASH_CACHE_SIZE - 1)), data, len);
+static inline uint32_t part_gen(esp_partition_t const* part) {
+#if CFG_UF2_FLASH_BIN && !CFG_UF2_READBACK_PROTECT
+  // holds both of them
+  if (part == &_part_chip) return _fl_gen + _me_gen;
+#endif
+  return (part == _part_target) ? _fl_gen : (part == _part_measurement_data) ? _me_gen : 0;
+}
 
-  return true;
+// buffer holds (or is reading) data of part that is not outdated by a flush or erase
+static bool read_ahead_valid(read_ahead_t const* ra, esp_partition_t const* part) {
+  return (ra->state != RA_EMPTY) && (ra->part == part) && (ra->gen == part_gen(part));
 }
 
-bool board_flash_protect_bootloader(bool protect) {
-  // TODO implement later
-  (void) protect;
+// return true if requested data is copied from read-ahead buffer
+static bool read_ahead_copy(esp_partition_t const* part, uint32_t addr, void* buffer, uint32_t len) {
+  for (uint32_t i = 0; i < 2; i++) {
+    read_ahead_t* ra = &_ra[i];
+    if (read_ahead_valid(ra, part) && ra->addr <= addr && addr + len <= ra->addr + ra->len) {
+      read_ahead_wait(ra);
+
+      // ota0 may have been flushed (or measurement data erased) while it was being read
+      if (!read_ahead_valid(ra, part)) {
+        ra->state = RA_EMPTY;
+        return false;
+      }
+
+      memcpy(buffer, ra->buf + (addr - ra->addr), len);
+      return true;
+    }
+  }
   return false;
 }
 
+static read_ahead_t* read_ahead_find(esp_partition_t const* part, uint32_t addr) {
+  for (uint32_t i = 0; i < 2; i++) {
+    read_ahead_t* ra = &_ra[i];
+    if (read_ahead_valid(ra, part) && ra->addr == addr) return ra;
+  }
+  return NULL;
+}
+
+// Make sure both the chunk containing addr and the one after it are buffered or being read
+static void read_ahead_schedule(esp_partition_t const* part, uint32_t addr) {
+  if (_ra_task == NULL) return;
+
+  uint32_t const chunk = addr & ~(FLASH_READ_AHEAD_SIZE - 1);
+  uint32_t const wanted[2] = { chunk, chunk + FLASH_READ_AHEAD_SIZE };
+  bool scheduled = false;
+
+  for (uint32_t w = 0; w < 2; w++) {
+    if (wanted[w] >= part->size || read_ahead_find(part, wanted[w])) continue;
+
+    // pick a buffer that does not hold any of the wanted chunks
+    read_ahead_t* ra = NULL;
+    for (uint32_t i = 0; i < 2; i++) {
+      read_ahead_t* cand = &_ra[i];
+      bool const is_wanted = read_ahead_valid(cand, part) &&
+                             (cand->addr == wanted[0] || cand->addr == wanted[1]);
+      if (!is_wanted) {
+        ra = cand;
+        break;
+      }
+    }
+    if (ra == NULL) break;
+
+    read_ahead_wait(ra);
+    ra->part = part;
+    ra->addr = wanted[w];
+    ra->gen = part_gen(part);
+    ra->len = part->size - wanted[w];
+    if (ra->len > FLASH_READ_AHEAD_SIZE) ra->len = FLASH_READ_AHEAD_SIZE;
+    ra->state = RA_PENDING;
+    scheduled = true;
+  }
+
+  if (scheduled) xTaskNotifyGive(_ra_task);
+}
+
+// Read-ahead task: fill pending buffers, lower address first
+void board_flash_read_ahead_task(void* param) {
+  (void) param;
+
+  _ra_done = xSemaphoreCreateBinaryStatic(&_ra_done_def);
+  _ra_task = xTaskGetCurrentTaskHandle();
+
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    while (1) {
+      read_ahead_t* ra = NULL;
+      for (uint32_t i = 0; i < 2; i++) {
+        if (_ra[i].state == RA_PENDING && (ra == NULL || _ra[i].addr < ra->addr)) ra = &_ra[i];
+      }
+      if (ra == NULL) break;
+
+      part_read(ra->part, ra->addr, ra->buf, ra->len);
+      ra->state = RA_READY;
+      xSemaphoreGive(_ra_done);
+    }
+  }
+}
+
+void board_flash_read_ahead(uint32_t addr, uint32_t len) {
+  (void) len;
+#if FLASH_AB_SLOTS
+  if (!ab_written(addr)) {
+    read_ahead_schedule(_part_active, addr);
+    return;
+  }
+#endif
+  read_ahead_schedule(_part_target, addr);
+}
+
+void board_measuremnt_data_read_ahead(uint32_t addr, uint32_t len) {
+  (void) len;
+  read_ahead_schedule(_part_measurement_data, addr);
+}
 
 //--------------------------------------------------------------------+
-// Self Update
+//
 //--------------------------------------------------------------------+
 
-#ifdef TINYUF2_SELF_UPDATE
-void board_self_update(const uint8_t * bootloader_bin, uint32_t bootloader_len) {
-  enum { SECTOR_SZ = 4096UL };
-  esp_partition_t const * _part_uf2;
+#if FLASH_CALIBRATE
+// Bootloader image: never written by a DFU session before calibration, and not a uniform pattern
+#define FLASH_CALIBRATE_ADDR      0x1000
+#define FLASH_CALIBRATE_LEN       4096
+#define FLASH_CALIBRATE_READS     8
+
+// fastest first, clock divider of the 80MHz SPI1 source
+static struct {
+  uint8_t clkdiv;
+  esp_flash_io_mode_t mode;
+} const _cal_candidates[] = {
+  { 1, SPI_FLASH_QIO }, { 1, SPI_FLASH_DIO }, { 2, SPI_FLASH_QIO }, { 2, SPI_FLASH_DIO },
+};
+
+// Read the pattern at each candidate setting and keep the first one that reads it back exactly,
+// several times. Only lives in the esp_flash driver state of this session: reset restores sdkconfig.
+// Buffers are the write cache window, not in use yet
+static void flash_calibrate(void) {
+  esp_flash_t* chip = esp_flash_default_chip;
+  spi_flash_hal_context_t* hal = (spi_flash_hal_context_t*) chip->host;
+  uint8_t* ref = _fl_buf;
+  uint8_t* buf = _fl_buf + FLASH_CALIBRATE_LEN;
+
+  spi_flash_ll_clock_reg_t const safe_clock = hal->clock_conf;
+  esp_flash_io_mode_t const safe_mode = chip->read_mode;
+
+  if (ESP_OK != esp_flash_read(chip, ref, FLASH_CALIBRATE_ADDR, FLASH_CALIBRATE_LEN)) return;
+
+  // erased or stuck lines would match at any setting
+  uint32_t i = 1;
+  while (i < FLASH_CALIBRATE_LEN && ref[i] == ref[0]) i++;
+  if (i == FLASH_CALIBRATE_LEN) return;
+
+  // quad modes need the QE bit, it is not set here: writing the status register on every DFU entry wears it
+  bool qe = false;
+  esp_flash_get_io_mode(chip, &qe);
+
+  for (uint32_t c = 0; c < sizeof(_cal_candidates) / sizeof(_cal_candidates[0]); c++) {
+    if (_cal_candidates[c].mode == SPI_FLASH_QIO && !qe) continue;
+
+    hal->clock_conf.spimem = spi_flash_ll_calculate_clock_reg(SPI1_HOST, _cal_candidates[c].clkdiv);
+    chip->read_mode = _cal_candidates[c].mode;
+
+    uint32_t n = 0;
+    for (; n < FLASH_CALIBRATE_READS; n++) {
+      memset(buf, ~ref[0], FLASH_CALIBRATE_LEN);
+      if (ESP_OK != esp_flash_read(chip, buf, FLASH_CALIBRATE_ADDR, FLASH_CALIBRATE_LEN) ||
+          0 != memcmp(ref, buf, FLASH_CALIBRATE_LEN)) {
+        break;
+      }
+    }
+
+    if (n == FLASH_CALIBRATE_READS) {
+      TUF2_LOG1("Flash: %uMHz %s", (unsigned) (80 / _cal_candidates[c].clkdiv), _cal_candidates[c].mode == SPI_FLASH_QIO ? "QIO" : "DIO");
+      return;
+    }
+  }
+
+  hal->clock_conf = safe_clock;
+  chip->read_mode = safe_mode;
+  TUF2_LOG1("Flash: calibration failed, sdkconfig settings kept");
+}
+#endif
+
+void board_flash_init(void) {
+#if FLASH_CALIBRATE
+  flash_calibrate();
+#endif
+
+  _fl_cur = NULL;
+  uint32_t windows = 0;
+  for (uint32_t i = 0; i < FLASH_CACHE_WINDOWS; i++) {
+    _fl_cache[i].addr = FLASH_CACHE_INVALID_ADDR;
+    _fl_cache[i].state = FL_FREE;
+    _fl_cache[i].buf = i ? NULL : _fl_buf;
+    // run with fewer windows (down to a single one) if heap is short or fragmented, the reserve is kept
+    if (i && heap_caps_get_free_size(MALLOC_CAP_8BIT) >= FLASH_CACHE_SIZE + FLASH_HEAP_RESERVE) {
+      _fl_cache[i].buf = malloc(FLASH_CACHE_SIZE);
+    }
+    if (_fl_cache[i].buf) windows++;
+  }
+  TUF2_LOG1("Write windows: %lu of %uKB", windows, (unsigned) (FLASH_CACHE_SIZE / 1024));
+
+  app_slots(&_part_active, &_part_target);
+  assert(_part_target != NULL);
+  if (_part_active != _part_target) {
+    TUF2_LOG1("A/B staging: %s boots, writing %s", _part_active->label, _part_target->label);
+  }
+
+  _part_measurement_count = measurement_partitions_find(_part_measurement);
+  assert(_part_measurement_count > 0);
+  _part_measurement_data = _part_measurement[0];
+  TUF2_LOG1("Measurement data: %s, %lu partitions", _part_measurement_data->label, _part_measurement_count);
+
+#if CFG_UF2_FLASH_BIN && !CFG_UF2_READBACK_PROTECT
+  // raw reads of the main chip by esp_partition_read(), as encrypted with flash encryption. Size is the
+  // configured one of the image header, the volume is sized to it
+  uint32_t chip_size = 0;
+  esp_flash_get_size(NULL, &chip_size);
+  _part_chip = (esp_partition_t) {
+    .flash_chip = esp_flash_default_chip,
+    .type       = ESP_PARTITION_TYPE_DATA,
+    .subtype    = ESP_PARTITION_SUBTYPE_ANY,
+    .address    = 0,
+    .size       = chip_size,
+    .erase_size = FLASH_SECTOR_SIZE,
+    .label      = "chip",
+    .encrypted  = false,
+  };
+#endif
+
+#if FLASH_PSRAM_STAGE
+  if (_part_target->size <= FLASH_PSRAM_WINDOWS_MAX * FLASH_CACHE_SIZE) {
+    _ps_buf = heap_caps_malloc(_part_target->size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  }
+  TUF2_LOG1("Store-then-flash: %s", _ps_buf ? "PSRAM" : "off, no PSRAM for the slot");
+#endif
+
+#if FLASH_READ_MMAP
+  part_map(_part_target);
+  part_map(_part_active);
+  for (uint32_t i = 0; i < _part_measurement_count; i++) part_map(_part_measurement[i]);
+#endif
+}
+
+uint32_t board_flash_size(void) {
+  return _part_target->size;
+}
+
+// Parse app image header and segment table to get the image length (including checksum and
+// appended sha256). Return 0 if there is no valid image
+static uint32_t app_image_size(esp_partition_t const* part) {
+  esp_image_header_t hdr;
+  esp_partition_read(part, 0, &hdr, sizeof(hdr));
+
+  if (hdr.magic != ESP_IMAGE_HEADER_MAGIC || hdr.segment_count > ESP_IMAGE_MAX_SEGMENTS) return 0;
+
+  uint32_t offset = sizeof(esp_image_header_t);
+  for (uint8_t i = 0; i < hdr.segment_count; i++) {
+    esp_image_segment_header_t seg;
+    esp_partition_read(part, offset, &seg, sizeof(seg));
+
+    offset += sizeof(seg) + seg.data_len;
+    if (offset > part->size) return 0;
+  }
+
+  // checksum byte is placed at the end of 16-byte padding
+  offset = (offset + 16) & ~15UL;
+  if (hdr.hash_appended) offset += 32;
+
+  return (offset <= part->size) ? offset : 0;
+}
+
+uint32_t board_flash_app_size(void) {
+  // application handed over its length: one read of the appended sha256 instead of the segment table
+  uf2_handoff_t const* handoff = board_handoff ? board_handoff() : NULL;
+  if (handoff && (handoff->flags & UF2_HANDOFF_APP) && handoff->app_len >= 32 && handoff->app_len <= _part_active->size) {
+    uint8_t sha[32];
+    esp_partition_read(_part_active, handoff->app_len - 32, sha, sizeof(sha));
+    if (0 == memcmp(sha, handoff->app_sha256, sizeof(sha))) return handoff->app_len;
+  }
+
+  return app_image_size(_part_active);
+}
+
+#if BOARD_APP_CHECK || FLASH_RESUME_JOURNAL || CFG_UF2_WEAR
+// NVS is initialized on first use rather than at startup, so that its page scan does not delay
+// USB enumeration. Already initialized partition returns right away
+static bool nvs_ready(void) {
+  return ESP_OK == nvs_flash_init();
+}
+#endif
+
+#if BOARD_APP_CHECK
+static bool app_identity(esp_partition_t const* part, app_valid_t* id) {
+  memset(id, 0, sizeof(app_valid_t));
+  id->len = app_image_size(part);
+  if (id->len < sizeof(id->tail)) return false;
+
+  esp_partition_read(part, id->len - sizeof(id->tail), id->tail, sizeof(id->tail));
+  return true;
+}
+
+#if CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC
+// Trusted image for the 2nd stage bootloader, which then loads it without validation (bootimage.h).
+// Only images with appended sha256, the tail of the identity is that digest
+static void app_trusted_save(bool valid, app_valid_t const* id) {
+  if (BOOTIMAGE_OFFSET + sizeof(bootimage_t) > CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE) return;
+  bootimage_t* bi = (bootimage_t*) (bootloader_common_get_rtc_retain_mem()->custom + BOOTIMAGE_OFFSET);
+
+  esp_image_header_t hdr;
+  if (valid && (ESP_OK != esp_partition_read(_part_target, 0, &hdr, sizeof(hdr)) ||
+                hdr.magic != ESP_IMAGE_HEADER_MAGIC || !hdr.hash_appended)) {
+    valid = false;
+  }
+
+  memset(bi, 0, sizeof(bootimage_t));
+  if (valid) {
+    bi->offset = _part_target->address;
+    bi->len = id->len;
+    memcpy(bi->sha256, id->tail, sizeof(bi->sha256));
+    bootimage_seal(bi);
+  }
+  bootloader_common_update_rtc_retain_mem(NULL, false);
+}
+#endif
+
+static void app_valid_save(bool valid) {
+  app_valid_t id;
+  if (valid && !app_identity(_part_target, &id)) valid = false;
+
+#if CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC
+  app_trusted_save(valid, &id);
+#endif
+
+  nvs_handle_t nvs;
+  if (!nvs_ready() || ESP_OK != nvs_open("storage", NVS_READWRITE, &nvs)) return;
+
+  if (valid) {
+    nvs_set_blob(nvs, "uf2appvalid", &id, sizeof(id));
+  } else {
+    nvs_erase_key(nvs, "uf2appvalid");
+  }
+  nvs_commit(nvs);
+  nvs_close(nvs);
+}
+
+// Called before board_flash_init(). Image is valid if its identity matches the one recorded after
+// it was written & verified, otherwise it is checked in full (checksum and sha256)
+bool board_flash_app_check(void) {
+  esp_partition_t const* part;
+  esp_partition_t const* target;
+  app_slots(&part, &target);
+  if (part == NULL) return false;
+
+  app_valid_t id;
+  if (!app_identity(part, &id)) {
+    TUF2_LOG1("No app image in ota0");
+    return false;
+  }
+
+  app_valid_t saved;
+  size_t size = sizeof(saved);
+
+  nvs_handle_t nvs;
+  if (nvs_ready() && ESP_OK == nvs_open("storage", NVS_READONLY, &nvs)) {
+    bool const match = (ESP_OK == nvs_get_blob(nvs, "uf2appvalid", &saved, &size)) && size == sizeof(saved) &&
+                       (0 == memcmp(&saved, &id, sizeof(id)));
+    nvs_close(nvs);
+    if (match) return true;
+  }
+
+  esp_partition_pos_t const pos = { .offset = part->address, .size = part->size };
+  esp_image_metadata_t data;
+  if (ESP_OK != esp_image_verify(ESP_IMAGE_VERIFY_SILENT, &pos, &data)) {
+    TUF2_LOG1("App image in ota0 is corrupted");
+    return false;
+  }
+
+  _part_target = part;
+  app_valid_save(true);
+  return true;
+}
+
+// Identity of the image in part into id, return true if it is the one of the validity record
+static bool app_valid_recorded(esp_partition_t const* part, app_valid_t* id) {
+  if (!app_identity(part, id)) return false;
+
+  app_valid_t saved;
+  size_t size = sizeof(saved);
+
+  nvs_handle_t nvs;
+  if (!nvs_ready() || ESP_OK != nvs_open("storage", NVS_READONLY, &nvs)) return false;
+  bool const match = (ESP_OK == nvs_get_blob(nvs, "uf2appvalid", &saved, &size)) && size == sizeof(saved) &&
+                     (0 == memcmp(&saved, id, sizeof(app_valid_t)));
+  nvs_close(nvs);
+  return match;
+}
+
+#if BOARD_FLASH_SCRUB
+static bool scrub_app_sha256(uint8_t sha256[32]);
+#endif
+
+// SHA256 of ota0 for INFO.JSON from the validity record, no hash over the image: the tail recorded
+// after the image was verified is its appended sha256, as long as ota0 still has that identity.
+// The idle-time scrub answers without NVS once it has hashed the image
+bool board_flash_app_sha256(uint8_t sha256[32]) {
+  if (_part_active == NULL) return false;
+
+#if BOARD_FLASH_SCRUB
+  if (scrub_app_sha256(sha256)) return true;
+#endif
+
+  esp_image_header_t hdr;
+  esp_partition_read(_part_active, 0, &hdr, sizeof(hdr));
+  if (hdr.magic != ESP_IMAGE_HEADER_MAGIC || !hdr.hash_appended) return false;
+
+  app_valid_t id;
+  if (!app_valid_recorded(_part_active, &id)) return false;
+
+  memcpy(sha256, id.tail, sizeof(id.tail));
+  return true;
+}
+#endif
+
+// return true if requested data is copied from a write window that may not be in flash yet
+static bool cache_copy(uint32_t addr, void* buffer, uint32_t len) {
+  flash_cache_t const* found = NULL;
+
+  for (uint32_t i = 0; i < FLASH_CACHE_WINDOWS; i++) {
+    flash_cache_t const* fc = &_fl_cache[i];
+    if (fc->state == FL_FREE || addr < fc->addr || addr + len > fc->addr + FLASH_CACHE_SIZE) continue;
+
+    // window being filled is newer than the ones being flushed with the same address, of those the last submitted
+    if (found == NULL || fc->state == FL_FILLING ||
+        (found->state == FL_FLUSHING && (int32_t) (fc->seq - found->seq) > 0)) {
+      found = fc;
+    }
+    if (found->state == FL_FILLING) break;
+  }
+  if (found == NULL) return false;
+
+  memcpy(buffer, found->buf + (addr - found->addr), len);
+  return true;
+}
+
+// Read what the target slot holds or is about to hold
+static void target_read(uint32_t addr, void* buffer, uint32_t len) {
+#if FLASH_PSRAM_STAGE
+  if (_ps_count) {
+    uint8_t* dst = (uint8_t*) buffer;
 
-  _part_uf2 = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_FACTORY, NULL);
-  assert(_part_uf2 != NULL);
+    // window by window, a read may straddle a staged and an unstaged one
+    while (len) {
+      uint32_t count = FLASH_CACHE_SIZE - (addr & (FLASH_CACHE_SIZE - 1));
+      if (count > len) count = len;
 
-  // make len aligned to 4K
-  uint32_t erase_sz = (bootloader_len & ~(SECTOR_SZ-1));
-  if (bootloader_len & (SECTOR_SZ-1)) erase_sz += SECTOR_SZ;
+      if (ps_staged(addr)) {
+        memcpy(dst, _ps_buf + addr, count);
+      } else if (!cache_copy(addr, dst, count) && !read_ahead_copy(_part_target, addr, dst, count)) {
+        part_read(_part_target, addr, dst, count);
+      }
 
-  // Erase old bootloader
-  esp_partition_erase_range(_part_uf2, 0, erase_sz);
+      addr += count;
+      dst += count;
+      len -= count;
+    }
+    return;
+  }
+#endif
+
+  if (cache_copy(addr, buffer, len)) return;
+  if (read_ahead_copy(_part_target, addr, buffer, len)) return;
+  part_read(_part_target, addr, buffer, len);
+}
+
+void board_flash_read(uint32_t addr, void* buffer, uint32_t len) {
+#if FLASH_AB_SLOTS
+  if (_part_active != _part_target) {
+    uint8_t* dst = (uint8_t*) buffer;
+
+    // window by window, a read may straddle a written and an untouched one
+    while (len) {
+      uint32_t count = FLASH_CACHE_SIZE - (addr & (FLASH_CACHE_SIZE - 1));
+      if (count > len) count = len;
+
+      if (ab_written(addr)) {
+        target_read(addr, dst, count);
+      } else if (!read_ahead_copy(_part_active, addr, dst, count)) {
+        part_read(_part_active, addr, dst, count);
+      }
+
+      addr += count;
+      dst += count;
+      len -= count;
+    }
+    return;
+  }
+#endif
+
+  target_read(addr, buffer, len);
+}
+
+uint32_t board_measuremnt_data_size(void) {
+  return _part_measurement_data->size;
+}
+
+void board_measuremnt_data_read(uint32_t addr, void* buffer, uint32_t len) {
+  if (read_ahead_copy(_part_measurement_data, addr, buffer, len)) return;
+  part_read(_part_measurement_data, addr, buffer, len);
+}
+
+uint32_t board_measurement_partition_count(void) {
+  return _part_measurement_count;
+}
+
+uint32_t board_measurement_partition_size(uint32_t part) {
+  return (part < _part_measurement_count) ? _part_measurement[part]->size : 0;
+}
+
+void board_measurement_partition_read(uint32_t part, uint32_t addr, void* buffer, uint32_t len) {
+  if (part == 0) {
+    board_measuremnt_data_read(addr, buffer, len);
+  } else if (part < _part_measurement_count) {
+    part_read(_part_measurement[part], addr, buffer, len);
+  }
+}
+
+#if CFG_UF2_FLASH_BIN && !CFG_UF2_READBACK_PROTECT
+uint32_t board_flash_chip_size(void) {
+  return _part_chip.size;
+}
+
+void board_flash_chip_read(uint32_t addr, void* buffer, uint32_t len) {
+  if (read_ahead_copy(&_part_chip, addr, buffer, len)) return;
+  part_read(&_part_chip, addr, buffer, len);
+}
+
+void board_flash_chip_read_ahead(uint32_t addr, uint32_t len) {
+  (void) len;
+  read_ahead_schedule(&_part_chip, addr);
+}
+#endif
+
+//--------------------------------------------------------------------+
+// Write
+// Windows are filled by the usbd task, then erased and programmed by the
+// flash task (or synchronously if flash task is not running).
+//--------------------------------------------------------------------+
+
+#if FLASH_RESUME_JOURNAL
+static void journal_save(flash_journal_t const* jr) {
+  nvs_handle_t nvs;
+  if (!nvs_ready() || ESP_OK != nvs_open("storage", NVS_READWRITE, &nvs)) return;
+
+  if (jr) {
+    nvs_set_blob(nvs, "uf2journal", jr, sizeof(flash_journal_t));
+  } else {
+    nvs_erase_key(nvs, "uf2journal");
+  }
+  nvs_commit(nvs);
+  nvs_close(nvs);
+}
+
+// called by flash task after a window is programmed
+static void journal_advance(uint32_t addr) {
+  if (_jr.flushed != addr) return;
+
+  _jr.flushed += FLASH_CACHE_SIZE;
+  journal_save(&_jr);
+}
+#endif
+
+//--------------------------------------------------------------------+
+// Wear counters
+// Erases of ota0 are counted per sector in RAM. Lifetime totals are read from NVS only when
+// WEAR.CSV is rendered or at DFU complete, and written back once at DFU complete
+//--------------------------------------------------------------------+
+
+#if CFG_UF2_WEAR
+static uint16_t* _wear = NULL;   // erases of this boot, lifetime totals once loaded
+static uint32_t _wear_units = 0;
+static bool _wear_loaded = false;
+static bool _wear_dirty = false;
+
+static void wear_count(esp_partition_t const* part, uint32_t addr, uint32_t len) {
+  if (part->subtype != ESP_PARTITION_SUBTYPE_APP_OTA_0) return;
+
+  // first erase may come from board_flash_erase_app(), before board_flash_init()
+  if (_wear == NULL) {
+    _wear = calloc(part->size / FLASH_SECTOR_SIZE, sizeof(uint16_t));
+    if (_wear == NULL) return;
+    _wear_units = part->size / FLASH_SECTOR_SIZE;
+  }
+
+  uint32_t const end = (addr + len + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE;
+  for (uint32_t i = addr / FLASH_SECTOR_SIZE; i < end && i < _wear_units; i++) {
+    if (_wear[i] != UINT16_MAX) _wear[i]++;
+  }
+  _wear_dirty = true;
+}
+
+// add lifetime totals from NVS to the counts of this boot
+static bool wear_load(void) {
+  if (_wear_loaded) return true;
+
+  if (_wear == NULL) {
+    uint32_t const size = _part_target ? _part_target->size : 0;
+    _wear = calloc(size / FLASH_SECTOR_SIZE, sizeof(uint16_t));
+    if (_wear == NULL) return false;
+    _wear_units = size / FLASH_SECTOR_SIZE;
+  }
+
+  uint16_t* saved = calloc(_wear_units, sizeof(uint16_t));
+  if (saved == NULL) return false;
+
+  nvs_handle_t nvs;
+  if (nvs_ready() && ESP_OK == nvs_open("storage", NVS_READONLY, &nvs)) {
+    // partition may have been resized, only the common part is kept
+    size_t len = _wear_units * sizeof(uint16_t);
+    if (ESP_ERR_NVS_INVALID_LENGTH == nvs_get_blob(nvs, "uf2wear", saved, &len)) {
+      memset(saved, 0, _wear_units * sizeof(uint16_t));
+    }
+    nvs_close(nvs);
+  }
+
+  // flash task may count an erase meanwhile
+  vTaskSuspendAll();
+  for (uint32_t i = 0; i < _wear_units; i++) {
+    uint32_t const sum = (uint32_t) _wear[i] + saved[i];
+    _wear[i] = (sum > UINT16_MAX) ? UINT16_MAX : (uint16_t) sum;
+  }
+  _wear_loaded = true;
+  xTaskResumeAll();
+
+  free(saved);
+  return true;
+}
+
+void board_flash_wear_save(void) {
+  if (!_wear_dirty || !wear_load()) return;
+
+  nvs_handle_t nvs;
+  if (!nvs_ready() || ESP_OK != nvs_open("storage", NVS_READWRITE, &nvs)) return;
+  nvs_set_blob(nvs, "uf2wear", _wear, _wear_units * sizeof(uint16_t));
+  nvs_commit(nvs);
+  nvs_close(nvs);
+
+  _wear_dirty = false;
+}
+
+uint32_t board_flash_wear_units(uint32_t* unit_size) {
+  *unit_size = FLASH_SECTOR_SIZE;
+  return _part_target ? _part_target->size / FLASH_SECTOR_SIZE : 0;
+}
+
+uint32_t board_flash_wear_read(uint32_t unit) {
+  if (!wear_load() || unit >= _wear_units) return 0;
+  return _wear[unit];
+}
+#else
+  #define wear_count(_part, _addr, _len)
+#endif
+
+static bool _sp_low = false;
+
+// Sample the supply with hysteresis, true while erase & program are throttled
+static bool supply_low(void) {
+  if (!board_supply_mv) return false;
+
+  uint32_t const mv = board_supply_mv();
+  if (mv == 0) return _sp_low;
+
+  if (!_sp_low && mv < FLASH_SUPPLY_LOW_MV) {
+    _sp_low = true;
+    TUF2_STATS_INC(supply_throttles);
+    TUF2_LOG1("Supply %lu mV, flash throttled", mv);
+  } else if (_sp_low && mv >= FLASH_SUPPLY_OK_MV) {
+    _sp_low = false;
+    TUF2_LOG1("Supply %lu mV, flash at full speed", mv);
+  }
+  return _sp_low;
+}
+
+static int64_t _fy_last = 0;  // last yield of a task erasing or programming
+
+#if FLASH_READ_ACTIVE_MS || BOARD_FLASH_SCRUB
+static volatile int64_t _rd_hint_us = INT64_MIN / 2;  // last READ10 of the host
+
+void board_flash_read_hint(void) {
+  _rd_hint_us = esp_timer_get_time();
+}
+#endif
+
+// Host is reading, erase & program go one sector at a time
+static inline bool read_active(void) {
+#if FLASH_READ_ACTIVE_MS
+  return esp_timer_get_time() - _rd_hint_us < (int64_t) FLASH_READ_ACTIVE_MS * 1000;
+#else
+  return false;
+#endif
+}
+
+// Called between erase & program slices, lets the idle tasks run once per FLASH_YIELD_MS
+static void flash_yield(void) {
+  int64_t const now = esp_timer_get_time();
+  if (now - _fy_last < (int64_t) FLASH_YIELD_MS * 1000) return;
+
+  if (ESP_OK == esp_task_wdt_status(NULL)) esp_task_wdt_reset();
+  vTaskDelay(1);
+  _fy_last = esp_timer_get_time();
+}
+
+// Erase in slices of up to max_slice, a higher priority usbd task preempts in between
+static void flash_erase(esp_partition_t const* part, uint32_t addr, uint32_t len, uint32_t max_slice) {
+  uint32_t offset = 0;
+  while (offset < len) {
+    bool const low = supply_low();
+    uint32_t const slice = (low || read_active()) ? FLASH_SECTOR_SIZE : max_slice;
+    uint32_t const n = (len - offset < slice) ? (len - offset) : slice;
+    esp_partition_erase_range(part, addr + offset, n);
+    offset += n;
+    if (low) vTaskDelay(pdMS_TO_TICKS(FLASH_SUPPLY_PAUSE_MS));
+    flash_yield();
+  }
+}
+
+static void flash_program(esp_partition_t const* part, uint32_t addr, void const* src, uint32_t len) {
+  uint32_t offset = 0;
+  while (offset < len) {
+    bool const low = supply_low();
+    bool const sliced = low || read_active();
+    uint32_t const n = (!sliced || len - offset < FLASH_SECTOR_SIZE) ? (len - offset) : FLASH_SECTOR_SIZE;
+    esp_partition_write(part, addr + offset, (uint8_t const*) src + offset, n);
+    offset += n;
+    if (low) vTaskDelay(pdMS_TO_TICKS(FLASH_SUPPLY_PAUSE_MS));
+    flash_yield();
+  }
+}
+
+// buf is word aligned, len a multiple of 4
+static bool is_erased(uint8_t const* buf, uint32_t len) {
+  uint32_t const* word = (uint32_t const*) buf;
+  for (uint32_t i = 0; i < len / 4; i++) {
+    if (word[i] != 0xffffffff) return false;
+  }
+  return true;
+}
+
+#if CFG_UF2_LKG_SNAPSHOT
+//--------------------------------------------------------------------+
+// Last-known-good snapshot
+// Before an update first erases a window of the app in ota0, the flash task compresses what it holds into the
+// FLASH_LKG_LABEL partition. Windows the update does not erase still hold the old app, writing the captured ones
+// back restores it. Sector 0 holds the header and an entry per window, programmed once its stream is written,
+// streams follow from sector 1 on. A snapshot is kept until an update after a verified one starts a new one
+//--------------------------------------------------------------------+
+
+#define LKG_MAGIC                 0x31474B4C // "LKG1"
+#define LKG_WINDOWS_MAX           256
+
+typedef struct {
+  uint32_t magic;
+  uint32_t image_len;  // of the app in ota0 when the snapshot started, windows past it are not captured
+  uint32_t complete;   // 0xffffffff until the update that started it is verified
+  uint32_t reserved;
+} lkg_header_t;
+
+typedef struct {
+  uint32_t window;     // address in ota0, 0xffffffff for a free entry
+  uint32_t offset;     // of the compressed stream in the partition
+  uint32_t len;        // compressed length
+  uint32_t crc;        // crc32 of the window as captured
+} lkg_entry_t;
+
+#define LKG_ENTRIES_MAX           ((FLASH_SECTOR_SIZE - sizeof(lkg_header_t)) / sizeof(lkg_entry_t))
+
+enum {
+  LK_UNKNOWN = 0, // not looked at since the last update ended
+  LK_OFF,         // nothing is captured in this update
+  LK_CAPTURING,
+};
+
+static esp_partition_t const* _lk_part = NULL;
+static uint8_t _lk_state = LK_UNKNOWN;
+static lkg_header_t _lk_hdr;
+static uint32_t _lk_count = 0;                       // entries in use
+static uint32_t _lk_next = 0;                        // start of the next stream, page aligned
+static uint32_t _lk_erased = 0;                      // partition is erased from _lk_next up to here
+static uint32_t _lk_captured[LKG_WINDOWS_MAX / 32];  // windows with an entry
+
+// stream being written: read buffer of the window, pages of output
+static uint8_t _lk_in[1024] __attribute__((aligned(4)));
+static uint8_t _lk_page[FLASH_PAGE_SIZE] __attribute__((aligned(4)));
+static uint32_t _lk_fill = 0;
+static uint32_t _lk_out = 0;
+static bool _lk_full = false;
+
+static esp_partition_t const* lkg_partition(void) {
+  // board_flash_erase_app() comes before board_flash_init()
+  if (_lk_part == NULL) _lk_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, FLASH_LKG_LABEL);
+  return _lk_part;
+}
+
+static void lkg_entry_read(uint32_t i, lkg_entry_t* entry) {
+  esp_partition_read(_lk_part, sizeof(lkg_header_t) + i * sizeof(lkg_entry_t), entry, sizeof(lkg_entry_t));
+}
+
+// Load header and entries, false if there is no snapshot
+static bool lkg_load(void) {
+  if (lkg_partition() == NULL) return false;
+
+  esp_partition_read(_lk_part, 0, &_lk_hdr, sizeof(_lk_hdr));
+  if (_lk_hdr.magic != LKG_MAGIC) return false;
+
+  memset(_lk_captured, 0, sizeof(_lk_captured));
+  uint32_t end = FLASH_SECTOR_SIZE;
+  for (_lk_count = 0; _lk_count < LKG_ENTRIES_MAX; _lk_count++) {
+    lkg_entry_t entry;
+    lkg_entry_read(_lk_count, &entry);
+    if (entry.window == FLASH_CACHE_INVALID_ADDR) break;
+
+    uint32_t const w = entry.window / FLASH_CACHE_SIZE;
+    if (w < LKG_WINDOWS_MAX) _lk_captured[w / 32] |= 1UL << (w % 32);
+    end = entry.offset + entry.len;
+  }
+
+  // a stream cut off before its entry may have left programmed pages in the sector it ended in
+  _lk_next = _lk_erased = (end + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+  return true;
+}
+
+// Snapshot is of no use anymore (partition full, app erased)
+static void lkg_drop(void) {
+  if (lkg_partition() == NULL) return;
+
+  uint32_t magic;
+  esp_partition_read(_lk_part, 0, &magic, sizeof(magic));
+  if (magic == LKG_MAGIC) flash_erase(_lk_part, 0, FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+}
+
+// First capture of an update: go on with the snapshot of an update that was not verified, its windows not
+// captured yet still hold the app it was taken of. Otherwise start one of the app in ota0
+static bool lkg_begin(void) {
+  if (_lk_state != LK_UNKNOWN) return _lk_state == LK_CAPTURING;
+  _lk_state = LK_OFF;
+
+  // A/B staging never erases the slot that boots
+  if (_part_target != _part_active || lkg_partition() == NULL) return false;
+
+  if (lkg_load() && _lk_hdr.complete == 0xffffffff) {
+    TUF2_LOG1("Snapshot: continued, %lu windows", _lk_count);
+  } else {
+    uint32_t const len = app_image_size(_part_active);
+    if (len == 0) return false;
+
+    lkg_header_t const hdr = { .magic = LKG_MAGIC, .image_len = len, .complete = 0xffffffff, .reserved = 0xffffffff };
+    flash_erase(_lk_part, 0, FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+    esp_partition_write(_lk_part, 0, &hdr, sizeof(hdr));
+    _lk_hdr = hdr;
+    _lk_count = 0;
+    _lk_next = _lk_erased = FLASH_SECTOR_SIZE;
+    memset(_lk_captured, 0, sizeof(_lk_captured));
+    TUF2_LOG1("Snapshot: started, app of %lu bytes", len);
+  }
+
+  _lk_state = LK_CAPTURING;
+  return true;
+}
+
+// Program the output page, erasing ahead of it in blocks where aligned
+static void lkg_page_write(void) {
+  uint32_t const end = _lk_out + FLASH_PAGE_SIZE;
+  if (end > _lk_part->size) {
+    _lk_full = true;
+    return;
+  }
+
+  while (_lk_erased < end) {
+    bool const block = !(_lk_erased % FLASH_BLOCK_SIZE) && _lk_erased + FLASH_BLOCK_SIZE <= _lk_part->size;
+    uint32_t const n = block ? FLASH_BLOCK_SIZE : FLASH_SECTOR_SIZE;
+    flash_erase(_lk_part, _lk_erased, n, FLASH_ERASE_SLICE);
+    _lk_erased += n;
+  }
+
+  flash_program(_lk_part, _lk_out, _lk_page, _lk_fill);
+  _lk_out += _lk_fill;
+  _lk_fill = 0;
+}
+
+static void lkg_output(uint8_t const* data, uint32_t len, void* arg) {
+  (void) arg;
+
+  while (len && !_lk_full) {
+    uint32_t const n = (len < FLASH_PAGE_SIZE - _lk_fill) ? len : (FLASH_PAGE_SIZE - _lk_fill);
+    memcpy(_lk_page + _lk_fill, data, n);
+    _lk_fill += n;
+    data += n;
+    len -= n;
+
+    if (_lk_fill == FLASH_PAGE_SIZE) lkg_page_write();
+  }
+}
+
+// Called by flash task before a window of ota0 is erased, flash still holds what it had before the update
+static void lkg_capture(uint32_t window) {
+  if (!lkg_begin()) return;
+
+  uint32_t const w = window / FLASH_CACHE_SIZE;
+  if (window >= _lk_hdr.image_len || w >= LKG_WINDOWS_MAX || (_lk_captured[w / 32] & (1UL << (w % 32)))) return;
+
+  int64_t const start = esp_timer_get_time();
+  _lk_out = _lk_next;
+  _lk_fill = 0;
+  _lk_full = (_lk_count == LKG_ENTRIES_MAX);
+
+  uint32_t crc = 0;
+  compress_init();
+  for (uint32_t offset = 0; offset < FLASH_CACHE_SIZE && !_lk_full; offset += sizeof(_lk_in)) {
+    part_read(_part_target, window + offset, _lk_in, sizeof(_lk_in));
+    crc = esp_rom_crc32_le(crc, _lk_in, sizeof(_lk_in));
+    compress_feed(_lk_in, sizeof(_lk_in), lkg_output, NULL);
+  }
+  compress_flush(lkg_output, NULL);
+  if (_lk_fill && !_lk_full) lkg_page_write();
+
+  // the update goes on without a way back rather than being refused
+  if (_lk_full) {
+    TUF2_LOG1("Snapshot: %s is full, dropped", _lk_part->label);
+    lkg_drop();
+    _lk_state = LK_OFF;
+    return;
+  }
+
+  lkg_entry_t const entry = { .window = window, .offset = _lk_next, .len = _lk_out - _lk_next, .crc = crc };
+  esp_partition_write(_lk_part, sizeof(lkg_header_t) + _lk_count * sizeof(lkg_entry_t), &entry, sizeof(entry));
+  _lk_count++;
+  _lk_captured[w / 32] |= 1UL << (w % 32);
+  _lk_next = (_lk_out + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1);
+
+  TUF2_LOG1("Snapshot of 0x%08lX: %lu bytes in %lu ms", window, entry.len,
+            (uint32_t) ((esp_timer_get_time() - start) / 1000));
+}
+
+// Update is over: a verified one completes the snapshot, the next update then starts a new one
+static void lkg_end(bool verified) {
+  if (_lk_state == LK_CAPTURING && verified) {
+    uint32_t const complete = 0;
+    esp_partition_write(_lk_part, offsetof(lkg_header_t, complete), &complete, sizeof(complete));
+  }
+  _lk_state = LK_UNKNOWN;
+}
+
+typedef struct {
+  uint8_t* buf;
+  uint32_t len;
+  bool overflow;
+} lkg_decode_t;
+
+static void lkg_decode_output(uint8_t const* data, uint32_t len, void* arg) {
+  lkg_decode_t* dec = (lkg_decode_t*) arg;
+
+  uint32_t const n = (len < FLASH_CACHE_SIZE - dec->len) ? len : (FLASH_CACHE_SIZE - dec->len);
+  memcpy(dec->buf + dec->len, data, n);
+  dec->len += n;
+  if (n < len) dec->overflow = true;
+}
+
+// Decompress the window of an entry into buf, false unless it is whole and matches its crc
+static bool lkg_decode(lkg_entry_t const* entry, uint8_t* buf) {
+  lkg_decode_t dec = { .buf = buf, .len = 0, .overflow = false };
+  uint8_t in[FLASH_PAGE_SIZE];
+
+  decompress_init();
+  for (uint32_t offset = 0; offset < entry->len; offset += sizeof(in)) {
+    uint32_t const n = (entry->len - offset < sizeof(in)) ? (entry->len - offset) : sizeof(in);
+    esp_partition_read(_lk_part, entry->offset + offset, in, n);
+    decompress_feed(in, n, lkg_decode_output, &dec);
+  }
+
+  return !dec.overflow && dec.len == FLASH_CACHE_SIZE && esp_rom_crc32_le(0, buf, FLASH_CACHE_SIZE) == entry->crc;
+}
+
+// Decoder state is shared with compressed uploads, one in progress is broken by a rollback
+bool board_flash_rollback(void) {
+  // windows of an update in progress go to flash first, all of them are free afterwards
+  board_flash_flush();
+  _lk_state = LK_UNKNOWN;
+#if FLASH_ERASE_AHEAD
+  while (_ea_state == EA_ERASING) {
+    xSemaphoreTake(_fl_done, portMAX_DELAY);
+  }
+#endif
+
+  if (_part_target != _part_active || !lkg_load() || _lk_count == 0) {
+    TUF2_LOG1("Rollback: no snapshot");
+    return false;
+  }
+
+  uint8_t* buf = _fl_cache[0].buf;
+  int64_t const start = esp_timer_get_time();
+
+  // every stream is checked before ota0 is touched, a bad snapshot leaves the app as it is
+  for (uint32_t i = 0; i < _lk_count; i++) {
+    lkg_entry_t entry;
+    lkg_entry_read(i, &entry);
+    if (entry.window + FLASH_CACHE_SIZE > _part_active->size || !lkg_decode(&entry, buf)) {
+      TUF2_LOG1("Rollback: window at 0x%08lX does not check out", entry.window);
+      return false;
+    }
+  }
+
+#if BOARD_APP_CHECK
+  app_valid_save(false);
+#endif
+
+  uint32_t restored = 0;
+  for (uint32_t i = 0; i < _lk_count; i++) {
+    lkg_entry_t entry;
+    lkg_entry_read(i, &entry);
+    lkg_decode(&entry, buf);
+
+    // window already holding the snapshot (restored before, or written back with the same data) is left alone
+    bool same = true;
+    for (uint32_t offset = 0; offset < FLASH_CACHE_SIZE && same; offset += sizeof(_lk_in)) {
+      part_read(_part_active, entry.window + offset, _lk_in, sizeof(_lk_in));
+      same = (0 == memcmp(_lk_in, buf + offset, sizeof(_lk_in)));
+    }
+    if (same) continue;
+
+    _fl_gen++;
+    flash_erase(_part_active, entry.window, FLASH_CACHE_SIZE, FLASH_ERASE_SLICE);
+    wear_count(_part_active, entry.window, FLASH_CACHE_SIZE);
+    flash_program(_part_active, entry.window, buf, FLASH_CACHE_SIZE);
+    _fl_gen++;
+    restored++;
+  }
+
+  // whatever the interrupted or finished update recorded is void
+#if FLASH_ERASE_AHEAD
+  _ea_state = EA_NONE;
+#endif
+  _vf_crc = 0;
+  _vf_start = _vf_end = FLASH_CACHE_INVALID_ADDR;
+  _vf_valid = true;
+#if FLASH_RESUME_JOURNAL
+  _jr.flushed = FLASH_CACHE_INVALID_ADDR;
+  journal_save(NULL);
+#endif
+
+  esp_ota_set_boot_partition(_part_active);
+  TUF2_LOG1("Rollback: %lu of %lu windows restored in %lu ms", restored, _lk_count,
+            (uint32_t) ((esp_timer_get_time() - start) / 1000));
+  return true;
+}
+#endif
+
+// Erase (unless erased ahead) and program a run of sectors of a cache window
+static void cache_program(flash_cache_t const* fc, uint32_t offset, uint32_t len) {
+  TUF2_LOG1("Erase and Write at 0x%08lX (%lu bytes)", fc->addr + offset, len);
+
+#if CFG_UF2_LKG_SNAPSHOT
+  // window still holds the app of before the update, unless it was erased ahead (captured then)
+  if (!fc->erased) lkg_capture(fc->addr);
+#endif
+
+  uint32_t start_us = TUF2_STATS_US();
+  if (!fc->erased) {
+    TUF2_TRACE_BEGIN(TUF2_TRACE_FLASH_ERASE);
+    flash_erase(_part_target, fc->addr + offset, len, FLASH_ERASE_SLICE);
+    wear_count(_part_target, fc->addr + offset, len);
+    TUF2_TRACE_END(TUF2_TRACE_FLASH_ERASE);
+    TUF2_STATS_INC(erase_count);
+    TUF2_STATS_ADD(erase_us, TUF2_STATS_US() - start_us);
+    start_us = TUF2_STATS_US();
+  }
+
+  // pages left at 0xff are already what erased flash holds, only runs of the others are programmed
+  TUF2_TRACE_BEGIN(TUF2_TRACE_FLASH_PROGRAM);
+  uint32_t const end = offset + len;
+  while (offset < end) {
+    while (offset < end && is_erased(fc->buf + offset, FLASH_PAGE_SIZE)) offset += FLASH_PAGE_SIZE;
+
+    uint32_t run = offset;
+    while (run < end && !is_erased(fc->buf + run, FLASH_PAGE_SIZE)) run += FLASH_PAGE_SIZE;
+    if (run == offset) break;
+
+    flash_program(_part_target, fc->addr + offset, fc->buf + offset, run - offset);
+    TUF2_STATS_INC(program_count);
+    TUF2_STATS_ADD(program_bytes, run - offset);
+    offset = run;
+  }
+  TUF2_TRACE_END(TUF2_TRACE_FLASH_PROGRAM);
+  TUF2_STATS_ADD(program_us, TUF2_STATS_US() - start_us);
+}
+
+// Erase and program only the 4KB sectors of a window that differ from flash,
+// consecutive differing sectors are erased & written as one range
+static void cache_flush(flash_cache_t* fc) {
+  uint32_t const verify_sz = FLASH_SECTOR_SIZE;
+
+  uint32_t run_start = 0;
+  uint32_t run_len = 0;
+  bool changed = false;
+
+  TUF2_TRACE_BEGIN(TUF2_TRACE_FLASH_FLUSH);
+  for (uint32_t count = 0; count < FLASH_CACHE_SIZE; count += verify_sz) {
+    // compared while filling, nothing is read back
+    bool const matches = !(fc->dirty & (1UL << (count / verify_sz)));
+
+    if (!matches) {
+      if (run_len == 0) run_start = count;
+      run_len += verify_sz;
+    } else {
+      TUF2_STATS_ADD(skipped_bytes, verify_sz);
+    }
+
+    if (run_len && (matches || count + verify_sz == FLASH_CACHE_SIZE)) {
+      if (!changed) {
+        changed = true;
+        _fl_gen++;
+      }
+      cache_program(fc, run_start, run_len);
+      run_len = 0;
+    }
+  }
+  TUF2_TRACE_END(TUF2_TRACE_FLASH_FLUSH);
+
+  if (changed) _fl_gen++;
+
+  // accumulate what flash is supposed to contain now
+  if (_vf_start == FLASH_CACHE_INVALID_ADDR) {
+    _vf_start = _vf_end = fc->addr;
+  }
+
+  if (fc->addr == _vf_end) {
+    _vf_crc = esp_rom_crc32_le(_vf_crc, fc->buf, FLASH_CACHE_SIZE);
+    _vf_end += FLASH_CACHE_SIZE;
+#ifdef BOARD_UF2_SIGN_PUBKEY
+    sign_consume(fc);
+#endif
+  } else {
+    _vf_valid = false;
+#ifdef BOARD_UF2_SIGN_PUBKEY
+    _sg_stream = false;
+#endif
+  }
+
+#if FLASH_RESUME_JOURNAL
+  journal_advance(fc->addr);
+#endif
+
+  fc->addr = FLASH_CACHE_INVALID_ADDR;
+  fc->state = FL_FREE;
+}
+
+// Hand over a window being filled to flash task
+static void cache_submit_window(flash_cache_t* fc) {
+  if (fc == _fl_cur) _fl_cur = NULL;
+
+  if (_fl_task == NULL) {
+    cache_flush(fc);
+  } else {
+    fc->seq = _fl_seq++;
+    fc->state = FL_FLUSHING;
+    xTaskNotifyGive(_fl_task);
+  }
+}
+
+// Submit all windows being filled, in address order so that verify and journal see a contiguous image
+static void cache_submit(void) {
+  while (1) {
+    flash_cache_t* fc = NULL;
+    for (uint32_t i = 0; i < FLASH_CACHE_WINDOWS; i++) {
+      if (_fl_cache[i].state == FL_FILLING && (fc == NULL || _fl_cache[i].addr < fc->addr)) fc = &_fl_cache[i];
+    }
+    if (fc == NULL) break;
+
+    cache_submit_window(fc);
+  }
+}
+
+// Window being filled least recently, NULL if there is none
+static flash_cache_t* cache_lru(void) {
+  flash_cache_t* lru = NULL;
+  for (uint32_t i = 0; i < FLASH_CACHE_WINDOWS; i++) {
+    flash_cache_t* fc = &_fl_cache[i];
+    if (fc->state == FL_FILLING && (lru == NULL || (int32_t) (fc->used - lru->used) < 0)) lru = fc;
+  }
+  return lru;
+}
+
+// Window being filled at addr, NULL if there is none
+static flash_cache_t* cache_find(uint32_t addr) {
+  for (uint32_t i = 0; i < FLASH_CACHE_WINDOWS; i++) {
+    if (_fl_cache[i].state == FL_FILLING && _fl_cache[i].addr == addr) return &_fl_cache[i];
+  }
+  return NULL;
+}
+
+static bool cache_holds(uint32_t addr) {
+  for (uint32_t i = 0; i < FLASH_CACHE_WINDOWS; i++) {
+    if (_fl_cache[i].state != FL_FREE && _fl_cache[i].addr == addr) return true;
+  }
+  return false;
+}
+
+#if FLASH_ERASE_AHEAD
+// Erase window following the one usbd is filling, run by flash task when there is nothing to flush
+static void erase_ahead(void) {
+  uint32_t const last = _fl_last_addr;
+  if (last == FLASH_CACHE_INVALID_ADDR) return;
+
+  uint32_t const next = last + FLASH_CACHE_SIZE;
+  if (next + FLASH_CACHE_SIZE > _ea_end || next + FLASH_CACHE_SIZE > _part_target->size) return;
+
+  // no erase ahead on a sagging supply, a brownout then only loses the window being programmed
+  if (supply_low()) return;
+
+  // claim window, usbd must not open it in between
+  bool claimed = false;
+  vTaskSuspendAll();
+  if (_fl_last_addr == last && next >= _ea_floor && !(_ea_state != EA_NONE && _ea_addr == next) &&
+      !cache_holds(next)) {
+    _ea_addr = next;
+    _ea_state = EA_ERASING;
+    claimed = true;
+  }
+  xTaskResumeAll();
+
+  if (!claimed) return;
+
+#if CFG_UF2_LKG_SNAPSHOT
+  lkg_capture(next);
+#endif
+
+  TUF2_LOG1("Erase ahead at 0x%08lX", next);
+
+  uint32_t const start_us = TUF2_STATS_US();
+  _fl_gen++;
+  TUF2_TRACE_BEGIN(TUF2_TRACE_FLASH_ERASE);
+  flash_erase(_part_target, next, FLASH_CACHE_SIZE, FLASH_ERASE_SLICE);
+  wear_count(_part_target, next, FLASH_CACHE_SIZE);
+  TUF2_TRACE_END(TUF2_TRACE_FLASH_ERASE);
+  _fl_gen++;
+  TUF2_STATS_INC(erase_count);
+  TUF2_STATS_ADD(erase_us, TUF2_STATS_US() - start_us);
+
+  _ea_state = EA_ERASED;
+  xSemaphoreGive(_fl_done);
+}
+#endif
+
+static flash_cache_t* cache_get_free(void) {
+  for (uint32_t i = 0; i < FLASH_CACHE_WINDOWS; i++) {
+    if (_fl_cache[i].buf != NULL && _fl_cache[i].state == FL_FREE) return &_fl_cache[i];
+  }
+  return NULL;
+}
+
+// Flash task: erase & program submitted windows, oldest first
+void board_flash_write_task(void* param) {
+  (void) param;
+
+  _fl_done = xSemaphoreCreateBinaryStatic(&_fl_done_def);
+  _fl_task = xTaskGetCurrentTaskHandle();
+
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    while (1) {
+      flash_cache_t* fc = NULL;
+      for (uint32_t i = 0; i < FLASH_CACHE_WINDOWS; i++) {
+        if (_fl_cache[i].state == FL_FLUSHING && (fc == NULL || (int32_t) (_fl_cache[i].seq - fc->seq) < 0)) {
+          fc = &_fl_cache[i];
+        }
+      }
+      if (fc == NULL) break;
+
+      cache_flush(fc);
+      xSemaphoreGive(_fl_done);
+    }
+
+#if FLASH_ERASE_AHEAD
+    erase_ahead();
+#endif
+
+    // one block at a time so that windows submitted in between are flushed first
+    if (measurement_erase_step()) xTaskNotifyGive(_fl_task);
+#if TINYUF2_DATA_LUN
+    else if (unmap_erase_step()) xTaskNotifyGive(_fl_task);
+#endif
+  }
+}
+
+void board_flash_erase_ahead(uint32_t addr, uint32_t len) {
+#if FLASH_ERASE_AHEAD
+  _ea_end = addr + len;
+#else
+  (void) addr;
+  (void) len;
+#endif
+}
+
+bool board_flash_write_busy(uint32_t addr) {
+#if FLASH_PSRAM_STAGE
+  if (_ps_buf) return false;
+#endif
+
+  uint32_t new_addr = addr & ~(FLASH_CACHE_SIZE - 1);
+  if (cache_find(new_addr) != NULL || cache_get_free() != NULL) return false;
+
+  // all windows are being filled: submit the least recently written one, free once flushed
+  bool flushing = false;
+  for (uint32_t i = 0; i < FLASH_CACHE_WINDOWS; i++) {
+    if (_fl_cache[i].state == FL_FLUSHING) flushing = true;
+  }
+  if (!flushing) {
+    TUF2_STATS_INC(cache_evictions);
+    cache_submit_window(cache_lru());
+  }
+  return true;
+}
+
+void board_flash_write_wait(void) {
+  if (_fl_done == NULL) return;
+
+  // a give left over from an earlier window only makes usbd check board_flash_write_busy() once more
+  xSemaphoreTake(_fl_done, pdMS_TO_TICKS(FLASH_WRITE_WAIT_MS));
+}
+
+void board_flash_flush(void) {
+#if FLASH_PSRAM_STAGE
+  if (_ps_count) psram_replay();
+#endif
+
+  // image is complete, nothing more to erase ahead
+  _ea_end = 0;
+  _ea_floor = 0;
+  cache_submit();
+
+  // wait for all windows to be written
+  for (uint32_t i = 0; i < FLASH_CACHE_WINDOWS; i++) {
+    while (_fl_cache[i].state == FL_FLUSHING) {
+      xSemaphoreTake(_fl_done, portMAX_DELAY);
+    }
+  }
+
+#ifdef BOARD_UF2_ROUTES
+  route_flush();
+#endif
+}
+
+#ifdef BOARD_UF2_SIGN_PUBKEY
+void board_flash_signature(uint32_t len, uint8_t const signature[64]) {
+  // same block sent again by host OS re-sending the sector
+  if (len == _sg_len && 0 == memcmp(signature, _sg_signature, sizeof(_sg_signature))) return;
+
+  // flash task must not be hashing a window meanwhile
+  for (uint32_t i = 0; i < FLASH_CACHE_WINDOWS; i++) {
+    while (_fl_cache[i].state == FL_FLUSHING) {
+      xSemaphoreTake(_fl_done, portMAX_DELAY);
+    }
+  }
+
+  if (_sg_len) mbedtls_sha256_free(&_sg_sha);
+  memcpy(_sg_signature, signature, sizeof(_sg_signature));
+  _sg_len = len;
+
+  // windows flushed so far were not hashed for this length
+  if (_sg_hashed) _sg_stream = false;
+
+  mbedtls_sha256_init(&_sg_sha);
+  mbedtls_sha256_starts(&_sg_sha, 0);
+}
+
+// Run by flash task for each window flushed in order, sha256 uses the SHA peripheral
+static void sign_consume(flash_cache_t const* fc) {
+  if (!_sg_stream) return;
+  if (_sg_len == 0 || fc->addr != _sg_hashed) {
+    _sg_stream = false;
+    return;
+  }
+
+  if (fc->addr < _sg_len) {
+    uint32_t const len = (_sg_len - fc->addr < FLASH_CACHE_SIZE) ? (_sg_len - fc->addr) : FLASH_CACHE_SIZE;
+    mbedtls_sha256_update(&_sg_sha, fc->buf, len);
+  }
+  _sg_hashed += FLASH_CACHE_SIZE;
+}
+
+// ECDSA P-256 signature of the image over its sha256, buf is a free window
+static bool sign_verify(uint8_t* buf) {
+  if (_sg_len == 0 || _sg_len > _part_target->size) {
+    TUF2_LOG1("Signature missing");
+    return false;
+  }
+
+  // image was not hashed during the transfer (resumed or out of order): read it once
+  if (!_sg_stream || _sg_hashed < _sg_len) {
+    TUF2_LOG1("Signature: hashing image from flash");
+    mbedtls_sha256_free(&_sg_sha);
+    mbedtls_sha256_init(&_sg_sha);
+    mbedtls_sha256_starts(&_sg_sha, 0);
+
+    for (uint32_t addr = 0; addr < _sg_len; addr += FLASH_CACHE_SIZE) {
+      uint32_t const len = (_sg_len - addr < FLASH_CACHE_SIZE) ? (_sg_len - addr) : FLASH_CACHE_SIZE;
+      esp_partition_read(_part_target, addr, buf, len);
+      mbedtls_sha256_update(&_sg_sha, buf, len);
+    }
+  }
+
+  uint8_t hash[32];
+  mbedtls_sha256_finish(&_sg_sha, hash);
+  mbedtls_sha256_free(&_sg_sha);
+
+  bool const result = (1 == uECC_verify(_sg_pubkey, hash, sizeof(hash), _sg_signature, uECC_secp256r1()));
+  TUF2_LOG1("Signature of %lu bytes: %s", _sg_len, result ? "OK" : "FAILED");
+  return result;
+}
+#endif
+
+void board_flash_set_boot(void) {
+  esp_ota_set_boot_partition(_part_target);
+}
+
+bool board_flash_verify(void) {
+  bool result = true;
+
+  if (_vf_start == FLASH_CACHE_INVALID_ADDR) {
+    // nothing written
+  } else if (!_vf_valid) {
+    TUF2_LOG1("Verify skipped: windows not written in order");
+  } else {
+    // all windows are free after flush, use one as read buffer
+    uint8_t* buf = _fl_cache[0].buf;
+    uint32_t crc = 0;
+
+    for (uint32_t addr = _vf_start; addr < _vf_end; addr += FLASH_CACHE_SIZE) {
+      esp_partition_read(_part_target, addr, buf, FLASH_CACHE_SIZE);
+      crc = esp_rom_crc32_le(crc, buf, FLASH_CACHE_SIZE);
+    }
+
+    result = (crc == _vf_crc);
+    TUF2_LOG1("Verify 0x%08lX - 0x%08lX: %s", _vf_start, _vf_end, result ? "OK" : "FAILED");
+  }
+
+#ifdef BOARD_UF2_SIGN_PUBKEY
+  // checked before board_dfu_complete() makes ota0 bootable, all windows are free after flush
+  if (result) {
+    result = sign_verify(_fl_cache[0].buf);
+  } else if (_sg_len) {
+    mbedtls_sha256_free(&_sg_sha);
+  }
+  _sg_len = 0;
+  _sg_hashed = 0;
+  _sg_stream = true;
+#endif
+
+#ifdef BOARD_UF2_STAGE_FAMILY
+  // tinyuf2 of a bundle is installed last, refuse the whole update if it would not boot
+  if (result && !stage_check()) result = false;
+#endif
+
+#if BOARD_APP_CHECK
+  // flash holds exactly what was written, next boot only needs the cheap check
+  if (result && _vf_start != FLASH_CACHE_INVALID_ADDR && _vf_valid) app_valid_save(true);
+  _av_cleared = false;
+#endif
+
+  _vf_crc = 0;
+  _vf_start = _vf_end = FLASH_CACHE_INVALID_ADDR;
+  _vf_valid = true;
+
+#if FLASH_AB_SLOTS
+  memset(_ab_written, 0, sizeof(_ab_written));
+#endif
+
+#if CFG_UF2_LKG_SNAPSHOT
+  lkg_end(result);
+#endif
+
+#if FLASH_RESUME_JOURNAL
+  // download is complete, a later one must start over even for the same image
+  _jr.flushed = FLASH_CACHE_INVALID_ADDR;
+  journal_save(NULL);
+#endif
+
+  return result;
+}
+
+// Pass [addr, addr+len) of ota0 as seen by read (board_flash_read() or target_read()) to consume in
+// aligned chunks, so that each read is served by a single write-back window or flash
+static void read_chunks(void (*read)(uint32_t addr, void* buffer, uint32_t len), uint32_t addr, uint32_t len,
+                        void (*consume)(uint8_t const* buf, uint32_t len, void* arg), void* arg) {
+  uint8_t buf[256] __attribute__((aligned(4)));
+
+  while (len) {
+    uint32_t count = sizeof(buf) - (addr & (sizeof(buf) - 1));
+    if (count > len) count = len;
+
+    read(addr, buf, count);
+    consume(buf, count, arg);
+
+    addr += count;
+    len -= count;
+  }
+}
+
+static void crc32_consume(uint8_t const* buf, uint32_t len, void* arg) {
+  uint32_t* crc = (uint32_t*) arg;
+  *crc = esp_rom_crc32_le(*crc, buf, len);
+}
+
+uint32_t board_flash_crc32(uint32_t addr, uint32_t len) {
+  uint32_t crc = 0;
+  read_chunks(board_flash_read, addr, len, crc32_consume, &crc);
+  return crc;
+}
+
+uint32_t board_crc32(uint32_t crc, void const* buf, uint32_t len) {
+  return esp_rom_crc32_le(crc, (uint8_t const*) buf, len);
+}
+
+static void md5_consume(uint8_t const* buf, uint32_t len, void* arg) {
+  esp_rom_md5_update((md5_context_t*) arg, buf, len);
+}
+
+// ESP32-S2 has no MD5 peripheral, ROM implementation is used. Blocks that match are not written,
+// so with A/B staging this is against the target slot, not the image seen by board_flash_read()
+bool board_flash_md5_match(uint32_t addr, uint32_t len, uint8_t const md5[16]) {
+  if (addr + len > _part_target->size) return false;
+
+  md5_context_t ctx;
+  uint8_t digest[ESP_ROM_MD5_DIGEST_LEN];
+
+  esp_rom_md5_init(&ctx);
+  read_chunks(target_read, addr, len, md5_consume, &ctx);
+  esp_rom_md5_final(digest, &ctx);
+
+  return 0 == memcmp(digest, md5, sizeof(digest));
+}
+
+#if BOARD_FLASH_SCRUB
+//--------------------------------------------------------------------+
+// Idle-time scrub
+// Hashes the image as board_flash_read() serves it while the host is idle: each 64KB window (the ranges of
+// uf2verify.py at its default range size) and the whole image up to its appended sha256. Results belong to
+// one _fl_gen, any erase or program of ota0 starts over
+//--------------------------------------------------------------------+
+
+#define SCRUB_CHUNK  1024
+
+static volatile int64_t _wr_last_us = INT64_MIN / 2;  // last board_flash_write()
+
+static struct {
+  uint32_t gen;
+  uint32_t len;                 // image length, 0 if there is none
+  uint32_t hash_end;            // start of the appended sha256, 0 without one
+  uint32_t pos;                 // bytes hashed
+  uint32_t window_count;        // entries of window[]
+  uint8_t (*window)[32];
+  uint8_t image[32];
+  volatile uint32_t windows;    // window digests done
+  volatile bool started;
+  volatile bool done;
+  volatile bool image_ok;       // image hashes to its appended sha256
+} _sc;
+
+static mbedtls_sha256_context _sc_window_sha;
+static mbedtls_sha256_context _sc_image_sha;
+static uint8_t _sc_buf[SCRUB_CHUNK] __attribute__((aligned(4)));
+
+// nothing in the windows or the PSRAM stage that flash does not have yet
+static bool scrub_flash_settled(void) {
+  for (uint32_t i = 0; i < FLASH_CACHE_WINDOWS; i++) {
+    if (_fl_cache[i].state != FL_FREE) return false;
+  }
+#if FLASH_PSRAM_STAGE
+  if (_ps_count) return false;
+#endif
+  return _ea_state != EA_ERASING;
+}
+
+static bool scrub_idle(void) {
+  int64_t const now = esp_timer_get_time();
+  int64_t const idle_us = (int64_t) FLASH_SCRUB_IDLE_MS * 1000;
+  return (now - _rd_hint_us >= idle_us) && (now - _wr_last_us >= idle_us) && scrub_flash_settled();
+}
+
+// results describe what board_flash_read() returns
+static inline bool scrub_current(void) {
+  return _sc.started && _sc.gen == _fl_gen && scrub_flash_settled();
+}
+
+static void scrub_restart(void) {
+  _sc.gen = _fl_gen;
+  _sc.started = true;
+  _sc.done = false;
+  _sc.image_ok = false;
+  _sc.pos = 0;
+  _sc.windows = 0;
+
+  mbedtls_sha256_free(&_sc_window_sha);
+  mbedtls_sha256_free(&_sc_image_sha);
+  mbedtls_sha256_init(&_sc_window_sha);
+  mbedtls_sha256_init(&_sc_image_sha);
+  mbedtls_sha256_starts(&_sc_window_sha, 0);
+  mbedtls_sha256_starts(&_sc_image_sha, 0);
+
+  esp_image_header_t hdr;
+  board_flash_read(0, &hdr, sizeof(hdr));
+  _sc.len = board_flash_app_size();
+  _sc.hash_end = (_sc.len > 32 && hdr.hash_appended) ? _sc.len - 32 : 0;
+  if (_sc.len == 0) _sc.done = true;
+}
+
+// Image is hashed through: compare with the appended sha256, record a good one that is not recorded yet
+static void scrub_finish(void) {
+  if (_sc.hash_end) {
+    uint8_t tail[32];
+    mbedtls_sha256_finish(&_sc_image_sha, _sc.image);
+    board_flash_read(_sc.hash_end, tail, sizeof(tail));
+    _sc.image_ok = (0 == memcmp(tail, _sc.image, sizeof(tail)));
+  }
+  TUF2_LOG1("Scrub: %lu bytes, %lu windows, image %s", (unsigned long) _sc.len, (unsigned long) _sc.windows,
+            !_sc.hash_end ? "without sha256" : _sc.image_ok ? "OK" : "DIFFERS");
+
+#if BOARD_APP_CHECK
+  app_valid_t id;
+  if (_sc.image_ok && _part_active == _part_target && !_av_cleared && _sc.gen == _fl_gen &&
+      !app_valid_recorded(_part_active, &id)) {
+    app_valid_save(true);
+  }
+#endif
+  _sc.done = true;
+}
+
+// Hash the next chunk, a flush or erase while it was read drops it and starts over
+static void scrub_step(void) {
+  if (!_sc.started || _sc.gen != _fl_gen) scrub_restart();
+  if (_sc.done) return;
+
+  uint32_t const window_end = (_sc.pos & ~(FLASH_CACHE_SIZE - 1)) + FLASH_CACHE_SIZE;
+  uint32_t count = SCRUB_CHUNK;
+  if (count > _sc.len - _sc.pos) count = _sc.len - _sc.pos;
+
+  board_flash_read(_sc.pos, _sc_buf, count);
+  if (_sc.gen != _fl_gen) return;
+
+  mbedtls_sha256_update(&_sc_window_sha, _sc_buf, count);
+  if (_sc.pos < _sc.hash_end) {
+    uint32_t const n = (_sc.hash_end - _sc.pos < count) ? (_sc.hash_end - _sc.pos) : count;
+    mbedtls_sha256_update(&_sc_image_sha, _sc_buf, n);
+  }
+  _sc.pos += count;
+
+  if (_sc.pos == window_end || _sc.pos == _sc.len) {
+    if (_sc.windows < _sc.window_count) {
+      mbedtls_sha256_finish(&_sc_window_sha, _sc.window[_sc.windows]);
+      _sc.windows++;
+    }
+    mbedtls_sha256_free(&_sc_window_sha);
+    mbedtls_sha256_init(&_sc_window_sha);
+    mbedtls_sha256_starts(&_sc_window_sha, 0);
+  }
+
+  if (_sc.pos == _sc.len) scrub_finish();
+}
+
+// Digest of a hashed window if [addr, addr + len) is exactly one, the last one ends with the image
+static uint8_t const* scrub_window_digest(uint32_t addr, uint32_t len) {
+  if (!scrub_current() || (addr & (FLASH_CACHE_SIZE - 1)) || addr >= _sc.len) return NULL;
+
+  uint32_t const w = addr / FLASH_CACHE_SIZE;
+  uint32_t const end = (_sc.len - addr < FLASH_CACHE_SIZE) ? _sc.len : addr + FLASH_CACHE_SIZE;
+  return (w < _sc.windows && addr + len == end) ? _sc.window[w] : NULL;
+}
+
+#if BOARD_APP_CHECK
+static bool scrub_app_sha256(uint8_t sha256[32]) {
+  if (!scrub_current() || !_sc.done || !_sc.image_ok) return false;
+  memcpy(sha256, _sc.image, sizeof(_sc.image));
+  return true;
+}
+#endif
+
+// Idle priority, waits for board_flash_init() and then for the host to leave the device alone
+void board_flash_scrub_task(void* param) {
+  (void) param;
+
+  while (_part_active == NULL) vTaskDelay(pdMS_TO_TICKS(FLASH_SCRUB_IDLE_MS));
+
+  // whole image digest still works without them
+  _sc.window_count = (_part_active->size + FLASH_CACHE_SIZE - 1) / FLASH_CACHE_SIZE;
+  _sc.window = calloc(_sc.window_count, sizeof(_sc.window[0]));
+  if (_sc.window == NULL) _sc.window_count = 0;
+
+  mbedtls_sha256_init(&_sc_window_sha);
+  mbedtls_sha256_init(&_sc_image_sha);
+
+  while (1) {
+    if (_sc.started && _sc.done && _sc.gen == _fl_gen) {
+      vTaskDelay(pdMS_TO_TICKS(FLASH_SCRUB_IDLE_MS));
+    } else if (!scrub_idle()) {
+      vTaskDelay(pdMS_TO_TICKS(100));
+    } else {
+      scrub_step();
+      vTaskDelay(1);
+    }
+  }
+}
+#endif
+
+static void sha256_consume(uint8_t const* buf, uint32_t len, void* arg) {
+  mbedtls_sha256_update((mbedtls_sha256_context*) arg, buf, len);
+}
+
+// mbedtls uses the SHA peripheral. Audits are against the image as CURRENT.UF2 serves it, so board_flash_read()
+bool board_flash_sha256_match(uint32_t addr, uint32_t len, uint8_t const sha256[32]) {
+  if (addr + len < addr || addr + len > board_flash_size()) return false;
+
+#if BOARD_FLASH_SCRUB
+  uint8_t const* hashed = scrub_window_digest(addr, len);
+  if (hashed) return 0 == memcmp(hashed, sha256, 32);
+#endif
+
+  mbedtls_sha256_context ctx;
+  uint8_t digest[32];
+
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_starts(&ctx, 0);
+  read_chunks(board_flash_read, addr, len, sha256_consume, &ctx);
+  mbedtls_sha256_finish(&ctx, digest);
+  mbedtls_sha256_free(&ctx);
+
+  return 0 == memcmp(digest, sha256, sizeof(digest));
+}
+
+// Reject images that are not an app for this chip on their first block, before erasing ota0
+bool board_flash_check_image(uint32_t addr, uint8_t const* data, uint32_t len) {
+  if (addr != 0) {
+    TUF2_LOG1("Image does not start at ota0: 0x%08lX", addr);
+    return false;
+  }
+
+  esp_image_header_t hdr;
+  if (len < sizeof(hdr)) return false;
+  memcpy(&hdr, data, sizeof(hdr));
+
+  if (hdr.magic != ESP_IMAGE_HEADER_MAGIC || hdr.segment_count == 0 || hdr.segment_count > ESP_IMAGE_MAX_SEGMENTS) {
+    TUF2_LOG1("Image has no valid app header");
+    return false;
+  }
+
+  if (hdr.chip_id != CONFIG_IDF_FIRMWARE_CHIP_ID) {
+    TUF2_LOG1("Image is built for chip id %u", hdr.chip_id);
+    return false;
+  }
+
+  return true;
+}
+
+#if FLASH_RESUME_JOURNAL
+uint32_t board_flash_resume(uint8_t const* data, uint32_t len, uint32_t num_blocks) {
+#if FLASH_PSRAM_STAGE
+  // left from a download cut off before completion, partly received windows must not advance the journal.
+  // Those below the journal point are in flash, the host sends the rest again
+  memset(_ps_staged, 0, sizeof(_ps_staged));
+  _ps_count = 0;
+#endif
+
+  // wait for windows of a previous image, they would otherwise advance the new journal
+  board_flash_flush();
+
+  // first block of an esp image holds the app descriptor with its elf sha256
+  uint32_t const image_id = esp_rom_crc32_le(0, data, len);
+
+  flash_journal_t saved = { 0 };
+  size_t size = sizeof(saved);
+
+  nvs_handle_t nvs;
+  if (nvs_ready() && ESP_OK == nvs_open("storage", NVS_READONLY, &nvs)) {
+    if (ESP_OK != nvs_get_blob(nvs, "uf2journal", &saved, &size) || size != sizeof(saved)) {
+      saved.flushed = 0;
+    }
+    nvs_close(nvs);
+  }
+
+  if (saved.image_id == image_id && saved.num_blocks == num_blocks && saved.flushed <= _part_target->size) {
+    TUF2_LOG1("Resume update at 0x%08lX", saved.flushed);
+    _jr = saved;
+  } else {
+    _jr.image_id = image_id;
+    _jr.num_blocks = num_blocks;
+    _jr.flushed = 0;
+    journal_save(&_jr);
+  }
+
+#if FLASH_AB_SLOTS
+  // skipped windows are already in the target slot
+  for (uint32_t addr = 0; addr < _jr.flushed; addr += FLASH_CACHE_SIZE) ab_mark(addr);
+#endif
+
+  return _jr.flushed;
+}
+#endif
+
+// Copy into a window being filled. Its buffer holds what flash holds (or is about to) since cache_open(), a
+// sector is only marked for erase & program if the copy changes it, or cache_open() found the target slot
+// differs from the buffer. Repeated images, runs of 0xff over erased flash and zero-filled sections that
+// flash already holds are skipped by cache_flush() without a compare read
+static void cache_fill(flash_cache_t* fc, uint32_t offset, uint8_t const* src, uint32_t len) {
+  while (len) {
+    uint32_t const sector = offset / FLASH_SECTOR_SIZE;
+    uint32_t n = FLASH_SECTOR_SIZE - (offset % FLASH_SECTOR_SIZE);
+    if (n > len) n = len;
+
+    if (!(fc->dirty & (1UL << sector)) && memcmp(fc->buf + offset, src, n)) fc->dirty |= 1UL << sector;
+    memcpy(fc->buf + offset, src, n);
+
+    offset += n;
+    src += n;
+    len -= n;
+  }
+}
+
+// Sectors of a window whose buffer differs from what the target slot holds, or a submitted window of it
+// is about to program. For a buffer read from elsewhere (the active slot, the PSRAM stage): cache_fill()
+// only compares with the buffer, cache_flush() programs nothing else
+static uint32_t cache_target_diff(uint32_t addr, uint8_t const* buf) {
+  uint8_t chunk[256] __attribute__((aligned(4)));
+  uint32_t dirty = 0;
+
+  for (uint32_t offset = 0; offset < FLASH_CACHE_SIZE; offset += sizeof(chunk)) {
+    uint32_t const sector = offset / FLASH_SECTOR_SIZE;
+    if (dirty & (1UL << sector)) continue;
+
+    if (!cache_copy(addr + offset, chunk, sizeof(chunk))) part_read(_part_target, addr + offset, chunk, sizeof(chunk));
+    if (memcmp(chunk, buf + offset, sizeof(chunk))) dirty |= 1UL << sector;
+  }
+  return dirty;
+}
+
+// Make the window of new_addr the current one, opened in a free window if it is not being filled yet
+static void cache_open(uint32_t new_addr) {
+  if (_fl_cur == NULL || new_addr != _fl_cur->addr) {
+    flash_cache_t* fc = cache_find(new_addr);
+    if (fc != NULL) {
+      _fl_cur = fc;
+      fc->used = _fl_used++;
+      return;
+    }
+
+    // caller should check board_flash_write_busy() first, block until a window is free anyway
+    while (NULL == (fc = cache_get_free())) {
+      flash_cache_t* lru = cache_lru();
+      if (lru != NULL) {
+        TUF2_STATS_INC(cache_evictions);
+        cache_submit_window(lru);
+      } else {
+        xSemaphoreTake(_fl_done, portMAX_DELAY);
+      }
+    }
+
+    vTaskSuspendAll();
+    _fl_last_addr = new_addr;
+    if (new_addr + FLASH_CACHE_SIZE > _ea_floor) _ea_floor = new_addr + FLASH_CACHE_SIZE;
+    bool const ea_hit = (_ea_state != EA_NONE) && (_ea_addr == new_addr);
+    xTaskResumeAll();
+
+    if (ea_hit) {
+      while (_ea_state == EA_ERASING) {
+        xSemaphoreTake(_fl_done, portMAX_DELAY);
+      }
+    }
+
+    uint32_t dirty = 0;
+    if (ea_hit && _ea_state == EA_ERASED && _ea_addr == new_addr) {
+      _ea_state = EA_NONE;
+      memset(fc->buf, 0xff, FLASH_CACHE_SIZE);
+      fc->erased = true;
+    } else {
+      // submitted window may still hold data of new_addr that is not in flash yet
+      board_flash_read(new_addr, fc->buf, FLASH_CACHE_SIZE);
+      fc->erased = false;
+
+      // buffer was not read from the target slot: a window that is unwritten with A/B staging comes from
+      // the active slot, a staged one from PSRAM. Sectors equal to it may still differ from the target slot
+      bool from_target = true;
+#if FLASH_AB_SLOTS
+      if (!ab_written(new_addr)) from_target = false;
+#endif
+#if FLASH_PSRAM_STAGE
+      if (_ps_count && ps_staged(new_addr)) from_target = false;
+#endif
+      if (!from_target) dirty = cache_target_diff(new_addr, fc->buf);
+    }
+
+#if FLASH_AB_SLOTS
+    // from here on reads of the window see the new image
+    ab_mark(new_addr);
+#endif
+
+    fc->addr = new_addr;
+    fc->used = _fl_used++;
+    fc->received = 0;
+    fc->dirty = dirty;
+    fc->state = FL_FILLING;
+    _fl_cur = fc;
+
+    // let flash task erase the next window
+    if (_fl_task) xTaskNotifyGive(_fl_task);
+  }
+}
+
+#if FLASH_PSRAM_STAGE
+static void psram_write(uint32_t addr, uint8_t const* src, uint32_t len) {
+  while (len) {
+    uint32_t const window = addr & ~(FLASH_CACHE_SIZE - 1);
+    uint32_t const offset = addr - window;
+    uint32_t const count = (len < FLASH_CACHE_SIZE - offset) ? len : (FLASH_CACHE_SIZE - offset);
+
+    if (!ps_staged(window)) {
+      // rest of the window keeps what the slot holds, as a write window opened by cache_open()
+      board_flash_read(window, _ps_buf + window, FLASH_CACHE_SIZE);
+      uint32_t const w = window / FLASH_CACHE_SIZE;
+      _ps_staged[w / 32] |= 1UL << (w % 32);
+      _ps_received[w] = 0;
+      _ps_count++;
+#if FLASH_AB_SLOTS
+      ab_mark(window);
+#endif
+    }
+    memcpy(_ps_buf + addr, src, count);
+    _ps_received[window / FLASH_CACHE_SIZE] += count;
+
+    addr += count;
+    src += count;
+    len -= count;
+  }
+}
+
+// Program the staged windows in ascending order, the same sequence of windows as a download straight to
+// flash: differential flush, erase-ahead of the next staged window, verify crc, signature and journal
+static void psram_replay(void) {
+  uint32_t const end = _part_target->size;
+
+  for (uint32_t window = 0; window < end; window += FLASH_CACHE_SIZE) {
+    if (!ps_staged(window)) continue;
+
+    // never erase ahead into a window that is not part of the image
+    uint32_t const next = window + FLASH_CACHE_SIZE;
+    _ea_end = (next < end && ps_staged(next)) ? next + FLASH_CACHE_SIZE : 0;
+
+    cache_open(window);
+    cache_fill(_fl_cur, 0, _ps_buf + window, FLASH_CACHE_SIZE);
+    cache_submit_window(_fl_cur);
+
+    uint32_t const w = window / FLASH_CACHE_SIZE;
+    _ps_staged[w / 32] &= ~(1UL << (w % 32));
+  }
+  _ps_count = 0;
+}
+#endif
+
+#if FLASH_RESUME_JOURNAL
+void board_flash_detach(void) {
+  // no image in progress
+  if (_jr.flushed == FLASH_CACHE_INVALID_ADDR) return;
+
+  int64_t const deadline = esp_timer_get_time() + (int64_t) FLASH_DETACH_MS * 1000;
+
+#if FLASH_PSRAM_STAGE
+  // staged windows received completely from the journal point on, an incomplete one would need the
+  // rest of the image. Windows straight to flash are submitted as soon as complete
+  if (_ps_count) {
+    uint32_t const ea_end = _ea_end;
+    uint32_t const end = _part_target->size;
+
+    for (uint32_t window = _jr.flushed; window < end && ps_staged(window); window += FLASH_CACHE_SIZE) {
+      uint32_t const w = window / FLASH_CACHE_SIZE;
+      if (_ps_received[w] < FLASH_CACHE_SIZE || esp_timer_get_time() >= deadline) break;
+
+      _ea_end = 0;
+      cache_open(window);
+      cache_fill(_fl_cur, 0, _ps_buf + window, FLASH_CACHE_SIZE);
+      cache_submit_window(_fl_cur);
+
+      _ps_staged[w / 32] &= ~(1UL << (w % 32));
+      _ps_count--;
+    }
+    _ea_end = ea_end;
+  }
+#endif
+
+  // journal advances as the flash task programs them
+  for (uint32_t i = 0; i < FLASH_CACHE_WINDOWS; i++) {
+    while (_fl_cache[i].state == FL_FLUSHING) {
+      int64_t const remain_us = deadline - esp_timer_get_time();
+      if (remain_us <= 0) break;
+      xSemaphoreTake(_fl_done, pdMS_TO_TICKS(remain_us / 1000 + 1));
+    }
+  }
+
+  TUF2_LOG1("Detached, update journal at 0x%08lX", _jr.flushed);
+}
+#endif
+
+bool board_flash_write(uint32_t addr, void const* data, uint32_t len) {
+  uint8_t const* src = (uint8_t const*) data;
+
+#if BOARD_FLASH_SCRUB
+  _wr_last_us = esp_timer_get_time();
+#endif
+
+#if BOARD_APP_CHECK
+  // image is about to change, recorded identity is no longer proof of a good image
+  if (!_av_cleared) {
+    app_valid_save(false);
+    _av_cleared = true;
+  }
+#endif
+
+#if FLASH_PSRAM_STAGE
+  if (_ps_buf) {
+    if (addr + len > _part_target->size) return false;
+    psram_write(addr, src, len);
+    return true;
+  }
+#endif
+
+  // payloads that are not a power of 2 (e.g 476 bytes) can straddle two windows
+  while (len) {
+    uint32_t const window = addr & ~(FLASH_CACHE_SIZE - 1);
+    if (cache_find(window) != NULL) {
+      TUF2_STATS_INC(cache_hits);
+    } else {
+      TUF2_STATS_INC(cache_misses);
+    }
+    cache_open(window);
+
+    uint32_t const offset = addr & (FLASH_CACHE_SIZE - 1);
+    uint32_t const count = (len < FLASH_CACHE_SIZE - offset) ? len : (FLASH_CACHE_SIZE - offset);
+    cache_fill(_fl_cur, offset, src, count);
+
+    // whole window or up to the end of the image received, a block written twice only submits it early
+    uint32_t const end = _ea_end;
+    uint32_t const size = (end > window && end - window < FLASH_CACHE_SIZE) ? end - window : FLASH_CACHE_SIZE;
+    _fl_cur->received += count;
+    if (_fl_cur->received >= size) cache_submit_window(_fl_cur);
+
+    addr += count;
+    src += count;
+    len -= count;
+  }
+
+  return true;
+}
+
+//--------------------------------------------------------------------+
+// Erase
+//--------------------------------------------------------------------+
+
+// Words sampled per 64KB block before it is read completely
+#define ERASE_SCAN_SAMPLES  16
+
+typedef struct {
+  uint32_t total;     // bytes scanned
+  uint32_t erased;    // bytes erased
+  uint32_t erase_us;  // time spent erasing
+  uint32_t slice;     // largest erase at once, 0 for FLASH_ERASE_SLICE
+} erase_stats_t;
+
+// Block holds programmed data. Coarse to fine: a few sampled words catch a block of an image
+// without reading it, otherwise reading stops at the first sector that is not erased
+static bool block_in_use(esp_partition_t const* part, uint32_t addr, uint32_t len, uint8_t* buf, uint32_t buf_size) {
+  for (uint32_t i = 0; i < ERASE_SCAN_SAMPLES; i++) {
+    uint32_t word;
+    esp_partition_read(part, addr + ((i * (len / ERASE_SCAN_SAMPLES)) & ~3UL), &word, 4);
+    if (word != 0xffffffffUL) return true;
+  }
+
+  for (uint32_t offset = 0; offset < len; offset += buf_size) {
+    esp_partition_read(part, addr + offset, buf, buf_size);
+    if (!is_erased(buf, buf_size)) return true;
+  }
+  return false;
+}
+
+static void erase_range(esp_partition_t const* part, uint32_t addr, uint32_t len, erase_stats_t* stats) {
+  int64_t const start = esp_timer_get_time();
+  flash_erase(part, addr, len, stats->slice ? stats->slice : FLASH_ERASE_SLICE);
+  wear_count(part, addr, len);
+  stats->erase_us += (uint32_t) (esp_timer_get_time() - start);
+  stats->erased += len;
+}
+
+// Erase the 64KB blocks of a partition that hold data, consecutive ones as one range. App partitions
+// are 64KB aligned, so that esp_partition_erase_range() issues block instead of sector erases
+static void partition_erase_used(esp_partition_t const* part, uint8_t* buf, erase_stats_t* stats) {
+  uint32_t run_start = 0;
+  uint32_t run_len = 0;
+
+  for (uint32_t addr = 0; addr < part->size; addr += FLASH_BLOCK_SIZE) {
+    uint32_t const len = (part->size - addr < FLASH_BLOCK_SIZE) ? (part->size - addr) : FLASH_BLOCK_SIZE;
+
+    if (block_in_use(part, addr, len, buf, FLASH_SECTOR_SIZE)) {
+      if (!run_len) run_start = addr;
+      run_len += len;
+    } else if (run_len) {
+      erase_range(part, run_start, run_len, stats);
+      run_len = 0;
+    }
+  }
+
+  if (run_len) erase_range(part, run_start, run_len, stats);
+  stats->total += part->size;
+}
+
+//--------------------------------------------------------------------+
+// Measurement erase
+// Blocks are erased from the end of the last measurement partition down to the start of the first.
+// Data is appended from the start, so at any time what is left is a valid shorter log
+//--------------------------------------------------------------------+
+
+static volatile uint32_t _me_part = 0;  // partitions [0, _me_part) are still to be erased
+static uint32_t _me_addr = 0;           // end of the part of partition _me_part - 1 still to be erased
+
+bool board_measurement_erase(void) {
+  if (_part_measurement_count == 0) return false;
+  if (_me_part) return true;
+
+  TUF2_LOG1("Erase measurement data");
+  _me_addr = _part_measurement[_part_measurement_count - 1]->size;
+  _me_part = _part_measurement_count;
+
+  if (_fl_task) {
+    xTaskNotifyGive(_fl_task);
+  } else {
+    while (measurement_erase_step()) {}
+  }
+  return true;
+}
+
+bool board_measurement_erase_busy(void) {
+  return _me_part != 0;
+}
+
+static bool measurement_erase_step(void) {
+  if (_me_part == 0) return false;
+
+  esp_partition_t const* part = _part_measurement[_me_part - 1];
+  uint32_t const len = (_me_addr & (FLASH_BLOCK_SIZE - 1)) ? (_me_addr & (FLASH_BLOCK_SIZE - 1)) : FLASH_BLOCK_SIZE;
+  uint32_t const addr = _me_addr - len;
+
+  uint8_t buf[256];
+  if (block_in_use(part, addr, len, buf, sizeof(buf))) {
+    erase_stats_t stats = { 0 };
+    _me_gen++;
+    erase_range(part, addr, len, &stats);
+    _me_gen++;
+  }
+
+  _me_addr = addr;
+  if (_me_addr == 0) {
+    if (_me_part > 1) _me_addr = _part_measurement[_me_part - 2]->size;
+    _me_part--;
+    if (_me_part == 0) {
+      TUF2_LOG1("Erase measurement data done");
+    }
+  }
+
+  return _me_part != 0;
+}
+
+// Called from check_dfu_mode(), before board_flash_init()
+void board_flash_erase_app(void) {
+  uint8_t* buf = tuf2_scratch_alloc(FLASH_SECTOR_SIZE);
+  if (!buf) return;
+
+  // usbd is not running yet, nothing to preempt: 64KB block erases even if FLASH_ERASE_SLICE is smaller
+  erase_stats_t stats = { .slice = FLASH_BLOCK_SIZE };
+  int64_t const start = esp_timer_get_time();
+
+  // both slots with A/B staging
+  esp_partition_t const* active;
+  esp_partition_t const* target;
+  app_slots(&active, &target);
+  partition_erase_used(active, buf, &stats);
+  if (target != active) partition_erase_used(target, buf, &stats);
+
+#if FLASH_ERASE_APP_MEASUREMENT
+  esp_partition_t const* parts[FLASH_MEASUREMENT_PARTITIONS];
+  uint32_t const count = measurement_partitions_find(parts);
+  for (uint32_t i = 0; i < count; i++) {
+    partition_erase_used(parts[i], buf, &stats);
+  }
+#endif
+
+  tuf2_scratch_free(buf);
+
+  // skipped blocks would have taken as long as the erased ones on average
+  uint32_t const elapsed_ms = (uint32_t) ((esp_timer_get_time() - start) / 1000);
+  uint32_t const saved_ms = stats.erased ?
+      (uint32_t) ((uint64_t) stats.erase_us * (stats.total - stats.erased) / stats.erased / 1000) : 0;
+  TUF2_LOG1("Erase app: %lu of %lu KB in use, done in %lu ms, about %lu ms saved",
+            stats.erased / 1024, stats.total / 1024, elapsed_ms, saved_ms);
+
+  // records of the erased image
+#if FLASH_PSRAM_STAGE
+  memset(_ps_staged, 0, sizeof(_ps_staged));
+  _ps_count = 0;
+#endif
+#if BOARD_APP_CHECK
+  app_valid_save(false);
+#endif
+#if FLASH_RESUME_JOURNAL
+  journal_save(NULL);
+#endif
+#if CFG_UF2_LKG_SNAPSHOT
+  // windows it did not capture are gone
+  lkg_drop();
+#endif
+}
+
+// Last window of ota0, only if the application image ends before it.
+// Runs in the usbd task while the screen may be drawn: its buffer is static, not from scratch arena
+bool board_flash_benchmark(board_flash_bench_t* result) {
+  static uint8_t buf[FLASH_SECTOR_SIZE] __attribute__((aligned(4)));
+
+  uint32_t const addr = _part_target->size - FLASH_CACHE_SIZE;
+  if (board_flash_app_size() > addr) return false;
+
+  // no window may be in flight, read-ahead of this range is stale afterwards
+  board_flash_flush();
+  _fl_gen++;
+
+  int64_t t0 = esp_timer_get_time();
+  esp_partition_erase_range(_part_target, addr, FLASH_CACHE_SIZE);
+  wear_count(_part_target, addr, FLASH_CACHE_SIZE);
+  result->erase_us = (uint32_t) (esp_timer_get_time() - t0);
+
+  for (uint32_t i = 0; i < FLASH_SECTOR_SIZE; i++) buf[i] = (uint8_t) (i * 7 + 1);
+
+  t0 = esp_timer_get_time();
+  for (uint32_t offset = 0; offset < FLASH_CACHE_SIZE; offset += FLASH_SECTOR_SIZE) {
+    esp_partition_write(_part_target, addr + offset, buf, FLASH_SECTOR_SIZE);
+  }
+  result->program_us = (uint32_t) (esp_timer_get_time() - t0);
+
+  t0 = esp_timer_get_time();
+  for (uint32_t offset = 0; offset < FLASH_CACHE_SIZE; offset += FLASH_SECTOR_SIZE) {
+    esp_partition_read(_part_target, addr + offset, buf, FLASH_SECTOR_SIZE);
+  }
+  result->read_us = (uint32_t) (esp_timer_get_time() - t0);
+
+  esp_partition_erase_range(_part_target, addr, FLASH_CACHE_SIZE);
+  wear_count(_part_target, addr, FLASH_CACHE_SIZE);
+  _fl_gen++;
+
+  result->len = FLASH_CACHE_SIZE;
+  return true;
+}
+
+bool board_flash_protect_bootloader(bool protect) {
+  // TODO implement later
+  (void) protect;
+  return false;
+}
+
+
+//--------------------------------------------------------------------+
+// Sector cache: one flash sector write cache for raw partition access,
+// used by data LUN and uf2 families routed to other partitions
+//--------------------------------------------------------------------+
+
+#if TINYUF2_DATA_LUN || defined(BOARD_UF2_ROUTES)
+
+typedef struct {
+  esp_partition_t const* part;
+  uint8_t* buf;
+  uint32_t addr;
+  bool dirty;
+  uint8_t* erased;  // bit per sector known to be erased, NULL if not tracked
+} sector_cache_t;
+
+// Sector bitmaps are updated by both usbd and flash task, callers suspend the scheduler around
+// a change so that bits of the same byte are not lost
+static bool sector_bit_get(uint8_t const* map, uint32_t addr) {
+  uint32_t const sector = addr / FLASH_SECTOR_SIZE;
+  return map[sector / 8] & (1u << (sector % 8));
+}
+
+static void sector_bit_set(uint8_t* map, uint32_t addr, bool value) {
+  uint32_t const sector = addr / FLASH_SECTOR_SIZE;
+  if (value) {
+    map[sector / 8] |= (uint8_t) (1u << (sector % 8));
+  } else {
+    map[sector / 8] &= (uint8_t) ~(1u << (sector % 8));
+  }
+}
+
+// partition and sector buffer are only set up on first use
+static bool sector_cache_init(sector_cache_t* sc, esp_partition_type_t type, esp_partition_subtype_t subtype) {
+  if (sc->part && sc->buf) return true;
+
+  if (!sc->part) {
+    sc->part = esp_partition_find_first(type, subtype, NULL);
+    sc->addr = FLASH_CACHE_INVALID_ADDR;
+    sc->dirty = false;
+  }
+  if (!sc->part) return false;
+
+  if (!sc->buf) sc->buf = malloc(FLASH_SECTOR_SIZE);
+  return sc->buf != NULL;
+}
+
+static void sector_cache_flush(sector_cache_t* sc) {
+  if (!sc->dirty) return;
+
+  // sector erased in the background after an unmap is programmed right away. Checked, a route to
+  // the same partition may have written it since
+  bool erased = false;
+  if (sc->erased && sector_bit_get(sc->erased, sc->addr)) {
+    vTaskSuspendAll();
+    sector_bit_set(sc->erased, sc->addr, false);
+    xTaskResumeAll();
+
+    uint8_t buf[256];
+    erased = !block_in_use(sc->part, sc->addr, FLASH_SECTOR_SIZE, buf, sizeof(buf));
+  }
+  if (!erased) esp_partition_erase_range(sc->part, sc->addr, FLASH_SECTOR_SIZE);
+  esp_partition_write(sc->part, sc->addr, sc->buf, FLASH_SECTOR_SIZE);
+  sc->dirty = false;
+}
+
+static bool sector_cache_read(sector_cache_t* sc, uint32_t addr, void* buffer, uint32_t len) {
+  if (ESP_OK != esp_partition_read(sc->part, addr, buffer, len)) return false;
+
+  // overlay data not yet written back
+  if (sc->dirty && addr < sc->addr + FLASH_SECTOR_SIZE && sc->addr < addr + len) {
+    uint32_t const start = (addr > sc->addr) ? addr : sc->addr;
+    uint32_t const end = (addr + len < sc->addr + FLASH_SECTOR_SIZE) ? (addr + len) : (sc->addr + FLASH_SECTOR_SIZE);
+    memcpy((uint8_t*) buffer + (start - addr), sc->buf + (start - sc->addr), end - start);
+  }
+
+  return true;
+}
+
+static bool sector_cache_write(sector_cache_t* sc, uint32_t addr, void const* buffer, uint32_t len) {
+  uint8_t const* src = (uint8_t const*) buffer;
+  if (addr + len > sc->part->size) return false;
+
+  while (len) {
+    uint32_t const sector = addr & ~(FLASH_SECTOR_SIZE - 1);
+    uint32_t const offset = addr - sector;
+    uint32_t const n = (FLASH_SECTOR_SIZE - offset < len) ? (FLASH_SECTOR_SIZE - offset) : len;
+
+    if (sector != sc->addr) {
+      sector_cache_flush(sc);
+
+      // sector that is entirely overwritten does not need to be read first
+      if (n < FLASH_SECTOR_SIZE && ESP_OK != esp_partition_read(sc->part, sector, sc->buf, FLASH_SECTOR_SIZE)) {
+        sc->addr = FLASH_CACHE_INVALID_ADDR;
+        return false;
+      }
+      sc->addr = sector;
+    }
+
+    memcpy(sc->buf + offset, src, n);
+    sc->dirty = true;
+
+    src += n;
+    addr += n;
+    len -= n;
+  }
+
+  return true;
+}
+
+#endif
+
+//--------------------------------------------------------------------+
+// Routes: uf2 families other than BOARD_UF2_FAMILY_ID written to other partitions
+//--------------------------------------------------------------------+
+
+#ifdef BOARD_UF2_ROUTES
+
+typedef struct {
+  uint32_t family_id;
+  esp_partition_type_t type;
+  esp_partition_subtype_t subtype;
+} flash_route_t;
+
+static flash_route_t const _route[] = { BOARD_UF2_ROUTES };
+static sector_cache_t _route_cache[sizeof(_route) / sizeof(_route[0])];
+
+#ifdef BOARD_UF2_STAGE_FAMILY
+// tinyuf2 image of a bundle, see Bundle below
+static sector_cache_t _stage;
+static bool stage_write(uint32_t addr, void const* data, uint32_t len);
+#endif
+
+bool board_flash_write_family(uint32_t family_id, uint32_t addr, void const* data, uint32_t len) {
+#ifdef BOARD_UF2_STAGE_FAMILY
+  if (family_id == BOARD_UF2_STAGE_FAMILY) return stage_write(addr, data, len);
+#endif
+
+  for (uint32_t i = 0; i < sizeof(_route) / sizeof(_route[0]); i++) {
+    if (_route[i].family_id != family_id) continue;
+
+    sector_cache_t* sc = &_route_cache[i];
+    bool const first = (sc->part == NULL);
+    if (!sector_cache_init(sc, _route[i].type, _route[i].subtype)) return false;
+
+    // NVS library must not touch the partition while its raw image is being replaced,
+    // including the serial number and update journal of this session
+    if (first && _route[i].type == ESP_PARTITION_TYPE_DATA && _route[i].subtype == ESP_PARTITION_SUBTYPE_DATA_NVS) {
+      nvs_flash_deinit();
+    }
+
+    return sector_cache_write(sc, addr, data, len);
+  }
+
+  return false;
+}
+
+static void route_flush(void) {
+  for (uint32_t i = 0; i < sizeof(_route) / sizeof(_route[0]); i++) {
+    if (_route_cache[i].part) sector_cache_flush(&_route_cache[i]);
+  }
+#ifdef BOARD_UF2_STAGE_FAMILY
+  if (_stage.part) sector_cache_flush(&_stage);
+#endif
+}
+
+#endif
+
+//--------------------------------------------------------------------+
+// Bundle: tinyuf2 itself (BOARD_UF2_STAGE_FAMILY) in the same uf2 file as app and data.
+// It can not overwrite the partition it runs from while the transfer goes on, so its image is
+// staged in the last factory-sized part of the target app slot (the app must end before it).
+// Once app and data are verified and the app is bootable, the copy to the factory partition is
+// recorded for the 2nd stage bootloader (bootstage.h), which does it before any app runs.
+//--------------------------------------------------------------------+
+
+#ifdef BOARD_UF2_STAGE_FAMILY
+
+#ifndef BOARD_UF2_ROUTES
+#error "BOARD_UF2_STAGE_FAMILY is written like BOARD_UF2_ROUTES, which must be defined as well"
+#endif
+
+#if !CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC
+#error "BOARD_UF2_STAGE_FAMILY is installed by the bootloader, CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC is required"
+#endif
+
+_Static_assert(BOOTSTAGE_OFFSET + sizeof(bootstage_t) <= CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE,
+               "CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE too small for the tinyuf2 install record");
+
+static bool _stage_written = false;
+
+static esp_partition_t const* stage_factory(void) {
+  esp_partition_t const* factory = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_FACTORY, NULL);
+  return (factory && factory->size <= _part_target->size) ? factory : NULL;
+}
+
+static bool stage_write(uint32_t addr, void const* data, uint32_t len) {
+  esp_partition_t const* factory = stage_factory();
+  if (factory == NULL || addr + len > factory->size) return false;
+
+  if (_stage.part == NULL) {
+    _stage.part = _part_target;
+    _stage.addr = FLASH_CACHE_INVALID_ADDR;
+    _stage.dirty = false;
+  }
+  if (!sector_cache_init(&_stage, ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY)) return false;
+
+  _stage_written = true;
+  return sector_cache_write(&_stage, _part_target->size - factory->size + addr, data, len);
+}
+
+static bool stage_check(void) {
+  if (!_stage_written) return true;
+
+  esp_partition_t const* factory = stage_factory();
+  uint32_t const base = _part_target->size - factory->size;
+
+  uint32_t const app_len = app_image_size(_part_target);
+  if (app_len > base) {
+    TUF2_LOG1("Bundle: app of %lu bytes overlaps the tinyuf2 stage at 0x%08lX", app_len, base);
+    return false;
+  }
+
+  esp_partition_pos_t const pos = { .offset = _part_target->address + base, .size = factory->size };
+  esp_image_metadata_t data;
+  if (ESP_OK != esp_image_verify(ESP_IMAGE_VERIFY_SILENT, &pos, &data)) {
+    TUF2_LOG1("Bundle: staged tinyuf2 image is not valid");
+    return false;
+  }
+
+  return true;
+}
+
+void board_flash_stage_commit(void) {
+  if (!_stage_written) return;
+
+  esp_partition_t const* factory = stage_factory();
+  bootstage_t* bs = (bootstage_t*) (bootloader_common_get_rtc_retain_mem()->custom + BOOTSTAGE_OFFSET);
+
+  bs->src = _part_target->address + _part_target->size - factory->size;
+  bs->dst = factory->address;
+  bs->len = factory->size;
+  bootstage_seal(bs);
+  bootloader_common_update_rtc_retain_mem(NULL, false);
+
+  TUF2_LOG1("Bundle: staged tinyuf2 is installed by the bootloader");
+  esp_restart();
+}
+
+#endif
+
+//--------------------------------------------------------------------+
+// Data LUN: raw ffat partition through a sector cache
+//--------------------------------------------------------------------+
+
+#if TINYUF2_DATA_LUN
+
+#define DATA_LUN_BLOCK_SIZE  512
+
+static sector_cache_t _ffat;
+
+// Sectors unmapped by the host and not yet erased by the flash task, and the one it is erasing
+static uint8_t* _dl_pending;
+static volatile uint32_t _dl_pending_count = 0;
+static volatile uint32_t _dl_erasing = FLASH_CACHE_INVALID_ADDR;
+
+static bool data_lun_init(void) {
+  if (!sector_cache_init(&_ffat, ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_FAT)) return false;
+
+  // without the bitmaps unmap is not supported, the LUN still works
+  if (!_ffat.erased) {
+    uint32_t const bytes = (_ffat.part->size / FLASH_SECTOR_SIZE + 7) / 8;
+    _ffat.erased = calloc(1, bytes);
+    _dl_pending = calloc(1, bytes);
+  }
+  return true;
+}
+
+// Host accesses [addr, addr+len) again: its sectors are no longer to be erased, one erased right
+// now is waited for
+static void data_lun_claim(uint32_t addr, uint32_t len) {
+  if (!_dl_pending || !len) return;
+
+  for (uint32_t sector = addr & ~(FLASH_SECTOR_SIZE - 1); sector < addr + len; sector += FLASH_SECTOR_SIZE) {
+    if (_dl_pending_count) {
+      vTaskSuspendAll();
+      if (sector_bit_get(_dl_pending, sector)) {
+        sector_bit_set(_dl_pending, sector, false);
+        _dl_pending_count--;
+      }
+      xTaskResumeAll();
+    }
+    while (_dl_erasing == sector) vTaskDelay(1);
+  }
+}
+
+uint32_t board_data_lun_block_count(void) {
+  if (!data_lun_init()) return 0;
+  return _ffat.part->size / DATA_LUN_BLOCK_SIZE;
+}
+
+bool board_data_lun_read(uint32_t lba, void* buffer, uint32_t count) {
+  if (!sector_cache_init(&_ffat, ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_FAT)) return false;
+  return sector_cache_read(&_ffat, lba * DATA_LUN_BLOCK_SIZE, buffer, count * DATA_LUN_BLOCK_SIZE);
+}
+
+bool board_data_lun_write(uint32_t lba, void const* buffer, uint32_t count) {
+  if (!data_lun_init()) return false;
+  data_lun_claim(lba * DATA_LUN_BLOCK_SIZE, count * DATA_LUN_BLOCK_SIZE);
+  return sector_cache_write(&_ffat, lba * DATA_LUN_BLOCK_SIZE, buffer, count * DATA_LUN_BLOCK_SIZE);
+}
+
+void board_data_lun_flush(void) {
+  if (_ffat.part) sector_cache_flush(&_ffat);
+}
+
+bool board_data_lun_unmap(uint32_t lba, uint32_t count) {
+  if (!data_lun_init() || !_dl_pending) return false;
+
+  uint32_t const addr = lba * DATA_LUN_BLOCK_SIZE;
+  uint32_t const end = addr + count * DATA_LUN_BLOCK_SIZE;
+  if (end > _ffat.part->size) return false;
+
+  // only whole sectors are erased, data of the others stays as it is
+  uint32_t const first = (addr + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+  uint32_t const last = end & ~(FLASH_SECTOR_SIZE - 1);
+
+  for (uint32_t sector = first; sector < last; sector += FLASH_SECTOR_SIZE) {
+    // cached data of the sector is no longer needed
+    if (_ffat.addr == sector) {
+      _ffat.dirty = false;
+      _ffat.addr = FLASH_CACHE_INVALID_ADDR;
+    }
+    vTaskSuspendAll();
+    if (!sector_bit_get(_ffat.erased, sector) && !sector_bit_get(_dl_pending, sector)) {
+      sector_bit_set(_dl_pending, sector, true);
+      _dl_pending_count++;
+    }
+    xTaskResumeAll();
+  }
+
+  if (_dl_pending_count && _fl_task) xTaskNotifyGive(_fl_task);
+  return true;
+}
+
+static bool unmap_erase_step(void) {
+  if (_dl_pending_count == 0) return false;
+
+  // claim the lowest pending sector, usbd must not write it in between
+  uint32_t sector = FLASH_CACHE_INVALID_ADDR;
+  vTaskSuspendAll();
+  for (uint32_t addr = 0; addr < _ffat.part->size; addr += FLASH_SECTOR_SIZE) {
+    if (sector_bit_get(_dl_pending, addr)) {
+      sector_bit_set(_dl_pending, addr, false);
+      _dl_pending_count--;
+      _dl_erasing = sector = addr;
+      break;
+    }
+  }
+  if (sector == FLASH_CACHE_INVALID_ADDR) _dl_pending_count = 0;
+  xTaskResumeAll();
+
+  if (sector == FLASH_CACHE_INVALID_ADDR) return false;
+
+  // sectors the filesystem never wrote are erased already
+  uint8_t buf[256];
+  if (block_in_use(_ffat.part, sector, FLASH_SECTOR_SIZE, buf, sizeof(buf))) {
+    erase_stats_t stats = { 0 };
+    erase_range(_ffat.part, sector, FLASH_SECTOR_SIZE, &stats);
+  }
+  vTaskSuspendAll();
+  sector_bit_set(_ffat.erased, sector, true);
+  xTaskResumeAll();
+  _dl_erasing = FLASH_CACHE_INVALID_ADDR;
+
+  return _dl_pending_count != 0;
+}
+
+#endif
+
+//--------------------------------------------------------------------+
+// Self Update
+//--------------------------------------------------------------------+
+
+#ifdef TINYUF2_SELF_UPDATE
+
+// A compressed image is first decoded without writing to check its MD5. It is then decoded again
+// and written sector by sector: unchanged sectors are skipped, written ones are read back.
+// UF2 becomes the boot partition only once the whole image is verified, until then a reset runs
+// this self-update app again.
+enum { SELF_UPDATE_SECTOR_SZ = 4096UL };
+
+typedef struct {
+  esp_partition_t const* part;
+  uint32_t len;     // bytes decoded so far
+  uint32_t count;   // bytes in _su_sector
+  uint32_t skipped;
+  bool dry_run;
+  bool failed;
+  md5_context_t md5;
+} self_update_t;
+
+static uint8_t _su_sector[SELF_UPDATE_SECTOR_SZ];
+static uint8_t _su_readback[SELF_UPDATE_SECTOR_SZ];
+
+static bool su_sector_matches(self_update_t* su, uint32_t addr) {
+  return (esp_partition_read(su->part, addr, _su_readback, su->count) == ESP_OK) &&
+         (0 == memcmp(_su_sector, _su_readback, su->count));
+}
+
+static void su_sector_write(self_update_t* su) {
+  if (!su->count) return;
+
+  uint32_t const addr = (su->len - 1) & ~(SELF_UPDATE_SECTOR_SZ - 1);
+  esp_rom_md5_update(&su->md5, _su_sector, su->count);
+
+  if (!su->failed && addr + SELF_UPDATE_SECTOR_SZ > su->part->size) su->failed = true;
+
+  if (!su->failed && !su->dry_run) {
+    if (su_sector_matches(su, addr)) {
+      su->skipped++;
+    } else if (esp_partition_erase_range(su->part, addr, SELF_UPDATE_SECTOR_SZ) != ESP_OK ||
+               esp_partition_write(su->part, addr, _su_sector, su->count) != ESP_OK ||
+               !su_sector_matches(su, addr)) {
+      TUF2_LOG1("Self-update: sector 0x%08lX failed", addr);
+      su->failed = true;
+    }
+  }
+
+  su->count = 0;
+}
+
+static void su_output(uint8_t const* data, uint32_t len, void* arg) {
+  self_update_t* su = (self_update_t*) arg;
+
+  while (len) {
+    uint32_t n = SELF_UPDATE_SECTOR_SZ - su->count;
+    if (n > len) n = len;
+
+    memcpy(_su_sector + su->count, data, n);
+    su->count += n;
+    su->len += n;
+    data += n;
+    len -= n;
+
+    if (su->count == SELF_UPDATE_SECTOR_SZ) su_sector_write(su);
+  }
+}
+
+// Decode (or copy) the whole image through su_output(), false if it is not the expected image
+static bool su_run(self_update_t* su, uint8_t const* bin, uint32_t bin_len, bool dry_run) {
+  decompress_image_t const* hdr = (decompress_image_t const*) bin;
+  bool const compressed = (bin_len >= sizeof(decompress_image_t)) && (hdr->magic == DECOMPRESS_IMAGE_MAGIC);
+
+  su->len = su->count = su->skipped = 0;
+  su->dry_run = dry_run;
+  su->failed = false;
+  esp_rom_md5_init(&su->md5);
+
+  if (compressed) {
+    decompress_init();
+    decompress_feed(bin + sizeof(decompress_image_t), bin_len - sizeof(decompress_image_t), su_output, su);
+  } else {
+    su_output(bin, bin_len, su);
+  }
+  su_sector_write(su);
+
+  uint8_t digest[ESP_ROM_MD5_DIGEST_LEN];
+  esp_rom_md5_final(digest, &su->md5);
+
+  return !su->failed && (!compressed || (su->len == hdr->len && 0 == memcmp(digest, hdr->md5, sizeof(digest))));
+}
+
+void board_self_update(const uint8_t * bootloader_bin, uint32_t bootloader_len) {
+  self_update_t su = { 0 };
+
+  su.part = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_FACTORY, NULL);
+  assert(su.part != NULL);
+
+  decompress_image_t const* hdr = (decompress_image_t const*) bootloader_bin;
+  bool const compressed = (bootloader_len >= sizeof(decompress_image_t)) && (hdr->magic == DECOMPRESS_IMAGE_MAGIC);
+
+  // nothing is written for an image that can not be decoded here or is corrupted
+  if ((!compressed && bootloader_len > su.part->size) ||
+      (compressed && (hdr->window_bits != CFG_UF2_HEATSHRINK_WINDOW_BITS ||
+                      hdr->lookahead_bits != CFG_UF2_HEATSHRINK_LOOKAHEAD_BITS)) ||
+      (compressed && !su_run(&su, bootloader_bin, bootloader_len, true))) {
+    TUF2_LOG1("Self-update: image rejected");
+    while (1) {}
+  }
+
+  if (!su_run(&su, bootloader_bin, bootloader_len, false)) {
+    // keep booting this app, next reset retries
+    TUF2_LOG1("Self-update: verify failed, bootloader not switched");
+    esp_restart();
+  }
 
-  // Write new bootloader
-  esp_partition_write(_part_uf2, 0, bootloader_bin, bootloader_len);
+  TUF2_LOG1("Self-update: %lu sectors unchanged", su.skipped);
 
   // Set UF2 as next boot and restart
-  esp_ota_set_boot_partition(_part_uf2);
+  esp_ota_set_boot_partition(su.part);
   esp_restart();
 }
 #endif
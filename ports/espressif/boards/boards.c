@@ -22,6 +22,7 @@
  * THE SOFTWARE.
  */
 
+#include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
@@ -35,6 +36,7 @@
 #include "esp_ota_ops.h"
 #include "esp_mac.h"
 #include "esp_timer.h"
+#include "esp_heap_caps.h"
 #include "esp_rom_gpio.h"
 
 #include "driver/gpio.h"
@@ -63,6 +65,17 @@ void dotstar_init(void);
 void dotstar_write(uint8_t const rgb[]);
 #endif
 
+#if defined(NEOPIXEL_PIN) || defined(DOTSTAR_PIN_DATA)
+// latest requested and last transmitted color as 0xRRGGBB, RGB_NONE before the first write
+#define RGB_NONE  UINT32_MAX
+static volatile uint32_t _rgb_pending = RGB_NONE;
+static uint32_t _rgb_sent = RGB_NONE;
+
+// transmits indicator color in DFU mode, NULL before tasks are started
+static TaskHandle_t rgb_task_hdl;
+static void rgb_refresh(void);
+#endif
+
 #if defined(TCA9554_ADDR) || defined(AW9523_ADDR)
 #include "esp_err.h"
 #include "driver/i2c.h"
@@ -78,12 +91,29 @@ ledc_channel_config_t ledc_channel = {
   .hpoint     = 0,
   .timer_sel  = LEDC_TIMER_0
 };
+
+// LEDC fades the duty in hardware, timer only reverses the direction once per ramp
+static esp_timer_handle_t led_fade_timer_hdl;
+static uint32_t led_fade_ms;
+static bool led_fade_up;
+
+static void led_fade_timer_cb(void* arg) {
+  (void) arg;
+  led_fade_up = !led_fade_up;
+  ledc_set_fade_time_and_start(ledc_channel.speed_mode, ledc_channel.channel, led_fade_up ? 255 : 0,
+                               led_fade_ms, LEDC_FADE_NO_WAIT);
+}
 #endif
 
 #ifdef DISPLAY_PIN_SCK
 #include "lcd.h"
 #endif
 
+#ifdef OLED_PIN_SDA
+#include <stdio.h>
+#include "ssd1306.h"
+#endif
+
 #if BOARD_INIT_CUSTOM
 extern bool board_init_extension();
 #endif
@@ -102,18 +132,415 @@ void app_main(void) {
 }
 #else
 
+// Scheduling model in DFU mode, highest priority first:
+// - usbd: woken by the USB interrupt through the tinyusb event queue, blocks while both write windows are busy
+// - flash_wr: erase & program, each erase slice (FLASH_ERASE_SLICE) bounds how long usbd can be held off
+// - flash_ra: read-ahead for sequential READ10
+// - main (display, deferred log) and rgb: idle priority, only run while all of the above wait
+// Stack sizes are in bytes, increase USBD_STACK_SIZE when debug log is enabled
+#ifndef USBD_TASK_PRIORITY
+#define USBD_TASK_PRIORITY         (configMAX_PRIORITIES - 1)
+#endif
+
+#ifndef FLASH_WRITE_TASK_PRIORITY
+#define FLASH_WRITE_TASK_PRIORITY  (configMAX_PRIORITIES - 2)
+#endif
+
+#ifndef READ_AHEAD_TASK_PRIORITY
+#define READ_AHEAD_TASK_PRIORITY   (configMAX_PRIORITIES - 3)
+#endif
+
+#ifndef MAIN_TASK_PRIORITY
+#define MAIN_TASK_PRIORITY         tskIDLE_PRIORITY
+#endif
+
+#ifndef RGB_TASK_PRIORITY
+#define RGB_TASK_PRIORITY          tskIDLE_PRIORITY
+#endif
+
 // static task for usbd
-// Increase stack size when debug log is enabled
+#ifndef USBD_STACK_SIZE
 #define USBD_STACK_SIZE     (4*1024)
+#endif
 
 static StackType_t usb_device_stack[USBD_STACK_SIZE];
 static StaticTask_t usb_device_taskdef;
 
+// static task for flash read-ahead
+#ifndef READ_AHEAD_STACK_SIZE
+#define READ_AHEAD_STACK_SIZE  (2*1024)
+#endif
+
+static StackType_t read_ahead_stack[READ_AHEAD_STACK_SIZE];
+static StaticTask_t read_ahead_taskdef;
+
+// static task for background flash erase & program
+#ifndef FLASH_WRITE_STACK_SIZE
+#define FLASH_WRITE_STACK_SIZE  (3*1024)
+#endif
+
+static StackType_t flash_write_stack[FLASH_WRITE_STACK_SIZE];
+static StaticTask_t flash_write_taskdef;
+
+#if BOARD_FLASH_SCRUB
+// static task hashing ota0 in idle time, mbedtls sha256 contexts are static
+#ifndef SCRUB_STACK_SIZE
+#define SCRUB_STACK_SIZE  (2*1024)
+#endif
+
+static StackType_t scrub_stack[SCRUB_STACK_SIZE];
+static StaticTask_t scrub_taskdef;
+#endif
+
+// TUF2_STATS_TASK_* order, for board_task_info()
+static TaskHandle_t task_hdl[TUF2_STATS_TASK_COUNT];
+
+#if defined(NEOPIXEL_PIN) || defined(DOTSTAR_PIN_DATA)
+// static task for transmitting the RGB indicator
+#ifndef RGB_STACK_SIZE
+#define RGB_STACK_SIZE  (2*1024)
+#endif
+
+static StackType_t rgb_stack[RGB_STACK_SIZE];
+static StaticTask_t rgb_taskdef;
+
+// Idle priority, the waits for RMT/SPI to finish never delay usbd or flash tasks
+static void rgb_task(void* param) {
+  (void) param;
+
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    rgb_refresh();
+  }
+}
+#endif
+
+#ifdef OLED_PIN_SDA
+// SSD1306 status display on its own I2C bus (I2C_NUM_0 of the component), not shared with an I/O expander
+#ifndef OLED_PIN_RESET
+#define OLED_PIN_RESET  (-1)
+#endif
+
+#ifndef OLED_I2C_ADDR
+#define OLED_I2C_ADDR   I2CAddress
+#endif
+
+#ifndef OLED_HEIGHT
+#define OLED_HEIGHT     64
+#endif
+
+#ifndef OLED_STACK_SIZE
+#define OLED_STACK_SIZE  (3*1024)
+#endif
+
+// pages of 8 rows: state, serial, progress percentage and bar
+#define OLED_PAGE_STATE     0
+#define OLED_PAGE_SERIAL    1
+#define OLED_PAGE_PERCENT   2
+#define OLED_PAGE_BAR       3
+
+static StackType_t oled_stack[OLED_STACK_SIZE];
+static StaticTask_t oled_taskdef;
+static TaskHandle_t oled_task_hdl;
+
+static SSD1306_t _oled;
+static uint8_t _oled_frame[OLED_HEIGHT / 8 * 128];
+
+// latest status, percentage of the transfer or -1 while not writing
+static volatile uint32_t _oled_state = STATE_BOOTLOADER_STARTED;
+static volatile int32_t _oled_percent = -1;
+
+static void oled_render(void) {
+  static char const* const state_text[] = {
+    [STATE_BOOTLOADER_STARTED] = "TinyUF2",
+    [STATE_USB_PLUGGED]        = "USB connected",
+    [STATE_USB_UNPLUGGED]      = "USB unplugged",
+    [STATE_WRITING_STARTED]    = "Flashing",
+    [STATE_WRITING_FINISHED]   = "Done",
+  };
+  uint32_t const state = _oled_state;
+  int32_t const percent = _oled_percent;
+  char line[17];
+
+  ssd1306_frame_text(&_oled, _oled_frame, OLED_PAGE_STATE,
+                     (state < TU_ARRAY_SIZE(state_text)) ? state_text[state] : "", true);
+
+  uint8_t serial_id[16];
+  uint8_t const serial_len = board_usb_get_serial(serial_id);
+  uint32_t n = 0;
+  for (uint8_t i = 0; i < serial_len && n + 2 < sizeof(line); i++) n += snprintf(line + n, 3, "%02X", serial_id[i]);
+  line[n] = '\0';
+  ssd1306_frame_text(&_oled, _oled_frame, OLED_PAGE_SERIAL, line, false);
+
+  if (percent < 0) {
+    line[0] = '\0';
+  } else {
+    snprintf(line, sizeof(line), "%3ld%%", (long) percent);
+  }
+  ssd1306_frame_text(&_oled, _oled_frame, OLED_PAGE_PERCENT, line, false);
+
+  // outlined bar, filled up to the percentage
+  uint8_t* bar = &_oled_frame[OLED_PAGE_BAR * 128];
+  uint32_t const fill = (percent < 0) ? 0 : (uint32_t) percent * 128 / 100;
+  for (uint32_t x = 0; x < 128; x++) {
+    bar[x] = (percent < 0) ? 0x00 : (x < fill || x == 0 || x == 127) ? 0x7E : 0x42;
+  }
+}
+
+// Idle priority: I2C transfers of the display never delay usbd or flash tasks. Only pages that changed
+// are sent, state and progress changes meanwhile are coalesced into the next frame
+static void oled_task(void* param) {
+  (void) param;
+
+  i2c_master_init(&_oled, OLED_PIN_SDA, OLED_PIN_SCL, OLED_PIN_RESET, OLED_I2C_ADDR);
+  ssd1306_init(&_oled, 128, OLED_HEIGHT);
+  ssd1306_clear_screen(&_oled, false);
+
+  while (1) {
+    oled_render();
+    ssd1306_update_frame(&_oled, _oled_frame);
+
+    vTaskDelay(pdMS_TO_TICKS(TINYUF2_DISPLAY_PROGRESS_MS));
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  }
+}
+
+void board_status_state(uint32_t state) {
+  _oled_state = state;
+  if (state == STATE_USB_PLUGGED || state == STATE_USB_UNPLUGGED) _oled_percent = -1;
+  if (oled_task_hdl) xTaskNotifyGive(oled_task_hdl);
+}
+
+// called for every WRITE10, the task is only woken when the percentage changes
+void board_status_progress(uint32_t written, uint32_t total) {
+  int32_t const percent = total ? (int32_t) ((uint64_t) written * 100 / total) : 0;
+  if (percent == _oled_percent) return;
+
+  _oled_percent = percent;
+  if (oled_task_hdl) xTaskNotifyGive(oled_task_hdl);
+}
+#endif
+
+#ifdef EPD_PIN_SCK
+// E-paper status display (MagTag): keeps its image without power, so the full refresh of a DFU entry is
+// skipped if the panel still shows the frame it would draw (bootscreen.h). Later changes only refresh
+// the band of rows that differs
+#ifdef OLED_PIN_SDA
+  #error "OLED_PIN_SDA and EPD_PIN_SCK both implement the status display"
+#endif
+
+#include <stdio.h>
+#include "esp_rom_crc.h"
+#include "epd.h"
+
+#ifndef EPD_SPI_HOST
+#define EPD_SPI_HOST     SPI2_HOST
+#endif
+
+#ifndef EPD_STACK_SIZE
+#define EPD_STACK_SIZE   (3*1024)
+#endif
+
+// progress is drawn in steps, each partial refresh takes the panel about a second
+#ifndef EPD_PROGRESS_STEP
+#define EPD_PROGRESS_STEP  10
+#endif
+
+// wait for the state to settle before the first frame, e.g USB enumerates right after DFU entry
+#ifndef EPD_SETTLE_MS
+#define EPD_SETTLE_MS    1000
+#endif
+
+// landscape rows of the lines, state and percentage at scale 2
+#define EPD_ROW_STATE     8
+#define EPD_ROW_SERIAL    40
+#define EPD_ROW_PERCENT   64
+#define EPD_ROW_BAR       96
+#define EPD_BAR_HEIGHT    16
+
+static StackType_t epd_stack[EPD_STACK_SIZE];
+static StaticTask_t epd_taskdef;
+static TaskHandle_t epd_task_hdl;
+
+static epd_t _epd;
+static uint8_t _epd_frame[EPD_FRAME_SIZE];
+static uint8_t _epd_shown[EPD_FRAME_SIZE];
+
+static volatile uint32_t _epd_state = STATE_BOOTLOADER_STARTED;
+static volatile int32_t _epd_percent = -1;
+
+#if CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC
+#include "bootloader_common.h"
+#include "bootscreen.h"
+
+_Static_assert(BOOTSCREEN_OFFSET >= UF2_HANDOFF_OFFSET + sizeof(uf2_handoff_t) &&
+               BOOTSCREEN_OFFSET + sizeof(bootscreen_t) <= CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE,
+               "bootscreen_t does not fit reserved RTC memory");
+
+static bootscreen_t* epd_record(void) {
+  return (bootscreen_t*) (bootloader_common_get_rtc_retain_mem()->custom + BOOTSCREEN_OFFSET);
+}
+
+static bool epd_record_match(uint32_t hash) {
+  bootscreen_t const* rec = epd_record();
+  return bootscreen_valid(rec) && rec->hash == hash;
+}
+
+// cleared while the panel changes, a reset halfway through must not trust the old hash
+static void epd_record_store(bool valid, uint32_t hash) {
+  if (valid) {
+    bootscreen_set(epd_record(), hash);
+  } else {
+    bootscreen_clear(epd_record());
+  }
+  bootloader_common_update_rtc_retain_mem(NULL, false);
+}
+#else
+static bool epd_record_match(uint32_t hash) {
+  (void) hash;
+  return false;
+}
+
+static void epd_record_store(bool valid, uint32_t hash) {
+  (void) valid;
+  (void) hash;
+}
+#endif
+
+static void epd_render(void) {
+  static char const* const state_text[] = {
+    [STATE_BOOTLOADER_STARTED] = "TinyUF2",
+    [STATE_USB_PLUGGED]        = "USB connected",
+    [STATE_USB_UNPLUGGED]      = "USB unplugged",
+    [STATE_WRITING_STARTED]    = "Flashing",
+    [STATE_WRITING_FINISHED]   = "Done",
+  };
+  uint32_t const state = _epd_state;
+  int32_t const percent = _epd_percent;
+  char line[EPD_WIDTH / 8 + 1];
+
+  epd_frame_clear(_epd_frame);
+  epd_frame_text(_epd_frame, 8, EPD_ROW_STATE, (state < TU_ARRAY_SIZE(state_text)) ? state_text[state] : "", 2);
+
+  uint8_t serial_id[16];
+  uint8_t const serial_len = board_usb_get_serial(serial_id);
+  uint32_t n = 0;
+  for (uint8_t i = 0; i < serial_len && n + 2 < sizeof(line); i++) n += snprintf(line + n, 3, "%02X", serial_id[i]);
+  line[n] = '\0';
+  epd_frame_text(_epd_frame, 8, EPD_ROW_SERIAL, line, 1);
+
+  if (percent < 0) return;
+
+  snprintf(line, sizeof(line), "%3ld%%", (long) percent);
+  epd_frame_text(_epd_frame, 8, EPD_ROW_PERCENT, line, 2);
+
+  // outlined bar, filled up to the percentage
+  int const bar_w = EPD_WIDTH - 16;
+  epd_frame_fill(_epd_frame, 8, EPD_ROW_BAR, bar_w, EPD_BAR_HEIGHT, true);
+  epd_frame_fill(_epd_frame, 9, EPD_ROW_BAR + 1, bar_w - 2, EPD_BAR_HEIGHT - 2, false);
+  epd_frame_fill(_epd_frame, 8, EPD_ROW_BAR, bar_w * percent / 100, EPD_BAR_HEIGHT, true);
+}
+
+// first and last landscape row that differ from the panel, false if none
+static bool epd_changed_rows(int* y0, int* y1) {
+  int const row_bytes = EPD_SOURCES / 8;
+  int lo = row_bytes, hi = -1;
+
+  for (int i = 0; i < EPD_FRAME_SIZE; i++) {
+    if (_epd_frame[i] == _epd_shown[i]) continue;
+    int const b = i % row_bytes;
+    if (b < lo) lo = b;
+    if (b > hi) hi = b;
+  }
+
+  *y0 = lo * 8;
+  *y1 = hi * 8 + 7;
+  return hi >= 0;
+}
+
+// Idle priority, SPI and busy polling never delay usbd or flash tasks. State and progress changes during
+// a refresh (about a second partial, a few seconds full) are coalesced into the next frame
+static void epd_task(void* param) {
+  (void) param;
+
+  spi_bus_config_t bus_cfg = {
+    .miso_io_num     = EPD_PIN_MISO,
+    .mosi_io_num     = EPD_PIN_MOSI,
+    .sclk_io_num     = EPD_PIN_SCK,
+    .quadwp_io_num   = -1,
+    .quadhd_io_num   = -1,
+    .max_transfer_sz = EPD_FRAME_SIZE
+  };
+  ESP_ERROR_CHECK(spi_bus_initialize(EPD_SPI_HOST, &bus_cfg, SPI_DMA_CH_AUTO));
+  ESP_ERROR_CHECK(epd_init(&_epd, EPD_SPI_HOST, EPD_PIN_CS, EPD_PIN_DC, EPD_PIN_RST, EPD_PIN_BUSY));
+
+  vTaskDelay(pdMS_TO_TICKS(EPD_SETTLE_MS));
+
+  epd_render();
+  uint32_t hash = esp_rom_crc32_le(0, _epd_frame, EPD_FRAME_SIZE);
+  if (epd_record_match(hash)) {
+    TUF2_LOG1("EPD: screen unchanged, no refresh\r\n");
+  } else {
+    epd_record_store(false, 0);
+    epd_refresh_full(&_epd, _epd_frame);
+    epd_wait(&_epd);
+    epd_record_store(true, hash);
+  }
+  memcpy(_epd_shown, _epd_frame, EPD_FRAME_SIZE);
+
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    epd_render();
+    int y0, y1;
+    if (!epd_changed_rows(&y0, &y1)) continue;
+
+    hash = esp_rom_crc32_le(0, _epd_frame, EPD_FRAME_SIZE);
+    epd_record_store(false, 0);
+    epd_refresh_rows(&_epd, _epd_shown, _epd_frame, y0, y1);
+    epd_record_store(true, hash);
+    memcpy(_epd_shown, _epd_frame, EPD_FRAME_SIZE);
+  }
+}
+
+void board_status_state(uint32_t state) {
+  _epd_state = state;
+  if (state == STATE_USB_PLUGGED || state == STATE_USB_UNPLUGGED) _epd_percent = -1;
+  if (epd_task_hdl) xTaskNotifyGive(epd_task_hdl);
+}
+
+// called for every WRITE10, the task is only woken every EPD_PROGRESS_STEP percent
+void board_status_progress(uint32_t written, uint32_t total) {
+  int32_t percent = total ? (int32_t) ((uint64_t) written * 100 / total) : 0;
+  percent -= percent % EPD_PROGRESS_STEP;
+  if (percent == _epd_percent) return;
+
+  _epd_percent = percent;
+  if (epd_task_hdl) xTaskNotifyGive(epd_task_hdl);
+}
+#endif
+
+// Dual core (S3): flash erase/program/verify and read-ahead run on the APP CPU, usbd and the USB interrupt
+// (allocated by tusb_init() in main) stay on the PRO CPU. Flash tasks then never compete with usbd for CPU
+// time. While a flash operation is actually in progress IDF still parks the other CPU with cache disabled
+#if CONFIG_FREERTOS_UNICORE
+  #define USBD_CORE   tskNO_AFFINITY
+  #define FLASH_CORE  tskNO_AFFINITY
+#else
+  #define USBD_CORE   PRO_CPU_NUM
+  #define FLASH_CORE  APP_CPU_NUM
+#endif
+
 // USB Device Driver task
 // This top level thread process all usb events and invoke callbacks
 void usb_device_task(void* param) {
   (void) param;
 
+  // started by board_dfu_init(), shortly before main() calls tud_init()
+  while (!tud_inited()) {
+    vTaskDelay(1);
+  }
+
   // RTOS forever loop
   while (1) {
     tud_task();
@@ -122,19 +549,83 @@ void usb_device_task(void* param) {
 
 void app_main(void) {
   main();
+}
+
+// Tasks are started in DFU mode only, before tud_init(): main task (idle priority) then continues
+// with flash, uf2 and display init while usbd already answers the host
+static void start_tasks(void) {
+  task_hdl[TUF2_STATS_TASK_MAIN] = xTaskGetCurrentTaskHandle();
+  vTaskPrioritySet(NULL, MAIN_TASK_PRIORITY);
+
+  // Create a task for erasing & programming flash while usbd keeps receiving uf2 blocks.
+  // Lower priority than usbd, which sleeps in board_flash_write_wait() while both write windows are busy
+  task_hdl[TUF2_STATS_TASK_FLASH_WRITE] =
+    xTaskCreateStaticPinnedToCore(board_flash_write_task, "flash_wr", FLASH_WRITE_STACK_SIZE, NULL,
+                                  FLASH_WRITE_TASK_PRIORITY, flash_write_stack, &flash_write_taskdef, FLASH_CORE);
 
   // Create a task for tinyusb device stack
-  (void) xTaskCreateStatic(usb_device_task, "usbd", USBD_STACK_SIZE, NULL, configMAX_PRIORITIES - 2, usb_device_stack,
-                           &usb_device_taskdef);
+  task_hdl[TUF2_STATS_TASK_USBD] =
+    xTaskCreateStaticPinnedToCore(usb_device_task, "usbd", USBD_STACK_SIZE, NULL, USBD_TASK_PRIORITY,
+                                  usb_device_stack, &usb_device_taskdef, USBD_CORE);
+
+  // Create a task for reading flash ahead of sequential READ10, lower priority than usbd
+  task_hdl[TUF2_STATS_TASK_READ_AHEAD] =
+    xTaskCreateStaticPinnedToCore(board_flash_read_ahead_task, "flash_ra", READ_AHEAD_STACK_SIZE, NULL,
+                                  READ_AHEAD_TASK_PRIORITY, read_ahead_stack, &read_ahead_taskdef, FLASH_CORE);
+
+#if BOARD_FLASH_SCRUB
+  // Create a task hashing ota0 while the host leaves the device alone, idle priority like main
+  xTaskCreateStaticPinnedToCore(board_flash_scrub_task, "scrub", SCRUB_STACK_SIZE, NULL, tskIDLE_PRIORITY,
+                                scrub_stack, &scrub_taskdef, FLASH_CORE);
+#endif
+
+#if defined(NEOPIXEL_PIN) || defined(DOTSTAR_PIN_DATA)
+  // Create a task for RGB indicator updates, board_rgb_write() then only queues the color
+  rgb_task_hdl = xTaskCreateStaticPinnedToCore(rgb_task, "rgb", RGB_STACK_SIZE, NULL, RGB_TASK_PRIORITY,
+                                               rgb_stack, &rgb_taskdef, USBD_CORE);
+#endif
+
+#ifdef OLED_PIN_SDA
+  // Create a task for the status display, it also initializes the panel so that main does not wait for I2C
+  oled_task_hdl = xTaskCreateStaticPinnedToCore(oled_task, "oled", OLED_STACK_SIZE, NULL, MAIN_TASK_PRIORITY,
+                                                oled_stack, &oled_taskdef, USBD_CORE);
+#endif
+
+#ifdef EPD_PIN_SCK
+  // Create a task for the e-paper status display, refreshes take seconds and only poll the busy pin
+  epd_task_hdl = xTaskCreateStaticPinnedToCore(epd_task, "epd", EPD_STACK_SIZE, NULL, MAIN_TASK_PRIORITY,
+                                               epd_stack, &epd_taskdef, USBD_CORE);
+#endif
 }
 
 #endif
 
+//--------------------------------------------------------------------+
+// Timing markers
+//--------------------------------------------------------------------+
+#ifdef PIN_PERF_MARKER
+static void perf_marker_init(void) {
+  gpio_reset_pin(PIN_PERF_MARKER);
+  gpio_set_direction(PIN_PERF_MARKER, GPIO_MODE_OUTPUT);
+  gpio_set_level(PIN_PERF_MARKER, 0);
+}
+
+// a single out_w1ts / out_w1tc write, ids outside CFG_UF2_PERF_MARKER_IDS leave the pin alone
+void board_perf_marker(uint32_t id, bool on) {
+  if (id < 32 && (CFG_UF2_PERF_MARKER_IDS & (1UL << id))) gpio_ll_set_level(&GPIO, PIN_PERF_MARKER, on);
+}
+#endif
+
 //--------------------------------------------------------------------+
 // Board API
 //--------------------------------------------------------------------+
 
 void board_init(void) {
+#ifdef PIN_PERF_MARKER
+  // the pulse of BOOTLOG_MAIN comes before this and is lost
+  perf_marker_init();
+#endif
+
 // Peripheral control through I2C Expander
 #if defined(TCA9554_ADDR) || defined(AW9523_ADDR)
   int i2c_num = I2C_MASTER_NUM;
@@ -215,6 +706,10 @@ void board_init(void) {
   };
   ledc_timer_config(&ledc_timer);
   ledc_channel_config(&ledc_channel);
+  ledc_fade_func_install(0);
+
+  const esp_timer_create_args_t fade_timer_args = { .callback = led_fade_timer_cb, .name = "led_fade" };
+  esp_timer_create(&fade_timer_args, &led_fade_timer_hdl);
 #endif
 
 #ifdef NEOPIXEL_PIN
@@ -267,6 +762,10 @@ void board_dfu_init(void) {
   };
   usb_hal_init(&hal);
   configure_pins(&hal);
+
+#ifndef TINYUF2_SELF_UPDATE
+  start_tasks();
+#endif
 }
 
 void board_reset(void) {
@@ -274,8 +773,17 @@ void board_reset(void) {
 }
 
 void board_dfu_complete(void) {
-  // Set partition OTA0 as bootable and reset
-  esp_ota_set_boot_partition(esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, NULL));
+#if CFG_UF2_WEAR
+  // counters are written once per update rather than per erase
+  board_flash_wear_save();
+#endif
+
+  // Set written partition as bootable and reset
+  board_flash_set_boot();
+#ifdef BOARD_UF2_STAGE_FAMILY
+  // tinyuf2 of a bundle is installed by the bootloader after this reset, app is already bootable
+  board_flash_stage_commit();
+#endif
   esp_restart();
 }
 
@@ -283,8 +791,12 @@ bool board_app_valid(void) {
   // // esp32s2 is always enter DFU mode
   // return false;
 
+#if BOARD_APP_CHECK
+  return board_flash_app_check();
+#else
   // it is engineers' responsibility to check if application is valid
   return true;
+#endif
 }
 
 void board_app_jump(void) {
@@ -307,7 +819,49 @@ void board_led_write(uint32_t value) {
 #endif
 }
 
+// Without LED_PIN there is nothing to fade, RGB stays constant in fading states
+bool board_led_fade(uint32_t ramp_ms) {
+  (void) ramp_ms;
+
+#ifdef LED_PIN
+  esp_timer_stop(led_fade_timer_hdl);
+  ledc_fade_stop(ledc_channel.speed_mode, ledc_channel.channel);
+
+  led_fade_ms = ramp_ms;
+  if (ramp_ms) {
+    led_fade_up = false;
+    led_fade_timer_cb(NULL);
+    esp_timer_start_periodic(led_fade_timer_hdl, ramp_ms * 1000);
+  }
+#endif
+
+  return true;
+}
+
+// Color is only queued here once the RGB task runs: called from the 25 ms timer while writing,
+// transmitting must not add latency there. Consecutive writes of the same color are coalesced
 void board_rgb_write(uint8_t const rgb[]) {
+#if defined(NEOPIXEL_PIN) || defined(DOTSTAR_PIN_DATA)
+  _rgb_pending = ((uint32_t) rgb[0] << 16) | ((uint32_t) rgb[1] << 8) | rgb[2];
+
+  if (rgb_task_hdl) {
+    xTaskNotifyGive(rgb_task_hdl);
+  } else {
+    rgb_refresh();
+  }
+#else
+  (void) rgb[0];
+#endif
+}
+
+#if defined(NEOPIXEL_PIN) || defined(DOTSTAR_PIN_DATA)
+static void rgb_refresh(void) {
+  uint32_t const color = _rgb_pending;
+  if (color == _rgb_sent) return;
+  _rgb_sent = color;
+
+  uint8_t const rgb[3] = { (uint8_t) (color >> 16), (uint8_t) (color >> 8), (uint8_t) color };
+
 #ifdef NEOPIXEL_PIN
   uint32_t const r = (rgb[0] * NEOPIXEL_BRIGHTNESS) >> 8;
   uint32_t const g = (rgb[1] * NEOPIXEL_BRIGHTNESS) >> 8;
@@ -323,6 +877,7 @@ void board_rgb_write(uint8_t const rgb[]) {
   dotstar_write(rgb);
 #endif
 }
+#endif
 
 //--------------------------------------------------------------------+
 // Timer
@@ -342,6 +897,158 @@ void board_timer_stop(void) {
   esp_timer_stop(timer_hdl);
 }
 
+uint32_t board_millis(void) {
+  return (uint32_t) (esp_timer_get_time() / 1000);
+}
+
+uint32_t board_micros(void) {
+  return (uint32_t) esp_timer_get_time();
+}
+
+void board_heap_info(uint32_t* size, uint32_t* used_max) {
+  *size = (uint32_t) heap_caps_get_total_size(MALLOC_CAP_DEFAULT);
+  *used_max = *size - (uint32_t) heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+}
+
+#ifdef BOARD_SUPPLY_ADC_CHANNEL
+#include "esp_adc/adc_oneshot.h"
+#include "esp_adc/adc_cali_scheme.h"
+
+// Supply through a divider on an ADC1 pin, ratio of supply to pin voltage
+#ifndef BOARD_SUPPLY_DIVIDER
+#define BOARD_SUPPLY_DIVIDER  2
+#endif
+
+static adc_oneshot_unit_handle_t supply_adc_hdl;
+static adc_cali_handle_t supply_cali_hdl;
+
+// Set up on first use by the flash task, readings are only trusted with eFuse calibration
+uint32_t board_supply_mv(void) {
+  if (supply_adc_hdl == NULL) {
+    adc_oneshot_unit_init_cfg_t const unit_cfg = { .unit_id = ADC_UNIT_1 };
+    adc_oneshot_chan_cfg_t const chan_cfg = { .atten = ADC_ATTEN_DB_11, .bitwidth = ADC_BITWIDTH_DEFAULT };
+    if (ESP_OK != adc_oneshot_new_unit(&unit_cfg, &supply_adc_hdl)) return 0;
+    adc_oneshot_config_channel(supply_adc_hdl, BOARD_SUPPLY_ADC_CHANNEL, &chan_cfg);
+
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+    adc_cali_curve_fitting_config_t const cali_cfg = { .unit_id = ADC_UNIT_1, .chan = BOARD_SUPPLY_ADC_CHANNEL,
+                                                      .atten = ADC_ATTEN_DB_11, .bitwidth = ADC_BITWIDTH_DEFAULT };
+    if (ESP_OK != adc_cali_create_scheme_curve_fitting(&cali_cfg, &supply_cali_hdl)) supply_cali_hdl = NULL;
+#else
+    adc_cali_line_fitting_config_t const cali_cfg = { .unit_id = ADC_UNIT_1, .atten = ADC_ATTEN_DB_11,
+                                                     .bitwidth = ADC_BITWIDTH_DEFAULT };
+    if (ESP_OK != adc_cali_create_scheme_line_fitting(&cali_cfg, &supply_cali_hdl)) supply_cali_hdl = NULL;
+#endif
+  }
+
+  int raw;
+  int mv;
+  if (supply_cali_hdl == NULL || ESP_OK != adc_oneshot_read(supply_adc_hdl, BOARD_SUPPLY_ADC_CHANNEL, &raw) ||
+      ESP_OK != adc_cali_raw_to_voltage(supply_cali_hdl, raw, &mv)) {
+    return 0;
+  }
+  return (uint32_t) mv * BOARD_SUPPLY_DIVIDER;
+}
+#endif
+
+#ifdef BOARD_SERIAL_EFUSE
+#include "esp_efuse.h"
+
+// First bit of the serial number in the eFuse user data block (BLOCK3), 48 bits. The custom MAC
+// (ESP_EFUSE_USER_DATA_MAC_CUSTOM) is at the end of the block
+#ifndef BOARD_SERIAL_EFUSE_BIT
+#define BOARD_SERIAL_EFUSE_BIT  0
+#endif
+
+static esp_efuse_desc_t const serial_efuse = { EFUSE_BLK_USER_DATA, BOARD_SERIAL_EFUSE_BIT, 48 };
+static esp_efuse_desc_t const* const serial_efuse_field[] = { &serial_efuse, NULL };
+
+// Unburnt bits read as zero, a serial number starts with its hardware identifier character
+bool board_serial_read(uint8_t serial[6]) {
+  static uint8_t const none[6] = { 0 };
+  if (ESP_OK != esp_efuse_read_field_blob(serial_efuse_field, serial, 48)) return false;
+  return 0 != memcmp(serial, none, sizeof(none));
+}
+
+// Burnt once, read back so that a partial burn is not taken as done. Another serial number can not
+// be stored after that
+bool board_serial_write(uint8_t const serial[6]) {
+  uint8_t stored[6];
+  if (board_serial_read(stored)) return 0 == memcmp(stored, serial, sizeof(stored));
+  if (ESP_OK != esp_efuse_write_field_blob(serial_efuse_field, serial, 48)) return false;
+  return board_serial_read(stored) && 0 == memcmp(stored, serial, sizeof(stored));
+}
+#endif
+
+#ifndef TINYUF2_SELF_UPDATE
+// CPU time needs CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS (esp_timer clock, microseconds) and
+// CONFIG_FREERTOS_USE_TRACE_FACILITY, the stack minimum is always available
+void board_task_info(uint32_t run_ms[TUF2_STATS_TASK_COUNT], uint32_t stack_free[TUF2_STATS_TASK_COUNT]) {
+  for (uint32_t i = 0; i < TUF2_STATS_TASK_COUNT; i++) {
+    if (task_hdl[i] == NULL) continue;
+#if configGENERATE_RUN_TIME_STATS && configUSE_TRACE_FACILITY
+    TaskStatus_t status;
+    vTaskGetInfo(task_hdl[i], &status, pdFALSE, eInvalid);
+    run_ms[i] = (uint32_t) (status.ulRunTimeCounter / 1000);
+#else
+    (void) run_ms;
+#endif
+    stack_free[i] = (uint32_t) uxTaskGetStackHighWaterMark(task_hdl[i]);
+  }
+}
+#endif
+
+//--------------------------------------------------------------------+
+// Boot log
+//--------------------------------------------------------------------+
+#if CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC
+#include "bootloader_common.h"
+
+// bootloader starts the log in reserved RTC memory, see bootloader_start.c
+_Static_assert(sizeof(bootlog_t) <= CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE, "bootlog_t does not fit reserved RTC memory");
+
+void board_bootlog_mark(uint32_t stage) {
+  bootlog_add((bootlog_t*) bootloader_common_get_rtc_retain_mem()->custom, stage, (uint32_t) esp_timer_get_time());
+
+  // keep crc of retained memory valid, bootloader clears it otherwise
+  bootloader_common_update_rtc_retain_mem(NULL, false);
+}
+
+bootlog_t const* board_bootlog(void) {
+  return (bootlog_t const*) bootloader_common_get_rtc_retain_mem()->custom;
+}
+
+//--------------------------------------------------------------------+
+// Handoff
+//--------------------------------------------------------------------+
+
+// application places the handoff block after the boot log, see handoff.h
+_Static_assert(UF2_HANDOFF_OFFSET >= sizeof(bootlog_t) &&
+               UF2_HANDOFF_OFFSET + sizeof(uf2_handoff_t) <= CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE,
+               "uf2_handoff_t does not fit reserved RTC memory");
+
+uf2_handoff_t const* board_handoff(void) {
+  static uf2_handoff_t handoff;
+  static bool loaded = false;
+
+  if (!loaded) {
+    loaded = true;
+
+    uf2_handoff_t* rtc = (uf2_handoff_t*) (bootloader_common_get_rtc_retain_mem()->custom + UF2_HANDOFF_OFFSET);
+    if (uf2_handoff_valid(rtc)) {
+      handoff = *rtc;
+      TUF2_LOG1("Handoff from application: flags 0x%02x mode %u\r\n", handoff.flags, handoff.mode);
+    }
+
+    // used once, a later reset into UF2 (e.g by tinyuf2 itself) must not pick it up again
+    memset(rtc, 0, sizeof(*rtc));
+    bootloader_common_update_rtc_retain_mem(NULL, false);
+  }
+
+  return handoff.magic == UF2_HANDOFF_MAGIC ? &handoff : NULL;
+}
+#endif
+
 //--------------------------------------------------------------------+
 // CDC Touch1200
 //--------------------------------------------------------------------+
@@ -477,7 +1184,7 @@ void board_display_init(void) {
     .sclk_io_num     = DISPLAY_PIN_SCK,
     .quadwp_io_num   = -1,
     .quadhd_io_num   = -1,
-    .max_transfer_sz = PARALLEL_LINES * 320 * 2 + 8
+    .max_transfer_sz = DISPLAY_STRIP_LINES * 320 * 2 + 8
   };
 
   spi_device_interface_config_t devcfg = {
@@ -503,6 +1210,18 @@ void board_display_draw_line(int y, uint16_t* pixel_color, uint32_t pixel_num) {
   lcd_draw_lines(_display_spi, y, (uint16_t*) pixel_color);
 }
 
+void board_display_draw_lines_async(int y, uint16_t* pixel_color, uint32_t count) {
+  lcd_draw_lines_start(_display_spi, y, pixel_color, (int) count);
+}
+
+void board_display_wait(void) {
+  lcd_draw_lines_finish(_display_spi);
+}
+
+void board_display_draw_line_window(int y, uint32_t offset, uint16_t* pixel_color, uint32_t pixel_num) {
+  lcd_draw_line_window(_display_spi, y, (int) offset, pixel_color, (int) pixel_num);
+}
+
 #endif
 
 //--------------------------------------------------------------------+
@@ -579,7 +1298,8 @@ void dotstar_write(uint8_t const rgb[]) {
     .tx_buffer = _dotstar_data
   };
 
-  spi_device_queue_trans(_dotstar_spi, &xact, portMAX_DELAY);
+  // waits for completion, _dotstar_data is reused by the next write
+  spi_device_transmit(_dotstar_spi, &xact);
 }
 
 #endif
@@ -30,6 +30,7 @@
 #endif
 
 #include "sdkconfig.h"
+#include "esp_attr.h"
 #include "board.h"
 
 // Family ID for updating Application
@@ -52,6 +53,50 @@
  #define TINYUF2_DISPLAY 1
 #endif
 
+// Logic analyzer timing markers on a debug GPIO of the board, see board_perf_marker()
+#if defined(PIN_PERF_MARKER) && !defined(CFG_UF2_PERF_MARKER)
+  #define CFG_UF2_PERF_MARKER     1
+#endif
+
+// RTC slow memory is kept across software and watchdog resets
+#define TINYUF2_RETAINED_ATTR   RTC_NOINIT_ATTR
+
+// verify buffer used by board_flash.c
+#define BOARD_FLASH_SCRATCH_SIZE  4096
+
+// Check ota0 before jumping to it: full image verify only the first boot after an update
+// that was not verified by tinyuf2, afterwards a header and segment table check
+#ifndef BOARD_APP_CHECK
+#define BOARD_APP_CHECK           0
+#endif
+
+bool board_flash_app_check(void);
+
+// Hash ota0 while the host is idle, INFO.JSON, VERIFY.TXT ranges and the validity record are then answered
+// without a read pass. 32 bytes of heap per 64KB of ota0
+#ifndef BOARD_FLASH_SCRUB
+#define BOARD_FLASH_SCRUB         0
+#endif
+
+// Make the slot the uf2 was written to bootable (ota0, or the inactive one with FLASH_AB_SLOTS),
+// otadata is updated atomically. Implemented in board_flash.c
+void board_flash_set_boot(void);
+
+// Record the tinyuf2 staged by a bundle (BOARD_UF2_STAGE_FAMILY) for the bootloader to install
+// and reset, returns if there is none.
+// Implemented in board_flash.c
+void board_flash_stage_commit(void);
+
+// Write erase counts of this boot to NVS (CFG_UF2_WEAR), implemented in board_flash.c
+void board_flash_wear_save(void);
+
+// Task filling read-ahead buffers for sequential flash reads, implemented in board_flash.c
+void board_flash_read_ahead_task(void* param);
+void board_flash_write_task(void* param);
+
+// Idle priority task hashing ota0 (BOARD_FLASH_SCRUB), implemented in board_flash.c
+void board_flash_scrub_task(void* param);
+
 #ifdef __cplusplus
  }
 #endif
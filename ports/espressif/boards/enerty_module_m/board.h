@@ -37,6 +37,10 @@
 // pin value long enough for double reset detection.
 // #define PIN_DOUBLE_RESET_RC   34
 
+// Debug GPIO for logic analyzer timing markers (boot stages, UF2 detection, window flushes), see
+// board_perf_marker(). The bootloader leaves it an output, enable for bench builds only
+// #define PIN_PERF_MARKER       33
+
 // GPIO to enter DFU OTA mode on reset
 // should be LOW to enter DFU mode
  #define PIN_DFU_TRIGGER       34
@@ -82,3 +86,125 @@
 #define UF2_BOARD_ID      "ESP32S2FN4R2-ModuleM-1-0-0"
 #define UF2_VOLUME_LABEL  "ENERTYMBOOT"
 #define UF2_INDEX_URL     "https://www.google.com/search?q=ENERTY+module+m"
+
+//--------------------------------------------------------------------+
+// Data LUN
+//--------------------------------------------------------------------+
+
+// Expose ffat partition as second drive for files written by the application
+#define TINYUF2_DATA_LUN  1
+
+// Write UF2 file container blocks (web assets, config files) into the ffat partition
+#define CFG_UF2_FILE_CONTAINER  1
+
+// Track written UF2 blocks as ranges instead of a 2KB bitmap
+#define CFG_UF2_WRITE_RANGES  8
+
+// App and bundle UF2 files copied at the same time complete the update together
+#define CFG_UF2_WRITE_SESSIONS  4
+
+// Accept compressed UF2 files made by tools/uf2compress.py, 2KB history
+#define CFG_UF2_HEATSHRINK    1
+
+// Accept delta UF2 files made by tools/uf2delta.py
+#define CFG_UF2_DELTA         1
+
+// Other UF2 families written to their partition in the same file, see tools/uf2combine.py
+// { family ID, partition type, partition subtype }
+#define BOARD_UF2_ROUTES \
+  { 0x2f1e7a51, ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1 }, /* measurement data */ \
+  { 0x9c3b47d2, ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_FAT }, /* ffat */ \
+  { 0x51d0e8a3, ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_NVS }, /* nvs */
+
+// tinyuf2.bin in the same file (uf2combine.py 0x7c4e19b3:tinyuf2.bin), installed after the app.
+// Staged in the last 256KB of ota0, so the app must stay below 1152KB
+#define BOARD_UF2_STAGE_FAMILY  0x7c4e19b3
+
+// Complete DFU after host has written no new uf2 blocks for 500ms, or on sync/eject
+#define CFG_UF2_IDLE_COMPLETE_MS  500
+
+// Tell the host NOT READY instead of holding a write off for more than 2s while flash is busy
+#define CFG_UF2_WRITE_NOT_READY_MS  2000
+
+// Serve measurement data over CDC for gateways, see tools/measurement_sync.py
+#define CFG_UF2_MEASUREMENT_CDC   1
+
+// Measurement files on their own read-only LUN, data LUN follows as LUN 2
+#define CFG_UF2_MEASUREMENT_LUN   1
+
+// ota1 sectors shared by all measurement files, repeated host reads do not hit flash. 16KB of RAM
+#define CFG_UF2_MEASUREMENT_CACHE_SECTORS  4
+
+// MEASDAT.CSV.GZ for faster downloads over USB FS, 8KB of RAM. All of MEASDAT.CSV is compressed
+// once each time the measurement volume is built, which delays its mount for a full ota1
+// #define CFG_UF2_MEASUREMENT_GZ    1
+
+// Host FAT/directory writes of the firmware volume read back as written, 4KB of RAM
+#define CFG_UF2_WRITE_OVERLAY_SECTORS  8
+
+// No 500ms UF2 detection window in 2nd stage bootloader on every power up. GPIO0 held at power up
+// selects the ROM bootloader, UF2 is entered by application reset hint (or missing application)
+#define UF2_DETECTION_LATCHED     1
+
+// Enter UF2 instead of jumping to a corrupted ota0
+#define BOARD_APP_CHECK           1
+
+// Stage timing of bootloader and tinyuf2 as BOOTLOG.TXT
+#define CFG_UF2_BOOTLOG           1
+
+// Serial number and measurement data size kept in RTC memory, DFU entry reads NVS only once per power up
+#define CFG_UF2_RETAINED_CACHE    1
+
+// Serial number block burns the serial into eFuse BLOCK3 once, read from there instead of NVS. Cannot be
+// undone, NVS still serves modules provisioned before
+// #define BOARD_SERIAL_EFUSE        1
+
+// Read/write/flash counters of this boot as STATS.TXT, for diagnosing slow updates in the field
+#define CFG_UF2_STATS             1
+
+// Lifetime erase count of each 4KB sector of ota0 as WEAR.CSV, saved to NVS once per update
+#define CFG_UF2_WEAR              1
+
+// Host can clear measurement data after download by copying an Erase_Block file, see uf2.h
+#define CFG_UF2_MEASUREMENT_ERASE 1
+
+// Production audits: ota0 ranges of a tools/uf2verify.py file are hashed, VERIFY.TXT has the result
+#define CFG_UF2_VERIFY            1
+
+// ota0 hashed in idle time, VERIFY.TXT and INFO.JSON sha256 answered from the result
+#define BOARD_FLASH_SCRUB         1
+
+// Raw app image as CURRENT.BIN for backups, half the USB transfer of CURRENT.UF2
+#define CFG_UF2_CURRENT_BIN       1
+
+// Blocks of uf2pack.py --crc are checked by the ROM crc32 before they are written
+#define CFG_UF2_BLOCK_CRC         1
+
+// Plain .bin files copied to the drive are flashed too, NVS.BIN goes to the nvs partition
+#define CFG_UF2_RAW_BIN           1
+#define CFG_UF2_RAW_BIN_ROUTES    { "NVS     ", 0x51d0e8a3 }
+
+// Firmware volume sized to its files plus an upload, 5MB extra for bundles of ota_1, ffat and nvs
+#define CFG_UF2_VOLUME_FIT        1
+#define CFG_UF2_VOLUME_FIT_EXTRA  (5*1024*1024)
+
+// Measurement LUN always has CFG_UF2_NUM_BLOCKS, kept instead of the geometry generated for the partition table
+#define CFG_UF2_NUM_BLOCKS          (0x10109)
+#define CFG_UF2_SECTORS_PER_CLUSTER (1)
+
+// Flashing station: volume serial from the chip MAC so hosts keep several modules apart, STATUS.TXT
+// to poll. Label stays ENERTYMBOOT, CFG_UF2_VOLUME_LABEL_SUFFIX would append MAC digits to it
+#define CFG_UF2_VOLUME_SERIAL_UNIQUE  1
+#define CFG_UF2_STATUS            1
+
+// INFO.JSON for the test scripts: board, serial, sizes, app sha256, update state and the counters
+#define CFG_UF2_INFO_JSON         1
+
+// CONFIG.TXT to provision the serial number without a reset
+#define CFG_UF2_CONFIG            1
+
+// DFU session runs SPI flash at the fastest clock/mode that reads the bootloader back reliably
+#define FLASH_CALIBRATE           1
+
+// Uf2 is received into PSRAM at full USB speed and flashed once complete, off on modules without PSRAM
+#define FLASH_PSRAM_STAGE         1
@@ -23,6 +23,7 @@
 static const char *TAG = "AXP2101";
 
 static XPowersPMU PMU;
+static bool pmu_ok = false;
 
 #endif /* CONFIG_XPOWERS_CHIP_AXP2102 */
 
@@ -106,6 +107,14 @@ int pmu_register_write_byte(uint8_t devAddr, uint8_t regAddr, uint8_t *data, uin
     return ret == ESP_OK ? 0 : -1;
 }
 
+#ifdef CONFIG_XPOWERS_CHIP_AXP2102
+// VBUS as measured by the PMU, 0 while running from battery
+extern "C" uint32_t board_supply_mv(void)
+{
+  return pmu_ok ? PMU.getVbusVoltage() : 0;
+}
+#endif
+
 extern "C" bool board_init_extension()
 {
   SSD1306_t dev;
@@ -125,6 +134,10 @@ extern "C" bool board_init_extension()
   if (PMU.begin(AXP2101_SLAVE_ADDRESS, pmu_register_read, pmu_register_write_byte)) {
 
     ESP_LOGI(TAG, "Init PMU SUCCESS!");
+    pmu_ok = true;
+
+    // VBUS for board_supply_mv()
+    PMU.enableVbusVoltageMeasure();
 
     //Turn off not use power channel
     PMU.disableDC2();
@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 #include <stdbool.h>
+#include <string.h>
 #include "esp_log.h"
 #include "esp_rom_sys.h"
 #include "bootloader_init.h"
@@ -34,11 +35,102 @@
 // Reset Reason Hint to enter UF2. Check out esp_reset_reason_t for other Espressif pre-defined values
 #define APP_REQUEST_UF2_RESET_HINT   0x11F2
 
+#ifndef DOTSTAR_CLOCK_DELAY_NS
+  // Half clock period for bit-banged DotStar, APA102 is specified for more than 10MHz
+  #define DOTSTAR_CLOCK_DELAY_NS    200
+#endif
+
+#ifndef UF2_DETECTION_LATCHED
+  // Only check triggers that are latched by the time we get here: application reset hint and
+  // PIN_BUTTON_UF2 held during power up (sampled once). No detection window, boot is not delayed.
+  #define UF2_DETECTION_LATCHED      0
+#endif
+
+#if UF2_DETECTION_LATCHED
+  #ifdef PIN_DOUBLE_RESET_RC
+  #error "PIN_DOUBLE_RESET_RC needs the detection window to charge the RC, not supported with UF2_DETECTION_LATCHED"
+  #endif
+
+  #undef UF2_DETECTION_DELAY_MS
+  #define UF2_DETECTION_DELAY_MS     0
+#endif
+
 #ifndef UF2_DETECTION_DELAY_MS
   // Initial delay in milliseconds to detect user interaction to enter UF2.
   #define UF2_DETECTION_DELAY_MS     500
 #endif
 
+#ifndef UF2_BOOT_TIMESTAMPS
+  // Log esp_log_early_timestamp() at each boot stage, to measure boot time
+  #define UF2_BOOT_TIMESTAMPS        0
+#endif
+
+#if CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC
+  // Boot log in reserved RTC memory, continued by tinyuf2 and rendered as BOOTLOG.TXT
+  #include "bootlog.h"
+  _Static_assert(sizeof(bootlog_t) <= CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE, "bootlog_t does not fit reserved RTC memory");
+  static void bootlog_mark(uint32_t stage);
+
+  // Screen record of e-paper boards, an application may draw over what tinyuf2 left on the panel
+  #include "bootscreen.h"
+  static void bootscreen_forget(void);
+#else
+  #define bootlog_mark(_stage)
+#endif
+
+#if CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC && CONFIG_PARTITION_TABLE_MD5 && !CONFIG_SECURE_BOOT
+  // Partition positions cached in reserved RTC memory for warm boots, see bootpart.h
+  #include "bootpart.h"
+  #include "handoff.h"
+  #include "bootloader_flash_priv.h"
+  #include "esp_flash_partitions.h"
+  _Static_assert(BOOTPART_OFFSET >= sizeof(bootlog_t) && BOOTPART_OFFSET + sizeof(bootpart_t) <= UF2_HANDOFF_OFFSET,
+                 "bootpart_t does not fit between boot log and handoff block");
+  #define BOOT_PARTITION_CACHE       1
+  static bool partition_cache_load(bootloader_state_t *bs);
+  static void partition_cache_save(const bootloader_state_t *bs);
+#else
+  #define BOOT_PARTITION_CACHE       0
+#endif
+
+#if CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC && !CONFIG_SECURE_BOOT
+  // App image verified by tinyuf2 is loaded without validation, see bootimage.h. bootloader_utility
+  // calls bootloader_load_image() through the wrapper at the end of this file (-Wl,--wrap)
+  #include "bootimage.h"
+  #include "esp_image_format.h"
+  #include "bootloader_flash_priv.h"
+  #define BOOT_IMAGE_CACHE           1
+#else
+  #define BOOT_IMAGE_CACHE           0
+#endif
+
+#if CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC
+  // tinyuf2 staged by a bundle, copied to the factory partition before anything runs, see bootstage.h
+  #include "bootstage.h"
+  #include "bootloader_flash_priv.h"
+  #include "hal/wdt_hal.h"
+  #include "soc/rtc_cntl_struct.h"
+  static void stage_install(void);
+#endif
+
+#ifdef PIN_PERF_MARKER
+  // Boot stage pulses and the UF2 detection window on the debug GPIO of the board, same ids as tinyuf2
+  #include "trace.h"
+  static void perf_marker(uint32_t id, bool on);
+  #define PERF_MARKER(_id, _on)   perf_marker(_id, _on)
+#else
+  #define PERF_MARKER(_id, _on)
+#endif
+
+#if UF2_BOOT_TIMESTAMPS
+  #define BOOT_STAGE(_id, _name) \
+    do { bootlog_mark(_id); PERF_MARKER(TUF2_MARKER_STAGE + (_id), true); PERF_MARKER(TUF2_MARKER_STAGE + (_id), false); \
+         ESP_LOGI(TAG, "Stage %s at %u ms", _name, (unsigned) esp_log_early_timestamp()); } while (0)
+#else
+  #define BOOT_STAGE(_id, _name) \
+    do { bootlog_mark(_id); PERF_MARKER(TUF2_MARKER_STAGE + (_id), true); PERF_MARKER(TUF2_MARKER_STAGE + (_id), false); } while (0)
+#endif
+
 uint8_t const RGB_DOUBLE_TAP[] = { 0x80, 0x00, 0xff }; // Purple
 uint8_t const RGB_OFF[]        = { 0x00, 0x00, 0x00 };
 
@@ -93,12 +185,18 @@ void __attribute__((noreturn)) call_start_cpu0(void)
     if (bootloader_init() != ESP_OK) {
         bootloader_reset();
     }
+    BOOT_STAGE(BOOTLOG_BL_INIT, "init");
 
     // (1.1 Call the after-init hook, if available)
     if (bootloader_after_init) {
         bootloader_after_init();
     }
 
+#if CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC
+    // (1.2 Install tinyuf2 of a bundle, the factory partition is not running now)
+    stage_install();
+#endif
+
 #ifdef CONFIG_BOOTLOADER_SKIP_VALIDATE_IN_DEEP_SLEEP
     // If this boot is a wake up from the deep sleep then go to the short way,
     // try to load the application which worked before deep sleep.
@@ -113,6 +211,12 @@ void __attribute__((noreturn)) call_start_cpu0(void)
     if (boot_index == INVALID_INDEX) {
         bootloader_reset();
     }
+#if CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC
+    if (boot_index != FACTORY_INDEX) {
+        bootscreen_forget();
+    }
+#endif
+    BOOT_STAGE(BOOTLOG_BL_SELECT, "select");
 
     // 3. Load the app image for booting
     bootloader_utility_load_boot_image(&bs, boot_index);
@@ -121,11 +225,20 @@ void __attribute__((noreturn)) call_start_cpu0(void)
 // Select the number of boot partition
 static int select_partition_number(bootloader_state_t *bs)
 {
-    // 1. Load partition table
-    if (!bootloader_utility_load_partition_table(bs)) {
-        ESP_LOGE(TAG, "load partition table error!");
-        return INVALID_INDEX;
+    // 1. Load partition table, on a warm boot from the cache if the table is unchanged
+#if BOOT_PARTITION_CACHE
+    if (!partition_cache_load(bs))
+#endif
+    {
+        if (!bootloader_utility_load_partition_table(bs)) {
+            ESP_LOGE(TAG, "load partition table error!");
+            return INVALID_INDEX;
+        }
+#if BOOT_PARTITION_CACHE
+        partition_cache_save(bs);
+#endif
     }
+    BOOT_STAGE(BOOTLOG_BL_PARTITION_TABLE, "partition table");
 
     // 2. Select the number of boot partition
     return selected_boot_partition(bs);
@@ -141,9 +254,13 @@ static int selected_boot_partition(const bootloader_state_t *bs) {
         return boot_index; // Unrecoverable failure (not due to corrupt ota data or bad partition contents)
     }
 
+    // Deep sleep wake of the app goes straight back to it: no UF2 detection, indicator I/O or log output.
+    // With CONFIG_BOOTLOADER_SKIP_VALIDATE_IN_DEEP_SLEEP this is only reached if the retained partition
+    // could not be loaded
     soc_reset_reason_t reset_reason = esp_rom_get_reset_reason(0);
-    ESP_LOGI(TAG, "Reset Reason = %d", reset_reason);
     if (reset_reason != RESET_REASON_CORE_DEEP_SLEEP) {
+        ESP_LOGI(TAG, "Reset Reason = %d", reset_reason);
+
         // Factory firmware.
 #ifdef CONFIG_BOOTLOADER_FACTORY_RESET
         bool reset_level = false;
@@ -235,6 +352,7 @@ static int selected_boot_partition(const bootloader_state_t *bs) {
             esp_rom_gpio_pad_pullup_only(PIN_BUTTON_UF2);
 
             // run the GPIO detection at least once even if UF2_DETECTION_DELAY_MS is set to zero
+            PERF_MARKER(TUF2_MARKER_DETECT, true);
             uint32_t tm_start = esp_log_early_timestamp();
             do {
               if ( gpio_ll_get_level(&GPIO, PIN_BUTTON_UF2) == 0 ) {
@@ -243,6 +361,7 @@ static int selected_boot_partition(const bootloader_state_t *bs) {
                 break;
               }
             } while (UF2_DETECTION_DELAY_MS > (esp_log_early_timestamp() - tm_start) );
+            PERF_MARKER(TUF2_MARKER_DETECT, false);
 
             if (UF2_DETECTION_DELAY_MS > 0){
               #if CONFIG_IDF_TARGET_ESP32S3
@@ -270,6 +389,159 @@ static int selected_boot_partition(const bootloader_state_t *bs) {
     return boot_index;
 }
 
+#if CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC
+// Timestamps are microseconds of CPU cycle counter since reset, first stage starts a new log
+static void bootlog_mark(uint32_t stage) {
+  bootlog_t* log = (bootlog_t*) bootloader_common_get_rtc_retain_mem()->custom;
+  if (stage == BOOTLOG_BL_INIT) bootlog_reset(log);
+
+  bootlog_add(log, stage, esp_cpu_get_cycle_count() / esp_rom_get_cpu_ticks_per_us());
+
+  // keep crc of retained memory valid, it is reset otherwise
+  bootloader_common_update_rtc_retain_mem(NULL, false);
+}
+
+// Booting anything but tinyuf2, crc is updated by the select stage of the boot log right after
+static void bootscreen_forget(void) {
+  if (BOOTSCREEN_OFFSET + sizeof(bootscreen_t) > CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE) return;
+  bootscreen_clear((bootscreen_t*) (bootloader_common_get_rtc_retain_mem()->custom + BOOTSCREEN_OFFSET));
+}
+
+static bool stage_sector_same(uint32_t src, uint32_t dst, uint8_t* buf, uint8_t* cur) {
+  for (uint32_t off = 0; off < 4096; off += 256) {
+    if (ESP_OK != bootloader_flash_read(src + off, buf, 256, false) ||
+        ESP_OK != bootloader_flash_read(dst + off, cur, 256, false) || 0 != memcmp(buf, cur, 256)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Sectors equal to the staged image are skipped, so a reset during the copy just starts it over.
+// The record is cleared once the copy is done, or failed on a flash error
+static void stage_install(void) {
+  if (BOOTSTAGE_OFFSET + sizeof(bootstage_t) > CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE) return;
+  bootstage_t* bs = (bootstage_t*) (bootloader_common_get_rtc_retain_mem()->custom + BOOTSTAGE_OFFSET);
+  if (!bootstage_valid(bs)) return;
+
+  static uint8_t buf[256];
+  static uint8_t cur[256];
+  uint32_t const src = bs->src;
+  uint32_t const dst = bs->dst;
+  uint32_t const len = bs->len;
+  bool ok = (src + len <= dst || dst + len <= src);
+
+  ESP_LOGI(TAG, "Installing staged tinyuf2 from 0x%x to 0x%x", (unsigned) src, (unsigned) dst);
+  for (uint32_t sector = 0; ok && sector < len; sector += 4096) {
+#if CONFIG_BOOTLOADER_WDT_ENABLE
+    // erase of a large image takes longer than the RTC watchdog set up by bootloader_init()
+    wdt_hal_context_t rtc_wdt_ctx = {.inst = WDT_RWDT, .rwdt_dev = &RTCCNTL};
+    wdt_hal_write_protect_disable(&rtc_wdt_ctx);
+    wdt_hal_feed(&rtc_wdt_ctx);
+    wdt_hal_write_protect_enable(&rtc_wdt_ctx);
+#endif
+    if (stage_sector_same(src + sector, dst + sector, buf, cur)) continue;
+
+    ok = (ESP_OK == bootloader_flash_erase_range(dst + sector, 4096));
+    for (uint32_t off = 0; ok && off < 4096; off += 256) {
+      ok = (ESP_OK == bootloader_flash_read(src + sector + off, buf, 256, false) &&
+            ESP_OK == bootloader_flash_write(dst + sector + off, buf, 256, false));
+    }
+  }
+  if (!ok) ESP_LOGE(TAG, "Staged tinyuf2 not installed");
+
+  // a failed copy is not retried on every boot, the app selected below is bootable either way
+  bootstage_clear(bs);
+  bootloader_common_update_rtc_retain_mem(NULL, false);
+}
+#endif
+
+#ifdef PIN_PERF_MARKER
+// pin is set up on first use, the bootloader init stage is the first marker
+static void perf_marker(uint32_t id, bool on) {
+  static bool ready = false;
+  if (id >= 32 || !(CFG_UF2_PERF_MARKER_IDS & (1UL << id))) return;
+
+  if (!ready) {
+    esp_rom_gpio_pad_select_gpio(PIN_PERF_MARKER);
+    gpio_ll_output_enable(&GPIO, PIN_PERF_MARKER);
+    ready = true;
+  }
+  gpio_ll_set_level(&GPIO, PIN_PERF_MARKER, on);
+}
+#endif
+
+#if BOOT_PARTITION_CACHE
+static inline bootpart_t* partition_cache(void) {
+  return (bootpart_t*) (bootloader_common_get_rtc_retain_mem()->custom + BOOTPART_OFFSET);
+}
+
+// Fill bs from the cache if it is valid and the MD5 entry of the partition table still has its digest
+static bool partition_cache_load(bootloader_state_t *bs) {
+  bootpart_t const* bp = partition_cache();
+  if (!bootpart_valid(bp)) return false;
+
+  esp_partition_info_t entry;
+  if (ESP_OK != bootloader_flash_read(ESP_PARTITION_TABLE_OFFSET + bp->md5_offset, &entry, sizeof(entry), true) ||
+      entry.magic != ESP_PARTITION_MAGIC_MD5 || memcmp(bp->md5, ((uint8_t const*) &entry) + 16, sizeof(bp->md5))) {
+    return false;
+  }
+
+  esp_partition_pos_t* const pos[BOOTPART_COUNT] = { &bs->ota_info, &bs->factory, &bs->ota[0], &bs->ota[1] };
+  for (uint32_t i = 0; i < BOOTPART_COUNT; i++) {
+    pos[i]->offset = bp->part[i].offset * 0x1000UL;
+    pos[i]->size = bp->part[i].size * 0x1000UL;
+  }
+  bs->app_count = bp->app_count;
+
+  ESP_LOGI(TAG, "Partition table unchanged, %u ota slots", (unsigned) bs->app_count);
+  return true;
+}
+
+// Remember the positions of a table that was just loaded and verified, if they fit the cache
+static bool partition_cache_fill(bootpart_t* bp, const bootloader_state_t *bs) {
+  if (bs->test.offset != 0 || bs->app_count > BOOTPART_OTA_SLOTS) return false;
+
+  esp_partition_pos_t const* const pos[BOOTPART_COUNT] = { &bs->ota_info, &bs->factory, &bs->ota[0], &bs->ota[1] };
+  for (uint32_t i = 0; i < BOOTPART_COUNT; i++) {
+    uint32_t const offset = (i < BOOTPART_OTA_0 || i - BOOTPART_OTA_0 < bs->app_count) ? pos[i]->offset : 0;
+    uint32_t const size = offset ? pos[i]->size : 0;
+    if (((offset | size) & 0xFFF) || offset / 0x1000 > 0xFFFF || size / 0x1000 > 0xFFFF) return false;
+    bp->part[i].offset = offset / 0x1000;
+    bp->part[i].size = size / 0x1000;
+  }
+  bp->app_count = bs->app_count;
+
+  // MD5 entry follows the partitions, verified by bootloader_utility_load_partition_table()
+  esp_partition_info_t const* table = bootloader_mmap(ESP_PARTITION_TABLE_OFFSET, ESP_PARTITION_TABLE_MAX_LEN);
+  if (table == NULL) return false;
+
+  bool found = false;
+  for (uint32_t i = 0; i < ESP_PARTITION_TABLE_MAX_ENTRIES && !found; i++) {
+    if (table[i].magic == ESP_PARTITION_MAGIC_MD5) {
+      bp->md5_offset = i * sizeof(esp_partition_info_t);
+      memcpy(bp->md5, ((uint8_t const*) &table[i]) + 16, sizeof(bp->md5));
+      found = true;
+    }
+  }
+  bootloader_munmap(table);
+  return found;
+}
+
+static void partition_cache_save(const bootloader_state_t *bs) {
+  bootpart_t bp = { 0 };
+  if (partition_cache_fill(&bp, bs)) {
+    bootpart_seal(&bp);
+  } else {
+    bp.check = ~bootpart_check(&bp);
+  }
+  memcpy(partition_cache(), &bp, sizeof(bp));
+
+  // keep crc of retained memory valid, it is reset otherwise
+  bootloader_common_update_rtc_retain_mem(NULL, false);
+}
+#endif
+
 // Return global reent struct if any newlib functions are linked to bootloader
 struct _reent *__getreent(void)
 {
@@ -365,12 +637,12 @@ static void SPI_write(int32_t pin_data,uint32_t pin_sck,uint8_t c) {
     else {
       gpio_ll_set_level(&GPIO, pin_data, 1);
     }
-    delay_cycle( ns2cycle(200000) ) ;
+    delay_cycle( ns2cycle(DOTSTAR_CLOCK_DELAY_NS) ) ;
     gpio_ll_set_level(&GPIO, pin_sck, 1);
     c<<=1;
-    delay_cycle( ns2cycle(200000) ) ;
+    delay_cycle( ns2cycle(DOTSTAR_CLOCK_DELAY_NS) ) ;
     gpio_ll_set_level(&GPIO, pin_sck, 0);
-    delay_cycle( ns2cycle(200000) );
+    delay_cycle( ns2cycle(DOTSTAR_CLOCK_DELAY_NS) );
   }
 }
 
@@ -585,3 +857,38 @@ static void board_led_off(void) {
   gpio_ll_output_disable(&GPIO, LED_PIN);
 #endif
 }
+
+//--------------------------------------------------------------------+
+// Trusted image
+//--------------------------------------------------------------------+
+
+esp_err_t __real_bootloader_load_image(const esp_partition_pos_t *part, esp_image_metadata_t *data);
+
+#if BOOT_IMAGE_CACHE
+// Header and appended digest still those of the image tinyuf2 recorded: 24 + 32 bytes read
+// instead of the whole image
+static bool trusted_image(const esp_partition_pos_t *part) {
+  if (BOOTIMAGE_OFFSET + sizeof(bootimage_t) > CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE) return false;
+  bootimage_t const* bi = (bootimage_t const*) (bootloader_common_get_rtc_retain_mem()->custom + BOOTIMAGE_OFFSET);
+  if (!bootimage_valid(bi) || bi->offset != part->offset || bi->len > part->size) return false;
+
+  esp_image_header_t hdr;
+  uint8_t sha256[32];
+  if (ESP_OK != bootloader_flash_read(part->offset, &hdr, sizeof(hdr), true) ||
+      hdr.magic != ESP_IMAGE_HEADER_MAGIC || !hdr.hash_appended ||
+      ESP_OK != bootloader_flash_read(part->offset + bi->len - sizeof(sha256), sha256, sizeof(sha256), true)) {
+    return false;
+  }
+  return 0 == memcmp(sha256, bi->sha256, sizeof(sha256));
+}
+#endif
+
+esp_err_t __wrap_bootloader_load_image(const esp_partition_pos_t *part, esp_image_metadata_t *data) {
+#if BOOT_IMAGE_CACHE
+  if (trusted_image(part)) {
+    ESP_LOGI(TAG, "Trusted image at 0x%x, loading without validation", (unsigned) part->offset);
+    if (ESP_OK == bootloader_load_image_no_verify(part, data)) return ESP_OK;
+  }
+#endif
+  return __real_bootloader_load_image(part, data);
+}
@@ -0,0 +1,192 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+
+#include "epd.h"
+#include "font8x8_basic.h"
+
+// IL0373 commands
+#define CMD_PANEL_SETTING     0x00
+#define CMD_POWER_SETTING     0x01
+#define CMD_BOOSTER_SOFTSTART 0x06
+#define CMD_POWER_ON          0x04
+#define CMD_DTM1              0x10  // old data, of the refresh before
+#define CMD_DISPLAY_REFRESH   0x12
+#define CMD_DTM2              0x13  // new data
+#define CMD_CDI               0x50  // VCOM and data interval
+#define CMD_RESOLUTION        0x61
+#define CMD_PARTIAL_WINDOW    0x90
+#define CMD_PARTIAL_IN        0x91
+#define CMD_PARTIAL_OUT       0x92
+
+#define ROW_BYTES             (EPD_SOURCES / 8)
+
+// BUSY_N is low while the controller works
+#define BUSY_POLL_MS          5
+
+//--------------------------------------------------------------------+
+// SPI
+//--------------------------------------------------------------------+
+
+static void epd_send(epd_t const* dev, bool data, void const* buf, size_t len) {
+  if (len == 0) return;
+  spi_transaction_t t = {
+    .length    = len * 8,
+    .tx_buffer = buf,
+  };
+  gpio_set_level(dev->pin_dc, data);
+  spi_device_polling_transmit(dev->spi, &t);
+}
+
+static void epd_cmd(epd_t const* dev, uint8_t cmd, uint8_t const* data, size_t len) {
+  epd_send(dev, false, &cmd, 1);
+  epd_send(dev, true, data, len);
+}
+
+// rows [0, EPD_GATES) of bytes [bx0, bx1] of frame
+static void epd_data_window(epd_t const* dev, uint8_t cmd, uint8_t const* frame, int bx0, int bx1) {
+  epd_send(dev, false, &cmd, 1);
+  if (bx0 == 0 && bx1 == ROW_BYTES - 1) {
+    epd_send(dev, true, frame, EPD_FRAME_SIZE);
+    return;
+  }
+  for (int row = 0; row < EPD_GATES; row++) {
+    epd_send(dev, true, frame + row * ROW_BYTES + bx0, (size_t) (bx1 - bx0 + 1));
+  }
+}
+
+//--------------------------------------------------------------------+
+// Panel
+//--------------------------------------------------------------------+
+
+bool epd_busy(epd_t const* dev) {
+  return gpio_get_level(dev->pin_busy) == 0;
+}
+
+void epd_wait(epd_t const* dev) {
+  while (epd_busy(dev)) vTaskDelay(pdMS_TO_TICKS(BUSY_POLL_MS));
+}
+
+esp_err_t epd_init(epd_t* dev, spi_host_device_t host, int pin_cs, int pin_dc, int pin_rst, int pin_busy) {
+  dev->pin_dc = pin_dc;
+  dev->pin_rst = pin_rst;
+  dev->pin_busy = pin_busy;
+
+  gpio_reset_pin(pin_dc);
+  gpio_set_direction(pin_dc, GPIO_MODE_OUTPUT);
+  gpio_reset_pin(pin_rst);
+  gpio_set_direction(pin_rst, GPIO_MODE_OUTPUT);
+  gpio_reset_pin(pin_busy);
+  gpio_set_direction(pin_busy, GPIO_MODE_INPUT);
+
+  spi_device_interface_config_t devcfg = {
+    .clock_speed_hz = 4 * 1000 * 1000,
+    .mode           = 0,
+    .spics_io_num   = pin_cs,
+    .queue_size     = 1,
+  };
+  esp_err_t err = spi_bus_add_device(host, &devcfg, &dev->spi);
+  if (err != ESP_OK) return err;
+
+  gpio_set_level(pin_rst, 0);
+  vTaskDelay(pdMS_TO_TICKS(10));
+  gpio_set_level(pin_rst, 1);
+  vTaskDelay(pdMS_TO_TICKS(10));
+  epd_wait(dev);
+
+  epd_cmd(dev, CMD_POWER_SETTING, (uint8_t const[]) { 0x03, 0x00, 0x2B, 0x2B, 0x09 }, 5);
+  epd_cmd(dev, CMD_BOOSTER_SOFTSTART, (uint8_t const[]) { 0x17, 0x17, 0x17 }, 3);
+  epd_cmd(dev, CMD_POWER_ON, NULL, 0);
+  epd_wait(dev);
+
+  // black/white, waveform from OTP, 128 sources x 296 gates
+  epd_cmd(dev, CMD_PANEL_SETTING, (uint8_t const[]) { 0x1F }, 1);
+  epd_cmd(dev, CMD_RESOLUTION, (uint8_t const[]) { EPD_SOURCES, EPD_GATES >> 8, EPD_GATES & 0xFF }, 3);
+  epd_cmd(dev, CMD_CDI, (uint8_t const[]) { 0x97 }, 1);
+
+  return ESP_OK;
+}
+
+void epd_refresh_full(epd_t const* dev, uint8_t const* frame) {
+  epd_data_window(dev, CMD_DTM1, frame, 0, ROW_BYTES - 1);
+  epd_data_window(dev, CMD_DTM2, frame, 0, ROW_BYTES - 1);
+  epd_cmd(dev, CMD_DISPLAY_REFRESH, NULL, 0);
+}
+
+void epd_refresh_rows(epd_t const* dev, uint8_t const* shown, uint8_t const* frame, int y0, int y1) {
+  // landscape rows are source columns, a window starts and ends on a byte
+  int const bx0 = y0 / 8;
+  int const bx1 = y1 / 8;
+
+  uint8_t const window[] = {
+    (uint8_t) (bx0 * 8), (uint8_t) (bx1 * 8 + 7),
+    0, 0, (EPD_GATES - 1) >> 8, (EPD_GATES - 1) & 0xFF,
+    0x01, // gates scan inside and outside the window
+  };
+
+  epd_cmd(dev, CMD_PARTIAL_IN, NULL, 0);
+  epd_cmd(dev, CMD_PARTIAL_WINDOW, window, sizeof(window));
+  epd_data_window(dev, CMD_DTM1, shown, bx0, bx1);
+  epd_data_window(dev, CMD_DTM2, frame, bx0, bx1);
+  epd_cmd(dev, CMD_DISPLAY_REFRESH, NULL, 0);
+  epd_wait(dev);
+  epd_cmd(dev, CMD_PARTIAL_OUT, NULL, 0);
+}
+
+//--------------------------------------------------------------------+
+// Frame
+//--------------------------------------------------------------------+
+
+static inline void frame_pixel(uint8_t* frame, int x, int y, bool black) {
+  if (x < 0 || x >= EPD_WIDTH || y < 0 || y >= EPD_HEIGHT) return;
+  uint8_t* b = &frame[x * ROW_BYTES + y / 8];
+  uint8_t const mask = 0x80 >> (y & 7);
+  *b = black ? (*b & ~mask) : (*b | mask);
+}
+
+void epd_frame_clear(uint8_t* frame) {
+  memset(frame, 0xFF, EPD_FRAME_SIZE);
+}
+
+void epd_frame_fill(uint8_t* frame, int x, int y, int w, int h, bool black) {
+  for (int i = 0; i < w; i++) {
+    for (int j = 0; j < h; j++) frame_pixel(frame, x + i, y + j, black);
+  }
+}
+
+void epd_frame_text(uint8_t* frame, int x, int y, char const* text, int scale) {
+  for (; *text && x < EPD_WIDTH; text++, x += 8 * scale) {
+    uint8_t const* columns = font8x8_basic_tr[(uint8_t) *text & 0x7F];
+    for (int col = 0; col < 8; col++) {
+      for (int row = 0; row < 8; row++) {
+        if (columns[col] & (1 << row)) epd_frame_fill(frame, x + col * scale, y + row * scale, scale, scale, true);
+      }
+    }
+  }
+}
@@ -0,0 +1,87 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef EPD_H_
+#define EPD_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "driver/spi_master.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// 2.9" 296x128 e-paper panel with IL0373 (UC8151) controller, black/white with the waveform from its
+// OTP. Frames are kept in the controller's order: EPD_GATES rows of EPD_SOURCES / 8 bytes, MSB first,
+// bit set = white. Drawing coordinates are landscape (x along the 296 pixel side). A refresh only
+// starts the panel, epd_busy()/epd_wait() tell when it is done; the image stays without power.
+//--------------------------------------------------------------------+
+
+#define EPD_SOURCES      128
+#define EPD_GATES        296
+
+#define EPD_WIDTH        EPD_GATES
+#define EPD_HEIGHT       EPD_SOURCES
+
+#define EPD_FRAME_SIZE   (EPD_GATES * EPD_SOURCES / 8)
+
+typedef struct {
+  spi_device_handle_t spi;
+  int pin_dc;
+  int pin_rst;
+  int pin_busy;
+} epd_t;
+
+// Add the panel to a SPI bus that is already initialized, reset and power it up. Waits for the
+// controller (tens of ms), the panel content is left as it is
+esp_err_t epd_init(epd_t* dev, spi_host_device_t host, int pin_cs, int pin_dc, int pin_rst, int pin_busy);
+
+bool epd_busy(epd_t const* dev);
+
+// Wait for a refresh to finish, polling at a few ms so lower priority tasks keep running
+void epd_wait(epd_t const* dev);
+
+//------------- Frame drawing, nothing is sent -------------//
+void epd_frame_clear(uint8_t* frame);
+
+void epd_frame_fill(uint8_t* frame, int x, int y, int w, int h, bool black);
+
+// 8x8 font scaled by scale, clipped at the frame border
+void epd_frame_text(uint8_t* frame, int x, int y, char const* text, int scale);
+
+//------------- Refresh -------------//
+// Whole panel, flashes black and white once (seconds)
+void epd_refresh_full(epd_t const* dev, uint8_t const* frame);
+
+// Partial window of landscape rows [y0, y1], aligned to 8 rows; shown is what the panel has now. Only
+// the window is driven, the rest of the panel is left alone
+void epd_refresh_rows(epd_t const* dev, uint8_t const* shown, uint8_t const* frame, int y0, int y1);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
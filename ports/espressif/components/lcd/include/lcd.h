@@ -60,6 +60,17 @@ esp_err_t lcd_init(spi_device_handle_t spi);
 
 void lcd_draw_lines(spi_device_handle_t spi, int ypos, uint16_t *linedata);
 
+/**
+ * @brief Queue count lines without waiting, linedata must stay valid until lcd_draw_lines_finish().
+ */
+void lcd_draw_lines_start(spi_device_handle_t spi, int ypos, uint16_t *linedata, int count);
+void lcd_draw_lines_finish(spi_device_handle_t spi);
+
+/**
+ * @brief Send pixel_num pixels of one line starting at pixel offset.
+ */
+void lcd_draw_line_window(spi_device_handle_t spi, int ypos, int offset, uint16_t *linedata, int pixel_num);
+
 #ifdef __cplusplus
 }
 #endif
@@ -393,7 +393,7 @@ static void send_line_finish(spi_device_handle_t spi)
  * sent faster (compared to calling spi_device_transmit several times), and at
  * the mean while the lines for next transactions can get calculated.
  */
-void lcd_draw_lines(spi_device_handle_t spi, int ypos, uint16_t *linedata)
+static void queue_window(spi_device_handle_t spi, int ypos, int count, int col, int ncol, uint16_t *linedata)
 {
     esp_err_t ret;
     int x;
@@ -421,31 +421,28 @@ void lcd_draw_lines(spi_device_handle_t spi, int ypos, uint16_t *linedata)
 
     ypos += DISPLAY_ROW_OFFSET;
 
+    /*!< Exact column window so that several lines (or part of a line) can be sent at once */
+    col += DISPLAY_COL_OFFSET;
     trans[0].tx_data[0] = 0x2A;         /*!< Column Address Set */
-    trans[1].tx_data[0] = (DISPLAY_COL_OFFSET) >> 8;            /*!< Start Col High */
-    trans[1].tx_data[1] = (DISPLAY_COL_OFFSET) & 0xff;            /*!< Start Col Low */
-    #if defined( CONFIG_LCD_TYPE_GC9107 )
-    trans[1].tx_data[2] = (DISPLAY_HEIGHT+DISPLAY_COL_OFFSET-1) >> 8;   /*!< End Col High */
-    trans[1].tx_data[3] = (DISPLAY_HEIGHT+DISPLAY_COL_OFFSET-1) & 0xff; /*!< End Col Low */
-    #else
-    trans[1].tx_data[2] = (320) >> 8;   /*!< End Col High */
-    trans[1].tx_data[3] = (320) & 0xff; /*!< End Col Low */
-    #endif
+    trans[1].tx_data[0] = col >> 8;     /*!< Start Col High */
+    trans[1].tx_data[1] = col & 0xff;   /*!< Start Col Low */
+    trans[1].tx_data[2] = (col + ncol - 1) >> 8;   /*!< End Col High */
+    trans[1].tx_data[3] = (col + ncol - 1) & 0xff; /*!< End Col Low */
 
     trans[2].tx_data[0] = 0x2B;         /*!< Page address set */
     trans[3].tx_data[0] = ypos >> 8;    /*!< Start page high */
     trans[3].tx_data[1] = ypos & 0xff;  /*!< start page low */
     #if defined( CONFIG_LCD_TYPE_GC9107 )
-    trans[3].tx_data[2] = (ypos + PARALLEL_LINES-1) >> 8; /*!< end page high */
-    trans[3].tx_data[3] = (ypos + PARALLEL_LINES-1) & 0xff; /*!< end page low */
+    trans[3].tx_data[2] = (ypos + count - 1) >> 8; /*!< end page high */
+    trans[3].tx_data[3] = (ypos + count - 1) & 0xff; /*!< end page low */
     #else
-    trans[3].tx_data[2] = (ypos + PARALLEL_LINES) >> 8; /*!< end page high */
-    trans[3].tx_data[3] = (ypos + PARALLEL_LINES) & 0xff; /*!< end page low */
+    trans[3].tx_data[2] = (ypos + count) >> 8; /*!< end page high */
+    trans[3].tx_data[3] = (ypos + count) & 0xff; /*!< end page low */
     #endif
 
     trans[4].tx_data[0] = 0x2C;         /*!< memory write */
     trans[5].tx_buffer = linedata;      /*!< finally send the line data */
-    trans[5].length = DISPLAY_HEIGHT * 2 * 8 * PARALLEL_LINES;  /*!< Data length, in bits */
+    trans[5].length = ncol * 2 * 8 * count;  /*!< Data length, in bits */
     trans[5].flags = 0; /*!< undo SPI_TRANS_USE_TXDATA flag */
 
     /*!< Queue all transactions. */
@@ -457,8 +454,28 @@ void lcd_draw_lines(spi_device_handle_t spi, int ypos, uint16_t *linedata)
     /*!< When we are here, the SPI driver is busy (in the background) getting the transactions sent. That happens */
     /*!< mostly using DMA, so the CPU doesn't have much to do here. We're not going to wait for the transaction to */
     /*!< finish because we may as well spend the time calculating the next line. When that is done, we can call */
-    /*!< send_line_finish, which will wait for the transfers to be done and check their status. */
+    /*!< lcd_draw_lines_finish, which will wait for the transfers to be done and check their status. */
+}
+
+void lcd_draw_lines_start(spi_device_handle_t spi, int ypos, uint16_t *linedata, int count)
+{
+    queue_window(spi, ypos, count, 0, DISPLAY_HEIGHT, linedata);
+}
+
+void lcd_draw_line_window(spi_device_handle_t spi, int ypos, int offset, uint16_t *linedata, int pixel_num)
+{
+    queue_window(spi, ypos, 1, offset, pixel_num, linedata);
+    send_line_finish(spi);
+}
 
+void lcd_draw_lines_finish(spi_device_handle_t spi)
+{
+    send_line_finish(spi);
+}
+
+void lcd_draw_lines(spi_device_handle_t spi, int ypos, uint16_t *linedata)
+{
+    lcd_draw_lines_start(spi, ypos, linedata, PARALLEL_LINES);
     send_line_finish(spi);
 }
 
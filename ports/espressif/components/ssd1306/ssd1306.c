@@ -111,6 +111,44 @@ void ssd1306_display_text(SSD1306_t * dev, int page, char * text, int text_len,
 	}
 }
 
+// Draw a line of text (16 chars at most) into a page of an off-screen frame of _pages x 128 bytes,
+// the rest of the page is cleared. Nothing is sent, see ssd1306_update_frame()
+void ssd1306_frame_text(SSD1306_t * dev, uint8_t * frame, int page, const char * text, bool invert)
+{
+	if (page >= dev->_pages) return;
+	uint8_t * segs = &frame[page * 128];
+	memset(segs, invert ? 0xFF : 0x00, 128);
+
+	for (int i = 0; i < 16 && text[i]; i++) {
+		uint8_t * image = &segs[i * 8];
+		memcpy(image, font8x8_basic_tr[(uint8_t)text[i] & 0x7F], 8);
+		if (invert) ssd1306_invert(image, 8);
+		if (dev->_flip) ssd1306_flip(image, 8);
+	}
+}
+
+// Send the pages of frame that differ from the internal buffer, which holds what the display shows.
+// Only the changed columns of a page are sent. Returns number of pages sent
+int ssd1306_update_frame(SSD1306_t * dev, const uint8_t * frame)
+{
+	int sent = 0;
+	for (int page = 0; page < dev->_pages; page++) {
+		const uint8_t * segs = &frame[page * 128];
+		const uint8_t * shown = dev->_page[page]._segs;
+
+		int first = 0;
+		while (first < dev->_width && segs[first] == shown[first]) first++;
+		if (first == dev->_width) continue;
+
+		int last = dev->_width - 1;
+		while (segs[last] == shown[last]) last--;
+
+		ssd1306_display_image(dev, page, first, (uint8_t *)&segs[first], last - first + 1);
+		sent++;
+	}
+	return sent;
+}
+
 // by Coert Vonk
 void
 ssd1306_display_text_x3(SSD1306_t * dev, int page, char * text, int text_len, bool invert)
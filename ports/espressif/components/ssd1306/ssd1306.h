@@ -116,6 +116,8 @@ void ssd1306_get_buffer(SSD1306_t * dev, uint8_t * buffer);
 void ssd1306_display_image(SSD1306_t * dev, int page, int seg, uint8_t * images, int width);
 void ssd1306_display_text(SSD1306_t * dev, int page, char * text, int text_len, bool invert);
 void ssd1306_display_text_x3(SSD1306_t * dev, int page, char * text, int text_len, bool invert);
+void ssd1306_frame_text(SSD1306_t * dev, uint8_t * frame, int page, const char * text, bool invert);
+int ssd1306_update_frame(SSD1306_t * dev, const uint8_t * frame);
 void ssd1306_clear_screen(SSD1306_t * dev, bool invert);
 void ssd1306_clear_line(SSD1306_t * dev, int page, bool invert);
 void ssd1306_contrast(SSD1306_t * dev, int contrast);
@@ -0,0 +1,84 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+// Board functions used by the measurement volume when it is linked into the application
+// (CFG_UF2_APP_EXPORT). ota1 is read through a data mmap: a read is a copy out of the flash
+// cache, it takes no SPI flash lock and never holds off the sampling task programming ota1.
+// The USB task should run below the sampling task, reads then only use otherwise idle time.
+//
+// Application side:
+//   tusb_init();
+//   uf2_init();                   // measurement scan is deferred to the host's first access
+//   ...
+//   append records to ota1, then uf2_measurement_changed()
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+
+#include "board_api.h"
+#include "uf2.h"
+
+static const char* TAG = "uf2_export";
+
+static esp_partition_t const* _part = NULL;
+
+// whole ota1 mapped once, NULL if that failed: reads fall back to esp_partition_read()
+static uint8_t const* _map = NULL;
+static esp_partition_mmap_handle_t _map_handle;
+
+static void export_open(void) {
+  if (_part) return;
+
+  _part = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, NULL);
+  assert(_part != NULL);
+
+  void const* ptr;
+  if (ESP_OK == esp_partition_mmap(_part, 0, _part->size, ESP_PARTITION_MMAP_DATA, &ptr, &_map_handle)) {
+    _map = ptr;
+  } else {
+    ESP_LOGW(TAG, "ota1 mmap failed, reading through spi flash");
+  }
+}
+
+uint32_t board_measuremnt_data_size(void) {
+  export_open();
+  return _part->size;
+}
+
+void board_measuremnt_data_read(uint32_t addr, void* buffer, uint32_t len) {
+  export_open();
+  if (_map) {
+    memcpy(buffer, _map + addr, len);
+  } else {
+    esp_partition_read(_part, addr, buffer, len);
+  }
+}
+
+uint32_t board_crc32(uint32_t crc, void const* buf, uint32_t len) {
+  return esp_rom_crc32_le(crc, (uint8_t const*) buf, len);
+}
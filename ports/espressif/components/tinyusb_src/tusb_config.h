@@ -74,6 +74,17 @@
 #define CFG_TUSB_MEM_ALIGN          __attribute__ ((aligned(4)))
 #endif
 
+// DWC2 core of ESP32-S2/S3 has internal DMA: let it move packets to/from the transfer buffers instead of
+// the CPU copying each one through the FIFO in tud_task/ISR. Buffers above are .bss in internal DRAM
+// (reachable by the USB DMA) as long as CONFIG_SPIRAM_ALLOW_BSS_SEG_EXTERNAL_MEMORY is not set
+#ifndef CFG_TUD_DWC2_DMA_ENABLE
+#define CFG_TUD_DWC2_DMA_ENABLE     1
+#endif
+
+#if CFG_TUD_DWC2_DMA_ENABLE && defined(CONFIG_SPIRAM_ALLOW_BSS_SEG_EXTERNAL_MEMORY)
+  #error "USB DMA can not reach transfer buffers in PSRAM, set CFG_TUSB_MEM_SECTION to internal RAM"
+#endif
+
 //--------------------------------------------------------------------
 // DEVICE CONFIGURATION
 //--------------------------------------------------------------------
@@ -87,7 +98,8 @@
 #define CFG_TUD_MSC              1
 #define CFG_TUD_HID              0
 #define CFG_TUD_MIDI             0
-#define CFG_TUD_VENDOR           0
+#define CFG_TUD_VENDOR           1
+#define CFG_TUD_DFU              1
 
 //------------- CDC -------------//
 
@@ -104,8 +116,23 @@
 #define CFG_TUD_CDC_EP_BUFSIZE   64
 
 //------------- MSC -------------//
-// MSC Buffer size of Device Mass storage
-#define CFG_TUD_MSC_BUFSIZE      4096
+// MSC Buffer size of Device Mass storage, data of a READ10/WRITE10 is passed to the callbacks in
+// chunks of this size. 16KB is 32 uf2 blocks per call, must divide the 64KB flash cache window.
+// The class has a single buffer, the next chunk is only received once the WRITE10 callback returned.
+// With the flash task the callback only copies payloads (write_cb_max_us in STATS.TXT), the gap is
+// small next to the more than 10 ms a 16KB chunk takes at full speed. ESP32-S3 has the SRAM for
+// half the callbacks, the read-ahead buffers follow (FLASH_READ_AHEAD_SIZE in board_flash.c)
+#ifndef CFG_TUD_MSC_BUFSIZE
+  #if CONFIG_IDF_TARGET_ESP32S3
+    #define CFG_TUD_MSC_BUFSIZE    32768
+  #else
+    #define CFG_TUD_MSC_BUFSIZE    16384
+  #endif
+#endif
+
+//------------- DFU -------------//
+// DFU transfer size, one DNLOAD/UPLOAD block. Larger means less GETSTATUS round trips
+#define CFG_TUD_DFU_XFER_BUFSIZE 4096
 
 //------------- HID -------------//
 // HID buffer size Should be sufficient to hold ID (if any) + Data
@@ -114,7 +141,7 @@
 //------------- Vendor -------------//
 // Vendor FIFO size of TX and RX
 // If not configured vendor endpoints will not be buffered
-#define CFG_TUD_VENDOR_RX_BUFSIZE 64
+#define CFG_TUD_VENDOR_RX_BUFSIZE 1024
 #define CFG_TUD_VENDOR_TX_BUFSIZE 64
 
 #ifdef __cplusplus
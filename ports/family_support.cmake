@@ -204,6 +204,7 @@ function(family_configure_tinyuf2 TARGET OPT_MCU)
 
   include(${TOP}/src/tinyuf2.cmake)
   add_tinyuf2(${TARGET})
+  tinyuf2_add_memreport(${TARGET} $<TARGET_FILE:${TARGET}> $<TARGET_FILE:${TARGET}>.map)
 
   family_add_uf2version(${TARGET} "${FAMILY_SUBMODULE_DEPS}")
   family_add_tinyusb(${TARGET} ${OPT_MCU} none)
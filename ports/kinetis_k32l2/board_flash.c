@@ -23,22 +23,41 @@
  */
 
 #include "board_api.h"
+#include "flash_cache.h"
 #include "fsl_flash.h"
 #include "tusb.h" // for logging
 
-// FLASH
-#define NO_CACHE        0xffffffff
-
-#define FLASH_PAGE_SIZE 1024
+// FLASH, written through the shared cache (CFG_UF2_FLASH_CACHE)
+// FLASH_Erase takes several 1KB sectors at once, 4 sectors are cached and handled per FTFA call
+#define FLASH_PAGE_SIZE   1024
+#define FLASH_ERASE_SIZE  (4*1024)
 #define FILESYSTEM_BLOCK_SIZE 256
 
-static uint32_t bf_flash_page_addr = NO_CACHE;
-static uint8_t  bf_flash_cache[FLASH_PAGE_SIZE] __attribute__((aligned(4)));
+// DFU session: the flash controller speculates on data fetches too (off after reset), CURRENT.UF2 and
+// backups read flash sequentially with memcpy. The app starts after a reset with the default again
+#ifndef FLASH_DATA_SPECULATION
+#define FLASH_DATA_SPECULATION  1
+#endif
+
 /*! @brief Flash driver Structure */
 static flash_config_t bf_flash_config;
 /*! @brief Flash cache driver Structure */
 static ftfx_cache_config_t bf_cache_config;
 
+#if FLASH_DATA_SPECULATION
+static ftfx_prefetch_speculation_status_t bf_speculation = { .instructionOff = false, .dataOff = false };
+#endif
+
+// Flash contents changed: drop cached lines and speculation buffers, the controller has no clear by address.
+// Speculation as set up by board_flash_init() again
+static void flash_cache_resync(void)
+{
+  FTFx_CACHE_ClearCachePrefetchSpeculation(&bf_cache_config, false);
+#if FLASH_DATA_SPECULATION
+  FTFx_CACHE_PflashSetPrefetchSpeculation(&bf_speculation);
+#endif
+}
+
 //--------------------------------------------------------------------+
 //
 //--------------------------------------------------------------------+
@@ -63,6 +82,12 @@ void board_flash_init(void)
     {
         TU_LOG1("FTFx_CACHE_Init failed");
     }
+#if FLASH_DATA_SPECULATION
+    if (kStatus_FTFx_Success != FTFx_CACHE_PflashSetPrefetchSpeculation(&bf_speculation))
+    {
+        TU_LOG1("FTFx_CACHE_PflashSetPrefetchSpeculation failed");
+    }
+#endif
     /* Get flash properties*/
     FLASH_GetProperty(&bf_flash_config, kFLASH_PropertyPflash0BlockBaseAddr, &pflashBlockBase);
     FLASH_GetProperty(&bf_flash_config, kFLASH_PropertyPflash0TotalSize, &pflashTotalSize);
@@ -77,65 +102,66 @@ uint32_t board_flash_size(void)
   return BOARD_FLASH_SIZE;
 }
 
+// Data still in the write cache is copied over, CURRENT.UF2 read during an update shows the image as written so far
 void board_flash_read(uint32_t addr, void* buffer, uint32_t len)
 {
   memcpy(buffer, (void*) addr, len);
+  flash_cache_read_overlay(addr, buffer, len);
 }
 
-void board_flash_flush(void)
+board_flash_geometry_t const* board_flash_geometry(void)
 {
-  status_t result;
-//  uint32_t failedAddress, failedData;
-
-  if ( bf_flash_page_addr == NO_CACHE ) return;
-
-//  result = FLASH_VerifyProgram(&_flash_config, _flash_page_addr, FLASH_PAGE_SIZE, (const uint8_t *)_flash_cache, &failedAddress, &failedData);
-//  if (result != kStatus_Success) {
+  static board_flash_geometry_t const geo =
+  {
+    .erase_size   = FLASH_ERASE_SIZE,
+    .block_size   = 0,
+    .program_size = FLASH_PAGE_SIZE,
+    .erased_value = 0xff,
+    .xip          = true,
+  };
+  return &geo;
+}
 
-  // skip matching contents
-  if ( memcmp(bf_flash_cache, (void*) bf_flash_page_addr, FLASH_PAGE_SIZE) ) {
-    TU_LOG1("Clear cache prefetch speculation for flush operation.\r\n");
+bool board_flash_erase_raw(uint32_t addr, uint32_t len)
+{
+  /* Pre-preparation work about flash Cache/Prefetch/Speculation. */
+  FTFx_CACHE_ClearCachePrefetchSpeculation(&bf_cache_config, true);
 
-    /* Pre-preparation work about flash Cache/Prefetch/Speculation. */
-    FTFx_CACHE_ClearCachePrefetchSpeculation(&bf_cache_config, true);
+  __disable_irq();
+  status_t const result = FLASH_Erase(&bf_flash_config, addr, len, kFLASH_ApiEraseKey);
+  __enable_irq();
 
-    TU_LOG1("Erase and Write at address = 0x%08lX...\r\n", bf_flash_page_addr);
-    __disable_irq();
-    result = FLASH_Erase(&bf_flash_config, bf_flash_page_addr, FLASH_PAGE_SIZE, kFLASH_ApiEraseKey);
-    if (kStatus_FTFx_Success != result) {
-        TU_LOG1("FLASH_Erase failed at address = 0x%08lX\r\n",bf_flash_page_addr);
-    }
-    TU_LOG1("Erased...\r\n");
-    result = FLASH_Program(&bf_flash_config, bf_flash_page_addr, bf_flash_cache, FLASH_PAGE_SIZE);
-    if (kStatus_FTFx_Success != result) {
-        TU_LOG1("FLASH_Program failed at address = 0x%08lX\r\n",bf_flash_page_addr);
-    }
-    __enable_irq();
-    TU_LOG1("Programmed.\r\n");
+  /* Post-preparation work about flash Cache/Prefetch/Speculation. */
+  flash_cache_resync();
 
-    /* Post-preparation work about flash Cache/Prefetch/Speculation. */
-    FTFx_CACHE_ClearCachePrefetchSpeculation(&bf_cache_config, false);
+  if (kStatus_FTFx_Success != result) {
+    TU_LOG1("FLASH_Erase failed at address = 0x%08lX\r\n", addr);
+    return false;
   }
-
-  bf_flash_page_addr = NO_CACHE;
+  return true;
 }
 
+// A run of sectors is programmed with one command: Program Section through the programming
+// acceleration RAM where the FTFA has it, otherwise by longword
+bool board_flash_program(uint32_t addr, void const* data, uint32_t len)
+{
+  FTFx_CACHE_ClearCachePrefetchSpeculation(&bf_cache_config, true);
+
+  __disable_irq();
+#if defined(FSL_FEATURE_FLASH_HAS_PROGRAM_SECTION_CMD) && FSL_FEATURE_FLASH_HAS_PROGRAM_SECTION_CMD
+  status_t const result = FLASH_ProgramSection(&bf_flash_config, addr, (uint8_t*) (uintptr_t) data, len);
+#else
+  status_t const result = FLASH_Program(&bf_flash_config, addr, (uint8_t*) (uintptr_t) data, len);
+#endif
+  __enable_irq();
 
-bool board_flash_write(uint32_t addr, void const* data, uint32_t len) {
-  uint32_t newAddr = addr & ~(FLASH_PAGE_SIZE - 1);
-  // int32_t result;
+  // data read back by memcpy (verify, CURRENT.UF2) must not come from lines fetched before programming
+  flash_cache_resync();
 
-  if (newAddr != bf_flash_page_addr) {
-    board_flash_flush();
-    bf_flash_page_addr = newAddr;
-    board_flash_read(newAddr, bf_flash_cache, FLASH_PAGE_SIZE);
-    // result = FLASH_Read(&_flash_config, newAddr, _flash_cache, FLASH_PAGE_SIZE);
-    // if (result != kStatus_Success) {
-    //   TU_LOG1("Flash read error at address = 0x%08lX\r\n", _flash_page_addr);
-    // }
+  if (kStatus_FTFx_Success != result) {
+    TU_LOG1("FLASH_Program failed at address = 0x%08lX\r\n", addr);
+    return false;
   }
-  memcpy(bf_flash_cache + (addr & (FLASH_PAGE_SIZE - 1)), data, len);
-
   return true;
 }
 
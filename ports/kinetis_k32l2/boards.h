@@ -37,6 +37,9 @@
 #define BOARD_FLASH_APP_START    0x8000
 //#define BOARD_FLASH_SIZE         (BOARD_FLASH_TOTAL - BOARD_FLASH_APP_START)
 
+// board_flash_write() and flush by the shared write-back cache, see flash_cache.h
+#define CFG_UF2_FLASH_CACHE      1
+
 #ifdef __cplusplus
  }
 #endif
@@ -23,6 +23,7 @@
  */
 
 #include "board_api.h"
+#include "flash_cache.h"
 #include "fsl_device_registers.h"
 #include "fsl_rtc.h"
 #include "fsl_iap.h"
@@ -85,15 +86,15 @@ static uint8_t const _led_tricolor[3][2] = LED_TRICOLOR_GPIO;
 
 #define IOCON_VBUS_CONFIG        IOCON_PIO_DIG_FUNC7_EN /*!<@brief Digital pin function 7 enabled */
 
-// FLASH
-#define NO_CACHE        0xffffffff
-
-#define FLASH_PAGE_SIZE 512
+// FLASH, written through the shared cache (CFG_UF2_FLASH_CACHE)
+// IAP erases any multiple of the 512 byte page in one call: 8 pages are cached and erased at once,
+// the first unit of a 32KB block inside the erase ahead range erases the whole block
+#define FLASH_PAGE_SIZE   512
+#define FLASH_ERASE_SIZE  (4*1024)
+#define FLASH_BLOCK_SIZE  (32*1024)
 #define FILESYSTEM_BLOCK_SIZE 256
 
 static flash_config_t _flash_config;
-static uint32_t _flash_page_addr = NO_CACHE;
-static uint8_t  _flash_cache[FLASH_PAGE_SIZE] __attribute__((aligned(4)));
 
 //--------------------------------------------------------------------+
 //
@@ -108,44 +109,64 @@ uint32_t board_flash_size(void)
   return BOARD_FLASH_SIZE;
 }
 
+// Erased pages fail to read with an ECC error, they are returned as 0xff. Data still in the write
+// cache is copied over, CURRENT.UF2 read during an update shows the image as written so far
 void board_flash_read(uint32_t addr, void* buffer, uint32_t len)
 {
-  FLASH_Read(&_flash_config, addr, buffer, len);
-}
-
-void board_flash_flush(void)
-{
-  status_t status;
-  uint32_t failedAddress, failedData;
+  uint8_t* dst = (uint8_t*) buffer;
+  uint32_t const start = addr;
+  uint32_t const total = len;
 
-  if ( _flash_page_addr == NO_CACHE ) return;
+  while ( len )
+  {
+    uint32_t const remain = FLASH_PAGE_SIZE - (addr & (FLASH_PAGE_SIZE - 1));
+    uint32_t const count = (len < remain) ? len : remain;
 
-  status = FLASH_VerifyProgram(&_flash_config, _flash_page_addr, FLASH_PAGE_SIZE, (const uint8_t *)_flash_cache, &failedAddress, &failedData);
+    if ( FLASH_Read(&_flash_config, addr, dst, count) != kStatus_Success )
+    {
+      memset(dst, 0xff, count);
+    }
 
-  if (status != kStatus_Success) {
-    TU_LOG1("Erase and Write at address = 0x%08lX\r\n",_flash_page_addr);
-    status = FLASH_Erase(&_flash_config, _flash_page_addr, FLASH_PAGE_SIZE, kFLASH_ApiEraseKey);
-    status = FLASH_Program(&_flash_config, _flash_page_addr, _flash_cache, FLASH_PAGE_SIZE);
+    addr += count;
+    dst += count;
+    len -= count;
   }
 
-  _flash_page_addr = NO_CACHE;
+  flash_cache_read_overlay(start, buffer, total);
 }
 
-bool board_flash_write(uint32_t addr, void const* data, uint32_t len)
+board_flash_geometry_t const* board_flash_geometry(void)
 {
-  uint32_t newAddr = addr & ~(FLASH_PAGE_SIZE - 1);
-  int32_t status;
-
-  if (newAddr != _flash_page_addr) {
-    board_flash_flush();
-    _flash_page_addr = newAddr;
-    status = FLASH_Read(&_flash_config, newAddr, _flash_cache, FLASH_PAGE_SIZE);
-    if (status != kStatus_Success) {
-      TU_LOG1("Flash read error at address = 0x%08lX\r\n", _flash_page_addr);
-    }
+  static board_flash_geometry_t const geo =
+  {
+    .erase_size   = FLASH_ERASE_SIZE,
+    .block_size   = FLASH_BLOCK_SIZE,
+    .program_size = FLASH_PAGE_SIZE,
+    .erased_value = 0xff,
+    .xip          = false,   // erased flash must not be read directly
+  };
+  return &geo;
+}
+
+bool board_flash_erase_raw(uint32_t addr, uint32_t len)
+{
+  status_t const status = FLASH_Erase(&_flash_config, addr, len, kFLASH_ApiEraseKey);
+  if ( status != kStatus_Success )
+  {
+    TU_LOG1("Erase failed at address = 0x%08lX, status = %ld\r\n", addr, status);
+    return false;
   }
-  memcpy(_flash_cache + (addr & (FLASH_PAGE_SIZE - 1)), data, len);
+  return true;
+}
 
+bool board_flash_program(uint32_t addr, void const* data, uint32_t len)
+{
+  status_t const status = FLASH_Program(&_flash_config, addr, (uint8_t*) (uintptr_t) data, len);
+  if ( status != kStatus_Success )
+  {
+    TU_LOG1("Program failed at address = 0x%08lX, status = %ld\r\n", addr, status);
+    return false;
+  }
   return true;
 }
 
@@ -296,8 +317,28 @@ void board_dfu_init(void)
   USBHSH->PORTMODE = USBHSH_PORTMODE_SW_PDCOM_MASK;
   /* According to reference manual, device mode setting has to be set by access usb host register */
   USBHSH->PORTMODE |= USBHSH_PORTMODE_DEV_ENABLE_MASK;
-  /* enable usb1 host clock */
+  /* disable usb1 host clock */
   CLOCK_DisableClock(kCLOCK_Usbh1);
+
+  // High speed PHY runs from the PLL of the 16 MHz crystal, the device controller from the PHY
+  CLOCK_EnableUsbhs0PhyPllClock(kCLOCK_UsbPhySrcExt, BOARD_XTAL0_CLK_HZ);
+  CLOCK_EnableUsbhs0DeviceClock(kCLOCK_UsbSrcUnused, 0U);
+  CLOCK_EnableClock(kCLOCK_UsbRam1);
+
+  // Enable PHY support for low speed device and LS via FS hub
+  USBPHY->CTRL |= USBPHY_CTRL_SET_ENUTMILEVEL2_MASK | USBPHY_CTRL_SET_ENUTMILEVEL3_MASK;
+
+  // Enable all power for normal operation
+  USBPHY->PWD = 0;
+
+  USBPHY->CTRL_SET = USBPHY_CTRL_SET_ENAUTOCLR_CLKGATE_MASK;
+  USBPHY->CTRL_SET = USBPHY_CTRL_SET_ENAUTOCLR_PHY_PWD_MASK;
+
+  // TX timing calibration
+  uint32_t phytx = USBPHY->TX;
+  phytx &= ~(USBPHY_TX_D_CAL_MASK | USBPHY_TX_TXCAL45DM_MASK | USBPHY_TX_TXCAL45DP_MASK);
+  phytx |= USBPHY_TX_D_CAL(0x0C) | USBPHY_TX_TXCAL45DP(0x06) | USBPHY_TX_TXCAL45DM(0x06);
+  USBPHY->TX = phytx;
   #endif
 #endif
 
@@ -38,6 +38,14 @@
 #define TINYUF2_DBL_TAP_DFU      1
 #define TINYUF2_DBL_TAP_REG      RTC->GPREG[7]
 
+// Crystal clocking the high speed PHY of USB1 (BOARD_TUD_RHPORT=1)
+#ifndef BOARD_XTAL0_CLK_HZ
+#define BOARD_XTAL0_CLK_HZ       16000000U
+#endif
+
+// board_flash_write() and flush by the shared write-back cache, see flash_cache.h
+#define CFG_UF2_FLASH_CACHE      1
+
 #ifdef __cplusplus
  }
 #endif
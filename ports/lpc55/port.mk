@@ -5,6 +5,9 @@ SDK_DIR = lib/mcu/nxp/mcux-sdk
 MCU_DIR = $(SDK_DIR)/devices/$(MCU)
 CMSIS_5 = lib/CMSIS_5
 
+# Choose which USB port to use: USB0 is full speed, USB1 is high speed with the integrated PHY
+BOARD_TUD_RHPORT ?= 0
+
 # Port Compiler Flags
 CFLAGS += \
   -flto \
@@ -13,7 +16,8 @@ CFLAGS += \
   -mcpu=cortex-m33 \
   -mfloat-abi=hard \
   -mfpu=fpv5-sp-d16 \
-  -DCFG_TUSB_MCU=OPT_MCU_LPC55XX
+  -DCFG_TUSB_MCU=OPT_MCU_LPC55XX \
+  -DBOARD_TUD_RHPORT=$(BOARD_TUD_RHPORT)
 
 # suppress warning caused by vendor mcu driver
 CFLAGS += -Wno-error=unused-parameter -Wno-error=float-equal
@@ -47,6 +47,11 @@
 #define BOARD_TUD_RHPORT         0
 #endif
 
+// USB1 is the high speed controller
+#if BOARD_TUD_RHPORT == 1
+#define CFG_TUD_MAX_SPEED        OPT_MODE_HIGH_SPEED
+#endif
+
 // can be defined by compiler in DEBUG build
 #ifndef CFG_TUSB_DEBUG
 #define CFG_TUSB_DEBUG           0
@@ -59,7 +64,15 @@
  * - CFG_TUSB_MEM SECTION : __attribute__ (( section(".usb_ram") ))
  * - CFG_TUSB_MEM_ALIGN   : __attribute__ ((aligned(4)))
  */
-#define CFG_TUSB_MEM_SECTION      __attribute__((section(".data")))
+#ifndef CFG_TUSB_MEM_SECTION
+  #if BOARD_TUD_RHPORT == 1
+  // USB1 can only access the 16KB USB RAM (m_usb_sram of the SDK linker script)
+  #define CFG_TUSB_MEM_SECTION    __attribute__((section("m_usb_global")))
+  #else
+  #define CFG_TUSB_MEM_SECTION    __attribute__((section(".data")))
+  #endif
+#endif
+
 #define CFG_TUSB_MEM_ALIGN        __attribute__((aligned(64)))
 
 //--------------------------------------------------------------------
@@ -77,7 +90,8 @@
 #define CFG_TUD_MIDI             0
 #define CFG_TUD_VENDOR           0
 
-// MSC Buffer size of Device Mass storage
+// MSC Buffer size of Device Mass storage, a multiple of the 512 byte high speed packet. With USB1 it
+// lives in USB RAM next to the endpoint buffers
 #define CFG_TUD_MSC_BUFSIZE      4096
 
 // HID buffer size Should be sufficient to hold ID (if any) + Data
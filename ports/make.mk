@@ -77,12 +77,32 @@ CFLAGS += \
 
 # Bootloader src, board folder and TinyUSB stack
 SRC_C += \
+  src/access.c \
+  src/compress.c \
+  src/decompress.c \
+  src/deflate.c \
+  src/delta.c \
+  src/dfu.c \
+  src/file_container.c \
+  src/flash_cache.c \
   src/ghostfat.c \
   src/images.c \
+  src/log_deferred.c \
   src/main.c \
+  src/measurement_cache.c \
+  src/measurement_cdc.c \
+  src/measurement_csv.c \
+  src/measurement_gz.c \
+  src/measurement_pack.c \
+  src/measurement_ring.c \
   src/msc.c \
+  src/scratch.c \
+  src/sched.c \
   src/screen.c \
+  src/splash.c \
+  src/trace.c \
   src/usb_descriptors.c \
+  src/vendor.c \
   $(subst $(TOP)/,,$(wildcard $(TOP)/$(BOARD_DIR)/*.c))
 
 endif # BUILD_APPLICATION
@@ -132,6 +152,21 @@ endif
 LOG ?= 0
 CFLAGS += -DTUF2_LOG=$(LOG) -DCFG_TUSB_DEBUG=$(LOG)
 
+# Deferred log: log sites only queue format and arguments, printed from the main loop
+ifeq ($(LOG_DEFERRED),1)
+  CFLAGS += -DCFG_UF2_LOG_DEFERRED=1
+endif
+
+# Cycle counter trace points of the USB and flash paths, downloaded as TRACE.BIN
+ifeq ($(TRACE),1)
+  CFLAGS += -DCFG_UF2_TRACE=1
+endif
+
+# Sectors read and written by the host per region and LBA range, first commands after mount, as ACCESS.CSV
+ifeq ($(ACCESS),1)
+  CFLAGS += -DCFG_UF2_ACCESS=1
+endif
+
 # Logger: default is uart, can be set to rtt or swo
 ifeq ($(LOGGER),rtt)
   RTT_SRC = lib/SEGGER_RTT
@@ -42,9 +42,6 @@
 // i.e "--before no_reset" should not be include in the esptool.py command
 #define ESP32_DTR_RTS_BOOT_RESET_SUPPORT    0
 
-// optional API, not included in board_api.h
-int board_uart_read(uint8_t* buf, int len);
-
 //--------------------------------------------------------------------+
 // MACRO TYPEDEF CONSTANT ENUM DECLARATION
 //--------------------------------------------------------------------+
@@ -55,6 +52,9 @@ int board_uart_read(uint8_t* buf, int len);
 static volatile uint32_t _timer_count = 0;
 static uint32_t baud_rate = 115200;
 
+// set by SET_LINE_CODING, applied once UART TX is drained
+static volatile uint32_t _baud_pending = 0;
+
 //--------------------------------------------------------------------+
 // Timer
 //--------------------------------------------------------------------+
@@ -78,6 +78,100 @@ void board_timer_handler(void)
   _timer_count++;
 }
 
+//--------------------------------------------------------------------+
+// UART DMA
+//--------------------------------------------------------------------+
+
+// eDMA requests of UART_DEV
+#ifndef UART_RX_DMA_REQUEST
+#define UART_RX_DMA_REQUEST   kDmaRequestMuxLPUART1Rx
+#define UART_TX_DMA_REQUEST   kDmaRequestMuxLPUART1Tx
+#endif
+
+#define UART_RX_DMA_CH        0
+#define UART_TX_DMA_CH        1
+
+// RX ring is filled by eDMA without CPU, 4KB buffers ~13 ms at 3 Mbaud while USB is busy.
+// Both buffers are in DTCM (m_data) which is not cached
+#define UART_RX_RING_SIZE     4096
+#define UART_TX_BUF_SIZE      1024
+
+TU_VERIFY_STATIC((UART_RX_RING_SIZE & (UART_RX_RING_SIZE - 1)) == 0, "ring size must be power of 2");
+
+static uint8_t _rx_ring[UART_RX_RING_SIZE];
+static uint32_t _rx_tail = 0;
+static uint8_t _tx_buf[UART_TX_BUF_SIZE];
+
+static void uart_dma_init(void)
+{
+  CLOCK_EnableClock(kCLOCK_Dma);
+
+  DMAMUX->CHCFG[UART_RX_DMA_CH] = DMAMUX_CHCFG_SOURCE(UART_RX_DMA_REQUEST) | DMAMUX_CHCFG_ENBL_MASK;
+  DMAMUX->CHCFG[UART_TX_DMA_CH] = DMAMUX_CHCFG_SOURCE(UART_TX_DMA_REQUEST) | DMAMUX_CHCFG_ENBL_MASK;
+
+  // RX: one byte per request, the major loop covers the ring and DLAST rewinds it. Without DREQ
+  // the request stays enabled, the channel runs forever
+  DMA0->TCD[UART_RX_DMA_CH].SADDR         = LPUART_GetDataRegisterAddress(UART_DEV);
+  DMA0->TCD[UART_RX_DMA_CH].SOFF          = 0;
+  DMA0->TCD[UART_RX_DMA_CH].ATTR          = DMA_ATTR_SSIZE(0) | DMA_ATTR_DSIZE(0);
+  DMA0->TCD[UART_RX_DMA_CH].NBYTES_MLNO   = 1;
+  DMA0->TCD[UART_RX_DMA_CH].SLAST         = 0;
+  DMA0->TCD[UART_RX_DMA_CH].DADDR         = (uint32_t) _rx_ring;
+  DMA0->TCD[UART_RX_DMA_CH].DOFF          = 1;
+  DMA0->TCD[UART_RX_DMA_CH].CITER_ELINKNO = UART_RX_RING_SIZE;
+  DMA0->TCD[UART_RX_DMA_CH].BITER_ELINKNO = UART_RX_RING_SIZE;
+  DMA0->TCD[UART_RX_DMA_CH].DLAST_SGA     = (uint32_t) (-(int32_t) UART_RX_RING_SIZE);
+  DMA0->TCD[UART_RX_DMA_CH].CSR           = 0;
+  DMA0->SERQ = DMA_SERQ_SERQ(UART_RX_DMA_CH);
+
+  LPUART_EnableRxDMA(UART_DEV, true);
+  LPUART_EnableTxDMA(UART_DEV, true);
+}
+
+// position eDMA writes next in the RX ring
+static inline uint32_t uart_rx_head(void)
+{
+  return (UART_RX_RING_SIZE - DMA0->TCD[UART_RX_DMA_CH].CITER_ELINKNO) & (UART_RX_RING_SIZE - 1);
+}
+
+// DREQ clears the request when the last byte is handed to the LPUART FIFO
+static inline bool uart_tx_busy(void)
+{
+  return DMA0->ERQ & (1UL << UART_TX_DMA_CH);
+}
+
+static void uart_tx_start(uint32_t count)
+{
+  DMA0->TCD[UART_TX_DMA_CH].SADDR         = (uint32_t) _tx_buf;
+  DMA0->TCD[UART_TX_DMA_CH].SOFF          = 1;
+  DMA0->TCD[UART_TX_DMA_CH].ATTR          = DMA_ATTR_SSIZE(0) | DMA_ATTR_DSIZE(0);
+  DMA0->TCD[UART_TX_DMA_CH].NBYTES_MLNO   = 1;
+  DMA0->TCD[UART_TX_DMA_CH].SLAST         = 0;
+  DMA0->TCD[UART_TX_DMA_CH].DADDR         = LPUART_GetDataRegisterAddress(UART_DEV);
+  DMA0->TCD[UART_TX_DMA_CH].DOFF          = 0;
+  DMA0->TCD[UART_TX_DMA_CH].CITER_ELINKNO = count;
+  DMA0->TCD[UART_TX_DMA_CH].BITER_ELINKNO = count;
+  DMA0->TCD[UART_TX_DMA_CH].DLAST_SGA     = 0;
+  DMA0->TCD[UART_TX_DMA_CH].CSR           = DMA_CSR_DREQ_MASK;
+  DMA0->SERQ = DMA_SERQ_SERQ(UART_TX_DMA_CH);
+}
+
+static void uart_set_baudrate(uint32_t baud)
+{
+  // must be the same freq as board_init()
+  uint32_t freq;
+  if (CLOCK_GetMux(kCLOCK_UartMux) == 0) /* PLL3 div6 80M */
+  {
+    freq = (CLOCK_GetPllFreq(kCLOCK_PllUsb1) / 6U) / (CLOCK_GetDiv(kCLOCK_UartDiv) + 1U);
+  }
+  else
+  {
+    freq = CLOCK_GetOscFreq() / (CLOCK_GetDiv(kCLOCK_UartDiv) + 1U);
+  }
+
+  LPUART_SetBaudRate(UART_DEV, baud, freq);
+}
+
 //--------------------------------------------------------------------+
 // ESP32 Helper
 //--------------------------------------------------------------------+
@@ -126,6 +220,7 @@ int main(void)
   GPIO_PinInit(ESP32_RESET_PORT, ESP32_RESET_PIN, &pin_config);
 
   board_uart_init(115200);
+  uart_dma_init();
   board_usb_init();
   tusb_init();
 
@@ -137,33 +232,54 @@ int main(void)
 
   while(1)
   {
-    uint8_t serial_buf[512];
-    uint32_t count;
+    tud_task();
 
-    // UART -> USB
-    count = (uint32_t) board_uart_read(serial_buf, sizeof(serial_buf));
-    if (count)
+    // overrun stops the receiver until cleared, e.g after garbage during a baud rate change
+    if (LPUART_GetStatusFlags(UART_DEV) & kLPUART_RxOverrunFlag)
     {
-      board_led_write(0xff);
-
-      tud_cdc_write(serial_buf, count);
-      tud_cdc_write_flush();
-
-      board_led_write(0);
+      LPUART_ClearStatusFlags(UART_DEV, kLPUART_RxOverrunFlag);
     }
 
-    // USB -> UART
-    while ( tud_cdc_available() )
+    // UART -> USB: contiguous part of the RX ring, the rest stays there until CDC has room
+    uint32_t const head = uart_rx_head();
+    bool active = uart_tx_busy();
+
+    if (head != _rx_tail)
     {
-      board_led_write(0xff);
+      uint32_t const count = ((head > _rx_tail) ? head : UART_RX_RING_SIZE) - _rx_tail;
+      uint32_t const written = tud_cdc_write(_rx_ring + _rx_tail, count);
 
-      count = tud_cdc_read(serial_buf, sizeof(serial_buf));
-      board_uart_write(serial_buf, count);
+      _rx_tail = (_rx_tail + written) & (UART_RX_RING_SIZE - 1);
+      tud_cdc_write_flush();
+      active = true;
+    }
 
-      board_led_write(0);
+    // USB -> UART: host data stays in CDC FIFO (then endpoint NAKs) while a transfer is running.
+    // A new baud rate is applied once everything sent before it left the shifter
+    if (!uart_tx_busy())
+    {
+      if (_baud_pending)
+      {
+        if (LPUART_GetStatusFlags(UART_DEV) & kLPUART_TransmissionCompleteFlag)
+        {
+          uart_set_baudrate(_baud_pending);
+          _baud_pending = 0;
+        }
+      }
+      else if (tud_cdc_available())
+      {
+        uint32_t const count = tud_cdc_read(_tx_buf, sizeof(_tx_buf));
+        if (count) uart_tx_start(count);
+        active = true;
+      }
     }
 
-    tud_task();
+    static bool led_on = false;
+    if (active != led_on)
+    {
+      led_on = active;
+      board_led_write(led_on ? 0xff : 0);
+    }
   }
 }
 
@@ -192,18 +308,8 @@ void tud_cdc_line_coding_cb(uint8_t itf, cdc_line_coding_t const* line_coding)
   {
     baud_rate = line_coding->bit_rate;
 
-    // must be the same freq as board_init()
-    uint32_t freq;
-    if (CLOCK_GetMux(kCLOCK_UartMux) == 0) /* PLL3 div6 80M */
-    {
-      freq = (CLOCK_GetPllFreq(kCLOCK_PllUsb1) / 6U) / (CLOCK_GetDiv(kCLOCK_UartDiv) + 1U);
-    }
-    else
-    {
-      freq = CLOCK_GetOscFreq() / (CLOCK_GetDiv(kCLOCK_UartDiv) + 1U);
-    }
-
-    LPUART_SetBaudRate(UART_DEV, baud_rate, freq);
+    // esptool switches to up to 3 Mbaud after the ROM acknowledged CHANGE_BAUDRATE at the old rate
+    _baud_pending = baud_rate;
   }
 }
 
@@ -77,9 +77,9 @@
 //------------- CLASS -------------//
 #define CFG_TUD_CDC              1
 
-// CDC FIFO size of TX and RX
-#define CFG_TUD_CDC_RX_BUFSIZE   1024
-#define CFG_TUD_CDC_TX_BUFSIZE   1024
+// CDC FIFO size of TX and RX, large enough to keep up with 3 Mbaud while the other direction is busy
+#define CFG_TUD_CDC_RX_BUFSIZE   4096
+#define CFG_TUD_CDC_TX_BUFSIZE   4096
 
 #define CFG_TUD_CDC_EP_BUFSIZE   (TUD_OPT_HIGH_SPEED ? 512 : 64)
 
@@ -286,6 +286,16 @@ void test_print_adc(void) {
 #define LPSPI1_CLOCK_FREQ 105600000UL
 #define LPSPI_MAX_FREQ 25000000UL
 
+// data blocks are moved by eDMA, short command/token exchanges stay polled
+#define SD_SPI_DMA_MIN_SIZE 16
+#define SD_SPI_DMA_TX_CH    0
+#define SD_SPI_DMA_RX_CH    1 // higher channel number has higher priority, RX must never lag
+
+// throughput test: sequential CMD18 reads from block 0, CMD25 writes to the last chunk of the card
+#define SD_TEST_CHUNK_BLOCKS  8
+#define SD_TEST_READ_CHUNKS   64
+#define SD_TEST_WRITE_CHUNKS  16
+
 lpspi_master_config_t spi_config = {
     .baudRate = 400000UL,
     .bitsPerFrame = 8UL,
@@ -313,6 +323,13 @@ void sdhost_deinit(void){
 }
 
 static bool force_cs = false;
+
+// hold CS for a whole multi-block transaction instead of toggling it per exchange
+static void sdhost_select(bool selected) {
+  force_cs = selected;
+  digitalWrite(SD_CS, selected ? LOW : HIGH);
+}
+
 /*!< SPI CS active polarity */
 void sdhost_csActivePolarity(sdspi_cs_active_polarity_t polarity){
   if (polarity == kSDSPI_CsActivePolarityHigh) {
@@ -340,8 +357,78 @@ status_t sdhost_setFrequency(uint32_t frequency){
   return kStatus_Success;
 }
 
+// eDMA transfer of a data block, buffers are in DTCM (m_data) which is not cached.
+// NULL out sends 0xFF, NULL in discards received data
+static void sdhost_exchange_dma(uint8_t *out, uint8_t *in, uint32_t size) {
+  static uint8_t const dummy_tx = 0xFF;
+  static uint8_t dummy_rx;
+  static bool dma_inited = false;
+
+  if (!dma_inited) {
+    CLOCK_EnableClock(kCLOCK_Dma);
+    DMAMUX->CHCFG[SD_SPI_DMA_TX_CH] = DMAMUX_CHCFG_SOURCE(kDmaRequestMuxLPSPI1Tx) | DMAMUX_CHCFG_ENBL_MASK;
+    DMAMUX->CHCFG[SD_SPI_DMA_RX_CH] = DMAMUX_CHCFG_SOURCE(kDmaRequestMuxLPSPI1Rx) | DMAMUX_CHCFG_ENBL_MASK;
+    dma_inited = true;
+  }
+
+  LPSPI_FlushFifo(LPSPI1, true, true);
+  LPSPI_ClearStatusFlags(LPSPI1, kLPSPI_AllStatusFlag);
+
+  // polled transfers may leave RX/TX masked
+  LPSPI1->TCR &= ~(LPSPI_TCR_RXMSK_MASK | LPSPI_TCR_TXMSK_MASK | LPSPI_TCR_CONT_MASK);
+
+  DMA0->TCD[SD_SPI_DMA_RX_CH].SADDR         = LPSPI_GetRxRegisterAddress(LPSPI1);
+  DMA0->TCD[SD_SPI_DMA_RX_CH].SOFF          = 0;
+  DMA0->TCD[SD_SPI_DMA_RX_CH].ATTR          = DMA_ATTR_SSIZE(0) | DMA_ATTR_DSIZE(0);
+  DMA0->TCD[SD_SPI_DMA_RX_CH].NBYTES_MLNO   = 1;
+  DMA0->TCD[SD_SPI_DMA_RX_CH].SLAST         = 0;
+  DMA0->TCD[SD_SPI_DMA_RX_CH].DADDR         = (uint32_t) (in ? in : &dummy_rx);
+  DMA0->TCD[SD_SPI_DMA_RX_CH].DOFF          = in ? 1 : 0;
+  DMA0->TCD[SD_SPI_DMA_RX_CH].CITER_ELINKNO = size;
+  DMA0->TCD[SD_SPI_DMA_RX_CH].BITER_ELINKNO = size;
+  DMA0->TCD[SD_SPI_DMA_RX_CH].DLAST_SGA     = 0;
+  DMA0->TCD[SD_SPI_DMA_RX_CH].CSR           = DMA_CSR_DREQ_MASK;
+
+  DMA0->TCD[SD_SPI_DMA_TX_CH].SADDR         = (uint32_t) (out ? out : &dummy_tx);
+  DMA0->TCD[SD_SPI_DMA_TX_CH].SOFF          = out ? 1 : 0;
+  DMA0->TCD[SD_SPI_DMA_TX_CH].ATTR          = DMA_ATTR_SSIZE(0) | DMA_ATTR_DSIZE(0);
+  DMA0->TCD[SD_SPI_DMA_TX_CH].NBYTES_MLNO   = 1;
+  DMA0->TCD[SD_SPI_DMA_TX_CH].SLAST         = 0;
+  DMA0->TCD[SD_SPI_DMA_TX_CH].DADDR         = LPSPI_GetTxRegisterAddress(LPSPI1);
+  DMA0->TCD[SD_SPI_DMA_TX_CH].DOFF          = 0;
+  DMA0->TCD[SD_SPI_DMA_TX_CH].CITER_ELINKNO = size;
+  DMA0->TCD[SD_SPI_DMA_TX_CH].BITER_ELINKNO = size;
+  DMA0->TCD[SD_SPI_DMA_TX_CH].DLAST_SGA     = 0;
+  DMA0->TCD[SD_SPI_DMA_TX_CH].CSR           = DMA_CSR_DREQ_MASK;
+
+  DMA0->SERQ = DMA_SERQ_SERQ(SD_SPI_DMA_RX_CH);
+  DMA0->SERQ = DMA_SERQ_SERQ(SD_SPI_DMA_TX_CH);
+  LPSPI_EnableDMA(LPSPI1, kLPSPI_RxDmaEnable | kLPSPI_TxDmaEnable);
+
+  // RX completes last, the module stalls instead of overflowing RX FIFO
+  while (!(DMA0->TCD[SD_SPI_DMA_RX_CH].CSR & DMA_CSR_DONE_MASK)) {}
+
+  LPSPI_DisableDMA(LPSPI1, kLPSPI_RxDmaEnable | kLPSPI_TxDmaEnable);
+  DMA0->CDNE = DMA_CDNE_CDNE(SD_SPI_DMA_RX_CH);
+  DMA0->CDNE = DMA_CDNE_CDNE(SD_SPI_DMA_TX_CH);
+}
+
 /*!< Exchange data over SPI */
 status_t sdhost_exchange(uint8_t *out, uint8_t *in, uint32_t size) {
+  if (size >= SD_SPI_DMA_MIN_SIZE) {
+    if (!force_cs) {
+      digitalWrite(SD_CS, LOW);
+    }
+
+    sdhost_exchange_dma(out, in, size);
+
+    if (!force_cs) {
+      digitalWrite(SD_CS, HIGH);
+    }
+
+    return kStatus_Success;
+  }
+
   lpspi_transfer_t xfer = {
       .txData = out,
       .rxData = in,
@@ -384,6 +471,83 @@ sdspi_card_t sdcard = {
     .host = &sdhost,
 };
 
+static uint8_t sd_buf[SD_TEST_CHUNK_BLOCKS * 512];
+static uint8_t sd_saved[SD_TEST_CHUNK_BLOCKS * 512];
+
+static void print_speed(const char* name, uint32_t bytes, uint32_t ms) {
+  if (ms == 0) ms = 1;
+  printf("%s: %lu KB in %lu ms, %lu KB/s\r\n", name, bytes / 1024, ms, bytes / ms * 1000 / 1024);
+}
+
+// multi-block read/write throughput, the written chunk is verified then restored
+static bool test_sd_speed(void) {
+  uint32_t const chunk_size = SD_TEST_CHUNK_BLOCKS * sdcard.blockSize;
+  uint32_t const wr_block = sdcard.blockCount - SD_TEST_CHUNK_BLOCKS;
+  status_t status = kStatus_Success;
+
+  if (chunk_size > sizeof(sd_buf)) {
+    printf("SD block size %lu not supported\r\n", sdcard.blockSize);
+    return false;
+  }
+
+  sdhost_select(true);
+
+  uint32_t start_ms = millis();
+  for (uint32_t i = 0; i < SD_TEST_READ_CHUNKS && status == kStatus_Success; i++) {
+    status = SDSPI_ReadBlocks(&sdcard, sd_buf, i * SD_TEST_CHUNK_BLOCKS, SD_TEST_CHUNK_BLOCKS);
+  }
+  uint32_t const read_ms = millis() - start_ms;
+
+  if (status == kStatus_Success) {
+    status = SDSPI_ReadBlocks(&sdcard, sd_saved, wr_block, SD_TEST_CHUNK_BLOCKS);
+  }
+
+  uint32_t write_ms = 0;
+  if (status == kStatus_Success) {
+    for (uint32_t i = 0; i < chunk_size; i++) {
+      sd_buf[i] = (uint8_t) (i ^ (i >> 8));
+    }
+
+    start_ms = millis();
+    for (uint32_t i = 0; i < SD_TEST_WRITE_CHUNKS && status == kStatus_Success; i++) {
+      status = SDSPI_WriteBlocks(&sdcard, sd_buf, wr_block, SD_TEST_CHUNK_BLOCKS);
+    }
+    write_ms = millis() - start_ms;
+  }
+
+  bool verified = false;
+  if (status == kStatus_Success) {
+    status = SDSPI_ReadBlocks(&sdcard, sd_buf, wr_block, SD_TEST_CHUNK_BLOCKS);
+
+    verified = (status == kStatus_Success);
+    for (uint32_t i = 0; i < chunk_size && verified; i++) {
+      verified = (sd_buf[i] == (uint8_t) (i ^ (i >> 8)));
+    }
+
+    // restore even if verify failed
+    if (kStatus_Success != SDSPI_WriteBlocks(&sdcard, sd_saved, wr_block, SD_TEST_CHUNK_BLOCKS)) {
+      verified = false;
+    }
+  }
+
+  sdhost_select(false);
+
+  if (status != kStatus_Success) {
+    printf("SD multi-block transfer failed: %ld\r\n", status);
+    return false;
+  }
+
+  print_speed("SD read", SD_TEST_READ_CHUNKS * chunk_size, read_ms);
+  print_speed("SD write", SD_TEST_WRITE_CHUNKS * chunk_size, write_ms);
+
+  if (!verified) {
+    printf("SD write verify failed\r\n");
+    return false;
+  }
+
+  return true;
+}
+
 bool test_sd(void) {
   // init SD CS & Detect
   pinMode(SD_CS, OUTPUT);
@@ -416,6 +580,12 @@ bool test_sd(void) {
   }
   tud_cdc_write_flush();
 
+  if (status == kStatus_Success) {
+    bool const speed_ok = test_sd_speed();
+    tud_cdc_write_flush();
+    return speed_ok;
+  }
+
   return true;
 }
 
@@ -24,26 +24,26 @@
 
 #include "board_api.h"
 #include "romapi_flash.h"
+#include "flash_cache.h"
 
-#define FLASH_CACHE_SIZE          4096
-#define FLASH_CACHE_INVALID_ADDR  0xffffffff
-
-// FLASH
-#define NO_CACHE        0xffffffff
-
+// FLASH, written through the shared cache (CFG_UF2_FLASH_CACHE)
 #define SECTOR_SIZE     (4*1024)
+#define BLOCK_SIZE      (64*1024)
 #define FLASH_PAGE_SIZE 256
 
 // on-board flash is connected to FLEXSPI2 on rt1064
 #if defined(MIMXRT1064_SERIES)
   #define FLEXSPI_INSTANCE    1
   #define FLEXSPI_FLASH_BASE  FlexSPI2_AMBA_BASE
+  #define FLEXSPI_PERIPH      FLEXSPI2
 #elif defined(MIMXRT1176_cm7_SERIES)
   #define FLEXSPI_INSTANCE    1
   #define FLEXSPI_FLASH_BASE  FlexSPI1_AMBA_BASE
+  #define FLEXSPI_PERIPH      FLEXSPI1
 #else
   #define FLEXSPI_INSTANCE    0
   #define FLEXSPI_FLASH_BASE  FlexSPI_AMBA_BASE
+  #define FLEXSPI_PERIPH      FLEXSPI
 #endif
 
 // defined in linker
@@ -57,9 +57,6 @@ extern uint32_t _fcfb_length[];
 extern flexspi_nor_config_t const qspiflash_config;
 static flexspi_nor_config_t* flash_cfg = (flexspi_nor_config_t*)(uintptr_t) &qspiflash_config;
 
-static uint32_t _flash_page_addr = NO_CACHE;
-static uint8_t  _flash_cache[SECTOR_SIZE] __attribute__((aligned(4)));
-
 // compare and write tinyuf2 to flash every time it is running
 #define COMPARE_AND_WRITE_TINYUF2   0
 
@@ -99,9 +96,22 @@ static void write_tinyuf2_to_flash(void)
   TUF2_LOG1("TinyUF2 copied to flash.\r\n");
 }
 
+// Sequential AHB reads (CURRENT.UF2) fetch the following lines while the current one is copied
+static void flash_enable_prefetch(void)
+{
+  FLEXSPI_Type* const base = FLEXSPI_PERIPH;
+
+  for ( uint32_t i = 0; i < sizeof(base->AHBRXBUFCR0) / sizeof(base->AHBRXBUFCR0[0]); i++ )
+  {
+    base->AHBRXBUFCR0[i] |= FLEXSPI_AHBRXBUFCR0_PREFETCHEN_MASK;
+  }
+  base->AHBCR |= FLEXSPI_AHBCR_PREFETCHEN_MASK;
+}
+
 void board_flash_init(void)
 {
   ROM_FLEXSPI_NorFlash_Init(FLEXSPI_INSTANCE, flash_cfg);
+  flash_enable_prefetch();
 
   // TinyUF2 will copy its image to flash if one of conditions meets:
   // - Boot Mode is '01' i.e Serial Download Mode (BootRom)
@@ -128,80 +138,182 @@ uint32_t board_flash_size(void)
 
 void board_flash_read(uint32_t addr, void* buffer, uint32_t len)
 {
-  // Must write out anything in cache before trying to read.
-  //board_flash_flush();
-
+  // DCache is invalidated after each erase/program, data still in the write cache is copied over
+  flash_cache_read_wait();
   memcpy(buffer, (uint8_t*) addr, len);
+  flash_cache_read_overlay(addr, buffer, len);
+}
+
+board_flash_geometry_t const* board_flash_geometry(void)
+{
+  static board_flash_geometry_t const geo =
+  {
+    .erase_size   = SECTOR_SIZE,
+    .block_size   = BLOCK_SIZE,
+    .program_size = FLASH_PAGE_SIZE,
+    .erased_value = 0xff,
+    .xip          = true,
+  };
+  return &geo;
 }
 
-void board_flash_flush(void)
+// Operations are only started with IRQs masked, completion is polled in short masked windows
+// so that USB interrupts keep being serviced while flash is busy
+static status_t flash_wait(uint32_t offset)
 {
   status_t status;
+  bool busy = true;
+
+  do
+  {
+    __disable_irq();
+    status = flexspi_nor_busy(FLEXSPI_INSTANCE, flash_cfg, offset, &busy);
+    __enable_irq();
+  } while ( status == kStatus_Success && busy );
+
+  return status;
+}
 
-  if ( _flash_page_addr == NO_CACHE ) return;
+// FlexSPI cache and DCache are invalidated once per operation
+static void flash_op_done(uint32_t addr, uint32_t len)
+{
+  __disable_irq();
+  flexspi_nor_clear_cache(FLEXSPI_INSTANCE);
+  __enable_irq();
+
+  SCB_InvalidateDCache_by_Addr((uint32_t *) addr, len);
+}
 
-  TUF2_LOG1("Erase and Write at address = 0x%08lX\r\n",_flash_page_addr);
+bool board_flash_erase_raw(uint32_t addr, uint32_t len)
+{
+  status_t status = kStatus_Success;
+  uint32_t const end = addr + len - FLEXSPI_FLASH_BASE;
 
-  // Skip if data is the same
-  if ( memcmp(_flash_cache, (void*) _flash_page_addr, SECTOR_SIZE) != 0 )
+  for ( uint32_t offset = addr - FLEXSPI_FLASH_BASE; offset < end && status == kStatus_Success; )
   {
-    uint32_t const sector_addr = (_flash_page_addr - FLEXSPI_FLASH_BASE);
+    // whole 64KB block at once
+    bool const block = (flash_cfg->blockSize == BLOCK_SIZE) && !(offset & (BLOCK_SIZE - 1)) && (end - offset >= BLOCK_SIZE);
 
     __disable_irq();
-    status = ROM_FLEXSPI_NorFlash_Erase(FLEXSPI_INSTANCE, flash_cfg, sector_addr, SECTOR_SIZE);
+    status = flexspi_nor_start_erase(FLEXSPI_INSTANCE, flash_cfg, offset, block);
     __enable_irq();
 
-    SCB_InvalidateDCache_by_Addr((uint32_t *)sector_addr, SECTOR_SIZE);
+    if ( status == kStatus_Success ) status = flash_wait(offset);
 
-    if ( status != kStatus_Success )
-    {
-      TUF2_LOG1("Erase failed: status = %ld!\r\n", status);
-      return;
-    }
+    offset += block ? BLOCK_SIZE : SECTOR_SIZE;
+  }
 
-    for ( int i = 0; i < SECTOR_SIZE / FLASH_PAGE_SIZE; ++i )
-    {
-      uint32_t const page_addr = sector_addr + i * FLASH_PAGE_SIZE;
-      void* page_data =  _flash_cache + i * FLASH_PAGE_SIZE;
+  flash_op_done(addr, len);
 
-      __disable_irq();
-      status = ROM_FLEXSPI_NorFlash_ProgramPage(FLEXSPI_INSTANCE, flash_cfg, page_addr, (uint32_t*) page_data);
-      __enable_irq();
+  if ( status != kStatus_Success )
+  {
+    TUF2_LOG1("Erase failed: status = %ld!\r\n", status);
+    return false;
+  }
+  return true;
+}
 
-      if ( status != kStatus_Success )
-      {
-        TUF2_LOG1("Page program failed: status = %ld!\r\n", status);
-        return;
-      }
-    }
+// Page is all 0xff, programming it would leave flash as it is
+static bool page_blank(uint32_t const* page)
+{
+  for ( uint32_t i = 0; i < FLASH_PAGE_SIZE / 4; i++ )
+  {
+    if ( page[i] != 0xffffffffUL ) return false;
+  }
+  return true;
+}
+
+bool board_flash_program(uint32_t addr, void const* data, uint32_t len)
+{
+  status_t status = kStatus_Success;
+
+  for ( uint32_t i = 0; i < len && status == kStatus_Success; i += FLASH_PAGE_SIZE )
+  {
+    uint32_t const offset = addr + i - FLEXSPI_FLASH_BASE;
+    if ( page_blank((uint32_t const*) ((uintptr_t) data + i)) ) continue;
+
+    __disable_irq();
+    status = flexspi_nor_start_program_page(FLEXSPI_INSTANCE, flash_cfg, offset, (uint32_t*) ((uintptr_t) data + i));
+    __enable_irq();
 
-    SCB_InvalidateDCache_by_Addr((uint32_t *)sector_addr, SECTOR_SIZE);
+    if ( status == kStatus_Success ) status = flash_wait(offset);
   }
 
-  _flash_page_addr = NO_CACHE;
+  flash_op_done(addr, len);
+
+  if ( status != kStatus_Success )
+  {
+    TUF2_LOG1("Page program failed: status = %ld!\r\n", status);
+    return false;
+  }
+  return true;
 }
 
-bool board_flash_write (uint32_t addr, void const *src, uint32_t len)
+#if CFG_UF2_FLASH_CACHE_ASYNC
+// Operation started by board_flash_erase_start() or board_flash_program_start(), finished by board_flash_busy()
+static bool _op_pending = false;
+static uint32_t _op_addr;
+static uint32_t _op_len;
+
+bool board_flash_erase_start(uint32_t addr, uint32_t len)
 {
-  uint32_t const page_addr = addr & ~(SECTOR_SIZE - 1);
+  uint32_t const offset = addr - FLEXSPI_FLASH_BASE;
+  bool const block = (flash_cfg->blockSize == BLOCK_SIZE) && (len == BLOCK_SIZE);
 
-  if ( page_addr != _flash_page_addr )
-  {
-    // Write out anything in cache before overwriting it.
-    board_flash_flush();
+  __disable_irq();
+  status_t const status = flexspi_nor_start_erase(FLEXSPI_INSTANCE, flash_cfg, offset, block);
+  __enable_irq();
 
-    _flash_page_addr = page_addr;
+  _op_addr = addr;
+  _op_len = block ? BLOCK_SIZE : SECTOR_SIZE;
+  _op_pending = (status == kStatus_Success);
 
-    // Copy the current contents of the entire page into the cache.
-    memcpy(_flash_cache, (void*) page_addr, SECTOR_SIZE);
+  if ( status != kStatus_Success )
+  {
+    TUF2_LOG1("Erase failed: status = %ld!\r\n", status);
+    return false;
   }
+  return true;
+}
+
+bool board_flash_program_start(uint32_t addr, void const* data)
+{
+  if ( page_blank((uint32_t const*) data) ) return true;
 
-  // Overwrite part or all of the page cache with the src data.
-  memcpy(_flash_cache + (addr & (SECTOR_SIZE - 1)), src, len);
+  __disable_irq();
+  status_t const status = flexspi_nor_start_program_page(FLEXSPI_INSTANCE, flash_cfg, addr - FLEXSPI_FLASH_BASE,
+                                                         (uint32_t const*) data);
+  __enable_irq();
 
+  _op_addr = addr;
+  _op_len = FLASH_PAGE_SIZE;
+  _op_pending = (status == kStatus_Success);
+
+  if ( status != kStatus_Success )
+  {
+    TUF2_LOG1("Page program failed: status = %ld!\r\n", status);
+    return false;
+  }
   return true;
 }
 
+bool board_flash_busy(void)
+{
+  if ( !_op_pending ) return false;
+
+  bool busy = false;
+  __disable_irq();
+  status_t const status = flexspi_nor_busy(FLEXSPI_INSTANCE, flash_cfg, _op_addr - FLEXSPI_FLASH_BASE, &busy);
+  __enable_irq();
+
+  if ( status == kStatus_Success && busy ) return true;
+
+  _op_pending = false;
+  flash_op_done(_op_addr, _op_len);
+  return false;
+}
+#endif
+
 void board_flash_erase_app(void)
 {
   TUF2_LOG1("Erase whole chip\r\n");
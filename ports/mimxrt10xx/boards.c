@@ -128,8 +128,48 @@ void board_usb_init(void)
   usb_phy->TX = phytx;
 }
 
+// DFU cache profile: tinyuf2 itself runs from TCM, caches matter for the FlexSPI flash that is
+// read back through XIP (CURRENT.UF2, compare before program) and for code in OCRAM on rt1010.
+// The ROM may leave the MPU in any state, so XIP flash and OCRAM get explicit write-back regions.
+// USB transfer buffers are in DTCM, which is not cached. Erase/program invalidates the written
+// range (flash_op_done in board_flash.c)
+static void dfu_cache_init(void)
+{
+  // smallest MPU region covering the flash, regions are power of 2 sized and aligned
+  uint32_t const flash_size_log2 = 32 - __CLZ(BOARD_FLASH_SIZE - 1);
+  uint32_t const flash_base = BOARD_FLASH_APP_START & ~((1UL << flash_size_log2) - 1);
+
+  extern uint32_t _ocram_base[], _ocram_size[];
+  uint32_t const ocram_size_log2 = 32 - __CLZ((uint32_t) _ocram_size - 1);
+
+#if defined(__DCACHE_PRESENT) && __DCACHE_PRESENT
+  // attributes of cached lines must not change under the cache
+  if (SCB_CCR_DC_Msk == (SCB_CCR_DC_Msk & SCB->CCR)) SCB_CleanInvalidateDCache();
+#endif
+
+  ARM_MPU_Disable();
+
+  // XIP flash: normal, write-back read/write allocate, read-only as writes go through FlexSPI IP commands
+  ARM_MPU_SetRegionEx(0, flash_base, ARM_MPU_RASR(0, ARM_MPU_AP_RO, 1, 0, 1, 1, 0, flash_size_log2 - 1));
+
+  // OCRAM: normal, write-back read/write allocate
+  ARM_MPU_SetRegionEx(1, (uint32_t) _ocram_base, ARM_MPU_RASR(0, ARM_MPU_AP_FULL, 1, 0, 1, 1, 0, ocram_size_log2 - 1));
+
+  // everything else keeps the default memory map
+  ARM_MPU_Enable(MPU_CTRL_PRIVDEFENA_Msk);
+
+#if defined(__ICACHE_PRESENT) && __ICACHE_PRESENT
+  if (SCB_CCR_IC_Msk != (SCB_CCR_IC_Msk & SCB->CCR)) SCB_EnableICache();
+#endif
+
+#if defined(__DCACHE_PRESENT) && __DCACHE_PRESENT
+  if (SCB_CCR_DC_Msk != (SCB_CCR_DC_Msk & SCB->CCR)) SCB_EnableDCache();
+#endif
+}
+
 void board_dfu_init(void)
 {
+  dfu_cache_init();
   board_usb_init();
 
   _dfu_mode = true;
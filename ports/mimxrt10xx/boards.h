@@ -69,6 +69,12 @@ extern uint32_t _board_boot_length[];
 #define TINYUF2_LED             1
 #endif
 
+// board_flash_write() and flush by the shared write-back cache, see flash_cache.h
+#define CFG_UF2_FLASH_CACHE     1
+
+// erase and program run from the main loop between tud_task() calls instead of inside WRITE10
+#define CFG_UF2_FLASH_CACHE_ASYNC  1
+
 #ifdef __cplusplus
  }
 #endif
@@ -337,3 +337,102 @@ status_t ROM_FLEXSPI_NorFlash_EraseAll (uint32_t instance, flexspi_nor_config_t
 }
 
 #endif
+
+//--------------------------------------------------------------------+
+// Non-blocking operations
+//--------------------------------------------------------------------+
+
+// LUT sequences fixed by the ROM bootloader, see lookupTable in board's flash_config.c
+#define SEQ_READSTATUS    1
+#define SEQ_WRITEENABLE   3
+#define SEQ_ERASESECTOR   5
+#define SEQ_ERASEBLOCK    8
+#define SEQ_PAGEPROGRAM   9
+
+#if defined(FSL_FEATURE_BOOT_ROM_HAS_ROMAPI) && FSL_FEATURE_BOOT_ROM_HAS_ROMAPI
+  #define nor_command_xfer  ROM_FLEXSPI_NorFlash_CommandXfer
+  #define nor_clear_cache   ROM_FLEXSPI_NorFlash_ClearCache
+  #define OP_COMMAND        kFLEXSPIOperation_Command
+  #define OP_WRITE          kFLEXSPIOperation_Write
+  #define OP_READ           kFLEXSPIOperation_Read
+#else
+  #define nor_command_xfer  flexspi_command_xfer
+  #define nor_clear_cache   flexspi_clear_cache
+  #define OP_COMMAND        kFlexSpiOperation_Command
+  #define OP_WRITE          kFlexSpiOperation_Write
+  #define OP_READ           kFlexSpiOperation_Read
+#endif
+
+// on-board flash is never used in parallel mode
+static status_t write_enable(uint32_t instance, uint32_t address)
+{
+  flexspi_xfer_t xfer =
+  {
+    .operation   = OP_COMMAND,
+    .baseAddress = address,
+    .seqId       = SEQ_WRITEENABLE,
+    .seqNum      = 1,
+  };
+  return nor_command_xfer(instance, &xfer);
+}
+
+status_t flexspi_nor_start_erase(uint32_t instance, flexspi_nor_config_t *config, uint32_t address, bool block)
+{
+  (void) config;
+
+  status_t status = write_enable(instance, address);
+  if ( status != kStatus_Success ) return status;
+
+  flexspi_xfer_t xfer =
+  {
+    .operation   = OP_COMMAND,
+    .baseAddress = address,
+    .seqId       = block ? SEQ_ERASEBLOCK : SEQ_ERASESECTOR,
+    .seqNum      = 1,
+  };
+  return nor_command_xfer(instance, &xfer);
+}
+
+status_t flexspi_nor_start_program_page(uint32_t instance, flexspi_nor_config_t *config, uint32_t dstAddr, const uint32_t *src)
+{
+  status_t status = write_enable(instance, dstAddr);
+  if ( status != kStatus_Success ) return status;
+
+  flexspi_xfer_t xfer =
+  {
+    .operation   = OP_WRITE,
+    .baseAddress = dstAddr,
+    .seqId       = SEQ_PAGEPROGRAM,
+    .seqNum      = 1,
+    .txBuffer    = (uint32_t*)(uintptr_t) src,
+    .txSize      = config->pageSize,
+  };
+  return nor_command_xfer(instance, &xfer);
+}
+
+status_t flexspi_nor_busy(uint32_t instance, flexspi_nor_config_t *config, uint32_t address, bool *busy)
+{
+  uint32_t value = 0;
+  flexspi_xfer_t xfer =
+  {
+    .operation   = OP_READ,
+    .baseAddress = address,
+    .seqId       = SEQ_READSTATUS,
+    .seqNum      = 1,
+    .rxBuffer    = &value,
+    .rxSize      = 1,
+  };
+
+  status_t const status = nor_command_xfer(instance, &xfer);
+
+  // polarity 0: busy flag is 1 while busy
+  bool const flag = (value >> config->memConfig.busyOffset) & 1;
+  *busy = config->memConfig.busyBitPolarity ? !flag : flag;
+
+  return status;
+}
+
+void flexspi_nor_clear_cache(uint32_t instance)
+{
+  nor_clear_cache(instance);
+}
@@ -42,3 +42,10 @@ status_t ROM_FLEXSPI_NorFlash_ProgramPage(uint32_t instance, flexspi_nor_config_
 #if !( defined(FSL_ROM_FLEXSPINOR_API_HAS_FEATURE_ERASE_ALL) && FSL_ROM_FLEXSPINOR_API_HAS_FEATURE_ERASE_ALL )
 status_t ROM_FLEXSPI_NorFlash_EraseAll(uint32_t instance, flexspi_nor_config_t *config);
 #endif
+
+// Non-blocking operations: each is started by a short FlexSPI command sequence, completion is
+// polled with flexspi_nor_busy(). Caller clears the FlexSPI cache once done.
+status_t flexspi_nor_start_erase(uint32_t instance, flexspi_nor_config_t *config, uint32_t address, bool block);
+status_t flexspi_nor_start_program_page(uint32_t instance, flexspi_nor_config_t *config, uint32_t dstAddr, const uint32_t *src);
+status_t flexspi_nor_busy(uint32_t instance, flexspi_nor_config_t *config, uint32_t address, bool *busy);
+void flexspi_nor_clear_cache(uint32_t instance);
@@ -55,6 +55,10 @@ size: $(BUILD)/$(OUTNAME).elf
 	@$(SIZE) $<
 	-@echo ''
 
+# static RAM and flash per module and symbol, full report in $(BUILD)/$(OUTNAME).mem.txt
+memreport: $(BUILD)/$(OUTNAME).elf
+	@$(PYTHON3) $(TOP)/tools/memreport.py --nm $(CROSS_COMPILE)nm -o $(BUILD)/$(OUTNAME).mem.txt $<.map $<
+
 # linkermap must be install previously at https://github.com/hathach/linkermap
 linkermap: $(BUILD)/$(OUTNAME).elf
 	@linkermap -v $<.map
@@ -44,7 +44,18 @@ enum {
   BOOTLOADER_SECTOR_COUNT = ((BOARD_FLASH_APP_START - FLASH_BASE_ADDR) / BOARD_PAGE_SIZE)
 };
 
-static uint8_t erased_sectors[SECTOR_COUNT] = {0};
+// Sector state, checked lazily on first write to the sector
+enum {
+  SECTOR_UNKNOWN = 0, // not checked yet
+  SECTOR_BLANK,       // erased, nothing written yet
+  SECTOR_WRITTEN,     // written in this session, don't erase anymore
+  SECTOR_DIRTY        // holds old data, needs erase
+};
+
+// words sampled before scanning a whole sector
+#define SECTOR_SAMPLE_COUNT     16
+
+static uint8_t sector_state[SECTOR_COUNT] = {0};
 
 //--------------------------------------------------------------------+
 // Internal Helper
@@ -64,6 +75,22 @@ static bool is_blank(uint32_t addr, uint32_t size) {
   return true;
 }
 
+// Sampled pre-check first, used sectors mostly fail at one of the samples without a full scan
+static uint8_t flash_sector_state(uint32_t sector, uint32_t sector_addr) {
+  if (sector_state[sector] == SECTOR_UNKNOWN) {
+    uint32_t const size = flash_sector_size(sector);
+    bool blank = (*(uint32_t*) (sector_addr + size - 4) == 0xffffffff);
+
+    for (uint32_t i = 0; i < SECTOR_SAMPLE_COUNT && blank; i++) {
+      blank = (*(uint32_t*) (sector_addr + i * (size / SECTOR_SAMPLE_COUNT)) == 0xffffffff);
+    }
+
+    sector_state[sector] = (blank && is_blank(sector_addr, size)) ? SECTOR_BLANK : SECTOR_DIRTY;
+  }
+
+  return sector_state[sector];
+}
+
 static bool flash_erase_sector(uint32_t addr) {
 #ifndef TINYUF2_SELF_UPDATE
   // skip erasing bootloader if not self-update
@@ -72,7 +99,7 @@ static bool flash_erase_sector(uint32_t addr) {
 
   // starting address from 0x08000000
   uint32_t sector_addr = FLASH_BASE_ADDR;
-  bool erased = false;
+  bool erased = true;
   uint32_t size = 0;
 
   for (uint32_t i = 0; i < SECTOR_COUNT; i++) {
@@ -80,14 +107,14 @@ static bool flash_erase_sector(uint32_t addr) {
 
     size = flash_sector_size(i);
     if (sector_addr + size > addr) {
-      erased = erased_sectors[i];
-      erased_sectors[i] = 1;    // don't erase anymore - we will continue writing here!
+      erased = (flash_sector_state(i, sector_addr) != SECTOR_DIRTY);
+      sector_state[i] = SECTOR_WRITTEN;    // don't erase anymore - we will continue writing here!
       break;
     }
     sector_addr += size;
   }
 
-  if (!erased && !is_blank(sector_addr, size)) {
+  if (!erased) {
     TUF2_LOG1("Erase: %08lX size = %lu KB ... ", sector_addr, size / 1024);
 
     FLASH_EraseInitTypeDef EraseInit;
@@ -226,20 +253,23 @@ void board_self_update(const uint8_t* bootloader_bin, uint32_t bootloader_len) {
     board_flash_protect_bootloader(false);
 #endif
 
-    // keep writing until flash contents matches new bootloader data
-    while (memcmp((const void*) FLASH_BASE_ADDR, bootloader_bin, bootloader_len)) {
-      uint32_t sector_addr = FLASH_BASE_ADDR;
-      const uint8_t* data = bootloader_bin;
-      uint32_t len = bootloader_len;
+    // Pages already matching the new bootloader are left alone, the others are erased (unless
+    // blank) and programmed. Keep writing until a page matches
+    uint32_t sector_addr = FLASH_BASE_ADDR;
+    const uint8_t* data = bootloader_bin;
+    uint32_t len = bootloader_len;
 
-      for (uint32_t i = 0; i < BOOTLOADER_SECTOR_COUNT && len > 0; i++) {
-        uint32_t const size = (flash_sector_size(i) < len ? flash_sector_size(i) : len);
-        board_flash_write(sector_addr, data, size);
+    for (uint32_t i = 0; i < BOOTLOADER_SECTOR_COUNT && len > 0; i++) {
+      uint32_t const size = (flash_sector_size(i) < len ? flash_sector_size(i) : len);
 
-        sector_addr += size;
-        data += size;
-        len -= size;
+      while (memcmp((const void*) sector_addr, data, size)) {
+        sector_state[i] = SECTOR_UNKNOWN;
+        board_flash_write(sector_addr, data, size);
       }
+
+      sector_addr += size;
+      data += size;
+      len -= size;
     }
   }
 
@@ -37,47 +37,72 @@
 // TinyUF2 resides in the first 2 flash sectors on STM32F4s, therefore these are write protected
 #define BOOTLOADER_SECTOR_MASK  0x3UL
 
-/* flash parameters that we should not really know */
-static const uint32_t sector_size[] =
+// Each 1 MB bank holds 4 x 16 KB, 64 KB and 7 x 128 KB sectors, the second bank only on 2 MB devices.
+// First 4 sectors are for bootloader (64KB), application starts at BOARD_FLASH_APP_START
+#define BANK_SIZE               (1024 * 1024UL)
+#define BANK_SECTORS            12
+#define BANK_GRANULE_SHIFT      14  // 16 KB, the smallest sector
+
+static const uint32_t bank_sector_offset[BANK_SECTORS] =
+{
+  0x00000, 0x04000, 0x08000, 0x0C000, 0x10000, 0x20000,
+  0x40000, 0x60000, 0x80000, 0xA0000, 0xC0000, 0xE0000
+};
+
+static const uint32_t bank_sector_size[BANK_SECTORS] =
+{
+  16 * 1024, 16 * 1024, 16 * 1024, 16 * 1024, 64 * 1024, 128 * 1024,
+  128 * 1024, 128 * 1024, 128 * 1024, 128 * 1024, 128 * 1024, 128 * 1024
+};
+
+// sector within the bank of each 16 KB granule
+#define GRANULES_4(s)  s, s, s, s
+#define GRANULES_8(s)  GRANULES_4(s), GRANULES_4(s)
+
+static const uint8_t bank_granule_sector[BANK_SIZE >> BANK_GRANULE_SHIFT] =
 {
-  // First 4 sectors are for bootloader (64KB)
-  16 * 1024,
-	16 * 1024,
-	16 * 1024,
-	16 * 1024,
-	// Application (BOARD_FLASH_APP_START)
-	64 * 1024,
-	128 * 1024,
-	128 * 1024,
-	128 * 1024,
-
-	// flash sectors only in 1 MB devices
-	128 * 1024,
-	128 * 1024,
-	128 * 1024,
-	128 * 1024,
-
-	// flash sectors only in 2 MB devices
-	16 * 1024,
-	16 * 1024,
-	16 * 1024,
-	16 * 1024,
-	64 * 1024,
-	128 * 1024,
-	128 * 1024,
-	128 * 1024,
-	128 * 1024,
-	128 * 1024,
-	128 * 1024,
-	128 * 1024
+  0, 1, 2, 3, GRANULES_4(4),
+  GRANULES_8(5), GRANULES_8(6), GRANULES_8(7), GRANULES_8(8), GRANULES_8(9), GRANULES_8(10), GRANULES_8(11)
 };
 
 enum
 {
-  SECTOR_COUNT = sizeof(sector_size)/sizeof(sector_size[0])
+  SECTOR_COUNT = 2 * BANK_SECTORS
 };
 
-static uint8_t erased_sectors[SECTOR_COUNT] = { 0 };
+// Sector state, checked lazily on first write to the sector
+enum
+{
+  SECTOR_UNKNOWN = 0, // not checked yet
+  SECTOR_BLANK,       // erased, nothing written yet
+  SECTOR_WRITTEN,     // written in this session, don't erase anymore
+  SECTOR_DIRTY,       // holds old data, needs erase
+  SECTOR_ERASING      // erase running in the background, see flash_erase_start()
+};
+
+// words sampled before scanning a whole sector
+#define SECTOR_SAMPLE_COUNT     16
+
+// also updated by the flash end of operation interrupt
+static volatile uint8_t sector_state[SECTOR_COUNT] = { 0 };
+
+// sector being erased in the background, SECTOR_COUNT if none
+static volatile uint32_t _erase_sector = SECTOR_COUNT;
+
+// Parallelism follows the supply voltage range: x8 (1.8-2.1V), x16, x32 (2.7-3.6V) or x64 (external Vpp)
+#ifndef BOARD_FLASH_VOLTAGE_RANGE
+#define BOARD_FLASH_VOLTAGE_RANGE  FLASH_VOLTAGE_RANGE_3
+#endif
+
+#define FLASH_PROGRAM_PSIZE     (BOARD_FLASH_VOLTAGE_RANGE << FLASH_CR_PSIZE_Pos)
+#define FLASH_PROGRAM_UNIT      (1UL << BOARD_FLASH_VOLTAGE_RANGE)
+
+// RAM buffer of contiguous payloads not yet written
+#define FLASH_BUF_SIZE          4096
+
+static uint8_t _buf[FLASH_BUF_SIZE] __attribute__((aligned(4)));
+static uint32_t _buf_addr = 0;
+static uint32_t _buf_len = 0;
 
 //--------------------------------------------------------------------+
 // Internal Helper
@@ -85,7 +110,7 @@ static uint8_t erased_sectors[SECTOR_COUNT] = { 0 };
 
 static inline uint32_t flash_sector_size(uint32_t sector)
 {
-  return sector_size[sector];
+  return bank_sector_size[sector % BANK_SECTORS];
 }
 
 static bool is_blank(uint32_t addr, uint32_t size)
@@ -100,40 +125,91 @@ static bool is_blank(uint32_t addr, uint32_t size)
   return true;
 }
 
-static bool flash_erase(uint32_t addr)
+// Sampled pre-check first, used sectors mostly fail at one of the samples without a full scan
+static uint8_t flash_sector_state(uint32_t sector, uint32_t sector_addr)
 {
-  // starting address from 0x08000000
-  uint32_t sector_addr = FLASH_BASE_ADDR;
-  bool erased = false;
-
-  uint32_t sector = 0;
-  uint32_t size = 0;
-
-  for ( uint32_t i = 0; i < SECTOR_COUNT; i++ )
+  if ( sector_state[sector] == SECTOR_UNKNOWN )
   {
-    TUF2_ASSERT(sector_addr < FLASH_BASE_ADDR + BOARD_FLASH_SIZE);
+    uint32_t const size = flash_sector_size(sector);
+    bool blank = (*(uint32_t*) (sector_addr + size - 4) == 0xffffffff);
 
-    size = flash_sector_size(i);
-    if ( sector_addr + size > addr )
+    for ( uint32_t i = 0; i < SECTOR_SAMPLE_COUNT && blank; i++ )
     {
-      sector = i;
-      erased = erased_sectors[i];
-      erased_sectors[i] = 1;    // don't erase anymore - we will continue writing here!
-      break;
+      blank = (*(uint32_t*) (sector_addr + i * (size / SECTOR_SAMPLE_COUNT)) == 0xffffffff);
     }
-    sector_addr += size;
+
+    sector_state[sector] = (blank && is_blank(sector_addr, size)) ? SECTOR_BLANK : SECTOR_DIRTY;
+  }
+
+  return sector_state[sector];
+}
+
+// Sector holding addr, its start address in sector_addr. SECTOR_COUNT if addr is outside of flash
+static uint32_t flash_sector(uint32_t addr, uint32_t* sector_addr)
+{
+  if ( addr < FLASH_BASE_ADDR || addr >= FLASH_BASE_ADDR + BOARD_FLASH_SIZE ) return SECTOR_COUNT;
+
+  uint32_t const offset = addr - FLASH_BASE_ADDR;
+  uint32_t const bank = offset / BANK_SIZE;
+  uint32_t const sector = bank_granule_sector[(offset % BANK_SIZE) >> BANK_GRANULE_SHIFT];
+
+  *sector_addr = FLASH_BASE_ADDR + bank * BANK_SIZE + bank_sector_offset[sector];
+  return bank * BANK_SECTORS + sector;
+}
+
+// Start erasing sector with the end of operation interrupt instead of waiting for it. Reads of
+// flash stall while it is busy, the host is told to retry the write meanwhile (board_flash_write_busy)
+static bool flash_erase_start(uint32_t sector, uint32_t sector_addr)
+{
+  FLASH_EraseInitTypeDef erase =
+  {
+    .TypeErase    = FLASH_TYPEERASE_SECTORS,
+    .Sector       = sector,
+    .NbSectors    = 1,
+    .VoltageRange = BOARD_FLASH_VOLTAGE_RANGE
+  };
+
+  TUF2_LOG1("Erase: %08lX size = %lu KB (background)\r\n", sector_addr, flash_sector_size(sector) / 1024);
+  HAL_FLASH_Unlock();
+
+  sector_state[sector] = SECTOR_ERASING;
+  _erase_sector = sector;
+
+  if ( HAL_FLASHEx_Erase_IT(&erase) != HAL_OK )
+  {
+    sector_state[sector] = SECTOR_DIRTY;
+    _erase_sector = SECTOR_COUNT;
+    HAL_FLASH_Lock();
+    return false;
   }
 
+  return true;
+}
+
+// Flash interface can't be used until a background erase is done
+static void flash_erase_wait(void)
+{
+  while ( _erase_sector != SECTOR_COUNT ) { }
+}
+
+// Erase sector once per session, unless it is already blank
+static bool flash_erase(uint32_t sector, uint32_t sector_addr)
+{
 #ifndef TINYUF2_SELF_UPDATE
   // skip erasing sector0 if not self-update
   TUF2_ASSERT(sector);
 #endif
 
-  if ( !erased && !is_blank(sector_addr, size) )
+  uint8_t const state = flash_sector_state(sector, sector_addr);
+  sector_state[sector] = SECTOR_WRITTEN;    // don't erase anymore - we will continue writing here!
+
+  if ( state == SECTOR_DIRTY )
   {
+    uint32_t const size = flash_sector_size(sector);
     TUF2_LOG1("Erase: %08lX size = %lu KB ... ", sector_addr, size / 1024);
-    FLASH_Erase_Sector(sector, FLASH_VOLTAGE_RANGE_3);
+    FLASH_Erase_Sector(sector, BOARD_FLASH_VOLTAGE_RANGE);
     FLASH_WaitForLastOperation(HAL_MAX_DELAY);
+    FLASH_FlushCaches();
     TUF2_LOG1("OK\r\n");
     TUF2_ASSERT( is_blank(sector_addr, size) );
   }
@@ -141,32 +217,110 @@ static bool flash_erase(uint32_t addr)
   return true;
 }
 
-static void flash_write(uint32_t dst, const uint8_t *src, int len)
+// Program with the parallelism of the voltage range. Flash interface stalls the bus while the
+// previous program operation is busy, so there is only one wait at the end
+static bool flash_program(uint32_t dst, uint8_t const* src, uint32_t len)
 {
-  flash_erase(dst);
+  if ( FLASH_WaitForLastOperation(HAL_MAX_DELAY) != HAL_OK ) return false;
+
+  CLEAR_BIT(FLASH->CR, FLASH_CR_PSIZE);
+  SET_BIT(FLASH->CR, FLASH_PROGRAM_PSIZE | FLASH_CR_PG);
 
-  TUF2_LOG1("Write flash at address %08lX\r\n", dst);
-  for ( int i = 0; i < len; i += 4 )
+  for ( uint32_t i = 0; i < len; i += FLASH_PROGRAM_UNIT )
   {
-    uint32_t data = *((uint32_t*) ((void*) (src + i)));
+    // skip units that stay erased
+    uint32_t word[2] = { 0xffffffff, 0xffffffff };
+    memcpy(word, src + i, FLASH_PROGRAM_UNIT);
+    if ( word[0] == 0xffffffff && word[1] == 0xffffffff ) continue;
+
+#if FLASH_PROGRAM_UNIT == 8
+    *(__IO uint32_t*) (dst + i) = word[0];
+    __ISB(); // x64 programs lower and upper word as one
+    *(__IO uint32_t*) (dst + i + 4) = word[1];
+#elif FLASH_PROGRAM_UNIT == 4
+    *(__IO uint32_t*) (dst + i) = word[0];
+#elif FLASH_PROGRAM_UNIT == 2
+    *(__IO uint16_t*) (dst + i) = (uint16_t) word[0];
+#else
+    *(__IO uint8_t*) (dst + i) = (uint8_t) word[0];
+#endif
+  }
 
-    if ( HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, dst + i, (uint64_t) data) != HAL_OK )
-    {
-      TUF2_LOG1("Failed to write flash at address %08lX\r\n", dst + i);
-      break;
-    }
+  HAL_StatusTypeDef const status = FLASH_WaitForLastOperation(HAL_MAX_DELAY);
+  CLEAR_BIT(FLASH->CR, FLASH_CR_PG);
+
+  // ART data cache may still hold the erased contents
+  FLASH_FlushCaches();
+
+  return status == HAL_OK;
+}
+
+// Write a run within flash, sector by sector. Unchanged parts of sectors already erased in
+// this session are skipped, other sectors are erased first (erasing would lose data that was skipped)
+static bool flash_write(uint32_t dst, const uint8_t *src, uint32_t len)
+{
+  flash_erase_wait();
 
-    if ( FLASH_WaitForLastOperation(HAL_MAX_DELAY) != HAL_OK )
+  while ( len )
+  {
+    uint32_t sector_addr;
+    uint32_t const sector = flash_sector(dst, &sector_addr);
+    TUF2_ASSERT(sector < SECTOR_COUNT);
+
+    uint32_t const sector_end = sector_addr + flash_sector_size(sector);
+    uint32_t const count = (len < sector_end - dst) ? len : (sector_end - dst);
+
+    if ( !(sector_state[sector] == SECTOR_WRITTEN && 0 == memcmp((void*) dst, src, count)) )
     {
-      TUF2_LOG1("Waiting on last operation failed\r\n");
-      return;
+      flash_erase(sector, sector_addr);
+
+      TUF2_LOG1("Write flash at address %08lX\r\n", dst);
+      if ( !flash_program(dst, src, count) || memcmp((void*) dst, src, count) != 0 )
+      {
+        TUF2_LOG1("Failed to write\r\n");
+        return false;
+      }
     }
+
+    dst += count;
+    src += count;
+    len -= count;
   }
 
-  // verify contents
-  if ( memcmp((void*) dst, src, len) != 0 )
+  return true;
+}
+
+//--------------------------------------------------------------------+
+// Flash interrupt
+//--------------------------------------------------------------------+
+
+void FLASH_IRQHandler(void)
+{
+  HAL_FLASH_IRQHandler();
+}
+
+void HAL_FLASH_EndOfOperationCallback(uint32_t ReturnValue)
+{
+  (void) ReturnValue;
+
+  if ( _erase_sector < SECTOR_COUNT )
+  {
+    sector_state[_erase_sector] = SECTOR_BLANK;
+    _erase_sector = SECTOR_COUNT;
+    HAL_FLASH_Lock();
+  }
+}
+
+void HAL_FLASH_OperationErrorCallback(uint32_t ReturnValue)
+{
+  (void) ReturnValue;
+
+  // erased again on the first write
+  if ( _erase_sector < SECTOR_COUNT )
   {
-    TUF2_LOG1("Failed to write\r\n");
+    sector_state[_erase_sector] = SECTOR_DIRTY;
+    _erase_sector = SECTOR_COUNT;
+    HAL_FLASH_Lock();
   }
 }
 
@@ -175,7 +329,7 @@ static void flash_write(uint32_t dst, const uint8_t *src, int len)
 //--------------------------------------------------------------------+
 void board_flash_init(void)
 {
-
+  NVIC_EnableIRQ(FLASH_IRQn);
 }
 
 uint32_t board_flash_size(void)
@@ -190,15 +344,54 @@ void board_flash_read(uint32_t addr, void* buffer, uint32_t len)
 
 void board_flash_flush(void)
 {
+  if ( _buf_len == 0 ) return;
+
+  HAL_FLASH_Unlock();
+  flash_write(_buf_addr, _buf, _buf_len);
+  HAL_FLASH_Lock();
+
+  _buf_len = 0;
+}
+
+// First write to a sector holding old data starts its erase and is retried by the host until the
+// erase is done, instead of waiting up to 2 s for a 128 KB sector inside the WRITE10 callback
+bool board_flash_write_busy(uint32_t addr)
+{
+  if ( addr < BOARD_FLASH_APP_START ) return false;
+
+  uint32_t sector_addr;
+  uint32_t const sector = flash_sector(addr, &sector_addr);
+  if ( sector >= SECTOR_COUNT ) return false;
+
+  if ( _erase_sector == SECTOR_COUNT && flash_sector_state(sector, sector_addr) == SECTOR_DIRTY )
+  {
+    flash_erase_start(sector, sector_addr);
+  }
+
+  return _erase_sector != SECTOR_COUNT;
 }
 
-// TODO not working quite yet
+// Payloads are accumulated in RAM and programmed as one run when the next one is not contiguous,
+// the buffer is full or on flush
 bool board_flash_write(uint32_t addr, void const* data, uint32_t len)
 {
-  // TODO skip matching contents
-  HAL_FLASH_Unlock();
-  flash_write(addr, data, len);
-  HAL_FLASH_Lock();
+  if ( _buf_len && (addr != _buf_addr + _buf_len || _buf_len + len > FLASH_BUF_SIZE) )
+  {
+    board_flash_flush();
+  }
+
+  // larger than the buffer: written directly
+  if ( len > FLASH_BUF_SIZE )
+  {
+    HAL_FLASH_Unlock();
+    bool const ret = flash_write(addr, data, len);
+    HAL_FLASH_Lock();
+    return ret;
+  }
+
+  if ( _buf_len == 0 ) _buf_addr = addr;
+  memcpy(_buf + _buf_len, data, len);
+  _buf_len += len;
 
   return true;
 }
@@ -279,23 +472,32 @@ void board_self_update(const uint8_t * bootloader_bin, uint32_t bootloader_len)
     board_flash_protect_bootloader(false);
 #endif
 
-    // keep writing until flash contents matches new bootloader data
-    while( memcmp((const void*) FLASH_BASE_ADDR, bootloader_bin, bootloader_len) )
+    // Sectors already matching the new bootloader are left alone, the others are erased (unless
+    // blank) and programmed directly with wide writes. Keep writing until a sector matches
+    HAL_FLASH_Unlock();
+
+    uint32_t sector_addr = FLASH_BASE_ADDR;
+    const uint8_t * data = bootloader_bin;
+    uint32_t len = bootloader_len;
+
+    for ( uint32_t i = 0; i < 4 && len > 0; i++ )
     {
-      uint32_t sector_addr = FLASH_BASE_ADDR;
-      const uint8_t * data = bootloader_bin;
-      uint32_t len = bootloader_len;
+      uint32_t const size = (flash_sector_size(i) < len ? flash_sector_size(i) : len);
 
-      for ( uint32_t i = 0; i < 4 && len > 0; i++ )
+      while ( memcmp((const void*) sector_addr, data, size) )
       {
-        uint32_t const size = (flash_sector_size(i) < len ? flash_sector_size(i) : len);
-        board_flash_write(sector_addr, data, size);
-
-        sector_addr += size;
-        data += size;
-        len -= size;
+        sector_state[i] = SECTOR_UNKNOWN;
+        flash_write(sector_addr, data, size);
       }
+
+      TUF2_LOG1("Bootloader sector %lu: %s\r\n", i, (sector_state[i] == SECTOR_WRITTEN) ? "updated" : "unchanged");
+
+      sector_addr += size;
+      data += size;
+      len -= size;
     }
+
+    HAL_FLASH_Lock();
   }
 
   // self-destruct: write 0 to first 2 entry of vector table
@@ -103,6 +103,15 @@ void board_init(void)
 
 void board_dfu_init(void)
 {
+  // DFU performance profile: clocks are already at their maximum from clock_init(), HAL_Init() is
+  // never called so the ART accelerator is off. DFU always ends with a reset, the app starts with
+  // it off as before
+  __HAL_FLASH_INSTRUCTION_CACHE_RESET();
+  __HAL_FLASH_DATA_CACHE_RESET();
+  __HAL_FLASH_INSTRUCTION_CACHE_ENABLE();
+  __HAL_FLASH_DATA_CACHE_ENABLE();
+  __HAL_FLASH_PREFETCH_BUFFER_ENABLE();
+
   GPIO_InitTypeDef  GPIO_InitStruct;
 
   // USB Pin Init
@@ -42,6 +42,213 @@ uint32_t W25Qx_GetTick(void)
 }
 #endif // W25Qx_SPI
 
+//--------------------------------------------------------------------+
+// Internal flash
+// Programmed in 256-bit flash words assembled from payloads. Each sector is erased once per
+// session. Erases complete in the flash interrupt: the first write to a sector starts its erase
+// and the host retries it until done (board_flash_write_busy). On dual-bank parts the erase of the
+// next sector is started ahead when it lies in the other bank, so it runs while the current bank
+// is programmed.
+//--------------------------------------------------------------------+
+
+#define FLASH_WORD_SIZE   (FLASH_NB_32BITWORD_IN_FLASHWORD * 4)
+#define NO_CACHE          0xffffffff
+
+#if defined(DUAL_BANK)
+  #define PFLASH_BANK_COUNT 2
+#else
+  #define PFLASH_BANK_COUNT 1
+#endif
+
+static uint8_t _fword[FLASH_WORD_SIZE] __attribute__((aligned(4)));
+static uint32_t _fword_addr = NO_CACHE;
+
+// one bit per sector erased in this session, bank 2 sectors follow bank 1
+static volatile uint32_t _erased_mask = 0;
+
+// sector erased in the background, NO_SECTOR if none. The HAL runs one interrupt driven
+// erase at a time, the flash end of operation interrupt clears it
+#define NO_SECTOR         0xffffffff
+static volatile uint32_t _erase_sector = NO_SECTOR;
+static bool _pflash_unlocked = false;
+
+// range the host is about to overwrite, see board_flash_erase_ahead()
+static uint32_t _ahead_start = 0;
+static uint32_t _ahead_end = 0;
+
+static inline uint32_t pflash_sector(uint32_t addr)
+{
+  return (addr - PFLASH_BASE_ADDR) / FLASH_SECTOR_SIZE;
+}
+
+static inline uint32_t pflash_bank(uint32_t sector)
+{
+  return sector / FLASH_SECTOR_TOTAL;
+}
+
+static inline bool pflash_erasing(uint32_t bank)
+{
+  uint32_t const sector = _erase_sector;
+  return sector != NO_SECTOR && pflash_bank(sector) == bank;
+}
+
+static void pflash_wait(uint32_t bank)
+{
+  while (pflash_erasing(bank)) {}
+}
+
+// Start erasing sector without waiting for it, sectors holding tinyuf2 are never erased
+static bool pflash_erase_start(uint32_t sector)
+{
+  if (_erased_mask & (1UL << sector)) return true;
+
+  uint32_t const sector_addr = PFLASH_BASE_ADDR + sector * FLASH_SECTOR_SIZE;
+  TUF2_ASSERT(sector_addr >= BOARD_PFLASH_APP_ADDR);
+
+  if (!_pflash_unlocked)
+  {
+    HAL_FLASH_Unlock();
+    _pflash_unlocked = true;
+  }
+
+  // one erase at a time, whichever bank it is in
+  while (_erase_sector != NO_SECTOR) {}
+
+  FLASH_EraseInitTypeDef erase =
+  {
+    .TypeErase    = FLASH_TYPEERASE_SECTORS,
+#if defined(DUAL_BANK)
+    .Banks        = pflash_bank(sector) ? FLASH_BANK_2 : FLASH_BANK_1,
+#else
+    .Banks        = FLASH_BANK_1,
+#endif
+    .Sector       = sector % FLASH_SECTOR_TOTAL,
+    .NbSectors    = 1,
+    .VoltageRange = FLASH_VOLTAGE_RANGE_3
+  };
+
+  TUF2_LOG1("Erase: %08lX size = %lu KB\r\n", sector_addr, FLASH_SECTOR_SIZE / 1024);
+
+  _erase_sector = sector;
+  _erased_mask |= (1UL << sector);
+
+  if (HAL_FLASHEx_Erase_IT(&erase) != HAL_OK)
+  {
+    _erase_sector = NO_SECTOR;
+    _erased_mask &= ~(1UL << sector);
+    return false;
+  }
+
+  return true;
+}
+
+static bool pflash_write_word(void)
+{
+  if (_fword_addr == NO_CACHE) return true;
+
+  uint32_t const addr = _fword_addr;
+  uint32_t const sector = pflash_sector(addr);
+  _fword_addr = NO_CACHE;
+
+  if (!pflash_erase_start(sector)) return false;
+  pflash_wait(pflash_bank(sector));
+
+  // next sector is in the other bank: erase it while this bank is programmed
+  uint32_t const next_addr = PFLASH_BASE_ADDR + (sector + 1) * FLASH_SECTOR_SIZE;
+  if (pflash_bank(sector + 1) != pflash_bank(sector) && pflash_bank(sector + 1) < PFLASH_BANK_COUNT &&
+      next_addr >= _ahead_start && next_addr < _ahead_end)
+  {
+    pflash_erase_start(sector + 1);
+  }
+
+  if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_FLASHWORD, addr, (uint32_t) _fword) != HAL_OK)
+  {
+    TUF2_LOG1("Failed to write flash at address %08lX\r\n", addr);
+    return false;
+  }
+
+  // flash word is one cache line, reads must not see what was cached before programming
+  SCB_InvalidateDCache_by_Addr((uint32_t *) addr, FLASH_WORD_SIZE);
+
+  return true;
+}
+
+// Assemble payload into flash words, a word is programmed once complete or on flush
+static bool pflash_write(uint32_t addr, uint8_t const * src, uint32_t len)
+{
+  while (len)
+  {
+    uint32_t const word_addr = addr & ~(FLASH_WORD_SIZE - 1);
+    uint32_t const offset = addr - word_addr;
+    uint32_t const count = (len < FLASH_WORD_SIZE - offset) ? len : (FLASH_WORD_SIZE - offset);
+
+    if (word_addr != _fword_addr)
+    {
+      if (!pflash_write_word()) return false;
+
+      _fword_addr = word_addr;
+      memset(_fword, 0xff, sizeof(_fword));
+    }
+
+    memcpy(_fword + offset, src, count);
+
+    if (offset + count == FLASH_WORD_SIZE)
+    {
+      if (!pflash_write_word()) return false;
+    }
+
+    addr += count;
+    src += count;
+    len -= count;
+  }
+
+  return true;
+}
+
+static void pflash_flush(void)
+{
+  pflash_write_word();
+
+  for (uint32_t bank = 0; bank < PFLASH_BANK_COUNT; bank++)
+  {
+    pflash_wait(bank);
+  }
+
+  if (_pflash_unlocked)
+  {
+    HAL_FLASH_Lock();
+    _pflash_unlocked = false;
+  }
+}
+
+void FLASH_IRQHandler(void)
+{
+  HAL_FLASH_IRQHandler();
+}
+
+void HAL_FLASH_EndOfOperationCallback(uint32_t ReturnValue)
+{
+  (void) ReturnValue;
+
+  if (_erase_sector != NO_SECTOR)
+  {
+    SCB_InvalidateDCache_by_Addr((uint32_t *) (PFLASH_BASE_ADDR + _erase_sector * FLASH_SECTOR_SIZE), FLASH_SECTOR_SIZE);
+    _erase_sector = NO_SECTOR;
+  }
+}
+
+void HAL_FLASH_OperationErrorCallback(uint32_t ReturnValue)
+{
+  (void) ReturnValue;
+
+  // erased again on the next write to it
+  if (_erase_sector != NO_SECTOR)
+  {
+    _erased_mask &= ~(1UL << _erase_sector);
+    _erase_sector = NO_SECTOR;
+  }
+}
+
 //--------------------------------------------------------------------+
 // Flash LL for tinyuf2
 //--------------------------------------------------------------------+
@@ -91,6 +298,8 @@ void board_flash_early_init(void)
 
 void board_flash_init(void)
 {
+  NVIC_EnableIRQ(FLASH_IRQn);
+
 #if BOARD_SPI_FLASH_EN
   // Initialize SPI peripheral
   spi_flash_init(&_spi_flash);
@@ -116,8 +325,33 @@ uint32_t board_flash_size(void)
 
 void board_flash_flush(void)
 {
-  // TODO: do we need to implement this if there no caching involved?
-  // maybe flush cached RAM here?
+  pflash_flush();
+}
+
+void board_flash_erase_ahead(uint32_t addr, uint32_t len)
+{
+  if (IS_PFLASH_ADDR(addr))
+  {
+    _ahead_start = addr;
+    _ahead_end = addr + len;
+  }
+}
+
+// Writes to a sector not erased yet start its erase and report busy until its bank is done, the
+// WRITE10 callback never waits for an erase
+bool board_flash_write_busy(uint32_t addr)
+{
+  if (!IS_PFLASH_ADDR(addr) || addr < BOARD_PFLASH_APP_ADDR) return false;
+
+  uint32_t const sector = pflash_sector(addr);
+
+  if (!(_erased_mask & (1UL << sector)))
+  {
+    if (_erase_sector == NO_SECTOR) pflash_erase_start(sector);
+    return true;
+  }
+
+  return pflash_erasing(pflash_bank(sector));
 }
 
 void board_flash_read(uint32_t addr, void * data, uint32_t len)
@@ -193,13 +427,12 @@ bool board_flash_write(uint32_t addr, void const * data, uint32_t len)
 
   // This is not a good idea for the h750 port because
   // - There is only one flash bank available
-  // - There is only one sector available
+  // - There is only one sector available, it holds tinyuf2 and is never erased
   // - It will also need a config section in flash to store the boot address
   if (IS_PFLASH_ADDR(addr) && IS_PFLASH_ADDR(addr + len - 1))
   {
-    // TODO: Implement this
     // SET_BOOT_ADDR(BOARD_PFLASH_APP_ADDR);
-    return false;
+    return pflash_write(addr, data, len);
   }
 
   // Invalid address write
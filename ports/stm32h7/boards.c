@@ -49,9 +49,40 @@ void board_init(void)
 #endif // TINYUF2_SELF_UPDATE
 }
 
+// DFU cache profile: I/D caches are enabled in board_init(), the MPU makes the memory they cover
+// explicit. QSPI is only memory mapped once the app is started, speculative reads of the unmapped
+// region would stall the bus. USB uses the FIFOs of the OTG core without DMA, internal flash is
+// invalidated after erase/program (board_flash.c) and AXI SRAM, write-back in the default
+// memory map, is cleaned in board_dfu_complete()
+static void dfu_mpu_init(void)
+{
+  MPU_Region_InitTypeDef region = { 0 };
+
+  HAL_MPU_Disable();
+
+  // QSPI: no access until memory mapped
+  region.Enable           = MPU_REGION_ENABLE;
+  region.Number           = MPU_REGION_NUMBER0;
+  region.BaseAddress      = QSPI_BASE_ADDR;
+  region.Size             = MPU_REGION_SIZE_256MB;
+  region.AccessPermission = MPU_REGION_NO_ACCESS;
+  region.TypeExtField     = MPU_TEX_LEVEL0;
+  region.IsBufferable     = MPU_ACCESS_NOT_BUFFERABLE;
+  region.IsCacheable      = MPU_ACCESS_NOT_CACHEABLE;
+  region.IsShareable      = MPU_ACCESS_SHAREABLE;
+  region.DisableExec      = MPU_INSTRUCTION_ACCESS_DISABLE;
+  region.SubRegionDisable = 0x00;
+  HAL_MPU_ConfigRegion(&region);
+
+  // everything else keeps the default memory map
+  HAL_MPU_Enable(MPU_PRIVILEGED_DEFAULT);
+}
+
 // Configure USB for DFU
 void board_dfu_init(void)
 {
+  dfu_mpu_init();
+
   // Not quite sure what an RHPORT is :/
 #if BOARD_TUD_RHPORT == 0
   GPIO_InitTypeDef GPIO_InitStruct;
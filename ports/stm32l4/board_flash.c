@@ -39,7 +39,34 @@ enum
   SECTOR_COUNT = 2048/4
 };
 
-static uint8_t erased_sectors[SECTOR_COUNT] = { 0 };
+// Sector state, checked lazily on first write to the sector
+enum
+{
+  SECTOR_UNKNOWN = 0, // not checked yet
+  SECTOR_BLANK,       // erased, nothing written yet
+  SECTOR_WRITTEN,     // written in this session, don't erase anymore
+  SECTOR_DIRTY        // holds old data, needs erase
+};
+
+// words sampled before scanning a whole sector
+#define SECTOR_SAMPLE_COUNT     16
+
+static uint8_t sector_state[SECTOR_COUNT] = { 0 };
+
+// Fast programming writes a row of 32 double-words
+#define FLASH_ROW_SIZE    256
+
+enum
+{
+  PAGE_ROW_COUNT = BOARD_PAGE_SIZE / FLASH_ROW_SIZE
+};
+
+#define NO_CACHE          0xffffffff
+
+// page assembled in RAM, one bit per double-word that holds payload
+static uint8_t _page[BOARD_PAGE_SIZE] __attribute__((aligned(8)));
+static uint32_t _page_mask[PAGE_ROW_COUNT];
+static uint32_t _page_addr = NO_CACHE;
 
 //--------------------------------------------------------------------+
 // Internal Helper
@@ -63,6 +90,25 @@ static bool is_blank(uint32_t addr, uint32_t size)
   return true;
 }
 
+// Sampled pre-check first, used sectors mostly fail at one of the samples without a full scan
+static uint8_t flash_sector_state(uint32_t sector, uint32_t sector_addr)
+{
+  if ( sector_state[sector] == SECTOR_UNKNOWN )
+  {
+    uint32_t const size = flash_sector_size(sector);
+    bool blank = (*(uint32_t*) (sector_addr + size - 4) == 0xffffffff);
+
+    for ( uint32_t i = 0; i < SECTOR_SAMPLE_COUNT && blank; i++ )
+    {
+      blank = (*(uint32_t*) (sector_addr + i * (size / SECTOR_SAMPLE_COUNT)) == 0xffffffff);
+    }
+
+    sector_state[sector] = (blank && is_blank(sector_addr, size)) ? SECTOR_BLANK : SECTOR_DIRTY;
+  }
+
+  return sector_state[sector];
+}
+
 static bool flash_erase(uint32_t addr)
 {
   // starting address from 0x08000000
@@ -80,8 +126,6 @@ static bool flash_erase(uint32_t addr)
     if ( sector_addr + size > addr )
     {
       sector = i;
-      erased = erased_sectors[i];
-      erased_sectors[i] = 1;    // don't erase anymore - we will continue writing here!
       break;
     }
     sector_addr += size;
@@ -89,7 +133,10 @@ static bool flash_erase(uint32_t addr)
 
   TUF2_ASSERT(sector);
 
-  if ( !erased && !is_blank(sector_addr, size) )
+  erased = (flash_sector_state(sector, sector_addr) != SECTOR_DIRTY);
+  sector_state[sector] = SECTOR_WRITTEN;    // don't erase anymore - we will continue writing here!
+
+  if ( !erased )
   {
     TUF2_LOG1("Erase: %08lX size = %lu KB ... ", sector_addr, size / 1024);
 
@@ -110,32 +157,56 @@ static bool flash_erase(uint32_t addr)
   return true;
 }
 
-static void flash_write(uint32_t dst, const uint8_t *src, int len)
+// Program the buffered page. Fully buffered rows of a blank page use fast programming,
+// the rest (page edges, partial rows) is programmed by double-word
+static void flash_write_page(void)
 {
-  flash_erase(dst);
+  if ( !flash_erase(_page_addr) ) return;
 
-  TUF2_LOG1("Write flash at address %08lX\r\n", dst);
-  for ( int i = 0; i < len; i += 8 )
+  TUF2_LOG1("Write flash at address %08lX\r\n", _page_addr);
+  for ( uint32_t row = 0; row < PAGE_ROW_COUNT; row++ )
   {
-    uint64_t data = *((uint64_t*) ((void*) (src + i)));
+    uint32_t const offset = row * FLASH_ROW_SIZE;
+    uint32_t const row_addr = _page_addr + offset;
+    uint32_t const mask = _page_mask[row];
+
+    if ( !mask ) continue;
 
-    if ( HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, dst + i, data) != HAL_OK )
+    // fast programming only works on a row that is still erased
+    if ( mask == UINT32_MAX && is_blank(row_addr, FLASH_ROW_SIZE) )
     {
-      TUF2_LOG1("Failed to write flash at address %08lX\r\n", dst + i);
-      break;
+      if ( HAL_FLASH_Program(FLASH_TYPEPROGRAM_FAST_AND_LAST, row_addr, (uint32_t) (_page + offset)) != HAL_OK )
+      {
+        TUF2_LOG1("Failed to write flash at address %08lX\r\n", row_addr);
+        return;
+      }
+      continue;
     }
 
-    if ( FLASH_WaitForLastOperation(HAL_MAX_DELAY) != HAL_OK )
+    for ( uint32_t i = 0; i < 32; i++ )
     {
-      TUF2_LOG1("Waiting on last operation failed\r\n");
-      return;
+      uint64_t data;
+      memcpy(&data, _page + offset + 8*i, 8);
+
+      // skip double-words not written or staying erased
+      if ( !(mask & (1UL << i)) || data == UINT64_MAX ) continue;
+
+      if ( HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, row_addr + 8*i, data) != HAL_OK )
+      {
+        TUF2_LOG1("Failed to write flash at address %08lX\r\n", row_addr + 8*i);
+        return;
+      }
     }
   }
 
   // verify contents
-  if (memcmp((void*)dst, src, len) != 0)
+  for ( uint32_t i = 0; i < PAGE_ROW_COUNT*32; i++ )
   {
-    TUF2_LOG1("Failed to write\r\n");
+    if ( (_page_mask[i / 32] & (1UL << (i % 32))) && memcmp((void*) (_page_addr + 8*i), _page + 8*i, 8) != 0 )
+    {
+      TUF2_LOG1("Failed to write\r\n");
+      return;
+    }
   }
 }
 
@@ -159,15 +230,48 @@ void board_flash_read(uint32_t addr, void* buffer, uint32_t len)
 
 void board_flash_flush(void)
 {
+  if ( _page_addr == NO_CACHE ) return;
+
+  HAL_FLASH_Unlock();
+  flash_write_page();
+  HAL_FLASH_Lock();
+
+  _page_addr = NO_CACHE;
 }
 
-// TODO not working quite yet
+// Payloads are assembled into whole pages in RAM, a page is programmed once the next payload
+// is in another page or on flush
 bool board_flash_write(uint32_t addr, void const* data, uint32_t len)
 {
-  // TODO skip matching contents
-  HAL_FLASH_Unlock();
-  flash_write(addr, data, len);
-  HAL_FLASH_Lock();
+  uint8_t const* src = (uint8_t const*) data;
+
+  while ( len )
+  {
+    uint32_t const page_addr = addr & ~(BOARD_PAGE_SIZE - 1);
+    uint32_t const offset = addr - page_addr;
+    uint32_t const count = (len < BOARD_PAGE_SIZE - offset) ? len : (BOARD_PAGE_SIZE - offset);
+
+    if ( page_addr != _page_addr )
+    {
+      board_flash_flush();
+
+      _page_addr = page_addr;
+      memset(_page, 0xff, sizeof(_page));
+      memset(_page_mask, 0, sizeof(_page_mask));
+    }
+
+    memcpy(_page + offset, src, count);
+
+    // mark double-words covered by the payload
+    for ( uint32_t i = offset / 8; i < (offset + count + 7) / 8; i++ )
+    {
+      _page_mask[i / 32] |= (1UL << (i % 32));
+    }
+
+    addr += count;
+    src += count;
+    len -= count;
+  }
 
   return true;
 }
@@ -0,0 +1,216 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "board_api.h"
+#include "flash_cache.h"
+#include "flash_model.h"
+
+//--------------------------------------------------------------------+
+// Reference flash backend for the shared write-back cache (CFG_UF2_FLASH_CACHE, see flash_cache.h): the
+// cache implements board_flash_write() and board_flash_flush() on top of the geometry and the raw
+// primitives below. With CFG_UF2_FLASH_CACHE_ASYNC it flushes from the main loop through the *_start()
+// variants and board_flash_busy(), so USB keeps being served while the chip erases. A new port replaces
+// the ctrl_*() functions with the registers or ROM API of its flash controller and the numbers in
+// flash_model.h with those of its chip, the rest stays as it is
+//--------------------------------------------------------------------+
+
+// flash as seen by the board_flash_*() API, CPU addresses if memory mapped
+#define FLASH_BASE_ADDR   0x00000000UL
+#define FLASH_SIZE        (4*1024*1024)
+
+//--------------------------------------------------------------------+
+// Controller, offsets are relative to FLASH_BASE_ADDR
+//--------------------------------------------------------------------+
+
+static void ctrl_init(void) {
+  // e.g clock, pins and quad mode of the flash interface
+}
+
+// Issue an erase of the erase unit or block at offset, returns without waiting for it
+static bool ctrl_erase(uint32_t offset, bool block) {
+  (void) offset;
+  (void) block;
+  return true;
+}
+
+// Issue a program of one page at offset, returns without waiting for it
+static bool ctrl_program_page(uint32_t offset, void const* data) {
+  (void) offset;
+  (void) data;
+  return true;
+}
+
+// Erase or program issued last still in progress, e.g WIP bit of the status register
+static bool ctrl_busy(void) {
+  return false;
+}
+
+// Operation on [addr, addr+len) has ended: invalidate whatever caches memory mapped flash
+static void ctrl_done(uint32_t addr, uint32_t len) {
+  (void) addr;
+  (void) len;
+}
+
+static void ctrl_read(uint32_t offset, void* buffer, uint32_t len) {
+#if PORT_FLASH_XIP
+  memcpy(buffer, (void const*) (uintptr_t) (FLASH_BASE_ADDR + offset), len);
+#else
+  // e.g fast read command
+  (void) offset;
+  memset(buffer, PORT_FLASH_ERASED_VALUE, len);
+#endif
+}
+
+static bool page_erased(uint8_t const* page) {
+  for (uint32_t i = 0; i < PORT_FLASH_PROGRAM_SIZE; i++) {
+    if (page[i] != PORT_FLASH_ERASED_VALUE) return false;
+  }
+  return true;
+}
+
+// block erase if the controller has one and [offset, offset+len) covers it
+static inline bool erase_block(uint32_t offset, uint32_t len) {
+  return PORT_FLASH_BLOCK_SIZE && !(offset & (PORT_FLASH_BLOCK_SIZE - 1)) && len >= PORT_FLASH_BLOCK_SIZE;
+}
+
+//--------------------------------------------------------------------+
+// Board API
+//--------------------------------------------------------------------+
+
+void board_flash_init(void) {
+  ctrl_init();
+}
+
+uint32_t board_flash_size(void) {
+  return FLASH_SIZE;
+}
+
+void board_flash_read(uint32_t addr, void* buffer, uint32_t len) {
+  // a chip that is erasing or programming returns no data
+  flash_cache_read_wait();
+  ctrl_read(addr - FLASH_BASE_ADDR, buffer, len);
+  flash_cache_read_overlay(addr, buffer, len);
+}
+
+board_flash_geometry_t const* board_flash_geometry(void) {
+  static board_flash_geometry_t const geo = {
+    .erase_size   = PORT_FLASH_ERASE_SIZE,
+    .block_size   = PORT_FLASH_BLOCK_SIZE,
+    .program_size = PORT_FLASH_PROGRAM_SIZE,
+    .erased_value = PORT_FLASH_ERASED_VALUE,
+    .xip          = PORT_FLASH_XIP,
+  };
+  return &geo;
+}
+
+// Blocking primitives, used by the cache without CFG_UF2_FLASH_CACHE_ASYNC. It traces them itself
+bool board_flash_erase_raw(uint32_t addr, uint32_t len) {
+  uint32_t const end = addr + len - FLASH_BASE_ADDR;
+  bool ok = true;
+
+  for (uint32_t offset = addr - FLASH_BASE_ADDR; offset < end && ok;) {
+    bool const block = erase_block(offset, end - offset);
+    ok = ctrl_erase(offset, block);
+    while (ok && ctrl_busy()) {}
+    offset += block ? PORT_FLASH_BLOCK_SIZE : PORT_FLASH_ERASE_SIZE;
+  }
+
+  ctrl_done(addr, len);
+  if (!ok) {
+    TUF2_LOG1("Erase failed at 0x%08lX\r\n", addr);
+  }
+  return ok;
+}
+
+bool board_flash_program(uint32_t addr, void const* data, uint32_t len) {
+  uint8_t const* src = (uint8_t const*) data;
+  bool ok = true;
+
+  for (uint32_t i = 0; i < len && ok; i += PORT_FLASH_PROGRAM_SIZE) {
+    // programming an erased page leaves flash as it is
+    if (page_erased(src + i)) continue;
+
+    ok = ctrl_program_page(addr + i - FLASH_BASE_ADDR, src + i);
+    while (ok && ctrl_busy()) {}
+  }
+
+  ctrl_done(addr, len);
+  if (!ok) {
+    TUF2_LOG1("Page program failed at 0x%08lX\r\n", addr);
+  }
+  return ok;
+}
+
+#if CFG_UF2_FLASH_CACHE_ASYNC
+// Operation started by board_flash_erase_start() or board_flash_program_start(), finished by board_flash_busy()
+static bool _op_pending = false;
+static uint32_t _op_addr;
+static uint32_t _op_len;
+
+bool board_flash_erase_start(uint32_t addr, uint32_t len) {
+  bool const block = erase_block(addr - FLASH_BASE_ADDR, len);
+
+  _op_addr = addr;
+  _op_len = block ? PORT_FLASH_BLOCK_SIZE : PORT_FLASH_ERASE_SIZE;
+  _op_pending = ctrl_erase(addr - FLASH_BASE_ADDR, block);
+
+  if (!_op_pending) {
+    TUF2_LOG1("Erase failed at 0x%08lX\r\n", addr);
+  }
+  return _op_pending;
+}
+
+bool board_flash_program_start(uint32_t addr, void const* data) {
+  if (page_erased((uint8_t const*) data)) return true;
+
+  _op_addr = addr;
+  _op_len = PORT_FLASH_PROGRAM_SIZE;
+  _op_pending = ctrl_program_page(addr - FLASH_BASE_ADDR, data);
+
+  if (!_op_pending) {
+    TUF2_LOG1("Page program failed at 0x%08lX\r\n", addr);
+  }
+  return _op_pending;
+}
+
+bool board_flash_busy(void) {
+  if (!_op_pending) return false;
+  if (ctrl_busy()) return true;
+
+  _op_pending = false;
+  ctrl_done(_op_addr, _op_len);
+  return false;
+}
+#endif
+
+void board_flash_erase_app(void) {
+  // TODO implement later
+}
+
+bool board_flash_protect_bootloader(bool protect) {
+  // TODO implement later
+  (void) protect;
+  return false;
+}
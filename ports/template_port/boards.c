@@ -92,49 +92,32 @@ void SysTick_Handler(void) {
   board_timer_handler();
 }
 
-int board_uart_write(void const* buf, int len) {
-  (void) buf;
-  (void) len;
-  return 0;
+// Free running 1MHz counter for STATS.TXT and the erase/program times of the flash cache, optional
+uint32_t board_micros(void) {
+  return 0; // TIM2->CNT
 }
 
 //--------------------------------------------------------------------+
-// Flash
+// Timing markers
 //--------------------------------------------------------------------+
-void board_flash_init(void) {
-
-}
-
-uint32_t board_flash_size(void) {
-  return 0;
-}
-
-void board_flash_read(uint32_t addr, void* buffer, uint32_t len) {
-  (void) addr;
-  (void) buffer;
-  (void) len;
-}
 
-void board_flash_flush(void) {
+// Logic analyzer pin with CFG_UF2_PERF_MARKER: one set/reset register write, ids outside
+// CFG_UF2_PERF_MARKER_IDS leave the pin alone. Flush spans show how long each erase unit keeps flash busy
+void board_perf_marker(uint32_t id, bool on) {
+  if (id < 32 && (CFG_UF2_PERF_MARKER_IDS & (1UL << id))) {
+    (void) on; // GPIOA->BSRR = on ? GPIO_BSRR_BS0 : GPIO_BSRR_BR0;
+  }
 }
 
-bool board_flash_write(uint32_t addr, void const* data, uint32_t len) {
-  (void) addr;
-  (void) data;
+int board_uart_write(void const* buf, int len) {
+  (void) buf;
   (void) len;
-
-  return true;
-}
-
-void board_flash_erase_app(void) {
-  // TODO implement later
+  return 0;
 }
 
-bool board_flash_protect_bootloader(bool protect) {
-  // TODO implement later
-  (void) protect;
-  return false;
-}
+//--------------------------------------------------------------------+
+// Flash, see board_flash.c
+//--------------------------------------------------------------------+
 
 #ifdef TINYUF2_SELF_UPDATE
 void board_self_update(const uint8_t * bootloader_bin, uint32_t bootloader_len)
@@ -33,6 +33,14 @@
 
 #define TINYUF2_DBL_TAP_DFU     0
 
+// board_flash_write() and flush by the shared write-back cache on top of board_flash.c, flushed in
+// the background by the main loop. Cache holds one erase unit of flash_model.h
+#include "flash_model.h"
+
+#define CFG_UF2_FLASH_CACHE        1
+#define CFG_UF2_FLASH_CACHE_ASYNC  1
+#define CFG_UF2_FLASH_CACHE_SIZE   PORT_FLASH_ERASE_SIZE
+
 #ifdef __cplusplus
  }
 #endif
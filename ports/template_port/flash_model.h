@@ -0,0 +1,52 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef PORT_FLASH_MODEL_H_
+#define PORT_FLASH_MODEL_H_
+
+//--------------------------------------------------------------------+
+// Flash of the port: geometry reported by board_flash_geometry() and datasheet timing. Kept free of
+// SDK includes so that test_ghostfat can simulate the same chip off-target as its "port" model, e.g in
+// ports/test_ghostfat: make CFG_UF2_FLASH_CACHE_ASYNC=1 write-port UF2=firmware.uf2 PORT_FLASH_MODEL=<this file>
+//--------------------------------------------------------------------+
+
+// smallest erase unit (sector), larger erase unit or 0 (block), program unit (page). Powers of 2
+#define PORT_FLASH_ERASE_SIZE        4096
+#define PORT_FLASH_BLOCK_SIZE        65536
+#define PORT_FLASH_PROGRAM_SIZE      256
+
+#define PORT_FLASH_ERASED_VALUE      0xff
+
+// memory mapped, flash addresses of the board_flash_*() API are CPU addresses
+#define PORT_FLASH_XIP               0
+
+// typical datasheet times, here a SPI NOR like W25Q32: sector and block erase, page program,
+// command overhead per page and read time per KB
+#define PORT_FLASH_ERASE_US          45000
+#define PORT_FLASH_BLOCK_ERASE_US    150000
+#define PORT_FLASH_PROGRAM_US        600
+#define PORT_FLASH_PROGRAM_SETUP_US  20
+#define PORT_FLASH_READ_NS_PER_KB    51200
+
+#endif
@@ -1,4 +1,6 @@
 #include "boards.h"
+#include "flash_sim.h"
+#include "flash_cache.h"
 
 // From board_api.h
 
@@ -26,22 +28,71 @@
 //------------- Flash -------------//
 uint32_t board_flash_size(void) { return CFG_UF2_FLASH_SIZE; }
 
-// not supported
-bool board_flash_write(uint32_t addr, void const* data, uint32_t len) {
-  (void) addr;
-  (void) data;
-  (void) len;
-  return true;
-}
-
 // not supported
 void board_self_update(const uint8_t* bootloader_bin, uint32_t bootloader_len) {
   (void) bootloader_bin;
   (void) bootloader_len;
 }
 
-// not supported
-void board_flash_flush(void) {}
+//------------- Simulated flash, see flash_sim.h -------------//
+board_flash_geometry_t const* board_flash_geometry(void) {
+  static board_flash_geometry_t geo;
+  FlashSimModel const* model = flash_sim_model();
+
+  geo.erase_size = model->erase_size;
+  geo.block_size = model->block_size;
+  geo.program_size = model->program_size;
+  geo.erased_value = 0xff;
+  geo.xip = false; // cache must not compare against host memory at flash address
+  return &geo;
+}
+
+bool board_flash_erase_raw(uint32_t addr, uint32_t len) {
+  return flash_sim_erase(addr, len);
+}
+
+bool board_flash_program(uint32_t addr, void const* data, uint32_t len) {
+  return flash_sim_program(addr, data, len);
+}
+
+#if CFG_UF2_FLASH_CACHE_ASYNC
+// operation is applied at once but reported busy for a few polls, like a chip that has started it
+static uint32_t _busy_polls = 0;
+
+bool board_flash_erase_start(uint32_t addr, uint32_t len) {
+  _busy_polls = 3;
+  return flash_sim_erase(addr, len);
+}
+
+bool board_flash_program_start(uint32_t addr, void const* data) {
+  _busy_polls = 1;
+  return flash_sim_program(addr, data, flash_sim_model()->program_size);
+}
+
+bool board_flash_busy(void) {
+  if (_busy_polls == 0) return false;
+  _busy_polls--;
+  return true;
+}
+#endif
+
+#if !CFG_UF2_FLASH_CACHE
+// no-op unless simulating
+bool board_flash_write(uint32_t addr, void const* data, uint32_t len) {
+  if (!flash_sim_active()) {
+    (void) addr;
+    (void) data;
+    (void) len;
+    return true;
+  }
+  return flash_sim_windowed() ? flash_sim_write_window(addr, data, len) : flash_sim_write_direct(addr, data, len);
+}
+
+// writes are only buffered by the window strategy
+void board_flash_flush(void) {
+  if (flash_sim_active()) flash_sim_flush_window();
+}
+#endif
 
 // not supported
 bool board_flash_protect_bootloader(bool protect) {
@@ -51,6 +102,17 @@ bool board_flash_protect_bootloader(bool protect) {
 
 //------------- Interesting part of flash support for this test -------------//
 void board_flash_read(uint32_t addr, void* buffer, uint32_t len) {
+  if (flash_sim_active()) {
+    flash_cache_read_wait();
+#if CFG_UF2_FLASH_CACHE_ASYNC
+    // a chip that is erasing or programming returns no data
+    if (_busy_polls) { exit(1); }
+#endif
+    flash_sim_read(addr, buffer, len);
+    flash_cache_read_overlay(addr, buffer, len);
+    return;
+  }
+
   if ((addr & 7) != 0) {
     // TODO - need to copy part of the first eight bytes
     exit(1); // failure exit
@@ -70,3 +132,20 @@ void board_flash_read(uint32_t addr, void* buffer, uint32_t len) {
     currentAddress += incBytes;
   }
 }
+
+//------------- Measurement data -------------//
+// not supported
+void board_measuremnt_data_read(uint32_t addr, void* buffer, uint32_t len) {
+  (void) addr;
+  memset(buffer, 0xff, len);
+}
+
+uint32_t board_measuremnt_data_size(void) { return 0; }
+
+//------------- USB -------------//
+// fixed serial, tells volumes apart with CFG_UF2_VOLUME_SERIAL_UNIQUE
+uint8_t board_usb_get_serial(uint8_t serial_id[16]) {
+  static uint8_t const id[6] = { 0x7C, 0xDF, 0xA1, 0x01, 0x23, 0x45 };
+  memcpy(serial_id, id, sizeof(id));
+  return sizeof(id);
+}
@@ -0,0 +1,55 @@
+#ifndef GHOSTFAT_TEST_FFCONF_H
+#define GHOSTFAT_TEST_FFCONF_H
+
+// FatFs configuration of the --fuzz reference parser: read-only, single volume, LFN enabled since
+// ghostfat renders VFAT long names. disk_*() glue is in main.c, reading through uf2_read_blocks()
+#define FFCONF_DEF          80286   // R0.15
+
+//------------- Function -------------//
+#define FF_FS_READONLY      1
+#define FF_FS_MINIMIZE      0
+#define FF_USE_FIND         0
+#define FF_USE_MKFS         0
+#define FF_USE_FASTSEEK     0
+#define FF_USE_EXPAND       0
+#define FF_USE_CHMOD        0
+#define FF_USE_LABEL        1
+#define FF_USE_FORWARD      0
+#define FF_USE_STRFUNC      0
+#define FF_PRINT_LLI        0
+#define FF_PRINT_FLOAT      0
+#define FF_STRF_ENCODE      0
+
+//------------- Namespace and locale -------------//
+#define FF_CODE_PAGE        437
+#define FF_USE_LFN          1       // static working buffer, each seed runs in its own process
+#define FF_MAX_LFN          255
+#define FF_LFN_UNICODE      0
+#define FF_LFN_BUF          255
+#define FF_SFN_BUF          12
+#define FF_FS_RPATH         0
+
+//------------- Drive/volume -------------//
+#define FF_VOLUMES          1
+#define FF_STR_VOLUME_ID    0
+#define FF_VOLUME_STRS      "RAM"
+#define FF_MULTI_PARTITION  0
+#define FF_MIN_SS           512
+#define FF_MAX_SS           512
+#define FF_LBA64            0
+#define FF_MIN_GPT          0x10000000
+#define FF_USE_TRIM         0
+
+//------------- System -------------//
+#define FF_FS_TINY          0
+#define FF_FS_EXFAT         0
+#define FF_FS_NORTC         1
+#define FF_NORTC_MON        1
+#define FF_NORTC_MDAY       1
+#define FF_NORTC_YEAR       2022
+#define FF_FS_NOFSINFO      0
+#define FF_FS_LOCK          0
+#define FF_FS_REENTRANT     0
+#define FF_FS_TIMEOUT       1000
+
+#endif  // GHOSTFAT_TEST_FFCONF_H
@@ -0,0 +1,331 @@
+#include "boards.h"
+#include "flash_sim.h"
+
+#include <stddef.h>
+#include <inttypes.h>
+
+// flash_model.h of the port being brought up, simulated as model "port"
+#ifdef PORT_FLASH_MODEL
+#include PORT_FLASH_MODEL
+#endif
+
+// Typical datasheet values:
+// - esp32  : SPI NOR like W25Q32/GD25Q32, 4KB sector / 64KB block erase, 256B page program, QIO read
+// - stm32f4: internal flash at 2.7-3.6V, 128KB application sectors, x32 programming, memory mapped
+// - imxrt  : FlexSPI NOR like IS25WP/W25Q, same erase/program as SPI NOR, octal/quad DDR read
+// - port   : PORT_FLASH_* of PORT_FLASH_MODEL, ports/template_port/flash_model.h unless overridden
+static FlashSimModel const _models[] = {
+    { "esp32"  ,   4096, 65536, 256,   45000, 150000, 600, 20, 51200 },
+    { "stm32f4", 131072,     0,   4, 1000000,      0,  16,  0,  2000 },
+    { "imxrt"  ,   4096, 65536, 256,   45000, 150000, 400, 20, 10240 },
+#ifdef PORT_FLASH_MODEL
+    { "port"   , PORT_FLASH_ERASE_SIZE, PORT_FLASH_BLOCK_SIZE, PORT_FLASH_PROGRAM_SIZE, PORT_FLASH_ERASE_US,
+      PORT_FLASH_BLOCK_ERASE_US, PORT_FLASH_PROGRAM_US, PORT_FLASH_PROGRAM_SETUP_US, PORT_FLASH_READ_NS_PER_KB },
+#endif
+    { NULL }
+};
+
+// fields settable by flash_sim_set()
+static struct {
+    char const * key;
+    size_t offset;
+} const _fields[] = {
+    { "erase_size"      , offsetof(FlashSimModel, erase_size)       },
+    { "block_size"      , offsetof(FlashSimModel, block_size)       },
+    { "program_size"    , offsetof(FlashSimModel, program_size)     },
+    { "erase_us"        , offsetof(FlashSimModel, erase_us)         },
+    { "block_erase_us"  , offsetof(FlashSimModel, block_erase_us)   },
+    { "program_us"      , offsetof(FlashSimModel, program_us)       },
+    { "program_setup_us", offsetof(FlashSimModel, program_setup_us) },
+    { "read_ns_per_kb"  , offsetof(FlashSimModel, read_ns_per_kb)   },
+};
+
+static bool _active = false;
+static FlashSimModel _model;
+static FlashSimStats _stats;
+static uint8_t * _flash = NULL;
+
+// erase units written in this session by flash_sim_write_direct()
+static uint8_t * _unit_written = NULL;
+
+// window strategy: active slot windows (NULL reads as 0x00), windows opened in this session
+static bool _windowed = false;
+static uint8_t ** _active_windows = NULL;
+static uint8_t * _window_opened = NULL;
+static uint8_t _window_buf[FLASH_SIM_WINDOW_SIZE];
+static uint32_t _window_addr = UINT32_MAX;
+static uint32_t _window_dirty = 0;
+
+//--------------------------------------------------------------------+
+// Model
+//--------------------------------------------------------------------+
+
+FlashSimModel const * flash_sim_find_model(char const * name) {
+    if (!name) { return _models; }
+    for (FlashSimModel const * m = _models; m->name; m++) {
+        if (0 == strcmp(m->name, name)) { return m; }
+    }
+    return NULL;
+}
+
+bool flash_sim_set(FlashSimModel * model, char const * assignment) {
+    char const * eq = strchr(assignment, '=');
+    if (!eq) { return false; }
+
+    char * end;
+    unsigned long const value = strtoul(eq + 1, &end, 0);
+    if ((end == eq + 1) || *end) { return false; }
+
+    for (size_t i = 0; i < sizeof(_fields) / sizeof(_fields[0]); i++) {
+        if ((strlen(_fields[i].key) == (size_t)(eq - assignment)) &&
+            (0 == strncmp(_fields[i].key, assignment, eq - assignment))) {
+            *(uint32_t *)((uint8_t *)model + _fields[i].offset) = (uint32_t)value;
+            return true;
+        }
+    }
+    return false;
+}
+
+void flash_sim_init(FlashSimModel const * model) {
+    _model = *model;
+    memset(&_stats, 0, sizeof(_stats));
+
+    if (_active_windows) {
+        for (uint32_t w = 0; w < CFG_UF2_FLASH_SIZE / FLASH_SIM_WINDOW_SIZE; w++) { free(_active_windows[w]); }
+    }
+    free(_flash);
+    free(_unit_written);
+    free(_active_windows);
+    free(_window_opened);
+    _flash = malloc(CFG_UF2_FLASH_SIZE);
+    _unit_written = calloc(CFG_UF2_FLASH_SIZE / _model.erase_size + 1, 1);
+    _active_windows = calloc(CFG_UF2_FLASH_SIZE / FLASH_SIM_WINDOW_SIZE + 1, sizeof(uint8_t *));
+    _window_opened = calloc(CFG_UF2_FLASH_SIZE / FLASH_SIM_WINDOW_SIZE + 1, 1);
+    _windowed = false;
+    _window_addr = UINT32_MAX;
+    if (!_flash || !_unit_written || !_active_windows || !_window_opened) {
+        printf("flash_sim: out of memory\n");
+        exit(1);
+    }
+    memset(_flash, 0xff, CFG_UF2_FLASH_SIZE);
+
+    _active = true;
+}
+
+void flash_sim_fill(int value) {
+    if (value >= 0) {
+        memset(_flash, value, CFG_UF2_FLASH_SIZE);
+        return;
+    }
+
+    uint32_t seed = 0x87654321u;
+    for (uint32_t i = 0; i < CFG_UF2_FLASH_SIZE; i++) {
+        seed = seed * 1664525u + 1013904223u; // LCG, same contents every run
+        _flash[i] = (uint8_t)(seed >> 24);
+    }
+}
+
+bool flash_sim_active(void) { return _active; }
+FlashSimModel const * flash_sim_model(void) { return &_model; }
+FlashSimStats const * flash_sim_stats(void) { return &_stats; }
+uint8_t const * flash_sim_contents(void) { return _flash; }
+
+//--------------------------------------------------------------------+
+// Raw primitives
+//--------------------------------------------------------------------+
+
+static bool in_range(uint32_t addr, uint32_t len) {
+    return (addr <= CFG_UF2_FLASH_SIZE) && (len <= CFG_UF2_FLASH_SIZE - addr);
+}
+
+bool flash_sim_erase(uint32_t addr, uint32_t len) {
+    bool const block = _model.block_size && (len == _model.block_size);
+    uint32_t const unit = block ? _model.block_size : _model.erase_size;
+
+    if (!in_range(addr, len) || (addr & (unit - 1)) || (len & (unit - 1))) {
+        printf("flash_sim: unaligned erase 0x%08" PRIx32 " + %" PRIu32 "\n", addr, len);
+        return false;
+    }
+
+    memset(_flash + addr, 0xff, len);
+
+    if (block) {
+        _stats.block_erase_count++;
+        _stats.time_ns += (uint64_t)_model.block_erase_us * 1000;
+    } else {
+        _stats.erase_count += len / unit;
+        _stats.time_ns += (uint64_t)_model.erase_us * 1000 * (len / unit);
+    }
+    return true;
+}
+
+bool flash_sim_program(uint32_t addr, void const * data, uint32_t len) {
+    if (!in_range(addr, len) || (addr & (_model.program_size - 1))) {
+        printf("flash_sim: unaligned program 0x%08" PRIx32 " + %" PRIu32 "\n", addr, len);
+        return false;
+    }
+
+    // NOR programming only clears bits
+    uint8_t const * src = data;
+    for (uint32_t i = 0; i < len; i++) {
+        if ((_flash[addr + i] & src[i]) != src[i]) { _stats.program_errors++; }
+        _flash[addr + i] &= src[i];
+    }
+
+    uint32_t const units = (len + _model.program_size - 1) / _model.program_size;
+    _stats.program_calls++;
+    _stats.bytes_programmed += len;
+    _stats.time_ns += ((uint64_t)_model.program_setup_us + (uint64_t)units * _model.program_us) * 1000;
+    return true;
+}
+
+void flash_sim_read(uint32_t addr, void * buffer, uint32_t len) {
+    if (!in_range(addr, len)) {
+        memset(buffer, 0xff, len);
+        return;
+    }
+
+    memcpy(buffer, _flash + addr, len);
+    _stats.bytes_read += len;
+    _stats.time_ns += (uint64_t)len * _model.read_ns_per_kb / 1024;
+
+    // data of the window being filled is not in flash yet
+    if ((_window_addr != UINT32_MAX) && (addr < _window_addr + FLASH_SIM_WINDOW_SIZE) && (_window_addr < addr + len)) {
+        uint32_t const start = (addr > _window_addr) ? addr : _window_addr;
+        uint32_t const end = (addr + len < _window_addr + FLASH_SIM_WINDOW_SIZE) ? (addr + len) : (_window_addr + FLASH_SIM_WINDOW_SIZE);
+        memcpy((uint8_t *)buffer + (start - addr), _window_buf + (start - _window_addr), end - start);
+    }
+}
+
+//--------------------------------------------------------------------+
+// Direct write strategy
+//--------------------------------------------------------------------+
+
+bool flash_sim_write_direct(uint32_t addr, void const * data, uint32_t len) {
+    uint8_t const * src = data;
+    static uint8_t unit_buf[256 * 1024];
+
+    while (len) {
+        uint32_t const unit = addr / _model.erase_size;
+        uint32_t const unit_addr = unit * _model.erase_size;
+        uint32_t const n = (len < unit_addr + _model.erase_size - addr) ? len : (unit_addr + _model.erase_size - addr);
+
+        if (!in_range(addr, n) || (_model.erase_size > sizeof(unit_buf))) { return false; }
+
+        if (!_unit_written[unit]) {
+            _unit_written[unit] = 1;
+
+            // blank check reads the whole unit
+            flash_sim_read(unit_addr, unit_buf, _model.erase_size);
+            bool blank = true;
+            for (uint32_t i = 0; (i < _model.erase_size) && blank; i++) { blank = (unit_buf[i] == 0xff); }
+
+            if (!blank && !flash_sim_erase(unit_addr, _model.erase_size)) { return false; }
+        }
+
+        if (!flash_sim_program(addr, src, n)) { return false; }
+
+        addr += n;
+        src += n;
+        len -= n;
+    }
+    return true;
+}
+
+void flash_sim_new_session(void) {
+    memset(_unit_written, 0, CFG_UF2_FLASH_SIZE / _model.erase_size + 1);
+
+    // slots are swapped on reset only after a verified image, both were the same before this session
+    flash_sim_flush_window();
+    memset(_window_opened, 0, CFG_UF2_FLASH_SIZE / FLASH_SIM_WINDOW_SIZE + 1);
+}
+
+//--------------------------------------------------------------------+
+// Window strategy with A/B slots
+//--------------------------------------------------------------------+
+
+void flash_sim_set_windowed(bool windowed) { _windowed = windowed; }
+bool flash_sim_windowed(void) { return _windowed; }
+
+void flash_sim_set_active(uint32_t addr, void const * data, uint32_t len) {
+    uint32_t const w = addr / FLASH_SIM_WINDOW_SIZE;
+    if (!in_range(addr, len) || (len > (w + 1) * FLASH_SIM_WINDOW_SIZE - addr)) { return; }
+
+    if (!_active_windows[w] && !(_active_windows[w] = calloc(FLASH_SIM_WINDOW_SIZE, 1))) {
+        printf("flash_sim: out of memory\n");
+        exit(1);
+    }
+    memcpy(_active_windows[w] + addr % FLASH_SIM_WINDOW_SIZE, data, len);
+}
+
+// erase units of a window, at most 32 of them
+static uint32_t window_units(void) { return FLASH_SIM_WINDOW_SIZE / _model.erase_size; }
+
+bool flash_sim_flush_window(void) {
+    if (_window_addr == UINT32_MAX) { return true; }
+
+    uint32_t const unit = _model.erase_size;
+    for (uint32_t u = 0; u < window_units(); u++) {
+        if (!(_window_dirty & (1UL << u))) { continue; }
+        if (!flash_sim_erase(_window_addr + u * unit, unit) ||
+            !flash_sim_program(_window_addr + u * unit, _window_buf + u * unit, unit)) { return false; }
+    }
+
+    _window_addr = UINT32_MAX;
+    _window_dirty = 0;
+    return true;
+}
+
+static bool window_open(uint32_t window) {
+    uint32_t const w = window / FLASH_SIM_WINDOW_SIZE;
+    uint32_t const unit = _model.erase_size;
+
+    if (!flash_sim_flush_window()) { return false; }
+
+    _window_dirty = 0;
+    if (_window_opened[w]) {
+        flash_sim_read(window, _window_buf, FLASH_SIM_WINDOW_SIZE);
+    } else {
+        // rest of the window keeps the running image, units equal to it may still differ from the target slot
+        if (_active_windows[w]) {
+            memcpy(_window_buf, _active_windows[w], FLASH_SIM_WINDOW_SIZE);
+        } else {
+            memset(_window_buf, 0, FLASH_SIM_WINDOW_SIZE);
+        }
+        for (uint32_t u = 0; u < window_units(); u++) {
+            if (memcmp(_window_buf + u * unit, _flash + window + u * unit, unit)) { _window_dirty |= 1UL << u; }
+        }
+        _stats.bytes_read += FLASH_SIM_WINDOW_SIZE;
+        _stats.time_ns += (uint64_t)FLASH_SIM_WINDOW_SIZE * _model.read_ns_per_kb / 1024;
+        _window_opened[w] = 1;
+    }
+    _window_addr = window;
+    return true;
+}
+
+bool flash_sim_write_window(uint32_t addr, void const * data, uint32_t len) {
+    uint8_t const * src = data;
+    uint32_t const unit = _model.erase_size;
+
+    if (!in_range(addr, len) || (unit > FLASH_SIM_WINDOW_SIZE) || (window_units() > 32)) { return false; }
+
+    while (len) {
+        uint32_t const window = addr & ~(FLASH_SIM_WINDOW_SIZE - 1);
+        uint32_t const offset = addr - window;
+        uint32_t const n = (len < FLASH_SIM_WINDOW_SIZE - offset) ? len : (FLASH_SIM_WINDOW_SIZE - offset);
+
+        if ((window != _window_addr) && !window_open(window)) { return false; }
+
+        // a unit is only marked if the write changes the window
+        for (uint32_t i = offset; i < offset + n; i = (i / unit + 1) * unit) {
+            uint32_t const end = ((i / unit + 1) * unit < offset + n) ? (i / unit + 1) * unit : (offset + n);
+            if (memcmp(_window_buf + i, src + (i - offset), end - i)) { _window_dirty |= 1UL << (i / unit); }
+        }
+        memcpy(_window_buf + offset, src, n);
+
+        addr += n;
+        src += n;
+        len -= n;
+    }
+    return true;
+}
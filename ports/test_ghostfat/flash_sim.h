@@ -0,0 +1,83 @@
+#ifndef GHOSTFAT_TEST_FLASH_SIM_H
+#define GHOSTFAT_TEST_FLASH_SIM_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Simulated NOR flash behind board_flash_*() with a timing model. Inactive until flash_sim_init(),
+// board_flash_read() then returns simulated contents instead of the address pattern of the image test.
+// Nothing is slept, elapsed time is only accumulated.
+typedef struct {
+    char const * name;
+    uint32_t erase_size;          // smallest erase unit, power of 2
+    uint32_t block_size;          // larger erase unit, 0 if there is none
+    uint32_t program_size;        // program granularity, also the unit of program_us
+    uint32_t erase_us;            // erase one erase_size unit
+    uint32_t block_erase_us;      // erase one block_size unit
+    uint32_t program_us;          // program one program_size unit
+    uint32_t program_setup_us;    // per board_flash_program() call e.g command and wait for ready
+    uint32_t read_ns_per_kb;      // board_flash_read() cost
+} FlashSimModel;
+
+typedef struct {
+    uint64_t time_ns;             // simulated time so far
+    uint32_t erase_count;         // erase_size units erased
+    uint32_t block_erase_count;   // block_size units erased
+    uint32_t program_calls;
+    uint64_t bytes_programmed;
+    uint64_t bytes_read;
+    uint32_t program_errors;      // programmed bits that were not erased (NOR can only clear bits)
+} FlashSimStats;
+
+// NULL if there is no such model, name NULL returns the list terminated by a NULL name
+FlashSimModel const * flash_sim_find_model(char const * name);
+
+// Set model field from "key=value" e.g "erase_us=30000", return false if key or value is unknown
+bool flash_sim_set(FlashSimModel * model, char const * assignment);
+
+// Start simulating with erased flash and cleared statistics
+void flash_sim_init(FlashSimModel const * model);
+
+// Preset contents without cost e.g previous firmware still in flash, value < 0 fills pseudo-random data
+void flash_sim_fill(int value);
+
+bool flash_sim_active(void);
+FlashSimModel const * flash_sim_model(void);
+FlashSimStats const * flash_sim_stats(void);
+uint8_t const * flash_sim_contents(void);
+
+// Raw primitives with the contract of board_flash_erase_raw(), board_flash_program() and board_flash_read()
+bool flash_sim_erase(uint32_t addr, uint32_t len);
+bool flash_sim_program(uint32_t addr, void const * data, uint32_t len);
+void flash_sim_read(uint32_t addr, void * buffer, uint32_t len);
+
+// Write strategy without the shared cache, like the stm32f4 and espressif ports: each erase unit is
+// erased (unless blank) the first time it is written in this session, writes are programmed right away
+bool flash_sim_write_direct(uint32_t addr, void const * data, uint32_t len);
+
+// Device reset between two images, flash_sim_write_direct() erases units written before again
+void flash_sim_new_session(void);
+
+// Write strategy of the espressif port with FLASH_AB_SLOTS: writes are collected in a 64KB window of the
+// target slot (flash), a window not written in this session starts out as what the active slot holds.
+// On flush only the erase units that differ from the target slot are erased and programmed
+#define FLASH_SIM_WINDOW_SIZE     (64 * 1024)
+
+// Select the window strategy for board_flash_write(), the active slot reads as 0x00 until set
+void flash_sim_set_windowed(bool windowed);
+bool flash_sim_windowed(void);
+
+// Contents of the active slot at [addr, addr+len), within one window
+void flash_sim_set_active(uint32_t addr, void const * data, uint32_t len);
+
+bool flash_sim_write_window(uint32_t addr, void const * data, uint32_t len);
+bool flash_sim_flush_window(void);
+
+#ifdef __cplusplus
+ }
+#endif
+#endif  // GHOSTFAT_TEST_FLASH_SIM_H
@@ -0,0 +1,69 @@
+#ifndef GHOSTFAT_TEST_NVS_H
+#define GHOSTFAT_TEST_NVS_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Host stand-in for the ESP-IDF NVS API used by ghostfat.c: an empty "storage" namespace that
+// accepts writes and forgets them. Keys read back as not found, so the image only depends on
+// the board configuration and the flash contents.
+typedef int esp_err_t;
+typedef uint32_t nvs_handle_t;
+
+#define ESP_OK                          0
+#define ESP_ERR_INVALID_SIZE            0x104
+#define ESP_ERR_NVS_NOT_FOUND           0x1102
+#define ESP_ERR_NVS_NO_FREE_PAGES       0x110d
+#define ESP_ERR_NVS_NEW_VERSION_FOUND   0x1110
+
+#define ESP_ERROR_CHECK(_x)             ((void) (_x))
+
+typedef enum {
+  NVS_READONLY,
+  NVS_READWRITE
+} nvs_open_mode_t;
+
+static inline esp_err_t nvs_open(char const* name, nvs_open_mode_t mode, nvs_handle_t* handle) {
+  (void) name;
+  *handle = 0;
+  return (mode == NVS_READWRITE) ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+static inline void nvs_close(nvs_handle_t handle) {
+  (void) handle;
+}
+
+static inline esp_err_t nvs_commit(nvs_handle_t handle) {
+  (void) handle;
+  return ESP_OK;
+}
+
+static inline esp_err_t nvs_get_blob(nvs_handle_t handle, char const* key, void* value, size_t* length) {
+  (void) handle; (void) key; (void) value; (void) length;
+  return ESP_ERR_NVS_NOT_FOUND;
+}
+
+static inline esp_err_t nvs_set_blob(nvs_handle_t handle, char const* key, void const* value, size_t length) {
+  (void) handle; (void) key; (void) value; (void) length;
+  return ESP_OK;
+}
+
+static inline esp_err_t nvs_get_u32(nvs_handle_t handle, char const* key, uint32_t* value) {
+  (void) handle; (void) key; (void) value;
+  return ESP_ERR_NVS_NOT_FOUND;
+}
+
+static inline esp_err_t nvs_set_u32(nvs_handle_t handle, char const* key, uint32_t value) {
+  (void) handle; (void) key; (void) value;
+  return ESP_OK;
+}
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
@@ -1,5 +1,14 @@
 #include "boards.h"
+#include "flash_sim.h"
+#include "flash_cache.h"
+#include "sched.h"
+#include "ff.h"
+#include "diskio.h"
 #include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <strings.h>
+#include <sys/wait.h>
 
 #ifndef COMPILE_DATE
   #error "Reproducible build requirement - COMPILE_DATE"
@@ -349,10 +358,1105 @@ int DumpDiskImage(void) {
     return ERR_NONE;
 }
 
-int main(void)
+//--------------------------------------------------------------------+
+// Read benchmark: sectors/second of uf2_read_block() per region and access pattern
+//--------------------------------------------------------------------+
+
+// each measurement reads at least this many sectors and runs for at least BENCH_MIN_MS. Integer
+// constants: make.mk builds with -fsingle-precision-constant, timing is kept in double
+#define BENCH_MIN_READS   20000u
+#define BENCH_MIN_MS      200u
+#define BENCH_MAX_RANGES  32
+
+typedef struct {
+    uint32_t first;
+    uint32_t count;
+} SectorRange;
+
+typedef struct {
+    char const * name;
+    SectorRange ranges[BENCH_MAX_RANGES];
+    uint32_t rangeCount;
+    uint32_t sectorCount;
+} BenchRegion;
+
+static void AddRange(BenchRegion * region, uint32_t first, uint32_t count) {
+    if ((count == 0) || (region->rangeCount == BENCH_MAX_RANGES)) { return; }
+    region->ranges[region->rangeCount].first = first;
+    region->ranges[region->rangeCount].count = count;
+    region->rangeCount++;
+    region->sectorCount += count;
+}
+
+// n-th sector of the region, ranges in order
+static uint32_t RegionSector(BenchRegion const * region, uint32_t n) {
+    for (uint32_t i = 0; i < region->rangeCount; i++) {
+        if (n < region->ranges[i].count) { return region->ranges[i].first + n; }
+        n -= region->ranges[i].count;
+    }
+    return region->ranges[0].first;
+}
+
+static double NowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1000000000u;
+}
+
+static uint16_t ReadU16(uint8_t const * p) { return p[0] | (p[1] << 8); }
+static uint32_t ReadU32(uint8_t const * p) { return ReadU16(p) | ((uint32_t)ReadU16(p + 2) << 16); }
+
+// Regions are found the way a host would: from the boot sector and the root directory entries
+enum { REGION_BOOT, REGION_FAT, REGION_ROOTDIR, REGION_STATIC, REGION_CURRENT_UF2, REGION_FREE, REGION_COUNT };
+
+static int FindRegions(BenchRegion regions[REGION_COUNT]) {
+    uint8_t * const bpb = singleSectorBuffer;
+    uf2_read_block(0, bpb);
+
+    uint32_t const reserved        = ReadU16(bpb + 0x0E);
+    uint32_t const fatCount        = bpb[0x10];
+    uint32_t const rootEntries     = ReadU16(bpb + 0x11);
+    uint32_t const sectorsPerFat   = ReadU16(bpb + 0x16);
+    uint32_t const sectorsPerClust = bpb[0x0D];
+    uint32_t const rootSectors     = (rootEntries * 32 + GHOSTFAT_SECTOR_SIZE - 1) / GHOSTFAT_SECTOR_SIZE;
+    uint32_t const rootStart       = reserved + fatCount * sectorsPerFat;
+    uint32_t const dataStart       = rootStart + rootSectors;
+
+    if ((ReadU16(bpb + 0x0B) != GHOSTFAT_SECTOR_SIZE) || (sectorsPerClust == 0) || (sectorsPerFat == 0)) {
+        return ERR_INTERNAL_ERROR;
+    }
+
+    memset(regions, 0, REGION_COUNT * sizeof(BenchRegion));
+    regions[REGION_BOOT].name        = "boot";
+    regions[REGION_FAT].name         = "fat";
+    regions[REGION_ROOTDIR].name     = "rootdir";
+    regions[REGION_STATIC].name      = "static";
+    regions[REGION_CURRENT_UF2].name = "current_uf2";
+    regions[REGION_FREE].name        = "free";
+
+    AddRange(&regions[REGION_BOOT], 0, reserved);
+    AddRange(&regions[REGION_FAT], reserved, fatCount * sectorsPerFat);
+    AddRange(&regions[REGION_ROOTDIR], rootStart, rootSectors);
+
+    // regular files in the root directory, skipping LFN, volume label, directories and free entries
+    for (uint32_t s = 0; s < rootSectors; s++) {
+        uf2_read_block(rootStart + s, anotherSectorBuffer);
+        for (uint32_t e = 0; e < GHOSTFAT_SECTOR_SIZE; e += 32) {
+            uint8_t const * d = anotherSectorBuffer + e;
+            if ((d[0] == 0x00) || (d[0] == 0xE5) || (d[11] & 0x18)) { continue; }
+
+            uint32_t const cluster = ReadU16(d + 0x1A) | ((uint32_t)ReadU16(d + 0x14) << 16);
+            uint32_t const size = ReadU32(d + 0x1C);
+            if ((cluster < 2) || (size == 0)) { continue; }
+
+            uint32_t const first = dataStart + (cluster - 2) * sectorsPerClust;
+            uint32_t const count = (size + GHOSTFAT_SECTOR_SIZE - 1) / GHOSTFAT_SECTOR_SIZE;
+            bool const isCurrent = (0 == memcmp(d, "CURRENT UF2", 11));
+            AddRange(&regions[isCurrent ? REGION_CURRENT_UF2 : REGION_STATIC], first, count);
+        }
+    }
+
+    // free clusters are the gaps between files, up to the end of the volume
+    uint32_t const totalSectors = ReadU16(bpb + 0x13) ? ReadU16(bpb + 0x13) : ReadU32(bpb + 0x20);
+    uint32_t next = dataStart;
+    while (next < totalSectors) {
+        uint32_t gapEnd = totalSectors;
+        uint32_t fileEnd = next;
+        for (int r = REGION_STATIC; r <= REGION_CURRENT_UF2; r++) {
+            for (uint32_t i = 0; i < regions[r].rangeCount; i++) {
+                SectorRange const * range = &regions[r].ranges[i];
+                if (range->first + range->count <= next) { continue; }
+                if (range->first <= next) {
+                    if (range->first + range->count > fileEnd) { fileEnd = range->first + range->count; }
+                } else if (range->first < gapEnd) {
+                    gapEnd = range->first;
+                }
+            }
+        }
+        if (fileEnd > next) {
+            next = fileEnd;
+            continue;
+        }
+        AddRange(&regions[REGION_FREE], next, gapEnd - next);
+        next = gapEnd;
+    }
+
+    return ERR_NONE;
+}
+
+// Emits one CSV line per region and pattern
+static void BenchRegionPattern(BenchRegion const * region, bool random) {
+    uint32_t seed = 0x12345678u;
+    uint32_t reads = 0;
+    double const start = NowSeconds();
+    double elapsed;
+
+    do {
+        for (uint32_t i = 0; i < 1000; i++, reads++) {
+            uint32_t n = reads % region->sectorCount;
+            if (random) {
+                seed = seed * 1664525u + 1013904223u; // LCG, same sequence every run
+                n = (seed >> 8) % region->sectorCount;
+            }
+            uf2_read_block(RegionSector(region, n), singleSectorBuffer);
+        }
+        elapsed = NowSeconds() - start;
+    } while ((reads < BENCH_MIN_READS) || (elapsed * 1000u < BENCH_MIN_MS));
+
+    printf("%s,%s,%" PRIu32 ",%" PRIu32 ",%.6f,%.0f\n",
+           region->name, random ? "random" : "sequential",
+           region->sectorCount, reads, elapsed, reads / elapsed);
+}
+
+int BenchmarkReads(void) {
+    BenchRegion regions[REGION_COUNT];
+    int r = FindRegions(regions);
+    if (r) { return r; }
+
+    printf("region,pattern,sectors,reads,seconds,sectors_per_second\n");
+    for (int i = 0; i < REGION_COUNT; i++) {
+        if (regions[i].sectorCount == 0) { continue; }
+        BenchRegionPattern(&regions[i], false);
+        BenchRegionPattern(&regions[i], true);
+    }
+    fflush(stdout);
+    return ERR_NONE;
+}
+
+//--------------------------------------------------------------------+
+// Region digests: regression check of large volumes without a golden image
+//--------------------------------------------------------------------+
+
+static char const * const knownGoodDigestFilename = "knowngood.digest";
+
+// each region is also hashed in this many chunks, which locate a mismatch
+#define DIGEST_CHUNKS 16
+
+typedef struct {
+    uint64_t region;
+    uint64_t chunks[DIGEST_CHUNKS];
+    uint32_t chunkSectors;
+} RegionDigest;
+
+// FNV-1a over 64-bit little-endian words, 8x faster than per byte. The xor-shift feeds high bits
+// back to the low ones, which a multiply alone never does
+static uint64_t HashSector(uint64_t hash, uint8_t const * sector) {
+    for (uint32_t i = 0; i < GHOSTFAT_SECTOR_SIZE; i += 8) {
+        uint64_t word;
+        memcpy(&word, sector + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ull;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+#define HASH_INIT 0xcbf29ce484222325ull
+
+// Streams the region through uf2_read_block(), nothing is stored
+static void DigestRegion(BenchRegion const * region, RegionDigest * digest) {
+    digest->region = HASH_INIT;
+    digest->chunkSectors = (region->sectorCount + DIGEST_CHUNKS - 1) / DIGEST_CHUNKS;
+    for (uint32_t c = 0; c < DIGEST_CHUNKS; c++) { digest->chunks[c] = HASH_INIT; }
+
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < region->rangeCount; i++) {
+        for (uint32_t s = 0; s < region->ranges[i].count; s++, n++) {
+            uf2_read_block(region->ranges[i].first + s, singleSectorBuffer);
+            digest->region = HashSector(digest->region, singleSectorBuffer);
+            uint64_t * chunk = &digest->chunks[n / digest->chunkSectors];
+            *chunk = HashSector(*chunk, singleSectorBuffer);
+        }
+    }
+}
+
+// Line per region "name sectors digest" followed by its chunks "name.index sectors digest"
+int WriteDigests(char const * filename) {
+    BenchRegion regions[REGION_COUNT];
+    int r = FindRegions(regions);
+    if (r) { return r; }
+
+    FILE * file = fopen(filename, "w");
+    if (!file) { return ERR_CANNOT_OPEN_NEW_IMAGE_FILE; }
+
+    fprintf(file, "# test_ghostfat region digests, regenerate with --mk-digest\n");
+    for (int i = 0; i < REGION_COUNT; i++) {
+        RegionDigest digest;
+        DigestRegion(&regions[i], &digest);
+        fprintf(file, "%s %" PRIu32 " %016" PRIx64 "\n", regions[i].name, regions[i].sectorCount, digest.region);
+        for (uint32_t c = 0; c * digest.chunkSectors < regions[i].sectorCount; c++) {
+            fprintf(file, "%s.%" PRIu32 " %" PRIu32 " %016" PRIx64 "\n", regions[i].name, c,
+                    digest.chunkSectors, digest.chunks[c]);
+        }
+    }
+
+    if (fclose(file)) { return ERR_FAILED_CLOSE_FILE; }
+    return ERR_NONE;
+}
+
+// Looks up "name sectors digest" for region or chunk name in the digest file
+static bool FindDigest(FILE * file, char const * name, uint32_t * sectors, uint64_t * digest) {
+    char line[128];
+    char lineName[64];
+    rewind(file);
+    while (fgets(line, sizeof(line), file)) {
+        if ((sscanf(line, "%63s %" SCNu32 " %" SCNx64, lineName, sectors, digest) == 3) &&
+            (0 == strcmp(lineName, name))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int CompareDigests(char const * filename) {
+    BenchRegion regions[REGION_COUNT];
+    int r = FindRegions(regions);
+    if (r) { return r; }
+
+    FILE * file = fopen(filename, "r");
+    if (!file) { return ERR_CANNOT_OPEN_KNOWN_GOOD_IMAGE_FILE; }
+
+    int retVal = ERR_NONE;
+    for (int i = 0; i < REGION_COUNT; i++) {
+        uint32_t expectedSectors;
+        uint64_t expected;
+        if (!FindDigest(file, regions[i].name, &expectedSectors, &expected)) {
+            printf("FAIL: no digest for region %s\n", regions[i].name);
+            retVal = ERR_FILES_NOT_IDENTICAL;
+            continue;
+        }
+
+        RegionDigest digest;
+        DigestRegion(&regions[i], &digest);
+
+        if (expectedSectors != regions[i].sectorCount) {
+            printf("FAIL: region %s has %" PRIu32 " sectors, expected %" PRIu32 "\n",
+                   regions[i].name, regions[i].sectorCount, expectedSectors);
+            retVal = ERR_FILES_NOT_IDENTICAL;
+            continue;
+        }
+        if (expected == digest.region) {
+            printf("INFO: region %s (%" PRIu32 " sectors) matches\n", regions[i].name, regions[i].sectorCount);
+            continue;
+        }
+
+        printf("FAIL: region %s (%" PRIu32 " sectors) does not match\n", regions[i].name, regions[i].sectorCount);
+        retVal = ERR_FILES_NOT_IDENTICAL;
+
+        for (uint32_t c = 0; c * digest.chunkSectors < regions[i].sectorCount; c++) {
+            char name[80];
+            uint32_t chunkSectors;
+            snprintf(name, sizeof(name), "%s.%" PRIu32, regions[i].name, c);
+            if (FindDigest(file, name, &chunkSectors, &expected) && (expected == digest.chunks[c])) { continue; }
+
+            uint32_t const n = c * digest.chunkSectors;
+            uint32_t const last = (n + digest.chunkSectors < regions[i].sectorCount) ?
+                                  (n + digest.chunkSectors - 1) : (regions[i].sectorCount - 1);
+            printf("FAIL:   mismatch in sectors %" PRIu32 "..%" PRIu32 " (byte offset 0x%" PRIx64 ")\n",
+                   RegionSector(&regions[i], n), RegionSector(&regions[i], last),
+                   ((uint64_t)GHOSTFAT_SECTOR_SIZE) * RegionSector(&regions[i], n));
+        }
+    }
+
+    fclose(file);
+    return retVal;
+}
+
+//--------------------------------------------------------------------+
+// Write simulation: feed an uf2 file through uf2_write_blocks() into the simulated flash
+//--------------------------------------------------------------------+
+
+// image is moved down to an address aligned to the largest erase unit of all models
+#define WRITE_BASE_ALIGN  0x40000u
+
+// LBA the uf2 file is written at, anywhere past the FAT like a host would
+#define WRITE_FIRST_LBA   0x1000u
+
+typedef enum {
+    ORDER_SEQUENTIAL,
+    ORDER_REVERSE,
+    ORDER_RANDOM,
+    ORDER_INTERLEAVE,
+} WriteOrder;
+
+static char const * const orderNames[] = { "sequential", "reverse", "random", "interleave" };
+
+static WriteState writeState;
+
+// uf2_write_blocks() until all count sectors are taken, running background flash jobs like the main loop of a
+// port without an RTOS while it reports busy. Stops early if it is still busy once no job is left to run
+static uint32_t WriteBlocks(uint32_t lba, uint8_t * sectors, uint32_t count) {
+    uint32_t done = 0;
+    bool pending = true;
+    while (done < count) {
+        uint32_t const n = uf2_write_blocks(lba + done, sectors + done * GHOSTFAT_SECTOR_SIZE, count - done, &writeState);
+        if (n == 0) {
+            if (!pending) { break; }
+            pending = tuf2_sched_run();
+        } else {
+            pending = true;
+        }
+        done += n;
+    }
+    return done;
+}
+
+// Loads the file, keeps blocks of the first family as app blocks rebased to the start of flash
+static uint8_t * LoadUf2(char const * filename, uint32_t * blockCount) {
+    FILE * file = fopen(filename, "rb");
+    if (!file) { return NULL; }
+
+    uint8_t * buffer = NULL;
+    if (!fseek(file, 0L, SEEK_END)) {
+        long int const size = ftell(file);
+        *blockCount = (size > 0) ? (uint32_t)(size / GHOSTFAT_SECTOR_SIZE) : 0;
+        buffer = malloc(*blockCount * GHOSTFAT_SECTOR_SIZE + 1);
+        if (buffer && (fseek(file, 0L, SEEK_SET) ||
+            (fread(buffer, GHOSTFAT_SECTOR_SIZE, *blockCount, file) != *blockCount))) {
+            free(buffer);
+            buffer = NULL;
+        }
+    }
+    fclose(file);
+    if (!buffer || (*blockCount == 0)) { free(buffer); return NULL; }
+
+    UF2_Block * const blocks = (UF2_Block *)buffer;
+    uint32_t familyID = 0;
+    uint32_t minAddr = UINT32_MAX;
+    bool familySeen = false;
+
+    for (uint32_t i = 0; i < *blockCount; i++) {
+        UF2_Block * bl = &blocks[i];
+        if ((bl->magicStart0 != UF2_MAGIC_START0) || (bl->magicStart1 != UF2_MAGIC_START1) ||
+            (bl->flags & UF2_FLAG_NOFLASH)) { continue; }
+        if (!familySeen) { familyID = bl->familyID; familySeen = true; }
+        if ((bl->familyID == familyID) && (bl->targetAddr < minAddr)) { minAddr = bl->targetAddr; }
+    }
+    uint32_t const base = minAddr & ~(WRITE_BASE_ALIGN - 1);
+
+    for (uint32_t i = 0; i < *blockCount; i++) {
+        UF2_Block * bl = &blocks[i];
+        if ((bl->magicStart0 != UF2_MAGIC_START0) || (bl->magicStart1 != UF2_MAGIC_START1) ||
+            (bl->flags & UF2_FLAG_NOFLASH)) { continue; }
+        if (bl->familyID != familyID) {
+            bl->flags |= UF2_FLAG_NOFLASH; // other family, e.g another partition
+            continue;
+        }
+        bl->flags |= UF2_FLAG_FAMILYID;
+        bl->familyID = BOARD_UF2_FAMILY_ID;
+        bl->targetAddr -= base;
+    }
+    return buffer;
+}
+
+// Chunk sequence of the given host write order
+static void OrderChunks(uint32_t * chunks, uint32_t count, WriteOrder order) {
+    for (uint32_t i = 0; i < count; i++) { chunks[i] = i; }
+
+    if (order == ORDER_REVERSE) {
+        for (uint32_t i = 0; i < count; i++) { chunks[i] = count - 1 - i; }
+    } else if (order == ORDER_RANDOM) {
+        uint32_t seed = 0x12345678u;
+        for (uint32_t i = count; i > 1; i--) {
+            seed = seed * 1664525u + 1013904223u; // LCG, same sequence every run
+            uint32_t const j = (seed >> 8) % i;
+            uint32_t const tmp = chunks[i - 1];
+            chunks[i - 1] = chunks[j];
+            chunks[j] = tmp;
+        }
+    } else if (order == ORDER_INTERLEAVE) {
+        // even chunks first, then odd ones
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < count; i += 2) { chunks[n++] = i; }
+        for (uint32_t i = 1; i < count; i += 2) { chunks[n++] = i; }
+    }
+}
+
+// Payloads of plain app blocks against simulated flash, compressed and delta payloads are not comparable
+static char const * VerifyWrite(uint8_t const * image, uint32_t blockCount) {
+    uint8_t const * flash = flash_sim_contents();
+    uint32_t checked = 0;
+
+    for (uint32_t i = 0; i < blockCount; i++) {
+        UF2_Block const * bl = (UF2_Block const *)(image + i * GHOSTFAT_SECTOR_SIZE);
+        if ((bl->magicStart0 != UF2_MAGIC_START0) || (bl->magicStart1 != UF2_MAGIC_START1) ||
+            (bl->flags & (UF2_FLAG_NOFLASH | UF2_FLAG_HEATSHRINK | UF2_FLAG_DELTA | UF2_FLAG_MD5))) { continue; }
+        if ((bl->targetAddr + bl->payloadSize > CFG_UF2_FLASH_SIZE) ||
+            memcmp(flash + bl->targetAddr, bl->data, bl->payloadSize)) {
+            return "mismatch";
+        }
+        checked++;
+    }
+    return checked ? "ok" : "skipped";
+}
+
+// fill < 0 is pseudo-random data, 0xff is erased flash
+int SimulateWrite(char const * filename, FlashSimModel const * model, WriteOrder order, uint32_t chunk, int fill) {
+    uint32_t blockCount = 0;
+    uint8_t * image = LoadUf2(filename, &blockCount);
+    if (!image) { return ERR_INVALID_FILENAME; }
+
+    uint32_t const chunkCount = (blockCount + chunk - 1) / chunk;
+    uint32_t * chunks = malloc(chunkCount * sizeof(uint32_t));
+    if (!chunks) { free(image); return ERR_INTERNAL_ERROR; }
+    OrderChunks(chunks, chunkCount, order);
+
+    // uf2_write_blocks() may modify the sectors, writes are fed from a copy
+    uint8_t * sectors = malloc(chunk * GHOSTFAT_SECTOR_SIZE);
+    if (!sectors) { free(chunks); free(image); return ERR_INTERNAL_ERROR; }
+
+    flash_sim_init(model);
+    flash_sim_fill(fill);
+    memset(&writeState, 0, sizeof(writeState));
+
+    for (uint32_t c = 0; c < chunkCount; c++) {
+        uint32_t const first = chunks[c] * chunk;
+        uint32_t const count = (first + chunk <= blockCount) ? chunk : (blockCount - first);
+        memcpy(sectors, image + first * GHOSTFAT_SECTOR_SIZE, count * GHOSTFAT_SECTOR_SIZE);
+
+        WriteBlocks(WRITE_FIRST_LBA + first, sectors, count);
+        tuf2_sched_run();
+    }
+
+    // host may not have completed the image (different numBlocks), write back what is left
+    board_flash_flush();
+
+    FlashSimStats const * stats = flash_sim_stats();
+    char fillName[12];
+    if (fill < 0) { strcpy(fillName, "random"); } else { snprintf(fillName, sizeof(fillName), "0x%02x", fill); }
+    printf("model,strategy,order,chunk,fill,blocks,sim_ms,erases,block_erases,bytes_programmed,bytes_read,program_errors,verify\n");
+    printf("%s,%s,%s,%" PRIu32 ",%s,%" PRIu32 ",%.3f,%" PRIu32 ",%" PRIu32 ",%" PRIu64 ",%" PRIu64 ",%" PRIu32 ",%s\n",
+           model->name, CFG_UF2_FLASH_CACHE_ASYNC ? "async" : (CFG_UF2_FLASH_CACHE ? "cache" : "direct"), orderNames[order], chunk, fillName, blockCount,
+           (double) stats->time_ns / 1000000u, stats->erase_count, stats->block_erase_count,
+           stats->bytes_programmed, stats->bytes_read, stats->program_errors,
+           VerifyWrite(image, blockCount));
+    fflush(stdout);
+
+    free(sectors);
+    free(chunks);
+    free(image);
+    return ERR_NONE;
+}
+
+// --write file.uf2 [--model name] [--order name] [--chunk sectors] [--fill byte|random] [--set key=value]...
+static int WriteMain(int argc, char * argv[]) {
+    FlashSimModel model = *flash_sim_find_model("esp32");
+    WriteOrder order = ORDER_SEQUENTIAL;
+    uint32_t chunk = 1;
+    int fill = 0xff;
+
+    for (int i = 3; i < argc; i += 2) {
+        char const * option = argv[i];
+        char const * value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (!value) { option = NULL; }
+
+        if (option && (0 == strcmp(option, "--model"))) {
+            FlashSimModel const * m = flash_sim_find_model(value);
+            if (!m) {
+                fprintf(stderr, "unknown model %s, one of:", value);
+                for (m = flash_sim_find_model(NULL); m->name; m++) { fprintf(stderr, " %s", m->name); }
+                fprintf(stderr, "\n");
+                return ERR_INTERNAL_ERROR;
+            }
+            model = *m;
+        } else if (option && (0 == strcmp(option, "--order"))) {
+            int o = 0;
+            while ((o < (int)(sizeof(orderNames) / sizeof(orderNames[0]))) && strcmp(orderNames[o], value)) { o++; }
+            if (o == (int)(sizeof(orderNames) / sizeof(orderNames[0]))) {
+                fprintf(stderr, "unknown order %s\n", value);
+                return ERR_INTERNAL_ERROR;
+            }
+            order = (WriteOrder)o;
+        } else if (option && (0 == strcmp(option, "--chunk"))) {
+            chunk = (uint32_t)strtoul(value, NULL, 0);
+            if (chunk == 0) { chunk = 1; }
+        } else if (option && (0 == strcmp(option, "--fill"))) {
+            fill = (0 == strcmp(value, "random")) ? -1 : (int)(strtoul(value, NULL, 0) & 0xff);
+        } else if (option && (0 == strcmp(option, "--set"))) {
+            if (!flash_sim_set(&model, value)) {
+                fprintf(stderr, "invalid model setting %s\n", value);
+                return ERR_INTERNAL_ERROR;
+            }
+        } else {
+            fprintf(stderr, "invalid option %s\n", argv[i]);
+            return ERR_INTERNAL_ERROR;
+        }
+    }
+
+    if ((model.erase_size == 0) || (model.erase_size & (model.erase_size - 1)) ||
+        (model.program_size == 0) || (model.program_size & (model.program_size - 1))) {
+        fprintf(stderr, "erase_size and program_size must be powers of 2\n");
+        return ERR_INTERNAL_ERROR;
+    }
+#if CFG_UF2_FLASH_CACHE
+    if (model.erase_size > CFG_UF2_FLASH_CACHE_SIZE) {
+        fprintf(stderr, "erase_size larger than CFG_UF2_FLASH_CACHE_SIZE\n");
+        return ERR_INTERNAL_ERROR;
+    }
+#endif
+
+    return SimulateWrite(argv[2], &model, order, chunk, fill);
+}
+
+//--------------------------------------------------------------------+
+// Fuzzing: randomized host access patterns through uf2_read_blocks() and uf2_write_blocks(), the layer
+// below tud_msc_read10_cb() / tud_msc_write10_cb() which need tinyusb. The volume is checked by FatFs
+// after every step. ghostfat state is global, so each seed runs in a child process of its own.
+//--------------------------------------------------------------------+
+
+#define FUZZ_MAX_RUN      64u   // sectors per READ10 / WRITE10, more than tinyusb ever passes at once
+#define FUZZ_MAX_BLOCKS   2048u // blocks of a generated uf2 image
+#define FUZZ_MAX_READ     65536u // files up to this size are read completely, larger ones are sampled
+
+typedef struct {
+    uint32_t rng;
+    uint32_t step;
+    uint32_t totalSectors;
+    BenchRegion regions[REGION_COUNT];
+
+    // image being copied by the host, NULL in between
+    uint8_t * image;
+    uint32_t blockCount;
+    uint32_t lba;
+    uint32_t * chunks;      // first block and count of each WRITE10, in host order
+    uint32_t chunkCount;
+    uint32_t chunkNext;
+    uint32_t imagesDone;
+} FuzzState;
+
+static FATFS fuzzFs;
+static uint8_t fuzzRun[FUZZ_MAX_RUN * GHOSTFAT_SECTOR_SIZE];
+static uint8_t fuzzRef[FUZZ_MAX_RUN * GHOSTFAT_SECTOR_SIZE];
+static char fuzzFile[FUZZ_MAX_READ + 1];
+
+//------------- FatFs disk glue -------------//
+DSTATUS disk_status(BYTE pdrv) { return pdrv ? STA_NOINIT : 0; }
+DSTATUS disk_initialize(BYTE pdrv) { return disk_status(pdrv); }
+
+DRESULT disk_read(BYTE pdrv, BYTE * buff, LBA_t sector, UINT count) {
+    if (pdrv) { return RES_PARERR; }
+    uf2_read_blocks(sector, count, buff);
+    return RES_OK;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void * buff) {
+    if (pdrv) { return RES_PARERR; }
+    if (cmd == CTRL_SYNC) { return RES_OK; }
+    if (cmd == GET_SECTOR_SIZE) { *(WORD *)buff = GHOSTFAT_SECTOR_SIZE; return RES_OK; }
+    return RES_PARERR;
+}
+
+//------------- Host actions -------------//
+
+// xorshift32, [0, n)
+static uint32_t FuzzRandom(FuzzState * fz, uint32_t n) {
+    uint32_t x = fz->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    fz->rng = x;
+    return n ? (x % n) : x;
+}
+
+// Random run of at most maxCount sectors within one range of the region, 0 if the region is empty
+static uint32_t FuzzPickRun(FuzzState * fz, BenchRegion const * region, uint32_t maxCount, uint32_t * lba) {
+    if (region->sectorCount == 0) { return 0; }
+
+    uint32_t n = FuzzRandom(fz, region->sectorCount);
+    uint32_t i = 0;
+    while (n >= region->ranges[i].count) { n -= region->ranges[i++].count; }
+
+    uint32_t const left = region->ranges[i].count - n;
+    *lba = region->ranges[i].first + n;
+    uint32_t const count = 1 + FuzzRandom(fz, maxCount);
+    return (count < left) ? count : left;
+}
+
+// READ10 of a random run, optionally announced by read ahead: must match reading its sectors one by one
+static char const * FuzzRead(FuzzState * fz) {
+    uint32_t lba;
+    uint32_t count = 1 + FuzzRandom(fz, FUZZ_MAX_RUN);
+
+    if (FuzzRandom(fz, 2)) {
+        lba = FuzzRandom(fz, fz->totalSectors + FUZZ_MAX_RUN); // may run past the end of the volume
+    } else if (!(count = FuzzPickRun(fz, &fz->regions[FuzzRandom(fz, REGION_COUNT)], FUZZ_MAX_RUN, &lba))) {
+        return NULL;
+    }
+
+    if (FuzzRandom(fz, 2)) { uf2_read_ahead(lba, count); }
+    uf2_read_blocks(lba, count, fuzzRun);
+
+    for (uint32_t i = 0; i < count; i++) { uf2_read_block(lba + i, fuzzRef + i * GHOSTFAT_SECTOR_SIZE); }
+    return memcmp(fuzzRun, fuzzRef, count * GHOSTFAT_SECTOR_SIZE) ? "multi-sector read differs from single sector reads" : NULL;
+}
+
+#if CFG_UF2_BLOCK_CRC
+// UF2_EXT_CRC32 tag after the payload as tools/uf2pack.py --crc adds it
+static void FuzzAddCrc(UF2_Block * bl) {
+    bl->flags |= UF2_FLAG_EXTENSION;
+    uint8_t const * p = (uint8_t const *)bl;
+    uint32_t crc = 0xffffffff;
+    for (uint32_t i = 0; i < 32 + bl->payloadSize; i++) {
+        crc ^= p[i];
+        for (int k = 0; k < 8; k++) { crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1))); }
+    }
+    crc = ~crc;
+    uint32_t const tag = 8 | ((uint32_t)UF2_EXT_CRC32 << 8);
+    memcpy(bl->data + bl->payloadSize, &tag, 4);
+    memcpy(bl->data + bl->payloadSize + 4, &crc, 4);
+}
+#endif
+
+// Random plain image somewhere in flash, copied as chunks of random size in sequential or shuffled order
+static void FuzzStartImage(FuzzState * fz) {
+    uint32_t const count = 1 + FuzzRandom(fz, FUZZ_MAX_BLOCKS);
+    uint32_t const units = (count * 256 + 4095) / 4096;
+    uint32_t const base = FuzzRandom(fz, CFG_UF2_FLASH_SIZE / 4096 - units + 1) * 4096;
+
+    fz->image = calloc(count, GHOSTFAT_SECTOR_SIZE);
+    fz->chunks = malloc(2 * count * sizeof(uint32_t));
+    if (!fz->image || !fz->chunks) {
+        printf("fuzz: out of memory\n");
+        exit(1);
+    }
+    fz->blockCount = count;
+
+    for (uint32_t i = 0; i < count; i++) {
+        UF2_Block * bl = (UF2_Block *)(fz->image + i * GHOSTFAT_SECTOR_SIZE);
+        bl->magicStart0 = UF2_MAGIC_START0;
+        bl->magicStart1 = UF2_MAGIC_START1;
+        bl->flags = UF2_FLAG_FAMILYID;
+        bl->targetAddr = base + i * 256;
+        bl->payloadSize = 256;
+        bl->blockNo = i;
+        bl->numBlocks = count;
+        bl->familyID = BOARD_UF2_FAMILY_ID;
+        for (uint32_t j = 0; j < 256; j++) { bl->data[j] = (uint8_t)FuzzRandom(fz, 0); }
+        bl->magicEnd = UF2_MAGIC_END;
+#if CFG_UF2_BLOCK_CRC
+        FuzzAddCrc(bl);
+#endif
+    }
+
+    // A/B slots: about half of the windows of the image are unchanged from the running app, they must still
+    // reach the target slot
+    if (flash_sim_windowed()) {
+        uint32_t window = UINT32_MAX;
+        bool same = false;
+        for (uint32_t i = 0; i < count; i++) {
+            UF2_Block const * bl = (UF2_Block const *)(fz->image + i * GHOSTFAT_SECTOR_SIZE);
+            if (bl->targetAddr / FLASH_SIM_WINDOW_SIZE != window) {
+                window = bl->targetAddr / FLASH_SIM_WINDOW_SIZE;
+                same = FuzzRandom(fz, 2);
+            }
+            if (same) { flash_sim_set_active(bl->targetAddr, bl->data, bl->payloadSize); }
+        }
+    }
+
+    fz->chunkCount = 0;
+    for (uint32_t first = 0; first < count; fz->chunkCount++) {
+        uint32_t n = 1 + FuzzRandom(fz, FUZZ_MAX_RUN);
+        if (n > count - first) { n = count - first; }
+        fz->chunks[2 * fz->chunkCount] = first;
+        fz->chunks[2 * fz->chunkCount + 1] = n;
+        first += n;
+    }
+    if (FuzzRandom(fz, 2)) {
+        for (uint32_t i = fz->chunkCount; i > 1; i--) {
+            uint32_t const j = FuzzRandom(fz, i);
+            uint32_t const first = fz->chunks[2 * (i - 1)], n = fz->chunks[2 * (i - 1) + 1];
+            fz->chunks[2 * (i - 1)] = fz->chunks[2 * j];
+            fz->chunks[2 * (i - 1) + 1] = fz->chunks[2 * j + 1];
+            fz->chunks[2 * j] = first;
+            fz->chunks[2 * j + 1] = n;
+        }
+    }
+    fz->chunkNext = 0;
+
+    // file goes to free clusters when they are large enough, the LBA does not matter to ghostfat otherwise
+    fz->lba = WRITE_FIRST_LBA;
+    BenchRegion const * freeRegion = &fz->regions[REGION_FREE];
+    for (uint32_t i = 0; i < freeRegion->rangeCount; i++) {
+        if (freeRegion->ranges[i].count >= count) {
+            fz->lba = freeRegion->ranges[i].first + FuzzRandom(fz, freeRegion->ranges[i].count - count + 1);
+            break;
+        }
+    }
+
+    // bootloader was reset after the previous image
+    if (fz->imagesDone) { flash_sim_new_session(); }
+    memset(&writeState, 0, sizeof(writeState));
+}
+
+// Next WRITE10 of the image being copied, sometimes an earlier one again like a host retrying
+static char const * FuzzWriteImage(FuzzState * fz) {
+    if (!fz->image) { FuzzStartImage(fz); }
+
+    bool const resend = fz->chunkNext && (FuzzRandom(fz, 8) == 0);
+    uint32_t const c = resend ? FuzzRandom(fz, fz->chunkNext) : fz->chunkNext++;
+    uint32_t const first = fz->chunks[2 * c];
+    uint32_t const count = fz->chunks[2 * c + 1];
+
+#if CFG_UF2_BLOCK_CRC
+    // chunk corrupted on the way first: the damaged block must be dropped, the others are new and counted
+    if (!resend && (FuzzRandom(fz, 8) == 0)) {
+        uint32_t const written = writeState.numWritten;
+        memcpy(fuzzRun, fz->image + first * GHOSTFAT_SECTOR_SIZE, count * GHOSTFAT_SECTOR_SIZE);
+        fuzzRun[FuzzRandom(fz, count) * GHOSTFAT_SECTOR_SIZE + 32 + FuzzRandom(fz, 256)] ^= 1 << FuzzRandom(fz, 8);
+        if (WriteBlocks(fz->lba + first, fuzzRun, count) != count) {
+            return "corrupted write not consumed";
+        }
+        if (writeState.numWritten != written + count - 1) { return "block failing its crc was counted"; }
+    }
+#endif
+
+    // uf2_write_blocks() may modify the sectors, fed from a copy
+    memcpy(fuzzRun, fz->image + first * GHOSTFAT_SECTOR_SIZE, count * GHOSTFAT_SECTOR_SIZE);
+    if (WriteBlocks(fz->lba + first, fuzzRun, count) != count) {
+        return "write not consumed, simulated flash stays busy";
+    }
+
+    if (fz->chunkNext < fz->chunkCount) { return NULL; }
+
+    // last chunk completes the image, which flushes it
+    char const * result = NULL;
+    if (writeState.numWritten != fz->blockCount) {
+        result = "written block count does not match image";
+    } else if (strcmp(VerifyWrite(fz->image, fz->blockCount), "ok")) {
+        result = "flash does not match completed image";
+    }
+    free(fz->image);
+    free(fz->chunks);
+    fz->image = NULL;
+    fz->chunks = NULL;
+    fz->imagesDone++;
+    return result;
+}
+
+// Host OS writing back metadata or static file sectors as it reads them, e.g updating the FAT or
+// directory entries without any change
+static char const * FuzzRewrite(FuzzState * fz) {
+    static int const regions[] = { REGION_BOOT, REGION_FAT, REGION_ROOTDIR, REGION_STATIC };
+    uint32_t lba;
+    uint32_t const count = FuzzPickRun(fz, &fz->regions[regions[FuzzRandom(fz, 4)]], 8, &lba);
+    if (!count) { return NULL; }
+
+    uf2_read_blocks(lba, count, fuzzRun);
+    return (WriteBlocks(lba, fuzzRun, count) != count) ? "metadata write not consumed" : NULL;
+}
+
+// Other file written by the host into free clusters, not touching the image being copied
+static char const * FuzzWriteOther(FuzzState * fz) {
+    uint32_t lba;
+    uint32_t const count = FuzzPickRun(fz, &fz->regions[REGION_FREE], FUZZ_MAX_RUN, &lba);
+    if (!count || (fz->image && (lba < fz->lba + fz->blockCount) && (fz->lba < lba + count))) { return NULL; }
+
+    for (uint32_t i = 0; i < count * GHOSTFAT_SECTOR_SIZE; i++) { fuzzRun[i] = (uint8_t)FuzzRandom(fz, 0); }
+    // low byte of every block magic is non-zero
+    for (uint32_t i = 0; i < count; i++) { fuzzRun[i * GHOSTFAT_SECTOR_SIZE] = 0; }
+
+    return (WriteBlocks(lba, fuzzRun, count) != count) ? "data write not consumed" : NULL;
+}
+
+//------------- Reference check by FatFs -------------//
+
+static char const * FuzzCheckFile(FuzzState * fz, char const * path, FILINFO const * info) {
+    FIL file;
+    UINT br;
+    if (f_open(&file, path, FA_READ) != FR_OK) { return "f_open failed"; }
+
+    char const * result = NULL;
+    FSIZE_t const size = f_size(&file);
+    char const * name = strrchr(path, '/') + 1;
+    bool const isCurrent = (0 == strcmp(name, "CURRENT.UF2"));
+    bool const isBin = (0 == strcmp(name, "CURRENT.BIN"));
+
+    if (size != info->fsize) {
+        result = "file size differs from directory listing";
+    } else if (size <= FUZZ_MAX_READ) {
+        // whole cluster chain
+        if ((f_read(&file, fuzzFile, (UINT)size, &br) != FR_OK) || (br != size)) {
+            result = "file read failed";
+        }
+        fuzzFile[br] = 0;
+        if (!result && (0 == strcmp(name, "INFO_UF2.TXT")) && !strstr(fuzzFile, "\r\nModel: " UF2_PRODUCT_NAME "\r\n")) {
+            result = "INFO_UF2.TXT content";
+        }
+    } else {
+        // start, end and random sectors, seeking walks the cluster chain
+        for (uint32_t i = 0; (i < 6) && !result; i++) {
+            uint32_t const sectors = (uint32_t)((size + GHOSTFAT_SECTOR_SIZE - 1) / GHOSTFAT_SECTOR_SIZE);
+            uint32_t const sector = (i == 0) ? 0 : (i == 1) ? sectors - 1 : FuzzRandom(fz, sectors);
+            FSIZE_t const offset = (FSIZE_t)sector * GHOSTFAT_SECTOR_SIZE;
+            UINT const len = (size - offset < GHOSTFAT_SECTOR_SIZE) ? (UINT)(size - offset) : GHOSTFAT_SECTOR_SIZE;
+
+            if ((f_lseek(&file, offset) != FR_OK) || (f_read(&file, fuzzFile, len, &br) != FR_OK) || (br != len)) {
+                result = "file seek or read failed";
+                continue;
+            }
+
+            UF2_Block const * bl = (UF2_Block const *)fuzzFile;
+            if (isCurrent && ((bl->magicStart0 != UF2_MAGIC_START0) || (bl->magicStart1 != UF2_MAGIC_START1) ||
+                (bl->magicEnd != UF2_MAGIC_END) || (bl->blockNo != sector) || (bl->numBlocks != sectors))) {
+                result = "CURRENT.UF2 block out of place";
+            }
+
+            static uint8_t flashRef[GHOSTFAT_SECTOR_SIZE];
+            if (isBin) {
+                board_flash_read(BOARD_FLASH_APP_START + (uint32_t)offset, flashRef, len);
+                if (memcmp(fuzzFile, flashRef, len)) { result = "CURRENT.BIN differs from flash"; }
+            }
+        }
+    }
+
+    f_close(&file);
+    return result;
+}
+
+static char const * FuzzCheckDir(FuzzState * fz, char * path, uint32_t depth, uint32_t * files) {
+    DIR dir;
+    FILINFO info;
+    size_t const len = strlen(path);
+    char const * result = NULL;
+
+    if (f_opendir(&dir, path) != FR_OK) { return "f_opendir failed"; }
+
+    while (!result && (f_readdir(&dir, &info) == FR_OK) && info.fname[0]) {
+        if (len + 2 + strlen(info.fname) >= 256) { result = "path too long"; break; }
+        sprintf(path + len, "/%s", info.fname);
+
+        // by long and by short name
+        FILINFO found;
+        if ((f_stat(path, &found) != FR_OK) || (found.fsize != info.fsize)) {
+            result = "f_stat by name failed";
+        } else if (info.altname[0] && strcmp(info.altname, info.fname)) {
+            sprintf(path + len, "/%s", info.altname);
+            // FatFs reports the name looked up rather than the long name of an entry found by its short name
+            if ((f_stat(path, &found) != FR_OK) || (found.fsize != info.fsize) || (found.fattrib != info.fattrib)) {
+                result = "f_stat by short name failed";
+            }
+            sprintf(path + len, "/%s", info.fname);
+        }
+
+        if (result) {
+        } else if (info.fattrib & AM_DIR) {
+            result = (depth < 4) ? FuzzCheckDir(fz, path, depth + 1, files) : "directories nested too deep";
+        } else {
+            result = FuzzCheckFile(fz, path, &info);
+            (*files)++;
+        }
+        path[len] = 0;
+    }
+
+    f_closedir(&dir);
+    return result;
+}
+
+static char const * FuzzValidate(FuzzState * fz) {
+    if (f_mount(&fuzzFs, "", 1) != FR_OK) { return "f_mount failed"; }
+
+    char label[12];
+    char path[256] = "";
+    uint32_t files = 0;
+    char const * result = NULL;
+
+    // label ends in the last hex digits of the serial of board_usb_get_serial() in boards.c
+    char expected[12] = UF2_VOLUME_LABEL;
+#if CFG_UF2_VOLUME_LABEL_SUFFIX
+    static char const serial[] = "7CDFA1012345";
+    size_t const keep = (strlen(expected) < 11 - CFG_UF2_VOLUME_LABEL_SUFFIX) ? strlen(expected) : 11 - CFG_UF2_VOLUME_LABEL_SUFFIX;
+    strcpy(expected + keep, serial + sizeof(serial) - 1 - CFG_UF2_VOLUME_LABEL_SUFFIX);
+#endif
+
+    if ((f_getlabel("", label, NULL) != FR_OK) || strcasecmp(label, expected)) {
+        result = "volume label";
+    } else {
+        result = FuzzCheckDir(fz, path, 0, &files);
+        if (!result && !files) { result = "no files found"; }
+    }
+
+    f_mount(NULL, "", 0);
+    return result;
+}
+
+//------------- Seeds -------------//
+
+static char const * FuzzSeed(FuzzState * fz, uint32_t seed, uint32_t steps) {
+    memset(fz, 0, sizeof(*fz));
+    fz->rng = seed * 2654435761u + 1; // never 0
+
+    flash_sim_init(flash_sim_find_model("esp32"));
+    flash_sim_fill(FuzzRandom(fz, 2) ? 0xff : -1);
+#if !CFG_UF2_FLASH_CACHE
+    // odd seeds write like the espressif port with A/B slots
+    flash_sim_set_windowed(seed & 1);
+#endif
+    memset(&writeState, 0, sizeof(writeState));
+    uf2_init();
+
+    if (FindRegions(fz->regions)) { return "boot sector"; }
+    uint8_t * const bpb = singleSectorBuffer;
+    uf2_read_block(0, bpb);
+    fz->totalSectors = ReadU16(bpb + 0x13) ? ReadU16(bpb + 0x13) : ReadU32(bpb + 0x20);
+
+    char const * result = FuzzValidate(fz);
+
+    for (uint32_t step = 1; !result && (step <= steps); step++) {
+        fz->step = step;
+        uint32_t const op = FuzzRandom(fz, 100);
+        if (op < 35) {
+            result = FuzzRead(fz);
+        } else if (op < 65) {
+            result = FuzzWriteImage(fz);
+        } else if (op < 80) {
+            result = FuzzRewrite(fz);
+        } else if (op < 92) {
+            result = FuzzWriteOther(fz);
+        } else {
+            // TEST UNIT READY, may report a medium change
+            uf2_refresh();
+        }
+        // main loop between USB events
+        tuf2_sched_run();
+
+        if (!result) { result = FuzzValidate(fz); }
+    }
+
+    // host finishes the copy it started
+    while (!result && fz->image) { result = FuzzWriteImage(fz); }
+    if (!result) { result = FuzzValidate(fz); }
+
+    free(fz->image);
+    free(fz->chunks);
+    return result;
+}
+
+// --fuzz [--seeds count] [--first seed] [--jobs count] [--steps count]
+static int FuzzMain(int argc, char * argv[]) {
+    uint32_t seeds = 32;
+    uint32_t first = 1;
+    uint32_t steps = 200;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int i = 2; i < argc; i += 2) {
+        char const * option = argv[i];
+        char const * value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        uint32_t const n = value ? (uint32_t)strtoul(value, NULL, 0) : 0;
+
+        if (value && (0 == strcmp(option, "--seeds"))) {
+            seeds = n;
+        } else if (value && (0 == strcmp(option, "--first"))) {
+            first = n;
+        } else if (value && (0 == strcmp(option, "--steps"))) {
+            steps = n;
+        } else if (value && (0 == strcmp(option, "--jobs"))) {
+            jobs = n;
+        } else {
+            fprintf(stderr, "invalid option %s\n", option);
+            return ERR_INTERNAL_ERROR;
+        }
+    }
+    if (jobs < 1) { jobs = 1; }
+
+    pid_t * pids = calloc(jobs, sizeof(pid_t));
+    uint32_t * pidSeeds = calloc(jobs, sizeof(uint32_t));
+    if (!pids || !pidSeeds) { free(pids); free(pidSeeds); return ERR_INTERNAL_ERROR; }
+
+    uint32_t failed = 0;
+    uint32_t next = first;
+    long running = 0;
+
+    while ((next - first < seeds) || running) {
+        if ((next - first < seeds) && (running < jobs)) {
+            long slot = 0;
+            while (pids[slot]) { slot++; }
+
+            fflush(stdout);
+            pid_t const pid = fork();
+            if (pid < 0) { break; }
+            if (pid == 0) {
+                FuzzState fz;
+                char const * result = FuzzSeed(&fz, next, steps);
+                if (result) { printf("FAIL: seed %" PRIu32 " step %" PRIu32 ": %s\n", next, fz.step, result); }
+                fflush(stdout);
+                _exit(result ? 1 : 0);
+            }
+            pids[slot] = pid;
+            pidSeeds[slot] = next++;
+            running++;
+            continue;
+        }
+
+        int status;
+        pid_t const pid = wait(&status);
+        if (pid < 0) { break; }
+        for (long slot = 0; slot < jobs; slot++) {
+            if (pids[slot] != pid) { continue; }
+            if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+                if (WIFSIGNALED(status)) { printf("FAIL: seed %" PRIu32 " killed by signal %d\n", pidSeeds[slot], WTERMSIG(status)); }
+                failed++;
+            }
+            pids[slot] = 0;
+            running--;
+        }
+    }
+
+    free(pids);
+    free(pidSeeds);
+
+    // a failure is reproduced with --first seed --seeds 1
+    printf("fuzz: seeds %" PRIu32 "..%" PRIu32 ", %" PRIu32 " steps each, %" PRIu32 " failed\n",
+           first, next - 1, steps, failed);
+    return (failed || (next - first < seeds)) ? ERR_INTERNAL_ERROR : ERR_NONE;
+}
+
+int main(int argc, char * argv[])
 {
     int r;
 
+    // --bench: only CSV benchmark results on stdout, no image generation
+    if ((argc > 1) && (0 == strcmp(argv[1], "--bench"))) {
+        uf2_init();
+        r = BenchmarkReads();
+        if (r) { fprintf(stderr, "FAIL: (%d) %s\n", r, GetErrorString(r)); }
+        return r;
+    }
+
+    // --mk-digest / --check-digest [file]: region digests of the volume instead of the whole image file
+    char const * const digestFilename = (argc > 2) ? argv[2] : knownGoodDigestFilename;
+    if ((argc > 1) && (0 == strcmp(argv[1], "--mk-digest"))) {
+        uf2_init();
+        r = WriteDigests(digestFilename);
+        if (r) { goto errorExit; }
+        printf("PASS: %s written\n", digestFilename);
+        return ERR_NONE;
+    }
+    if ((argc > 1) && (0 == strcmp(argv[1], "--check-digest"))) {
+        printf("initializing UF2\n"); fflush(stdout);
+        uf2_init();
+
+        printf("comparing against known good region digests %s\n", digestFilename); fflush(stdout);
+        r = CompareDigests(digestFilename);
+        if (r) { goto errorExit; }
+
+        printf("PASS: Ghostfat generation validation completed successfully.\n");
+        return ERR_NONE;
+    }
+
+    // --fuzz: randomized reads and writes, FatFs checks the volume after each step
+    if ((argc > 1) && (0 == strcmp(argv[1], "--fuzz"))) {
+        r = FuzzMain(argc, argv);
+        if (r) { fprintf(stderr, "FAIL: (%d) %s\n", r, GetErrorString(r)); }
+        return r;
+    }
+
+    // --write: simulated flash write of an uf2 file, one CSV result line on stdout
+    if ((argc > 2) && (0 == strcmp(argv[1], "--write"))) {
+        uf2_init();
+        r = WriteMain(argc, argv);
+        if (r) { fprintf(stderr, "FAIL: (%d) %s\n", r, GetErrorString(r)); }
+        return r;
+    }
+
     printf("initializing UF2\n"); fflush(stdout);
     uf2_init();
 
@@ -0,0 +1,174 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "board_api.h"
+#include "uf2.h"
+
+#if CFG_UF2_ACCESS
+
+//--------------------------------------------------------------------+
+// MACRO TYPEDEF CONSTANT ENUM DECLARATION
+//--------------------------------------------------------------------+
+
+typedef struct {
+  uint32_t lba;
+  uint16_t count;
+  uint8_t write;
+  uint8_t region;   // of the first sector
+} access_cmd_t;
+
+// [0] sectors read, [1] written
+static uint32_t _region[TUF2_ACCESS_REGION_COUNT][2];
+static uint32_t _bucket[CFG_UF2_ACCESS_BUCKETS][2];
+
+static access_cmd_t _seq[CFG_UF2_ACCESS_SEQUENCE];
+static uint32_t _seq_count;
+
+static char const* const region_name[TUF2_ACCESS_REGION_COUNT] = {
+  "boot", "fat", "dir", "file", "current", "free", "outside"
+};
+
+// ACCESS.CSV has a fixed size: one line per region, per bucket and per sequence entry, unused
+// entries are blank. Fields are padded with spaces
+static char const accessHead[] = "kind,lba,sectors,reads,writes,region\n";
+
+// kind 7 chars, lba, sectors, reads and writes 10 digits right aligned, region 7 chars, commas and newline
+#define ACCESS_LINE_LEN  60
+
+#define ACCESS_LINES     (TUF2_ACCESS_REGION_COUNT + CFG_UF2_ACCESS_BUCKETS + CFG_UF2_ACCESS_SEQUENCE)
+
+//--------------------------------------------------------------------+
+//
+//--------------------------------------------------------------------+
+
+// sectors per bucket, the last one may be partial
+static uint32_t access_bucket_size(void) {
+  uint32_t const total = uf2_block_count();
+  return total ? (total + CFG_UF2_ACCESS_BUCKETS - 1) / CFG_UF2_ACCESS_BUCKETS : 1;
+}
+
+void tuf2_access_record(uint32_t lba, uint32_t count, bool write) {
+  if (count == 0) return;
+
+  if (_seq_count < CFG_UF2_ACCESS_SEQUENCE) {
+    access_cmd_t* cmd = &_seq[_seq_count++];
+    cmd->lba = lba;
+    cmd->count = (uint16_t) ((count > UINT16_MAX) ? UINT16_MAX : count);
+    cmd->write = write;
+    cmd->region = tuf2_access_region(lba);
+  }
+
+  // a command may span several regions and buckets
+  uint32_t const bucket_size = access_bucket_size();
+  for (uint32_t i = 0; i < count; i++) {
+    _region[tuf2_access_region(lba + i)][write]++;
+
+    uint32_t const bucket = (lba + i) / bucket_size;
+    if (bucket < CFG_UF2_ACCESS_BUCKETS) _bucket[bucket][write]++;
+  }
+}
+
+void tuf2_access_mount(void) {
+  _seq_count = 0;
+}
+
+// left aligned text field of len chars starting at pos
+static void access_text(char* line, uint32_t pos, uint32_t len, char const* text) {
+  uint32_t n = strlen(text);
+  if (n > len) n = len;
+  memcpy(line + pos, text, n);
+}
+
+// right aligned 10 digit field ending before end
+static void access_dec(char* end, uint32_t value) {
+  do {
+    *--end = (char) ('0' + value % 10);
+    value /= 10;
+  } while (value);
+}
+
+static void access_line(uint32_t n, char line[ACCESS_LINE_LEN]) {
+  memset(line, ' ', ACCESS_LINE_LEN - 1);
+  line[7] = line[18] = line[29] = line[40] = line[51] = ',';
+  line[ACCESS_LINE_LEN - 1] = '\n';
+
+  if (n < TUF2_ACCESS_REGION_COUNT) {
+    access_text(line, 0, 7, "region");
+    access_dec(line + 40, _region[n][0]);
+    access_dec(line + 51, _region[n][1]);
+    access_text(line, 52, 7, region_name[n]);
+    return;
+  }
+
+  n -= TUF2_ACCESS_REGION_COUNT;
+  if (n < CFG_UF2_ACCESS_BUCKETS) {
+    uint32_t const size = access_bucket_size();
+    access_text(line, 0, 7, "bucket");
+    access_dec(line + 18, n * size);
+    access_dec(line + 29, size);
+    access_dec(line + 40, _bucket[n][0]);
+    access_dec(line + 51, _bucket[n][1]);
+    return;
+  }
+
+  n -= CFG_UF2_ACCESS_BUCKETS;
+  if (n < _seq_count) {
+    access_cmd_t const* cmd = &_seq[n];
+    access_text(line, 0, 7, cmd->write ? "write" : "read");
+    access_dec(line + 18, cmd->lba);
+    access_dec(line + 29, cmd->count);
+    access_text(line, 52, 7, region_name[cmd->region]);
+  }
+}
+
+uint32_t tuf2_access_size(void) {
+  return sizeof(accessHead) - 1 + ACCESS_LINES * ACCESS_LINE_LEN;
+}
+
+void tuf2_access_read(uint32_t offset, void* dst, uint32_t len) {
+  uint8_t* out = dst;
+
+  for (uint32_t pos = offset; pos < offset + len; ) {
+    uint32_t n;
+    if (pos < sizeof(accessHead) - 1) {
+      n = sizeof(accessHead) - 1 - pos;
+      if (n > offset + len - pos) n = offset + len - pos;
+      memcpy(out, accessHead + pos, n);
+    } else {
+      char line[ACCESS_LINE_LEN];
+      uint32_t const line_ofs = (pos - (sizeof(accessHead) - 1)) % ACCESS_LINE_LEN;
+      access_line((pos - (sizeof(accessHead) - 1)) / ACCESS_LINE_LEN, line);
+
+      n = ACCESS_LINE_LEN - line_ofs;
+      if (n > offset + len - pos) n = offset + len - pos;
+      memcpy(out, line + line_ofs, n);
+    }
+    out += n;
+    pos += n;
+  }
+}
+
+#endif
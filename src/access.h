@@ -0,0 +1,94 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef TUF2_ACCESS_H_
+#define TUF2_ACCESS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Access profile of the firmware volume, to see which sectors a host OS reads at mount and during a
+// copy: sectors read and written per region and per LBA range of the volume, and the first READ10 /
+// WRITE10 commands since the host mounted it. Counted by msc, downloaded as ACCESS.CSV. Compiled out
+// unless CFG_UF2_ACCESS.
+//--------------------------------------------------------------------+
+
+#ifndef CFG_UF2_ACCESS
+#define CFG_UF2_ACCESS           0
+#endif
+
+// LBA ranges of equal size the volume is divided into
+#ifndef CFG_UF2_ACCESS_BUCKETS
+#define CFG_UF2_ACCESS_BUCKETS   64
+#endif
+
+// commands kept after mount, 8 bytes each
+#ifndef CFG_UF2_ACCESS_SEQUENCE
+#define CFG_UF2_ACCESS_SEQUENCE  256
+#endif
+
+// regions of a GhostFAT volume
+enum {
+  TUF2_ACCESS_BOOT = 0,       // boot sector and reserved sectors
+  TUF2_ACCESS_FAT,
+  TUF2_ACCESS_DIR,            // root directory and subdirectories with their files
+  TUF2_ACCESS_FILE,           // static and generated files except CURRENT.UF2
+  TUF2_ACCESS_CURRENT_UF2,
+  TUF2_ACCESS_FREE,           // clusters after the last file, where the host puts new ones
+  TUF2_ACCESS_OUTSIDE,        // past the end of the volume
+  TUF2_ACCESS_REGION_COUNT
+};
+
+#if CFG_UF2_ACCESS
+  // sectors [lba, lba+count) of the firmware volume read or taken by a write
+  void tuf2_access_record(uint32_t lba, uint32_t count, bool write);
+
+  // host mounted the volume again (USB mount, medium change), sequence starts over
+  void tuf2_access_mount(void);
+
+  #define TUF2_ACCESS_RECORD(_lba, _count, _write)  tuf2_access_record(_lba, _count, _write)
+  #define TUF2_ACCESS_MOUNT()                       tuf2_access_mount()
+#else
+  #define TUF2_ACCESS_RECORD(_lba, _count, _write)
+  #define TUF2_ACCESS_MOUNT()
+#endif
+
+// Region of a firmware volume sector, by ghostfat
+uint8_t tuf2_access_region(uint32_t lba);
+
+// ACCESS.CSV content, size is fixed
+uint32_t tuf2_access_size(void);
+void tuf2_access_read(uint32_t offset, void* dst, uint32_t len);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
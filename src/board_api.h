@@ -29,6 +29,15 @@
 #include <stdint.h>
 #include <string.h>
 #include "boards.h"
+#include "bootlog.h"
+#include "handoff.h"
+#include "stats.h"
+#include "trace.h"
+#include "access.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
 
 //--------------------------------------------------------------------+
 // Compiler
@@ -84,21 +93,48 @@
 #define TINYUF2_DBL_TAP_REG_SIZE  32
 #endif
 
+// Detect double tap by timestamp instead of waiting TINYUF2_DBL_TAP_DELAY on every boot: first reset
+// records board_dbl_tap_time() in TINYUF2_DBL_TAP_TIME_REG and jumps to application immediately
+#ifndef TINYUF2_DBL_TAP_TIMESTAMP
+#define TINYUF2_DBL_TAP_TIMESTAMP 0
+#endif
+
 // Use Display to draw DFU image
 #ifndef TINYUF2_DISPLAY
 #define TINYUF2_DISPLAY 0
 #endif
 
+// Number of display lines rendered and sent at once, two strips of this size are buffered
+#ifndef DISPLAY_STRIP_LINES
+#define DISPLAY_STRIP_LINES 4
+#endif
+
+// Minimum interval between redraws of the flashing progress bar
+#ifndef TINYUF2_DISPLAY_PROGRESS_MS
+#define TINYUF2_DISPLAY_PROGRESS_MS 250
+#endif
+
 // Write protection for bootloader
 #ifndef TINYUF2_PROTECT_BOOTLOADER
 #define TINYUF2_PROTECT_BOOTLOADER  0
 #endif
 
+// Expose raw board storage (e.g espressif ffat partition) as a second MSC LUN, see Data LUN API
+#ifndef TINYUF2_DATA_LUN
+#define TINYUF2_DATA_LUN 0
+#endif
+
 // Bootloader often has limited ROM than RAM and prefer to use RAM for data
 #ifndef TINYUF2_CONST
 #define TINYUF2_CONST
 #endif
 
+// Attribute of variables kept across resets (but not power up) e.g RTC memory, for CFG_UF2_RETAINED_CACHE.
+// Without it the cache is cleared on every boot
+#ifndef TINYUF2_RETAINED_ATTR
+#define TINYUF2_RETAINED_ATTR
+#endif
+
 // Use favicon.ico + autorun.inf (only works with windows)
 // define TINYUF2_FAVICON_HEADER to enable this feature
 
@@ -123,6 +159,14 @@ extern DBL_TAP_TYPE _board_dfu_dbl_tap[];
 #define TINYUF2_DBL_TAP_REG   _board_dfu_dbl_tap[0]
 #endif
 
+#if TINYUF2_DBL_TAP_TIMESTAMP && !defined(TINYUF2_DBL_TAP_TIME_REG)
+  #if TINYUF2_DBL_TAP_REG_SIZE != 32
+  #error "TINYUF2_DBL_TAP_TIMESTAMP needs 32-bit TINYUF2_DBL_TAP_REG_SIZE or TINYUF2_DBL_TAP_TIME_REG"
+  #endif
+// next to TINYUF2_DBL_TAP_REG, must be retained across reset as well
+#define TINYUF2_DBL_TAP_TIME_REG  _board_dfu_dbl_tap[1]
+#endif
+
 #define DBL_TAP_MAGIC            (0xf01669ef >> (32 - TINYUF2_DBL_TAP_REG_SIZE)) // Enter DFU magic
 #define DBL_TAP_MAGIC_QUICK_BOOT (0xf02669ef >> (32 - TINYUF2_DBL_TAP_REG_SIZE)) // Skip double tap delay detection
 #define DBL_TAP_MAGIC_ERASE_APP  (0xf5e80ab4 >> (32 - TINYUF2_DBL_TAP_REG_SIZE)) // Erase entire application !!
@@ -155,6 +199,10 @@ void board_reset(void);
 // Write PWM duty value to LED
 void board_led_write(uint32_t value);
 
+// Optional: breathe LED in hardware, ramp_ms for each fade up or down, 0 stops fading.
+// Return false if not supported, the indicator then fades with board_timer_handler()
+bool board_led_fade(uint32_t ramp_ms) __attribute__ ((weak));
+
 // Write color to rgb strip
 void board_rgb_write(uint8_t const rgb[]);
 
@@ -173,6 +221,44 @@ void board_timer_stop(void);
 // timer event handler, must be called by port/board
 extern void board_timer_handler(void);
 
+// Milliseconds since boot, optional. Used by CFG_UF2_IDLE_COMPLETE_MS
+uint32_t board_millis(void) __attribute__ ((weak));
+
+// Microseconds since boot, optional. Used for the times in STATS.TXT (CFG_UF2_STATS)
+uint32_t board_micros(void) __attribute__ ((weak));
+
+// Supply voltage in millivolts (VBUS, or the rail the board measures), optional. 0 if unknown right now.
+// Polled by the flash write path of a port to throttle erase & program while the supply sags
+uint32_t board_supply_mv(void) __attribute__ ((weak));
+
+// Heap size and the most of it ever in use since boot, optional. Shown in STATS.TXT (CFG_UF2_STATS)
+void board_heap_info(uint32_t* size, uint32_t* used_max) __attribute__ ((weak));
+
+// CPU time and least free stack of the TUF2_STATS_TASK_* tasks (stats.h), optional. Shown in STATS.TXT,
+// entries the port does not know are left unchanged
+void board_task_info(uint32_t run_ms[TUF2_STATS_TASK_COUNT], uint32_t stack_free[TUF2_STATS_TASK_COUNT]) __attribute__ ((weak));
+
+// Record boot stage (BOOTLOG_* in bootlog.h) with current time in the boot log, optional
+void board_bootlog_mark(uint32_t stage) __attribute__ ((weak));
+
+// Set a timing marker for a logic analyzer with CFG_UF2_PERF_MARKER, optional. id is a TUF2_TRACE_* event
+// (on at begin, off at end) or a TUF2_MARKER_* id, see trace.h. Should be a single GPIO register write
+void board_perf_marker(uint32_t id, bool on) __attribute__ ((weak));
+
+// Boot stage in the boot log and as a marker pulse
+#define TUF2_BOOT_STAGE(_stage) \
+  do { if (board_bootlog_mark) board_bootlog_mark(_stage); TUF2_MARKER_PULSE(TUF2_MARKER_STAGE + (_stage)); } while (0)
+
+// Boot log of the current boot, optional. NULL if not available
+bootlog_t const* board_bootlog(void) __attribute__ ((weak));
+
+// Handoff block left by application before resetting into UF2 (see handoff.h), NULL if there is none.
+// Consumed on first call, later calls return the same block. Optional
+uf2_handoff_t const* board_handoff(void) __attribute__ ((weak));
+
+// Milliseconds from a clock that keeps running across reset (e.g RTC), required by TINYUF2_DBL_TAP_TIMESTAMP
+uint32_t board_dbl_tap_time(void);
+
 // Check if application is valid
 bool board_app_valid(void);
 
@@ -194,6 +280,12 @@ void board_dfu_complete(void);
 // Fill Serial Number and return its length (limit to 16 bytes)
 uint8_t board_usb_get_serial(uint8_t serial_id[16]);
 
+// Device serial number of INFO_UF2.TXT kept write-once by the board, e.g in an eFuse user block. Read returns
+// false if none is stored, NVS is looked up then. Write stores it where nothing is stored yet, returns false
+// otherwise. Optional, NVS only without them
+bool board_serial_read(uint8_t serial[6]) __attribute__ ((weak));
+bool board_serial_write(uint8_t const serial[6]) __attribute__ ((weak));
+
 // Check if NRST pin is used to reset the board
 // bool board_reseted_by_nrst(void);
 
@@ -207,33 +299,212 @@ void board_flash_init(void);
 // Get size of flash
 uint32_t board_flash_size(void);
 
+// Get size of application image in flash, CURRENT.UF2 is limited to it. Return 0 if unknown, optional
+uint32_t board_flash_app_size(void) __attribute__ ((weak));
+
+// Get SHA256 of the application image from a record kept by the port (not hashed on each call), for INFO.JSON.
+// Return false if not known, optional
+bool board_flash_app_sha256(uint8_t sha256[32]) __attribute__ ((weak));
+
 // Read from flash
 void board_flash_read (uint32_t addr, void* buffer, uint32_t len);
 
+// Raw flash chip from address 0 for FLASH.BIN with CFG_UF2_FLASH_BIN, optional. Outside of any partition,
+// reads what is on the chip without pending writes
+uint32_t board_flash_chip_size(void) __attribute__ ((weak));
+void board_flash_chip_read(uint32_t addr, void* buffer, uint32_t len) __attribute__ ((weak));
+void board_flash_chip_read_ahead(uint32_t addr, uint32_t len) __attribute__ ((weak));
+
 // read from ota1 partition
 void board_measuremnt_data_read(uint32_t addr, void* buffer, uint32_t len);
 
+// Get size of ota1 partition
+uint32_t board_measuremnt_data_size(void);
+
+// Measurement data partitions, partition 0 is the one of board_measuremnt_data_read(). Optional,
+// others are exposed as raw files with CFG_UF2_MEASUREMENT_PARTITIONS > 1
+uint32_t board_measurement_partition_count(void) __attribute__ ((weak));
+uint32_t board_measurement_partition_size(uint32_t part) __attribute__ ((weak));
+void board_measurement_partition_read(uint32_t part, uint32_t addr, void* buffer, uint32_t len) __attribute__ ((weak));
+
+// Start erasing all measurement partitions in the background, from their end so that what is left
+// is always a valid shorter log. Return false if not possible. Optional, see Erase_Block
+bool board_measurement_erase(void) __attribute__ ((weak));
+bool board_measurement_erase_busy(void) __attribute__ ((weak));
+
+// Hint that flash region is likely to be read next (host reading sequentially).
+// Port can prefetch it in the background, optional
+void board_flash_read_ahead(uint32_t addr, uint32_t len) __attribute__ ((weak));
+void board_measuremnt_data_read_ahead(uint32_t addr, uint32_t len) __attribute__ ((weak));
+
+// Host issued a READ10, of any LUN. Port can keep background erase & program in short steps for a while
+// so that reads wait less for them, optional
+void board_flash_read_hint(void) __attribute__ ((weak));
+
+// Restore the app kept by the last-known-good snapshot (CFG_UF2_LKG_SNAPSHOT) and make it bootable.
+// Returns false, leaving the app as it is, if there is no snapshot or it does not check out
+bool board_flash_rollback(void) __attribute__ ((weak));
+
 // Write to flash, len is uf2's payload size (often 256 bytes)
 bool board_flash_write(uint32_t addr, void const* data, uint32_t len);
 
+// Return true if write to addr cannot be accepted right now (e.g previous data is still being flushed
+// in the background). uf2_write_block() then reports busy and is called again later, optional
+bool board_flash_write_busy(uint32_t addr) __attribute__ ((weak));
+
+// Block for a short while until flushing makes progress, called before a write reports busy. Lets the
+// caller run at a higher priority than the flash work without polling it, optional
+void board_flash_write_wait(void) __attribute__ ((weak));
+
+// Hint that [addr, addr+len) is about to be entirely overwritten by subsequent writes (remainder of uf2 image).
+// Port may erase it ahead in the background, optional
+void board_flash_erase_ahead(uint32_t addr, uint32_t len) __attribute__ ((weak));
+
+// Check the first uf2 block (blockNo 0) of an image before anything is erased, e.g image header and target chip.
+// Return false to reject the whole image, optional
+bool board_flash_check_image(uint32_t addr, uint8_t const* data, uint32_t len) __attribute__ ((weak));
+
+// Called with the first uf2 block (blockNo 0) of an image. Return the address below which flash already
+// holds this image from an earlier interrupted download, writes there are skipped. Optional
+uint32_t board_flash_resume(uint8_t const* data, uint32_t len, uint32_t num_blocks) __attribute__ ((weak));
+
+// Host went away (unmount, suspend) possibly in the middle of an image: program what was received
+// completely within a bounded time and record it for board_flash_resume(). Optional
+void board_flash_detach(void) __attribute__ ((weak));
+
+// crc32 (zlib polynomial, initial value 0) of flash contents in [addr, addr+len), needed for delta updates. Optional
+uint32_t board_flash_crc32(uint32_t addr, uint32_t len) __attribute__ ((weak));
+
+// crc32 (zlib polynomial, crc of the preceding data or 0) of a RAM buffer by ROM or hardware. Optional, else computed in software
+uint32_t board_crc32(uint32_t crc, void const* buf, uint32_t len) __attribute__ ((weak));
+
+// Return true if MD5 of flash contents in [addr, addr+len) equals md5, used by UF2_FLAG_MD5 blocks. Optional
+bool board_flash_md5_match(uint32_t addr, uint32_t len, uint8_t const md5[16]) __attribute__ ((weak));
+
+// Return true if SHA256 of flash contents in [addr, addr+len) equals sha256, used by Verify_Block. Optional
+bool board_flash_sha256_match(uint32_t addr, uint32_t len, uint8_t const sha256[32]) __attribute__ ((weak));
+
+// Write uf2 block of a family other than BOARD_UF2_FAMILY_ID, addr is relative to the partition of that family.
+// Return false if family is unknown or write failed. Optional, flushed by board_flash_flush()
+bool board_flash_write_family(uint32_t family_id, uint32_t addr, void const* data, uint32_t len) __attribute__ ((weak));
+
 // Flush/Sync flash contents
 void board_flash_flush(void);
 
+// Verify flash contents of everything written since last verify, called once after the final flush.
+// Return false if flash does not match written data, optional
+bool board_flash_verify(void) __attribute__ ((weak));
+
+// Signature of the image being written (Sign_Block), board_flash_verify() fails unless it matches.
+// Optional, ports that check signatures hash the image while it is flushed
+void board_flash_signature(uint32_t len, uint8_t const signature[64]) __attribute__ ((weak));
+
 // Erase application
 void board_flash_erase_app(void);
 
+typedef struct {
+  uint32_t len;           // bytes erased, programmed and read
+  uint32_t erase_us;
+  uint32_t program_us;
+  uint32_t read_us;
+} board_flash_bench_t;
+
+// Number of erase units tracked for WEAR.CSV (CFG_UF2_WEAR) and their size in bytes. Must not need
+// the counters themselves, called by uf2_init(). Optional
+uint32_t board_flash_wear_units(uint32_t* unit_size) __attribute__ ((weak));
+
+// Times erase unit has been erased over the life of the device, saturating. Optional
+uint32_t board_flash_wear_read(uint32_t unit) __attribute__ ((weak));
+
+// Measure raw erase, program and read time of a flash region the application does not use (e.g past
+// its image), the region is left erased. Return false if there is no such region, optional
+bool board_flash_benchmark(board_flash_bench_t* result) __attribute__ ((weak));
+
 // Protect bootloader in flash
 bool board_flash_protect_bootloader(bool protect);
 
+//--------------------------------------------------------------------+
+// Flash geometry and raw primitives
+// Needed by the shared write-back cache (CFG_UF2_FLASH_CACHE, see flash_cache.h), which then
+// implements board_flash_write(), board_flash_flush() and board_flash_erase_ahead() for the port
+//--------------------------------------------------------------------+
+
+typedef struct {
+  uint32_t erase_size;    // smallest (uniform) erase unit e.g 4KB sector, power of 2
+  uint32_t block_size;    // larger erase unit used for erase ahead e.g 64KB block, 0 if there is none
+  uint32_t program_size;  // program granularity e.g 256 byte page, power of 2
+  uint8_t  erased_value;  // content of erased flash, typically 0xff
+  bool     xip;           // memory mapped, board_flash_read() is as cheap as memcpy()
+} board_flash_geometry_t;
+
+// Flash geometry, constant
+board_flash_geometry_t const* board_flash_geometry(void);
+
+// Erase [addr, addr+len), aligned to erase_size or block_size (if len is block_size)
+bool board_flash_erase_raw(uint32_t addr, uint32_t len);
+
+// Program [addr, addr+len) of erased flash, aligned to program_size
+bool board_flash_program(uint32_t addr, void const* data, uint32_t len);
+
+// Non-blocking variants for CFG_UF2_FLASH_CACHE_ASYNC: start erasing one erase_size unit (or block_size block if
+// len is block_size), or programming one program_size page of erased flash. Data is taken before returning.
+// Only one operation is in progress at a time
+bool board_flash_erase_start(uint32_t addr, uint32_t len);
+bool board_flash_program_start(uint32_t addr, void const* data);
+
+// Return true while the operation started last is in progress, does what the port needs once it is done
+// (e.g invalidate caches) the first time it returns false
+bool board_flash_busy(void);
+
+//--------------------------------------------------------------------+
+// Data LUN API
+//--------------------------------------------------------------------+
+
+#if TINYUF2_DATA_LUN
+// Number of 512-byte blocks of data storage, 0 if not present (LUN is then not reported)
+uint32_t board_data_lun_block_count(void);
+
+// Read/write count blocks starting at lba, writes may be cached until board_data_lun_flush()
+bool board_data_lun_read(uint32_t lba, void* buffer, uint32_t count);
+bool board_data_lun_write(uint32_t lba, void const* buffer, uint32_t count);
+
+// Commit cached writes to storage, called when a host write command completes
+void board_data_lun_flush(void);
+
+// Host no longer needs count blocks starting at lba (SCSI UNMAP). Whole flash sectors among them are
+// erased in the background so that later writes skip the erase. Optional, return false if out of range
+bool board_data_lun_unmap(uint32_t lba, uint32_t count) __attribute__ ((weak));
+#endif
+
 //--------------------------------------------------------------------+
 // Display API
 //--------------------------------------------------------------------+
 
+// Optional small status display of the board, e.g an SSD1306 OLED. state is a STATE_* on every indicator
+// change, progress of the uf2 transfer in blocks comes from the write path. Both must return quickly,
+// drawing is up to a task of the board
+void board_status_state(uint32_t state) __attribute__ ((weak));
+void board_status_progress(uint32_t written, uint32_t total) __attribute__ ((weak));
+
 #if TINYUF2_DISPLAY
 void board_display_init(void);
 void board_display_draw_line(int y, uint16_t* pixel_color, uint32_t pixel_num);
 
+// Optional: start sending count lines of DISPLAY_HEIGHT pixels from y without waiting,
+// pixel_color must stay untouched until board_display_wait() returns
+void board_display_draw_lines_async(int y, uint16_t* pixel_color, uint32_t count) __attribute__ ((weak));
+void board_display_wait(void) __attribute__ ((weak));
+
+// Optional: draw pixel_num pixels of line y starting at pixel offset, used for partial updates
+void board_display_draw_line_window(int y, uint32_t offset, uint16_t* pixel_color, uint32_t pixel_num) __attribute__ ((weak));
+
 void screen_draw_drag(void);
+
+// Progress of the current uf2 transfer (uf2 blocks), cheap to call on the write path
+void screen_set_progress(uint32_t written, uint32_t total);
+
+// Redraw progress bar if changed, rate limited to TINYUF2_DISPLAY_PROGRESS_MS. Call from idle context
+void screen_task(void);
 #endif
 
 // perform self-update on bootloader
@@ -260,6 +531,12 @@ void board_self_update(const uint8_t * bootloader_bin, uint32_t bootloader_len);
 
 #include <stdio.h>
 
+// format later from the main loop instead of at the log site, see log_deferred.h
+#if CFG_UF2_LOG_DEFERRED
+#include "log_deferred.h"
+#define tuf2_printf(...)  TUF2_LOG_DEFER(__VA_ARGS__)
+#endif
+
 #ifndef tuf2_printf
 #define tuf2_printf printf
 #endif
@@ -369,4 +646,8 @@ static inline void rgb_brightness(uint8_t out[3], uint8_t const in[3], uint8_t b
 #define TFT_MADCTL_RGB 0x00  ///< Red-Green-Blue pixel order
 #define TFT_MADCTL_BGR 0x08  ///< Blue-Green-Red pixel order
 
+#ifdef __cplusplus
+ }
+#endif
+
 #endif
@@ -0,0 +1,77 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef TUF2_BOOTIMAGE_H_
+#define TUF2_BOOTIMAGE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Trusted app image, recorded by tinyuf2 in the espressif reserved RTC memory after the screen record
+// once it has verified the image in full (the validity record of BOARD_APP_CHECK). The 2nd stage
+// bootloader then loads that image without its checksum & sha256 pass, as long as the header is still
+// one with appended sha256 and the last 32 bytes at offset + len are that digest. Any other image,
+// secure boot or power up (RTC memory lost) are validated as before.
+//--------------------------------------------------------------------+
+
+#define BOOTIMAGE_MAGIC    0x4D495442UL // "BTIM"
+
+// offset in the espressif reserved RTC memory, after the screen record (bootscreen.h)
+#define BOOTIMAGE_OFFSET   192
+
+typedef struct {
+  uint32_t check;          // bootimage_check()
+  uint32_t offset;         // of the app partition in flash
+  uint32_t len;            // image length including the appended sha256
+  uint8_t  sha256[32];     // appended digest of the image
+} bootimage_t;
+
+// rotate-xor of all words after check, seeded with the magic
+static inline uint32_t bootimage_check(bootimage_t const* bi) {
+  uint32_t const* word = (uint32_t const*) bi;
+  uint32_t sum = BOOTIMAGE_MAGIC;
+  for ( uint32_t i = 1; i < sizeof(bootimage_t) / 4; i++ ) {
+    sum = ((sum << 5) | (sum >> 27)) ^ word[i];
+  }
+  return sum;
+}
+
+static inline void bootimage_seal(bootimage_t* bi) {
+  bi->check = bootimage_check(bi);
+}
+
+static inline bool bootimage_valid(bootimage_t const* bi) {
+  return bi->len >= sizeof(bi->sha256) && bi->check == bootimage_check(bi);
+}
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
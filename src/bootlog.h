@@ -0,0 +1,86 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef TUF2_BOOTLOG_H_
+#define TUF2_BOOTLOG_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Boot stage timestamps, shared by the 2nd stage bootloader and tinyuf2 through memory retained
+// across the jump (e.g RTC). The bootloader starts a new log on every boot, entries that do not fit
+// overwrite the oldest ones. Rendered as BOOTLOG.TXT with CFG_UF2_BOOTLOG.
+//--------------------------------------------------------------------+
+
+#define BOOTLOG_MAGIC    0x474C5442UL // "BTLG"
+// one boot records at most BOOTLOG_STAGE_COUNT - 1 stages, the partition cache follows (bootpart.h)
+#define BOOTLOG_ENTRIES  11
+
+enum {
+  BOOTLOG_BL_INIT = 1,        // bootloader hardware init done
+  BOOTLOG_BL_PARTITION_TABLE, // partition table loaded
+  BOOTLOG_BL_SELECT,          // boot partition selected (including UF2 detection)
+  BOOTLOG_MAIN,               // tinyuf2 main() entered
+  BOOTLOG_BOARD_INIT,         // board_init() done
+  BOOTLOG_DFU_CHECK,          // check_dfu_mode() decided to stay in DFU
+  BOOTLOG_FLASH_INIT,         // board_flash_init() done
+  BOOTLOG_UF2_INIT,           // uf2_init() done
+  BOOTLOG_TUD_INIT,           // tud_init() done
+  BOOTLOG_MOUNT,              // device configured by host
+  BOOTLOG_FIRST_READ,         // first READ10 of a GhostFAT volume
+  BOOTLOG_STAGE_COUNT
+};
+
+typedef struct {
+  uint32_t magic;
+  uint32_t count; // entries recorded this boot, the last BOOTLOG_ENTRIES of them are kept
+  struct {
+    uint32_t stage;
+    uint32_t us;  // clock depends on who recorded it, see board_bootlog_mark()
+  } entry[BOOTLOG_ENTRIES];
+} bootlog_t;
+
+static inline void bootlog_reset(bootlog_t* log) {
+  log->magic = BOOTLOG_MAGIC;
+  log->count = 0;
+}
+
+static inline void bootlog_add(bootlog_t* log, uint32_t stage, uint32_t us) {
+  if (log->magic != BOOTLOG_MAGIC) bootlog_reset(log);
+
+  uint32_t const i = log->count % BOOTLOG_ENTRIES;
+  log->entry[i].stage = stage;
+  log->entry[i].us = us;
+  log->count++;
+}
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#ifndef TUF2_BOOTPART_H_
+#define TUF2_BOOTPART_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Partition table positions cached by the espressif 2nd stage bootloader in the reserved RTC memory,
+// between the boot log and the handoff block. A warm boot reads the 32 byte MD5 entry of the table
+// instead of loading, verifying and logging the whole table; the cache is only used while that entry
+// still holds the same digest. Power up (RTC memory lost), a table without MD5 entry, secure boot,
+// a test partition or more than BOOTPART_OTA_SLOTS ota slots load the table as before.
+// The otadata selection is not cached, applications change it without a reset.
+//--------------------------------------------------------------------+
+
+#define BOOTPART_MAGIC      0x54504642UL // "BFPT"
+
+// offset in the espressif reserved RTC memory, after the boot log
+#define BOOTPART_OFFSET     96
+
+#define BOOTPART_OTA_SLOTS  2
+
+enum {
+  BOOTPART_OTA_INFO = 0,
+  BOOTPART_FACTORY,
+  BOOTPART_OTA_0,
+  BOOTPART_COUNT = BOOTPART_OTA_0 + BOOTPART_OTA_SLOTS
+};
+
+typedef struct {
+  uint32_t check;             // bootpart_check()
+  uint16_t md5_offset;        // of the MD5 entry within the partition table
+  uint8_t  app_count;         // ota slots
+  uint8_t  reserved;
+  uint8_t  md5[8];            // leading bytes of the digest in the MD5 entry
+  struct {
+    uint16_t offset;          // 4KB units, 0 if absent
+    uint16_t size;
+  } part[BOOTPART_COUNT];
+} bootpart_t;
+
+// rotate-xor of all words after check, seeded with the magic
+static inline uint32_t bootpart_check(bootpart_t const* bp) {
+  uint32_t const* word = (uint32_t const*) bp;
+  uint32_t sum = BOOTPART_MAGIC;
+  for ( uint32_t i = 1; i < sizeof(bootpart_t) / 4; i++ ) {
+    sum = ((sum << 5) | (sum >> 27)) ^ word[i];
+  }
+  return sum;
+}
+
+static inline void bootpart_seal(bootpart_t* bp) {
+  bp->check = bootpart_check(bp);
+}
+
+static inline bool bootpart_valid(bootpart_t const* bp) {
+  return bp->check == bootpart_check(bp);
+}
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef TUF2_BOOTSCREEN_H_
+#define TUF2_BOOTSCREEN_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Hash of the screen tinyuf2 left on a panel that keeps its image without power (e-paper), in the
+// espressif reserved RTC memory after the handoff block. The next DFU entry skips the full refresh if
+// it would draw the same screen. The 2nd stage bootloader clears the record whenever it boots an
+// application, which may draw on the panel itself; power up (RTC memory lost) clears it as well.
+//--------------------------------------------------------------------+
+
+#define BOOTSCREEN_MAGIC   0x4E524353UL // "SCRN"
+
+// offset in the espressif reserved RTC memory, after the handoff block (handoff.h)
+#define BOOTSCREEN_OFFSET  184
+
+typedef struct {
+  uint32_t hash;    // crc32 of the frame that is on the panel
+  uint32_t check;   // hash ^ BOOTSCREEN_MAGIC
+} bootscreen_t;
+
+static inline bool bootscreen_valid(bootscreen_t const* s) {
+  return s->check == (s->hash ^ BOOTSCREEN_MAGIC);
+}
+
+static inline void bootscreen_set(bootscreen_t* s, uint32_t hash) {
+  s->hash = hash;
+  s->check = hash ^ BOOTSCREEN_MAGIC;
+}
+
+static inline void bootscreen_clear(bootscreen_t* s) {
+  s->hash = 0;
+  s->check = 0;
+}
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
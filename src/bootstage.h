@@ -0,0 +1,82 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef TUF2_BOOTSTAGE_H_
+#define TUF2_BOOTSTAGE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Staged tinyuf2 of a bundle (BOARD_UF2_STAGE_FAMILY), recorded by tinyuf2 in the espressif reserved
+// RTC memory after the trusted image record once app and data are verified, followed by a reset.
+// tinyuf2 can not rewrite the factory partition it runs from, the 2nd stage bootloader copies the
+// sectors that differ from src to dst before it selects the app, then clears the record. A reset
+// during the copy starts it over, power loss leaves the app bootable and its done part in place.
+//--------------------------------------------------------------------+
+
+#define BOOTSTAGE_MAGIC    0x47545342UL // "BSTG"
+
+// offset in the espressif reserved RTC memory, after the trusted image record (bootimage.h)
+#define BOOTSTAGE_OFFSET   236
+
+typedef struct {
+  uint32_t check;          // bootstage_check()
+  uint32_t src;            // flash address of the staged image, 4KB aligned
+  uint32_t dst;            // flash address of the factory partition, 4KB aligned
+  uint32_t len;            // bytes to copy, multiple of 4KB
+} bootstage_t;
+
+// rotate-xor of all words after check, seeded with the magic
+static inline uint32_t bootstage_check(bootstage_t const* bs) {
+  uint32_t const* word = (uint32_t const*) bs;
+  uint32_t sum = BOOTSTAGE_MAGIC;
+  for ( uint32_t i = 1; i < sizeof(bootstage_t) / 4; i++ ) {
+    sum = ((sum << 5) | (sum >> 27)) ^ word[i];
+  }
+  return sum;
+}
+
+static inline void bootstage_seal(bootstage_t* bs) {
+  bs->check = bootstage_check(bs);
+}
+
+static inline bool bootstage_valid(bootstage_t const* bs) {
+  return bs->len && !((bs->src | bs->dst | bs->len) & 0xFFFUL) && bs->check == bootstage_check(bs);
+}
+
+static inline void bootstage_clear(bootstage_t* bs) {
+  bs->check = 0;
+  bs->len = 0;
+}
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
@@ -0,0 +1,223 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "compress.h"
+
+#if CFG_UF2_LKG_SNAPSHOT
+
+#if !CFG_UF2_HEATSHRINK
+  #error "CFG_UF2_LKG_SNAPSHOT needs CFG_UF2_HEATSHRINK"
+#endif
+
+//--------------------------------------------------------------------+
+// MACRO TYPEDEF CONSTANT ENUM DECLARATION
+//--------------------------------------------------------------------+
+
+#define WINDOW_SIZE   (1UL << CFG_UF2_HEATSHRINK_WINDOW_BITS)
+#define WINDOW_MASK   (WINDOW_SIZE - 1)
+#define BUF_SIZE      (2 * WINDOW_SIZE)
+#define HASH_BITS     10
+
+// a back-reference is shorter than two literals
+#define MIN_MATCH     2
+#define MAX_MATCH     (1UL << CFG_UF2_HEATSHRINK_LOOKAHEAD_BITS)
+
+// candidates compared per position, same as tools/uf2compress.py
+#define MAX_CHAIN     16
+
+#define OUT_SIZE      64
+
+_Static_assert(1 + CFG_UF2_HEATSHRINK_WINDOW_BITS + CFG_UF2_HEATSHRINK_LOOKAHEAD_BITS < 2 * 9,
+               "back-reference of MIN_MATCH bytes must be shorter than its literals");
+_Static_assert(BUF_SIZE - MAX_MATCH >= WINDOW_SIZE, "window slides by WINDOW_SIZE");
+_Static_assert(BUF_SIZE <= 0xFFFF, "positions are stored in 16 bit");
+
+// History and not yet encoded input: [0, _pos) is history, [_pos, _end) lookahead
+static uint8_t _buf[BUF_SIZE];
+static uint32_t _pos;
+static uint32_t _end;
+
+// position + 1 of the most recent 2 bytes with each hash, 0 for none
+static uint16_t _head[1UL << HASH_BITS];
+
+// position + 1 of the previous 2 bytes with the same hash, by position & WINDOW_MASK
+static uint16_t _prev[WINDOW_SIZE];
+
+// output bits not yet complete to a byte, right aligned
+static uint32_t _bits;
+static uint8_t _bit_count;
+
+static uint8_t _out[OUT_SIZE];
+static uint32_t _out_len;
+static compress_output_cb_t _output;
+static void* _arg;
+
+//--------------------------------------------------------------------+
+//
+//--------------------------------------------------------------------+
+
+static void out_flush(void) {
+  if ( _out_len ) _output(_out, _out_len, _arg);
+  _out_len = 0;
+}
+
+// n <= 16 bits, first bit of the stream is the most significant one
+static void put_bits(uint32_t value, uint8_t n) {
+  _bits = (_bits << n) | value;
+  _bit_count += n;
+
+  while ( _bit_count >= 8 ) {
+    _bit_count -= 8;
+    _out[_out_len++] = (uint8_t) (_bits >> _bit_count);
+    if ( _out_len == OUT_SIZE ) out_flush();
+  }
+  _bits &= (1UL << _bit_count) - 1;
+}
+
+static uint32_t hash(uint32_t p) {
+  uint32_t const v = ((uint32_t) _buf[p] << 8) | _buf[p + 1];
+  return ((uint32_t) (v * 2654435761UL)) >> (32 - HASH_BITS);
+}
+
+static void insert(uint32_t p) {
+  uint32_t const h = hash(p);
+  _prev[p & WINDOW_MASK] = _head[h];
+  _head[h] = (uint16_t) (p + 1);
+}
+
+// longest match for the bytes at _pos within the window, return its length (0 if below MIN_MATCH)
+static uint32_t find_match(uint32_t* offset) {
+  uint32_t const avail = _end - _pos;
+  if ( avail < MIN_MATCH ) return 0;
+
+  uint32_t const max = (avail < MAX_MATCH) ? avail : MAX_MATCH;
+  uint32_t best = 0;
+  uint32_t cand = _head[hash(_pos)];
+
+  // stale entries of the chain may point anywhere before _pos, bytes are always compared
+  for ( uint32_t chain = 0; cand && chain < MAX_CHAIN; chain++ ) {
+    uint32_t const p = cand - 1;
+    if ( p >= _pos || _pos - p > WINDOW_SIZE ) break;
+
+    uint32_t len = 0;
+    while ( len < max && _buf[p + len] == _buf[_pos + len] ) len++;
+
+    if ( len > best ) {
+      best = len;
+      *offset = _pos - p;
+      if ( len == max ) break;
+    }
+
+    cand = _prev[p & WINDOW_MASK];
+  }
+
+  return (best >= MIN_MATCH) ? best : 0;
+}
+
+// Encode input while a longest match can be found, or all of it for flush
+static void encode(bool flush) {
+  while ( _end - _pos >= (flush ? 1 : MAX_MATCH) ) {
+    uint32_t offset = 0;
+    uint32_t n = find_match(&offset);
+
+    if ( n ) {
+      put_bits(0, 1);
+      put_bits(offset - 1, CFG_UF2_HEATSHRINK_WINDOW_BITS);
+      put_bits(n - 1, CFG_UF2_HEATSHRINK_LOOKAHEAD_BITS);
+    } else {
+      put_bits(0x100 | _buf[_pos], 9);
+      n = 1;
+    }
+
+    for ( ; n; n-- ) {
+      if ( _pos + MIN_MATCH <= _end ) insert(_pos);
+      _pos++;
+    }
+  }
+}
+
+// Drop the oldest WINDOW_SIZE bytes, a multiple of the window keeps _prev slots in place
+static void slide(void) {
+  memmove(_buf, _buf + WINDOW_SIZE, _end - WINDOW_SIZE);
+  _pos -= WINDOW_SIZE;
+  _end -= WINDOW_SIZE;
+
+  for ( uint32_t i = 0; i < (1UL << HASH_BITS); i++ ) {
+    _head[i] = (_head[i] > WINDOW_SIZE) ? (uint16_t) (_head[i] - WINDOW_SIZE) : 0;
+  }
+  for ( uint32_t i = 0; i < WINDOW_SIZE; i++ ) {
+    _prev[i] = (_prev[i] > WINDOW_SIZE) ? (uint16_t) (_prev[i] - WINDOW_SIZE) : 0;
+  }
+}
+
+//--------------------------------------------------------------------+
+// API
+//--------------------------------------------------------------------+
+
+void compress_init(void) {
+  memset(_head, 0, sizeof(_head));
+  memset(_prev, 0, sizeof(_prev));
+  _pos = _end = 0;
+  _bits = 0;
+  _bit_count = 0;
+  _out_len = 0;
+}
+
+void compress_feed(uint8_t const* in, uint32_t len, compress_output_cb_t output, void* arg) {
+  _output = output;
+  _arg = arg;
+
+  while ( len ) {
+    // lookahead is less than MAX_MATCH when full, so _pos is past the window
+    if ( _end == BUF_SIZE ) slide();
+
+    uint32_t n = BUF_SIZE - _end;
+    if ( n > len ) n = len;
+
+    memcpy(_buf + _end, in, n);
+    _end += n;
+    in += n;
+    len -= n;
+
+    encode(false);
+  }
+
+  out_flush();
+}
+
+void compress_flush(compress_output_cb_t output, void* arg) {
+  _output = output;
+  _arg = arg;
+
+  encode(true);
+
+  // padding is shorter than any token
+  if ( _bit_count ) put_bits(0, (uint8_t) (8 - _bit_count));
+
+  out_flush();
+}
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef TUF2_COMPRESS_H_
+#define TUF2_COMPRESS_H_
+
+#include "decompress.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Streaming heatshrink (LZSS) encoder, the counterpart of decompress.c with the same window and
+// lookahead bits: greedy matches of 2 or more bytes found through a hash chain. Used by the port to
+// keep the last-known-good app compressed (CFG_UF2_LKG_SNAPSHOT), each stream starts from an empty
+// history and is decoded on its own.
+//--------------------------------------------------------------------+
+
+// Called with consecutive runs of compressed data
+typedef void (*compress_output_cb_t)(uint8_t const* data, uint32_t len, void* arg);
+
+// Start a stream: empty history, no pending bits. The previous stream must be flushed
+void compress_init(void);
+
+// Compress len bytes. Up to a lookahead of bytes is held back to search matches, output is passed on before returning
+void compress_feed(uint8_t const* in, uint32_t len, compress_output_cb_t output, void* arg);
+
+// Encode all held input and pad the last byte with zero bits, which decompress_feed() leaves pending
+void compress_flush(compress_output_cb_t output, void* arg);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
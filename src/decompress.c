@@ -0,0 +1,103 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include "decompress.h"
+
+#if CFG_UF2_HEATSHRINK
+
+//--------------------------------------------------------------------+
+// MACRO TYPEDEF CONSTANT ENUM DECLARATION
+//--------------------------------------------------------------------+
+
+#define WINDOW_SIZE       (1UL << CFG_UF2_HEATSHRINK_WINDOW_BITS)
+#define BACKREF_BITS      (1 + CFG_UF2_HEATSHRINK_WINDOW_BITS + CFG_UF2_HEATSHRINK_LOOKAHEAD_BITS)
+#define LITERAL_BITS      (1 + 8)
+
+_Static_assert(BACKREF_BITS <= 24, "bit accumulator is 32 bit");
+
+// History of decoded bytes, also used as output buffer: bytes in [_flushed, _pos) are not passed to output yet
+static uint8_t _window[WINDOW_SIZE];
+static uint32_t _pos;
+static uint32_t _flushed;
+
+// unconsumed input bits, right aligned
+static uint32_t _bits;
+static uint8_t _bit_count;
+
+//--------------------------------------------------------------------+
+//
+//--------------------------------------------------------------------+
+
+static void flush(decompress_output_cb_t output, void* arg) {
+  if (_pos > _flushed) output(_window + _flushed, _pos - _flushed, arg);
+
+  // window is full, restart at its beginning
+  if (_pos == WINDOW_SIZE) _pos = 0;
+  _flushed = _pos;
+}
+
+void decompress_init(void) {
+  // heatshrink starts with a zeroed window, back-references before the start read zeros
+  memset(_window, 0, sizeof(_window));
+  _pos = _flushed = 0;
+  _bits = 0;
+  _bit_count = 0;
+}
+
+void decompress_feed(uint8_t const* in, uint32_t len, decompress_output_cb_t output, void* arg) {
+  for (uint32_t i = 0; i < len; i++) {
+    _bits = (_bits << 8) | in[i];
+    _bit_count += 8;
+
+    while (_bit_count) {
+      bool const literal = (_bits >> (_bit_count - 1)) & 1;
+      uint8_t const need = literal ? LITERAL_BITS : BACKREF_BITS;
+      if (_bit_count < need) break;
+
+      _bit_count -= need;
+      uint32_t const token = (_bits >> _bit_count) & ((1UL << (need - 1)) - 1);
+
+      if (literal) {
+        _window[_pos++] = (uint8_t) token;
+        if (_pos == WINDOW_SIZE) flush(output, arg);
+      } else {
+        uint32_t const offset = (token >> CFG_UF2_HEATSHRINK_LOOKAHEAD_BITS) + 1;
+        uint32_t count = (token & ((1UL << CFG_UF2_HEATSHRINK_LOOKAHEAD_BITS) - 1)) + 1;
+
+        while (count--) {
+          _window[_pos] = _window[(_pos - offset) & (WINDOW_SIZE - 1)];
+          _pos++;
+          if (_pos == WINDOW_SIZE) flush(output, arg);
+        }
+      }
+    }
+  }
+
+  flush(output, arg);
+}
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef TUF2_DECOMPRESS_H_
+#define TUF2_DECOMPRESS_H_
+
+#include "uf2.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Streaming decoder for compressed UF2 payloads (UF2_FLAG_HEATSHRINK).
+// Payloads of all blocks together form one heatshrink (LZSS) stream, MSB first:
+//   1 + 8 bits literal, 0 + WINDOW_BITS (offset-1) + LOOKAHEAD_BITS (count-1) back-reference.
+// Decoder state carries over between blocks, which must be fed in order.
+//--------------------------------------------------------------------+
+
+// Support compressed UF2 files, costs (1 << CFG_UF2_HEATSHRINK_WINDOW_BITS) bytes of RAM for the history
+#ifndef CFG_UF2_HEATSHRINK
+  #define CFG_UF2_HEATSHRINK                0
+#endif
+
+// Parameters the file was compressed with, must match tools/uf2compress.py
+#ifndef CFG_UF2_HEATSHRINK_WINDOW_BITS
+  #define CFG_UF2_HEATSHRINK_WINDOW_BITS    11
+#endif
+
+#ifndef CFG_UF2_HEATSHRINK_LOOKAHEAD_BITS
+  #define CFG_UF2_HEATSHRINK_LOOKAHEAD_BITS 4
+#endif
+
+// Header of a compressed image embedded by tools/uf2compress.py --carray (self-update),
+// followed by the stream of the whole image
+#define DECOMPRESS_IMAGE_MAGIC  0x31555348 // "HSU1"
+
+typedef struct {
+  uint32_t magic;
+  uint32_t len;           // decompressed length
+  uint8_t window_bits;
+  uint8_t lookahead_bits;
+  uint16_t reserved;
+  uint8_t md5[16];        // of the decompressed image
+} decompress_image_t;
+
+// Called with consecutive runs of decompressed data
+typedef void (*decompress_output_cb_t)(uint8_t const* data, uint32_t len, void* arg);
+
+// Start a new stream
+void decompress_init(void);
+
+// Decode len bytes of the stream. Every byte decoded is passed to output before returning,
+// incomplete tokens at the end are kept for the next call
+void decompress_feed(uint8_t const* in, uint32_t len, decompress_output_cb_t output, void* arg);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
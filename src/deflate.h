@@ -0,0 +1,68 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef TUF2_DEFLATE_H_
+#define TUF2_DEFLATE_H_
+
+#include "uf2.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Streaming DEFLATE (RFC 1951) encoder of MEASDAT.CSV.GZ: fixed Huffman codes, greedy matches
+// found through a hash chain within a small window. Output is produced in segments, each one a
+// fixed Huffman block that ends with a full flush (empty stored block, byte aligned) and does not
+// reference data of the segments before it. The output of a segment therefore only depends on its
+// input, which is what allows a reader to restart the encoder at any segment.
+//--------------------------------------------------------------------+
+
+// Distance of back-references, costs 6 << CFG_UF2_DEFLATE_WINDOW_BITS bytes of RAM
+#ifndef CFG_UF2_DEFLATE_WINDOW_BITS
+  #define CFG_UF2_DEFLATE_WINDOW_BITS  10
+#endif
+
+// Longest output of one deflate_feed() of len bytes followed by deflate_flush(), 9 bits per literal
+// for input held back as lookahead plus the block end and the flush
+#define DEFLATE_OUTPUT_MAX(_len)  ((((_len) + 258) * 9 + 7) / 8 + 8)
+
+// Called with consecutive runs of compressed data
+typedef void (*deflate_output_cb_t)(uint8_t const* data, uint32_t len, void* arg);
+
+// Start a segment: empty history, begin a fixed Huffman block. The previous segment must be flushed
+void deflate_init(void);
+
+// Compress len bytes. Up to 257 bytes are held back to search matches, output is passed on before returning
+void deflate_feed(uint8_t const* in, uint32_t len, deflate_output_cb_t output, void* arg);
+
+// Encode all held input and end the segment with a full flush
+void deflate_flush(deflate_output_cb_t output, void* arg);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
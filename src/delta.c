@@ -0,0 +1,181 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include "delta.h"
+
+#if CFG_UF2_DELTA
+
+//--------------------------------------------------------------------+
+// MACRO TYPEDEF CONSTANT ENUM DECLARATION
+//--------------------------------------------------------------------+
+
+#define HEADER_SIZE   16
+#define COPY_CHUNK    256
+
+enum {
+  ST_HEADER = 0,
+  ST_OP,
+  ST_DATA,
+  ST_DONE,
+};
+
+static uint8_t _state;
+static uint32_t _start;
+static uint32_t _addr;
+static uint32_t _end;
+
+// fixed size part (header or op with its fields) being collected
+static uint8_t _field[HEADER_SIZE];
+static uint8_t _field_count;
+
+// remaining bytes of a DATA op
+static uint32_t _data_left;
+
+static uint8_t _copy_buf[COPY_CHUNK] __attribute__((aligned(4)));
+
+//--------------------------------------------------------------------+
+//
+//--------------------------------------------------------------------+
+
+static uint32_t get_u32(uint8_t const* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint16_t get_u16(uint8_t const* p) {
+  return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+static uint8_t field_size(void) {
+  if (_state == ST_HEADER) return HEADER_SIZE;
+  if (_field_count == 0) return 1; // op code decides the rest
+  return (_field[0] == DELTA_OP_COPY) ? 7 : 3;
+}
+
+static bool check_header(void) {
+  uint32_t const base_len = get_u32(_field + 4);
+  uint32_t const base_crc = get_u32(_field + 8);
+  uint32_t const new_len = get_u32(_field + 12);
+
+  if (get_u32(_field) != DELTA_MAGIC || !board_flash_crc32) return false;
+
+  if (board_flash_crc32(_start, base_len) != base_crc) {
+    TUF2_LOG1("Delta base image does not match\r\n");
+    return false;
+  }
+
+  _end = _start + new_len;
+  return true;
+}
+
+static bool copy(uint32_t src, uint32_t len) {
+  if (_addr + len > _end) return false;
+
+  // same place in old and new image, flash already holds it
+  if (src == _addr) {
+    _addr += len;
+    return true;
+  }
+
+  // ascending chunks, a source overlapping the output is always ahead of it (old data) or behind it (new data).
+  // Chunks are aligned to source so that a read never straddles two write-back windows of the port
+  while (len) {
+    uint32_t count = COPY_CHUNK - (src & (COPY_CHUNK - 1));
+    if (count > len) count = len;
+    board_flash_read(src, _copy_buf, count);
+    board_flash_write(_addr, _copy_buf, count);
+
+    src += count;
+    _addr += count;
+    len -= count;
+  }
+
+  return true;
+}
+
+static bool run_op(void) {
+  switch (_field[0]) {
+    case DELTA_OP_COPY:
+      return copy(get_u32(_field + 1), get_u16(_field + 5));
+
+    case DELTA_OP_DATA:
+      _data_left = get_u16(_field + 1);
+      if (_addr + _data_left > _end) return false;
+      _state = _data_left ? ST_DATA : ST_OP;
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+void delta_init(uint32_t addr) {
+  _state = ST_HEADER;
+  _start = _addr = _end = addr;
+  _field_count = 0;
+  _data_left = 0;
+}
+
+uint32_t delta_addr(void) {
+  return _addr;
+}
+
+bool delta_feed(uint8_t const* in, uint32_t len) {
+  while (len) {
+    if (_state == ST_DONE) {
+      // rest is padding of the last block
+      return true;
+    }
+
+    if (_state == ST_DATA) {
+      uint32_t const count = (len < _data_left) ? len : _data_left;
+      board_flash_write(_addr, in, count);
+
+      _addr += count;
+      _data_left -= count;
+      in += count;
+      len -= count;
+
+      if (_data_left == 0) _state = ST_OP;
+    } else {
+      _field[_field_count++] = *in++;
+      len--;
+
+      if (_field_count < field_size()) continue;
+      _field_count = 0;
+
+      bool const ok = (_state == ST_HEADER) ? check_header() : run_op();
+      if (!ok) return false;
+      if (_state == ST_HEADER) _state = ST_OP;
+    }
+
+    if (_state == ST_OP && _addr == _end) _state = ST_DONE;
+  }
+
+  return true;
+}
+
+#endif
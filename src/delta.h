@@ -0,0 +1,71 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef TUF2_DELTA_H_
+#define TUF2_DELTA_H_
+
+#include "uf2.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// In-place delta update (UF2_FLAG_DELTA) against the image currently in flash.
+// Payloads of all blocks together form one stream, all values little endian:
+//   header: "DLT1", base length, crc32 of base [target, target+base length), new length
+//   ops   : 0x01 COPY src (u32), len (u16) - copy from flash address src
+//           0x02 DATA len (u16), len bytes  - literal data
+// Output is written sequentially from the target address of block 0. Flash is patched in place,
+// so COPY sources below the output position read new data and the others still old data,
+// tools/uf2delta.py generates streams under this model. A COPY to its own address costs nothing.
+//--------------------------------------------------------------------+
+
+// Support delta UF2 files, needs board_flash_crc32()
+#ifndef CFG_UF2_DELTA
+  #define CFG_UF2_DELTA   0
+#endif
+
+#define DELTA_MAGIC       0x31544C44UL // "DLT1"
+
+enum {
+  DELTA_OP_COPY = 0x01,
+  DELTA_OP_DATA = 0x02,
+};
+
+// Start a new stream written to addr
+void delta_init(uint32_t addr);
+
+// Process len bytes of the stream, return false if the stream is invalid or does not match the base image
+bool delta_feed(uint8_t const* in, uint32_t len);
+
+// Address the next output byte is written to
+uint32_t delta_addr(void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
@@ -0,0 +1,145 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "tusb.h"
+#include "uf2.h"
+
+#if CFG_TUD_DFU
+
+//--------------------------------------------------------------------+
+// USB DFU 1.1 interface for scripted flashing with dfu-util, alt 0 is the app partition.
+// DNLOAD blocks go into the same write pipeline as uf2 blocks, manifestation flushes and
+// verifies. UPLOAD reads the app back. DFU_DETACH boots a manifested image.
+//--------------------------------------------------------------------+
+
+static bool _rejected = false;
+static bool _manifested = false;
+
+// app image size if known, otherwise whole partition
+static uint32_t app_size(void) {
+  uint32_t const flash_size = board_flash_size();
+  uint32_t const size = board_flash_app_size ? board_flash_app_size() : 0;
+  return (size && size < flash_size) ? size : flash_size;
+}
+
+//--------------------------------------------------------------------+
+// tinyusb callbacks
+//--------------------------------------------------------------------+
+
+// Invoked right before tud_dfu_download_cb() (state=DFU_DNBUSY) or tud_dfu_manifest_cb() (state=DFU_MANIFEST)
+// Return bwPollTimeout in ms, both are handled synchronously
+uint32_t tud_dfu_get_timeout_cb(uint8_t alt, uint8_t state) {
+  (void) alt;
+  (void) state;
+  return 1;
+}
+
+// Invoked when received DFU_DNLOAD (wLength>0) following by DFU_GETSTATUS (state=DFU_DNBUSY) requests
+void tud_dfu_download_cb(uint8_t alt, uint16_t block_num, uint8_t const* data, uint16_t length) {
+  (void) alt;
+  uint32_t const addr = ((uint32_t) block_num) * CFG_TUD_DFU_XFER_BUFSIZE;
+
+  if (block_num == 0) {
+    _rejected = false;
+    _manifested = false;
+
+    // wrong image is rejected before anything is erased
+    if (board_flash_check_image && !board_flash_check_image(0, data, length)) {
+      TUF2_LOG1("Image rejected\r\n");
+      _rejected = true;
+    } else {
+      indicator_set(STATE_WRITING_STARTED);
+    }
+  }
+
+  if (_rejected) {
+    tud_dfu_finish_flashing(DFU_STATUS_ERR_TARGET);
+    return;
+  }
+
+  if (addr >= board_flash_size() || length > board_flash_size() - addr) {
+    tud_dfu_finish_flashing(DFU_STATUS_ERR_ADDRESS);
+    return;
+  }
+
+  // DFU does not tell the image size, at most the window after the image end is erased needlessly
+  if (board_flash_erase_ahead) board_flash_erase_ahead(addr, board_flash_size() - addr);
+
+  board_flash_write(addr, data, length);
+  tud_dfu_finish_flashing(DFU_STATUS_OK);
+}
+
+// Invoked when download process is complete, received DFU_DNLOAD (wLength=0) following by DFU_GETSTATUS (state=Manifest)
+void tud_dfu_manifest_cb(uint8_t alt) {
+  (void) alt;
+
+  if (_rejected) {
+    tud_dfu_finish_flashing(DFU_STATUS_ERR_TARGET);
+    return;
+  }
+
+  board_flash_flush();
+
+  if (board_flash_verify && !board_flash_verify()) {
+    tud_dfu_finish_flashing(DFU_STATUS_ERR_VERIFY);
+    return;
+  }
+
+  _manifested = true;
+  tud_dfu_finish_flashing(DFU_STATUS_OK);
+}
+
+// Invoked when received DFU_UPLOAD request, return number of bytes copied, less than length ends upload
+uint16_t tud_dfu_upload_cb(uint8_t alt, uint16_t block_num, uint8_t* data, uint16_t length) {
+  (void) alt;
+  uint32_t const addr = ((uint32_t) block_num) * CFG_TUD_DFU_XFER_BUFSIZE;
+  uint32_t const size = app_size();
+
+  // readback protected: upload is empty
+  if (CFG_UF2_READBACK_PROTECT || addr >= size) return 0;
+  if (length > size - addr) length = (uint16_t) (size - addr);
+
+  board_flash_read(addr, data, length);
+  return length;
+}
+
+// Invoked when the host aborts a transfer with DFU_ABORT
+void tud_dfu_abort_cb(uint8_t alt) {
+  (void) alt;
+  _manifested = false;
+}
+
+// Invoked when received DFU_DETACH: boot the new image if manifested, otherwise restart the bootloader
+void tud_dfu_detach_cb(void) {
+  if (_manifested) {
+    TUF2_LOG1("Writing finished\r\n");
+    indicator_set(STATE_WRITING_FINISHED);
+    board_dfu_complete();
+  }
+
+  board_reset();
+}
+
+#endif
@@ -0,0 +1,172 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include "file_container.h"
+
+#if CFG_UF2_FILE_CONTAINER
+#include "ff.h"
+#include "diskio.h"
+
+//--------------------------------------------------------------------+
+// MACRO TYPEDEF CONSTANT ENUM DECLARATION
+//--------------------------------------------------------------------+
+
+// longest path accepted, including the terminating NUL
+#define FILE_CONTAINER_NAME_MAX  128
+
+enum {
+  FILE_CLOSED = 0,
+  FILE_OPEN,
+  FILE_FAILED,   // remaining blocks of the file are dropped
+};
+
+static FATFS _fs;
+static FIL _file;
+static bool _mounted = false;
+static bool _changed = false;
+static uint8_t _file_state = FILE_CLOSED;
+static char _name[FILE_CONTAINER_NAME_MAX];
+
+//--------------------------------------------------------------------+
+// lib/fatfs disk glue, the volume is the whole data LUN storage
+//--------------------------------------------------------------------+
+
+DSTATUS disk_status(BYTE pdrv) {
+  return (pdrv || !board_data_lun_block_count()) ? STA_NOINIT : 0;
+}
+
+DSTATUS disk_initialize(BYTE pdrv) {
+  return disk_status(pdrv);
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE* buff, LBA_t sector, UINT count) {
+  if (pdrv) return RES_PARERR;
+  return board_data_lun_read(sector, buff, count) ? RES_OK : RES_ERROR;
+}
+
+DRESULT disk_write(BYTE pdrv, BYTE const* buff, LBA_t sector, UINT count) {
+  if (pdrv) return RES_PARERR;
+  return board_data_lun_write(sector, buff, count) ? RES_OK : RES_ERROR;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void* buff) {
+  (void) buff;
+  if (pdrv) return RES_PARERR;
+
+  if (cmd == CTRL_SYNC) {
+    board_data_lun_flush();
+    return RES_OK;
+  }
+  return RES_PARERR;
+}
+
+//--------------------------------------------------------------------+
+//
+//--------------------------------------------------------------------+
+
+// Open name for writing with its final size, creating the directories of its path
+static bool file_open(char const* name, uint32_t size) {
+  if (!_mounted) {
+    FRESULT const res = f_mount(&_fs, "", 1);
+    if (res != FR_OK) {
+      TUF2_LOG1("Files: no FAT volume on data storage (%u)\r\n", (unsigned) res);
+      return false;
+    }
+    _mounted = true;
+  }
+
+  // already existing ones fail with FR_EXIST
+  for (char* sep = strchr(_name, '/'); sep; sep = strchr(sep + 1, '/')) {
+    *sep = 0;
+    f_mkdir(_name);
+    *sep = '/';
+  }
+
+  FRESULT res = f_open(&_file, name, FA_OPEN_ALWAYS | FA_WRITE);
+  if (res == FR_OK) {
+    // seeking to the end in write mode allocates the whole cluster chain at once, truncate then drops
+    // clusters of a larger file it replaces
+    res = f_lseek(&_file, size);
+    if (res == FR_OK && f_tell(&_file) != size) res = FR_DENIED;
+    if (res == FR_OK) res = f_truncate(&_file);
+    if (res != FR_OK) f_close(&_file);
+  }
+
+  if (res != FR_OK) {
+    TUF2_LOG1("Files: %s of %lu bytes not written (%u)\r\n", name, size, (unsigned) res);
+    return false;
+  }
+
+  TUF2_LOG1("Files: %s, %lu bytes\r\n", name, size);
+  return true;
+}
+
+static void file_close(void) {
+  if (_file_state == FILE_OPEN) f_close(&_file);
+  _file_state = FILE_CLOSED;
+}
+
+//--------------------------------------------------------------------+
+// API
+//--------------------------------------------------------------------+
+
+bool file_container_write(char const* name, uint32_t offset, void const* data, uint32_t len, uint32_t file_size) {
+  // paths are relative to the root of the volume
+  while (*name == '/') name++;
+
+  if (!*name || strlen(name) >= FILE_CONTAINER_NAME_MAX) return false;
+  if (offset > file_size || len > file_size - offset) return false;
+
+  if (_file_state == FILE_CLOSED || strcmp(name, _name)) {
+    file_close();
+    strcpy(_name, name);
+    _file_state = file_open(_name, file_size) ? FILE_OPEN : FILE_FAILED;
+  }
+  if (_file_state != FILE_OPEN) return false;
+
+  UINT written = 0;
+  if (f_tell(&_file) != offset && f_lseek(&_file, offset) != FR_OK) return false;
+  return f_write(&_file, data, len, &written) == FR_OK && written == len;
+}
+
+void file_container_flush(void) {
+  if (!_mounted) return;
+
+  // host may write the volume through the data LUN after the session, nothing of it is kept
+  file_close();
+  f_unmount("");
+  _mounted = false;
+  _changed = true;
+}
+
+bool file_container_changed(void) {
+  bool const changed = _changed;
+  _changed = false;
+  return changed;
+}
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef FILE_CONTAINER_H_
+#define FILE_CONTAINER_H_
+
+#include "board_api.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// UF2 file container blocks (UF2_FLAG_FILE_CONTAINER): the payload is part of a file named after it
+// instead of a flash image. Files are written into the filesystem of the data LUN storage (espressif
+// ffat partition) with lib/fatfs, which goes through the board's write-back sector cache. The file
+// being written stays open, its whole cluster chain is allocated when it is opened and the FAT and
+// directory are only committed when another file starts or the UF2 session completes. Blocks of
+// files and of a firmware image can be mixed in one UF2 file. The storage must hold a FAT volume,
+// it is not formatted here
+//--------------------------------------------------------------------+
+
+// Accept file container blocks, needs TINYUF2_DATA_LUN and a ffconf.h of the port for lib/fatfs
+#ifndef CFG_UF2_FILE_CONTAINER
+  #define CFG_UF2_FILE_CONTAINER  0
+#endif
+
+#if CFG_UF2_FILE_CONTAINER && !TINYUF2_DATA_LUN
+  #error "CFG_UF2_FILE_CONTAINER needs TINYUF2_DATA_LUN"
+#endif
+
+// Write [offset, offset+len) of file name, file_size bytes in total. Directories in name are created
+bool file_container_write(char const* name, uint32_t offset, void const* data, uint32_t len, uint32_t file_size);
+
+// Close the file being written and commit the filesystem to storage
+void file_container_flush(void);
+
+// Files were written since the last call, the host is told of a medium change of the data LUN
+bool file_container_changed(void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
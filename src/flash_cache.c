@@ -0,0 +1,475 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "flash_cache.h"
+
+#if CFG_UF2_FLASH_CACHE_ASYNC
+#include "sched.h"
+#endif
+
+#if CFG_UF2_FLASH_CACHE
+
+//--------------------------------------------------------------------+
+// MACRO TYPEDEF CONSTANT ENUM DECLARATION
+//--------------------------------------------------------------------+
+
+#define FLASH_CACHE_INVALID_ADDR  0xffffffffUL
+
+// compare chunk read from flash that is not memory mapped
+#define FLASH_CACHE_CHUNK         64
+
+typedef struct {
+  uint32_t addr;     // erase unit being cached
+  uint32_t written;  // sub-units written since it was opened
+  uint32_t compared; // written sub-units compared with flash as they were written
+  uint32_t dirty;    // compared sub-units that differ from flash
+  uint32_t erased;   // compared sub-units whose flash is erased
+  uint8_t* buf;
+} cache_unit_t;
+
+static uint8_t _fc_buf[CFG_UF2_FLASH_CACHE_SIZE] __attribute__((aligned(4)));
+static cache_unit_t _fc = { FLASH_CACHE_INVALID_ADDR, 0, 0, 0, 0, _fc_buf };
+
+// flush in progress is comparing, its reads must see flash contents
+static bool _fc_flushing = false;
+
+// erase ahead range, remainder of the uf2 image being written, and its last block so far
+static uint32_t _ahead_start = 0;
+static uint32_t _ahead_end = 0;
+static uint32_t _ahead_last = 0;
+
+#if CFG_UF2_FLASH_CACHE_ASYNC
+enum {
+  FX_IDLE = 0,
+  FX_ERASE,
+  FX_ERASE_WAIT,
+  FX_PROGRAM,
+  FX_PROGRAM_WAIT,
+};
+
+// unit handed over to the flush job, _fc is filled meanwhile
+static uint8_t _fx_buf[CFG_UF2_FLASH_CACHE_SIZE] __attribute__((aligned(4)));
+static cache_unit_t _fx = { FLASH_CACHE_INVALID_ADDR, 0, 0, 0, 0, _fx_buf };
+static uint8_t _fx_state = FX_IDLE;
+static uint32_t _fx_program = 0;   // sub-units to program
+static uint32_t _fx_offset = 0;    // next page to program
+static uint32_t _fx_start_us = 0;
+
+static bool flush_step(void* arg);
+static tuf2_job_t _fx_job = { .step = flush_step };
+#endif
+
+//--------------------------------------------------------------------+
+//
+//--------------------------------------------------------------------+
+
+static inline uint32_t subunit_size(board_flash_geometry_t const* geo) {
+  uint32_t const size = geo->erase_size / FLASH_CACHE_SUBUNITS;
+  return (size > geo->program_size) ? size : geo->program_size;
+}
+
+static inline void unit_reset(cache_unit_t* unit) {
+  unit->addr = FLASH_CACHE_INVALID_ADDR;
+  unit->written = unit->compared = unit->dirty = unit->erased = 0;
+}
+
+static bool buf_erased(uint8_t const* buf, uint32_t len, uint8_t erased_value) {
+  for (uint32_t i = 0; i < len; i++) {
+    if (buf[i] != erased_value) return false;
+  }
+  return true;
+}
+
+// Compare flash [addr, addr+len) with buf, stops once it is known to be neither equal nor erased
+static void flash_compare(board_flash_geometry_t const* geo, uint32_t addr, uint8_t const* buf, uint32_t len,
+                          bool* equal, bool* erased) {
+  *equal = true;
+  *erased = true;
+
+  if (geo->xip) {
+    uint8_t const* flash = (uint8_t const*) (uintptr_t) addr;
+    *equal = (0 == memcmp(flash, buf, len));
+    *erased = !*equal && buf_erased(flash, len, geo->erased_value);
+    return;
+  }
+
+  uint8_t chunk[FLASH_CACHE_CHUNK] __attribute__((aligned(4)));
+  for (uint32_t offset = 0; offset < len && (*equal || *erased); offset += FLASH_CACHE_CHUNK) {
+    uint32_t const n = (len - offset < FLASH_CACHE_CHUNK) ? (len - offset) : FLASH_CACHE_CHUNK;
+    board_flash_read(addr + offset, chunk, n);
+
+    if (*equal && memcmp(chunk, buf + offset, n)) *equal = false;
+    if (*erased && !buf_erased(chunk, n, geo->erased_value)) *erased = false;
+  }
+}
+
+// Memory mapped flash can be compared directly, but not while the background flush changes it
+static inline bool xip_idle(board_flash_geometry_t const* geo) {
+#if CFG_UF2_FLASH_CACHE_ASYNC
+  return geo->xip && _fx_state == FX_IDLE;
+#else
+  return geo->xip;
+#endif
+}
+
+// First unit of a block that the image overwrites entirely erases the whole block,
+// following units of the block are then programmed without erase
+static uint32_t erase_len(board_flash_geometry_t const* geo, uint32_t addr) {
+  uint32_t const block = geo->block_size;
+  if (block && !(addr & (block - 1)) && addr >= _ahead_start && addr + block <= _ahead_end) {
+    TUF2_LOG1("Erase block at 0x%08lX\r\n", addr);
+    return block;
+  }
+  return geo->erase_size;
+}
+
+#if !CFG_UF2_FLASH_CACHE_ASYNC
+static void unit_erase(board_flash_geometry_t const* geo, uint32_t addr) {
+  uint32_t const start_us = TUF2_STATS_US();
+  TUF2_TRACE_BEGIN(TUF2_TRACE_FLASH_ERASE);
+  board_flash_erase_raw(addr, erase_len(geo, addr));
+  TUF2_TRACE_END(TUF2_TRACE_FLASH_ERASE);
+  TUF2_STATS_INC(erase_count);
+  TUF2_STATS_ADD(erase_us, TUF2_STATS_US() - start_us);
+}
+#endif
+
+// Sub-units of the unit to program, the unit is read back completely and has to be erased first if
+// need_erase is set. 0 if flash already holds what was written
+static uint32_t flush_plan(board_flash_geometry_t const* geo, cache_unit_t* unit, bool* need_erase) {
+  uint32_t const sub = subunit_size(geo);
+  uint32_t const count = geo->erase_size / sub;
+
+  _fc_flushing = true;
+
+  // written sub-units that differ from flash, and whether flash has to be erased for them
+  uint32_t program = 0;
+  uint32_t skipped = 0;
+  *need_erase = false;
+
+  TUF2_TRACE_BEGIN(TUF2_TRACE_FLASH_COMPARE);
+  for (uint32_t i = 0; i < count; i++) {
+    if (!(unit->written & (1UL << i))) continue;
+
+    bool equal, erased;
+    if (unit->compared & (1UL << i)) {
+      equal = !(unit->dirty & (1UL << i));
+      erased = (unit->erased & (1UL << i)) != 0;
+    } else {
+      flash_compare(geo, unit->addr + i * sub, unit->buf + i * sub, sub, &equal, &erased);
+    }
+    if (equal) {
+      skipped += sub;
+      continue;
+    }
+
+    program |= (1UL << i);
+    if (!erased) *need_erase = true;
+  }
+  TUF2_TRACE_END(TUF2_TRACE_FLASH_COMPARE);
+
+  if (*need_erase) {
+    // unwritten sub-units keep their flash contents
+    for (uint32_t i = 0; i < count; i++) {
+      if (!(unit->written & (1UL << i))) board_flash_read(unit->addr + i * sub, unit->buf + i * sub, sub);
+    }
+
+    TUF2_LOG1("Erase and Write at 0x%08lX\r\n", unit->addr);
+    program = (count < 32) ? ((1UL << count) - 1) : 0xffffffffUL;
+  } else {
+    // equal parts are only left alone without erase
+    TUF2_STATS_ADD(skipped_bytes, skipped);
+  }
+
+  _fc_flushing = false;
+  return program;
+}
+
+#if !CFG_UF2_FLASH_CACHE_ASYNC
+static void cache_flush(void) {
+  if (_fc.addr == FLASH_CACHE_INVALID_ADDR) return;
+
+  board_flash_geometry_t const* geo = board_flash_geometry();
+  uint32_t const sub = subunit_size(geo);
+  uint32_t const count = geo->erase_size / sub;
+
+  TUF2_TRACE_BEGIN(TUF2_TRACE_FLASH_FLUSH);
+
+  bool need_erase;
+  uint32_t const program = flush_plan(geo, &_fc, &need_erase);
+  if (need_erase) unit_erase(geo, _fc.addr);
+
+  // consecutive sub-units are programmed with one call
+  for (uint32_t i = 0; i < count;) {
+    uint32_t n = 0;
+    while (i + n < count && (program & (1UL << (i + n))) &&
+           !buf_erased(_fc.buf + (i + n) * sub, sub, geo->erased_value)) {
+      n++;
+    }
+
+    if (n) {
+      uint32_t const start_us = TUF2_STATS_US();
+      TUF2_TRACE_BEGIN(TUF2_TRACE_FLASH_PROGRAM);
+      board_flash_program(_fc.addr + i * sub, _fc.buf + i * sub, n * sub);
+      TUF2_TRACE_END(TUF2_TRACE_FLASH_PROGRAM);
+      TUF2_STATS_INC(program_count);
+      TUF2_STATS_ADD(program_bytes, n * sub);
+      TUF2_STATS_ADD(program_us, TUF2_STATS_US() - start_us);
+      i += n;
+    } else {
+      i++;
+    }
+  }
+
+  unit_reset(&_fc);
+  TUF2_TRACE_END(TUF2_TRACE_FLASH_FLUSH);
+}
+#else
+// One step of the flush job: start an erase or a page program, or poll for its end
+static bool flush_step(void* arg) {
+  (void) arg;
+  board_flash_geometry_t const* geo = board_flash_geometry();
+
+  switch (_fx_state) {
+    case FX_ERASE:
+      _fx_start_us = TUF2_STATS_US();
+      TUF2_TRACE_BEGIN(TUF2_TRACE_FLASH_ERASE);
+      board_flash_erase_start(_fx.addr, erase_len(geo, _fx.addr));
+      _fx_state = FX_ERASE_WAIT;
+      return true;
+
+    case FX_ERASE_WAIT:
+      if (board_flash_busy()) return true;
+      TUF2_TRACE_END(TUF2_TRACE_FLASH_ERASE);
+      TUF2_STATS_INC(erase_count);
+      TUF2_STATS_ADD(erase_us, TUF2_STATS_US() - _fx_start_us);
+      _fx_state = FX_PROGRAM;
+      return true;
+
+    case FX_PROGRAM_WAIT:
+      if (board_flash_busy()) return true;
+      TUF2_TRACE_END(TUF2_TRACE_FLASH_PROGRAM);
+      TUF2_STATS_INC(program_count);
+      TUF2_STATS_ADD(program_bytes, geo->program_size);
+      TUF2_STATS_ADD(program_us, TUF2_STATS_US() - _fx_start_us);
+      _fx_offset += geo->program_size;
+      _fx_state = FX_PROGRAM;
+      return true;
+
+    case FX_PROGRAM: {
+      // next page of a sub-unit to program that is not left erased
+      uint32_t const sub = subunit_size(geo);
+      while (_fx_offset < geo->erase_size) {
+        uint8_t const* page = _fx.buf + _fx_offset;
+        if ((_fx_program & (1UL << (_fx_offset / sub))) && !buf_erased(page, geo->program_size, geo->erased_value)) {
+          _fx_start_us = TUF2_STATS_US();
+          TUF2_TRACE_BEGIN(TUF2_TRACE_FLASH_PROGRAM);
+          board_flash_program_start(_fx.addr + _fx_offset, page);
+          _fx_state = FX_PROGRAM_WAIT;
+          return true;
+        }
+        _fx_offset += geo->program_size;
+      }
+
+      unit_reset(&_fx);
+      _fx_state = FX_IDLE;
+      TUF2_TRACE_END(TUF2_TRACE_FLASH_FLUSH);
+      return false;
+    }
+
+    default:
+      return false;
+  }
+}
+
+// Hand the unit being filled over to the flush job, once the previous one is done
+static void cache_submit(void) {
+  if (_fc.addr == FLASH_CACHE_INVALID_ADDR) return;
+  while (flush_step(NULL)) {}
+
+  cache_unit_t const unit = _fx;
+  _fx = _fc;
+  _fc = unit;
+
+  // flush span lasts until the job has programmed the last page, erase and program spans are the
+  // time the chip is busy with them
+  TUF2_TRACE_BEGIN(TUF2_TRACE_FLASH_FLUSH);
+
+  bool need_erase;
+  _fx_program = flush_plan(board_flash_geometry(), &_fx, &need_erase);
+  _fx_offset = 0;
+
+  if (!_fx_program) {
+    unit_reset(&_fx);
+    TUF2_TRACE_END(TUF2_TRACE_FLASH_FLUSH);
+    return;
+  }
+
+  _fx_state = need_erase ? FX_ERASE : FX_PROGRAM;
+  tuf2_sched_post(&_fx_job);
+}
+#endif
+
+//--------------------------------------------------------------------+
+// Board Flash API
+//--------------------------------------------------------------------+
+
+bool board_flash_write(uint32_t addr, void const* data, uint32_t len) {
+  board_flash_geometry_t const* geo = board_flash_geometry();
+  TUF2_ASSERT(geo->erase_size <= CFG_UF2_FLASH_CACHE_SIZE);
+
+  uint32_t const mask = geo->erase_size - 1;
+  uint32_t const sub = subunit_size(geo);
+  uint8_t const* src = (uint8_t const*) data;
+
+  while (len) {
+    if ((addr & ~mask) != _fc.addr) {
+      TUF2_STATS_INC(cache_misses);
+#if CFG_UF2_FLASH_CACHE_ASYNC
+      cache_submit();
+#else
+      cache_flush();
+#endif
+      _fc.addr = addr & ~mask;
+    } else {
+      TUF2_STATS_INC(cache_hits);
+    }
+
+    uint32_t const offset = addr & mask;
+    uint32_t const n = (len < geo->erase_size - offset) ? len : (geo->erase_size - offset);
+
+    // sub-units written partially for the first time start with their flash contents, these and memory
+    // mapped ones are compared with flash right away so that flush does not read them again
+    for (uint32_t i = offset / sub; i <= (offset + n - 1) / sub; i++) {
+      uint32_t const bit = 1UL << i;
+      uint32_t const start = i * sub;
+      bool const covered = (offset <= start) && (start + sub <= offset + n);
+      uint8_t const* flash = NULL;
+
+      if (!(_fc.written & bit)) {
+        if (!covered) {
+          board_flash_read(_fc.addr + start, _fc.buf + start, sub);
+          flash = _fc.buf + start;
+        } else if (xip_idle(geo)) {
+          flash = (uint8_t const*) (uintptr_t) (_fc.addr + start);
+        }
+
+        if (flash) {
+          _fc.compared |= bit;
+          if (buf_erased(flash, sub, geo->erased_value)) _fc.erased |= bit;
+        }
+        _fc.written |= bit;
+      } else if ((_fc.compared & bit) && !(_fc.dirty & bit)) {
+        // nothing differed so far, the buffer still holds the flash contents
+        flash = _fc.buf + start;
+      }
+
+      if (flash && !(_fc.dirty & bit)) {
+        uint32_t const from = (offset > start) ? offset : start;
+        uint32_t const to = (offset + n < start + sub) ? (offset + n) : (start + sub);
+        if (memcmp(flash + (from - start), src + (from - offset), to - from)) _fc.dirty |= bit;
+      }
+    }
+
+    memcpy(_fc.buf + offset, src, n);
+
+    addr += n;
+    src += n;
+    len -= n;
+  }
+
+  return true;
+}
+
+#if CFG_UF2_FLASH_CACHE_ASYNC
+bool board_flash_write_busy(uint32_t addr) {
+  // another unit is needed while the previous one is still being flushed
+  uint32_t const mask = board_flash_geometry()->erase_size - 1;
+  return _fc.addr != FLASH_CACHE_INVALID_ADDR && (addr & ~mask) != _fc.addr && _fx_state != FX_IDLE;
+}
+
+void flash_cache_read_wait(void) {
+  if (_fx_state == FX_ERASE_WAIT || _fx_state == FX_PROGRAM_WAIT) {
+    while (board_flash_busy()) {}
+  }
+}
+#endif
+
+void board_flash_flush(void) {
+#if CFG_UF2_FLASH_CACHE_ASYNC
+  cache_submit();
+  while (flush_step(NULL)) {}
+#else
+  cache_flush();
+#endif
+
+  // end of an image, range must not be erased on behalf of a later one
+  _ahead_start = _ahead_end = _ahead_last = 0;
+}
+
+// Copy written sub-units of unit overlapping [addr, addr+len) over buffer
+static void unit_overlay(cache_unit_t const* unit, uint32_t addr, void* buffer, uint32_t len) {
+  if (unit->addr == FLASH_CACHE_INVALID_ADDR) return;
+
+  board_flash_geometry_t const* geo = board_flash_geometry();
+  uint32_t const sub = subunit_size(geo);
+  uint32_t const count = geo->erase_size / sub;
+
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t const start = unit->addr + i * sub;
+    if (!(unit->written & (1UL << i)) || start >= addr + len || start + sub <= addr) continue;
+
+    // overlap of the sub-unit with [addr, addr+len)
+    uint32_t const from = (start > addr) ? start : addr;
+    uint32_t const to = (start + sub < addr + len) ? (start + sub) : (addr + len);
+    memcpy((uint8_t*) buffer + (from - addr), unit->buf + (from - unit->addr), to - from);
+  }
+}
+
+void flash_cache_read_overlay(uint32_t addr, void* buffer, uint32_t len) {
+  if (_fc_flushing) return;
+
+#if CFG_UF2_FLASH_CACHE_ASYNC
+  // unit being flushed is older than the one being filled
+  unit_overlay(&_fx, addr, buffer, len);
+#endif
+  unit_overlay(&_fc, addr, buffer, len);
+}
+
+void board_flash_erase_ahead(uint32_t addr, uint32_t len) {
+  // calls of an image share the end of the range while its blocks move up
+  if (addr + len != _ahead_end) {
+    _ahead_start = _ahead_last = addr;
+    _ahead_end = addr + len;
+  } else if (addr < _ahead_last) {
+    // image written out of order e.g by a host cache, the range may already hold written blocks.
+    // No erasing ahead for the rest of it
+    _ahead_start = _ahead_end;
+  } else {
+    _ahead_last = addr;
+  }
+}
+
+#endif
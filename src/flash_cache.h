@@ -0,0 +1,93 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef TUF2_FLASH_CACHE_H_
+#define TUF2_FLASH_CACHE_H_
+
+#include "board_api.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Shared write-back flash cache on top of board_flash_geometry(), board_flash_erase_raw() and
+// board_flash_program(). Implements board_flash_write(), board_flash_flush() and
+// board_flash_erase_ahead() for ports enabling it. One erase unit is cached, on flush:
+// - unwritten parts of the unit are filled from flash, nothing is read if it was written completely
+// - parts equal to flash are skipped, nothing is done if the whole unit matches
+// - parts read from flash because they were written partially, or memory mapped, are compared while
+//   being written, only the parts written completely of other flash are read back to compare
+// - written parts of flash that are still erased are programmed without erasing the unit
+// - consecutive parts to program are passed to board_flash_program() in one call
+// - otherwise the unit is erased, the first unit of a block inside the erase ahead range erases
+//   the whole block, following units then only need programming
+//--------------------------------------------------------------------+
+
+// Port uses the shared cache instead of implementing board_flash_write() and board_flash_flush()
+#ifndef CFG_UF2_FLASH_CACHE
+  #define CFG_UF2_FLASH_CACHE       0
+#endif
+
+// Cache size, at least erase_size of the port
+#ifndef CFG_UF2_FLASH_CACHE_SIZE
+  #define CFG_UF2_FLASH_CACHE_SIZE  4096
+#endif
+
+// Flush in the background instead of inside the WRITE10 callback, for ports without an RTOS: a unit that is
+// complete is handed to a job of tuf2_sched_run() (see sched.h), which starts each erase and page program and
+// polls for its end while the main loop keeps running tud_task(). A second buffer of CFG_UF2_FLASH_CACHE_SIZE
+// is filled meanwhile. Needs board_flash_erase_start(), board_flash_program_start() and board_flash_busy()
+#ifndef CFG_UF2_FLASH_CACHE_ASYNC
+  #define CFG_UF2_FLASH_CACHE_ASYNC 0
+#endif
+
+// Written parts are tracked in this many sub-units of the erase unit (at least program_size each)
+#define FLASH_CACHE_SUBUNITS        32
+
+// Copy data written to the cache but not flushed yet over buffer holding flash [addr, addr+len),
+// for the port's board_flash_read(). Does nothing while the cache itself reads flash to flush
+#if CFG_UF2_FLASH_CACHE
+void flash_cache_read_overlay(uint32_t addr, void* buffer, uint32_t len);
+#else
+static inline void flash_cache_read_overlay(uint32_t addr, void* buffer, uint32_t len) {
+  (void) addr; (void) buffer; (void) len;
+}
+#endif
+
+// Wait for the erase or program the background flush has in progress, for the port's board_flash_read()
+// before it reads flash: a NOR chip returns no data while it is busy
+#if CFG_UF2_FLASH_CACHE && CFG_UF2_FLASH_CACHE_ASYNC
+void flash_cache_read_wait(void);
+#else
+static inline void flash_cache_read_wait(void) {
+}
+#endif
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
@@ -24,6 +24,7 @@
  * THE SOFTWARE.
  */
 
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 #include <inttypes.h>
@@ -34,16 +35,64 @@
 #include "compile_date.h"
 #include "board_api.h"
 #include "uf2.h"
-#include "esp_private/system_internal.h" // for esp_restart()
+#include "measurement_csv.h"
+#include "measurement_ring.h"
+#include "measurement_pack.h"
+#include "measurement_cache.h"
+#include "measurement_gz.h"
+#include "decompress.h"
+#include "delta.h"
+#include "file_container.h"
 
 //--------------------------------------------------------------------+
 //
 //--------------------------------------------------------------------+
 
+#if !CFG_UF2_APP_EXPORT
 // ota0 partition size
 static uint32_t _flash_size;
-// size of the measurement data inside the ota1 partition
+// flash range exported as CURRENT.UF2, either app image size or whole ota0
+static uint32_t _uf2_size;
+#endif
+#if !CFG_UF2_APP_EXPORT && CFG_UF2_CURRENT_BIN && !CFG_UF2_READBACK_PROTECT
+// CURRENT.BIN, exact app image size or whole ota0
+static uint32_t _bin_size;
+#endif
+// size of the valid measurement data inside the ota1 partition
 static uint32_t _measurement_flash_size;
+static bool _measurement_scanned = false;
+#if CFG_UF2_MEASUREMENT_GZ
+// size of MEASDAT.CSV, rendered or raw
+static uint32_t _measurement_csv_size;
+#endif
+#if CFG_UF2_APP_EXPORT
+// application changed measurement data, cached ota1 sectors are dropped on the next refresh
+static volatile bool _measurement_changed = false;
+#else
+// INFO_UF2.TXT changed since the host read the volume, reported as medium change by uf2_refresh()
+static bool _info_changed = false;
+#endif
+// volumes are set up by uf2_init()
+static volatile bool _uf2_ready = false;
+// handoff block of the application that reset into UF2, see handoff.h
+static uf2_handoff_t const* _handoff = NULL;
+
+static inline bool handoff_has(uint8_t field) {
+  return _handoff && (_handoff->flags & field);
+}
+
+static inline bool handoff_mode(uint8_t mode) {
+  return _handoff && _handoff->mode == mode;
+}
+
+// measurement data is being erased (Erase_Block), its files are empty until done
+static inline bool measurement_erasing(void) {
+#if CFG_UF2_MEASUREMENT_ERASE
+  return board_measurement_erase_busy && board_measurement_erase_busy();
+#else
+  return false;
+#endif
+}
 
 #define STATIC_ASSERT(_exp) _Static_assert(_exp, "static assert failed")
 
@@ -68,6 +117,15 @@ typedef struct {
     uint16_t Heads;
     uint32_t HiddenSectors;
     uint32_t TotalSectors32;
+#if CFG_UF2_FAT32
+    uint32_t SectorsPerFAT32;
+    uint16_t ExtFlags;
+    uint16_t FSVersion;
+    uint32_t RootCluster;
+    uint16_t FSInfoSector;
+    uint16_t BackupBootSector;
+    uint8_t Reserved0[12];
+#endif
     uint8_t PhysicalDriveNum;
     uint8_t Reserved;
     uint8_t ExtendedBootSig;
@@ -76,6 +134,13 @@ typedef struct {
     uint8_t FilesystemIdentifier[8];
 } __attribute__((packed)) FAT_BootBlock;
 
+// Whole boot sector, read with a single copy: only total sectors, FAT size, serial and label are patched
+typedef struct {
+    FAT_BootBlock bpb;
+    uint8_t BootCode[510 - sizeof(FAT_BootBlock)];
+    uint8_t Signature[2]; // always at offsets 510/511, even when BPB_SECTOR_SIZE is larger
+} __attribute__((packed)) FAT_BootSector;
+
 typedef struct {
     char name[8];
     char ext[3];
@@ -92,39 +157,114 @@ typedef struct {
     uint32_t size;
 } __attribute__((packed)) DirEntry;
 STATIC_ASSERT(sizeof(DirEntry) == 32);
+STATIC_ASSERT(sizeof(FAT_BootSector) == 512);
+
+// Provider for files whose content is generated or read from flash on demand.
+// read() fills dst with len bytes at offset, offset + len never exceeds size().
+// Reads of CURRENT.UF2 are always sector aligned.
+typedef struct {
+  uint32_t (*size) (void);
+  void (*read) (uint32_t offset, void* dst, uint32_t len);
+  void (*read_ahead) (uint32_t offset, uint32_t len); // optional hint for sequential reads
+} FileProvider_t;
+
+#if CFG_UF2_FAT32
+typedef uint32_t cluster_t;
+#else
+typedef uint16_t cluster_t;
+#endif
+
+// Provider for a subdirectory of generated files, e.g one file per day of measurements.
+// name() fills the space padded 8.3 name and the NUL terminated long name (at most
+// DIR_LONG_NAME_MAX chars, empty for none) of file i < count().
+typedef struct {
+  uint32_t (*count) (void);
+  void (*name) (uint32_t i, char name[11], char* long_name);
+  uint32_t (*size) (uint32_t i);
+  void (*read) (uint32_t i, uint32_t offset, void* dst, uint32_t len);
+} DirProvider_t;
+
+#define DIR_LONG_NAME_MAX   32
 
 typedef struct FileContent {
   char const name[11];
-  void const * content;
+  char const * long_name;             // optional VFAT long file name
+  void const * content;               // static content, or NULL if provider is used
+  FileProvider_t const * provider;
+  DirProvider_t const * dir;          // subdirectory, its files are placed right after its own clusters
   uint32_t size;       // OK to use uint32_T b/c FAT32 limits filesize to (4GiB - 2)
 
   // computing fields based on index and size
-  uint16_t cluster_start;
-  uint16_t cluster_end;
+  cluster_t cluster_start;
+  cluster_t cluster_end;  // of the directory itself for a subdirectory
+  uint16_t child_first;   // subdirectory files in _child_cluster_start
+  uint16_t child_count;
 } FileContent_t;
 
+// Entry to be rendered in a directory: one 8.3 DirEntry, preceded by LFN entries if it has a long name
+typedef struct {
+  char name[11];
+  char long_name[DIR_LONG_NAME_MAX + 1];
+  uint8_t attrs;
+  uint32_t cluster;
+  uint32_t size;
+} DirNode_t;
+
+#define DIR_ATTR_VOLUME_LABEL   0x28
+#define DIR_ATTR_DIRECTORY      0x10
+#define DIR_ATTR_LONG_NAME      0x0F
+
+// UCS-2 characters per LFN entry and their byte offsets within it
+#define LFN_CHARS_PER_ENTRY     13
+static uint8_t const _lfn_char_offset[LFN_CHARS_PER_ENTRY] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+
 //--------------------------------------------------------------------+
 //
 //--------------------------------------------------------------------+
 
 #define BPB_SECTOR_SIZE           ( 512)
 #define BPB_SECTORS_PER_CLUSTER   (CFG_UF2_SECTORS_PER_CLUSTER)
-#define BPB_RESERVED_SECTORS      (   1)
 #define BPB_NUMBER_OF_FATS        (   2)
 #define BPB_ROOT_DIR_ENTRIES      (  64)
 #define BPB_TOTAL_SECTORS         CFG_UF2_NUM_BLOCKS
 #define BPB_MEDIA_DESCRIPTOR_BYTE (0xF8)
-#define FAT_ENTRY_SIZE            (2)
+
+#if CFG_UF2_FAT32
+  // FAT32: boot sector, FSInfo and their backups in reserved area, root directory is a cluster chain
+  // starting at cluster 2 with room for BPB_ROOT_DIR_ENTRIES
+  #define BPB_RESERVED_SECTORS    (  32)
+  #define FSINFO_SECTOR           (   1)
+  #define BACKUP_BOOT_SECTOR      (   6)
+  #define FAT_ENTRY_SIZE          (4)
+  #define FAT_END_OF_CHAIN        (0x0FFFFFFFUL)
+  typedef uint32_t fat_entry_t;
+#else
+  #define BPB_RESERVED_SECTORS    (   1)
+  #define FAT_ENTRY_SIZE          (2)
+  #define FAT_END_OF_CHAIN        (0xFFFF)
+  typedef uint16_t fat_entry_t;
+#endif
+
 #define FAT_ENTRIES_PER_SECTOR    (BPB_SECTOR_SIZE / FAT_ENTRY_SIZE)
-#define FAT_END_OF_CHAIN          (0xFFFF)
+#define FAT_MEDIA_ENTRY           ((FAT_END_OF_CHAIN & ~0xFFUL) | BPB_MEDIA_DESCRIPTOR_BYTE) // FAT entry of cluster 0
 
 // NOTE: MS specification explicitly allows FAT to be larger than necessary
 #define TOTAL_CLUSTERS_ROUND_UP   UF2_DIV_CEIL(BPB_TOTAL_SECTORS, BPB_SECTORS_PER_CLUSTER)
 #define BPB_SECTORS_PER_FAT       UF2_DIV_CEIL(TOTAL_CLUSTERS_ROUND_UP, FAT_ENTRIES_PER_SECTOR)
 #define DIRENTRIES_PER_SECTOR     (BPB_SECTOR_SIZE/sizeof(DirEntry))
-#define ROOT_DIR_SECTOR_COUNT     UF2_DIV_CEIL(BPB_ROOT_DIR_ENTRIES, DIRENTRIES_PER_SECTOR)
 #define BPB_BYTES_PER_CLUSTER     (BPB_SECTOR_SIZE * BPB_SECTORS_PER_CLUSTER)
 
+#if CFG_UF2_FAT32
+  #define ROOT_DIR_SECTOR_COUNT   0 // no fixed root directory region
+  #define ROOT_DIR_CLUSTERS       UF2_DIV_CEIL(BPB_ROOT_DIR_ENTRIES * sizeof(DirEntry), BPB_BYTES_PER_CLUSTER)
+#else
+  #define ROOT_DIR_SECTOR_COUNT   UF2_DIV_CEIL(BPB_ROOT_DIR_ENTRIES, DIRENTRIES_PER_SECTOR)
+  #define ROOT_DIR_CLUSTERS       0
+#endif
+#define BPB_SECTORS_PER_CLUSTER_SHIFT \
+  (BPB_SECTORS_PER_CLUSTER >= 64 ? 6 : BPB_SECTORS_PER_CLUSTER >= 32 ? 5 : BPB_SECTORS_PER_CLUSTER >= 16 ? 4 : \
+   BPB_SECTORS_PER_CLUSTER >=  8 ? 3 : BPB_SECTORS_PER_CLUSTER >=  4 ? 2 : BPB_SECTORS_PER_CLUSTER >=  2 ? 1 : 0)
+
 STATIC_ASSERT((BPB_SECTORS_PER_CLUSTER & (BPB_SECTORS_PER_CLUSTER-1)) == 0); // sectors per cluster must be power of two
 STATIC_ASSERT(BPB_SECTOR_SIZE                              ==       512); // GhostFAT does not support other sector sizes (currently)
 STATIC_ASSERT(BPB_NUMBER_OF_FATS                           ==         2); // FAT highest compatibility
@@ -132,28 +272,41 @@ STATIC_ASSERT(sizeof(DirEntry)                             ==        32); // FAT
 STATIC_ASSERT(BPB_SECTOR_SIZE % sizeof(DirEntry)           ==         0); // FAT requirement
 STATIC_ASSERT(BPB_ROOT_DIR_ENTRIES % DIRENTRIES_PER_SECTOR ==         0); // FAT requirement
 STATIC_ASSERT(BPB_BYTES_PER_CLUSTER                        <= (32*1024)); // FAT requirement (64k+ has known compatibility problems)
-STATIC_ASSERT(FAT_ENTRIES_PER_SECTOR                       ==       256); // FAT requirement
+STATIC_ASSERT(FAT_ENTRIES_PER_SECTOR * FAT_ENTRY_SIZE      ==       512); // FAT requirement
+STATIC_ASSERT((1UL << BPB_SECTORS_PER_CLUSTER_SHIFT) == BPB_SECTORS_PER_CLUSTER); // data region math is shift based
+STATIC_ASSERT(CFG_UF2_CURRENT_PAYLOAD_SIZE % 4 == 0 && CFG_UF2_CURRENT_PAYLOAD_SIZE <= 476); // UF2 payload limits
 
-#define UF2_FIRMWARE_BYTES_PER_SECTOR   256
-#define UF2_SECTOR_COUNT                (_flash_size / UF2_FIRMWARE_BYTES_PER_SECTOR)
+#define UF2_FIRMWARE_BYTES_PER_SECTOR   CFG_UF2_CURRENT_PAYLOAD_SIZE
+#define UF2_SECTOR_COUNT                UF2_DIV_CEIL(_uf2_size, UF2_FIRMWARE_BYTES_PER_SECTOR) // last block may be partial
 #define UF2_BYTE_COUNT                  (UF2_SECTOR_COUNT * BPB_SECTOR_SIZE) // always a multiple of sector size, per UF2 spec
 
-#define MEASUREMNT_SECOTR_COUNT         (_measurement_flash_size / UF2_FIRMWARE_BYTES_PER_SECTOR)
-#define MEASURMENT_BYTE_COUNT           (MEASUREMNT_SECOTR_COUNT * BPB_SECTOR_SIZE)
-// Define a general macro for calculating byte count
-#define BYTE_COUNT(_flash_size)        (((_flash_size) / UF2_FIRMWARE_BYTES_PER_SECTOR) * BPB_SECTOR_SIZE)
+// Measurement data is appended from the start of ota1, erased flash marks its end.
+// Data is scanned in units: a byte of CSV text (never 0xff) or a record (timestamp never 0xffffffff)
+#if CFG_UF2_MEASUREMENT_BINARY
+  #define MEASUREMENT_UNIT_SIZE         sizeof(MeasurementRecord_t)
+#else
+  #define MEASUREMENT_UNIT_SIZE         1
+#endif
 
 
 const uintptr_t SERIALNUM_ADDRESS = 0x3FF000;
 #define SERIALNUM_LEN     5
 
-char infoUf2File[128*3] =
+#if !CFG_UF2_APP_EXPORT
+// INFO_UF2.TXT is rendered on read: constant text with serial number and flash size in between
+static char const infoUf2Head[] =
     "EnertyUF2 Bootloader " UF2_VERSION "\r\n"
     "Model: " UF2_PRODUCT_NAME "\r\n"
     "Board-ID: " UF2_BOARD_ID "\r\n"
     "Date: " COMPILE_DATE "\r\n"
-    "Serial Number: AAAAAAAAAAA\r\n"
-    "Flash Size: 0x";
+    "Serial Number: ";
+static char const infoUf2FlashSize[] = "\r\nFlash Size: 0x";
+static char const infoUf2Tail[] = " bytes";
+
+// first byte is the hardware identifier (a character), followed by 5 bytes of serial number
+static uint8_t _serial_hex[6];
+static bool _serial_loaded = false;
+#endif
 
 TINYUF2_CONST char indexFile[] =
     "<!doctype html>\n"
@@ -183,19 +336,441 @@ char test_csv_data[] = "time,CT1,CT2,CT3\n"
 const char autorunFile[] = "[Autorun]\r\nIcon=FAVICON.ICO\r\n";
 #endif
 
-// size of CURRENT.UF2:
+static uint32_t measurement_size(void);
+static void measurement_read(uint32_t offset, void* dst, uint32_t len);
+static void measurement_read_ahead(uint32_t offset, uint32_t len);
+
+#if !CFG_UF2_APP_EXPORT
+static uint32_t info_txt_size(void);
+static void info_txt_read(uint32_t offset, void* dst, uint32_t len);
+static uint32_t current_uf2_size(void);
+static void current_uf2_read(uint32_t offset, void* dst, uint32_t len);
+static void current_uf2_read_ahead(uint32_t offset, uint32_t len);
+
+static FileProvider_t const info_txt_provider = {
+  .size = info_txt_size, .read = info_txt_read, .read_ahead = NULL
+};
+
+static FileProvider_t const current_uf2_provider = {
+  .size = current_uf2_size, .read = current_uf2_read, .read_ahead = current_uf2_read_ahead
+};
+
+#if CFG_UF2_CURRENT_BIN && !CFG_UF2_READBACK_PROTECT
+static uint32_t current_bin_size(void);
+static void current_bin_read(uint32_t offset, void* dst, uint32_t len);
+static void current_bin_read_ahead(uint32_t offset, uint32_t len);
+
+static FileProvider_t const current_bin_provider = {
+  .size = current_bin_size, .read = current_bin_read, .read_ahead = current_bin_read_ahead
+};
+#endif
+
+#if CFG_UF2_FLASH_BIN && !CFG_UF2_READBACK_PROTECT
+static uint32_t flash_bin_size(void);
+static void flash_bin_read(uint32_t offset, void* dst, uint32_t len);
+static void flash_bin_read_ahead(uint32_t offset, uint32_t len);
+
+static FileProvider_t const flash_bin_provider = {
+  .size = flash_bin_size, .read = flash_bin_read, .read_ahead = flash_bin_read_ahead
+};
+#endif
+#endif
+
+static FileProvider_t const measurement_provider = {
+  .size = measurement_size, .read = measurement_read, .read_ahead = measurement_read_ahead
+};
+
+#if CFG_UF2_MEASUREMENT_GZ
+static measurement_gz_source_t const measurement_gz_source = {
+  .read = measurement_read, .read_ahead = measurement_read_ahead
+};
+
+// MEASDAT.CSV compressed on the fly, size is known once MEASDAT.CSV (listed before it) has its size
+static uint32_t measurement_gz_file_size(void) {
+  return measurement_gz_init(_measurement_csv_size, &measurement_gz_source);
+}
+
+static FileProvider_t const measurement_gz_provider = {
+  .size = measurement_gz_file_size, .read = measurement_gz_read, .read_ahead = measurement_gz_read_ahead
+};
+
+  #define MEASUREMENT_GZ_FILE \
+    {.name = "MEASDA~1GZ ", .long_name = "MEASDAT.CSV.GZ", .provider = &measurement_gz_provider },
+#else
+  #define MEASUREMENT_GZ_FILE
+#endif
+
+#if CFG_UF2_MEASUREMENT_BINARY
+// size is known once MEASDAT.CSV (listed before it) has scanned the records
+static FileProvider_t const measurement_bin_provider = {
+  .size = measurement_bin_size, .read = measurement_bin_read, .read_ahead = measurement_bin_read_ahead
+};
+
+#if CFG_UF2_MEASUREMENT_INDEX_FILE
+// checkpoints of MEASDAT.CSV and MEASDAT.BIN, known after the same scan
+static FileProvider_t const measurement_index_provider = {
+  .size = measurement_index_size, .read = measurement_index_read, .read_ahead = NULL
+};
+
+  #define MEASUREMENT_INDEX_FILE \
+    {.name = "INDEX   BIN", .provider = &measurement_index_provider                 },
+#else
+  #define MEASUREMENT_INDEX_FILE
+#endif
+
+// recent data only, tail of MEASDAT.CSV
+static uint32_t last24h_size(void) { return measurement_window_size(MEASUREMENT_WINDOW_24H); }
+static void last24h_read(uint32_t offset, void* dst, uint32_t len) {
+  measurement_window_read(MEASUREMENT_WINDOW_24H, offset, dst, len);
+}
+static void last24h_read_ahead(uint32_t offset, uint32_t len) {
+  measurement_window_read_ahead(MEASUREMENT_WINDOW_24H, offset, len);
+}
+
+static uint32_t last7d_size(void) { return measurement_window_size(MEASUREMENT_WINDOW_7D); }
+static void last7d_read(uint32_t offset, void* dst, uint32_t len) {
+  measurement_window_read(MEASUREMENT_WINDOW_7D, offset, dst, len);
+}
+static void last7d_read_ahead(uint32_t offset, uint32_t len) {
+  measurement_window_read_ahead(MEASUREMENT_WINDOW_7D, offset, len);
+}
+
+static FileProvider_t const last24h_provider = {
+  .size = last24h_size, .read = last24h_read, .read_ahead = last24h_read_ahead
+};
+
+static FileProvider_t const last7d_provider = {
+  .size = last7d_size, .read = last7d_read, .read_ahead = last7d_read_ahead
+};
+
+// measurements/YYYY-MM-DD.csv, 8.3 name YYYYMMDD.CSV
+static void day_file_name(uint32_t i, char name[11], char* long_name) {
+  // civil date from days since epoch (Howard Hinnant's algorithm)
+  uint32_t const z = measurement_day_number(i) + 719468;
+  uint32_t const era = z / 146097;
+  uint32_t const doe = z - era * 146097;
+  uint32_t const yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  uint32_t const doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  uint32_t const mp = (5 * doy + 2) / 153;
+  uint32_t const d = doy - (153 * mp + 2) / 5 + 1;
+  uint32_t const m = mp < 10 ? mp + 3 : mp - 9;
+  uint32_t const y = yoe + era * 400 + (m <= 2);
+
+  char date[8];
+  date[0] = (char) ('0' + (y / 1000) % 10);
+  date[1] = (char) ('0' + (y / 100) % 10);
+  date[2] = (char) ('0' + (y / 10) % 10);
+  date[3] = (char) ('0' + y % 10);
+  date[4] = (char) ('0' + m / 10);
+  date[5] = (char) ('0' + m % 10);
+  date[6] = (char) ('0' + d / 10);
+  date[7] = (char) ('0' + d % 10);
+
+  memcpy(name, date, 8);
+  memcpy(name + 8, "CSV", 3);
+
+  memcpy(long_name, date, 4);
+  long_name[4] = '-';
+  memcpy(long_name + 5, date + 4, 2);
+  long_name[7] = '-';
+  memcpy(long_name + 8, date + 6, 2);
+  memcpy(long_name + 10, ".csv", 5);
+}
+
+static DirProvider_t const measurement_days_dir = {
+  .count = measurement_day_count, .name = day_file_name, .size = measurement_day_size, .read = measurement_day_read
+};
+
+// per-hour aggregate, computed in the same pass as MEASDAT.CSV
+static FileProvider_t const summary_provider = {
+  .size = measurement_summary_size, .read = measurement_summary_read, .read_ahead = NULL
+};
+
+// records after the watermark acknowledged by the host, see Ack_Block
+static FileProvider_t const measurement_new_provider = {
+  .size = measurement_new_size, .read = measurement_new_read, .read_ahead = measurement_new_read_ahead
+};
+
+#if CFG_UF2_MEASUREMENT_CHANNEL_FILES
+// time and a single CT per line, sizes are computed in the same pass as MEASDAT.CSV
+#define CHANNEL_PROVIDER(_n) \
+  static uint32_t ct##_n##_size(void) { return measurement_channel_size(_n - 1); } \
+  static void ct##_n##_read(uint32_t offset, void* dst, uint32_t len) { \
+    measurement_channel_read(_n - 1, offset, dst, len); \
+  } \
+  static void ct##_n##_read_ahead(uint32_t offset, uint32_t len) { \
+    measurement_channel_read_ahead(_n - 1, offset, len); \
+  } \
+  static FileProvider_t const ct##_n##_provider = { \
+    .size = ct##_n##_size, .read = ct##_n##_read, .read_ahead = ct##_n##_read_ahead \
+  };
+
+CHANNEL_PROVIDER(1)
+CHANNEL_PROVIDER(2)
+CHANNEL_PROVIDER(3)
+#endif
+
+#if CFG_UF2_MEASUREMENT_RING || CFG_UF2_MEASUREMENT_PACKED
+// chunks failing their crc32, checked in the same pass as MEASDAT.CSV
+static FileProvider_t const measurement_err_provider = {
+  .size = measurement_err_size, .read = measurement_err_read, .read_ahead = NULL
+};
+#endif
+#endif
+
+#if CFG_UF2_MEASUREMENT_PARTITIONS > 1
+static uint32_t partition_file_count(void);
+static void partition_file_name(uint32_t i, char name[11], char* long_name);
+static uint32_t partition_file_size(uint32_t i);
+static void partition_file_read(uint32_t i, uint32_t offset, void* dst, uint32_t len);
+
+// measurement partitions after the first one, raw like MEASDAT of the plain array
+static DirProvider_t const measurement_partitions_dir = {
+  .count = partition_file_count, .name = partition_file_name, .size = partition_file_size, .read = partition_file_read
+};
+#endif
+
+#if CFG_UF2_BOOTLOG
+static uint32_t bootlog_size(void);
+static void bootlog_read(uint32_t offset, void* dst, uint32_t len);
+
+static FileProvider_t const bootlog_provider = {
+  .size = bootlog_size, .read = bootlog_read, .read_ahead = NULL
+};
+#endif
+
+#if CFG_UF2_WEAR
+static uint32_t wear_size(void);
+static void wear_read(uint32_t offset, void* dst, uint32_t len);
+
+static FileProvider_t const wear_provider = {
+  .size = wear_size, .read = wear_read, .read_ahead = NULL
+};
+#endif
+
+#if CFG_UF2_TRACE && !CFG_UF2_APP_EXPORT
+static FileProvider_t const trace_provider = {
+  .size = tuf2_trace_size, .read = tuf2_trace_read, .read_ahead = NULL
+};
+#endif
+
+#if CFG_UF2_ACCESS && !CFG_UF2_APP_EXPORT
+static FileProvider_t const access_provider = {
+  .size = tuf2_access_size, .read = tuf2_access_read, .read_ahead = NULL
+};
+#endif
+
+#if CFG_UF2_STATS
+tuf2_stats_t tuf2_stats;
+#endif
+
+#if CFG_UF2_STATS && !CFG_UF2_APP_EXPORT
+static uint32_t stats_size(void);
+static void stats_read(uint32_t offset, void* dst, uint32_t len);
+
+static FileProvider_t const stats_provider = {
+  .size = stats_size, .read = stats_read, .read_ahead = NULL
+};
+#endif
+
+#if (CFG_UF2_STATUS || CFG_UF2_INFO_JSON) && !CFG_UF2_APP_EXPORT
+// state of the update in STATUS.TXT and INFO.JSON
+enum {
+  STATUS_READY = 0,
+  STATUS_WRITING,
+  STATUS_DONE,        // written and verified, committed at the idle timeout, sync or eject
+  STATUS_FAILED,
+};
+
+static WriteState const* _status_state = NULL;   // of the session, set by uf2_write_block()
+static uint8_t _status_reported = STATUS_READY;
+
+static uint8_t status_get(void) {
+  WriteState const* st = _status_state;
+  if ( st == NULL ) return STATUS_READY;
+  if ( st->aborted ) return STATUS_FAILED;
+  if ( st->numBlocks == 0 ) return STATUS_READY;
+  return (st->numWritten >= st->numBlocks) ? STATUS_DONE : STATUS_WRITING;
+}
+
+static char const* const status_text[] = { "READY", "WRITING", "DONE", "FAILED" };
+
+// decimal digits of value ending before end, right aligned
+static void status_dec(char* end, uint32_t value) {
+  do {
+    *--end = (char) ('0' + value % 10);
+    value /= 10;
+  } while ( value );
+}
+#endif
+
+#if CFG_UF2_STATUS && !CFG_UF2_APP_EXPORT
+static uint32_t status_size(void);
+static void status_read(uint32_t offset, void* dst, uint32_t len);
+
+static FileProvider_t const status_provider = {
+  .size = status_size, .read = status_read, .read_ahead = NULL
+};
+#endif
+
+#if CFG_UF2_INFO_JSON && !CFG_UF2_APP_EXPORT
+static uint32_t info_json_size(void);
+static void info_json_read(uint32_t offset, void* dst, uint32_t len);
+
+static FileProvider_t const info_json_provider = {
+  .size = info_json_size, .read = info_json_read, .read_ahead = NULL
+};
+#endif
+
+#if CFG_UF2_CONFIG && !CFG_UF2_APP_EXPORT
+static uint32_t config_size(void);
+static void config_read(uint32_t offset, void* dst, uint32_t len);
+
+static FileProvider_t const config_provider = {
+  .size = config_size, .read = config_read, .read_ahead = NULL
+};
+#endif
+
+#if CFG_UF2_VERIFY && !CFG_UF2_APP_EXPORT
+static uint32_t verify_size(void);
+static void verify_read(uint32_t offset, void* dst, uint32_t len);
+
+static FileProvider_t const verify_provider = {
+  .size = verify_size, .read = verify_read, .read_ahead = NULL
+};
+#endif
+
+// Static files come first. Their sizes are known at compile time, so are their clusters,
+// init only lays out the dynamic files after CLUSTER_DYNAMIC.
+enum {
+  FID_INFO_UF2_TXT = 0,
+  FID_INDEX_HTM,
+#ifdef TINYUF2_FAVICON_HEADER
+  FID_AUTORUN_INF,
+  FID_FAVICON_ICO,
+#endif
+  FID_TEST_CSV,
+  NUM_STATIC_FILES
+};
+
+// serial number is 11 characters, flash size 8 hex digits
+#define INFO_UF2_TXT_SIZE \
+  (sizeof(infoUf2Head) - 1 + 11 + sizeof(infoUf2FlashSize) - 1 + 8 + sizeof(infoUf2Tail) - 1)
+
+#define FILE_CLUSTERS(_size)    UF2_DIV_CEIL(_size, BPB_BYTES_PER_CLUSTER)
+#define CLUSTER_SECTOR(_c)      (((uint32_t) (_c) - 2) << BPB_SECTORS_PER_CLUSTER_SHIFT)
+
+#define CLUSTER_INFO_UF2_TXT    (2 + ROOT_DIR_CLUSTERS)
+#define CLUSTER_INDEX_HTM       (CLUSTER_INFO_UF2_TXT + FILE_CLUSTERS(INFO_UF2_TXT_SIZE))
+#ifdef TINYUF2_FAVICON_HEADER
+  #define CLUSTER_AUTORUN_INF   (CLUSTER_INDEX_HTM + FILE_CLUSTERS(sizeof(indexFile) - 1))
+  #define CLUSTER_FAVICON_ICO   (CLUSTER_AUTORUN_INF + FILE_CLUSTERS(sizeof(autorunFile) - 1))
+  #define CLUSTER_TEST_CSV      (CLUSTER_FAVICON_ICO + FILE_CLUSTERS(sizeof(favicon_data)))
+#else
+  #define CLUSTER_TEST_CSV      (CLUSTER_INDEX_HTM + FILE_CLUSTERS(sizeof(indexFile) - 1))
+#endif
+#define CLUSTER_DYNAMIC         (CLUSTER_TEST_CSV + FILE_CLUSTERS(sizeof(test_csv_data) - 1))
+
+// Formats with per-chunk checksums have MEASERR.TXT
+#if CFG_UF2_MEASUREMENT_RING || CFG_UF2_MEASUREMENT_PACKED
+  #define MEASUREMENT_ERR_FILE \
+    {.name = "MEASERR TXT", .provider = &measurement_err_provider                   },
+#else
+  #define MEASUREMENT_ERR_FILE
+#endif
+
+#if CFG_UF2_MEASUREMENT_PARTITIONS > 1
+  #define MEASUREMENT_PARTITION_DIR \
+    {.name = "PARTIT~1   ", .long_name = "partitions", .dir = &measurement_partitions_dir },
+#else
+  #define MEASUREMENT_PARTITION_DIR
+#endif
+
+#if CFG_UF2_MEASUREMENT_CHANNEL_FILES
+  #define MEASUREMENT_CHANNEL_FILES \
+    {.name = "CT1     CSV", .provider = &ct1_provider                               }, \
+    {.name = "CT2     CSV", .provider = &ct2_provider                               }, \
+    {.name = "CT3     CSV", .provider = &ct3_provider                               },
+#else
+  #define MEASUREMENT_CHANNEL_FILES
+#endif
+
+// Files rendered from the measurement data, on the firmware volume or on their own with CFG_UF2_MEASUREMENT_LUN
+#if CFG_UF2_MEASUREMENT_BINARY
+  #define MEASUREMENT_FILES \
+    {.name = "MEASDAT CSV", .provider = &measurement_provider                       }, \
+    MEASUREMENT_GZ_FILE \
+    {.name = "MEASDAT BIN", .provider = &measurement_bin_provider                   }, \
+    MEASUREMENT_INDEX_FILE \
+    {.name = "LAST24H CSV", .provider = &last24h_provider                           }, \
+    {.name = "LAST7D  CSV", .provider = &last7d_provider                            }, \
+    {.name = "NEW     CSV", .provider = &measurement_new_provider                   }, \
+    {.name = "SUMMARY CSV", .provider = &summary_provider                           }, \
+    MEASUREMENT_CHANNEL_FILES \
+    MEASUREMENT_ERR_FILE \
+    {.name = "MEASUR~1   ", .long_name = "measurements", .dir = &measurement_days_dir   }, \
+    MEASUREMENT_PARTITION_DIR
+#else
+  #define MEASUREMENT_FILES \
+    {.name = "MEASDAT CSV", .provider = &measurement_provider                       }, \
+    MEASUREMENT_GZ_FILE \
+    MEASUREMENT_PARTITION_DIR
+#endif
+
+#define STATIC_FILE(_name, _content, _provider, _size, _cluster) \
+  { .name = _name, .content = _content, .provider = _provider, .size = _size, \
+    .cluster_start = _cluster, .cluster_end = (_cluster) + FILE_CLUSTERS(_size) - 1 }
+
+#if !CFG_UF2_APP_EXPORT
 static FileContent_t info[] = {
-    {.name = "INFO_UF2TXT", .content = infoUf2File , .size = sizeof(infoUf2File) - 1},
-    {.name = "INDEX   HTM", .content = indexFile   , .size = sizeof(indexFile  ) - 1},
+    [FID_INFO_UF2_TXT] = STATIC_FILE("INFO_UF2TXT", NULL, &info_txt_provider, INFO_UF2_TXT_SIZE, CLUSTER_INFO_UF2_TXT),
+    [FID_INDEX_HTM]    = STATIC_FILE("INDEX   HTM", indexFile, NULL, sizeof(indexFile) - 1, CLUSTER_INDEX_HTM),
 #ifdef TINYUF2_FAVICON_HEADER
-    {.name = "AUTORUN INF", .content = autorunFile , .size = sizeof(autorunFile) - 1},
-    {.name = "FAVICON ICO", .content = favicon_data, .size = favicon_len            },
+    [FID_AUTORUN_INF]  = STATIC_FILE("AUTORUN INF", autorunFile, NULL, sizeof(autorunFile) - 1, CLUSTER_AUTORUN_INF),
+    [FID_FAVICON_ICO]  = STATIC_FILE("FAVICON ICO", favicon_data, NULL, sizeof(favicon_data), CLUSTER_FAVICON_ICO),
 #endif
     // {.name = "SERIAL  BIN", .content = serialNumberHex, .size = sizeof(serialNumberHex)}, // remove this
-    {.name = "TEST    CSV", .content = test_csv_data, .size = sizeof(test_csv_data) - 1},
-    {.name = "MEASDAT CSV", .content = NULL, .size = 0},
-    // current.uf2 must be the last element and its content must be NULL
-    {.name = "CURRENT UF2", .content = NULL       , .size = 0                       },
+    [FID_TEST_CSV]     = STATIC_FILE("TEST    CSV", test_csv_data, NULL, sizeof(test_csv_data) - 1, CLUSTER_TEST_CSV),
+
+    // dynamic files, sizes are filled in by uf2_init()
+#if !CFG_UF2_MEASUREMENT_LUN
+    MEASUREMENT_FILES
+#endif
+#if CFG_UF2_BOOTLOG
+    {.name = "BOOTLOG TXT", .provider = &bootlog_provider                           },
+#endif
+#if CFG_UF2_STATS
+    {.name = "STATS   TXT", .provider = &stats_provider                             },
+#endif
+#if CFG_UF2_VERIFY
+    {.name = "VERIFY  TXT", .provider = &verify_provider                            },
+#endif
+#if CFG_UF2_STATUS
+    {.name = "STATUS  TXT", .provider = &status_provider                            },
+#endif
+#if CFG_UF2_INFO_JSON
+    {.name = "INFO~1  JSO", .long_name = "info.json", .provider = &info_json_provider },
+#endif
+#if CFG_UF2_CONFIG
+    {.name = "CONFIG  TXT", .provider = &config_provider                            },
+#endif
+#if CFG_UF2_WEAR
+    {.name = "WEAR    CSV", .provider = &wear_provider                              },
+#endif
+#if CFG_UF2_TRACE
+    {.name = "TRACE   BIN", .provider = &trace_provider                             },
+#endif
+#if CFG_UF2_ACCESS
+    {.name = "ACCESS  CSV", .provider = &access_provider                            },
+#endif
+#if CFG_UF2_CURRENT_BIN && !CFG_UF2_READBACK_PROTECT
+    {.name = "CURRENT BIN", .provider = &current_bin_provider                       },
+#endif
+#if CFG_UF2_FLASH_BIN && !CFG_UF2_READBACK_PROTECT
+    {.name = "FLASH   BIN", .provider = &flash_bin_provider                         },
+#endif
+    // current.uf2 must be the last element
+    {.name = "CURRENT UF2", .provider = &current_uf2_provider                       },
 };
 
 enum {
@@ -204,35 +779,194 @@ enum {
 };
 
 enum {
-  FID_INFO = 0,
-  FID_INDEX = 1,
-  FID_MEASURMENT_DATA = NUM_FILES - 2,
   FID_UF2 = NUM_FILES - 1,
 };
 
 STATIC_ASSERT(NUM_DIRENTRIES < BPB_ROOT_DIR_ENTRIES);  // FAT requirement -- Ensures BPB reserves sufficient entries for all files
-STATIC_ASSERT(NUM_DIRENTRIES < DIRENTRIES_PER_SECTOR); // GhostFAT bug workaround -- else, code overflows buffer
+#endif
+
+#if CFG_UF2_MEASUREMENT_LUN
+// read-only measurement volume, all of its files are dynamic
+static FileContent_t measurement_info[] = {
+    MEASUREMENT_FILES
+};
+#endif
+
+// Root entry of directory node lookup, other directories are identified by their info[] index
+#define DIR_ROOT  0xFFFFFFFFUL
+
+#if CFG_UF2_MEASUREMENT_LUN
+enum {
+  NUM_MEASUREMENT_FILES = sizeof(measurement_info) / sizeof(measurement_info[0])
+};
+
+STATIC_ASSERT(NUM_MEASUREMENT_FILES + 1 < BPB_ROOT_DIR_ENTRIES);
+
+// subdirectories are on the measurement volume only
+#define NUM_DIR_VOLUME_FILES  NUM_MEASUREMENT_FILES
+#else
+#define NUM_DIR_VOLUME_FILES  NUM_FILES
+#endif
+
+// First cluster of each subdirectory file, a directory's files use [child_first, child_first + child_count],
+// the last entry being the cluster past its last file
+static cluster_t _child_cluster_start[CFG_UF2_SUBDIR_FILES_MAX + NUM_DIR_VOLUME_FILES];
+
+#if !CFG_UF2_APP_EXPORT
+// First data-region relative sector of each file, files are laid out back to back in info[] order.
+// Last entry is the sector past the last file. Sorted ascending, dynamic part filled by init_starting_clusters()
+static uint32_t _file_sector_start[NUM_FILES + 1] = {
+  [FID_INFO_UF2_TXT] = CLUSTER_SECTOR(CLUSTER_INFO_UF2_TXT),
+  [FID_INDEX_HTM]    = CLUSTER_SECTOR(CLUSTER_INDEX_HTM),
+#ifdef TINYUF2_FAVICON_HEADER
+  [FID_AUTORUN_INF]  = CLUSTER_SECTOR(CLUSTER_AUTORUN_INF),
+  [FID_FAVICON_ICO]  = CLUSTER_SECTOR(CLUSTER_FAVICON_ICO),
+#endif
+  [FID_TEST_CSV]     = CLUSTER_SECTOR(CLUSTER_TEST_CSV),
+};
+
+// Sorted last cluster of every chain, used to place END_OF_CHAIN in FAT sectors. Static files
+// (and FAT32 root directory) are constant, the ones of dynamic files and directories follow at runtime.
+static cluster_t TINYUF2_CONST _static_chain_end[] = {
+#if CFG_UF2_FAT32
+  CLUSTER_INFO_UF2_TXT - 1,
+#endif
+  CLUSTER_INDEX_HTM - 1,
+#ifdef TINYUF2_FAVICON_HEADER
+  CLUSTER_AUTORUN_INF - 1,
+  CLUSTER_FAVICON_ICO - 1,
+#endif
+  CLUSTER_TEST_CSV - 1,
+  CLUSTER_DYNAMIC - 1,
+};
+
+static cluster_t _chain_end[NUM_FILES + CFG_UF2_SUBDIR_FILES_MAX];
+#endif
+
+#if CFG_UF2_MEASUREMENT_LUN
+static uint32_t _measurement_sector_start[NUM_MEASUREMENT_FILES + 1];
+static cluster_t _measurement_chain_end[NUM_MEASUREMENT_FILES + CFG_UF2_SUBDIR_FILES_MAX];
+
+#if CFG_UF2_FAT32
+// root directory only, there are no static files
+static cluster_t TINYUF2_CONST _measurement_static_chain_end[] = { 1 + ROOT_DIR_CLUSTERS };
+#endif
+#endif
+
+// A ghost FAT volume and the layout of its files. All volumes share the cluster size,
+// total and FAT size are of the largest volume (CFG_UF2_NUM_BLOCKS) unless fitted to the files.
+typedef struct {
+  FileContent_t* info;
+  uint32_t num_files;
+  uint32_t num_static;                // files at the start of info[] laid out at compile time
+  cluster_t cluster_dynamic;          // first cluster of the other ones, laid out by init_starting_clusters()
+
+  cluster_t const* static_chain_end;
+  uint32_t static_chain_end_count;
+  uint32_t* file_sector_start;        // num_files + 1 entries
+  cluster_t* chain_end;
+  uint32_t chain_end_count;
+  cluster_t* child_cluster_start;     // NULL if volume has no subdirectory
+  uint32_t child_cluster_max;
+  cluster_t first_unused_cluster;
+  uint32_t total_sectors;
+  uint32_t sectors_per_fat;
+
+  char const* label;
+  uint32_t serial;
+  bool tail_file;                     // last file (CURRENT.UF2) also covers the unused clusters
+} GhostVolume_t;
+
+#if !CFG_UF2_APP_EXPORT
+static GhostVolume_t _uf2_volume = {
+  .info = info, .num_files = NUM_FILES, .num_static = NUM_STATIC_FILES, .cluster_dynamic = CLUSTER_DYNAMIC,
+  .static_chain_end = _static_chain_end, .static_chain_end_count = UF2_ARRAY_SIZE(_static_chain_end),
+  .file_sector_start = _file_sector_start, .chain_end = _chain_end,
+#if !CFG_UF2_MEASUREMENT_LUN
+  .child_cluster_start = _child_cluster_start, .child_cluster_max = UF2_ARRAY_SIZE(_child_cluster_start),
+#endif
+  .total_sectors = BPB_TOTAL_SECTORS, .sectors_per_fat = BPB_SECTORS_PER_FAT,
+  .label = UF2_VOLUME_LABEL, .serial = 0x00420042, .tail_file = true
+};
+#endif
+
+#if CFG_UF2_MEASUREMENT_LUN
+static GhostVolume_t _measurement_volume = {
+  .info = measurement_info, .num_files = NUM_MEASUREMENT_FILES, .num_static = 0, .cluster_dynamic = 2 + ROOT_DIR_CLUSTERS,
+#if CFG_UF2_FAT32
+  .static_chain_end = _measurement_static_chain_end, .static_chain_end_count = UF2_ARRAY_SIZE(_measurement_static_chain_end),
+#endif
+  .file_sector_start = _measurement_sector_start, .chain_end = _measurement_chain_end,
+  .child_cluster_start = _child_cluster_start, .child_cluster_max = UF2_ARRAY_SIZE(_child_cluster_start),
+  .total_sectors = BPB_TOTAL_SECTORS, .sectors_per_fat = BPB_SECTORS_PER_FAT,
+  .label = UF2_MEASUREMENT_VOLUME_LABEL, .serial = 0x00420043, .tail_file = false
+};
+
+#define MEASUREMENT_VOLUME  (&_measurement_volume)
+#else
+#define MEASUREMENT_VOLUME  (&_uf2_volume)
+#endif
 
 #define NUM_SECTORS_IN_DATA_REGION (BPB_TOTAL_SECTORS - BPB_RESERVED_SECTORS - (BPB_NUMBER_OF_FATS * BPB_SECTORS_PER_FAT) - ROOT_DIR_SECTOR_COUNT)
 #define CLUSTER_COUNT              (NUM_SECTORS_IN_DATA_REGION / BPB_SECTORS_PER_CLUSTER)
 
+#if CFG_UF2_FAT32
+// Ensure cluster count results in a valid FAT32 volume, keeping 32 away from the limits as for FAT16
+STATIC_ASSERT( CLUSTER_COUNT >= 0xFFF5 && CLUSTER_COUNT < 0x0FFFFFF5 );
+STATIC_ASSERT( CLUSTER_COUNT >= 0x10015 && CLUSTER_COUNT < 0x0FFFFFD5 );
+#else
 // Ensure cluster count results in a valid FAT16 volume!
 STATIC_ASSERT( CLUSTER_COUNT >= 0x0FF5 && CLUSTER_COUNT < 0xFFF5 );
 
 // Many existing FAT implementations have small (1-16) off-by-one style errors
 // So, avoid being within 32 of those limits for even greater compatibility.
 STATIC_ASSERT( CLUSTER_COUNT >= 0x1015 && CLUSTER_COUNT < 0xFFD5 );
+#endif
 
-#define FS_START_FAT0_SECTOR      BPB_RESERVED_SECTORS
-#define FS_START_FAT1_SECTOR      (FS_START_FAT0_SECTOR + BPB_SECTORS_PER_FAT)
-#define FS_START_ROOTDIR_SECTOR   (FS_START_FAT1_SECTOR + BPB_SECTORS_PER_FAT)
-#define FS_START_CLUSTERS_SECTOR  (FS_START_ROOTDIR_SECTOR + ROOT_DIR_SECTOR_COUNT)
+// Regions of a volume, its FAT size is BPB_SECTORS_PER_FAT unless fitted by volume_fit()
+#define FS_START_FAT0_SECTOR           BPB_RESERVED_SECTORS
+#define FS_START_FAT1_SECTOR(_vol)     (FS_START_FAT0_SECTOR + (_vol)->sectors_per_fat)
+#define FS_START_ROOTDIR_SECTOR(_vol)  (FS_START_FAT0_SECTOR + BPB_NUMBER_OF_FATS * (_vol)->sectors_per_fat)
+#define FS_START_CLUSTERS_SECTOR(_vol) (FS_START_ROOTDIR_SECTOR(_vol) + ROOT_DIR_SECTOR_COUNT)
+
+// FAT32 root directory in the data region, before the first file
+#define ROOT_DIR_DATA_SECTORS     (ROOT_DIR_CLUSTERS << BPB_SECTORS_PER_CLUSTER_SHIFT)
 
 //--------------------------------------------------------------------+
 //
 //--------------------------------------------------------------------+
 
-static FAT_BootBlock TINYUF2_CONST BootBlock = {
+#if CFG_UF2_FAT32
+static FAT_BootSector TINYUF2_CONST BootSector = {
+  .bpb = {
+    .JumpInstruction      = {0xeb, 0x58, 0x90},
+    .OEMInfo              = "UF2 UF2 ",
+    .SectorSize           = BPB_SECTOR_SIZE,
+    .SectorsPerCluster    = BPB_SECTORS_PER_CLUSTER,
+    .ReservedSectors      = BPB_RESERVED_SECTORS,
+    .FATCopies            = BPB_NUMBER_OF_FATS,
+    .RootDirectoryEntries = 0,
+    .TotalSectors16       = 0,
+    .MediaDescriptor      = BPB_MEDIA_DESCRIPTOR_BYTE,
+    .SectorsPerFAT        = 0,
+    .SectorsPerTrack      = 1,
+    .Heads                = 1,
+    .TotalSectors32       = BPB_TOTAL_SECTORS,
+    .SectorsPerFAT32      = BPB_SECTORS_PER_FAT,
+    .RootCluster          = 2,
+    .FSInfoSector         = FSINFO_SECTOR,
+    .BackupBootSector     = BACKUP_BOOT_SECTOR,
+    .PhysicalDriveNum     = 0x80, // to match MediaDescriptor of 0xF8
+    .ExtendedBootSig      = 0x29,
+    .VolumeSerialNumber   = 0x00420042,
+    .VolumeLabel          = UF2_VOLUME_LABEL,
+    .FilesystemIdentifier = "FAT32   ",
+  },
+  .Signature = { 0x55, 0xaa },
+};
+#else
+static FAT_BootSector TINYUF2_CONST BootSector = {
+  .bpb = {
     .JumpInstruction      = {0xeb, 0x3c, 0x90},
     .OEMInfo              = "UF2 UF2 ",
     .SectorSize           = BPB_SECTOR_SIZE,
@@ -251,7 +985,10 @@ static FAT_BootBlock TINYUF2_CONST BootBlock = {
     .VolumeSerialNumber   = 0x00420042,
     .VolumeLabel          = UF2_VOLUME_LABEL,
     .FilesystemIdentifier = "FAT16   ",
+  },
+  .Signature = { 0x55, 0xaa },
 };
+#endif
 
 //--------------------------------------------------------------------+
 //
@@ -261,24 +998,112 @@ static inline bool is_uf2_block (UF2_Block const *bl) {
   return (bl->magicStart0 == UF2_MAGIC_START0) &&
          (bl->magicStart1 == UF2_MAGIC_START1) &&
          (bl->magicEnd == UF2_MAGIC_END) &&
+         (bl->payloadSize <= sizeof(bl->data)) &&
          (bl->flags & UF2_FLAG_FAMILYID) &&
          !(bl->flags & UF2_FLAG_NOFLASH);
 }
 
+#if CFG_UF2_FILE_CONTAINER
+// file container block: familyID holds the file size, the file name follows the payload
+static inline bool is_file_block (UF2_Block const *bl) {
+  return (bl->magicStart0 == UF2_MAGIC_START0) &&
+         (bl->magicStart1 == UF2_MAGIC_START1) &&
+         (bl->magicEnd == UF2_MAGIC_END) &&
+         (bl->payloadSize < sizeof(bl->data)) &&
+         (bl->flags & UF2_FLAG_FILE_CONTAINER) &&
+         !(bl->flags & UF2_FLAG_NOFLASH) &&
+         memchr(bl->data + bl->payloadSize, 0, sizeof(bl->data) - bl->payloadSize);
+}
+#endif
+
+static inline bool is_ack_block (Ack_Block const *bl) {
+  return (bl->magicStart0 == ACK_MAGIC_START0) &&
+         (bl->magicStart1 == ACK_MAGIC_START1) &&
+         (bl->magicEnd == ACK_MAGIC_END);
+}
+
+static inline bool is_erase_block (Erase_Block const *bl) {
+  return (bl->magicStart0 == ERASE_MAGIC_START0) &&
+         (bl->magicStart1 == ERASE_MAGIC_START1) &&
+         (bl->magicEnd == ERASE_MAGIC_END);
+}
+
+#if CFG_UF2_LKG_SNAPSHOT
+static inline bool is_rollback_block (Rollback_Block const *bl) {
+  return (bl->magicStart0 == ROLLBACK_MAGIC_START0) &&
+         (bl->magicStart1 == ROLLBACK_MAGIC_START1) &&
+         (bl->magicEnd == ROLLBACK_MAGIC_END);
+}
+#endif
+
+static inline bool is_sign_block (Sign_Block const *bl) {
+  return (bl->magicStart0 == SIGN_MAGIC_START0) &&
+         (bl->magicStart1 == SIGN_MAGIC_START1) &&
+         (bl->magicEnd == SIGN_MAGIC_END);
+}
+
+static inline bool is_verify_block (Verify_Block const *bl) {
+  return (bl->magicStart0 == VERIFY_MAGIC_START0) &&
+         (bl->magicStart1 == VERIFY_MAGIC_START1) &&
+         (bl->magicEnd == VERIFY_MAGIC_END);
+}
+
 static inline bool is_serialnum_block (SerialNum_Block const *bl) {
   return (bl->magicStart0 == SERIALNUM_MAGIC_START0) &&
          (bl->magicStart1 == SERIALNUM_MAGIC_START1) &&
          (bl->magicEnd == SERIALNUM_MAGIC_END);
 }
 
-esp_err_t serialnum_from_nvs(nvs_handle_t* nvs, uint8_t* serialNumberHex) {
-  size_t required_size = 0;
-  esp_err_t err = nvs_get_blob(*nvs, "serialnum", NULL, &required_size);
-  if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) return err;
-  if (required_size == 0) {
-    // serialNumberHex = { 0x01, 0x23, 0x45, 0x67, 0x89 };
-    serialNumberHex[0] = 0x01;
-    serialNumberHex[1] = 0x23;
+#if CFG_UF2_STATS && !CFG_UF2_APP_EXPORT
+static inline bool is_bench_block (Bench_Block const *bl) {
+  return (bl->magicStart0 == BENCH_MAGIC_START0) &&
+         (bl->magicStart1 == BENCH_MAGIC_START1) &&
+         (bl->magicEnd == BENCH_MAGIC_END);
+}
+
+static uint32_t bench_kb_s(uint32_t len, uint32_t us) {
+  return us ? (uint32_t) ((uint64_t) len * 1000000 / 1024 / us) : 0;
+}
+
+// Time WRITE10 from the first to the last benchmark block, then measure raw flash. Results are
+// published in STATS.TXT, the medium change makes the host read it again
+static void bench_block_write(Bench_Block const* bl) {
+  static uint32_t start_us;
+  static uint32_t count;
+
+  if ( bl->blockNo == 0 ) {
+    start_us = TUF2_STATS_US();
+    count = 0;
+  }
+  count++;
+
+  if ( bl->numBlocks == 0 || bl->blockNo != bl->numBlocks - 1 ) return;
+
+  // block 0 was already transferred when its time was taken
+  uint32_t const elapsed_us = TUF2_STATS_US() - start_us;
+  tuf2_stats.bench_usb_kb_s = (count > 1) ? bench_kb_s((count - 1) * BPB_SECTOR_SIZE, elapsed_us) : 0;
+
+  board_flash_bench_t res;
+  if ( board_flash_benchmark && board_flash_benchmark(&res) ) {
+    tuf2_stats.bench_erase_kb_s = bench_kb_s(res.len, res.erase_us);
+    tuf2_stats.bench_program_kb_s = bench_kb_s(res.len, res.program_us);
+    tuf2_stats.bench_read_kb_s = bench_kb_s(res.len, res.read_us);
+  }
+
+  TUF2_LOG1("Benchmark: usb %lu, erase %lu, program %lu, read %lu KB/s\r\n", tuf2_stats.bench_usb_kb_s,
+            tuf2_stats.bench_erase_kb_s, tuf2_stats.bench_program_kb_s, tuf2_stats.bench_read_kb_s);
+  _info_changed = true;
+}
+#endif
+
+esp_err_t serialnum_from_nvs(nvs_handle_t* nvs, uint8_t* serialNumberHex) {
+  size_t required_size = 0;
+  esp_err_t err = nvs_get_blob(*nvs, "serialnum", NULL, &required_size);
+  if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) return err;
+  if (required_size == 0) {
+    // serialNumberHex = { 0x01, 0x23, 0x45, 0x67, 0x89 };
+    serialNumberHex[0] = 0x01;
+    serialNumberHex[1] = 0x23;
     serialNumberHex[2] = 0x45;
     serialNumberHex[3] = 0x67;
     serialNumberHex[4] = 0x89;
@@ -291,104 +1116,232 @@ esp_err_t serialnum_from_nvs(nvs_handle_t* nvs, uint8_t* serialNumberHex) {
   return ESP_OK;
 }
 
-size_t get_measurment_data_size_nvs(nvs_handle_t* nvs){
-  uint32_t size;
-  size_t required_size = sizeof(size);
-  esp_err_t err = nvs_get_blob(*nvs, "measurment_data_size", &size, &required_size);
-  if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) return 512;
-  return size;
+#if CFG_UF2_RETAINED_CACHE
+// Kept across resets, random after power up: only used when magic and check match
+typedef struct {
+  uint32_t magic;
+  uint8_t serial_hex[6];   // as read from NVS
+  uint8_t serial_valid;
+  uint8_t ack_valid;
+  uint32_t measurement_units; // 0xFFFFFFFF if not known
+  uint32_t ack_timestamp;     // NEW.CSV watermark as read from NVS
+  uint32_t check;
+} RetainedCache_t;
+
+#define RETAINED_CACHE_MAGIC  0x43524655UL // "UFRC"
+
+static TINYUF2_RETAINED_ATTR RetainedCache_t _retained;
+
+static uint32_t retained_check(RetainedCache_t const* cache) {
+  // rotate-xor of all words before check, enough against random content
+  uint32_t const* word = (uint32_t const*) cache;
+  uint32_t sum = RETAINED_CACHE_MAGIC;
+  for ( uint32_t i = 0; i < offsetof(RetainedCache_t, check) / 4; i++ ) {
+    sum = ((sum << 5) | (sum >> 27)) ^ word[i];
+  }
+  return sum;
 }
 
-esp_err_t serialnum_to_nvs(uint8_t serialNumberHex[6]) {
-  nvs_handle_t nvs;
-  esp_err_t err = nvs_open("storage", NVS_READWRITE, &nvs);
-  if (err != ESP_OK) return err;
+static bool retained_valid(void) {
+  return _retained.magic == RETAINED_CACHE_MAGIC && _retained.check == retained_check(&_retained);
+}
 
-  err = nvs_set_blob(nvs, "serialnum", serialNumberHex, 6);
-  if (err != ESP_OK) return err;
+static void retained_save(void) {
+  _retained.magic = RETAINED_CACHE_MAGIC;
+  _retained.check = retained_check(&_retained);
+}
 
-  // Commit
-  err = nvs_commit(nvs);
-  if (err != ESP_OK) return err;
+static void retained_clear(void) {
+  memset(&_retained, 0, sizeof(_retained));
+  _retained.measurement_units = 0xFFFFFFFFUL;
+  retained_save();
+}
+#endif
 
-  //close
-  nvs_close(nvs);
-  esp_restart();
-  return ESP_OK;
+#if !CFG_UF2_MEASUREMENT_RING && !CFG_UF2_MEASUREMENT_PACKED
+static bool measurement_unit_erased(uint32_t unit) {
+  uint8_t buf[MEASUREMENT_UNIT_SIZE < 4 ? MEASUREMENT_UNIT_SIZE : 4];
+  board_measuremnt_data_read(unit * MEASUREMENT_UNIT_SIZE, buf, sizeof(buf));
+
+  for (uint32_t i = 0; i < sizeof(buf); i++) {
+    if (buf[i] != 0xff) return false;
+  }
+  return true;
 }
+#endif
 
-esp_err_t init_nvs_partition(void) {
-  esp_err_t err = nvs_flash_init();
-  if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-    ESP_ERROR_CHECK(nvs_flash_erase());
-    err = nvs_flash_init();
+// Get length of valid measurement data by binary search for the first erased unit
+// in ota1, takes about log2(partition size) small reads
+static uint32_t measurement_scan_size(void) {
+  // firmware only session, measurement files stay empty
+  if ( handoff_mode(UF2_HANDOFF_MODE_FIRMWARE) || measurement_erasing() ) return 0;
+
+#if CFG_UF2_MEASUREMENT_RING
+  // ring headers locate the valid records, an end cached as size of the plain array does not apply
+  return measurement_ring_scan();
+#elif CFG_UF2_MEASUREMENT_PACKED
+  // records are counted from the block headers
+  return measurement_pack_scan();
+#else
+  uint32_t lo = 0;
+  uint32_t hi = board_measuremnt_data_size() / MEASUREMENT_UNIT_SIZE;
+
+  // end given by the application or cached from an earlier scan
+  uint32_t cached = 0xFFFFFFFFUL;
+  if ( handoff_has(UF2_HANDOFF_MEASUREMENT) ) {
+    cached = _handoff->measurement_size / MEASUREMENT_UNIT_SIZE;
   }
-  return err;
+#if CFG_UF2_RETAINED_CACHE
+  else if ( retained_valid() ) {
+    cached = _retained.measurement_units;
+  }
+#endif
+
+  // application may have appended data since, end is still valid if it is still the boundary
+  // between written and erased units: two reads instead of the search
+  if ( cached <= hi && (cached == hi || measurement_unit_erased(cached)) &&
+       (cached == 0 || !measurement_unit_erased(cached - 1)) ) {
+    return cached * MEASUREMENT_UNIT_SIZE;
+  }
+
+  while (lo < hi) {
+    uint32_t const mid = lo + (hi - lo) / 2;
+    if (measurement_unit_erased(mid)) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+
+#if CFG_UF2_RETAINED_CACHE
+  if ( !retained_valid() ) retained_clear();
+  _retained.measurement_units = lo;
+  retained_save();
+#endif
+
+  return lo * MEASUREMENT_UNIT_SIZE;
+#endif
 }
 
-// cache the cluster start offset for each file
-// this allows more flexible algorithms w/o O(n) time
-static void init_starting_clusters(void) {
-  // +2 because FAT decided first data sector would be in cluster number 2, rather than zero
-  uint16_t start_cluster = 2;
+#if CFG_UF2_MEASUREMENT_PARTITIONS > 1
+STATIC_ASSERT(CFG_UF2_MEASUREMENT_PARTITIONS <= 10); // single digit file names
+
+// Written length of the partitions after the first, updated by measurement_refresh()
+static uint32_t _partition_size[CFG_UF2_MEASUREMENT_PARTITIONS - 1];
+
+static uint32_t partition_file_count(void) {
+  uint32_t count = board_measurement_partition_count ? board_measurement_partition_count() : 0;
+  if ( count > CFG_UF2_MEASUREMENT_PARTITIONS ) count = CFG_UF2_MEASUREMENT_PARTITIONS;
+  return count ? count - 1 : 0;
+}
+
+static void partition_file_name(uint32_t i, char name[11], char* long_name) {
+  memcpy(name, "MEAS0   BIN", 11);
+  name[4] = (char) ('1' + i);
+  long_name[0] = 0;
+}
 
-  for (uint16_t i = 0; i < NUM_FILES; i++) {
-    info[i].cluster_start = start_cluster;
-    info[i].cluster_end = start_cluster + UF2_DIV_CEIL(info[i].size, BPB_SECTOR_SIZE*BPB_SECTORS_PER_CLUSTER) - 1;
+static uint32_t partition_file_size(uint32_t i) {
+  return _partition_size[i];
+}
+
+static void partition_file_read(uint32_t i, uint32_t offset, void* dst, uint32_t len) {
+  board_measurement_partition_read(i + 1, offset, dst, len);
+}
+
+static bool partition_unit_erased(uint32_t part, uint32_t unit) {
+  uint8_t buf[MEASUREMENT_UNIT_SIZE < 4 ? MEASUREMENT_UNIT_SIZE : 4];
+  board_measurement_partition_read(part, unit * MEASUREMENT_UNIT_SIZE, buf, sizeof(buf));
 
-    start_cluster = info[i].cluster_end + 1;
+  for (uint32_t i = 0; i < sizeof(buf); i++) {
+    if (buf[i] != 0xff) return false;
   }
+  return true;
 }
 
-// get file index for file that uses the cluster
-// if cluster is past last file, returns ( NUM_FILES-1 ).
-//
-// Caller must still check if a particular *sector*
-// contains data from the file's contents, as there
-// are often padding sectors, including all the unused
-// sectors past the end of the media.
-static uint32_t info_index_of(uint32_t cluster) {
-  // default results for invalid requests is the index of the last file (CURRENT.UF2)
-  if (cluster >= 0xFFF0) return FID_UF2;
+// Binary search for the written end of each extra partition, return true if any of them changed
+static bool partitions_scan(void) {
+  bool changed = false;
+  uint32_t const count = partition_file_count();
+
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t lo = 0;
+    uint32_t hi = (handoff_mode(UF2_HANDOFF_MODE_FIRMWARE) || measurement_erasing()) ? 0 :
+                  board_measurement_partition_size(i + 1) / MEASUREMENT_UNIT_SIZE;
+
+    while (lo < hi) {
+      uint32_t const mid = lo + (hi - lo) / 2;
+      if (partition_unit_erased(i + 1, mid)) {
+        hi = mid;
+      } else {
+        lo = mid + 1;
+      }
+    }
 
-  for (uint32_t i = 0; i < NUM_FILES; i++) {
-    if ( (info[i].cluster_start <= cluster) && (cluster <= info[i].cluster_end) ) {
-      return i;
+    if ( _partition_size[i] != lo * MEASUREMENT_UNIT_SIZE ) {
+      _partition_size[i] = lo * MEASUREMENT_UNIT_SIZE;
+      changed = true;
     }
   }
 
-  return FID_UF2;
+  return changed;
 }
+#endif
 
-static void u32_to_hexstr(uint32_t value, char* buffer) {
-  const char hexDigits[] = "0123456789ABCDEF";
-  size_t i;
+esp_err_t serialnum_to_nvs(uint8_t serialNumberHex[6]) {
+  nvs_handle_t nvs;
+  esp_err_t err = nvs_open("storage", NVS_READWRITE, &nvs);
+  if (err != ESP_OK) return err;
 
-  for (i = 0; i < 8; i++) {
-    buffer[i] = hexDigits[(value >> (28 - i * 4)) & 0xF];
+  err = nvs_set_blob(nvs, "serialnum", serialNumberHex, 6);
+  if (err == ESP_OK) err = nvs_commit(nvs);
+
+  nvs_close(nvs);
+  return err;
+}
+
+esp_err_t init_nvs_partition(void) {
+  esp_err_t err = nvs_flash_init();
+  if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+    ESP_ERROR_CHECK(nvs_flash_erase());
+    err = nvs_flash_init();
   }
-  buffer[i] = '\0';
+  return err;
 }
 
-static void u8_to_hexstr(uint8_t value[], size_t arr_len, char* buffer) {
-  const char hexDigits[] = "0123456789ABCDEF";
-  size_t i;
+#if !CFG_UF2_APP_EXPORT
+#if CFG_UF2_RETAINED_CACHE
+static void serial_cache(uint8_t const serial_hex[6]) {
+  if ( !retained_valid() ) retained_clear();
+  memcpy(_retained.serial_hex, serial_hex, sizeof(_retained.serial_hex));
+  _retained.serial_valid = 1;
+  retained_save();
+}
+#endif
 
-  for (i = 0; i < arr_len; i++) {
-    buffer[i * 2] = hexDigits[(value[i] >> 4) & 0xF];  // High nibble
-    buffer[i * 2 + 1] = hexDigits[value[i] & 0xF];      // Low nibble
+// ADDED BY ENERTY
+// Serial number is loaded from NVS when INFO_UF2.TXT is first rendered or a serial number is written,
+// NVS page scan (or erase) then does not delay USB enumeration
+static void serial_load(void) {
+  if ( _serial_loaded ) return;
+  _serial_loaded = true;
+
+  if ( handoff_has(UF2_HANDOFF_SERIAL) ) {
+    memcpy(_serial_hex, _handoff->serial_hex, sizeof(_serial_hex));
+    return;
   }
-  buffer[i * 2] = '\0';  // Null terminator at the end
-}
 
-void uf2_init(void) {
-  // TODO maybe limit to application size only if possible board_flash_app_size()
-  _flash_size = board_flash_size();
-  // update CURRENT.UF2 file size
-  info[FID_UF2].size = UF2_BYTE_COUNT;
+#if CFG_UF2_RETAINED_CACHE
+  if ( retained_valid() && _retained.serial_valid ) {
+    memcpy(_serial_hex, _retained.serial_hex, sizeof(_serial_hex));
+    return;
+  }
+#endif
+
+  // burnt in by the board, a single read without NVS
+  if ( board_serial_read && board_serial_read(_serial_hex) ) return;
 
-  // ADDED BY ENERTY
-  uint8_t serialNumberHex[6];
+  uint8_t* serialNumberHex = _serial_hex;
   esp_err_t err = init_nvs_partition(); // initialize the NVS partition for serial number storage
   if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND){
     serialNumberHex[0] = 0x10;
@@ -407,7 +1360,7 @@ void uf2_init(void) {
     serialNumberHex[5] = 0x00;
   } else{
     nvs_handle_t nvs;
-    esp_err_t err = nvs_open("storage", NVS_READONLY, &nvs);
+    err = nvs_open("storage", NVS_READONLY, &nvs);
     // Replace AAAAAAAAAAA with the actual serial number
     err = serialnum_from_nvs(&nvs, serialNumberHex);
     if (err == ESP_ERR_INVALID_SIZE){
@@ -433,290 +1386,2816 @@ void uf2_init(void) {
       serialNumberHex[4] = 0x11;
       serialNumberHex[5] = 0x00;
     }
-    char serialNumber[12];  // 11 characters + null terminator
-    u8_to_hexstr(serialNumberHex + 1, 5, serialNumber + 1); // the first byte should not be converted, it is the hardware identifier and already a character
-    serialNumber[0] = serialNumberHex[0];  // the first byte is a character
+    nvs_close(nvs);
 
-    // Find and replace "AAAAAAAAAAA" in the info file
-    char *serialPosition = strstr(infoUf2File, "AAAAAAAAAAA");
-    if (serialPosition != NULL) {
-      // Replace the AAAAAAAAAAA with the actual serial number
-      strncpy(serialPosition, serialNumber, 11);  // 10 characters (no null terminator)
-    }
+#if CFG_UF2_RETAINED_CACHE
+    // only a serial number read from NVS is cached, error placeholders are retried next time
+    if ( err == ESP_OK ) serial_cache(serialNumberHex);
+#endif
+  }
+}
+#endif
 
-    // get the size measurment data from the NVS+
-    _measurement_flash_size = get_measurment_data_size_nvs(&nvs);
-    info[FID_MEASURMENT_DATA].size = MEASURMENT_BYTE_COUNT;
-    nvs_close(nvs);
+#if CFG_UF2_MEASUREMENT_BINARY
+// ADDED BY ENERTY
+// NEW.CSV watermark, loaded from NVS before the measurement files are first rendered
+static bool _ack_loaded = false;
+static bool _ack_changed = false; // measurement files need to be rendered again
+
+static void ack_load(void) {
+  if ( _ack_loaded ) return;
+  _ack_loaded = true;
+
+#if CFG_UF2_RETAINED_CACHE
+  if ( retained_valid() && _retained.ack_valid ) {
+    measurement_new_set_watermark(_retained.ack_timestamp);
+    return;
   }
-  
-  // update INFO_UF2.TXT with flash size if having enough space (8 bytes)
-  size_t txt_len = strlen(infoUf2File);
-  size_t const max_len = sizeof(infoUf2File) - 1;
-  if ( max_len - txt_len > 8) {
-    u32_to_hexstr(_flash_size, infoUf2File + txt_len);
-    txt_len += 8;
+#endif
 
-    if (max_len - txt_len > 6) {
-      strcpy(infoUf2File + txt_len, " bytes");
-      txt_len += 6;
-    }
+  // nothing acknowledged yet: every record is new
+  uint32_t timestamp = 0;
+  size_t size = sizeof(timestamp);
+  nvs_handle_t nvs;
+  esp_err_t err = init_nvs_partition();
+  if ( err == ESP_OK ) err = nvs_open("storage", NVS_READONLY, &nvs);
+  if ( err == ESP_OK ) {
+    err = nvs_get_blob(nvs, "meas_ack", &timestamp, &size);
+    nvs_close(nvs);
   }
-  info[FID_INFO].size = txt_len;
+  if ( err != ESP_OK || size != sizeof(timestamp) ) timestamp = 0;
 
-  init_starting_clusters(); // fill the info struct with cluster start and end values
-}
+  measurement_new_set_watermark(timestamp);
 
-/*------------------------------------------------------------------*/
-/* Read CURRENT.UF2
- *------------------------------------------------------------------*/
-void padded_memcpy (char *dst, char const *src, int len) {
-  for ( int i = 0; i < len; ++i ) {
-    if ( *src ) {
-      *dst = *src++;
-    } else {
-      *dst = ' ';
-    }
-    dst++;
+#if CFG_UF2_RETAINED_CACHE
+  // not found is also a valid answer, other errors are retried next time
+  if ( err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND ) {
+    if ( !retained_valid() ) retained_clear();
+    _retained.ack_timestamp = timestamp;
+    _retained.ack_valid = 1;
+    retained_save();
   }
+#endif
 }
 
-void uf2_read_block (uint32_t block_no, uint8_t *data) {
-  memset(data, 0, BPB_SECTOR_SIZE);
-  uint32_t sectionRelativeSector = block_no;
+#if !CFG_UF2_APP_EXPORT
+static bool measurement_refresh(void);
 
-  if ( block_no == 0 ) {
-    // Request was for the Boot block
-    memcpy(data, &BootBlock, sizeof(BootBlock));
-    data[510] = 0x55;    // Always at offsets 510/511, even when BPB_SECTOR_SIZE is larger
-    data[511] = 0xaa;    // Always at offsets 510/511, even when BPB_SECTOR_SIZE is larger
-  }
-  else if ( block_no < FS_START_ROOTDIR_SECTOR ) {
-    // Request was for a FAT table sector
-    sectionRelativeSector -= FS_START_FAT0_SECTOR;
+// Host acknowledged records up to a timestamp: store the watermark, NEW.CSV shrinks at the next refresh
+static bool ack_write(Ack_Block const* ack) {
+  if ( !_measurement_scanned ) measurement_refresh();
 
-    // second FAT is same as the first... use sectionRelativeSector to write data
-    if ( sectionRelativeSector >= BPB_SECTORS_PER_FAT ) {
-      sectionRelativeSector -= BPB_SECTORS_PER_FAT;
-    }
+  uint32_t const timestamp = (ack->timestamp == ACK_TIMESTAMP_ALL) ? measurement_newest_timestamp() : ack->timestamp;
 
-    uint16_t* data16 = (uint16_t*) (void*) data;
-    uint32_t sectorFirstCluster = sectionRelativeSector * FAT_ENTRIES_PER_SECTOR;
-    uint32_t firstUnusedCluster = info[FID_UF2].cluster_end + 1;
+  // same block sent again by host OS re-sending the sector
+  if ( timestamp == measurement_new_watermark() ) return true;
 
-    // OPTIMIZATION:
-    // Because all files are contiguous, the FAT CHAIN entries
-    // are all set to (cluster+1) to point to the next cluster.
-    // All clusters past the last used cluster of the last file
-    // are set to zero.
-    //
-    // EXCEPTIONS:
-    // 1. Clusters 0 and 1 require special handling
-    // 2. Final cluster of each file must be set to END_OF_CHAIN
-    //
+  nvs_handle_t nvs;
+  esp_err_t err = nvs_open("storage", NVS_READWRITE, &nvs);
+  if ( err != ESP_OK ) return false;
 
-    // Set default FAT values first.
-    for (uint16_t i = 0; i < FAT_ENTRIES_PER_SECTOR; i++) {
-      uint32_t cluster = i + sectorFirstCluster;
-      if (cluster >= firstUnusedCluster) {
-        data16[i] = 0;
-      }
-      else {
-        data16[i] = cluster + 1;
-      }
-    }
+  err = nvs_set_blob(nvs, "meas_ack", &timestamp, sizeof(timestamp));
+  if ( err == ESP_OK ) err = nvs_commit(nvs);
+  nvs_close(nvs);
+  if ( err != ESP_OK ) return false;
 
-    // Exception #1: clusters 0 and 1 need special handling
-    if (sectionRelativeSector == 0) {
-      data[0] = BPB_MEDIA_DESCRIPTOR_BYTE;
-      data[1] = 0xff;
-      data16[1] = FAT_END_OF_CHAIN; // cluster 1 is reserved
-    }
-
-    // Exception #2: the final cluster of each file must be set to END_OF_CHAIN
-    for (uint32_t i = 0; i < NUM_FILES; i++) {
-      uint32_t lastClusterOfFile = info[i].cluster_end;
-      if (lastClusterOfFile >= sectorFirstCluster) {
-        uint32_t idx = lastClusterOfFile - sectorFirstCluster;
-        if (idx < FAT_ENTRIES_PER_SECTOR) {
-          // that last cluster of the file is in this sector
-          data16[idx] = FAT_END_OF_CHAIN;
-        }
-      }
-    }
-  }
-  else if ( block_no < FS_START_CLUSTERS_SECTOR ) {
-    // Request was for a (root) directory sector .. root because not supporting subdirectories (yet)
-    sectionRelativeSector -= FS_START_ROOTDIR_SECTOR;
+  TUF2_LOG1("Measurements acknowledged up to %lu\r\n", timestamp);
+  measurement_new_set_watermark(timestamp);
+  _ack_changed = true;
+
+#if CFG_UF2_RETAINED_CACHE
+  if ( !retained_valid() ) retained_clear();
+  _retained.ack_timestamp = timestamp;
+  _retained.ack_valid = 1;
+  retained_save();
+#endif
+  return true;
+}
+#endif
+#endif
 
-    DirEntry *d = (void*) data;                   // pointer to next free DirEntry this sector
-    int remainingEntries = DIRENTRIES_PER_SECTOR; // remaining count of DirEntries this sector
+#if CFG_UF2_MEASUREMENT_ERASE && !CFG_UF2_APP_EXPORT
+// Host clears the measurement data after storing it: start the background erase, measurement
+// files are empty at the next refresh. Sent again while erasing or after it is accepted as well
+static bool erase_write(Erase_Block const* er) {
+  serial_load();
+  if ( 0 != memcmp(_serial_hex, er->serialNumber, sizeof(_serial_hex)) ) return false;
 
-    uint32_t startingFileIndex;
+  return board_measurement_erase && board_measurement_erase();
+}
+#endif
 
-    if ( sectionRelativeSector == 0 ) {
-      // volume label is first directory entry
-      padded_memcpy(d->name, (char const*) BootBlock.VolumeLabel, 11);
-      d->attrs = 0x28;
-      d++;
-      remainingEntries--;
+#if CFG_UF2_LKG_SNAPSHOT
+// Restore the app of before the last update, the host sees a write error if there is no snapshot
+static bool rollback_write(Rollback_Block const* rb, WriteState* state) {
+  serial_load();
+  if ( 0 != memcmp(_serial_hex, rb->serialNumber, sizeof(_serial_hex)) ) return false;
 
-      startingFileIndex = 0;
-    }else {
-      // -1 to account for volume label in first sector
-      startingFileIndex = DIRENTRIES_PER_SECTOR * sectionRelativeSector - 1;
-    }
+  // host OS re-sending the sector
+  if ( state->rolledBack ) return true;
 
-    for ( uint32_t fileIndex = startingFileIndex;
-          remainingEntries > 0 && fileIndex < NUM_FILES; // while space remains in buffer and more files to add...
-          fileIndex++, d++ ) {
-      // WARNING -- code presumes all files take exactly one directory entry (no long file names!)
-      uint32_t const startCluster = info[fileIndex].cluster_start;
+  if ( !board_flash_rollback || !board_flash_rollback() ) return false;
 
-      FileContent_t const *inf = &info[fileIndex];
-      padded_memcpy(d->name, inf->name, 11);
-      d->createTimeFine   = COMPILE_SECONDS_INT % 2 * 100;
-      d->createTime       = COMPILE_DOS_TIME;
-      d->createDate       = COMPILE_DOS_DATE;
-      d->lastAccessDate   = COMPILE_DOS_DATE;
-      d->highStartCluster = startCluster >> 16;
-      d->updateTime       = COMPILE_DOS_TIME;
-      d->updateDate       = COMPILE_DOS_DATE;
-      d->startCluster     = startCluster & 0xFFFF;
-      d->size             = (inf->content ? inf->size : UF2_BYTE_COUNT);
-    }
-  }
-  else if ( block_no < BPB_TOTAL_SECTORS ) {
-    // Request was to read from the data area (files, unused space, ...)
-    sectionRelativeSector -= FS_START_CLUSTERS_SECTOR;
+  // CURRENT.UF2 and the files describing the app changed
+  _info_changed = true;
+  state->rolledBack = true;
+  return true;
+}
+#endif
 
-    // plus 2 for first data cluster offset
-    uint32_t fid = info_index_of(2 + sectionRelativeSector / BPB_SECTORS_PER_CLUSTER);
-    FileContent_t const * inf = &info[fid];
+static uint32_t dir_entry_count(GhostVolume_t const* vol, uint32_t dir);
 
-    uint32_t fileRelativeSector = sectionRelativeSector - (info[fid].cluster_start-2) * BPB_SECTORS_PER_CLUSTER;
+// Last generated sector of a volume, dropped when its layout changes
+typedef struct {
+  GhostVolume_t const* vol;
+  uint32_t sector;
+  uint8_t data[BPB_SECTOR_SIZE];
+} sector_memo_t;
 
-    if ( fid != FID_UF2 && fid != FID_MEASURMENT_DATA ) {
-      // Handle all files other than CURRENT.UF2
-      size_t fileContentStartOffset = fileRelativeSector * BPB_SECTOR_SIZE;
-      size_t fileContentLength = inf->size;
+static sector_memo_t _fat_memo;
+#if !CFG_UF2_FAT32
+static sector_memo_t _root_memo; // the fixed root directory region, FAT32 has its root in clusters
+#endif
 
-      // nothing to copy if already past the end of the file (only when >1 sector per cluster)
-      if (fileContentLength > fileContentStartOffset) {
-        // obviously, 2nd and later sectors should not copy data from the start
-        const void * dataStart = (inf->content) + fileContentStartOffset;
-        // limit number of bytes of data to be copied to remaining valid bytes
-        size_t bytesToCopy = fileContentLength - fileContentStartOffset;
-        // and further limit that to a single sector at a time
-        if (bytesToCopy > BPB_SECTOR_SIZE) {
-          bytesToCopy = BPB_SECTOR_SIZE;
-        }
-        memcpy(data, dataStart, bytesToCopy);
-      }
-    }
-    else if(fid == FID_UF2) {
-      // CURRENT.UF2: generate data on-the-fly
-      uint32_t addr = BOARD_FLASH_APP_START + (fileRelativeSector * UF2_FIRMWARE_BYTES_PER_SECTOR);
-      if ( addr < (BOARD_FLASH_ADDR_ZERO + _flash_size) ) {
-        UF2_Block *bl = (void*) data;
-        bl->magicStart0 = UF2_MAGIC_START0;
-        bl->magicStart1 = UF2_MAGIC_START1;
-        bl->magicEnd = UF2_MAGIC_END;
-        bl->blockNo = fileRelativeSector;
-        bl->numBlocks = UF2_SECTOR_COUNT;
-        bl->targetAddr = addr;
-        bl->payloadSize = UF2_FIRMWARE_BYTES_PER_SECTOR;
-        bl->flags = UF2_FLAG_FAMILYID;
-        bl->familyID = BOARD_UF2_FAMILY_ID;
-
-        board_flash_read(addr, bl->data, bl->payloadSize);
-      }
-    }
-    else {
-      // Handle all files other than CURRENT.UF2
-      size_t fileContentStartOffset = (fileRelativeSector * BPB_SECTOR_SIZE);
-      size_t fileContentLength = inf->size;
-
-            // nothing to copy if already past the end of the file (only when >1 sector per cluster)
-      if (fileContentLength > fileContentStartOffset) {
-        // limit number of bytes of data to be copied to remaining valid bytes
-        size_t bytesToCopy = fileContentLength - fileContentStartOffset;
-        // and further limit that to a single sector at a time
-        if (bytesToCopy > BPB_SECTOR_SIZE) {
-          bytesToCopy = BPB_SECTOR_SIZE;
-        }
-        board_measuremnt_data_read(fileContentStartOffset, data, bytesToCopy);
+// cache the cluster start offset for each file
+// this allows more flexible algorithms w/o O(n) time
+static void init_starting_clusters(GhostVolume_t* vol) {
+  if ( _fat_memo.vol == vol ) _fat_memo.vol = NULL;
+#if !CFG_UF2_FAT32
+  if ( _root_memo.vol == vol ) _root_memo.vol = NULL;
+#endif
+
+  // static files are laid out at compile time
+  cluster_t start_cluster = vol->cluster_dynamic;
+  uint32_t child = 0;
+
+  vol->chain_end_count = 0;
+
+  for (uint16_t i = vol->num_static; i < vol->num_files; i++) {
+    FileContent_t* inf = &vol->info[i];
+    uint32_t size = inf->size;
+
+    if ( inf->dir ) {
+      // directory's own clusters hold ".", ".." and the entries of its files
+      uint32_t count = inf->dir->count();
+      if ( count > vol->child_cluster_max - 1 - child ) {
+        count = vol->child_cluster_max - 1 - child;
+        TUF2_LOG1("Too many files in %.11s, limited to %lu\r\n", inf->name, count);
       }
+      inf->child_first = (uint16_t) child;
+      inf->child_count = (uint16_t) count;
+      size = dir_entry_count(vol, i) * sizeof(DirEntry);
     }
-  }
-}
 
-/*------------------------------------------------------------------*/
-/* Write UF2
- *------------------------------------------------------------------*/
+    inf->cluster_start = start_cluster;
+    inf->cluster_end = start_cluster + FILE_CLUSTERS(size) - 1;
+    start_cluster = inf->cluster_end + 1;
 
-/**
- * Write an uf2 block wrapped by 512 sector.
- * @return number of bytes processed, only 3 following values
- *  -1 : if not an uf2 block
- * 512 : write is successful (BPB_SECTOR_SIZE == 512)
- *   0 : is busy with flashing, tinyusb stack will call write_block again with the same parameters later on
- */
-int uf2_write_block (uint32_t block_no, uint8_t *data, WriteState *state) {
-  (void) block_no;
-  UF2_Block *bl = (void*) data;
+    // empty files have no clusters, hence no chain end
+    if ( size ) vol->chain_end[vol->chain_end_count++] = inf->cluster_end;
 
-  if ( !is_uf2_block(bl) ) {
-    // added by ENERTY
-    SerialNum_Block *sn = (void*) data;
-    if ( is_serialnum_block(sn) ) {
-      // write serial number to nvs
-      esp_err_t err = serialnum_to_nvs(sn->serialNumber);
-      if (err != ESP_OK) {
-        return -1;
+    if ( inf->dir ) {
+      for (uint32_t c = 0; c < inf->child_count; c++) {
+        cluster_t clusters = FILE_CLUSTERS(inf->dir->size(c));
+        vol->child_cluster_start[child + c] = start_cluster;
+        start_cluster += clusters;
+        if ( clusters ) vol->chain_end[vol->chain_end_count++] = start_cluster - 1;
       }
-      return BPB_SECTOR_SIZE;
+      vol->child_cluster_start[child + inf->child_count] = start_cluster;
+      child += inf->child_count + 1;
     }
-    return -1;
   }
 
-  if (bl->familyID == BOARD_UF2_FAMILY_ID) {
-    // generic family ID
-    board_flash_write(bl->targetAddr, bl->data, bl->payloadSize);
-  }else {
-    // TODO family matches VID/PID
-    return -1;
+  for (uint16_t i = vol->num_static; i < vol->num_files; i++) {
+    vol->file_sector_start[i] = CLUSTER_SECTOR(vol->info[i].cluster_start);
   }
+  vol->file_sector_start[vol->num_files] = CLUSTER_SECTOR(start_cluster);
+  vol->first_unused_cluster = start_cluster;
+}
 
-  //------------- Update written blocks -------------//
-  if ( bl->numBlocks ) {
-    // Update state num blocks if needed
-    if ( state->numBlocks != bl->numBlocks ) {
-      if ( bl->numBlocks >= MAX_BLOCKS || state->numBlocks ) {
-        state->numBlocks = 0xffffffff;
-      }
-      else {
-        state->numBlocks = bl->numBlocks;
-      }
+// Set END_OF_CHAIN for every chain end of the sorted table that falls in this FAT sector
+static void fat_mark_chain_end(fat_entry_t* fat, uint32_t first_cluster, cluster_t const* table, uint32_t count) {
+  // lower bound of first_cluster
+  uint32_t lo = 0;
+  uint32_t hi = count;
+  while ( lo < hi ) {
+    uint32_t mid = (lo + hi) / 2;
+    if ( table[mid] < first_cluster ) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
     }
+  }
 
-    if ( bl->blockNo < MAX_BLOCKS ) {
-      uint8_t const mask = 1 << (bl->blockNo % 8);
-      uint32_t const pos = bl->blockNo / 8;
+  for (; lo < count && table[lo] - first_cluster < FAT_ENTRIES_PER_SECTOR; lo++) {
+    fat[table[lo] - first_cluster] = FAT_END_OF_CHAIN;
+  }
+}
 
-      // only increase written number with new write (possibly prevent overwriting from OS)
-      if ( !(state->writtenMask[pos] & mask) ) {
-        state->writtenMask[pos] |= mask;
-        state->numWritten++;
-      }
+// get file index for file that uses the data-region relative sector, binary search of
+// the boundary table. If sector is past last file, returns the last one (FID_UF2 on the firmware volume).
+//
+// Caller must still check if a particular *sector*
+// contains data from the file's contents, as there
+// are often padding sectors, including all the unused
+// sectors past the end of the media.
+static uint32_t info_index_of(GhostVolume_t const* vol, uint32_t sectionRelativeSector) {
+  // default results for sectors past the last file is the index of the last file (CURRENT.UF2)
+  if ( sectionRelativeSector >= vol->file_sector_start[vol->num_files] ) return vol->num_files - 1;
 
-      // flush last blocks
-      // TODO numWritten can be smaller than numBlocks if return early
-      if ( state->numWritten >= state->numBlocks ) {
-        board_flash_flush();
-      }
+  // find last file starting at or before sector, empty files share their start with the next one
+  uint32_t lo = 0;
+  uint32_t hi = vol->num_files - 1;
+  while ( lo < hi ) {
+    uint32_t const mid = (lo + hi + 1) / 2;
+    if ( vol->file_sector_start[mid] <= sectionRelativeSector ) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
     }
   }
 
-  return BPB_SECTOR_SIZE;
+  return lo;
 }
+
+#if !CFG_UF2_APP_EXPORT
+static void u32_to_hexstr(uint32_t value, char* buffer) {
+  const char hexDigits[] = "0123456789ABCDEF";
+  size_t i;
+
+  for (i = 0; i < 8; i++) {
+    buffer[i] = hexDigits[(value >> (28 - i * 4)) & 0xF];
+  }
+  buffer[i] = '\0';
+}
+
+static void u8_to_hexstr(uint8_t value[], size_t arr_len, char* buffer) {
+  const char hexDigits[] = "0123456789ABCDEF";
+  size_t i;
+
+  for (i = 0; i < arr_len; i++) {
+    buffer[i * 2] = hexDigits[(value[i] >> 4) & 0xF];  // High nibble
+    buffer[i * 2 + 1] = hexDigits[value[i] & 0xF];      // Low nibble
+  }
+  buffer[i * 2] = '\0';  // Null terminator at the end
+}
+#endif
+
+#if !CFG_UF2_APP_EXPORT && (CFG_UF2_VOLUME_SERIAL_UNIQUE || CFG_UF2_VOLUME_LABEL_SUFFIX || CFG_UF2_STATUS || CFG_UF2_INFO_JSON)
+// USB serial as hex string, same as the string descriptor and what the host sees as device serial
+static char _usb_serial[33];
+
+static void usb_serial_load(void) {
+  uint8_t serial_id[16];
+  uint8_t len = board_usb_get_serial(serial_id);
+  if ( len > sizeof(serial_id) ) len = sizeof(serial_id);
+  u8_to_hexstr(serial_id, len, _usb_serial);
+}
+#endif
+
+#if !CFG_UF2_APP_EXPORT && (CFG_UF2_VOLUME_SERIAL_UNIQUE || CFG_UF2_VOLUME_LABEL_SUFFIX)
+STATIC_ASSERT(CFG_UF2_VOLUME_LABEL_SUFFIX <= 8);
+
+static char _uf2_label[12];
+#if CFG_UF2_MEASUREMENT_LUN
+static char _measurement_label[12];
+#endif
+
+// Several devices on one hub: serial number is a hash (FNV-1a) of the USB serial, index keeps the
+// volumes of one device apart. Label keeps as much of base as fits before the last hex digits
+static void volume_identity(GhostVolume_t* vol, char const* base, char label[12], uint32_t index) {
+#if CFG_UF2_VOLUME_SERIAL_UNIQUE
+  uint32_t hash = 2166136261UL;
+  for ( char const* p = _usb_serial; *p; p++ ) hash = (hash ^ (uint8_t) *p) * 16777619UL;
+  vol->serial = hash + index;
+#else
+  (void) index;
+#endif
+
+#if CFG_UF2_VOLUME_LABEL_SUFFIX
+  size_t const serial_len = strlen(_usb_serial);
+  size_t const n = (serial_len < CFG_UF2_VOLUME_LABEL_SUFFIX) ? serial_len : CFG_UF2_VOLUME_LABEL_SUFFIX;
+  size_t keep = strnlen(base, 11);
+  if ( keep > 11 - n ) keep = 11 - n;
+
+  memset(label, 0, 12);
+  memcpy(label, base, keep);
+  memcpy(label + keep, _usb_serial + serial_len - n, n);
+  vol->label = label;
+#if !CFG_UF2_FAT32
+  if ( _root_memo.vol == vol ) _root_memo.vol = NULL;
+#endif
+#else
+  (void) base;
+  (void) label;
+#endif
+}
+#endif
+
+// file sizes of providers depend on flash and measurement sizes
+static void update_file_sizes(GhostVolume_t* vol) {
+  for (uint32_t i = vol->num_static; i < vol->num_files; i++) {
+    if ( vol->info[i].provider ) vol->info[i].size = vol->info[i].provider->size();
+  }
+
+  init_starting_clusters(vol); // fill the info struct with cluster start and end values
+}
+
+#if CFG_UF2_VOLUME_FIT && !CFG_UF2_APP_EXPORT
+// Smallest cluster count of a FAT16/FAT32 volume, 32 away from the limit as for the static asserts
+#if CFG_UF2_FAT32
+  #define VOLUME_FIT_MIN_CLUSTERS  0x10015
+#else
+  #define VOLUME_FIT_MIN_CLUSTERS  0x1015
+#endif
+
+// Shrink the volume to its laid out files plus room for headroom bytes of uploads, hosts read and
+// scan the whole FAT on mount. Never larger than CFG_UF2_NUM_BLOCKS
+static void volume_fit(GhostVolume_t* vol, uint32_t headroom) {
+  uint32_t clusters = (vol->first_unused_cluster - 2) + FILE_CLUSTERS(headroom);
+  if ( clusters < VOLUME_FIT_MIN_CLUSTERS ) clusters = VOLUME_FIT_MIN_CLUSTERS;
+
+  // FAT also has the entries of clusters 0 and 1
+  uint32_t const sectors_per_fat = UF2_DIV_CEIL(clusters + 2, FAT_ENTRIES_PER_SECTOR);
+  uint32_t const total_sectors = BPB_RESERVED_SECTORS + BPB_NUMBER_OF_FATS * sectors_per_fat + ROOT_DIR_SECTOR_COUNT +
+                                 (clusters << BPB_SECTORS_PER_CLUSTER_SHIFT);
+  if ( total_sectors >= BPB_TOTAL_SECTORS ) return;
+
+  vol->total_sectors = total_sectors;
+  vol->sectors_per_fat = sectors_per_fat;
+  TUF2_LOG1("Volume fitted to %lu sectors\r\n", total_sectors);
+}
+#endif
+
+void uf2_init(void) {
+  _handoff = board_handoff ? board_handoff() : NULL;
+
+#if !CFG_UF2_APP_EXPORT
+  _flash_size = board_flash_size();
+
+  // limit CURRENT.UF2 to application image if its size is known, skipping padding after it.
+  // Logs only session or readback protected: empty
+  _uf2_size = _flash_size;
+  if ( handoff_mode(UF2_HANDOFF_MODE_LOGS) || CFG_UF2_READBACK_PROTECT == 2 ) {
+    _uf2_size = 0;
+  } else if ( board_flash_app_size ) {
+    uint32_t const app_size = board_flash_app_size();
+    if ( app_size && app_size < _flash_size ) {
+      _uf2_size = UF2_DIV_CEIL(app_size, UF2_FIRMWARE_BYTES_PER_SECTOR) * UF2_FIRMWARE_BYTES_PER_SECTOR;
+      if ( _uf2_size > _flash_size ) _uf2_size = _flash_size;
+    }
+  }
+
+#if CFG_UF2_CURRENT_BIN && !CFG_UF2_READBACK_PROTECT
+  _bin_size = _uf2_size;
+  if ( _uf2_size && board_flash_app_size ) {
+    uint32_t const app_size = board_flash_app_size();
+    if ( app_size && app_size < _flash_size ) _bin_size = app_size;
+  }
+#endif
+#endif
+
+  // Pass over measurement data is deferred to the first host access, so that it does not delay
+  // USB enumeration. Until then the measurement files are empty.
+  _measurement_flash_size = 0;
+  _measurement_scanned = false;
+#if CFG_UF2_MEASUREMENT_PARTITIONS > 1
+  memset(_partition_size, 0, sizeof(_partition_size));
+#endif
+#if !CFG_UF2_APP_EXPORT && (CFG_UF2_VOLUME_SERIAL_UNIQUE || CFG_UF2_VOLUME_LABEL_SUFFIX || CFG_UF2_STATUS || CFG_UF2_INFO_JSON)
+  usb_serial_load();
+#endif
+#if !CFG_UF2_APP_EXPORT && (CFG_UF2_VOLUME_SERIAL_UNIQUE || CFG_UF2_VOLUME_LABEL_SUFFIX)
+  volume_identity(&_uf2_volume, UF2_VOLUME_LABEL, _uf2_label, 0);
+#if CFG_UF2_MEASUREMENT_LUN
+  volume_identity(&_measurement_volume, UF2_MEASUREMENT_VOLUME_LABEL, _measurement_label, 1);
+#endif
+#endif
+
+#if !CFG_UF2_APP_EXPORT
+  update_file_sizes(&_uf2_volume);
+#if CFG_UF2_VOLUME_FIT
+  // largest upload is an image of the whole app partition with 256 byte payloads
+  volume_fit(&_uf2_volume, UF2_DIV_CEIL(_flash_size, 256) * BPB_SECTOR_SIZE + CFG_UF2_VOLUME_FIT_EXTRA);
+#endif
+#endif
+#if CFG_UF2_MEASUREMENT_LUN
+  update_file_sizes(&_measurement_volume);
+#endif
+
+  _uf2_ready = true;
+}
+
+// uf2_init() is done, USB may already be running before
+bool uf2_ready(void) {
+  return _uf2_ready;
+}
+
+#if !CFG_UF2_APP_EXPORT
+uint32_t uf2_block_count(void) {
+  return _uf2_volume.total_sectors;
+}
+
+#if CFG_UF2_ACCESS
+uint8_t tuf2_access_region(uint32_t lba) {
+  GhostVolume_t const* vol = &_uf2_volume;
+
+  if ( lba < FS_START_FAT0_SECTOR ) return TUF2_ACCESS_BOOT;
+  if ( lba < FS_START_ROOTDIR_SECTOR(vol) ) return TUF2_ACCESS_FAT;
+  if ( lba < FS_START_CLUSTERS_SECTOR(vol) + ROOT_DIR_DATA_SECTORS ) return TUF2_ACCESS_DIR;
+  if ( lba >= vol->total_sectors ) return TUF2_ACCESS_OUTSIDE;
+
+  // CURRENT.UF2 covers the unused clusters when reading, a host writing there is adding a file
+  uint32_t const rel = lba - FS_START_CLUSTERS_SECTOR(vol);
+  if ( (rel >> BPB_SECTORS_PER_CLUSTER_SHIFT) + 2 >= vol->first_unused_cluster ) return TUF2_ACCESS_FREE;
+
+  uint32_t const fid = info_index_of(vol, rel);
+  if ( vol->info[fid].dir ) return TUF2_ACCESS_DIR;
+  return (vol->tail_file && fid == vol->num_files - 1) ? TUF2_ACCESS_CURRENT_UF2 : TUF2_ACCESS_FILE;
+}
+#endif
+#endif
+
+uint32_t uf2_measurement_data_size(void) {
+  return measurement_scan_size();
+}
+
+uint32_t uf2_measurement_unit_size(void) {
+  return MEASUREMENT_UNIT_SIZE;
+}
+
+void uf2_measurement_data_read(uint32_t offset, void* buffer, uint32_t len) {
+#if CFG_UF2_MEASUREMENT_RING
+  measurement_ring_read(offset, buffer, len);
+#elif CFG_UF2_MEASUREMENT_PACKED
+  measurement_pack_read(offset, buffer, len);
+#else
+  measurement_cache_read(offset, buffer, len);
+#endif
+}
+
+void uf2_measurement_data_read_ahead(uint32_t offset, uint32_t len) {
+#if CFG_UF2_MEASUREMENT_RING
+  measurement_ring_read_ahead(offset, len);
+#elif CFG_UF2_MEASUREMENT_PACKED
+  measurement_pack_read_ahead(offset, len);
+#else
+  if ( board_measuremnt_data_read_ahead ) board_measuremnt_data_read_ahead(offset, len);
+#endif
+}
+
+// Rescan measurement data, return true if the files changed since the host read their volume
+static bool measurement_refresh(void) {
+#if CFG_UF2_APP_EXPORT
+  // sectors written since they were cached, data below their old size is appended to only
+  if ( _measurement_changed ) {
+    _measurement_changed = false;
+    measurement_cache_invalidate();
+  }
+#endif
+
+  uint32_t const size = measurement_scan_size();
+
+#if CFG_UF2_MEASUREMENT_PARTITIONS > 1
+  bool const parts_changed = partitions_scan();
+#else
+  bool const parts_changed = false;
+#endif
+
+#if CFG_UF2_MEASUREMENT_BINARY
+  ack_load();
+  bool const acked = _ack_changed;
+  _ack_changed = false;
+#else
+  bool const acked = false;
+#endif
+
+  // first scan: host has not seen the directory yet, no medium change to report
+  if ( !_measurement_scanned ) {
+    _measurement_scanned = true;
+    _measurement_flash_size = size;
+    update_file_sizes(MEASUREMENT_VOLUME);
+    return false;
+  }
+
+  if ( size == _measurement_flash_size && !acked && !parts_changed ) return false;
+
+  if ( size != _measurement_flash_size ) {
+    TUF2_LOG1("Measurement data size changed: %lu -> %lu\r\n", _measurement_flash_size, size);
+    measurement_cache_invalidate();
+  }
+  _measurement_flash_size = size;
+  update_file_sizes(MEASUREMENT_VOLUME);
+
+  return true;
+}
+
+#if CFG_UF2_APP_EXPORT
+void uf2_measurement_changed(void) {
+  _measurement_changed = true;
+}
+#endif
+
+#if CFG_UF2_WRITE_OVERLAY_SECTORS && !CFG_UF2_APP_EXPORT
+// Non-uf2 sectors written by the host to the firmware volume, see CFG_UF2_WRITE_OVERLAY_SECTORS
+typedef struct {
+  uint32_t lba;
+  uint32_t stamp;     // last use, 0 if slot is free
+  uint8_t data[BPB_SECTOR_SIZE];
+} OverlaySector_t;
+
+static OverlaySector_t _overlay[CFG_UF2_WRITE_OVERLAY_SECTORS];
+static uint32_t _overlay_stamp = 0;
+
+// Store a sector written by the host, replacing its older version or the least recently used one
+static void overlay_write(uint32_t lba, uint8_t const* data) {
+  OverlaySector_t* slot = &_overlay[0];
+  for ( uint32_t i = 0; i < CFG_UF2_WRITE_OVERLAY_SECTORS; i++ ) {
+    if ( _overlay[i].stamp && _overlay[i].lba == lba ) {
+      slot = &_overlay[i];
+      break;
+    }
+    if ( _overlay[i].stamp < slot->stamp ) slot = &_overlay[i];
+  }
+
+  slot->lba = lba;
+  slot->stamp = ++_overlay_stamp;
+  memcpy(slot->data, data, sizeof(slot->data));
+}
+
+#if CFG_UF2_RAW_BIN || CFG_UF2_CONFIG
+// Host's version of a sector, NULL if it is not kept
+static uint8_t const* overlay_find(uint32_t lba) {
+  for ( uint32_t i = 0; i < CFG_UF2_WRITE_OVERLAY_SECTORS; i++ ) {
+    if ( _overlay[i].stamp && _overlay[i].lba == lba ) return _overlay[i].data;
+  }
+  return NULL;
+}
+#endif
+
+// Replace generated sectors of a read by the host's version
+static void overlay_apply(uint32_t block_no, uint32_t block_count, uint8_t* data) {
+  for ( uint32_t i = 0; i < CFG_UF2_WRITE_OVERLAY_SECTORS; i++ ) {
+    OverlaySector_t* slot = &_overlay[i];
+    if ( slot->stamp && slot->lba - block_no < block_count ) {
+      memcpy(data + (slot->lba - block_no) * BPB_SECTOR_SIZE, slot->data, sizeof(slot->data));
+      slot->stamp = ++_overlay_stamp;
+    }
+  }
+}
+#endif
+
+#if !CFG_UF2_APP_EXPORT
+bool uf2_refresh(void) {
+#if CFG_UF2_STATUS || CFG_UF2_INFO_JSON
+  // station polls STATUS.TXT or INFO.JSON, make the host read it again once the update has ended. Not while
+  // writing, a medium change in the middle of the copy would drop the host's view of the volume
+  uint8_t const status = status_get();
+  if ( status != _status_reported && status >= STATUS_DONE ) _info_changed = true;
+  _status_reported = status;
+#endif
+
+  bool const info_changed = _info_changed;
+  _info_changed = false;
+
+#if CFG_UF2_MEASUREMENT_LUN
+  // measurement data is on its own volume, firmware volume does not need a scan
+  bool const changed = info_changed;
+#else
+  bool const changed = measurement_refresh() || info_changed;
+#endif
+
+#if CFG_UF2_VERIFY
+  // VERIFY.TXT grows with the report
+  if ( info_changed ) update_file_sizes(&_uf2_volume);
+#endif
+
+#if CFG_UF2_WRITE_OVERLAY_SECTORS
+  // host re-reads the volume after a medium change, its writes were made against the old layout
+  if ( changed ) memset(_overlay, 0, sizeof(_overlay));
+#endif
+
+  return changed;
+}
+#endif
+
+#if CFG_UF2_MEASUREMENT_LUN
+bool uf2_measurement_refresh(void) {
+  return measurement_refresh();
+}
+#endif
+
+/*------------------------------------------------------------------*/
+/* Read CURRENT.UF2
+ *------------------------------------------------------------------*/
+void padded_memcpy (char *dst, char const *src, int len) {
+  for ( int i = 0; i < len; ++i ) {
+    if ( *src ) {
+      *dst = *src++;
+    } else {
+      *dst = ' ';
+    }
+    dst++;
+  }
+}
+
+//--------------------------------------------------------------------+
+// Directory generator
+//--------------------------------------------------------------------+
+
+// Get n-th node of a directory (DIR_ROOT or info[] index of a subdirectory), return false past the last one.
+// Root starts with the volume label, a subdirectory with "." and "..".
+static bool dir_node_get(GhostVolume_t const* vol, uint32_t dir, uint32_t n, DirNode_t* node) {
+  memset(node, 0, sizeof(DirNode_t));
+
+  if ( dir == DIR_ROOT ) {
+    if ( n == 0 ) {
+      padded_memcpy(node->name, vol->label, 11);
+      node->attrs = DIR_ATTR_VOLUME_LABEL;
+      return true;
+    }
+    if ( n - 1 >= vol->num_files ) return false;
+
+    FileContent_t const* inf = &vol->info[n - 1];
+    padded_memcpy(node->name, inf->name, 11);
+    if ( inf->long_name ) strncpy(node->long_name, inf->long_name, DIR_LONG_NAME_MAX);
+    node->attrs = inf->dir ? DIR_ATTR_DIRECTORY : 0;
+    node->cluster = inf->cluster_start;
+    node->size = inf->dir ? 0 : inf->size;
+    return true;
+  }
+
+  FileContent_t const* inf = &vol->info[dir];
+  if ( n < 2 ) {
+    // "." is this directory, ".." is root (cluster 0)
+    padded_memcpy(node->name, n ? ".." : ".", 11);
+    node->attrs = DIR_ATTR_DIRECTORY;
+    node->cluster = n ? 0 : inf->cluster_start;
+    return true;
+  }
+  if ( n - 2 >= inf->child_count ) return false;
+
+  uint32_t const c = n - 2;
+  inf->dir->name(c, node->name, node->long_name);
+  node->long_name[DIR_LONG_NAME_MAX] = 0;
+  node->cluster = vol->child_cluster_start[inf->child_first + c];
+  node->size = inf->dir->size(c);
+  return true;
+}
+
+static uint32_t lfn_entry_count(DirNode_t const* node) {
+  return UF2_DIV_CEIL(strlen(node->long_name), LFN_CHARS_PER_ENTRY);
+}
+
+// Number of 32-byte entries of a directory
+static uint32_t dir_entry_count(GhostVolume_t const* vol, uint32_t dir) {
+  DirNode_t node;
+  uint32_t count = 0;
+  for ( uint32_t n = 0; dir_node_get(vol, dir, n, &node); n++ ) count += 1 + lfn_entry_count(&node);
+  return count;
+}
+
+static uint8_t lfn_checksum(char const name[11]) {
+  uint8_t sum = 0;
+  for ( uint32_t i = 0; i < 11; i++ ) sum = (uint8_t) (((sum & 1) << 7) + (sum >> 1) + (uint8_t) name[i]);
+  return sum;
+}
+
+// Fill LFN entry holding characters of sequence number seq (1-based), highest sequence is stored first
+static void lfn_fill(uint8_t* e, DirNode_t const* node, uint32_t seq, bool last) {
+  uint32_t const len = strlen(node->long_name);
+
+  e[0] = (uint8_t) (seq | (last ? 0x40 : 0));
+  e[11] = DIR_ATTR_LONG_NAME;
+  e[13] = lfn_checksum(node->name);
+
+  // name is NUL terminated only if it does not fill the entry, remaining characters are 0xFFFF
+  for ( uint32_t i = 0; i < LFN_CHARS_PER_ENTRY; i++ ) {
+    uint32_t const idx = (seq - 1) * LFN_CHARS_PER_ENTRY + i;
+    uint16_t const ch = (idx < len) ? (uint8_t) node->long_name[idx] : (idx == len) ? 0x0000 : 0xFFFF;
+    e[_lfn_char_offset[i]] = (uint8_t) ch;
+    e[_lfn_char_offset[i] + 1] = (uint8_t) (ch >> 8);
+  }
+}
+
+static void dirent_fill(DirEntry* d, DirNode_t const* node) {
+  memcpy(d->name, node->name, 11);
+  d->attrs = node->attrs;
+  if ( node->attrs == DIR_ATTR_VOLUME_LABEL ) return;
+
+  d->createTimeFine   = COMPILE_SECONDS_INT % 2 * 100;
+  d->createTime       = COMPILE_DOS_TIME;
+  d->createDate       = COMPILE_DOS_DATE;
+  d->lastAccessDate   = COMPILE_DOS_DATE;
+  d->highStartCluster = node->cluster >> 16;
+  d->updateTime       = COMPILE_DOS_TIME;
+  d->updateDate       = COMPILE_DOS_DATE;
+  d->startCluster     = node->cluster & 0xFFFF;
+  d->size             = node->size;
+}
+
+// Fill a directory-relative sector, data must be zeroed. LFN entries of a node may span two sectors.
+static void render_dir_sector(GhostVolume_t const* vol, uint32_t dir, uint32_t sector, uint8_t* data) {
+  uint32_t const first = sector * DIRENTRIES_PER_SECTOR;
+  uint32_t const last = first + DIRENTRIES_PER_SECTOR;
+  uint32_t pos = 0; // index of first entry of current node
+  DirNode_t node;
+
+  for ( uint32_t n = 0; pos < last && dir_node_get(vol, dir, n, &node); n++ ) {
+    uint32_t const lfn_count = lfn_entry_count(&node);
+
+    for ( uint32_t k = 0; k <= lfn_count; k++, pos++ ) {
+      if ( pos < first || pos >= last ) continue;
+
+      uint8_t* e = data + (pos - first) * sizeof(DirEntry);
+      if ( k < lfn_count ) {
+        lfn_fill(e, &node, lfn_count - k, k == 0);
+      } else {
+        dirent_fill((DirEntry*) (void*) e, &node);
+      }
+    }
+  }
+}
+
+// Fill a single sector of the boot/FAT/root directory region
+static void read_fs_sector (GhostVolume_t const* vol, uint32_t block_no, uint8_t *data) {
+  uint32_t sectionRelativeSector = block_no;
+
+#if CFG_UF2_FAT32
+  if ( block_no == 0 || block_no == BACKUP_BOOT_SECTOR ) {
+#else
+  if ( block_no == 0 ) {
+#endif
+    // Request was for the Boot block, label and serial number tell the volumes apart
+    memcpy(data, &BootSector, BPB_SECTOR_SIZE);
+    FAT_BootBlock* boot = (FAT_BootBlock*) (void*) data;
+    boot->VolumeSerialNumber = vol->serial;
+#if CFG_UF2_FAT32
+    boot->TotalSectors32 = vol->total_sectors;
+    boot->SectorsPerFAT32 = vol->sectors_per_fat;
+#else
+    boot->TotalSectors16 = (vol->total_sectors > 0xFFFF) ? 0 : (uint16_t) vol->total_sectors;
+    boot->TotalSectors32 = (vol->total_sectors > 0xFFFF) ? vol->total_sectors : 0;
+    boot->SectorsPerFAT = (uint16_t) vol->sectors_per_fat;
+#endif
+    memset(boot->VolumeLabel, 0, sizeof(boot->VolumeLabel));
+    memcpy(boot->VolumeLabel, vol->label, strnlen(vol->label, sizeof(boot->VolumeLabel)));
+    return;
+  }
+
+#if !CFG_UF2_FAT32
+  // root directory changes with the layout only, hosts read it again on every mount and directory poll
+  if ( block_no >= FS_START_ROOTDIR_SECTOR(vol) && _root_memo.vol == vol &&
+       _root_memo.sector == block_no - FS_START_ROOTDIR_SECTOR(vol) ) {
+    memcpy(data, _root_memo.data, BPB_SECTOR_SIZE);
+    return;
+  }
+#endif
+
+  memset(data, 0, BPB_SECTOR_SIZE);
+
+#if CFG_UF2_FAT32
+  if ( block_no == FSINFO_SECTOR || block_no == BACKUP_BOOT_SECTOR + FSINFO_SECTOR ) {
+    // FSInfo: signatures only, free cluster count and next free cluster are unknown
+    uint32_t* data32 = (uint32_t*) (void*) data;
+    data32[0]   = 0x41615252UL;
+    data32[121] = 0x61417272UL;
+    data32[122] = 0xFFFFFFFFUL;
+    data32[123] = 0xFFFFFFFFUL;
+    data32[127] = 0xAA550000UL;
+  }
+  else if ( block_no < FS_START_FAT0_SECTOR ) {
+    // rest of reserved sectors are zero
+  }
+  else
+#endif
+  if ( block_no < FS_START_ROOTDIR_SECTOR(vol) ) {
+    // Request was for a FAT table sector
+    sectionRelativeSector -= FS_START_FAT0_SECTOR;
+
+    // second FAT is same as the first... use sectionRelativeSector to write data
+    if ( sectionRelativeSector >= vol->sectors_per_fat ) {
+      sectionRelativeSector -= vol->sectors_per_fat;
+    }
+
+    // both FATs are read at mount, the second one by the same index: served from the last one generated
+    if ( _fat_memo.vol == vol && _fat_memo.sector == sectionRelativeSector ) {
+      memcpy(data, _fat_memo.data, BPB_SECTOR_SIZE);
+      return;
+    }
+
+    fat_entry_t* fat = (fat_entry_t*) (void*) data;
+    uint32_t sectorFirstCluster = sectionRelativeSector * FAT_ENTRIES_PER_SECTOR;
+    uint32_t firstUnusedCluster = vol->first_unused_cluster;
+
+    // OPTIMIZATION:
+    // Because all files are contiguous, the FAT CHAIN entries
+    // are all set to (cluster+1) to point to the next cluster.
+    // All clusters past the last used cluster of the last file
+    // are set to zero.
+    //
+    // EXCEPTIONS:
+    // 1. Clusters 0 and 1 require special handling
+    // 2. Final cluster of each file must be set to END_OF_CHAIN
+    //
+
+    // Set default FAT values first: a single split at the first unused cluster, the sector is
+    // already zero past it
+    uint32_t used = (firstUnusedCluster > sectorFirstCluster) ? firstUnusedCluster - sectorFirstCluster : 0;
+    if ( used > FAT_ENTRIES_PER_SECTOR ) used = FAT_ENTRIES_PER_SECTOR;
+#if CFG_UF2_FAT32
+    for (uint32_t i = 0; i < used; i++) {
+      fat[i] = sectorFirstCluster + i + 1;
+    }
+#else
+    // two entries per 32-bit store, the lower cluster in the low half (little endian)
+    uint32_t* pair = (uint32_t*) (void*) data;
+    uint32_t value = (sectorFirstCluster + 1) | ((sectorFirstCluster + 2) << 16);
+    for (uint32_t i = 0; i < used / 2; i++) {
+      pair[i] = value;
+      value += 0x00020002UL;
+    }
+    if ( used & 1 ) fat[used - 1] = (fat_entry_t) (sectorFirstCluster + used);
+#endif
+
+    // Exception #1: clusters 0 and 1 need special handling
+    if (sectionRelativeSector == 0) {
+      fat[0] = FAT_MEDIA_ENTRY;
+      fat[1] = FAT_END_OF_CHAIN; // cluster 1 is reserved
+    }
+
+    // Exception #2: the final cluster of each file (and FAT32 root directory) must be set to END_OF_CHAIN,
+    // both tables are sorted and only the few ends within this sector are visited
+    fat_mark_chain_end(fat, sectorFirstCluster, vol->static_chain_end, vol->static_chain_end_count);
+    fat_mark_chain_end(fat, sectorFirstCluster, vol->chain_end, vol->chain_end_count);
+
+    _fat_memo.vol = vol;
+    _fat_memo.sector = sectionRelativeSector;
+    memcpy(_fat_memo.data, data, BPB_SECTOR_SIZE);
+  }
+  else {
+    // Request was for a root directory sector, entries past BPB_ROOT_DIR_ENTRIES are not reachable
+    sectionRelativeSector -= FS_START_ROOTDIR_SECTOR(vol);
+    render_dir_sector(vol, DIR_ROOT, sectionRelativeSector, data);
+
+#if !CFG_UF2_FAT32
+    _root_memo.vol = vol;
+    _root_memo.sector = sectionRelativeSector;
+    memcpy(_root_memo.data, data, BPB_SECTOR_SIZE);
+#endif
+  }
+}
+
+#if !CFG_UF2_APP_EXPORT
+// Generate count consecutive CURRENT.UF2 blocks starting at file block block_no.
+// Payload of the whole run is fetched with a single flash read, using the tail
+// of the buffer as scratch area, then scattered forward into each 512-byte
+// envelope. Since block i is placed at i*512 and its payload is read from
+// count*(512-P) + i*P (P = payload size <= 480), processing in ascending order never
+// overwrites payload not yet consumed. Every byte of a generated envelope is written here, caller
+// does not need to clear the buffer beforehand.
+static void read_current_uf2 (uint32_t block_no, uint32_t count, uint8_t *data) {
+  uint32_t const addr = BOARD_FLASH_APP_START + (block_no * UF2_FIRMWARE_BYTES_PER_SECTOR);
+
+  // blocks past the end of exported image (never larger than flash) are zeroed
+  uint32_t valid_count = 0;
+  if ( block_no < UF2_SECTOR_COUNT ) {
+    valid_count = UF2_SECTOR_COUNT - block_no;
+    if ( valid_count > count ) valid_count = count;
+  }
+  memset(data + valid_count * BPB_SECTOR_SIZE, 0, (count - valid_count) * BPB_SECTOR_SIZE);
+  count = valid_count;
+  if ( count == 0 ) return;
+
+  // last block of the image is short if its size is not a multiple of the payload size
+  uint32_t payload_len = count * UF2_FIRMWARE_BYTES_PER_SECTOR;
+  if ( payload_len > _uf2_size - block_no * UF2_FIRMWARE_BYTES_PER_SECTOR ) {
+    payload_len = _uf2_size - block_no * UF2_FIRMWARE_BYTES_PER_SECTOR;
+  }
+
+  uint8_t* payload = data + count * (BPB_SECTOR_SIZE - UF2_FIRMWARE_BYTES_PER_SECTOR);
+#if CFG_UF2_READBACK_PROTECT
+  // stray host scans cost no flash bandwidth, the file only tells the image size
+  memset(payload, 0, payload_len);
+#else
+  board_flash_read(addr, payload, payload_len);
+#endif
+
+  for ( uint32_t i = 0; i < count; i++ ) {
+    UF2_Block *bl = (void*) (data + i * BPB_SECTOR_SIZE);
+    uint32_t const len = (payload_len - i * UF2_FIRMWARE_BYTES_PER_SECTOR < UF2_FIRMWARE_BYTES_PER_SECTOR) ?
+                         (payload_len - i * UF2_FIRMWARE_BYTES_PER_SECTOR) : UF2_FIRMWARE_BYTES_PER_SECTOR;
+
+    memmove(bl->data, payload + i * UF2_FIRMWARE_BYTES_PER_SECTOR, len);
+    memset(bl->data + len, 0, sizeof(bl->data) - len);
+
+    bl->magicStart0 = UF2_MAGIC_START0;
+    bl->magicStart1 = UF2_MAGIC_START1;
+    bl->magicEnd = UF2_MAGIC_END;
+    bl->blockNo = block_no + i;
+    bl->numBlocks = UF2_SECTOR_COUNT;
+    bl->targetAddr = addr + i * UF2_FIRMWARE_BYTES_PER_SECTOR;
+    bl->payloadSize = len;
+    // zero payload must never be flashed, when the file is copied back to the drive it is ignored
+    bl->flags = UF2_FLAG_FAMILYID | (CFG_UF2_READBACK_PROTECT ? UF2_FLAG_NOFLASH : 0);
+    bl->familyID = BOARD_UF2_FAMILY_ID;
+  }
+}
+#endif
+
+/*------------------------------------------------------------------*/
+/* File Providers
+ *------------------------------------------------------------------*/
+
+#if !CFG_UF2_APP_EXPORT
+// Copy part of a text segment that overlaps the requested [offset, offset+len) range.
+// Return segment length so that caller can advance seg_offset.
+static uint32_t copy_segment(char const* seg, uint32_t seg_len, uint32_t seg_offset,
+                             uint8_t* dst, uint32_t offset, uint32_t len) {
+  uint32_t const seg_end = seg_offset + seg_len;
+  uint32_t const start = (offset > seg_offset) ? offset : seg_offset;
+  uint32_t const end = (offset + len < seg_end) ? (offset + len) : seg_end;
+
+  if ( dst && start < end ) {
+    memcpy(dst + (start - offset), seg + (start - seg_offset), end - start);
+  }
+
+  return seg_len;
+}
+
+// Render INFO_UF2.TXT range into dst (if not NULL), return total text length
+static uint32_t info_txt_render(uint32_t offset, uint8_t* dst, uint32_t len) {
+  // the first byte should not be converted, it is the hardware identifier and already a character
+  char serialNumber[12];
+  if ( dst ) serial_load(); // length does not depend on it
+  serialNumber[0] = (char) _serial_hex[0];
+  u8_to_hexstr(_serial_hex + 1, 5, serialNumber + 1);
+
+  char flashSize[9];
+  u32_to_hexstr(_flash_size, flashSize);
+
+  uint32_t pos = 0;
+  pos += copy_segment(infoUf2Head, sizeof(infoUf2Head) - 1, pos, dst, offset, len);
+  pos += copy_segment(serialNumber, 11, pos, dst, offset, len);
+  pos += copy_segment(infoUf2FlashSize, sizeof(infoUf2FlashSize) - 1, pos, dst, offset, len);
+  pos += copy_segment(flashSize, 8, pos, dst, offset, len);
+  pos += copy_segment(infoUf2Tail, sizeof(infoUf2Tail) - 1, pos, dst, offset, len);
+
+  return pos;
+}
+
+static uint32_t info_txt_size(void) {
+  return info_txt_render(0, NULL, 0);
+}
+
+static void info_txt_read(uint32_t offset, void* dst, uint32_t len) {
+  (void) info_txt_render(offset, (uint8_t*) dst, len);
+}
+#endif
+
+#if CFG_UF2_BOOTLOG
+// BOOTLOG.TXT has a fixed size: header and one line per ring entry, unused entries are blank
+static char const bootlogHead[] = "stage                 us\n";
+
+static char const* const bootlog_stage_name[BOOTLOG_STAGE_COUNT] = {
+  [BOOTLOG_BL_INIT]            = "bl_init",
+  [BOOTLOG_BL_PARTITION_TABLE] = "bl_partition",
+  [BOOTLOG_BL_SELECT]          = "bl_select",
+  [BOOTLOG_MAIN]               = "main",
+  [BOOTLOG_BOARD_INIT]         = "board_init",
+  [BOOTLOG_DFU_CHECK]          = "dfu_check",
+  [BOOTLOG_FLASH_INIT]         = "flash_init",
+  [BOOTLOG_UF2_INIT]           = "uf2_init",
+  [BOOTLOG_TUD_INIT]           = "tud_init",
+  [BOOTLOG_MOUNT]              = "mount",
+  [BOOTLOG_FIRST_READ]         = "first_read",
+};
+
+// 12 chars stage name, 12 digits right aligned and newline
+#define BOOTLOG_LINE_LEN  25
+
+static void bootlog_line(bootlog_t const* log, uint32_t n, char line[BOOTLOG_LINE_LEN]) {
+  memset(line, ' ', BOOTLOG_LINE_LEN - 1);
+  line[BOOTLOG_LINE_LEN - 1] = '\n';
+
+  // n-th oldest entry kept in the ring
+  uint32_t const kept = (log->count < BOOTLOG_ENTRIES) ? log->count : BOOTLOG_ENTRIES;
+  if ( n >= kept ) return;
+
+  uint32_t const i = (log->count - kept + n) % BOOTLOG_ENTRIES;
+  uint32_t const stage = log->entry[i].stage;
+  char const* name = (stage < BOOTLOG_STAGE_COUNT && bootlog_stage_name[stage]) ? bootlog_stage_name[stage] : "?";
+  memcpy(line, name, strnlen(name, 12));
+
+  uint32_t us = log->entry[i].us;
+  char* p = line + BOOTLOG_LINE_LEN - 1;
+  do {
+    *--p = (char) ('0' + us % 10);
+    us /= 10;
+  } while ( us );
+}
+
+static uint32_t bootlog_size(void) {
+  return sizeof(bootlogHead) - 1 + BOOTLOG_ENTRIES * BOOTLOG_LINE_LEN;
+}
+
+static void bootlog_read(uint32_t offset, void* dst, uint32_t len) {
+  bootlog_t const* log = board_bootlog ? board_bootlog() : NULL;
+  bootlog_t const empty = { 0 };
+  if ( log == NULL || log->magic != BOOTLOG_MAGIC ) log = &empty;
+
+  uint32_t pos = copy_segment(bootlogHead, sizeof(bootlogHead) - 1, 0, dst, offset, len);
+  for ( uint32_t n = 0; n < BOOTLOG_ENTRIES && pos < offset + len; n++ ) {
+    char line[BOOTLOG_LINE_LEN];
+    bootlog_line(log, n, line);
+    pos += copy_segment(line, BOOTLOG_LINE_LEN, pos, dst, offset, len);
+  }
+}
+#endif
+
+#if CFG_UF2_STATS && !CFG_UF2_APP_EXPORT
+// STATS.TXT has a fixed size so that the host never needs a new directory: one line per counter,
+// values are rendered on every read
+static char const statsHead[] = "counter                 value\n";
+
+static struct {
+  char const* name;
+  uint16_t offset;
+} const stats_field[] = {
+  { "read10"            , offsetof(tuf2_stats_t, read10)                                       },
+  { "write10"           , offsetof(tuf2_stats_t, write10)                                      },
+  { "read_boot"         , offsetof(tuf2_stats_t, sectors_read[TUF2_STATS_READ_BOOT])           },
+  { "read_fat"          , offsetof(tuf2_stats_t, sectors_read[TUF2_STATS_READ_FAT])            },
+  { "read_dir"          , offsetof(tuf2_stats_t, sectors_read[TUF2_STATS_READ_DIR])            },
+  { "read_file"         , offsetof(tuf2_stats_t, sectors_read[TUF2_STATS_READ_FILE])           },
+  { "read_current_uf2"  , offsetof(tuf2_stats_t, sectors_read[TUF2_STATS_READ_CURRENT_UF2])    },
+  { "read_outside"      , offsetof(tuf2_stats_t, sectors_read[TUF2_STATS_READ_OUTSIDE])        },
+  { "written"           , offsetof(tuf2_stats_t, sectors_written)                              },
+  { "write_busy"        , offsetof(tuf2_stats_t, write_busy)                                   },
+  { "write_stall_max_us", offsetof(tuf2_stats_t, write_stall_max_us)                           },
+  { "write_cb_max_us"   , offsetof(tuf2_stats_t, write_cb_max_us)                              },
+  { "flush_max_us"      , offsetof(tuf2_stats_t, flush_max_us)                                 },
+  { "cache_hits"        , offsetof(tuf2_stats_t, cache_hits)                                   },
+  { "cache_misses"      , offsetof(tuf2_stats_t, cache_misses)                                 },
+  { "cache_evictions"   , offsetof(tuf2_stats_t, cache_evictions)                              },
+  { "skipped_bytes"     , offsetof(tuf2_stats_t, skipped_bytes)                                },
+  { "crc_rejected"      , offsetof(tuf2_stats_t, crc_rejected)                                 },
+  { "meas_cache_hits"   , offsetof(tuf2_stats_t, measurement_cache_hits)                       },
+  { "meas_cache_misses" , offsetof(tuf2_stats_t, measurement_cache_misses)                     },
+  { "erase_count"       , offsetof(tuf2_stats_t, erase_count)                                  },
+  { "erase_us"          , offsetof(tuf2_stats_t, erase_us)                                     },
+  { "program_count"     , offsetof(tuf2_stats_t, program_count)                                },
+  { "program_bytes"     , offsetof(tuf2_stats_t, program_bytes)                                },
+  { "program_us"        , offsetof(tuf2_stats_t, program_us)                                   },
+  { "supply_throttles"  , offsetof(tuf2_stats_t, supply_throttles)                             },
+  { "bench_usb_kb_s"    , offsetof(tuf2_stats_t, bench_usb_kb_s)                               },
+  { "bench_erase_kb_s"  , offsetof(tuf2_stats_t, bench_erase_kb_s)                             },
+  { "bench_program_kb_s", offsetof(tuf2_stats_t, bench_program_kb_s)                           },
+  { "bench_read_kb_s"   , offsetof(tuf2_stats_t, bench_read_kb_s)                              },
+  { "heap_size"         , offsetof(tuf2_stats_t, heap_size)                                    },
+  { "heap_used_max"     , offsetof(tuf2_stats_t, heap_used_max)                                },
+  { "usbd_run_ms"       , offsetof(tuf2_stats_t, task_run_ms[TUF2_STATS_TASK_USBD])            },
+  { "flash_wr_run_ms"   , offsetof(tuf2_stats_t, task_run_ms[TUF2_STATS_TASK_FLASH_WRITE])     },
+  { "flash_ra_run_ms"   , offsetof(tuf2_stats_t, task_run_ms[TUF2_STATS_TASK_READ_AHEAD])      },
+  { "main_run_ms"       , offsetof(tuf2_stats_t, task_run_ms[TUF2_STATS_TASK_MAIN])            },
+  { "usbd_stack_min"    , offsetof(tuf2_stats_t, task_stack_free[TUF2_STATS_TASK_USBD])        },
+  { "flash_wr_stack_min", offsetof(tuf2_stats_t, task_stack_free[TUF2_STATS_TASK_FLASH_WRITE]) },
+  { "flash_ra_stack_min", offsetof(tuf2_stats_t, task_stack_free[TUF2_STATS_TASK_READ_AHEAD])  },
+  { "main_stack_min"    , offsetof(tuf2_stats_t, task_stack_free[TUF2_STATS_TASK_MAIN])        },
+};
+
+#define STATS_FIELD_COUNT  (sizeof(stats_field) / sizeof(stats_field[0]))
+
+// 18 chars counter name, 10 digits right aligned (any uint32_t) and newline
+#define STATS_LINE_LEN  30
+
+static void stats_line(uint32_t n, char line[STATS_LINE_LEN]) {
+  memset(line, ' ', STATS_LINE_LEN - 1);
+  line[STATS_LINE_LEN - 1] = '\n';
+  memcpy(line, stats_field[n].name, strnlen(stats_field[n].name, 18));
+
+  uint32_t value;
+  memcpy(&value, (uint8_t const*) &tuf2_stats + stats_field[n].offset, sizeof(value));
+
+  char* p = line + STATS_LINE_LEN - 1;
+  do {
+    *--p = (char) ('0' + value % 10);
+    value /= 10;
+  } while ( value );
+}
+
+static uint32_t stats_size(void) {
+  return sizeof(statsHead) - 1 + STATS_FIELD_COUNT * STATS_LINE_LEN;
+}
+
+static void stats_read(uint32_t offset, void* dst, uint32_t len) {
+  if ( board_heap_info ) board_heap_info(&tuf2_stats.heap_size, &tuf2_stats.heap_used_max);
+  if ( board_task_info ) board_task_info(tuf2_stats.task_run_ms, tuf2_stats.task_stack_free);
+
+  uint32_t pos = copy_segment(statsHead, sizeof(statsHead) - 1, 0, dst, offset, len);
+  for ( uint32_t n = 0; n < STATS_FIELD_COUNT && pos < offset + len; n++ ) {
+    char line[STATS_LINE_LEN];
+    stats_line(n, line);
+    pos += copy_segment(line, STATS_LINE_LEN, pos, dst, offset, len);
+  }
+}
+#endif
+
+#if CFG_UF2_VERIFY && !CFG_UF2_APP_EXPORT
+// VERIFY.TXT: one line per range of the verify file in file order, and the overall result
+enum {
+  VERIFY_MISSING = 0,   // sector of the range not received
+  VERIFY_OK,
+  VERIFY_DIFFERS,
+  VERIFY_INVALID,       // range outside of ota0, or dropped
+};
+
+static char const verifyHead[] = "address    length     result\n";
+static char const* const verify_text[] = { "MISSING", "OK", "DIFFERS", "INVALID" };
+
+static struct {
+  uint32_t addr;
+  uint32_t len;
+  uint8_t result;
+} _verify[CFG_UF2_VERIFY_RANGES];
+
+static uint32_t _verify_count;
+static bool _verify_dropped;
+
+// "0x" and 8 hex digits address and length, 7 chars result and newline
+#define VERIFY_LINE_LEN  30
+
+static void verify_line(uint32_t n, char line[VERIFY_LINE_LEN]) {
+  memset(line, ' ', VERIFY_LINE_LEN - 1);
+  line[VERIFY_LINE_LEN - 1] = '\n';
+  line[0] = line[11] = '0';
+  line[1] = line[12] = 'x';
+  u32_to_hexstr(_verify[n].addr, line + 2);
+  u32_to_hexstr(_verify[n].len, line + 13);
+  line[10] = line[21] = ' ';
+  memcpy(line + 22, verify_text[_verify[n].result], strlen(verify_text[_verify[n].result]));
+}
+
+// differing ranges are what the audit is after, then the ones that could not be checked
+static uint8_t verify_total(void) {
+  bool missing = false, invalid = _verify_dropped;
+  for ( uint32_t n = 0; n < _verify_count; n++ ) {
+    if ( _verify[n].result == VERIFY_DIFFERS ) return VERIFY_DIFFERS;
+    missing |= (_verify[n].result == VERIFY_MISSING);
+    invalid |= (_verify[n].result == VERIFY_INVALID);
+  }
+  return missing ? VERIFY_MISSING : invalid ? VERIFY_INVALID : VERIFY_OK;
+}
+
+static uint32_t verify_size(void) {
+  return _verify_count ? (uint32_t) (sizeof(verifyHead) - 1 + (_verify_count + 1) * VERIFY_LINE_LEN) : 0;
+}
+
+static void verify_read(uint32_t offset, void* dst, uint32_t len) {
+  if ( !_verify_count ) return;
+
+  uint32_t pos = copy_segment(verifyHead, sizeof(verifyHead) - 1, 0, dst, offset, len);
+
+  // skip lines before offset
+  uint32_t n = (offset > pos) ? (offset - pos) / VERIFY_LINE_LEN : 0;
+  if ( n > _verify_count ) n = _verify_count;
+  pos += n * VERIFY_LINE_LEN;
+
+  for ( ; n <= _verify_count && pos < offset + len; n++ ) {
+    char line[VERIFY_LINE_LEN];
+    if ( n < _verify_count ) {
+      verify_line(n, line);
+    } else {
+      char const* total = verify_text[verify_total()];
+      memset(line, ' ', VERIFY_LINE_LEN - 1);
+      line[VERIFY_LINE_LEN - 1] = '\n';
+      memcpy(line, "total", 5);
+      memcpy(line + 22, total, strlen(total));
+    }
+    pos += copy_segment(line, VERIFY_LINE_LEN, pos, dst, offset, len);
+  }
+}
+
+// Audit: hash the ranges of the block, nothing is written. Block 0 starts a new report, the medium
+// change makes the host read VERIFY.TXT again
+static void verify_write(Verify_Block const* bl) {
+  if ( bl->blockNo == 0 ) {
+    memset(_verify, 0, sizeof(_verify));
+    _verify_count = 0;
+    _verify_dropped = false;
+  }
+
+  uint32_t const count = (bl->count < VERIFY_BLOCK_RANGES) ? bl->count : VERIFY_BLOCK_RANGES;
+  for ( uint32_t i = 0; i < count; i++ ) {
+    uint32_t const idx = bl->blockNo * VERIFY_BLOCK_RANGES + i;
+    if ( bl->blockNo >= CFG_UF2_VERIFY_RANGES || idx >= CFG_UF2_VERIFY_RANGES ) {
+      TUF2_LOG1("Verify: ranges of block %lu dropped\r\n", bl->blockNo);
+      _verify_dropped = true;
+      break;
+    }
+
+    uint32_t const addr = bl->ranges[i].addr;
+    uint32_t const rlen = bl->ranges[i].len;
+
+    _verify[idx].addr = addr;
+    _verify[idx].len = rlen;
+    if ( addr + rlen < addr || addr + rlen > _flash_size || !board_flash_sha256_match ) {
+      _verify[idx].result = VERIFY_INVALID;
+    } else {
+      _verify[idx].result = board_flash_sha256_match(addr, rlen, bl->ranges[i].sha256) ? VERIFY_OK : VERIFY_DIFFERS;
+    }
+    if ( idx + 1 > _verify_count ) _verify_count = idx + 1;
+  }
+
+  TUF2_LOG1("Verify: block %lu, %lu ranges, %s\r\n", bl->blockNo, count, verify_text[verify_total()]);
+  _info_changed = true;
+}
+#endif
+
+#if CFG_UF2_STATUS && !CFG_UF2_APP_EXPORT
+// STATUS.TXT for a flashing station polling many devices: fixed size, state of the uf2 file being
+// written and the USB serial to match drive and device. Done and failed come with a medium change
+
+// "state   " 7 chars, "blocks  " 10 digits written / 10 digits total, "serial  " 32 chars, each with newline
+#define STATUS_SIZE  (16 + 30 + 41)
+
+static uint32_t status_size(void) {
+  return STATUS_SIZE;
+}
+
+static void status_read(uint32_t offset, void* dst, uint32_t len) {
+  char text[STATUS_SIZE];
+  memset(text, ' ', sizeof(text));
+
+  char const* state = status_text[status_get()];
+  memcpy(text, "state", 5);
+  memcpy(text + 8, state, strlen(state));
+  text[15] = '\n';
+
+  memcpy(text + 16, "blocks", 6);
+  status_dec(text + 34, _status_state ? _status_state->numWritten : 0);
+  text[34] = '/';
+  status_dec(text + 45, _status_state ? _status_state->numBlocks : 0);
+  text[45] = '\n';
+
+  memcpy(text + 46, "serial", 6);
+  memcpy(text + 54, _usb_serial, strlen(_usb_serial));
+  text[86] = '\n';
+
+  copy_segment(text, sizeof(text), 0, dst, offset, len);
+}
+#endif
+
+#if CFG_UF2_INFO_JSON && !CFG_UF2_APP_EXPORT
+// INFO.JSON: what INFO_UF2.TXT, STATUS.TXT and STATS.TXT show, as one object for scripts. Fixed size
+// like STATS.TXT: one member per line, padded with whitespace so that values never change the length
+enum {
+  JSON_BOARD = 0,
+  JSON_SERIAL,
+  JSON_APP_PARTITION_SIZE,
+  JSON_MEASUREMENT_PARTITION_SIZE,
+  JSON_APP_SIZE,
+  JSON_APP_SHA256,
+  JSON_STATE,
+  JSON_BLOCKS_WRITTEN,
+  JSON_BLOCKS_TOTAL,
+  JSON_MEASUREMENT_RECORDS,
+  JSON_MEMBER_COUNT
+};
+
+static char const* const json_member[JSON_MEMBER_COUNT] = {
+  "board", "serial", "app_partition_size", "measurement_partition_size", "app_size", "app_sha256",
+  "state", "blocks_written", "blocks_total", "measurement_records"
+};
+
+// 2 or 4 spaces indent, quoted name and colon, value from column 32: 64 hex digits of the sha256 quoted,
+// comma and newline
+#define JSON_LINE_LEN   100
+#define JSON_VALUE_COL  32
+
+#if CFG_UF2_STATS
+  // top level members, "stats": { and its closing brace, inside of it once per counter
+  #define JSON_LINES    (2 + JSON_MEMBER_COUNT + 2 + STATS_FIELD_COUNT)
+#else
+  #define JSON_LINES    (2 + JSON_MEMBER_COUNT)
+#endif
+
+static void json_name(char line[JSON_LINE_LEN], uint32_t indent, char const* name, bool more) {
+  line[indent] = '"';
+  memcpy(line + indent + 1, name, strlen(name));
+  line[indent + 1 + strlen(name)] = '"';
+  line[indent + 2 + strlen(name)] = ':';
+  if ( more ) line[JSON_LINE_LEN - 2] = ',';
+}
+
+static void json_string(char line[JSON_LINE_LEN], char const* value) {
+  uint32_t len = strlen(value);
+  if ( len > JSON_LINE_LEN - JSON_VALUE_COL - 4 ) len = JSON_LINE_LEN - JSON_VALUE_COL - 4;
+  line[JSON_VALUE_COL] = '"';
+  memcpy(line + JSON_VALUE_COL + 1, value, len);
+  line[JSON_VALUE_COL + 1 + len] = '"';
+}
+
+// right aligned in 10 digits, any uint32_t
+static void json_number(char line[JSON_LINE_LEN], uint32_t value) {
+  status_dec(line + JSON_VALUE_COL + 10, value);
+}
+
+static void json_member_value(uint32_t n, char line[JSON_LINE_LEN]) {
+  switch ( n ) {
+    case JSON_BOARD: json_string(line, UF2_BOARD_ID); break;
+    case JSON_SERIAL: json_string(line, _usb_serial); break;
+    case JSON_APP_PARTITION_SIZE: json_number(line, _flash_size); break;
+    case JSON_MEASUREMENT_PARTITION_SIZE: json_number(line, board_measuremnt_data_size()); break;
+
+    case JSON_APP_SIZE: {
+      uint32_t const size = board_flash_app_size ? board_flash_app_size() : 0;
+      if ( size ) json_number(line, size);
+      else memcpy(line + JSON_VALUE_COL, "null", 4);
+      break;
+    }
+
+    case JSON_APP_SHA256: {
+      // from the port's record of the image, hashing ota0 on every read would stall the host
+      uint8_t sha256[32];
+      if ( board_flash_app_sha256 && board_flash_app_sha256(sha256) ) {
+        char hex[65];
+        u8_to_hexstr(sha256, sizeof(sha256), hex);
+        json_string(line, hex);
+      } else {
+        memcpy(line + JSON_VALUE_COL, "null", 4);
+      }
+      break;
+    }
+
+    case JSON_STATE: json_string(line, status_text[status_get()]); break;
+    case JSON_BLOCKS_WRITTEN: json_number(line, _status_state ? _status_state->numWritten : 0); break;
+    case JSON_BLOCKS_TOTAL: json_number(line, _status_state ? _status_state->numBlocks : 0); break;
+
+    case JSON_MEASUREMENT_RECORDS:
+#if CFG_UF2_MEASUREMENT_BINARY
+      json_number(line, _measurement_flash_size / MEASUREMENT_UNIT_SIZE);
+#else
+      // CSV text, no records to count
+      memcpy(line + JSON_VALUE_COL, "null", 4);
+#endif
+      break;
+
+    default: break;
+  }
+}
+
+static void info_json_line(uint32_t n, char line[JSON_LINE_LEN]) {
+  memset(line, ' ', JSON_LINE_LEN - 1);
+  line[JSON_LINE_LEN - 1] = '\n';
+
+  if ( n == 0 ) {
+    line[0] = '{';
+    return;
+  }
+  if ( n == JSON_LINES - 1 ) {
+    line[0] = '}';
+    return;
+  }
+
+  n--;
+  if ( n < JSON_MEMBER_COUNT ) {
+    json_name(line, 2, json_member[n], CFG_UF2_STATS || n + 1 < JSON_MEMBER_COUNT);
+    json_member_value(n, line);
+    return;
+  }
+
+#if CFG_UF2_STATS
+  n -= JSON_MEMBER_COUNT;
+  if ( n == 0 ) {
+    memcpy(line + 2, "\"stats\": {", 10);
+  } else if ( n == STATS_FIELD_COUNT + 1 ) {
+    line[2] = '}';
+  } else {
+    n--;
+    json_name(line, 4, stats_field[n].name, n + 1 < STATS_FIELD_COUNT);
+
+    uint32_t value;
+    memcpy(&value, (uint8_t const*) &tuf2_stats + stats_field[n].offset, sizeof(value));
+    json_number(line, value);
+  }
+#endif
+}
+
+static uint32_t info_json_size(void) {
+  return JSON_LINES * JSON_LINE_LEN;
+}
+
+static void info_json_read(uint32_t offset, void* dst, uint32_t len) {
+#if CFG_UF2_STATS
+  if ( board_heap_info ) board_heap_info(&tuf2_stats.heap_size, &tuf2_stats.heap_used_max);
+  if ( board_task_info ) board_task_info(tuf2_stats.task_run_ms, tuf2_stats.task_stack_free);
+#endif
+
+  uint32_t pos = 0;
+  for ( uint32_t n = 0; n < JSON_LINES && pos < offset + len; n++ ) {
+    char line[JSON_LINE_LEN];
+    info_json_line(n, line);
+    pos += copy_segment(line, JSON_LINE_LEN, pos, dst, offset, len);
+  }
+}
+#endif
+
+#if CFG_UF2_CONFIG && !CFG_UF2_APP_EXPORT
+// CONFIG.TXT: a comment, then serial and the CFG_UF2_CONFIG_U32 settings. Fixed size, values are padded
+// with spaces which the parser ignores. A setting not in NVS has an empty value, left empty it is kept
+static char const configHead[] = "# key=value, stored when this file is written\n";
+
+static struct {
+  char const* key;    // NVS key, 15 chars at most
+  uint32_t min;
+  uint32_t max;
+} const config_u32[] = { CFG_UF2_CONFIG_U32 { NULL, 0, 0 } };
+
+// loops stop at the NULL key, with no settings a count compare would always be false (-Wtype-limits)
+#define CONFIG_U32_COUNT  (UF2_ARRAY_SIZE(config_u32) - 1)
+
+// 15 chars key, '=', 12 hex digits of the serial or up to 10 digits, newline
+#define CONFIG_LINE_LEN   29
+
+STATIC_ASSERT(sizeof(configHead) - 1 + (1 + CONFIG_U32_COUNT) * CONFIG_LINE_LEN <= BPB_SECTOR_SIZE); // parsed from one sector
+
+static uint32_t _config_value[CONFIG_U32_COUNT + 1];
+static bool _config_stored[CONFIG_U32_COUNT + 1];
+static bool _config_loaded = false;
+
+// CONFIG.TXT written as a new file: its first cluster from the root directory, 0 if none
+static cluster_t _config_new_cluster = 0;
+static uint32_t _config_new_size = 0;
+
+static void config_load(void) {
+  if ( _config_loaded ) return;
+  _config_loaded = true;
+
+  nvs_handle_t nvs;
+  if ( ESP_OK != init_nvs_partition() || ESP_OK != nvs_open("storage", NVS_READONLY, &nvs) ) return;
+  for ( uint32_t i = 0; config_u32[i].key; i++ ) {
+    _config_stored[i] = (ESP_OK == nvs_get_u32(nvs, config_u32[i].key, &_config_value[i]));
+  }
+  nvs_close(nvs);
+}
+
+static void config_line(uint32_t n, char line[CONFIG_LINE_LEN]) {
+  memset(line, ' ', CONFIG_LINE_LEN - 1);
+  line[CONFIG_LINE_LEN - 1] = '\n';
+
+  if ( n == 0 ) {
+    char hex[13];
+    u8_to_hexstr(_serial_hex, sizeof(_serial_hex), hex);
+    memcpy(line, "serial=", 7);
+    memcpy(line + 7, hex, 12);
+    return;
+  }
+
+  n--;
+  uint32_t const klen = strlen(config_u32[n].key);
+  memcpy(line, config_u32[n].key, klen);
+  line[klen] = '=';
+  if ( !_config_stored[n] ) return;
+
+  char digits[10];
+  uint32_t count = 0;
+  uint32_t value = _config_value[n];
+  do {
+    digits[count++] = (char) ('0' + value % 10);
+    value /= 10;
+  } while ( value );
+  for ( uint32_t i = 0; i < count; i++ ) line[klen + 1 + i] = digits[count - 1 - i];
+}
+
+static uint32_t config_size(void) {
+  return sizeof(configHead) - 1 + (1 + CONFIG_U32_COUNT) * CONFIG_LINE_LEN;
+}
+
+static void config_read(uint32_t offset, void* dst, uint32_t len) {
+  serial_load();
+  config_load();
+
+  uint32_t pos = copy_segment(configHead, sizeof(configHead) - 1, 0, dst, offset, len);
+  for ( uint32_t n = 0; n < 1 + CONFIG_U32_COUNT && pos < offset + len; n++ ) {
+    char line[CONFIG_LINE_LEN];
+    config_line(n, line);
+    pos += copy_segment(line, CONFIG_LINE_LEN, pos, dst, offset, len);
+  }
+}
+
+static void config_trim(char const** start, char const** end) {
+  while ( *start < *end && (**start == ' ' || **start == '\t' || **start == '\r') ) (*start)++;
+  while ( *end > *start && ((*end)[-1] == ' ' || (*end)[-1] == '\t' || (*end)[-1] == '\r') ) (*end)--;
+}
+
+static bool config_key_is(char const* key, uint32_t len, char const* name) {
+  return len == strlen(name) && 0 == memcmp(key, name, len);
+}
+
+static bool config_hex(char const* s, uint32_t len, uint8_t out[6]) {
+  if ( len != 12 ) return false;
+  for ( uint32_t i = 0; i < 12; i++ ) {
+    char const c = s[i];
+    uint8_t const nibble = (c >= '0' && c <= '9') ? (uint8_t) (c - '0') :
+                           (c >= 'A' && c <= 'F') ? (uint8_t) (c - 'A' + 10) :
+                           (c >= 'a' && c <= 'f') ? (uint8_t) (c - 'a' + 10) : 0xff;
+    if ( nibble == 0xff ) return false;
+    out[i / 2] = (uint8_t) ((i & 1) ? (out[i / 2] | nibble) : (nibble << 4));
+  }
+  return true;
+}
+
+static bool config_dec(char const* s, uint32_t len, uint32_t* out) {
+  if ( len == 0 || len > 10 ) return false;
+  uint64_t value = 0;
+  for ( uint32_t i = 0; i < len; i++ ) {
+    if ( s[i] < '0' || s[i] > '9' ) return false;
+    value = value * 10 + (uint32_t) (s[i] - '0');
+  }
+  if ( value > UINT32_MAX ) return false;
+  *out = (uint32_t) value;
+  return true;
+}
+
+// Check all lines of a CONFIG.TXT written by the host, then store what changed with one NVS commit.
+// Nothing is stored if any line is wrong
+static bool config_apply(uint8_t const* data, uint32_t len) {
+  serial_load();
+  config_load();
+
+  uint8_t serial[6];
+  memcpy(serial, _serial_hex, sizeof(serial));
+  uint32_t value[CONFIG_U32_COUNT + 1];
+  memcpy(value, _config_value, sizeof(value));
+  bool assigned[CONFIG_U32_COUNT + 1] = { false };
+
+  char const* p = (char const*) data;
+  char const* const end = p + len;
+  while ( p < end && *p ) {
+    char const* eol = p;
+    while ( eol < end && *eol && *eol != '\n' ) eol++;
+
+    char const* ks = p;
+    char const* ve = eol;
+    p = (eol < end && *eol == '\n') ? eol + 1 : eol;
+
+    config_trim(&ks, &ve);
+    if ( ks == ve || *ks == '#' ) continue;
+
+    char const* eq = memchr(ks, '=', (size_t) (ve - ks));
+    if ( eq == NULL ) {
+      TUF2_LOG1("Config: line without '='\r\n");
+      return false;
+    }
+
+    char const* ke = eq;
+    char const* vs = eq + 1;
+    config_trim(&ks, &ke);
+    config_trim(&vs, &ve);
+    uint32_t const klen = (uint32_t) (ke - ks);
+    uint32_t const vlen = (uint32_t) (ve - vs);
+
+    // left empty, the setting is kept
+    if ( vlen == 0 ) continue;
+
+    if ( config_key_is(ks, klen, "serial") ) {
+      if ( !config_hex(vs, vlen, serial) ) {
+        TUF2_LOG1("Config: serial is not 12 hex digits\r\n");
+        return false;
+      }
+      continue;
+    }
+
+    uint32_t i = 0;
+    while ( config_u32[i].key && !config_key_is(ks, klen, config_u32[i].key) ) i++;
+    if ( config_u32[i].key == NULL ) {
+      TUF2_LOG1("Config: unknown key %.*s\r\n", (int) klen, ks);
+      return false;
+    }
+    if ( !config_dec(vs, vlen, &value[i]) || value[i] < config_u32[i].min || value[i] > config_u32[i].max ) {
+      TUF2_LOG1("Config: %s out of range %lu..%lu\r\n", config_u32[i].key, config_u32[i].min, config_u32[i].max);
+      return false;
+    }
+    assigned[i] = true;
+  }
+
+  // same file sent again by the host OS, nothing to store
+  bool const serial_changed = 0 != memcmp(serial, _serial_hex, sizeof(serial));
+  bool changed = serial_changed;
+  for ( uint32_t i = 0; config_u32[i].key; i++ ) {
+    assigned[i] = assigned[i] && (!_config_stored[i] || value[i] != _config_value[i]);
+    changed = changed || assigned[i];
+  }
+  if ( !changed ) return true;
+
+  // burnt in where the board can, once: another serial number than the stored one fails the whole file
+  if ( serial_changed && board_serial_write && !board_serial_write(serial) ) {
+    TUF2_LOG1("Config: serial is write-once on this board\r\n");
+    return false;
+  }
+
+  nvs_handle_t nvs;
+  esp_err_t err = nvs_open("storage", NVS_READWRITE, &nvs);
+  if ( err != ESP_OK ) return false;
+
+  if ( serial_changed && !board_serial_write ) err = nvs_set_blob(nvs, "serialnum", serial, sizeof(serial));
+  for ( uint32_t i = 0; config_u32[i].key && err == ESP_OK; i++ ) {
+    if ( assigned[i] ) err = nvs_set_u32(nvs, config_u32[i].key, value[i]);
+  }
+  if ( err == ESP_OK ) err = nvs_commit(nvs);
+  nvs_close(nvs);
+
+  if ( err != ESP_OK ) {
+    TUF2_LOG1("Config: NVS write failed (%d)\r\n", (int) err);
+    return false;
+  }
+
+  // INFO_UF2.TXT and CONFIG.TXT are rendered from these, same length so only their contents change
+  if ( serial_changed ) {
+    memcpy(_serial_hex, serial, sizeof(_serial_hex));
+#if CFG_UF2_RETAINED_CACHE
+    serial_cache(_serial_hex);
+#endif
+  }
+  for ( uint32_t i = 0; config_u32[i].key; i++ ) {
+    if ( assigned[i] ) {
+      _config_value[i] = value[i];
+      _config_stored[i] = true;
+    }
+  }
+
+  TUF2_LOG1("Config: stored\r\n");
+  _info_changed = true;
+  return true;
+}
+
+static uint32_t config_cluster_lba(uint32_t cluster) {
+  return FS_START_CLUSTERS_SECTOR(&_uf2_volume) + CLUSTER_SECTOR(cluster);
+}
+
+static FileContent_t const* config_file(void) {
+  for ( uint32_t i = 0; i < _uf2_volume.num_files; i++ ) {
+    if ( _uf2_volume.info[i].provider == &config_provider ) return &_uf2_volume.info[i];
+  }
+  return NULL;
+}
+
+// Non-uf2 sector written by the host: CONFIG.TXT rewritten in place, a root directory entry of a new
+// CONFIG.TXT in other clusters, or the data of that one
+static void config_write(uint32_t block_no, uint8_t const* data) {
+  FileContent_t const* own = config_file();
+  if ( own == NULL || block_no < FS_START_ROOTDIR_SECTOR(&_uf2_volume) ) return;
+
+  if ( block_no < FS_START_CLUSTERS_SECTOR(&_uf2_volume) + ROOT_DIR_DATA_SECTORS ) {
+    DirEntry const* d = (DirEntry const*) (void const*) data;
+    for ( uint32_t i = 0; i < DIRENTRIES_PER_SECTOR; i++, d++ ) {
+      if ( memcmp(d->name, "CONFIG  ", 8) || memcmp(d->ext, "TXT", 3) || (d->attrs & DIR_ATTR_DIRECTORY) ) continue;
+
+      uint32_t const cluster = (uint32_t) d->highStartCluster << 16 | d->startCluster;
+      if ( cluster < 2 || cluster == own->cluster_start || d->size == 0 ) continue;
+
+      _config_new_cluster = (cluster_t) cluster;
+      _config_new_size = d->size;
+
+#if CFG_UF2_WRITE_OVERLAY_SECTORS
+      // data came first
+      uint8_t const* sector = overlay_find(config_cluster_lba(cluster));
+      if ( sector ) {
+        (void) config_apply(sector, (d->size < BPB_SECTOR_SIZE) ? d->size : BPB_SECTOR_SIZE);
+        _config_new_cluster = 0;
+      }
+#endif
+      return;
+    }
+    return;
+  }
+
+  if ( block_no == config_cluster_lba(own->cluster_start) ) {
+    // in place, the host's new length is not known yet: up to the first NUL of the sector
+    (void) config_apply(data, BPB_SECTOR_SIZE);
+  } else if ( _config_new_cluster && block_no == config_cluster_lba(_config_new_cluster) ) {
+    (void) config_apply(data, (_config_new_size < BPB_SECTOR_SIZE) ? _config_new_size : BPB_SECTOR_SIZE);
+    _config_new_cluster = 0;
+  }
+}
+#endif
+
+#if CFG_UF2_WEAR
+// WEAR.CSV: one fixed length line per erase unit, counters are read from the port on every read
+static char const wearHead[] = "offset,erases\n";
+
+// "0x" and 8 hex digits offset, comma, 5 digits count (saturated) and newline
+#define WEAR_LINE_LEN  17
+
+static uint32_t wear_units(uint32_t* unit_size) {
+  *unit_size = 0;
+  return board_flash_wear_units ? board_flash_wear_units(unit_size) : 0;
+}
+
+static uint32_t wear_size(void) {
+  uint32_t unit_size;
+  return sizeof(wearHead) - 1 + wear_units(&unit_size) * WEAR_LINE_LEN;
+}
+
+static void wear_read(uint32_t offset, void* dst, uint32_t len) {
+  uint32_t unit_size;
+  uint32_t const units = wear_units(&unit_size);
+
+  uint32_t pos = copy_segment(wearHead, sizeof(wearHead) - 1, 0, dst, offset, len);
+
+  // skip lines before offset
+  uint32_t n = (offset > pos) ? (offset - pos) / WEAR_LINE_LEN : 0;
+  pos += n * WEAR_LINE_LEN;
+
+  for ( ; n < units && pos < offset + len; n++ ) {
+    char line[WEAR_LINE_LEN];
+    line[0] = '0';
+    line[1] = 'x';
+    u32_to_hexstr(n * unit_size, line + 2);
+    line[10] = ',';
+
+    uint32_t count = board_flash_wear_read ? board_flash_wear_read(n) : 0;
+    if ( count > 99999 ) count = 99999;
+    for ( int i = 15; i > 10; i-- ) {
+      line[i] = (char) ('0' + count % 10);
+      count /= 10;
+    }
+    line[16] = '\n';
+
+    pos += copy_segment(line, WEAR_LINE_LEN, pos, dst, offset, len);
+  }
+}
+#endif
+
+#if CFG_UF2_MEASUREMENT_BINARY
+// CSV text rendered from binary records
+static uint32_t measurement_size(void) {
+  uint32_t const size = measurement_csv_init(_measurement_flash_size);
+#if CFG_UF2_MEASUREMENT_GZ
+  _measurement_csv_size = size;
+#endif
+  return size;
+}
+
+static void measurement_read(uint32_t offset, void* dst, uint32_t len) {
+  measurement_csv_read(offset, dst, len);
+}
+
+static void measurement_read_ahead(uint32_t offset, uint32_t len) {
+  measurement_csv_read_ahead(offset, len);
+}
+#else
+// raw window over ota1, application stores CSV text
+static uint32_t measurement_size(void) {
+#if CFG_UF2_MEASUREMENT_GZ
+  _measurement_csv_size = _measurement_flash_size;
+#endif
+  return _measurement_flash_size;
+}
+
+static void measurement_read(uint32_t offset, void* dst, uint32_t len) {
+  measurement_cache_read(offset, dst, len);
+}
+
+static void measurement_read_ahead(uint32_t offset, uint32_t len) {
+  if ( board_measuremnt_data_read_ahead ) board_measuremnt_data_read_ahead(offset, len);
+}
+#endif
+
+#if !CFG_UF2_APP_EXPORT
+static uint32_t current_uf2_size(void) {
+  return UF2_BYTE_COUNT;
+}
+
+static void current_uf2_read(uint32_t offset, void* dst, uint32_t len) {
+  // generate data on-the-fly
+  read_current_uf2(offset / BPB_SECTOR_SIZE, len / BPB_SECTOR_SIZE, (uint8_t*) dst);
+}
+
+static void current_uf2_read_ahead(uint32_t offset, uint32_t len) {
+  if ( board_flash_read_ahead && !CFG_UF2_READBACK_PROTECT ) {
+    board_flash_read_ahead(BOARD_FLASH_APP_START + (offset / BPB_SECTOR_SIZE) * UF2_FIRMWARE_BYTES_PER_SECTOR,
+                           (len / BPB_SECTOR_SIZE) * UF2_FIRMWARE_BYTES_PER_SECTOR);
+  }
+}
+
+#if CFG_UF2_CURRENT_BIN && !CFG_UF2_READBACK_PROTECT
+static uint32_t current_bin_size(void) {
+  return _bin_size;
+}
+
+// straight from flash, a multi-sector READ10 is a single board_flash_read()
+static void current_bin_read(uint32_t offset, void* dst, uint32_t len) {
+  board_flash_read(BOARD_FLASH_APP_START + offset, dst, len);
+}
+
+static void current_bin_read_ahead(uint32_t offset, uint32_t len) {
+  if ( board_flash_read_ahead ) board_flash_read_ahead(BOARD_FLASH_APP_START + offset, len);
+}
+#endif
+
+#if CFG_UF2_FLASH_BIN && !CFG_UF2_READBACK_PROTECT
+static uint32_t flash_bin_size(void) {
+  return (board_flash_chip_size && board_flash_chip_read) ? board_flash_chip_size() : 0;
+}
+
+// the chip as is, a multi-sector READ10 is a single board_flash_chip_read()
+static void flash_bin_read(uint32_t offset, void* dst, uint32_t len) {
+  board_flash_chip_read(offset, dst, len);
+}
+
+static void flash_bin_read_ahead(uint32_t offset, uint32_t len) {
+  if ( board_flash_chip_read_ahead ) board_flash_chip_read_ahead(offset, len);
+}
+#endif
+#endif
+
+// Fill up to count sectors of a subdirectory region, starting at sector relative to its
+// first cluster: directory sectors first, then its files. Return number of sectors filled.
+static uint32_t read_dir_sectors (GhostVolume_t const* vol, uint32_t fid, uint32_t sector, uint32_t count, uint8_t *data) {
+  FileContent_t const* inf = &vol->info[fid];
+  uint32_t const dir_sectors = ((uint32_t) (inf->cluster_end - inf->cluster_start + 1)) << BPB_SECTORS_PER_CLUSTER_SHIFT;
+
+  if ( sector < dir_sectors ) {
+    if ( count > dir_sectors - sector ) count = dir_sectors - sector;
+
+    memset(data, 0, count * BPB_SECTOR_SIZE);
+    for ( uint32_t i = 0; i < count; i++ ) {
+      render_dir_sector(vol, fid, sector + i, data + i * BPB_SECTOR_SIZE);
+    }
+    return count;
+  }
+
+  // find file by binary search, last one starting at or before sector
+  cluster_t const* start = &vol->child_cluster_start[inf->child_first];
+  uint32_t const cluster = inf->cluster_start + (sector >> BPB_SECTORS_PER_CLUSTER_SHIFT);
+  uint32_t lo = 0;
+  uint32_t hi = inf->child_count - 1;
+  while ( lo < hi ) {
+    uint32_t const mid = (lo + hi + 1) / 2;
+    if ( start[mid] <= cluster ) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+
+  uint32_t const file_sector = sector - (((uint32_t) (start[lo] - inf->cluster_start)) << BPB_SECTORS_PER_CLUSTER_SHIFT);
+  uint32_t const file_sectors = ((uint32_t) (start[lo + 1] - start[lo])) << BPB_SECTORS_PER_CLUSTER_SHIFT;
+  if ( count > file_sectors - file_sector ) count = file_sectors - file_sector;
+
+  uint32_t const offset = file_sector * BPB_SECTOR_SIZE;
+  uint32_t const size = inf->dir->size(lo);
+  uint32_t copied = 0;
+  if ( size > offset ) {
+    copied = size - offset;
+    if ( copied > count * BPB_SECTOR_SIZE ) copied = count * BPB_SECTOR_SIZE;
+    inf->dir->read(lo, offset, data, copied);
+  }
+  memset(data + copied, 0, count * BPB_SECTOR_SIZE - copied);
+
+  return count;
+}
+
+// Fill up to count sectors of the data region, starting at sectionRelativeSector.
+// File lookup is done once, then sectors are filled until the end of that file's
+// clusters. Return number of sectors filled.
+static uint32_t read_data_sectors (GhostVolume_t const* vol, uint32_t sectionRelativeSector, uint32_t count, uint8_t *data) {
+#if CFG_UF2_FAT32
+  if ( sectionRelativeSector < ROOT_DIR_DATA_SECTORS ) {
+    if ( count > ROOT_DIR_DATA_SECTORS - sectionRelativeSector ) count = ROOT_DIR_DATA_SECTORS - sectionRelativeSector;
+
+    memset(data, 0, count * BPB_SECTOR_SIZE);
+    for ( uint32_t i = 0; i < count; i++ ) {
+      render_dir_sector(vol, DIR_ROOT, sectionRelativeSector + i, data + i * BPB_SECTOR_SIZE);
+    }
+    TUF2_STATS_ADD(sectors_read[TUF2_STATS_READ_DIR], count);
+    return count;
+  }
+#endif
+
+  uint32_t fid = info_index_of(vol, sectionRelativeSector);
+  FileContent_t const * inf = &vol->info[fid];
+
+  uint32_t fileRelativeSector = sectionRelativeSector - vol->file_sector_start[fid];
+
+  // CURRENT.UF2 also covers all the unused clusters up to the end of media
+  if ( !vol->tail_file || fid != vol->num_files - 1 ) {
+    // unused clusters of a volume without CURRENT.UF2
+    if ( sectionRelativeSector >= vol->file_sector_start[vol->num_files] ) {
+      memset(data, 0, count * BPB_SECTOR_SIZE);
+      return count;
+    }
+
+    uint32_t const sectorsLeftInFile = vol->file_sector_start[fid + 1] - sectionRelativeSector;
+    if ( count > sectorsLeftInFile ) {
+      count = sectorsLeftInFile;
+    }
+  }
+
+  if ( inf->dir ) {
+    TUF2_STATS_ADD(sectors_read[TUF2_STATS_READ_DIR], count);
+    return read_dir_sectors(vol, fid, fileRelativeSector, count, data);
+  }
+
+  TUF2_STATS_ADD(sectors_read[(vol->tail_file && fid == vol->num_files - 1) ? TUF2_STATS_READ_CURRENT_UF2 :
+                              TUF2_STATS_READ_FILE], count);
+
+  {
+    size_t fileContentStartOffset = fileRelativeSector * BPB_SECTOR_SIZE;
+    size_t fileContentLength = inf->size;
+    size_t bytesCopied = 0;
+
+    // nothing to copy if already past the end of the file (only when >1 sector per cluster)
+    if (fileContentLength > fileContentStartOffset) {
+      // limit number of bytes of data to be copied to remaining valid bytes
+      size_t bytesToCopy = fileContentLength - fileContentStartOffset;
+      // and further limit that to the requested sectors
+      if (bytesToCopy > count * BPB_SECTOR_SIZE) {
+        bytesToCopy = count * BPB_SECTOR_SIZE;
+      }
+
+      if ( inf->provider ) {
+        // generated straight into the buffer
+        inf->provider->read(fileContentStartOffset, data, bytesToCopy);
+      } else {
+        // obviously, 2nd and later sectors should not copy data from the start
+        const void * dataStart = (inf->content) + fileContentStartOffset;
+        memcpy(data, dataStart, bytesToCopy);
+      }
+      bytesCopied = bytesToCopy;
+    }
+
+    // zero padding up to the end of the last sector
+    memset(data + bytesCopied, 0, count * BPB_SECTOR_SIZE - bytesCopied);
+  }
+
+  return count;
+}
+
+#if !CFG_UF2_APP_EXPORT
+void uf2_read_block (uint32_t block_no, uint8_t *data) {
+  uf2_read_blocks(block_no, 1, data);
+}
+#endif
+
+// Each region handler clears only what it does not fill itself, so CURRENT.UF2
+// runs are not memset twice.
+static void volume_read_blocks (GhostVolume_t const* vol, uint32_t block_no, uint32_t block_count, uint8_t *data) {
+  while ( block_count ) {
+    uint32_t count;
+
+    if ( block_no < FS_START_CLUSTERS_SECTOR(vol) ) {
+      // Boot block, FAT tables and root directory
+      read_fs_sector(vol, block_no, data);
+      count = 1;
+      TUF2_STATS_INC(sectors_read[(block_no < FS_START_FAT0_SECTOR)         ? TUF2_STATS_READ_BOOT :
+                                  (block_no < FS_START_ROOTDIR_SECTOR(vol)) ? TUF2_STATS_READ_FAT  : TUF2_STATS_READ_DIR]);
+    }
+    else if ( block_no < vol->total_sectors ) {
+      // Request was to read from the data area (files, unused space, ...)
+      count = block_count;
+      if ( count > vol->total_sectors - block_no ) {
+        count = vol->total_sectors - block_no;
+      }
+      count = read_data_sectors(vol, block_no - FS_START_CLUSTERS_SECTOR(vol), count, data);
+    }
+    else {
+      // past the end of media
+      count = block_count;
+      memset(data, 0, count * BPB_SECTOR_SIZE);
+      TUF2_STATS_ADD(sectors_read[TUF2_STATS_READ_OUTSIDE], count);
+    }
+
+    block_no    += count;
+    block_count -= count;
+    data        += count * BPB_SECTOR_SIZE;
+  }
+}
+
+// Host is reading sequentially: let the file provider prefetch content of the next
+// block_count sectors, only files backed by flash do so.
+static void volume_read_ahead (GhostVolume_t const* vol, uint32_t block_no, uint32_t block_count) {
+  if ( block_no < FS_START_CLUSTERS_SECTOR(vol) || block_no >= vol->total_sectors ) return;
+
+  uint32_t const sectionRelativeSector = block_no - FS_START_CLUSTERS_SECTOR(vol);
+#if CFG_UF2_FAT32
+  if ( sectionRelativeSector < ROOT_DIR_DATA_SECTORS ) return;
+#endif
+
+  uint32_t const fid = info_index_of(vol, sectionRelativeSector);
+  uint32_t const offset = (sectionRelativeSector - vol->file_sector_start[fid]) * BPB_SECTOR_SIZE;
+  FileContent_t const * inf = &vol->info[fid];
+
+  if ( inf->provider && inf->provider->read_ahead && offset < inf->size ) {
+    inf->provider->read_ahead(offset, block_count * BPB_SECTOR_SIZE);
+  }
+}
+
+#if !CFG_UF2_APP_EXPORT
+void uf2_read_blocks (uint32_t block_no, uint32_t block_count, uint8_t *data) {
+#if !CFG_UF2_MEASUREMENT_LUN
+  // host read without TEST UNIT READY first
+  if ( !_measurement_scanned ) uf2_refresh();
+#endif
+
+  volume_read_blocks(&_uf2_volume, block_no, block_count, data);
+
+#if CFG_UF2_WRITE_OVERLAY_SECTORS
+  overlay_apply(block_no, block_count, data);
+#endif
+}
+
+void uf2_read_ahead (uint32_t block_no, uint32_t block_count) {
+  volume_read_ahead(&_uf2_volume, block_no, block_count);
+}
+#endif
+
+#if CFG_UF2_MEASUREMENT_LUN
+void uf2_measurement_read_blocks (uint32_t block_no, uint32_t block_count, uint8_t *data) {
+  // host read without TEST UNIT READY first
+  if ( !_measurement_scanned ) measurement_refresh();
+
+  volume_read_blocks(&_measurement_volume, block_no, block_count, data);
+}
+
+void uf2_measurement_read_ahead (uint32_t block_no, uint32_t block_count) {
+  volume_read_ahead(&_measurement_volume, block_no, block_count);
+}
+#endif
+
+/*------------------------------------------------------------------*/
+/* Write UF2
+ *------------------------------------------------------------------*/
+#if !CFG_UF2_APP_EXPORT
+
+#if CFG_UF2_WRITE_RANGES
+// Add block to the sorted written ranges, return true if it was not written before.
+// If the list is full and the block touches no range, it is not counted: the gap is
+// usually closed by later blocks which then merge ranges and free slots again.
+static bool session_mark(WriteSession* s, uint32_t block) {
+  uint8_t count = s->rangeCount;
+
+  // first range that ends at or after block
+  uint8_t i = 0;
+  while ( i < count && s->written[i].end < block ) i++;
+
+  if ( i < count ) {
+    if ( block >= s->written[i].start && block < s->written[i].end ) return false;
+
+    if ( block == s->written[i].end ) {
+      // append, possibly closing the gap to the next range
+      s->written[i].end++;
+      if ( i + 1 < count && s->written[i + 1].start == s->written[i].end ) {
+        s->written[i].end = s->written[i + 1].end;
+        memmove(&s->written[i + 1], &s->written[i + 2], (count - i - 2) * sizeof(s->written[0]));
+        s->rangeCount--;
+      }
+      return true;
+    }
+
+    if ( block + 1 == s->written[i].start ) {
+      s->written[i].start--;
+      return true;
+    }
+  }
+
+  if ( count >= CFG_UF2_WRITE_RANGES ) return false;
+
+  memmove(&s->written[i + 1], &s->written[i], (count - i) * sizeof(s->written[0]));
+  s->written[i].start = block;
+  s->written[i].end = block + 1;
+  s->rangeCount++;
+
+  return true;
+}
+#else
+static bool session_mark(WriteSession* s, uint32_t block) {
+  uint8_t const mask = 1 << (block % 8);
+  uint32_t const pos = block / 8;
+
+  if ( s->writtenMask[pos] & mask ) return false;
+
+  s->writtenMask[pos] |= mask;
+  return true;
+}
+#endif
+
+// Session of the uf2 file with num_blocks blocks, NULL if there is none
+static WriteSession* session_find(WriteState* state, uint32_t num_blocks) {
+  for ( uint8_t i = 0; i < state->sessionCount; i++ ) {
+    if ( state->session[i].numBlocks == num_blocks ) return &state->session[i];
+  }
+  return NULL;
+}
+
+// Session of the uf2 file with num_blocks blocks, started if it is a new one. Without room for it
+// (sessions or written bitmap) completion is no longer detected and NULL is returned
+static WriteSession* write_session(WriteState* state, uint32_t num_blocks) {
+  WriteSession* s = session_find(state, num_blocks);
+  if ( s || state->numBlocks == 0xffffffff ) return s;
+
+  if ( (!CFG_UF2_WRITE_RANGES && num_blocks >= MAX_BLOCKS) || state->sessionCount >= CFG_UF2_WRITE_SESSIONS ) {
+    state->numBlocks = 0xffffffff;
+    return NULL;
+  }
+
+  s = &state->session[state->sessionCount++];
+  s->numBlocks = num_blocks;
+  state->numBlocks += num_blocks;
+  return s;
+}
+
+// Count block of session s as written, return true if it was not written before
+static bool write_state_mark(WriteState* state, WriteSession* s, uint32_t block) {
+  if ( !session_mark(s, block) ) return false;
+  s->numWritten++;
+  state->numWritten++;
+  return true;
+}
+
+#if CFG_UF2_BLOCK_CRC
+// IEEE crc32 (reflected 0xEDB88320) by ROM or hardware if the board has it, else a nibble table
+static uint32_t block_crc32(uint32_t crc, uint8_t const* buf, uint32_t len) {
+  if ( board_crc32 ) return board_crc32(crc, buf, len);
+
+  static uint32_t const table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+
+  crc = ~crc;
+  for ( uint32_t i = 0; i < len; i++ ) {
+    crc = table[(crc ^ buf[i]) & 0x0F] ^ (crc >> 4);
+    crc = table[(crc ^ (buf[i] >> 4)) & 0x0F] ^ (crc >> 4);
+  }
+  return ~crc;
+}
+
+// Return false if the block carries a UF2_EXT_CRC32 tag that does not match its header and payload,
+// or if its extension tags are malformed. Blocks without the tag pass
+static bool block_crc_ok(UF2_Block const* bl) {
+  if ( !(bl->flags & UF2_FLAG_EXTENSION) ) return true;
+
+  // tags start 4 byte aligned after the payload, a zero size ends the list
+  uint32_t pos = (bl->payloadSize + 3) & ~3UL;
+  while ( pos + 4 <= sizeof(bl->data) ) {
+    uint8_t const* tag = bl->data + pos;
+    uint32_t const size = tag[0];
+    if ( size == 0 ) break;
+    if ( size < 4 || pos + size > sizeof(bl->data) ) return false;
+
+    uint32_t const type = tag[1] | ((uint32_t) tag[2] << 8) | ((uint32_t) tag[3] << 16);
+    if ( type == UF2_EXT_CRC32 ) {
+      uint32_t crc;
+      if ( size != 8 ) return false;
+      memcpy(&crc, tag + 4, 4);
+      return crc == block_crc32(0, (uint8_t const*) bl, 32 + bl->payloadSize);
+    }
+    pos += (size + 3) & ~3UL;
+  }
+  return true;
+}
+#endif
+
+// Range of flash that is known to hold the image already, verified by an MD5 block. Reset by block 0
+static uint32_t _md5_start;
+static uint32_t _md5_end;
+
+// Return true if flash already holds the payload of a UF2_FLAG_MD5 block, writing it can be skipped
+static bool md5_block_matches(UF2_Block const* bl) {
+  if ( !(bl->flags & UF2_FLAG_MD5) || !board_flash_md5_match ) return false;
+
+  uint32_t const addr = bl->targetAddr;
+  uint32_t const end = bl->targetAddr + bl->payloadSize;
+
+  // covered by the range of an earlier block
+  if ( addr >= _md5_start && end <= _md5_end ) return true;
+
+  uint8_t const* md5_info = bl->data + sizeof(bl->data) - 24;
+  uint32_t range_addr, range_len;
+  memcpy(&range_addr, md5_info, 4);
+  memcpy(&range_len, md5_info + 4, 4);
+
+  // checksum must cover this payload, payload must not overlap the checksum info
+  if ( bl->payloadSize > sizeof(bl->data) - 24 || addr < range_addr || end > range_addr + range_len ) return false;
+  if ( !board_flash_md5_match(range_addr, range_len, md5_info + 8) ) return false;
+
+  _md5_start = range_addr;
+  _md5_end = range_addr + range_len;
+  return true;
+}
+
+#if CFG_UF2_HEATSHRINK || CFG_UF2_DELTA
+// Payloads of compressed and delta files form a single stream, next expected block is _stream_next
+static uint32_t _stream_next;
+
+// Return true if block is the next one of the stream and must be processed
+static bool stream_block_next(UF2_Block const* bl, WriteState* state) {
+  if ( bl->blockNo == 0 ) _stream_next = 0;
+
+  // already processed, host is rewriting it
+  if ( bl->blockNo < _stream_next ) return false;
+
+  // stream can only be processed in order
+  if ( bl->blockNo > _stream_next ) {
+    TUF2_LOG1("Stream block %lu out of order\r\n", bl->blockNo);
+    state->aborted = true;
+    return false;
+  }
+
+  return true;
+}
+#endif
+
+#if CFG_UF2_HEATSHRINK
+// Decompressed data of the stream is written from _dec_addr on
+static uint32_t _dec_addr;
+static uint32_t _dec_start;
+
+static void compressed_output(uint8_t const* data, uint32_t len, void* arg) {
+  WriteState* state = (WriteState*) arg;
+  if ( state->aborted ) return;
+
+  // first decoded bytes are the image header, nothing is erased yet
+  if ( _dec_addr == _dec_start && board_flash_check_image && !board_flash_check_image(_dec_addr, data, len) ) {
+    TUF2_LOG1("Image rejected\r\n");
+    state->aborted = true;
+    return;
+  }
+
+  if ( _dec_addr + len > state->resumeAddr ) board_flash_write(_dec_addr, data, len);
+  _dec_addr += len;
+}
+
+// Return false if flash is busy and the block must be retried
+static bool write_compressed_block(UF2_Block const* bl, WriteState* state) {
+  if ( !stream_block_next(bl, state) ) return true;
+
+  if ( bl->blockNo == 0 ) {
+    decompress_init();
+    _dec_addr = _dec_start = bl->targetAddr;
+  }
+
+  if ( board_flash_write_busy && board_flash_write_busy(_dec_addr) ) return false;
+
+  decompress_feed(bl->data, bl->payloadSize, compressed_output, state);
+  _stream_next++;
+
+  return true;
+}
+#endif
+
+#if CFG_UF2_DELTA
+// Return false if flash is busy and the block must be retried
+static bool write_delta_block(UF2_Block const* bl, WriteState* state) {
+  if ( !stream_block_next(bl, state) ) return true;
+
+  if ( bl->blockNo == 0 ) delta_init(bl->targetAddr);
+
+  if ( board_flash_write_busy && board_flash_write_busy(delta_addr()) ) return false;
+
+  if ( !delta_feed(bl->data, bl->payloadSize) ) {
+    TUF2_LOG1("Delta rejected\r\n");
+    state->aborted = true;
+  }
+  _stream_next++;
+
+  return true;
+}
+#endif
+
+// All blocks written: flush last blocks, then a single pass/fail check of the whole image
+static void write_state_complete(WriteState* state) {
+#if CFG_UF2_FILE_CONTAINER
+  // files of the session are committed before the image is checked and possibly booted
+  file_container_flush();
+#endif
+
+  uint32_t const start_us = TUF2_STATS_US();
+  board_flash_flush();
+  TUF2_STATS_MAX(flush_max_us, TUF2_STATS_US() - start_us);
+
+  // abort DFU if it does not match
+  if ( board_flash_verify && !board_flash_verify() ) {
+    state->aborted = true;
+  }
+}
+
+#if CFG_UF2_RAW_BIN
+//--------------------------------------------------------------------+
+// Raw .bin ingest, see CFG_UF2_RAW_BIN. One file per session, its sector n is block n of the WriteState
+//--------------------------------------------------------------------+
+
+#ifdef CFG_UF2_RAW_BIN_ROUTES
+static struct {
+  char name[8];
+  uint32_t family;
+} const _raw_route[] = { CFG_UF2_RAW_BIN_ROUTES };
+#endif
+
+static struct {
+  uint32_t family;    // 0 until a file is found
+  uint32_t cluster;   // first cluster
+  uint32_t size;      // from the directory entry, 0 until known
+} _raw;
+
+// image is the first write session, its block count is known with the directory entry
+static inline WriteSession* raw_session(WriteState* state) {
+  if ( state->sessionCount == 0 ) state->sessionCount = 1;
+  return &state->session[0];
+}
+
+#if CFG_UF2_FAT32
+  #define RAW_FAT_EOC_MIN  0x0FFFFFF8UL
+  #define RAW_FAT_MASK     0x0FFFFFFFUL
+#else
+  #define RAW_FAT_EOC_MIN  0xFFF8UL
+  #define RAW_FAT_MASK     0xFFFFUL
+#endif
+
+#define RAW_CLUSTER_LBA(_c)  (FS_START_CLUSTERS_SECTOR(&_uf2_volume) + CLUSTER_SECTOR(_c))
+
+static uint32_t raw_family(DirEntry const* d) {
+#ifdef CFG_UF2_RAW_BIN_ROUTES
+  for ( uint32_t i = 0; i < UF2_ARRAY_SIZE(_raw_route); i++ ) {
+    if ( 0 == memcmp(d->name, _raw_route[i].name, sizeof(d->name)) ) return _raw_route[i].family;
+  }
+#else
+  (void) d;
+#endif
+  return BOARD_UF2_FAMILY_ID;
+}
+
+// Largest file the target takes, routed partitions are checked by board_flash_write_family()
+static uint32_t raw_limit(void) {
+  return (_raw.family == BOARD_UF2_FAMILY_ID) ? _flash_size : CFG_UF2_FLASH_SIZE;
+}
+
+// Check the chain entries of the file within one FAT sector: each cluster points to the next, the last
+// one ends the chain. Return false if the host fragmented the file
+static bool raw_chain_check(uint8_t const* sector, uint32_t fat_sector) {
+  if ( !_raw.size ) return true;
+
+  fat_entry_t const* fat = (fat_entry_t const*) (void const*) sector;
+  uint32_t const first = fat_sector * FAT_ENTRIES_PER_SECTOR;
+  uint32_t const last = _raw.cluster + FILE_CLUSTERS(_raw.size) - 1;
+
+  for ( uint32_t i = 0; i < FAT_ENTRIES_PER_SECTOR; i++ ) {
+    uint32_t const cluster = first + i;
+    if ( cluster < _raw.cluster || cluster > last ) continue;
+
+    uint32_t const next = fat[i] & RAW_FAT_MASK;
+    if ( cluster == last ? (next < RAW_FAT_EOC_MIN) : (next != cluster + 1) ) return false;
+  }
+  return true;
+}
+
+static void raw_abort(WriteState* state, char const* reason) {
+  if ( !state->aborted ) {
+    TUF2_LOG1("Raw image: %s\r\n", reason);
+  }
+  state->aborted = true;
+}
+
+// Root directory sector written by the host: the first new *.BIN file is the image
+static void raw_dir_write(uint8_t const* data, WriteState* state) {
+  DirEntry const* d = (DirEntry const*) (void const*) data;
+
+  for ( uint32_t i = 0; i < DIRENTRIES_PER_SECTOR; i++, d++ ) {
+    if ( d->name[0] == 0 || (uint8_t) d->name[0] == 0xE5 || (d->attrs & (DIR_ATTR_VOLUME_LABEL | DIR_ATTR_DIRECTORY)) ||
+         memcmp(d->ext, "BIN", 3) ) {
+      continue;
+    }
+
+    // generated files such as CURRENT.BIN are below the first unused cluster
+    uint32_t const cluster = ((uint32_t) d->highStartCluster << 16 | d->startCluster) & RAW_FAT_MASK;
+    if ( cluster < _uf2_volume.first_unused_cluster ) continue;
+
+    uint32_t const family = raw_family(d);
+    if ( _raw.family == 0 ) {
+      _raw.family = family;
+      _raw.cluster = cluster;
+      TUF2_LOG1("Raw image %.8s.BIN at cluster %lu\r\n", d->name, cluster);
+    } else if ( cluster != _raw.cluster ) {
+      continue;
+    } else if ( family != _raw.family ) {
+      raw_abort(state, "name does not match its content");
+      return;
+    }
+
+    // the host may extend the file, never shrink it
+    if ( d->size > _raw.size ) {
+      if ( d->size > raw_limit() ) {
+        raw_abort(state, "larger than its partition");
+        return;
+      }
+      _raw.size = d->size;
+
+      WriteSession* s = raw_session(state);
+      uint32_t const num_blocks = UF2_DIV_CEIL(_raw.size, BPB_SECTOR_SIZE);
+      state->numBlocks += num_blocks - s->numBlocks;
+      s->numBlocks = num_blocks;
+
+      // FAT sectors the host already wrote
+      for ( uint32_t sec = 0; sec < _uf2_volume.sectors_per_fat; sec++ ) {
+        uint8_t const* fat = overlay_find(FS_START_FAT0_SECTOR + sec);
+        if ( fat && !raw_chain_check(fat, sec) ) {
+          raw_abort(state, "clusters are not contiguous");
+          return;
+        }
+      }
+
+      if ( state->numWritten >= state->numBlocks ) write_state_complete(state);
+    }
+    return;
+  }
+}
+
+// Data sector of the image. Return -1 if it is not one, 0 if flash is busy, BPB_SECTOR_SIZE if consumed
+static int raw_data_write(uint32_t block_no, uint8_t const* data, WriteState* state) {
+  uint32_t const rel = block_no - (FS_START_CLUSTERS_SECTOR(&_uf2_volume) + ROOT_DIR_DATA_SECTORS);
+  uint32_t const cluster = ((rel + ROOT_DIR_DATA_SECTORS) >> BPB_SECTORS_PER_CLUSTER_SHIFT) + 2;
+
+  if ( _raw.family == 0 ) {
+    // written before its metadata: an app image header at the start of a free cluster
+    if ( (rel & (BPB_SECTORS_PER_CLUSTER - 1)) || cluster < _uf2_volume.first_unused_cluster ||
+         !board_flash_check_image || !board_flash_check_image(BOARD_FLASH_APP_START, data, BPB_SECTOR_SIZE) ) {
+      return -1;
+    }
+    _raw.family = BOARD_UF2_FAMILY_ID;
+    _raw.cluster = cluster;
+    TUF2_LOG1("Raw image header at cluster %lu\r\n", cluster);
+  }
+
+  if ( block_no < RAW_CLUSTER_LBA(_raw.cluster) ) return -1;
+  uint32_t const offset = (block_no - RAW_CLUSTER_LBA(_raw.cluster)) * BPB_SECTOR_SIZE;
+  uint32_t const limit = _raw.size ? _raw.size : raw_limit();
+  if ( offset >= limit ) return -1;
+
+  if ( state->aborted ) return BPB_SECTOR_SIZE;
+
+  uint32_t const len = (limit - offset < BPB_SECTOR_SIZE) ? (limit - offset) : BPB_SECTOR_SIZE;
+  if ( _raw.family == BOARD_UF2_FAMILY_ID ) {
+    if ( handoff_mode(UF2_HANDOFF_MODE_LOGS) ) {
+      raw_abort(state, "firmware update disabled by handoff");
+      return BPB_SECTOR_SIZE;
+    }
+    if ( offset == 0 && board_flash_check_image && !board_flash_check_image(BOARD_FLASH_APP_START, data, len) ) {
+      raw_abort(state, "rejected");
+      return BPB_SECTOR_SIZE;
+    }
+
+    uint32_t const addr = BOARD_FLASH_APP_START + offset;
+    if ( board_flash_write_busy && board_flash_write_busy(addr) ) return 0;
+    if ( board_flash_erase_ahead && _raw.size ) board_flash_erase_ahead(addr, _raw.size - offset);
+    board_flash_write(addr, data, len);
+  } else if ( !board_flash_write_family || !board_flash_write_family(_raw.family, offset, data, len) ) {
+    raw_abort(state, "no partition for its name");
+    return BPB_SECTOR_SIZE;
+  }
+
+  write_state_mark(state, raw_session(state), offset / BPB_SECTOR_SIZE);
+  if ( state->numBlocks && state->numWritten >= state->numBlocks ) write_state_complete(state);
+
+  return BPB_SECTOR_SIZE;
+}
+
+// Non-uf2 sector written by the host. Return -1 if it is not image data (metadata is only looked at)
+static int raw_write(uint32_t block_no, uint8_t const* data, WriteState* state) {
+  if ( block_no < FS_START_FAT0_SECTOR ) return -1;
+
+  if ( block_no < FS_START_ROOTDIR_SECTOR(&_uf2_volume) ) {
+    uint32_t fat_sector = block_no - FS_START_FAT0_SECTOR;
+    if ( fat_sector >= _uf2_volume.sectors_per_fat ) fat_sector -= _uf2_volume.sectors_per_fat;
+    if ( _raw.family && !raw_chain_check(data, fat_sector) ) raw_abort(state, "clusters are not contiguous");
+    return -1;
+  }
+
+  if ( block_no < FS_START_CLUSTERS_SECTOR(&_uf2_volume) + ROOT_DIR_DATA_SECTORS ) {
+    raw_dir_write(data, state);
+    return -1;
+  }
+
+  return raw_data_write(block_no, data, state);
+}
+#endif
+
+/**
+ * Write an uf2 block wrapped by 512 sector.
+ * @return number of bytes processed, only 3 following values
+ *  -1 : if not an uf2 block
+ * 512 : write is successful (BPB_SECTOR_SIZE == 512)
+ *   0 : is busy with flashing, tinyusb stack will call write_block again with the same parameters later on
+ */
+int uf2_write_block (uint32_t block_no, uint8_t *data, WriteState *state) {
+  UF2_Block *bl = (void*) data;
+
+#if CFG_UF2_STATUS || CFG_UF2_INFO_JSON
+  _status_state = state;
+#endif
+
+#if CFG_UF2_FILE_CONTAINER
+  bool const file = is_file_block(bl);
+#else
+  bool const file = false;
+#endif
+
+  if ( !file && !is_uf2_block(bl) ) {
+    // added by ENERTY
+    SerialNum_Block *sn = (void*) data;
+    if ( is_serialnum_block(sn) ) {
+      serial_load();
+
+      // same serial number is written again by host OS re-sending the sector, nothing to do. One that is
+      // only in NVS yet is still burnt in by a board that can
+      uint8_t burnt[6];
+      bool const stored = !board_serial_write || (board_serial_read && board_serial_read(burnt));
+      if ( stored && 0 == memcmp(_serial_hex, sn->serialNumber, sizeof(_serial_hex)) ) return BPB_SECTOR_SIZE;
+
+      // burn it in once if the board can, otherwise write it to nvs. Reset is deferred so that firmware
+      // can follow in the same session
+      if ( board_serial_write ) {
+        if ( !board_serial_write(sn->serialNumber) ) return -1;
+      } else {
+        esp_err_t err = serialnum_to_nvs(sn->serialNumber);
+        if (err != ESP_OK) {
+          return -1;
+        }
+      }
+
+      // INFO_UF2.TXT is rendered from _serial_hex, same length so only its contents change
+      memcpy(_serial_hex, sn->serialNumber, sizeof(_serial_hex));
+#if CFG_UF2_RETAINED_CACHE
+      serial_cache(_serial_hex);
+#endif
+      _info_changed = true;
+      state->serialWritten = true;
+      return BPB_SECTOR_SIZE;
+    }
+
+#if CFG_UF2_MEASUREMENT_BINARY
+    if ( is_ack_block((Ack_Block const*) data) ) {
+      return ack_write((Ack_Block const*) data) ? BPB_SECTOR_SIZE : -1;
+    }
+#endif
+
+    // signature comes first in the file, image is hashed as it is flushed
+    if ( is_sign_block((Sign_Block const*) data) && board_flash_signature ) {
+      Sign_Block const* sg = (Sign_Block const*) data;
+      board_flash_signature(sg->imageLen, sg->signature);
+      return BPB_SECTOR_SIZE;
+    }
+
+#if CFG_UF2_MEASUREMENT_ERASE
+    if ( is_erase_block((Erase_Block const*) data) ) {
+      return erase_write((Erase_Block const*) data) ? BPB_SECTOR_SIZE : -1;
+    }
+#endif
+
+#if CFG_UF2_LKG_SNAPSHOT
+    if ( is_rollback_block((Rollback_Block const*) data) ) {
+      return rollback_write((Rollback_Block const*) data, state) ? BPB_SECTOR_SIZE : -1;
+    }
+#endif
+
+#if CFG_UF2_VERIFY
+    if ( is_verify_block((Verify_Block const*) data) ) {
+      verify_write((Verify_Block const*) data);
+      return BPB_SECTOR_SIZE;
+    }
+#endif
+
+#if CFG_UF2_STATS
+    if ( is_bench_block((Bench_Block const*) data) ) {
+      bench_block_write((Bench_Block const*) data);
+      return BPB_SECTOR_SIZE;
+    }
+#endif
+
+#if CFG_UF2_CONFIG
+    // CONFIG.TXT data or a directory sector that may point to a new one, kept in the overlay as well
+    config_write(block_no, data);
+#endif
+
+#if CFG_UF2_RAW_BIN
+    // data of a raw .bin file goes to flash, its directory entry and FAT are also kept in the overlay
+    int const raw = raw_write(block_no, data, state);
+    if ( raw >= 0 ) return raw;
+#endif
+
+#if CFG_UF2_WRITE_OVERLAY_SECTORS
+    // FAT, directory or OS metadata sector, read back as written
+    overlay_write(block_no, data);
+#else
+    (void) block_no;
+#endif
+    return -1;
+  }
+
+  // image was rejected, drop remaining blocks without touching flash
+  if ( state->aborted ) return BPB_SECTOR_SIZE;
+
+#if CFG_UF2_BLOCK_CRC
+  // corrupted on the way: neither written nor counted, the image stays incomplete instead of reaching flash
+  if ( !block_crc_ok(bl) ) {
+    TUF2_LOG1("Block %lu crc mismatch\r\n", bl->blockNo);
+    TUF2_STATS_INC(crc_rejected);
+    return BPB_SECTOR_SIZE;
+  }
+#endif
+
+#if CFG_UF2_FILE_CONTAINER
+  if ( file ) {
+    // file of the data partition, counted towards completion like the app. One that can not be written
+    // is only logged, the firmware of the same session is still applied
+    file_container_write((char const*) bl->data + bl->payloadSize, bl->targetAddr, bl->data, bl->payloadSize,
+                         bl->familyID);
+  }else
+#endif
+  if (bl->familyID == BOARD_UF2_FAMILY_ID) {
+    // logs only session, application asked not to be replaced
+    if ( handoff_mode(UF2_HANDOFF_MODE_LOGS) ) {
+      if ( !state->aborted ) {
+        TUF2_LOG1("Firmware update disabled by handoff\r\n");
+      }
+      state->aborted = true;
+      return BPB_SECTOR_SIZE;
+    }
+
+    // generic family ID
+    bool const compressed = CFG_UF2_HEATSHRINK && (bl->flags & UF2_FLAG_HEATSHRINK);
+    bool const delta = CFG_UF2_DELTA && (bl->flags & UF2_FLAG_DELTA);
+
+    // header of a compressed image is checked once decoded, a delta is checked against its base image
+    if ( !compressed && !delta && board_flash_check_image && bl->blockNo == 0 &&
+         !board_flash_check_image(bl->targetAddr, bl->data, bl->payloadSize) ) {
+      TUF2_LOG1("Image rejected\r\n");
+      state->aborted = true;
+      return BPB_SECTOR_SIZE;
+    }
+
+    if ( bl->blockNo == 0 ) _md5_start = _md5_end = 0;
+
+    // an interrupted delta has modified its own base, it can not be resumed
+    if ( !delta && board_flash_resume && bl->blockNo == 0 ) {
+      state->resumeAddr = board_flash_resume(bl->data, bl->payloadSize, bl->numBlocks);
+    }
+
+#if CFG_UF2_HEATSHRINK
+    if ( compressed ) {
+      if ( !write_compressed_block(bl, state) ) return 0;
+    } else
+#endif
+#if CFG_UF2_DELTA
+    if ( delta ) {
+      if ( !write_delta_block(bl, state) ) return 0;
+    } else
+#endif
+    // skip blocks already flashed by an interrupted download of the same image or that flash already holds
+    // according to their MD5, still counted below
+    if ( bl->targetAddr + bl->payloadSize > state->resumeAddr && !md5_block_matches(bl) ) {
+      if ( board_flash_write_busy && board_flash_write_busy(bl->targetAddr) ) return 0;
+
+      // uf2 blocks are sent in ascending order, remaining blocks follow this one.
+      // Not with MD5 blocks, erasing ahead would destroy matching data of the following blocks
+      if ( board_flash_erase_ahead && !(bl->flags & UF2_FLAG_MD5) && bl->blockNo < bl->numBlocks ) {
+        board_flash_erase_ahead(bl->targetAddr, (bl->numBlocks - bl->blockNo) * bl->payloadSize);
+      }
+
+      board_flash_write(bl->targetAddr, bl->data, bl->payloadSize);
+    }
+  }else if ( board_flash_write_family && board_flash_write_family(bl->familyID, bl->targetAddr, bl->data, bl->payloadSize) ) {
+    // may be the measurement partition
+    measurement_cache_invalidate();
+    // other family routed by board to its own partition, counted towards completion like the app
+#if CFG_UF2_RETAINED_CACHE
+    // may be NVS or measurement data
+    retained_clear();
+#endif
+  }else {
+    // TODO family matches VID/PID
+    return -1;
+  }
+
+  //------------- Update written blocks -------------//
+  if ( bl->numBlocks && bl->blockNo < bl->numBlocks ) {
+    // session of the uf2 file the block belongs to, another file is told apart by its numBlocks
+    WriteSession* s = write_session(state, bl->numBlocks);
+
+    if ( s && (CFG_UF2_WRITE_RANGES || bl->blockNo < MAX_BLOCKS) ) {
+      // only increase written number with new write (possibly prevent overwriting from OS)
+      write_state_mark(state, s, bl->blockNo);
+
+      // flush last blocks of all sessions
+      // TODO numWritten can be smaller than numBlocks if return early
+      if ( state->numWritten >= state->numBlocks ) write_state_complete(state);
+    }
+  }
+
+  return BPB_SECTOR_SIZE;
+}
+
+// app block whose payload is written as is, a block failing its crc is left to uf2_write_block()
+static inline bool is_plain_block(UF2_Block const* bl) {
+  if ( !is_uf2_block(bl) || bl->familyID != BOARD_UF2_FAMILY_ID ||
+       (bl->flags & (UF2_FLAG_MD5 | UF2_FLAG_HEATSHRINK | UF2_FLAG_DELTA)) ) {
+    return false;
+  }
+#if CFG_UF2_BLOCK_CRC
+  if ( !block_crc_ok(bl) ) return false;
+#endif
+  return true;
+}
+
+// Number of leading sectors forming a run of plain blocks with consecutive block numbers and
+// contiguous target addresses. Block 0 (image check, resume) and the first block that sets
+// numBlocks always go through uf2_write_block(). Return 0 if there is no run.
+static uint32_t plain_run_length(uint8_t const* data, uint32_t count, WriteState* state) {
+  UF2_Block const* first = (void const*) data;
+  if ( state->aborted || !is_plain_block(first) || first->blockNo == 0 || first->blockNo >= first->numBlocks ||
+       !session_find(state, first->numBlocks) ) {
+    return 0;
+  }
+
+  uint32_t addr = first->targetAddr + first->payloadSize;
+  uint32_t n = 1;
+  for ( ; n < count && first->blockNo + n < first->numBlocks; n++ ) {
+    UF2_Block const* bl = (void const*) (data + n * BPB_SECTOR_SIZE);
+    if ( !is_plain_block(bl) || bl->blockNo != first->blockNo + n || bl->numBlocks != first->numBlocks ||
+         bl->targetAddr != addr ) {
+      break;
+    }
+    addr += bl->payloadSize;
+  }
+
+  // written bitmap only has room for MAX_BLOCKS
+  if ( !CFG_UF2_WRITE_RANGES && first->blockNo + n > MAX_BLOCKS ) return 0;
+
+  return n;
+}
+
+// Write a run found by plain_run_length(): flash busy check and erase ahead are done once for the
+// whole run, payloads go straight from the USB buffer into the flash cache. Return false if flash
+// is busy and the run must be retried.
+static bool write_plain_run(uint8_t const* data, uint32_t n, WriteState* state) {
+  UF2_Block const* first = (void const*) data;
+  UF2_Block const* last = (void const*) (data + (n - 1) * BPB_SECTOR_SIZE);
+
+  if ( last->targetAddr + last->payloadSize > state->resumeAddr ) {
+    // run is smaller than a flash cache window, it touches at most two of them
+    if ( board_flash_write_busy &&
+         (board_flash_write_busy(first->targetAddr) || board_flash_write_busy(last->targetAddr)) ) {
+      return false;
+    }
+
+    if ( board_flash_erase_ahead && first->blockNo < first->numBlocks ) {
+      board_flash_erase_ahead(first->targetAddr, (first->numBlocks - first->blockNo) * first->payloadSize);
+    }
+
+    for ( uint32_t i = 0; i < n; i++ ) {
+      UF2_Block const* bl = (void const*) (data + i * BPB_SECTOR_SIZE);
+      if ( bl->targetAddr + bl->payloadSize > state->resumeAddr ) {
+        board_flash_write(bl->targetAddr, bl->data, bl->payloadSize);
+      }
+    }
+  }
+
+  WriteSession* s = session_find(state, first->numBlocks);
+  for ( uint32_t i = 0; i < n; i++ ) {
+    write_state_mark(state, s, first->blockNo + i);
+  }
+
+  if ( state->numWritten >= state->numBlocks ) write_state_complete(state);
+
+  return true;
+}
+
+// Write count sectors of a WRITE10 buffer, return number of sectors processed. Processing stops
+// early only if flash is busy, the caller passes the remaining sectors again later on.
+uint32_t uf2_write_blocks (uint32_t block_no, uint8_t *data, uint32_t count, WriteState *state) {
+  uint32_t done = 0;
+
+  while ( done < count ) {
+    uint8_t* sector = data + done * BPB_SECTOR_SIZE;
+    uint32_t n = plain_run_length(sector, count - done, state);
+    bool written;
+
+    TUF2_TRACE_BEGIN(TUF2_TRACE_UF2_WRITE);
+    if ( n > 1 ) {
+      written = write_plain_run(sector, n, state);
+    } else {
+      // non-uf2 block write is consumed as well
+      n = 1;
+      written = (0 != uf2_write_block(block_no + done, sector, state));
+    }
+    TUF2_TRACE_END(TUF2_TRACE_UF2_WRITE);
+
+    if ( !written ) break;
+    done += n;
+  }
+
+  return done;
+}
+#endif
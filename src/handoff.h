@@ -0,0 +1,100 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef TUF2_HANDOFF_H_
+#define TUF2_HANDOFF_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Handoff block filled by the application before it resets into UF2 (reset hint), in memory
+// retained across the reset. tinyuf2 then uses what the application already knows instead of
+// reading NVS and scanning flash. A block is used once, fields without their flag are looked up
+// as usual. Application fills the block, sets flags and calls uf2_handoff_seal() last.
+//
+// On espressif it follows the boot log and partition cache in the reserved RTC memory, see UF2_HANDOFF_OFFSET: e.g
+//   uf2_handoff_t* h = (uf2_handoff_t*) (bootloader_common_get_rtc_retain_mem()->custom + UF2_HANDOFF_OFFSET);
+//   ... fill h, uf2_handoff_seal(h);
+//   bootloader_common_update_rtc_retain_mem(NULL, false); // otherwise bootloader clears the memory
+//--------------------------------------------------------------------+
+
+#define UF2_HANDOFF_MAGIC   0x46485546UL // "UFHF"
+
+// offset in the espressif reserved RTC memory, boot log and partition cache (bootpart.h) come first
+#define UF2_HANDOFF_OFFSET  128
+
+// fields set by the application
+enum {
+  UF2_HANDOFF_SERIAL      = 0x01, // serial_hex
+  UF2_HANDOFF_MEASUREMENT = 0x02, // measurement_size
+  UF2_HANDOFF_APP         = 0x04, // app_len and app_sha256
+};
+
+enum {
+  UF2_HANDOFF_MODE_ALL = 0,   // firmware and measurement data
+  UF2_HANDOFF_MODE_FIRMWARE,  // firmware only, measurement files are empty
+  UF2_HANDOFF_MODE_LOGS,      // measurement data only, CURRENT.UF2 is empty and firmware blocks are dropped
+};
+
+typedef struct {
+  uint32_t magic;
+  uint8_t  flags;             // UF2_HANDOFF_ fields that are set
+  uint8_t  mode;              // UF2_HANDOFF_MODE_
+  uint8_t  serial_hex[6];     // hardware identifier and serial number, as stored in NVS
+  uint32_t measurement_size;  // length of valid measurement data in bytes
+  uint32_t app_len;           // running image length including the appended sha256
+  uint8_t  app_sha256[32];    // sha256 appended to the running image (its last 32 bytes)
+  uint32_t check;             // uf2_handoff_check()
+} uf2_handoff_t;
+
+// rotate-xor of all words before check
+static inline uint32_t uf2_handoff_check(uf2_handoff_t const* h) {
+  uint32_t const* word = (uint32_t const*) h;
+  uint32_t sum = UF2_HANDOFF_MAGIC;
+  for ( uint32_t i = 0; i < (sizeof(uf2_handoff_t) - 4) / 4; i++ ) {
+    sum = ((sum << 5) | (sum >> 27)) ^ word[i];
+  }
+  return sum;
+}
+
+static inline void uf2_handoff_seal(uf2_handoff_t* h) {
+  h->magic = UF2_HANDOFF_MAGIC;
+  h->check = uf2_handoff_check(h);
+}
+
+static inline bool uf2_handoff_valid(uf2_handoff_t const* h) {
+  return h->magic == UF2_HANDOFF_MAGIC && h->check == uf2_handoff_check(h);
+}
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
@@ -0,0 +1,112 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "board_api.h"
+#include "log_deferred.h"
+
+#if CFG_UF2_LOG_DEFERRED
+
+//--------------------------------------------------------------------+
+// MACRO TYPEDEF CONSTANT ENUM DECLARATION
+//--------------------------------------------------------------------+
+
+#if CFG_UF2_LOG_DEFERRED_DEPTH & (CFG_UF2_LOG_DEFERRED_DEPTH - 1)
+  #error "CFG_UF2_LOG_DEFERRED_DEPTH must be a power of 2"
+#endif
+
+typedef struct {
+  uint32_t seq;   // record number + 1 once complete, 0 while being written
+  char const* fmt;
+  uint32_t args[TUF2_LOG_DEFERRED_ARGS];
+} log_record_t;
+
+static log_record_t _ring[CFG_UF2_LOG_DEFERRED_DEPTH];
+
+static uint32_t _head;    // records reserved
+static uint32_t _tail;    // next record to print, only used by tuf2_log_drain()
+static uint32_t _dropped;
+
+//--------------------------------------------------------------------+
+//
+//--------------------------------------------------------------------+
+
+void tuf2_log_record(char const* fmt, uint32_t argc, ...) {
+  uint32_t const num = __atomic_fetch_add(&_head, 1, __ATOMIC_RELAXED);
+  log_record_t* rec = &_ring[num & (CFG_UF2_LOG_DEFERRED_DEPTH - 1)];
+
+  // seqlock: drain discards a record that changed while it was copied
+  __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  va_list ap;
+  va_start(ap, argc);
+  for (uint32_t i = 0; i < TUF2_LOG_DEFERRED_ARGS; i++) {
+    rec->args[i] = (i < argc) ? va_arg(ap, uint32_t) : 0;
+  }
+  va_end(ap);
+  rec->fmt = fmt;
+
+  __atomic_store_n(&rec->seq, num + 1, __ATOMIC_RELEASE);
+}
+
+void tuf2_log_drain(void) {
+  while (1) {
+    uint32_t const head = __atomic_load_n(&_head, __ATOMIC_RELAXED);
+    if (_tail == head) break;
+
+    // overrun: oldest records are gone
+    if (head - _tail > CFG_UF2_LOG_DEFERRED_DEPTH) {
+      _dropped += head - _tail - CFG_UF2_LOG_DEFERRED_DEPTH;
+      _tail = head - CFG_UF2_LOG_DEFERRED_DEPTH;
+    }
+
+    log_record_t* rec = &_ring[_tail & (CFG_UF2_LOG_DEFERRED_DEPTH - 1)];
+    uint32_t const seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+
+    // still being written, print it next time
+    if (seq == 0 || seq < _tail + 1) break;
+
+    log_record_t copy = *rec;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if (seq != _tail + 1 || __atomic_load_n(&rec->seq, __ATOMIC_RELAXED) != seq) {
+      // overwritten by a newer record
+      _dropped++;
+      _tail++;
+      continue;
+    }
+    _tail++;
+
+    if (_dropped) {
+      printf("(%lu log records dropped)\r\n", (unsigned long) _dropped);
+      _dropped = 0;
+    }
+    printf(copy.fmt, copy.args[0], copy.args[1], copy.args[2], copy.args[3], copy.args[4], copy.args[5]);
+  }
+}
+
+#endif
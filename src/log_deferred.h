@@ -0,0 +1,70 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef TUF2_LOG_DEFERRED_H_
+#define TUF2_LOG_DEFERRED_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Deferred TUF2_LOG backend: a log site only stores the format string pointer and its raw 32-bit
+// arguments into a ring buffer, printf() runs later from tuf2_log_drain() outside the hot paths.
+// Arguments must stay valid until drained, "%s" is fine for literals and static names only.
+// Records are reserved with an atomic add, any task or ISR can log. When the ring is full the
+// oldest records are dropped and counted.
+//--------------------------------------------------------------------+
+
+#ifndef CFG_UF2_LOG_DEFERRED
+#define CFG_UF2_LOG_DEFERRED        0
+#endif
+
+// number of records, power of 2
+#ifndef CFG_UF2_LOG_DEFERRED_DEPTH
+#define CFG_UF2_LOG_DEFERRED_DEPTH  64
+#endif
+
+// arguments per record, at most this many per log site
+#define TUF2_LOG_DEFERRED_ARGS      6
+
+#define TUF2_LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _n, ...)  _n
+#define TUF2_LOG_NARGS(...)  TUF2_LOG_NARGS_(_0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+
+#define TUF2_LOG_DEFER(_fmt, ...)  tuf2_log_record(_fmt, TUF2_LOG_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+
+// Queue a record, arguments are read as uint32_t (32-bit targets: int, long and pointers)
+void tuf2_log_record(char const* fmt, uint32_t argc, ...);
+
+// Print queued records, called from the main loop (or lowest priority task)
+void tuf2_log_drain(void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
@@ -31,6 +31,12 @@
 #include "board_api.h"
 #include "uf2.h"
 #include "tusb.h"
+#include "sched.h"
+
+#if TINYUF2_DISPLAY && CFG_TUSB_OS == OPT_OS_FREERTOS
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
 
 #include "rom/rtc.h" // for RTC_RESET_CAUSE_REG
 
@@ -57,8 +63,10 @@ static volatile uint32_t _timer_count = 0;
 static bool check_dfu_mode(void);
 
 int main(void) {
+  TUF2_BOOT_STAGE(BOOTLOG_MAIN);
   board_init();
   if (board_init2) board_init2();
+  TUF2_BOOT_STAGE(BOOTLOG_BOARD_INIT);
   TUF2_LOG1("TinyUF2\r\n");
   
 
@@ -78,22 +86,50 @@ int main(void) {
   }
 
   TUF2_LOG1("Start DFU mode\r\n");
+  TUF2_BOOT_STAGE(BOOTLOG_DFU_CHECK);
   board_dfu_init();
-  board_flash_init();
-  uf2_init();
-
-  tud_init(BOARD_TUD_RHPORT);
 
+  // USB starts first: with an RTOS the host enumerates while the rest is initialized below,
+  // MSC answers NOT READY until uf2_init() is done. Set before mount callback can change it
   indicator_set(STATE_USB_UNPLUGGED);
+  tud_init(BOARD_TUD_RHPORT);
+  TUF2_BOOT_STAGE(BOOTLOG_TUD_INIT);
 
 #if TINYUF2_DISPLAY
+  // strip buffers are borrowed from the scratch arena also used by the flash driver, draw before MSC is ready
   board_display_init();
   screen_draw_drag();
 #endif
 
+  board_flash_init();
+  TUF2_BOOT_STAGE(BOOTLOG_FLASH_INIT);
+  uf2_init();
+  TUF2_BOOT_STAGE(BOOTLOG_UF2_INIT);
+
 #if CFG_TUSB_OS == OPT_OS_NONE || CFG_TUSB_OS == OPT_OS_PICO
   while(1) {
+    TUF2_TRACE_BEGIN(TUF2_TRACE_TUD_TASK);
     tud_task();
+    TUF2_TRACE_END(TUF2_TRACE_TUD_TASK);
+    // background flash work between USB events, see sched.h
+    tuf2_sched_run();
+#if TINYUF2_DISPLAY
+    screen_task();
+#endif
+#if TUF2_LOG && CFG_UF2_LOG_DEFERRED
+    tuf2_log_drain();
+#endif
+  }
+#elif (TINYUF2_DISPLAY || (TUF2_LOG && CFG_UF2_LOG_DEFERRED)) && CFG_TUSB_OS == OPT_OS_FREERTOS
+  // main task has the lowest priority: progress and log are only printed while usbd and flash tasks wait
+  while(1) {
+#if TINYUF2_DISPLAY
+    screen_task();
+#endif
+#if TUF2_LOG && CFG_UF2_LOG_DEFERRED
+    tuf2_log_drain();
+#endif
+    vTaskDelay(pdMS_TO_TICKS(TINYUF2_DISPLAY_PROGRESS_MS));
   }
 #endif
 }
@@ -141,6 +177,16 @@ bool board_dfu_trigger() {
 
 // return true if start DFU mode, else App mode
 static bool check_dfu_mode(void) {
+  // Reset Reason Hint to enter UF2. Check out esp_reset_reason_t for other Espressif pre-defined values.
+  // Checked first: DFU is entered anyway, no need to validate the application before USB is up
+  #define APP_REQUEST_UF2_RESET_HINT   0x11F2
+  // check reset reason
+  uint32_t const reset_hint = (uint32_t) esp_reset_reason_get_hint();
+  if ( APP_REQUEST_UF2_RESET_HINT == reset_hint ) {
+    esp_reset_reason_clear_hint(); // clear the hint
+    return true;
+  }
+
   // Check if app is valid
   if (!board_app_valid()) {
     TUF2_LOG1("App invalid\r\n");
@@ -170,9 +216,13 @@ static bool check_dfu_mode(void) {
       return false;
 
     case DBL_TAP_MAGIC:
+      TINYUF2_DBL_TAP_REG = 0;
+#if TINYUF2_DBL_TAP_TIMESTAMP
+      // first reset was too long ago, register this one as first reset instead
+      if ((uint32_t) (board_dbl_tap_time() - TINYUF2_DBL_TAP_TIME_REG) >= TINYUF2_DBL_TAP_DELAY) break;
+#endif
       // Double tap occurred
       TUF2_LOG1("Double Tap Reset\r\n");
-      TINYUF2_DBL_TAP_REG = 0;
       return true;
 
     case DBL_TAP_MAGIC_ERASE_APP:
@@ -190,6 +240,10 @@ static bool check_dfu_mode(void) {
   // Register our first reset for double reset detection
   TINYUF2_DBL_TAP_REG = DBL_TAP_MAGIC;
 
+#if TINYUF2_DBL_TAP_TIMESTAMP
+  // no delay, a second reset within TINYUF2_DBL_TAP_DELAY from now will enter DFU
+  TINYUF2_DBL_TAP_TIME_REG = board_dbl_tap_time();
+#else
   _timer_count = 0;
   board_timer_start(1);
 
@@ -210,15 +264,7 @@ static bool check_dfu_mode(void) {
 
   TINYUF2_DBL_TAP_REG = 0;
 #endif
-
-  // Reset Reason Hint to enter UF2. Check out esp_reset_reason_t for other Espressif pre-defined values
-  #define APP_REQUEST_UF2_RESET_HINT   0x11F2
-  // check reset reason
-  uint32_t const reset_hint = (uint32_t) esp_reset_reason_get_hint();
-    if ( APP_REQUEST_UF2_RESET_HINT == reset_hint ) {
-      esp_reset_reason_clear_hint(); // clear the hint
-      return true;
-  }
+#endif
 
   return false; 
 }
@@ -229,12 +275,21 @@ static bool check_dfu_mode(void) {
 
 // Invoked when device is plugged and configured
 void tud_mount_cb(void) {
+  TUF2_BOOT_STAGE(BOOTLOG_MOUNT);
+  TUF2_ACCESS_MOUNT();
   indicator_set(STATE_USB_PLUGGED);
 }
 
 // Invoked when device is unplugged
 void tud_umount_cb(void) {
   indicator_set(STATE_USB_UNPLUGGED);
+  if (board_flash_detach) board_flash_detach();
+}
+
+// self-powered boards keep running while the host sleeps or the cable is pulled without VBUS sense
+void tud_suspend_cb(bool remote_wakeup_en) {
+  (void) remote_wakeup_en;
+  if (board_flash_detach) board_flash_detach();
 }
 
 //--------------------------------------------------------------------+
@@ -244,27 +299,47 @@ void tud_umount_cb(void) {
 static uint32_t indicator_state = STATE_BOOTLOADER_STARTED;
 static uint8_t indicator_rgb[3];
 
+// Software fade ticks at most this often, duty then changes by more than 1 per tick
+#define INDICATOR_FADE_TICK_MS  16
+
+static uint32_t indicator_fade_step = 1;
+
+// fade LED with ms per duty step, in hardware if supported
+static void indicator_fade(uint32_t ms) {
+  if (board_led_fade && board_led_fade(ms * 256)) {
+    board_timer_stop();
+    return;
+  }
+
+  indicator_fade_step = (ms < INDICATOR_FADE_TICK_MS) ? INDICATOR_FADE_TICK_MS / ms : 1;
+  board_timer_start(ms * indicator_fade_step);
+}
+
 void indicator_set(uint32_t state) {
   indicator_state = state;
+  if (board_status_state) board_status_state(state);
+
   switch (state) {
     case STATE_USB_UNPLUGGED:
-      board_timer_start(1);
+      indicator_fade(1);
       memcpy(indicator_rgb, RGB_USB_UNMOUNTED, 3);
       board_rgb_write(indicator_rgb);
       break;
 
     case STATE_USB_PLUGGED:
-      board_timer_start(5);
+      indicator_fade(5);
       memcpy(indicator_rgb, RGB_USB_MOUNTED, 3);
       board_rgb_write(indicator_rgb);
       break;
 
     case STATE_WRITING_STARTED:
+      if (board_led_fade) board_led_fade(0);
       board_timer_start(25);
       memcpy(indicator_rgb, RGB_WRITING, 3);
       break;
 
     case STATE_WRITING_FINISHED:
+      if (board_led_fade) board_led_fade(0);
       board_timer_stop();
       board_rgb_write(RGB_WRITING);
       break;
@@ -281,8 +356,9 @@ void board_timer_handler(void) {
     case STATE_USB_UNPLUGGED:
     case STATE_USB_PLUGGED: {
       // Fading with LED TODO option to skip for unsupported MCUs
-      uint8_t duty = _timer_count & 0xff;
-      if (_timer_count & 0x100) duty = 255 - duty;
+      uint32_t const phase = _timer_count * indicator_fade_step;
+      uint8_t duty = phase & 0xff;
+      if (phase & 0x100) duty = 255 - duty;
       board_led_write(duty);
 
       // Skip RGB fading since it is too similar to CircuitPython
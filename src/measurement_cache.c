@@ -0,0 +1,117 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "measurement_cache.h"
+#include "stats.h"
+
+#if CFG_UF2_MEASUREMENT_CACHE_SECTORS
+
+//--------------------------------------------------------------------+
+// MACRO TYPEDEF CONSTANT ENUM DECLARATION
+//--------------------------------------------------------------------+
+
+typedef struct {
+  uint32_t sector;
+  uint32_t generation;  // valid if equal to _generation
+  uint32_t last_use;
+} cache_entry_t;
+
+static cache_entry_t _entry[CFG_UF2_MEASUREMENT_CACHE_SECTORS];
+static uint8_t _data[CFG_UF2_MEASUREMENT_CACHE_SECTORS][MEASUREMENT_CACHE_SECTOR_SIZE];
+
+// entries start at generation 0, which is never current
+static uint32_t _generation = 1;
+static uint32_t _use = 0;
+
+//--------------------------------------------------------------------+
+//
+//--------------------------------------------------------------------+
+
+// cached data of sector, filled from flash on a miss by replacing the least recently used entry
+static uint8_t const* sector_data(uint32_t sector) {
+  uint32_t victim = 0;
+  uint32_t victim_age = 0;
+  _use++;
+
+  for ( uint32_t i = 0; i < CFG_UF2_MEASUREMENT_CACHE_SECTORS; i++ ) {
+    cache_entry_t* e = &_entry[i];
+    bool const valid = (e->generation == _generation);
+    if ( valid && e->sector == sector ) {
+      e->last_use = _use;
+      TUF2_STATS_INC(measurement_cache_hits);
+      return _data[i];
+    }
+
+    // stale entries are free, else the one used longest ago
+    uint32_t const age = valid ? (_use - e->last_use) : UINT32_MAX;
+    if ( age > victim_age ) {
+      victim = i;
+      victim_age = age;
+    }
+  }
+
+  TUF2_STATS_INC(measurement_cache_misses);
+
+  // last sector of a partition that is not a multiple of the sector size reads as erased past its end
+  uint32_t const addr = sector * MEASUREMENT_CACHE_SECTOR_SIZE;
+  uint32_t const size = board_measuremnt_data_size();
+  uint32_t const n = (size - addr < MEASUREMENT_CACHE_SECTOR_SIZE) ? (size - addr) : MEASUREMENT_CACHE_SECTOR_SIZE;
+  board_measuremnt_data_read(addr, _data[victim], n);
+  memset(_data[victim] + n, 0xff, MEASUREMENT_CACHE_SECTOR_SIZE - n);
+
+  _entry[victim].sector = sector;
+  _entry[victim].generation = _generation;
+  _entry[victim].last_use = _use;
+  return _data[victim];
+}
+
+//--------------------------------------------------------------------+
+// API
+//--------------------------------------------------------------------+
+
+void measurement_cache_read(uint32_t addr, void* buffer, uint32_t len) {
+  uint8_t* out = (uint8_t*) buffer;
+  uint32_t const size = board_measuremnt_data_size();
+
+  while ( len && addr < size ) {
+    uint32_t const within = addr % MEASUREMENT_CACHE_SECTOR_SIZE;
+    uint32_t n = MEASUREMENT_CACHE_SECTOR_SIZE - within;
+    if ( n > len ) n = len;
+
+    memcpy(out, sector_data(addr / MEASUREMENT_CACHE_SECTOR_SIZE) + within, n);
+    out += n;
+    addr += n;
+    len -= n;
+  }
+
+  // past the end of the partition
+  memset(out, 0xff, len);
+}
+
+void measurement_cache_invalidate(void) {
+  if ( ++_generation == 0 ) _generation = 1;
+}
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef MEASUREMENT_CACHE_H_
+#define MEASUREMENT_CACHE_H_
+
+#include "board_api.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// LRU cache of ota1 sectors in front of board_measuremnt_data_read(), shared by all measurement
+// files (CSV, BIN, summaries, windows, CDC) and the ring/packed formats. Hosts reading the same
+// sectors through several files, or again for thumbnails and virus scans, then do not hit SPI flash.
+// Entries are tagged with a generation, measurement_cache_invalidate() drops all of them at once.
+//--------------------------------------------------------------------+
+
+// Number of cached sectors, each takes MEASUREMENT_CACHE_SECTOR_SIZE bytes of RAM. 0 reads flash directly
+#ifndef CFG_UF2_MEASUREMENT_CACHE_SECTORS
+  #define CFG_UF2_MEASUREMENT_CACHE_SECTORS  0
+#endif
+
+#define MEASUREMENT_CACHE_SECTOR_SIZE  4096
+
+#if CFG_UF2_MEASUREMENT_CACHE_SECTORS
+// Read [addr, addr+len) of ota1 through the cache
+void measurement_cache_read(uint32_t addr, void* buffer, uint32_t len);
+
+// Forget all cached sectors, e.g before ota1 is scanned again
+void measurement_cache_invalidate(void);
+#else
+static inline void measurement_cache_read(uint32_t addr, void* buffer, uint32_t len) {
+  board_measuremnt_data_read(addr, buffer, len);
+}
+
+static inline void measurement_cache_invalidate(void) {}
+#endif
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
@@ -0,0 +1,227 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "tusb.h"
+#include "measurement_csv.h"
+#include "measurement_cdc.h"
+
+#if CFG_UF2_MEASUREMENT_CDC && CFG_TUD_CDC
+
+//--------------------------------------------------------------------+
+// MACRO TYPEDEF CONSTANT ENUM DECLARATION
+//--------------------------------------------------------------------+
+
+#define RESP_HEADER_SIZE  sizeof(measurement_cdc_response_t)
+
+static measurement_cdc_request_t _req;
+static uint32_t _req_count = 0;
+
+// frame being sent: response header, data and crc32 of data
+static uint8_t _tx[RESP_HEADER_SIZE + CFG_UF2_MEASUREMENT_CDC_CHUNK + 4] __attribute__((aligned(4)));
+static uint32_t _tx_len = 0;
+static uint32_t _tx_pos = 0;
+
+// READ in progress, in units
+static bool _rd_active = false;
+static uint32_t _rd_index;
+static uint32_t _rd_end;
+
+//--------------------------------------------------------------------+
+//
+//--------------------------------------------------------------------+
+
+// IEEE crc32 (reflected 0xEDB88320), nibble table to keep flash usage small
+static uint32_t crc32_update(uint32_t crc, uint8_t const* buf, uint32_t len) {
+  static uint32_t const table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+
+  crc = ~crc;
+  for ( uint32_t i = 0; i < len; i++ ) {
+    crc = table[(crc ^ buf[i]) & 0x0F] ^ (crc >> 4);
+    crc = table[(crc ^ (buf[i] >> 4)) & 0x0F] ^ (crc >> 4);
+  }
+  return ~crc;
+}
+
+// queue a frame whose len bytes of data are already in place after the header
+static void frame_set(uint8_t status, uint32_t index, uint32_t len) {
+  measurement_cdc_response_t const resp = {
+    .magic  = MEASUREMENT_CDC_MAGIC,
+    .cmd    = (uint8_t) _req.cmd,
+    .status = status,
+    .index  = index,
+    .len    = len,
+  };
+  memcpy(_tx, &resp, RESP_HEADER_SIZE);
+
+  uint32_t const crc = crc32_update(0, _tx + RESP_HEADER_SIZE, len);
+  memcpy(_tx + RESP_HEADER_SIZE + len, &crc, 4);
+
+  _tx_len = RESP_HEADER_SIZE + len + 4;
+  _tx_pos = 0;
+}
+
+static uint32_t record_timestamp(uint32_t i) {
+  uint32_t ts;
+  uf2_measurement_data_read(i * uf2_measurement_unit_size(), &ts, sizeof(ts));
+  return ts;
+}
+
+static void cmd_info(uint32_t count) {
+  measurement_cdc_info_t info = {
+    .unit_size  = uf2_measurement_unit_size(),
+    .unit_count = count,
+  };
+
+  if ( CFG_UF2_MEASUREMENT_BINARY && count ) {
+    info.first_timestamp = record_timestamp(0);
+    info.last_timestamp = record_timestamp(count - 1);
+  }
+
+  memcpy(_tx + RESP_HEADER_SIZE, &info, sizeof(info));
+  frame_set(MEASUREMENT_CDC_OK, 0, sizeof(info));
+}
+
+// records are in ascending timestamp order: binary search for the first one at or after arg0
+static void cmd_find(uint32_t count) {
+  if ( !CFG_UF2_MEASUREMENT_BINARY ) {
+    frame_set(MEASUREMENT_CDC_BAD_REQUEST, 0, 0);
+    return;
+  }
+
+  uint32_t lo = 0;
+  uint32_t hi = count;
+  while ( lo < hi ) {
+    uint32_t const mid = lo + (hi - lo) / 2;
+    if ( record_timestamp(mid) < _req.arg0 ) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  frame_set(MEASUREMENT_CDC_OK, lo, 0);
+}
+
+static void cmd_read(uint32_t count) {
+  if ( _req.arg0 > count ) {
+    frame_set(MEASUREMENT_CDC_BAD_RANGE, _req.arg0, 0);
+    return;
+  }
+
+  _rd_index = _req.arg0;
+  _rd_end = (_req.arg1 && _req.arg1 < count - _rd_index) ? (_rd_index + _req.arg1) : count;
+  _rd_active = true;
+}
+
+// next chunk of READ, the one with len 0 ends it
+static void read_next_chunk(void) {
+  uint32_t const unit = uf2_measurement_unit_size();
+  uint32_t n = CFG_UF2_MEASUREMENT_CDC_CHUNK / unit;
+  if ( n > _rd_end - _rd_index ) n = _rd_end - _rd_index;
+
+  if ( n ) {
+    uf2_measurement_data_read(_rd_index * unit, _tx + RESP_HEADER_SIZE, n * unit);
+    if ( board_measuremnt_data_read_ahead && _rd_index + n < _rd_end ) {
+      uf2_measurement_data_read_ahead((_rd_index + n) * unit, CFG_UF2_MEASUREMENT_CDC_CHUNK);
+    }
+  } else {
+    _rd_active = false;
+  }
+
+  frame_set(MEASUREMENT_CDC_OK, _rd_index, n * unit);
+  _rd_index += n;
+}
+
+static void process_request(void) {
+  if ( _req.magic != MEASUREMENT_CDC_MAGIC ) {
+    // out of sync with host, drop what has been received so far
+    tud_cdc_read_flush();
+    frame_set(MEASUREMENT_CDC_BAD_REQUEST, 0, 0);
+    return;
+  }
+
+  // USB is started before the flash
+  if ( !uf2_ready() ) {
+    frame_set(MEASUREMENT_CDC_NOT_READY, 0, 0);
+    return;
+  }
+
+  uint32_t const count = uf2_measurement_data_size() / uf2_measurement_unit_size();
+
+  switch ( _req.cmd ) {
+    case MEASUREMENT_CDC_INFO: cmd_info(count); break;
+    case MEASUREMENT_CDC_FIND: cmd_find(count); break;
+    case MEASUREMENT_CDC_READ: cmd_read(count); break;
+    default: frame_set(MEASUREMENT_CDC_BAD_REQUEST, 0, 0); break;
+  }
+}
+
+// Send as much as tx fifo takes. A frame is always sent completely, a request arriving
+// during READ is answered after the current chunk and ends the READ.
+static void service(void) {
+  while ( 1 ) {
+    if ( _tx_pos < _tx_len ) {
+      _tx_pos += tud_cdc_write(_tx + _tx_pos, _tx_len - _tx_pos);
+      if ( _tx_pos < _tx_len ) break; // fifo full, continue on tx complete
+      continue;
+    }
+
+    if ( tud_cdc_available() ) {
+      _req_count += tud_cdc_read((uint8_t*) &_req + _req_count, sizeof(_req) - _req_count);
+      if ( _req_count == sizeof(_req) ) {
+        _req_count = 0;
+        _rd_active = false;
+        process_request();
+        continue;
+      }
+    }
+
+    if ( !_rd_active ) break;
+    read_next_chunk();
+  }
+
+  tud_cdc_write_flush();
+}
+
+//--------------------------------------------------------------------+
+// tinyusb callbacks
+//--------------------------------------------------------------------+
+
+// Invoked when CDC interface received data from host
+void tud_cdc_rx_cb(uint8_t itf) {
+  (void) itf;
+  service();
+}
+
+// Invoked when a CDC transfer to host is complete, room in tx fifo for the next part
+void tud_cdc_tx_complete_cb(uint8_t itf) {
+  (void) itf;
+  service();
+}
+
+#endif
@@ -0,0 +1,101 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#ifndef MEASUREMENT_CDC_H_
+#define MEASUREMENT_CDC_H_
+
+#include "uf2.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Binary measurement download over CDC, without mounting the drive. All values little endian.
+// Host sends a 16 byte request: magic, cmd, arg0, arg1. Device answers with one or more
+// responses: 16 byte header (magic, cmd, status, index, len), len bytes of data, crc32 of data.
+// Positions are in units of uf2_measurement_unit_size(): records, or bytes with CSV text data.
+//   INFO : data = measurement_cdc_info_t
+//   FIND : arg0 = timestamp, index = first record at or after it (binary records only)
+//   READ : arg0 = first unit, arg1 = unit count (0 = to the end). Data is sent in chunks of
+//          whole units, index = first unit of the chunk, a chunk with len 0 ends the transfer.
+//          Host resumes an interrupted sync by reading from the index after its last good chunk
+// A new request cancels a READ in progress. tools/measurement_sync.py implements the host side.
+//--------------------------------------------------------------------+
+
+// Serve measurement data over CDC
+#ifndef CFG_UF2_MEASUREMENT_CDC
+  #define CFG_UF2_MEASUREMENT_CDC        0
+#endif
+
+// Maximum data bytes per READ chunk, rounded down to whole units
+#ifndef CFG_UF2_MEASUREMENT_CDC_CHUNK
+  #define CFG_UF2_MEASUREMENT_CDC_CHUNK  1024
+#endif
+
+#define MEASUREMENT_CDC_MAGIC  0x4344434DUL // "MCDC"
+
+enum {
+  MEASUREMENT_CDC_INFO = 0x01,
+  MEASUREMENT_CDC_FIND = 0x02,
+  MEASUREMENT_CDC_READ = 0x03,
+};
+
+enum {
+  MEASUREMENT_CDC_OK = 0,
+  MEASUREMENT_CDC_BAD_REQUEST,  // unknown command or bad magic, not supported with CSV text data
+  MEASUREMENT_CDC_BAD_RANGE,    // first unit is past the end of data
+  MEASUREMENT_CDC_NOT_READY,    // tinyuf2 is still starting up, send again
+};
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint32_t cmd;
+  uint32_t arg0;
+  uint32_t arg1;
+} measurement_cdc_request_t;
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint8_t  cmd;
+  uint8_t  status;
+  uint16_t reserved;
+  uint32_t index;
+  uint32_t len;
+} measurement_cdc_response_t;
+
+typedef struct __attribute__((packed)) {
+  uint32_t unit_size;        // record size, 1 with CSV text data
+  uint32_t unit_count;
+  uint32_t first_timestamp;  // 0 with CSV text data or without records
+  uint32_t last_timestamp;
+} measurement_cdc_info_t;
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
@@ -0,0 +1,929 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "measurement_csv.h"
+#include "measurement_ring.h"
+#include "measurement_pack.h"
+
+#if CFG_UF2_MEASUREMENT_BINARY
+
+//--------------------------------------------------------------------+
+// MACRO TYPEDEF CONSTANT ENUM DECLARATION
+//--------------------------------------------------------------------+
+
+#define CSV_HEADER        "time,CT1,CT2,CT3\n"
+#define CSV_HEADER_LEN    (sizeof(CSV_HEADER) - 1)
+
+// header of a channel file, the CT digit is filled in
+#define CHANNEL_HEADER      "time,CT0\n"
+#define CHANNEL_HEADER_LEN  (sizeof(CHANNEL_HEADER) - 1)
+
+// channel of MEASDAT.CSV: all values on each line
+#define CSV_ALL_CHANNELS  3
+
+// longest line: 10 digits timestamp, 3x sign + 10 digits, 3 commas and newline
+#define CSV_LINE_MAX      (10 + 3 * 11 + 4)
+
+// records fetched from flash at once
+#define RECORD_BATCH      32
+
+static uint32_t _rec_count = 0;
+static MeasurementBinHeader_t _bin_header;
+
+// A CSV text rendered line by line from the records: MEASDAT.CSV or the file of one channel
+typedef struct {
+  uint32_t index[CFG_UF2_MEASUREMENT_INDEX_SIZE]; // offset of the line of every (1 << _index_shift)th record
+  uint32_t size;
+  uint8_t channel;              // CSV_ALL_CHANNELS or one CT
+
+  // next line to render for a sequential read
+  struct {
+    uint32_t rec;
+    uint32_t offset;
+  } cursor;
+} csv_text_t;
+
+static uint8_t _index_shift = 0;
+
+#if CFG_UF2_MEASUREMENT_INDEX_FILE
+// timestamp of every checkpoint record for INDEX.BIN
+static uint32_t _index_ts[CFG_UF2_MEASUREMENT_INDEX_SIZE];
+#endif
+
+static csv_text_t _csv = { .channel = CSV_ALL_CHANNELS };
+
+#if CFG_UF2_MEASUREMENT_CHANNEL_FILES
+static csv_text_t _channel_csv[3] = { { .channel = 0 }, { .channel = 1 }, { .channel = 2 } };
+#endif
+
+static struct {
+  uint32_t first;
+  uint32_t count;
+  MeasurementRecord_t rec[RECORD_BATCH];
+} _batch;
+
+// A window is the tail of MEASDAT.CSV starting at the line of its first record, with its own header
+static struct {
+  uint32_t seconds;
+  uint32_t start;  // offset of first line in MEASDAT.CSV
+} _window[MEASUREMENT_WINDOW_COUNT] = {
+  [MEASUREMENT_WINDOW_24H] = { .seconds = 24 * 3600UL },
+  [MEASUREMENT_WINDOW_7D ] = { .seconds = 7 * 24 * 3600UL },
+};
+
+// NEW.CSV is the tail of MEASDAT.CSV after the last record acknowledged by the host
+static uint32_t _new_watermark = 0;
+static uint32_t _new_start = CSV_HEADER_LEN;
+
+// A day file is a slice of MEASDAT.CSV lines with its own header
+typedef struct {
+  uint32_t day;     // days since epoch
+  uint32_t start;   // offset of first line in MEASDAT.CSV
+} day_file_t;
+
+static day_file_t _day[CFG_UF2_MEASUREMENT_DAY_FILES];
+static uint32_t _day_count = 0;
+
+#define SUMMARY_HEADER      "hour,CT1_min,CT1_max,CT1_mean,CT2_min,CT2_max,CT2_mean,CT3_min,CT3_max,CT3_mean\n"
+#define SUMMARY_HEADER_LEN  (sizeof(SUMMARY_HEADER) - 1)
+
+// longest line: 10 digits hour timestamp, 9x sign + 10 digits, 9 commas and newline
+#define SUMMARY_LINE_MAX    (10 + 9 * 11 + 10)
+
+// Aggregate of one hour, sums in 32-bit are enough for 16-bit readings at up to one record per 0.1 second
+typedef struct {
+  uint32_t hour;
+  uint32_t count;
+  int32_t sum[3];
+  CFG_UF2_MEASUREMENT_CT_TYPE min[3];
+  CFG_UF2_MEASUREMENT_CT_TYPE max[3];
+} summary_row_t;
+
+// ring of most recent hours, head is the hour being aggregated
+static summary_row_t _summary[CFG_UF2_MEASUREMENT_SUMMARY_HOURS];
+static uint32_t _summary_head = 0;
+static uint32_t _summary_count = 0;
+static uint32_t _summary_size = SUMMARY_HEADER_LEN;
+
+// longest MEASERR.TXT row: chunk, first record and count, two crc and separators
+#define ERR_LINE_MAX        (3 * 10 + 2 * 8 + 5)
+#define ERR_COLUMNS         "chunk,first_record,records,crc_stored,crc_read\n"
+
+#define MARK_LINE           "# crc error, chunk "
+
+// chunk whose records do not match their crc32
+typedef struct {
+  uint32_t chunk;
+  uint32_t first;
+  uint32_t count;
+  uint32_t crc_stored;
+  uint32_t crc_read;
+} bad_chunk_t;
+
+static bad_chunk_t _bad[CFG_UF2_MEASUREMENT_BAD_CHUNKS];
+static uint32_t _bad_count = 0;   // listed in _bad
+static uint32_t _bad_total = 0;
+static uint32_t _chunk_total = 0;
+static uint32_t _chunk_checked = 0;
+static uint32_t _err_size = 0;
+
+//--------------------------------------------------------------------+
+//
+//--------------------------------------------------------------------+
+
+static MeasurementRecord_t const* get_record(uint32_t i) {
+  if ( !(_batch.count && _batch.first <= i && i < _batch.first + _batch.count) ) {
+    uint32_t count = _rec_count - i;
+    if ( count > RECORD_BATCH ) count = RECORD_BATCH;
+
+    uf2_measurement_data_read(i * sizeof(MeasurementRecord_t), _batch.rec, count * sizeof(MeasurementRecord_t));
+    _batch.first = i;
+    _batch.count = count;
+  }
+
+  return &_batch.rec[i - _batch.first];
+}
+
+// "00" to "99", two digits per division
+static char const _digit_pairs[200] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+// write decimal value, return number of chars. Length is known up front so that digits are
+// written in place from the end, two at a time
+static uint32_t u32_to_dec(uint32_t value, char* buf) {
+  static uint32_t const pow10[9] = {
+    10UL, 100UL, 1000UL, 10000UL, 100000UL, 1000000UL, 10000000UL, 100000000UL, 1000000000UL
+  };
+
+  uint32_t n = 1;
+  while ( n < 10 && value >= pow10[n - 1] ) n++;
+
+  char* p = buf + n;
+  while ( value >= 100 ) {
+    uint32_t const pair = (value % 100) * 2;
+    value /= 100;
+    *--p = _digit_pairs[pair + 1];
+    *--p = _digit_pairs[pair];
+  }
+
+  if ( value >= 10 ) {
+    *--p = _digit_pairs[value * 2 + 1];
+    *--p = _digit_pairs[value * 2];
+  } else {
+    *--p = (char) ('0' + value);
+  }
+
+  return n;
+}
+
+static uint32_t i32_to_dec(int32_t value, char* buf) {
+  if ( value < 0 ) {
+    buf[0] = '-';
+    return 1 + u32_to_dec((uint32_t) (-(int64_t) value), buf + 1);
+  }
+  return u32_to_dec((uint32_t) value, buf);
+}
+
+// IEEE crc32 (reflected 0xEDB88320), nibble table to keep flash usage small
+static uint32_t crc32_update(uint32_t crc, uint8_t const* buf, uint32_t len) {
+  if ( board_crc32 ) return board_crc32(crc, buf, len);
+
+  static uint32_t const table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+
+  crc = ~crc;
+  for ( uint32_t i = 0; i < len; i++ ) {
+    crc = table[(crc ^ buf[i]) & 0x0F] ^ (crc >> 4);
+    crc = table[(crc ^ (buf[i] >> 4)) & 0x0F] ^ (crc >> 4);
+  }
+  return ~crc;
+}
+
+// render one CSV line of all or a single channel, return its length
+static uint32_t render_line(MeasurementRecord_t const* rec, uint8_t channel, char* line) {
+  uint32_t n = u32_to_dec(rec->timestamp, line);
+
+  for ( uint32_t i = 0; i < 3; i++ ) {
+    if ( channel != CSV_ALL_CHANNELS && i != channel ) continue;
+    line[n++] = ',';
+    n += i32_to_dec((int32_t) rec->ct[i], line + n);
+  }
+  line[n++] = '\n';
+
+  return n;
+}
+
+static uint32_t u32_to_hex(uint32_t value, char* buf) {
+  for ( uint32_t i = 0; i < 8; i++ ) buf[i] = "0123456789ABCDEF"[(value >> (28 - 4 * i)) & 0xF];
+  return 8;
+}
+
+// listed bad chunk holding record i, NULL if it is good
+static bad_chunk_t const* bad_chunk_of(uint32_t i) {
+  for ( uint32_t b = 0; b < _bad_count; b++ ) {
+    if ( i < _bad[b].first ) break;
+    if ( i < _bad[b].first + _bad[b].count ) return &_bad[b];
+  }
+  return NULL;
+}
+
+// CSV line of record i: its values, or with CFG_UF2_MEASUREMENT_MARK_BAD one marker line for a bad chunk
+static uint32_t render_record(uint32_t i, uint8_t channel, char* line) {
+#if CFG_UF2_MEASUREMENT_MARK_BAD
+  bad_chunk_t const* bad = bad_chunk_of(i);
+  if ( bad ) {
+    if ( i != bad->first ) return 0;
+
+    uint32_t n = sizeof(MARK_LINE) - 1;
+    memcpy(line, MARK_LINE, n);
+    n += u32_to_dec(bad->chunk, line + n);
+    line[n++] = '\n';
+    return n;
+  }
+#endif
+
+  return render_line(get_record(i), channel, line);
+}
+
+// the platform chunk list: sectors of the ring or packed blocks, the plain record array has no checksums
+static bool measurement_chunk(uint32_t k, MeasurementChunk_t* chunk) {
+#if CFG_UF2_MEASUREMENT_RING
+  return measurement_ring_chunk(k, chunk);
+#elif CFG_UF2_MEASUREMENT_PACKED
+  return measurement_pack_chunk(k, chunk);
+#else
+  (void) k;
+  (void) chunk;
+  return false;
+#endif
+}
+
+// Compare chunk records against their stored crc32, list the chunk if they do not match
+static void chunk_verify(uint32_t k, MeasurementChunk_t const* chunk) {
+  _chunk_total++;
+  if ( !chunk->checked ) return;
+  _chunk_checked++;
+
+  // records are read in batch sized pieces, outside of the record cache
+  uint8_t buf[RECORD_BATCH * sizeof(MeasurementRecord_t)];
+  uint32_t offset = chunk->first * sizeof(MeasurementRecord_t);
+  uint32_t len = chunk->count * sizeof(MeasurementRecord_t);
+  uint32_t crc = 0;
+
+  while ( len ) {
+    uint32_t const n = (len < sizeof(buf)) ? len : sizeof(buf);
+    uf2_measurement_data_read(offset, buf, n);
+    crc = crc32_update(crc, buf, n);
+    offset += n;
+    len -= n;
+  }
+
+  if ( crc == chunk->crc32 ) return;
+
+  TUF2_LOG1("Measurement chunk %lu: crc %08lX, stored %08lX\r\n", k, crc, chunk->crc32);
+  _bad_total++;
+  if ( _bad_count < CFG_UF2_MEASUREMENT_BAD_CHUNKS ) {
+    bad_chunk_t* bad = &_bad[_bad_count++];
+    bad->chunk = k;
+    bad->first = chunk->first;
+    bad->count = chunk->count;
+    bad->crc_stored = chunk->crc32;
+    bad->crc_read = crc;
+  }
+}
+
+// Start a new day file at CSV offset if record is from a later day than the current one.
+// Records from an earlier day (clock set back) stay in the current file so that names are unique.
+static void day_add(MeasurementRecord_t const* rec, uint32_t offset) {
+  uint32_t const day = rec->timestamp / 86400UL;
+  if ( _day_count && day <= _day[_day_count - 1].day ) return;
+
+  // drop the oldest day when full
+  if ( _day_count == CFG_UF2_MEASUREMENT_DAY_FILES ) {
+    memmove(&_day[0], &_day[1], (CFG_UF2_MEASUREMENT_DAY_FILES - 1) * sizeof(day_file_t));
+    _day_count--;
+  }
+
+  _day[_day_count].day = day;
+  _day[_day_count].start = offset;
+  _day_count++;
+}
+
+// Add record to its hour, starting a new row (dropping the oldest when full) when hour changes
+static void summary_add(MeasurementRecord_t const* rec) {
+  uint32_t const hour = rec->timestamp - (rec->timestamp % 3600);
+  summary_row_t* row = &_summary[_summary_head];
+
+  if ( _summary_count == 0 || row->hour != hour ) {
+    if ( _summary_count ) _summary_head = (_summary_head + 1) % CFG_UF2_MEASUREMENT_SUMMARY_HOURS;
+    if ( _summary_count < CFG_UF2_MEASUREMENT_SUMMARY_HOURS ) _summary_count++;
+
+    row = &_summary[_summary_head];
+    row->hour = hour;
+    row->count = 0;
+    for ( uint32_t i = 0; i < 3; i++ ) {
+      row->sum[i] = 0;
+      row->min[i] = rec->ct[i];
+      row->max[i] = rec->ct[i];
+    }
+  }
+
+  // branch-free per channel update
+  row->count++;
+  for ( uint32_t i = 0; i < 3; i++ ) {
+    CFG_UF2_MEASUREMENT_CT_TYPE const v = rec->ct[i];
+    row->sum[i] += v;
+    row->min[i] = (v < row->min[i]) ? v : row->min[i];
+    row->max[i] = (v > row->max[i]) ? v : row->max[i];
+  }
+}
+
+// render n-th oldest summary row, return its length
+static uint32_t summary_render(uint32_t n, char* line) {
+  uint32_t const idx = (_summary_head + CFG_UF2_MEASUREMENT_SUMMARY_HOURS - (_summary_count - 1) + n) %
+                       CFG_UF2_MEASUREMENT_SUMMARY_HOURS;
+  summary_row_t const* row = &_summary[idx];
+  uint32_t len = u32_to_dec(row->hour, line);
+
+  for ( uint32_t i = 0; i < 3; i++ ) {
+    line[len++] = ',';
+    len += i32_to_dec((int32_t) row->min[i], line + len);
+    line[len++] = ',';
+    len += i32_to_dec((int32_t) row->max[i], line + len);
+    line[len++] = ',';
+    len += i32_to_dec(row->sum[i] / (int32_t) row->count, line + len);
+  }
+  line[len++] = '\n';
+
+  return len;
+}
+
+static uint32_t err_rows(void) {
+  return 4 + _bad_count + ((_bad_total > _bad_count) ? 1 : 0);
+}
+
+// render n-th MEASERR.TXT row: totals, column names, listed chunks and the number of unlisted ones
+static uint32_t err_render(uint32_t n, char* line) {
+  static char const* const label[] = { "chunks: ", "checked: ", "bad: " };
+  uint32_t const value[] = { _chunk_total, _chunk_checked, _bad_total };
+  uint32_t len;
+
+  if ( n < 3 ) {
+    len = strlen(label[n]);
+    memcpy(line, label[n], len);
+    len += u32_to_dec(value[n], line + len);
+  } else if ( n == 3 ) {
+    len = sizeof(ERR_COLUMNS) - 1;
+    memcpy(line, ERR_COLUMNS, len);
+    return len;
+  } else if ( n - 4 < _bad_count ) {
+    bad_chunk_t const* bad = &_bad[n - 4];
+    len = u32_to_dec(bad->chunk, line);
+    line[len++] = ',';
+    len += u32_to_dec(bad->first, line + len);
+    line[len++] = ',';
+    len += u32_to_dec(bad->count, line + len);
+    line[len++] = ',';
+    len += u32_to_hex(bad->crc_stored, line + len);
+    line[len++] = ',';
+    len += u32_to_hex(bad->crc_read, line + len);
+  } else {
+    len = sizeof("not listed: ") - 1;
+    memcpy(line, "not listed: ", len);
+    len += u32_to_dec(_bad_total - _bad_count, line + len);
+  }
+  line[len++] = '\n';
+
+  return len;
+}
+
+// Copy [offset, offset+len) of a small text made of rendered rows starting at line_offset
+static void rows_read(uint32_t (*render)(uint32_t, char*), uint32_t rows, uint32_t line_offset,
+                      uint32_t offset, uint8_t* out, uint32_t len) {
+  // table is small, render rows from the start
+  char line[SUMMARY_LINE_MAX > ERR_LINE_MAX ? SUMMARY_LINE_MAX : ERR_LINE_MAX];
+  for ( uint32_t row = 0; len && row < rows; row++ ) {
+    uint32_t const line_len = render(row, line);
+
+    if ( offset < line_offset + line_len ) {
+      uint32_t const skip = offset - line_offset;
+      uint32_t n = line_len - skip;
+      if ( n > len ) n = len;
+
+      memcpy(out, line + skip, n);
+      out += n;
+      offset += n;
+      len -= n;
+    }
+
+    line_offset += line_len;
+  }
+}
+
+static uint32_t header_len(csv_text_t const* text) {
+  return (text->channel == CSV_ALL_CHANNELS) ? CSV_HEADER_LEN : CHANNEL_HEADER_LEN;
+}
+
+// Copy the part of the header of text before [offset, offset+len), return number of bytes copied
+static uint32_t header_read(csv_text_t const* text, uint32_t offset, uint8_t* out, uint32_t len) {
+  uint32_t const hlen = header_len(text);
+  if ( offset >= hlen ) return 0;
+
+  char header[CSV_HEADER_LEN];
+  if ( text->channel == CSV_ALL_CHANNELS ) {
+    memcpy(header, CSV_HEADER, CSV_HEADER_LEN);
+  } else {
+    memcpy(header, CHANNEL_HEADER, CHANNEL_HEADER_LEN);
+    header[CHANNEL_HEADER_LEN - 2] = (char) ('1' + text->channel);
+  }
+
+  uint32_t const n = (hlen - offset < len) ? (hlen - offset) : len;
+  memcpy(out, header + offset, n);
+  return n;
+}
+
+// Position cursor at the line containing CSV offset (offset is past header)
+static void seek(csv_text_t* text, uint32_t offset) {
+  // binary search checkpoint index for the last line starting at or before offset
+  uint32_t const index_count = (_rec_count + (1UL << _index_shift) - 1) >> _index_shift;
+  uint32_t lo = 0;
+  uint32_t hi = index_count - 1;
+  while ( lo < hi ) {
+    uint32_t const mid = (lo + hi + 1) / 2;
+    if ( text->index[mid] <= offset ) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+
+  // continue from cursor if host is reading sequentially
+  uint32_t const cp_rec = lo << _index_shift;
+  if ( !(cp_rec <= text->cursor.rec && text->cursor.offset <= offset && text->cursor.rec < _rec_count) ) {
+    text->cursor.rec = cp_rec;
+    text->cursor.offset = text->index[lo];
+  }
+
+  char line[CSV_LINE_MAX];
+  while ( text->cursor.rec < _rec_count ) {
+    uint32_t const len = render_record(text->cursor.rec, text->channel, line);
+    if ( text->cursor.offset + len > offset ) break;
+
+    text->cursor.offset += len;
+    text->cursor.rec++;
+  }
+}
+
+// MEASDAT.CSV offset of record's line, rendering forward from its checkpoint
+static uint32_t record_offset(uint32_t rec) {
+  uint32_t i = rec & ~((1UL << _index_shift) - 1);
+  uint32_t offset = _csv.index[i >> _index_shift];
+
+  char line[CSV_LINE_MAX];
+  for ( ; i < rec; i++ ) offset += render_record(i, CSV_ALL_CHANNELS, line);
+
+  return offset;
+}
+
+// Index of first record with timestamp >= ts, binary search since records are in ascending time order
+static uint32_t record_find(uint32_t ts) {
+  uint32_t lo = 0;
+  uint32_t hi = _rec_count;
+
+  while ( lo < hi ) {
+    uint32_t const mid = lo + (hi - lo) / 2;
+    if ( get_record(mid)->timestamp < ts ) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+// Render [offset, offset+len) of a CSV text into dst
+static void text_read(csv_text_t* text, uint32_t offset, void* dst, uint32_t len) {
+  uint8_t* out = (uint8_t*) dst;
+
+  uint32_t const n = header_read(text, offset, out, len);
+  out += n;
+  offset += n;
+  len -= n;
+
+  if ( len == 0 || _rec_count == 0 ) return;
+
+  seek(text, offset);
+
+  char line[CSV_LINE_MAX];
+
+  // whole lines are rendered straight into dst, only the partial first and last ones go through line
+  while ( len >= CSV_LINE_MAX && offset == text->cursor.offset && text->cursor.rec < _rec_count ) {
+    uint32_t const line_len = render_record(text->cursor.rec, text->channel, (char*) out);
+    out += line_len;
+    offset += line_len;
+    len -= line_len;
+    text->cursor.offset += line_len;
+    text->cursor.rec++;
+  }
+
+  while ( len && text->cursor.rec < _rec_count ) {
+    uint32_t const line_len = render_record(text->cursor.rec, text->channel, line);
+    uint32_t const skip = offset - text->cursor.offset;
+    uint32_t n = line_len - skip;
+    if ( n > len ) n = len;
+
+    memcpy(out, line + skip, n);
+    out += n;
+    offset += n;
+    len -= n;
+
+    // only advance past fully rendered lines
+    if ( skip + n < line_len ) break;
+    text->cursor.offset += line_len;
+    text->cursor.rec++;
+  }
+}
+
+static void text_read_ahead(csv_text_t const* text, uint32_t len) {
+  if ( !board_measuremnt_data_read_ahead || text->cursor.rec >= _rec_count ) return;
+
+  // CSV lines are longer than records, prefetching raw len bytes is more than enough
+  uf2_measurement_data_read_ahead(text->cursor.rec * sizeof(MeasurementRecord_t), len);
+}
+
+//--------------------------------------------------------------------+
+// API
+//--------------------------------------------------------------------+
+
+uint32_t measurement_csv_init(uint32_t data_size) {
+  _rec_count = data_size / sizeof(MeasurementRecord_t);
+  _batch.count = 0;
+
+  // smallest power of two stride so that index covers all records
+  _index_shift = 0;
+  while ( (_rec_count >> _index_shift) >= CFG_UF2_MEASUREMENT_INDEX_SIZE ) _index_shift++;
+
+  _summary_head = 0;
+  _summary_count = 0;
+  _day_count = 0;
+  _bad_count = _bad_total = _chunk_total = _chunk_checked = 0;
+
+  uint32_t offset = CSV_HEADER_LEN;
+  uint32_t crc = 0;
+  char line[CSV_LINE_MAX];
+
+#if CFG_UF2_MEASUREMENT_CHANNEL_FILES
+  for ( uint8_t c = 0; c < 3; c++ ) _channel_csv[c].size = CHANNEL_HEADER_LEN;
+#endif
+
+  MeasurementChunk_t chunk;
+  uint32_t k = 0;
+  bool has_chunk = measurement_chunk(0, &chunk);
+
+  for ( uint32_t i = 0; i < _rec_count; i++ ) {
+    // each chunk is verified before its first record is rendered, a bad one may render differently
+    while ( has_chunk && i >= chunk.first ) {
+      chunk_verify(k, &chunk);
+      has_chunk = measurement_chunk(++k, &chunk);
+    }
+
+    MeasurementRecord_t const* rec = get_record(i);
+    bool const bad = (bad_chunk_of(i) != NULL);
+
+    bool const checkpoint = (i & ((1UL << _index_shift) - 1)) == 0;
+    if ( checkpoint ) _csv.index[i >> _index_shift] = offset;
+#if CFG_UF2_MEASUREMENT_INDEX_FILE
+    if ( checkpoint ) _index_ts[i >> _index_shift] = rec->timestamp;
+#endif
+    if ( !bad ) day_add(rec, offset);
+    offset += render_record(i, CSV_ALL_CHANNELS, line);
+
+#if CFG_UF2_MEASUREMENT_CHANNEL_FILES
+    for ( uint8_t c = 0; c < 3; c++ ) {
+      csv_text_t* text = &_channel_csv[c];
+      if ( checkpoint ) text->index[i >> _index_shift] = text->size;
+      text->size += render_record(i, c, line);
+    }
+#endif
+
+    crc = crc32_update(crc, (uint8_t const*) rec, sizeof(MeasurementRecord_t));
+    if ( !bad ) summary_add(rec);
+  }
+
+  // MEASDAT.BIN header is computed in the same pass
+  _bin_header.magic = MEASUREMENT_BIN_MAGIC;
+  _bin_header.header_size = sizeof(MeasurementBinHeader_t);
+  _bin_header.record_size = sizeof(MeasurementRecord_t);
+  _bin_header.record_count = _rec_count;
+  _bin_header.first_timestamp = _rec_count ? get_record(0)->timestamp : 0;
+  _bin_header.crc32 = crc;
+
+  _csv.size = offset;
+
+  // SUMMARY.CSV size
+  char summary_line[SUMMARY_LINE_MAX];
+  _summary_size = SUMMARY_HEADER_LEN;
+  for ( uint32_t n = 0; n < _summary_count; n++ ) _summary_size += summary_render(n, summary_line);
+
+  // MEASERR.TXT size
+  char err_line[ERR_LINE_MAX];
+  _err_size = 0;
+  for ( uint32_t n = 0; n < err_rows(); n++ ) _err_size += err_render(n, err_line);
+
+  // locate start of each time window
+  uint32_t const newest = _rec_count ? get_record(_rec_count - 1)->timestamp : 0;
+  for ( uint8_t w = 0; w < MEASUREMENT_WINDOW_COUNT; w++ ) {
+    uint32_t const ts = (newest > _window[w].seconds) ? (newest - _window[w].seconds) : 0;
+    uint32_t const first = record_find(ts);
+    _window[w].start = (first < _rec_count) ? record_offset(first) : _csv.size;
+  }
+
+  measurement_new_set_watermark(_new_watermark);
+
+  _csv.cursor.rec = 0;
+  _csv.cursor.offset = CSV_HEADER_LEN;
+#if CFG_UF2_MEASUREMENT_CHANNEL_FILES
+  for ( uint8_t c = 0; c < 3; c++ ) {
+    _channel_csv[c].cursor.rec = 0;
+    _channel_csv[c].cursor.offset = CHANNEL_HEADER_LEN;
+  }
+#endif
+
+  return _csv.size;
+}
+
+void measurement_csv_read(uint32_t offset, void* dst, uint32_t len) {
+  text_read(&_csv, offset, dst, len);
+}
+
+void measurement_csv_read_ahead(uint32_t offset, uint32_t len) {
+  (void) offset;
+  text_read_ahead(&_csv, len);
+}
+
+//--------------------------------------------------------------------+
+// Slices of MEASDAT.CSV lines from start on, with their own header
+//--------------------------------------------------------------------+
+
+static void slice_read(uint32_t start, uint32_t offset, void* dst, uint32_t len) {
+  uint8_t* out = (uint8_t*) dst;
+
+  if ( offset < CSV_HEADER_LEN ) {
+    uint32_t const n = (CSV_HEADER_LEN - offset < len) ? (CSV_HEADER_LEN - offset) : len;
+    memcpy(out, CSV_HEADER + offset, n);
+    out += n;
+    offset += n;
+    len -= n;
+  }
+
+  // remaining lines are the same as MEASDAT.CSV
+  if ( len ) measurement_csv_read(start + (offset - CSV_HEADER_LEN), out, len);
+}
+
+static void slice_read_ahead(uint32_t start, uint32_t offset, uint32_t len) {
+  uint32_t const skip = (offset < CSV_HEADER_LEN) ? CSV_HEADER_LEN : offset;
+  measurement_csv_read_ahead(start + (skip - CSV_HEADER_LEN), len);
+}
+
+//--------------------------------------------------------------------+
+// Time windows
+//--------------------------------------------------------------------+
+
+uint32_t measurement_window_size(uint8_t w) {
+  return CSV_HEADER_LEN + (_csv.size - _window[w].start);
+}
+
+void measurement_window_read(uint8_t w, uint32_t offset, void* dst, uint32_t len) {
+  slice_read(_window[w].start, offset, dst, len);
+}
+
+void measurement_window_read_ahead(uint8_t w, uint32_t offset, uint32_t len) {
+  slice_read_ahead(_window[w].start, offset, len);
+}
+
+//--------------------------------------------------------------------+
+// Per-day files
+//--------------------------------------------------------------------+
+
+uint32_t measurement_day_count(void) {
+  return _day_count;
+}
+
+uint32_t measurement_day_number(uint32_t i) {
+  return _day[i].day;
+}
+
+uint32_t measurement_day_size(uint32_t i) {
+  uint32_t const end = (i + 1 < _day_count) ? _day[i + 1].start : _csv.size;
+  return CSV_HEADER_LEN + (end - _day[i].start);
+}
+
+void measurement_day_read(uint32_t i, uint32_t offset, void* dst, uint32_t len) {
+  slice_read(_day[i].start, offset, dst, len);
+}
+
+//--------------------------------------------------------------------+
+// NEW.CSV
+//--------------------------------------------------------------------+
+
+void measurement_new_set_watermark(uint32_t timestamp) {
+  _new_watermark = timestamp;
+
+  // first unacknowledged record by binary search, its line offset from the nearest checkpoint
+  uint32_t const first = (timestamp == UINT32_MAX) ? _rec_count : record_find(timestamp + 1);
+  _new_start = (first < _rec_count) ? record_offset(first) : _csv.size;
+}
+
+uint32_t measurement_new_watermark(void) {
+  return _new_watermark;
+}
+
+uint32_t measurement_newest_timestamp(void) {
+  return _rec_count ? get_record(_rec_count - 1)->timestamp : 0;
+}
+
+uint32_t measurement_new_size(void) {
+  return CSV_HEADER_LEN + (_csv.size - _new_start);
+}
+
+void measurement_new_read(uint32_t offset, void* dst, uint32_t len) {
+  slice_read(_new_start, offset, dst, len);
+}
+
+void measurement_new_read_ahead(uint32_t offset, uint32_t len) {
+  slice_read_ahead(_new_start, offset, len);
+}
+
+//--------------------------------------------------------------------+
+// SUMMARY.CSV
+//--------------------------------------------------------------------+
+
+uint32_t measurement_summary_size(void) {
+  return _summary_size;
+}
+
+void measurement_summary_read(uint32_t offset, void* dst, uint32_t len) {
+  uint8_t* out = (uint8_t*) dst;
+
+  if ( offset < SUMMARY_HEADER_LEN ) {
+    uint32_t const n = (SUMMARY_HEADER_LEN - offset < len) ? (SUMMARY_HEADER_LEN - offset) : len;
+    memcpy(out, SUMMARY_HEADER + offset, n);
+    out += n;
+    offset += n;
+    len -= n;
+  }
+
+  rows_read(summary_render, _summary_count, SUMMARY_HEADER_LEN, offset, out, len);
+}
+
+//--------------------------------------------------------------------+
+// MEASERR.TXT
+//--------------------------------------------------------------------+
+
+uint32_t measurement_err_size(void) {
+  return _err_size;
+}
+
+void measurement_err_read(uint32_t offset, void* dst, uint32_t len) {
+  rows_read(err_render, err_rows(), 0, offset, (uint8_t*) dst, len);
+}
+
+//--------------------------------------------------------------------+
+// CT1.CSV .. CT3.CSV
+//--------------------------------------------------------------------+
+
+#if CFG_UF2_MEASUREMENT_CHANNEL_FILES
+uint32_t measurement_channel_size(uint8_t channel) {
+  return _channel_csv[channel].size;
+}
+
+void measurement_channel_read(uint8_t channel, uint32_t offset, void* dst, uint32_t len) {
+  text_read(&_channel_csv[channel], offset, dst, len);
+}
+
+void measurement_channel_read_ahead(uint8_t channel, uint32_t offset, uint32_t len) {
+  (void) offset;
+  text_read_ahead(&_channel_csv[channel], len);
+}
+#endif
+
+//--------------------------------------------------------------------+
+// MEASDAT.BIN
+//--------------------------------------------------------------------+
+
+uint32_t measurement_bin_size(void) {
+  return sizeof(MeasurementBinHeader_t) + _rec_count * sizeof(MeasurementRecord_t);
+}
+
+void measurement_bin_read(uint32_t offset, void* dst, uint32_t len) {
+  uint8_t* out = (uint8_t*) dst;
+
+  if ( offset < sizeof(MeasurementBinHeader_t) ) {
+    uint32_t n = sizeof(MeasurementBinHeader_t) - offset;
+    if ( n > len ) n = len;
+
+    memcpy(out, ((uint8_t const*) &_bin_header) + offset, n);
+    out += n;
+    offset += n;
+    len -= n;
+  }
+
+  // records are read straight from flash into destination
+  if ( len ) uf2_measurement_data_read(offset - sizeof(MeasurementBinHeader_t), out, len);
+}
+
+void measurement_bin_read_ahead(uint32_t offset, uint32_t len) {
+  if ( !board_measuremnt_data_read_ahead ) return;
+
+  uint32_t const addr = (offset > sizeof(MeasurementBinHeader_t)) ? (offset - sizeof(MeasurementBinHeader_t)) : 0;
+  uf2_measurement_data_read_ahead(addr, len);
+}
+
+//--------------------------------------------------------------------+
+// INDEX.BIN
+//--------------------------------------------------------------------+
+
+#if CFG_UF2_MEASUREMENT_INDEX_FILE
+static uint32_t index_count(void) {
+  return (_rec_count + (1UL << _index_shift) - 1) >> _index_shift;
+}
+
+uint32_t measurement_index_size(void) {
+  return sizeof(MeasurementIndexHeader_t) + index_count() * sizeof(MeasurementIndexEntry_t);
+}
+
+// entries are built from the checkpoints as they are read, nothing is kept but the timestamps
+void measurement_index_read(uint32_t offset, void* dst, uint32_t len) {
+  uint8_t* out = (uint8_t*) dst;
+
+  if ( offset < sizeof(MeasurementIndexHeader_t) ) {
+    MeasurementIndexHeader_t const header = {
+      .magic       = MEASUREMENT_INDEX_MAGIC,
+      .header_size = sizeof(MeasurementIndexHeader_t),
+      .entry_size  = sizeof(MeasurementIndexEntry_t),
+      .entry_count = index_count(),
+      .stride      = 1UL << _index_shift,
+      .csv_size    = _csv.size,
+      .bin_size    = measurement_bin_size(),
+    };
+
+    uint32_t n = sizeof(MeasurementIndexHeader_t) - offset;
+    if ( n > len ) n = len;
+
+    memcpy(out, ((uint8_t const*) &header) + offset, n);
+    out += n;
+    offset += n;
+    len -= n;
+  }
+
+  uint32_t k = (offset - sizeof(MeasurementIndexHeader_t)) / sizeof(MeasurementIndexEntry_t);
+  uint32_t skip = (offset - sizeof(MeasurementIndexHeader_t)) % sizeof(MeasurementIndexEntry_t);
+
+  for ( ; len && k < index_count(); k++ ) {
+    uint32_t const rec = k << _index_shift;
+    MeasurementIndexEntry_t const entry = {
+      .timestamp  = _index_ts[k],
+      .record     = rec,
+      .csv_offset = _csv.index[k],
+      .bin_offset = sizeof(MeasurementBinHeader_t) + rec * sizeof(MeasurementRecord_t),
+    };
+
+    uint32_t n = sizeof(MeasurementIndexEntry_t) - skip;
+    if ( n > len ) n = len;
+
+    memcpy(out, ((uint8_t const*) &entry) + skip, n);
+    out += n;
+    len -= n;
+    skip = 0;
+  }
+}
+#endif
+
+#endif
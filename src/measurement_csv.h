@@ -0,0 +1,197 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef MEASUREMENT_CSV_H_
+#define MEASUREMENT_CSV_H_
+
+#include "uf2.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// MEASDAT.CSV rendered from fixed-size binary records stored by the application in ota1.
+// Record count is the measurement data size (from NVS) divided by record size.
+//--------------------------------------------------------------------+
+
+// Store measurements as binary records instead of CSV text
+#ifndef CFG_UF2_MEASUREMENT_BINARY
+  #define CFG_UF2_MEASUREMENT_BINARY      0
+#endif
+
+// Type of each current transformer value in a record
+#ifndef CFG_UF2_MEASUREMENT_CT_TYPE
+  #define CFG_UF2_MEASUREMENT_CT_TYPE     int16_t
+#endif
+
+// Number of record-to-CSV-offset checkpoints, each takes 4 bytes of RAM
+#ifndef CFG_UF2_MEASUREMENT_INDEX_SIZE
+  #define CFG_UF2_MEASUREMENT_INDEX_SIZE  256
+#endif
+
+// Number of most recent hours aggregated for SUMMARY.CSV, each takes 32 bytes of RAM (16-bit CT type)
+#ifndef CFG_UF2_MEASUREMENT_SUMMARY_HOURS
+  #define CFG_UF2_MEASUREMENT_SUMMARY_HOURS  168
+#endif
+
+// Maximum number of per-day CSV files, most recent days are kept. Each takes 8 bytes of RAM
+#ifndef CFG_UF2_MEASUREMENT_DAY_FILES
+  #define CFG_UF2_MEASUREMENT_DAY_FILES      366
+#endif
+
+// Number of bad chunks listed in MEASERR.TXT (and marked in CSV), each takes 20 bytes of RAM
+#ifndef CFG_UF2_MEASUREMENT_BAD_CHUNKS
+  #define CFG_UF2_MEASUREMENT_BAD_CHUNKS     16
+#endif
+
+// Replace the lines of a listed bad chunk in the CSV files by one "# crc error" marker line
+#ifndef CFG_UF2_MEASUREMENT_MARK_BAD
+  #define CFG_UF2_MEASUREMENT_MARK_BAD       0
+#endif
+
+// Export each CT on its own as CT1.CSV, CT2.CSV and CT3.CSV (time and one value per line),
+// each takes CFG_UF2_MEASUREMENT_INDEX_SIZE * 4 bytes of RAM for its checkpoint index
+#ifndef CFG_UF2_MEASUREMENT_CHANNEL_FILES
+  #define CFG_UF2_MEASUREMENT_CHANNEL_FILES  0
+#endif
+
+// Publish the checkpoint index as INDEX.BIN for hosts that seek by time, each checkpoint takes
+// 4 more bytes of RAM for its timestamp
+#ifndef CFG_UF2_MEASUREMENT_INDEX_FILE
+  #define CFG_UF2_MEASUREMENT_INDEX_FILE     0
+#endif
+
+typedef struct __attribute__((packed)) {
+  uint32_t timestamp;
+  CFG_UF2_MEASUREMENT_CT_TYPE ct[3];
+} MeasurementRecord_t;
+
+// Header of MEASDAT.BIN, followed by the raw record stream
+#define MEASUREMENT_BIN_MAGIC  0x5441444DUL // "MDAT"
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint16_t header_size;
+  uint16_t record_size;
+  uint32_t record_count;
+  uint32_t first_timestamp;
+  uint32_t crc32;            // IEEE crc32 of all records
+} MeasurementBinHeader_t;
+
+// Header of INDEX.BIN, followed by entry_count checkpoints in record order. Every stride-th record
+// has one, a host reads the lines or records of a time range from the last checkpoint at or
+// before its start on
+#define MEASUREMENT_INDEX_MAGIC  0x5844494DUL // "MIDX"
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint16_t header_size;
+  uint16_t entry_size;
+  uint32_t entry_count;
+  uint32_t stride;           // records from one checkpoint to the next
+  uint32_t csv_size;         // of MEASDAT.CSV and MEASDAT.BIN the offsets refer to
+  uint32_t bin_size;
+} MeasurementIndexHeader_t;
+
+typedef struct __attribute__((packed)) {
+  uint32_t timestamp;        // of the record, ascending unless the clock was set back
+  uint32_t record;
+  uint32_t csv_offset;       // of its line in MEASDAT.CSV
+  uint32_t bin_offset;       // of the record in MEASDAT.BIN
+} MeasurementIndexEntry_t;
+
+// Records of the stream covered by one stored checksum, e.g one sector of the ring or one packed block
+typedef struct {
+  uint32_t first;            // index of first record
+  uint32_t count;
+  uint32_t crc32;            // IEEE crc32 of the records as stored by the writer
+  bool checked;              // crc32 is stored, false for a chunk still being written
+} MeasurementChunk_t;
+
+// Scan records in measurement data of data_size bytes and build checkpoint index, return CSV size
+uint32_t measurement_csv_init(uint32_t data_size);
+
+// Render [offset, offset+len) of CSV text into dst
+void measurement_csv_read(uint32_t offset, void* dst, uint32_t len);
+
+// Hint that CSV text at offset will be read next
+void measurement_csv_read_ahead(uint32_t offset, uint32_t len);
+
+// Time windows exported as separate CSV files (LAST24H.CSV, LAST7D.CSV) containing only records
+// within the window before the newest timestamp. Records must be in ascending timestamp order.
+enum {
+  MEASUREMENT_WINDOW_24H = 0,
+  MEASUREMENT_WINDOW_7D,
+  MEASUREMENT_WINDOW_COUNT
+};
+
+// CSV of a time window, valid after measurement_csv_init()
+uint32_t measurement_window_size(uint8_t w);
+void measurement_window_read(uint8_t w, uint32_t offset, void* dst, uint32_t len);
+void measurement_window_read_ahead(uint8_t w, uint32_t offset, uint32_t len);
+
+// SUMMARY.CSV: per-hour min/max/mean of each CT, aggregated during measurement_csv_init()
+uint32_t measurement_summary_size(void);
+void measurement_summary_read(uint32_t offset, void* dst, uint32_t len);
+
+// Per-day CSV files: records of one UTC day each, valid after measurement_csv_init()
+uint32_t measurement_day_count(void);
+uint32_t measurement_day_number(uint32_t i); // days since 1970-01-01
+uint32_t measurement_day_size(uint32_t i);
+void measurement_day_read(uint32_t i, uint32_t offset, void* dst, uint32_t len);
+
+// MEASERR.TXT: chunks whose records do not match their crc32, checked during measurement_csv_init()
+uint32_t measurement_err_size(void);
+void measurement_err_read(uint32_t offset, void* dst, uint32_t len);
+
+// NEW.CSV: records with a timestamp after the watermark, the newest one the host acknowledged.
+// Setting it takes a binary search, valid after measurement_csv_init()
+void measurement_new_set_watermark(uint32_t timestamp);
+uint32_t measurement_new_watermark(void);
+uint32_t measurement_newest_timestamp(void);
+uint32_t measurement_new_size(void);
+void measurement_new_read(uint32_t offset, void* dst, uint32_t len);
+void measurement_new_read_ahead(uint32_t offset, uint32_t len);
+
+// Single CT channel (0..2) CSV files, valid after measurement_csv_init()
+uint32_t measurement_channel_size(uint8_t channel);
+void measurement_channel_read(uint8_t channel, uint32_t offset, void* dst, uint32_t len);
+void measurement_channel_read_ahead(uint8_t channel, uint32_t offset, uint32_t len);
+
+// MEASDAT.BIN: header and record stream, valid after measurement_csv_init()
+uint32_t measurement_bin_size(void);
+void measurement_bin_read(uint32_t offset, void* dst, uint32_t len);
+void measurement_bin_read_ahead(uint32_t offset, uint32_t len);
+
+// INDEX.BIN: header and checkpoints, valid after measurement_csv_init()
+uint32_t measurement_index_size(void);
+void measurement_index_read(uint32_t offset, void* dst, uint32_t len);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
@@ -0,0 +1,268 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include "measurement_gz.h"
+#include "deflate.h"
+
+#if CFG_UF2_MEASUREMENT_GZ
+
+//--------------------------------------------------------------------+
+// MACRO TYPEDEF CONSTANT ENUM DECLARATION
+//--------------------------------------------------------------------+
+
+// gzip member (RFC 1952): header, deflate stream of the segments, final block, crc32 and size
+#define GZ_HEADER_LEN   10
+#define GZ_TAIL_LEN     (2 + 8)
+
+// CSV bytes compressed at once, output of the last piece past the read is kept for the next one
+#define GZ_FEED         64
+#define GZ_PENDING      DEFLATE_OUTPUT_MAX(GZ_FEED)
+
+// CSV bytes covered by one compressed byte, for read-ahead
+#define GZ_RATIO        4
+
+// magic, deflate, no flags, no modification time, no extra flags, unknown OS
+static uint8_t const _gz_header[GZ_HEADER_LEN] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF };
+
+static measurement_gz_source_t const* _source;
+static uint32_t _csv_size;
+
+static uint32_t _index[CFG_UF2_MEASUREMENT_GZ_INDEX_SIZE]; // file offset of each segment
+static uint32_t _segment_len;
+static uint32_t _segment_count;
+static uint32_t _deflate_end;                              // file offset of the final block
+
+// final block (BFINAL 1, fixed Huffman, end of block), crc32 and size of the CSV
+static uint8_t _tail[GZ_TAIL_LEN];
+
+// Encoder of the last read: segment being compressed, next CSV offset to feed it and file offset
+// after its output, of which the last pending_len bytes were not read yet
+static struct {
+  bool active;
+  uint32_t segment;
+  uint32_t csv;
+  uint32_t produced;
+  uint32_t pending_len;
+  uint8_t pending[GZ_PENDING];
+} _enc;
+
+// [offset, end) of the file requested by a read
+typedef struct {
+  uint8_t* out;
+  uint32_t offset;
+  uint32_t end;
+} gz_dest_t;
+
+//--------------------------------------------------------------------+
+//
+//--------------------------------------------------------------------+
+
+static uint32_t crc32_update(uint32_t crc, uint8_t const* buf, uint32_t len) {
+  if ( board_crc32 ) return board_crc32(crc, buf, len);
+
+  static uint32_t const table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+
+  crc = ~crc;
+  for ( uint32_t i = 0; i < len; i++ ) {
+    crc = table[(crc ^ buf[i]) & 0x0F] ^ (crc >> 4);
+    crc = table[(crc ^ (buf[i] >> 4)) & 0x0F] ^ (crc >> 4);
+  }
+  return ~crc;
+}
+
+static uint32_t segment_end(uint32_t k) {
+  uint32_t const end = (k + 1) * _segment_len;
+  return (end < _csv_size) ? end : _csv_size;
+}
+
+static void count_output(uint8_t const* data, uint32_t len, void* arg) {
+  (void) data;
+  *((uint32_t*) arg) += len;
+}
+
+// Encoder output of a read: bytes before it are dropped, bytes after it kept as pending
+static void read_output(uint8_t const* data, uint32_t len, void* arg) {
+  gz_dest_t const* dest = (gz_dest_t const*) arg;
+  uint32_t pos = _enc.produced;
+  _enc.produced += len;
+
+  if ( pos < dest->offset ) {
+    uint32_t const n = (dest->offset - pos < len) ? (dest->offset - pos) : len;
+    data += n;
+    pos += n;
+    len -= n;
+  }
+
+  if ( len && pos < dest->end ) {
+    uint32_t const n = (dest->end - pos < len) ? (dest->end - pos) : len;
+    memcpy(dest->out + (pos - dest->offset), data, n);
+    data += n;
+    len -= n;
+  }
+
+  // data may be the pending buffer itself
+  memmove(_enc.pending + _enc.pending_len, data, len);
+  _enc.pending_len += len;
+}
+
+// Read [offset, offset+len) of the deflate stream, within [GZ_HEADER_LEN, _deflate_end)
+static void deflate_read(uint32_t offset, uint8_t* out, uint32_t len) {
+  // last segment starting at or before offset
+  uint32_t lo = 0;
+  uint32_t hi = _segment_count - 1;
+  while ( lo < hi ) {
+    uint32_t const mid = (lo + hi + 1) / 2;
+    if ( _index[mid] <= offset ) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+
+  // continue if the host reads on sequentially, otherwise restart at the segment
+  if ( !(_enc.active && _enc.produced - _enc.pending_len <= offset && lo <= _enc.segment) ) {
+    _enc.active = true;
+    _enc.segment = lo;
+    _enc.csv = lo * _segment_len;
+    _enc.produced = _index[lo];
+    _enc.pending_len = 0;
+    deflate_init();
+  }
+
+  gz_dest_t dest = { .out = out, .offset = offset, .end = offset + len };
+
+  uint32_t const pending = _enc.pending_len;
+  _enc.produced -= pending;
+  _enc.pending_len = 0;
+  read_output(_enc.pending, pending, &dest);
+
+  uint8_t buf[GZ_FEED];
+  while ( _enc.produced < dest.end && _enc.segment < _segment_count ) {
+    uint32_t const end = segment_end(_enc.segment);
+    uint32_t const n = (end - _enc.csv < GZ_FEED) ? (end - _enc.csv) : GZ_FEED;
+
+    _source->read(_enc.csv, buf, n);
+    _enc.csv += n;
+    deflate_feed(buf, n, read_output, &dest);
+
+    if ( _enc.csv == end ) {
+      deflate_flush(read_output, &dest);
+      _enc.segment++;
+      if ( _enc.segment < _segment_count ) deflate_init();
+    }
+  }
+}
+
+//--------------------------------------------------------------------+
+// API
+//--------------------------------------------------------------------+
+
+uint32_t measurement_gz_init(uint32_t size, measurement_gz_source_t const* source) {
+  _source = source;
+  _csv_size = size;
+  _enc.active = false;
+
+  _segment_len = (size + CFG_UF2_MEASUREMENT_GZ_INDEX_SIZE - 1) / CFG_UF2_MEASUREMENT_GZ_INDEX_SIZE;
+  if ( _segment_len < CFG_UF2_MEASUREMENT_GZ_SEGMENT ) _segment_len = CFG_UF2_MEASUREMENT_GZ_SEGMENT;
+
+  // an empty CSV is still one (empty) segment
+  _segment_count = (size + _segment_len - 1) / _segment_len;
+  if ( _segment_count == 0 ) _segment_count = 1;
+
+  uint32_t offset = GZ_HEADER_LEN;
+  uint32_t crc = 0;
+  uint8_t buf[GZ_FEED];
+
+  for ( uint32_t k = 0; k < _segment_count; k++ ) {
+    _index[k] = offset;
+    deflate_init();
+
+    uint32_t const end = segment_end(k);
+    for ( uint32_t csv = k * _segment_len; csv < end; ) {
+      uint32_t const n = (end - csv < GZ_FEED) ? (end - csv) : GZ_FEED;
+      source->read(csv, buf, n);
+      crc = crc32_update(crc, buf, n);
+      deflate_feed(buf, n, count_output, &offset);
+      csv += n;
+    }
+
+    deflate_flush(count_output, &offset);
+  }
+
+  _deflate_end = offset;
+
+  uint8_t* tail = _tail;
+  *tail++ = 0x03;
+  *tail++ = 0x00;
+  for ( uint32_t i = 0; i < 4; i++ ) *tail++ = (uint8_t) (crc >> (8 * i));
+  for ( uint32_t i = 0; i < 4; i++ ) *tail++ = (uint8_t) (size >> (8 * i));
+
+  TUF2_LOG1("MEASDAT.CSV.GZ: %lu bytes from %lu, %lu segments\r\n", _deflate_end + GZ_TAIL_LEN, size,
+            _segment_count);
+
+  return _deflate_end + GZ_TAIL_LEN;
+}
+
+void measurement_gz_read(uint32_t offset, void* dst, uint32_t len) {
+  uint8_t* out = (uint8_t*) dst;
+
+  if ( offset < GZ_HEADER_LEN ) {
+    uint32_t n = GZ_HEADER_LEN - offset;
+    if ( n > len ) n = len;
+
+    memcpy(out, _gz_header + offset, n);
+    out += n;
+    offset += n;
+    len -= n;
+  }
+
+  if ( len && offset < _deflate_end ) {
+    uint32_t n = _deflate_end - offset;
+    if ( n > len ) n = len;
+
+    deflate_read(offset, out, n);
+    out += n;
+    offset += n;
+    len -= n;
+  }
+
+  if ( len ) memcpy(out, _tail + (offset - _deflate_end), len);
+}
+
+void measurement_gz_read_ahead(uint32_t offset, uint32_t len) {
+  (void) offset;
+  if ( !_source->read_ahead || !_enc.active || _enc.csv >= _csv_size ) return;
+
+  uint32_t n = GZ_RATIO * len;
+  if ( n > _csv_size - _enc.csv ) n = _csv_size - _enc.csv;
+  _source->read_ahead(_enc.csv, n);
+}
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef MEASUREMENT_GZ_H_
+#define MEASUREMENT_GZ_H_
+
+#include "board_api.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// MEASDAT.CSV.GZ: MEASDAT.CSV (rendered from records or as stored by the application) as one gzip
+// member, compressed on the fly by deflate.c. The CSV is cut into segments that are compressed on
+// their own, a read continues the encoder of the previous read or restarts it at the segment it
+// falls in, so a random read compresses at most one segment again. The whole CSV is compressed
+// once in measurement_gz_init() for the file size, the offset of each segment and the crc32.
+//--------------------------------------------------------------------+
+
+// Export MEASDAT.CSV.GZ next to MEASDAT.CSV, costs about 8KB of RAM with the default window
+#ifndef CFG_UF2_MEASUREMENT_GZ
+  #define CFG_UF2_MEASUREMENT_GZ             0
+#endif
+
+// Minimum CSV bytes per segment, the most a random read compresses again
+#ifndef CFG_UF2_MEASUREMENT_GZ_SEGMENT
+  #define CFG_UF2_MEASUREMENT_GZ_SEGMENT     8192
+#endif
+
+// Number of segments, each takes 4 bytes of RAM. Segments grow beyond CFG_UF2_MEASUREMENT_GZ_SEGMENT
+// for a CSV that does not fit
+#ifndef CFG_UF2_MEASUREMENT_GZ_INDEX_SIZE
+  #define CFG_UF2_MEASUREMENT_GZ_INDEX_SIZE  256
+#endif
+
+// CSV text to compress: read() fills dst with [offset, offset+len), read_ahead() is optional
+typedef struct {
+  void (*read) (uint32_t offset, void* dst, uint32_t len);
+  void (*read_ahead) (uint32_t offset, uint32_t len);
+} measurement_gz_source_t;
+
+// Compress size bytes of CSV from source, return size of MEASDAT.CSV.GZ
+uint32_t measurement_gz_init(uint32_t size, measurement_gz_source_t const* source);
+
+// Render [offset, offset+len) of MEASDAT.CSV.GZ into dst
+void measurement_gz_read(uint32_t offset, void* dst, uint32_t len);
+
+// Hint that MEASDAT.CSV.GZ at offset will be read next
+void measurement_gz_read_ahead(uint32_t offset, uint32_t len);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
@@ -0,0 +1,254 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stddef.h>
+#include "measurement_pack.h"
+#include "measurement_cache.h"
+
+#if CFG_UF2_MEASUREMENT_PACKED
+
+#if !CFG_UF2_MEASUREMENT_BINARY
+  #error "CFG_UF2_MEASUREMENT_PACKED requires CFG_UF2_MEASUREMENT_BINARY"
+#endif
+
+#if CFG_UF2_MEASUREMENT_RING
+  #error "CFG_UF2_MEASUREMENT_PACKED and CFG_UF2_MEASUREMENT_RING are exclusive"
+#endif
+
+//--------------------------------------------------------------------+
+// MACRO TYPEDEF CONSTANT ENUM DECLARATION
+//--------------------------------------------------------------------+
+
+#define PACK_TAG_END      0xFF
+#define PACK_ENTRY_MAX    (1 + 4 * 4)
+
+// payload bytes fetched from flash at once, padded so that values are loaded as whole words
+#define PACK_WINDOW       256
+
+typedef CFG_UF2_MEASUREMENT_CT_TYPE ct_t;
+
+// bytes and value mask per size code
+static uint8_t const _code_len[4] = { 0, 1, 2, 4 };
+static uint32_t const _code_mask[4] = { 0, 0xFFUL, 0xFFFFUL, 0xFFFFFFFFUL };
+
+// found by the last scan
+static uint32_t _blocks;
+static uint32_t _records;
+static uint32_t _open_count;  // records of the last block if it is still open
+
+// block being decoded, rec is the record at index
+static struct {
+  uint32_t block;
+  uint32_t first;
+  uint32_t count;
+  uint32_t index;
+  uint32_t pos;      // payload offset of the entry after rec
+  uint32_t limit;    // payload bytes
+  uint32_t interval;
+  MeasurementRecord_t rec;
+} _dec = { .block = UINT32_MAX };
+
+static struct {
+  uint32_t block;
+  uint32_t start;
+  uint8_t buf[PACK_WINDOW + 4];
+} _win = { .block = UINT32_MAX };
+
+//--------------------------------------------------------------------+
+// Decoder
+//--------------------------------------------------------------------+
+
+static bool block_header(uint32_t block, MeasurementPackHeader_t* hdr) {
+  measurement_cache_read(block * MEASUREMENT_PACK_SECTOR_SIZE, hdr, sizeof(MeasurementPackHeader_t));
+  return hdr->magic == MEASUREMENT_PACK_MAGIC;
+}
+
+// payload of the current block from pos on, at least PACK_ENTRY_MAX bytes of it (erased past limit)
+static uint8_t const* window_at(uint32_t pos) {
+  if ( _win.block != _dec.block || pos < _win.start || pos + PACK_ENTRY_MAX > _win.start + PACK_WINDOW ) {
+    uint32_t const n = (_dec.limit - pos < PACK_WINDOW) ? (_dec.limit - pos) : PACK_WINDOW;
+    measurement_cache_read(_dec.block * MEASUREMENT_PACK_SECTOR_SIZE + sizeof(MeasurementPackHeader_t) + pos,
+                               _win.buf, n);
+    memset(_win.buf + n, 0xff, sizeof(_win.buf) - n);
+    _win.block = _dec.block;
+    _win.start = pos;
+  }
+  return _win.buf + (pos - _win.start);
+}
+
+// decode the entry at pos into rec, false at the end of an open block
+static bool decode_next(void) {
+  if ( _dec.pos >= _dec.limit ) return false;
+
+  uint8_t const* p = window_at(_dec.pos);
+  uint8_t const tag = *p++;
+  if ( tag == PACK_TAG_END ) return false;
+
+  // every column is one word load masked to its size, no branch on the size
+  int32_t delta[4];
+  for ( uint32_t c = 0; c < 4; c++ ) {
+    uint32_t const code = (tag >> (2 * c)) & 3;
+    uint32_t v;
+    memcpy(&v, p, 4);
+    v &= _code_mask[code];
+    p += _code_len[code];
+    delta[c] = (int32_t) (v >> 1) ^ -(int32_t) (v & 1);
+  }
+
+  _dec.interval += (uint32_t) delta[0];
+  _dec.rec.timestamp += _dec.interval;
+  for ( uint32_t i = 0; i < 3; i++ ) _dec.rec.ct[i] = (ct_t) (_dec.rec.ct[i] + delta[i + 1]);
+
+  _dec.pos += 1 + _code_len[tag & 3] + _code_len[(tag >> 2) & 3] + _code_len[(tag >> 4) & 3] + _code_len[tag >> 6];
+  _dec.index++;
+  return true;
+}
+
+// start decoding block at its first record
+static void decode_start(uint32_t block) {
+  MeasurementPackHeader_t hdr;
+  block_header(block, &hdr);
+
+  bool const open = (hdr.record_count == 0xFFFF);
+  _dec.block = block;
+  _dec.first = _dec.index = hdr.first_index;
+  _dec.count = open ? _open_count : hdr.record_count;
+  _dec.limit = open ? MEASUREMENT_PACK_PAYLOAD_MAX :
+               ((hdr.payload_size < MEASUREMENT_PACK_PAYLOAD_MAX) ? hdr.payload_size : MEASUREMENT_PACK_PAYLOAD_MAX);
+  _dec.pos = 0;
+  _dec.interval = 0;
+  _dec.rec = hdr.first;
+}
+
+// record i of the stream, decoding forward from the current one or from the start of its block
+static MeasurementRecord_t const* pack_record(uint32_t i) {
+  if ( !(_dec.block < _blocks && _dec.index <= i && i < _dec.first + _dec.count) ) {
+    // last block starting at or before i, probes bypass the sector cache
+    uint32_t lo = 0;
+    uint32_t hi = _blocks - 1;
+    while ( lo < hi ) {
+      uint32_t const mid = (lo + hi + 1) / 2;
+      uint32_t first;
+      board_measuremnt_data_read(mid * MEASUREMENT_PACK_SECTOR_SIZE + offsetof(MeasurementPackHeader_t, first_index),
+                                 &first, sizeof(first));
+      if ( first <= i ) {
+        lo = mid;
+      } else {
+        hi = mid - 1;
+      }
+    }
+    decode_start(lo);
+  }
+
+  while ( _dec.index < i && decode_next() ) {}
+  return &_dec.rec;
+}
+
+//--------------------------------------------------------------------+
+// API
+//--------------------------------------------------------------------+
+
+uint32_t measurement_pack_scan(void) {
+  _blocks = _records = _open_count = 0;
+  _dec.block = _win.block = UINT32_MAX;
+
+  // blocks are written from the first sector on, binary search for the first one without a header.
+  // Probes bypass the sector cache
+  MeasurementPackHeader_t hdr;
+  uint32_t lo = 0;
+  uint32_t hi = board_measuremnt_data_size() / MEASUREMENT_PACK_SECTOR_SIZE;
+  while ( lo < hi ) {
+    uint32_t const mid = lo + (hi - lo) / 2;
+    uint32_t magic;
+    board_measuremnt_data_read(mid * MEASUREMENT_PACK_SECTOR_SIZE, &magic, sizeof(magic));
+    if ( magic == MEASUREMENT_PACK_MAGIC ) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  _blocks = lo;
+  if ( !_blocks ) return 0;
+
+  block_header(_blocks - 1, &hdr);
+  if ( hdr.record_count != 0xFFFF ) {
+    _records = hdr.first_index + hdr.record_count;
+  } else {
+    // open block is counted by walking its entries
+    _open_count = UINT32_MAX;
+    decode_start(_blocks - 1);
+    while ( decode_next() ) {}
+    _open_count = _dec.index - _dec.first + 1;
+    _dec.count = _open_count;
+    _records = hdr.first_index + _open_count;
+  }
+
+  TUF2_LOG1("Measurement pack: %lu blocks, %lu records\r\n", _blocks, _records);
+  return _records * sizeof(MeasurementRecord_t);
+}
+
+void measurement_pack_read(uint32_t offset, void* dst, uint32_t len) {
+  uint8_t* out = (uint8_t*) dst;
+  uint32_t const size = _records * sizeof(MeasurementRecord_t);
+
+  while ( len && offset < size ) {
+    uint32_t const skip = offset % sizeof(MeasurementRecord_t);
+    uint32_t n = sizeof(MeasurementRecord_t) - skip;
+    if ( n > len ) n = len;
+
+    memcpy(out, ((uint8_t const*) pack_record(offset / sizeof(MeasurementRecord_t))) + skip, n);
+    out += n;
+    offset += n;
+    len -= n;
+  }
+
+  // past the end reads as erased, like the plain record array
+  memset(out, 0xff, len);
+}
+
+void measurement_pack_read_ahead(uint32_t offset, uint32_t len) {
+  (void) offset;
+  if ( !board_measuremnt_data_read_ahead || _dec.block >= _blocks ) return;
+
+  // entries are smaller than records, the rest of the current block covers len
+  uint32_t const pos = _dec.pos;
+  uint32_t const n = _dec.limit - pos;
+  board_measuremnt_data_read_ahead(_dec.block * MEASUREMENT_PACK_SECTOR_SIZE + sizeof(MeasurementPackHeader_t) + pos,
+                                   (len < n) ? len : n);
+}
+
+bool measurement_pack_chunk(uint32_t k, MeasurementChunk_t* chunk) {
+  MeasurementPackHeader_t hdr;
+  if ( k >= _blocks || !block_header(k, &hdr) ) return false;
+
+  bool const open = (hdr.record_count == 0xFFFF);
+  chunk->first = hdr.first_index;
+  chunk->count = open ? _open_count : hdr.record_count;
+  chunk->crc32 = hdr.crc32;
+  chunk->checked = !open;
+  return true;
+}
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef MEASUREMENT_PACK_H_
+#define MEASUREMENT_PACK_H_
+
+#include "measurement_csv.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Delta-encoded record blocks in ota1, written by the application, one block per sector of
+// MEASUREMENT_PACK_SECTOR_SIZE from the start of the partition. The bootloader decodes them back to
+// the MeasurementRecord_t stream everything else renders from (MEASDAT.CSV/BIN, CDC).
+//
+// A block is a header holding its first record as is, followed by one entry per further record:
+// a tag byte with a 2-bit size code per column (bits 0-1 timestamp, 2-3 CT1, 4-5 CT2, 6-7 CT3;
+// code 0, 1, 2, 3 for 0, 1, 2, 4 bytes) then the column values, little endian and zigzag encoded.
+// Timestamps store the change of the interval to the previous record (0 with a fixed interval,
+// interval starts at 0 in every block), CTs the difference to the previous record. Tag 0xFF is
+// never written, a record that needs 4 bytes in every column starts a new block instead.
+//
+// Writer contract:
+// - open: erase the sector, program the header with record_count, payload_size and crc32 left erased
+// - append entries, program the values before their tag byte: an erased tag ends an open block
+// - close when the next entry does not fit: program record_count, payload_size and crc32, open the next.
+//   A writer that finds programmed bytes after the end of an open block after a reset closes it
+//--------------------------------------------------------------------+
+
+// Present ota1 as packed blocks instead of a plain record array, needs CFG_UF2_MEASUREMENT_BINARY
+#ifndef CFG_UF2_MEASUREMENT_PACKED
+  #define CFG_UF2_MEASUREMENT_PACKED  0
+#endif
+
+#define MEASUREMENT_PACK_MAGIC        0x4B41504DUL // "MPAK"
+#define MEASUREMENT_PACK_SECTOR_SIZE  4096
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint32_t first_index;       // records in the blocks before this one
+  uint16_t record_count;      // 0xFFFF while open
+  uint16_t payload_size;      // bytes of entries, 0xFFFF while open
+  uint32_t crc32;             // IEEE crc32 of the decoded records, 0xFFFFFFFF while open
+  MeasurementRecord_t first;
+} MeasurementPackHeader_t;
+
+#define MEASUREMENT_PACK_PAYLOAD_MAX  (MEASUREMENT_PACK_SECTOR_SIZE - sizeof(MeasurementPackHeader_t))
+
+// Count blocks and records, return size of the decoded record stream in bytes.
+// Takes O(log n) header reads plus one pass over the open block.
+uint32_t measurement_pack_scan(void);
+
+// Decode [offset, offset+len) of the record stream found by the last measurement_pack_scan()
+void measurement_pack_read(uint32_t offset, void* dst, uint32_t len);
+void measurement_pack_read_ahead(uint32_t offset, uint32_t len);
+
+// Chunk k of the record stream is block k, false past the last block
+bool measurement_pack_chunk(uint32_t k, MeasurementChunk_t* chunk);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
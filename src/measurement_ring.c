@@ -0,0 +1,188 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stddef.h>
+#include "measurement_ring.h"
+#include "measurement_cache.h"
+
+#if CFG_UF2_MEASUREMENT_RING
+
+#if !CFG_UF2_MEASUREMENT_BINARY
+  #error "CFG_UF2_MEASUREMENT_RING requires CFG_UF2_MEASUREMENT_BINARY"
+#endif
+
+//--------------------------------------------------------------------+
+// MACRO TYPEDEF CONSTANT ENUM DECLARATION
+//--------------------------------------------------------------------+
+
+#define RING_SECTOR_BYTES   (MEASUREMENT_RING_RECORDS * sizeof(MeasurementRecord_t))
+
+// found by the last scan, stream is count sectors from tail on with head_records in the last one
+static uint32_t _sectors;
+static uint32_t _tail;
+static uint32_t _count;
+static uint32_t _head_records;
+
+//--------------------------------------------------------------------+
+// Scan
+// Probes are single small reads spread over the partition, they bypass the sector cache
+//--------------------------------------------------------------------+
+
+// seq of a sector with a valid header, false if it is erased or holds something else
+static bool sector_seq(uint32_t sector, uint32_t* seq) {
+  MeasurementRingHeader_t hdr;
+  board_measuremnt_data_read(sector * MEASUREMENT_RING_SECTOR_SIZE, &hdr, offsetof(MeasurementRingHeader_t, record_count));
+
+  *seq = hdr.seq;
+  return hdr.magic == MEASUREMENT_RING_MAGIC && hdr.seq != 0xFFFFFFFFUL && hdr.record_size == sizeof(MeasurementRecord_t);
+}
+
+// records in a sector: from its header once closed, else up to the first erased timestamp
+static uint32_t sector_records(uint32_t sector) {
+  uint32_t const addr = sector * MEASUREMENT_RING_SECTOR_SIZE;
+  uint16_t count;
+  board_measuremnt_data_read(addr + offsetof(MeasurementRingHeader_t, record_count), &count, sizeof(count));
+  if ( count != 0xFFFF ) return (count < MEASUREMENT_RING_RECORDS) ? count : MEASUREMENT_RING_RECORDS;
+
+  uint32_t lo = 0;
+  uint32_t hi = MEASUREMENT_RING_RECORDS;
+  while ( lo < hi ) {
+    uint32_t const mid = lo + (hi - lo) / 2;
+    uint32_t ts;
+    board_measuremnt_data_read(addr + sizeof(MeasurementRingHeader_t) + mid * sizeof(MeasurementRecord_t), &ts, sizeof(ts));
+    if ( ts == 0xFFFFFFFFUL ) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return lo;
+}
+
+uint32_t measurement_ring_scan(void) {
+  _sectors = board_measuremnt_data_size() / MEASUREMENT_RING_SECTOR_SIZE;
+  _tail = _count = _head_records = 0;
+  if ( !_sectors ) return 0;
+
+  uint32_t head;
+  uint32_t s0;
+  uint32_t seq;
+
+  if ( sector_seq(0, &s0) ) {
+    // sectors written since sector 0 follow it with consecutive seq, the first one that does not
+    // is erased (ring not full yet, or erased ahead) or older (ring wrapped)
+    uint32_t lo = 1;
+    uint32_t hi = _sectors;
+    while ( lo < hi ) {
+      uint32_t const mid = lo + (hi - lo) / 2;
+      if ( sector_seq(mid, &seq) && seq - s0 == mid ) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    head = lo - 1;
+
+    // oldest sector is right after the head, or after the one erased ahead of it
+    _tail = 0;
+    for ( uint32_t i = 1; i <= 2 && head + i < _sectors; i++ ) {
+      if ( sector_seq(head + i, &seq) ) {
+        if ( (int32_t) (seq - s0) < 0 ) _tail = head + i;
+        break;
+      }
+    }
+  } else if ( _sectors > 1 && sector_seq(_sectors - 1, &seq) ) {
+    // wrapped and sector 0 is erased ahead of the next record: head is the last sector
+    head = _sectors - 1;
+    _tail = sector_seq(1, &seq) ? 1 : head;
+  } else {
+    return 0;
+  }
+
+  _count = (head + _sectors - _tail) % _sectors + 1;
+  _head_records = sector_records(head);
+
+  TUF2_LOG1("Measurement ring: tail %lu, head %lu, %lu sectors\r\n", _tail, head, _count);
+  return ((_count - 1) * MEASUREMENT_RING_RECORDS + _head_records) * sizeof(MeasurementRecord_t);
+}
+
+//--------------------------------------------------------------------+
+// Read
+//--------------------------------------------------------------------+
+
+// partition address of stream offset, n is set to the bytes left in its sector
+static uint32_t stream_addr(uint32_t offset, uint32_t* n) {
+  uint32_t const k = offset / RING_SECTOR_BYTES;
+  uint32_t const within = offset % RING_SECTOR_BYTES;
+  uint32_t const sector = (_tail + k) % _sectors;
+
+  *n = RING_SECTOR_BYTES - within;
+  return sector * MEASUREMENT_RING_SECTOR_SIZE + sizeof(MeasurementRingHeader_t) + within;
+}
+
+void measurement_ring_read(uint32_t offset, void* dst, uint32_t len) {
+  uint8_t* out = (uint8_t*) dst;
+  uint32_t const size = _count ? ((_count - 1) * MEASUREMENT_RING_RECORDS + _head_records) * sizeof(MeasurementRecord_t) : 0;
+
+  while ( len && offset < size ) {
+    uint32_t n;
+    uint32_t const addr = stream_addr(offset, &n);
+    if ( n > len ) n = len;
+    if ( n > size - offset ) n = size - offset;
+
+    measurement_cache_read(addr, out, n);
+    out += n;
+    offset += n;
+    len -= n;
+  }
+
+  // past the end reads as erased, like the plain record array
+  memset(out, 0xff, len);
+}
+
+void measurement_ring_read_ahead(uint32_t offset, uint32_t len) {
+  if ( !board_measuremnt_data_read_ahead || !_count ) return;
+
+  // only the rest of the sector is contiguous in flash
+  uint32_t n;
+  uint32_t const addr = stream_addr(offset, &n);
+  board_measuremnt_data_read_ahead(addr, (len < n) ? len : n);
+}
+
+bool measurement_ring_chunk(uint32_t k, MeasurementChunk_t* chunk) {
+  if ( k >= _count ) return false;
+
+  uint32_t const addr = ((_tail + k) % _sectors) * MEASUREMENT_RING_SECTOR_SIZE;
+  uint16_t count;
+  measurement_cache_read(addr + offsetof(MeasurementRingHeader_t, record_count), &count, sizeof(count));
+  measurement_cache_read(addr + offsetof(MeasurementRingHeader_t, crc32), &chunk->crc32, sizeof(chunk->crc32));
+
+  chunk->first = k * MEASUREMENT_RING_RECORDS;
+  chunk->count = (k + 1 < _count) ? MEASUREMENT_RING_RECORDS : _head_records;
+  chunk->checked = (count != 0xFFFF);
+  return true;
+}
+
+#endif
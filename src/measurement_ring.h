@@ -0,0 +1,86 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef MEASUREMENT_RING_H_
+#define MEASUREMENT_RING_H_
+
+#include "measurement_csv.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Log-structured ring of binary records in ota1, written by the application. The partition is split
+// in sectors of MEASUREMENT_RING_SECTOR_SIZE, each starts with a header and holds as many records as
+// fit. Sectors are written in partition order and wrap around, seq counts sectors ever opened, so
+// the newest sector (head) and the oldest one (tail) are found by binary search over seq instead
+// of keeping the valid size in NVS.
+//
+// Writer contract, safe against power loss at any point:
+// - open: erase the sector, program the header without record_count, last_timestamp and crc32
+//   (left erased) together with the first record
+// - append records, an erased timestamp marks the first free slot
+// - close once full: program record_count, last_timestamp and crc32, then open the next sector.
+//   Only sectors that are full are closed, a sector left open by a reset is continued
+// - the sector after the head may be erased ahead, it is skipped as long as it holds no header
+//--------------------------------------------------------------------+
+
+// Present ota1 as ring instead of a plain record array, needs CFG_UF2_MEASUREMENT_BINARY
+#ifndef CFG_UF2_MEASUREMENT_RING
+  #define CFG_UF2_MEASUREMENT_RING  0
+#endif
+
+#define MEASUREMENT_RING_MAGIC        0x474E524DUL // "MRNG"
+#define MEASUREMENT_RING_SECTOR_SIZE  4096
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint32_t seq;               // sectors opened before this one
+  uint16_t record_size;       // sizeof(MeasurementRecord_t), sectors of another size are ignored
+  uint16_t record_count;      // 0xFFFF while open
+  uint32_t first_timestamp;
+  uint32_t last_timestamp;    // 0xFFFFFFFF while open
+  uint32_t crc32;             // IEEE crc32 of the records, 0xFFFFFFFF while open
+} MeasurementRingHeader_t;
+
+#define MEASUREMENT_RING_RECORDS  ((MEASUREMENT_RING_SECTOR_SIZE - sizeof(MeasurementRingHeader_t)) / sizeof(MeasurementRecord_t))
+
+// Locate tail and head of the ring, return size of the ordered record stream in bytes.
+// Takes O(log n) header reads plus O(log records per sector) for the open head sector.
+uint32_t measurement_ring_scan(void);
+
+// Read [offset, offset+len) of the record stream found by the last measurement_ring_scan()
+void measurement_ring_read(uint32_t offset, void* dst, uint32_t len);
+void measurement_ring_read_ahead(uint32_t offset, uint32_t len);
+
+// Chunk k of the record stream is its k-th sector from the tail, false past the head
+bool measurement_ring_chunk(uint32_t k, MeasurementChunk_t* chunk);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
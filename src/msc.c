@@ -24,6 +24,7 @@
 
 #include "tusb.h"
 #include "uf2.h"
+#include "file_container.h"
 
 //--------------------------------------------------------------------+
 // MACRO TYPEDEF CONSTANT ENUM
@@ -35,19 +36,114 @@
 static uint32_t _write_ms;
 #endif
 
+#if CFG_UF2_APP_EXPORT
+// Application export: the read-only measurement volume is the only LUN
+#define LUN_MEASUREMENT  0
+#define LUN_COUNT        1
+#define MSC_DATA_LUN     0
+#else
+// LUN 0 is the UF2 ghost FAT, followed by the read-only measurement volume and the raw data storage (if enabled)
+#define LUN_UF2          0
+#define LUN_MEASUREMENT  1
+#define LUN_DATA         (1 + CFG_UF2_MEASUREMENT_LUN)
+#define LUN_COUNT        (1 + CFG_UF2_MEASUREMENT_LUN)
+#define MSC_DATA_LUN     TINYUF2_DATA_LUN
+#endif
+
+#if CFG_UF2_MEASUREMENT_LUN
+  #define IS_MEASUREMENT_LUN(_lun)  ((_lun) == LUN_MEASUREMENT)
+#else
+  #define IS_MEASUREMENT_LUN(_lun)  false
+#endif
+
+#if MSC_DATA_LUN
+  #define IS_DATA_LUN(_lun)  ((_lun) == LUN_DATA)
+#else
+  #define IS_DATA_LUN(_lun)  false
+#endif
+
+// SYNCHRONIZE CACHE (10/16), MODE SENSE (10), UNMAP and READ CAPACITY (16), not in the tinyusb
+// scsi command list
+#define SCSI_CMD_SYNC_CACHE10    0x35
+#define SCSI_CMD_SYNC_CACHE16    0x91
+#define SCSI_CMD_MODE_SENSE10    0x5A
+#define SCSI_CMD_UNMAP           0x42
+#define SCSI_CMD_SERVICE_IN16    0x9E
+#define SCSI_SA_READ_CAPACITY16  0x10
+
+// INQUIRY vital product data pages: supported pages, Block Limits and Block Device Characteristics
+#define INQUIRY_EVPD             0x01
+#define VPD_PAGE_SUPPORTED       0x00
+#define VPD_PAGE_BLOCK_LIMITS    0xB0
+#define VPD_PAGE_BLOCK_DEVICE    0xB1
+
+// optimal transfer length reported in Block Limits: one 64KB flash cache window of 512 byte blocks
+#define VPD_OPTIMAL_BLOCKS       ((64*1024) / 512)
+
+// MODE SENSE caching page and the device-specific parameter bits of its header
+#define MODE_PAGE_CACHING      0x08
+#define MODE_PAGE_ALL          0x3F
+#define MODE_HEADER_WP         0x80
+#define MODE_CACHING_WCE       0x04
+
+#if !CFG_UF2_APP_EXPORT
 static WriteState _wr_state = {0};
 
+// board_millis() when the last new uf2 block was written, start of the idle time before completion
+static uint32_t _wr_idle_ms = 0;
+
+#if CFG_UF2_WRITE_NOT_READY_MS
+// WRITE10 held off by busy flash since _wr_hold_ms
+static bool _wr_hold = false;
+static uint32_t _wr_hold_ms = 0;
+
+// WRITE10 was failed with NOT READY, until flash takes the block at _wr_not_ready_addr again
+static bool _wr_not_ready = false;
+static uint32_t _wr_not_ready_addr = 0;
+#endif
+#endif
+
+// LUN and LBA following the last READ10, used to detect sequential reads
+static uint8_t _rd_lun = 0;
+static uint32_t _rd_next_lba = 0xFFFFFFFFUL;
+
+// first READ10 of the host is recorded in the boot log
+static bool _rd_seen = false;
+
+#if !CFG_UF2_APP_EXPORT
+#if CFG_UF2_STATS
+// WRITE10 held off by busy flash since _wr_busy_us
+static bool _wr_busy = false;
+static uint32_t _wr_busy_us = 0;
+#endif
+
+// all blocks of the uf2 file are written, flushed and verified
+static inline bool dfu_ready(void) {
+  return _wr_state.numBlocks && !_wr_state.aborted && _wr_state.numWritten >= _wr_state.numBlocks;
+}
+
+static void dfu_complete(void);
+#endif
+
 //--------------------------------------------------------------------+
 // tinyusb callbacks
 //--------------------------------------------------------------------+
 
+#if MSC_DATA_LUN || CFG_UF2_MEASUREMENT_LUN
+// Invoked to determine max LUN
+uint8_t tud_msc_get_maxlun_cb(void) {
+#if MSC_DATA_LUN
+  if (board_data_lun_block_count()) return LUN_DATA + 1;
+#endif
+  return LUN_COUNT;
+}
+#endif
+
 // Invoked when received SCSI_CMD_INQUIRY
 // Application fill vendor id, product id and revision with string up to 8, 16, 4 characters respectively
 void tud_msc_inquiry_cb(uint8_t lun, uint8_t vendor_id[8], uint8_t product_id[16], uint8_t product_rev[4]) {
-  (void) lun;
-
   const char vid[] = "ENERTY";
-  const char pid[] = "UF2 Bootloader";
+  const char* pid = IS_DATA_LUN(lun) ? "Data" : IS_MEASUREMENT_LUN(lun) ? "Measurements" : "UF2 Bootloader";
   const char rev[] = "1.0";
 
   memcpy(vendor_id, vid, strlen(vid));
@@ -58,16 +154,74 @@ void tud_msc_inquiry_cb(uint8_t lun, uint8_t vendor_id[8], uint8_t product_id[16
 // Invoked when received Test Unit Ready command.
 // return true allowing host to read/write this LUN e.g SD card inserted
 bool tud_msc_test_unit_ready_cb(uint8_t lun) {
-  (void) lun;
+  if (IS_DATA_LUN(lun)) {
+#if CFG_UF2_FILE_CONTAINER
+    // files of a uf2 were written into the volume: host drops its cached FAT and directories
+    if (file_container_changed()) {
+      tud_msc_set_sense(lun, SCSI_SENSE_UNIT_ATTENTION, 0x28, 0x00);
+      return false;
+    }
+#endif
+    return true;
+  }
+
+  // USB is started before uf2_init(): logical unit is in process of becoming ready
+  if (!uf2_ready()) {
+    tud_msc_set_sense(lun, SCSI_SENSE_NOT_READY, 0x04, 0x01);
+    return false;
+  }
+
+#if CFG_UF2_MEASUREMENT_LUN
+  // measurement files changed size: report medium change so that host drops its cached copy
+  if (IS_MEASUREMENT_LUN(lun)) {
+    if (!uf2_measurement_refresh()) return true;
+    tud_msc_set_sense(lun, SCSI_SENSE_UNIT_ATTENTION, 0x28, 0x00);
+    return false;
+  }
+#endif
+
+#if !CFG_UF2_APP_EXPORT
+#if CFG_UF2_WRITE_NOT_READY_MS
+  // host polls after a WRITE10 failed with NOT READY until flash has room for it again
+  if (_wr_not_ready) {
+    if (board_flash_write_busy && board_flash_write_busy(_wr_not_ready_addr)) {
+      tud_msc_set_sense(lun, SCSI_SENSE_NOT_READY, 0x04, 0x01);
+      return false;
+    }
+    _wr_not_ready = false;
+  }
+#endif
+
+  // host has been idle long enough after the last uf2 block
+  if (CFG_UF2_IDLE_COMPLETE_MS && dfu_ready() &&
+      (!board_millis || board_millis() - _wr_idle_ms >= CFG_UF2_IDLE_COMPLETE_MS)) {
+    dfu_complete();
+  }
+
+  // measurement file changed size or INFO_UF2.TXT changed: report medium change so that host re-reads the volume
+  if (uf2_refresh()) {
+    TUF2_ACCESS_MOUNT();
+    tud_msc_set_sense(lun, SCSI_SENSE_UNIT_ATTENTION, 0x28, 0x00);
+    return false;
+  }
+#endif
+
   return true;
 }
 
+// Invoked on MODE SENSE and before WRITE10, read-only LUNs report the write protect bit.
+// Host mounts the measurement volume read-only: no FAT or directory write back, cached as is
+bool tud_msc_is_writable_cb(uint8_t lun) {
+  (void) lun;
+  return !IS_MEASUREMENT_LUN(lun);
+}
+
 // Callback invoked when received an SCSI command not in built-in list below
 // - READ_CAPACITY10, READ_FORMAT_CAPACITY, INQUIRY, MODE_SENSE6, REQUEST_SENSE
 // - READ10 and WRITE10 has their own callbacks
 int32_t tud_msc_scsi_cb(uint8_t lun, uint8_t const scsi_cmd[16], void* buffer, uint16_t bufsize) {
   void const* response = NULL;
-  uint16_t resplen = 0;
+  int32_t resplen = 0;
 
   // most scsi handled is input
   bool in_xfer = true;
@@ -78,6 +232,162 @@ int32_t tud_msc_scsi_cb(uint8_t lun, uint8_t const scsi_cmd[16], void* buffer, u
       resplen = 0;
       break;
 
+    case SCSI_CMD_INQUIRY: {
+      // Vital product data. Block Limits asks the host for window sized, window aligned transfers
+      // that match the flash cache, Block Device Characteristics reports a non-rotating medium.
+      // Standard INQUIRY data is filled by tinyusb with tud_msc_inquiry_cb()
+      static uint8_t vpd[64];
+      uint8_t const page = scsi_cmd[2];
+
+      if (!(scsi_cmd[1] & INQUIRY_EVPD) || (page != VPD_PAGE_SUPPORTED && page != VPD_PAGE_BLOCK_LIMITS &&
+                                            page != VPD_PAGE_BLOCK_DEVICE)) {
+        tud_msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x24, 0x00);
+        resplen = -1;
+        break;
+      }
+
+      memset(vpd, 0, sizeof(vpd));
+      vpd[1] = page;
+
+      if (page == VPD_PAGE_SUPPORTED) {
+        vpd[3] = 3;
+        vpd[4] = VPD_PAGE_SUPPORTED;
+        vpd[5] = VPD_PAGE_BLOCK_LIMITS;
+        vpd[6] = VPD_PAGE_BLOCK_DEVICE;
+        resplen = 4 + 3;
+      } else if (page == VPD_PAGE_BLOCK_LIMITS) {
+        // granularity is the chunk tinyusb passes to the read/write callbacks, no maximum transfer length
+        uint16_t const granularity = CFG_TUD_MSC_BUFSIZE / 512;
+        vpd[3] = sizeof(vpd) - 4;
+        vpd[6] = (uint8_t) (granularity >> 8);
+        vpd[7] = (uint8_t) granularity;
+        vpd[14] = (uint8_t) (VPD_OPTIMAL_BLOCKS >> 8);
+        vpd[15] = (uint8_t) VPD_OPTIMAL_BLOCKS;
+#if MSC_DATA_LUN
+        // UNMAP parameter list must fit into one callback buffer
+        if (IS_DATA_LUN(lun) && board_data_lun_unmap) {
+          uint16_t const descriptors = (CFG_TUD_MSC_BUFSIZE - 8) / 16;
+          memset(vpd + 20, 0xFF, 4);
+          vpd[26] = (uint8_t) (descriptors >> 8);
+          vpd[27] = (uint8_t) descriptors;
+        }
+#endif
+        resplen = sizeof(vpd);
+      } else {
+        // medium rotation rate 1: non-rotating
+        vpd[3] = sizeof(vpd) - 4;
+        vpd[5] = 0x01;
+        resplen = sizeof(vpd);
+      }
+
+      response = vpd;
+      resplen = tu_min16((uint16_t) resplen, tu_u16(scsi_cmd[3], scsi_cmd[4]));
+      break;
+    }
+
+    case SCSI_CMD_MODE_SENSE10: {
+      // Caching page with WCE: hosts queue writes and flush them with SYNCHRONIZE CACHE, they no longer
+      // issue small synchronous writes. No DPOFUA bit, so hosts do not send FUA writes either.
+      // MODE SENSE (6) is answered by tinyusb itself, header only
+      static uint8_t mode[8 + 20];
+      uint8_t const page = scsi_cmd[2] & 0x3F;
+      uint8_t const control = scsi_cmd[2] >> 6;
+
+      if (page != MODE_PAGE_CACHING && page != MODE_PAGE_ALL) {
+        tud_msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x24, 0x00);
+        resplen = -1;
+        break;
+      }
+
+      memset(mode, 0, sizeof(mode));
+      mode[1] = sizeof(mode) - 2;
+      mode[3] = tud_msc_is_writable_cb(lun) ? 0 : MODE_HEADER_WP;
+      mode[8] = MODE_PAGE_CACHING;
+      mode[9] = sizeof(mode) - 10;
+      // changeable values (page control 1) are all zero, WCE can not be turned off
+      if (control != 1 && tud_msc_is_writable_cb(lun)) mode[10] = MODE_CACHING_WCE;
+
+      response = mode;
+      resplen = tu_min16(sizeof(mode), tu_u16(scsi_cmd[7], scsi_cmd[8]));
+      break;
+    }
+
+#if MSC_DATA_LUN
+    case SCSI_CMD_SERVICE_IN16: {
+      // READ CAPACITY (16) of the data LUN, LBPME tells the host it may UNMAP. Other LUNs only
+      // answer READ CAPACITY (10), hosts fall back to it
+      static uint8_t cap[32];
+      if (!IS_DATA_LUN(lun) || (scsi_cmd[1] & 0x1F) != SCSI_SA_READ_CAPACITY16) {
+        tud_msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x20, 0x00);
+        resplen = -1;
+        break;
+      }
+
+      uint32_t const last_lba = board_data_lun_block_count() - 1;
+      memset(cap, 0, sizeof(cap));
+      cap[4] = (uint8_t) (last_lba >> 24);
+      cap[5] = (uint8_t) (last_lba >> 16);
+      cap[6] = (uint8_t) (last_lba >> 8);
+      cap[7] = (uint8_t) last_lba;
+      cap[10] = 512 >> 8;
+      if (board_data_lun_unmap) cap[14] = 0x80;
+
+      response = cap;
+      resplen = tu_min16(sizeof(cap), tu_u16(scsi_cmd[12], scsi_cmd[13]));
+      break;
+    }
+
+    case SCSI_CMD_UNMAP:
+      // parameter list has been received into buffer: 8 byte header, then 16 byte descriptors of
+      // 64-bit LBA and 32-bit block count
+      in_xfer = false;
+      if (!IS_DATA_LUN(lun) || !board_data_lun_unmap) {
+        tud_msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x20, 0x00);
+        resplen = -1;
+        break;
+      }
+
+      resplen = bufsize;
+      if (bufsize >= 8) {
+        uint8_t const* param = (uint8_t const*) buffer;
+        uint32_t len = tu_u16(param[2], param[3]);
+        if (len > bufsize - 8u) len = bufsize - 8u;
+
+        for (uint8_t const* desc = param + 8; desc + 16 <= param + 8 + len; desc += 16) {
+          uint32_t const lba = tu_u32(desc[4], desc[5], desc[6], desc[7]);
+          uint32_t const count = tu_u32(desc[8], desc[9], desc[10], desc[11]);
+          if (tu_u32(desc[0], desc[1], desc[2], desc[3]) || !board_data_lun_unmap(lba, count)) {
+            // LBA out of range
+            tud_msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x21, 0x00);
+            resplen = -1;
+            break;
+          }
+        }
+      }
+      break;
+#endif
+
+    case SCSI_CMD_SYNC_CACHE10:
+    case SCSI_CMD_SYNC_CACHE16:
+      // Host flushes its writes: payloads still in the flash cache go to flash, then commit if the
+      // uf2 file is complete. Device resets before the status is sent, same as board_dfu_complete()
+      // after the last write
+#if MSC_DATA_LUN
+      if (IS_DATA_LUN(lun)) {
+        board_data_lun_flush();
+        resplen = 0;
+        break;
+      }
+#endif
+#if !CFG_UF2_APP_EXPORT
+      if (lun == LUN_UF2) {
+        if (_wr_state.numWritten && !_wr_state.aborted && !dfu_ready()) board_flash_flush();
+        if (dfu_ready()) dfu_complete();
+      }
+#endif
+      resplen = 0;
+      break;
+
     default:
       // Set Sense = Invalid Command Operation
       tud_msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x20, 0x00);
@@ -101,53 +411,184 @@ int32_t tud_msc_scsi_cb(uint8_t lun, uint8_t const scsi_cmd[16], void* buffer, u
   return resplen;
 }
 
-// Callback invoked when received READ10 command.
-// Copy disk's data to buffer (up to bufsize) and return number of copied bytes.
-int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize) {
-  (void) lun;
-  memset(buffer, 0, bufsize);
-
+static int32_t msc_read10(uint8_t lun, uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize) {
   // since we return block size each, offset should always be zero
   TU_ASSERT(offset == 0, -1);
 
-  uint32_t count = 0;
+  if (board_flash_read_hint) board_flash_read_hint();
 
-  while (count < bufsize) {
-    uf2_read_block(lba, buffer);
+  // fill all requested sectors in one pass
+  uint32_t const block_count = bufsize / 512;
 
-    lba++;
-    buffer += 512;
-    count += 512;
+#if MSC_DATA_LUN
+  if (IS_DATA_LUN(lun)) {
+    return board_data_lun_read(lba, buffer, block_count) ? (int32_t) (block_count * 512) : -1;
   }
+#endif
 
-  return count;
+  if (!uf2_ready()) {
+    tud_msc_set_sense(lun, SCSI_SENSE_NOT_READY, 0x04, 0x01);
+    return -1;
+  }
+
+  if (!_rd_seen) {
+    _rd_seen = true;
+    TUF2_BOOT_STAGE(BOOTLOG_FIRST_READ);
+  }
+
+  TUF2_STATS_INC(read10);
+
+  bool const sequential = (lun == _rd_lun && lba == _rd_next_lba);
+  _rd_lun = lun;
+  _rd_next_lba = lba + block_count;
+
+#if CFG_UF2_MEASUREMENT_LUN
+  if (IS_MEASUREMENT_LUN(lun)) {
+    uf2_measurement_read_blocks(lba, block_count, buffer);
+    if (sequential) uf2_measurement_read_ahead(lba + block_count, block_count);
+    return block_count * 512;
+  }
+#endif
+
+#if !CFG_UF2_APP_EXPORT
+  TUF2_ACCESS_RECORD(lba, block_count, false);
+  uf2_read_blocks(lba, block_count, buffer);
+
+  // host is reading sequentially e.g copying CURRENT.UF2 or MEASDAT.CSV: prefetch next blocks
+  if (sequential) {
+    uf2_read_ahead(lba + block_count, block_count);
+  }
+#endif
+
+  return block_count * 512;
 }
 
-// Callback invoked when received WRITE10 command.
-// Process data in buffer to disk's storage and return number of written bytes
-int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t* buffer, uint32_t bufsize) {
-  (void) lun;
+#if CFG_UF2_APP_EXPORT
+// application export is read-only, host ignored the write protect bit reported by MODE SENSE
+static int32_t msc_write10(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t* buffer, uint32_t bufsize) {
+  (void) lba;
   (void) offset;
+  (void) buffer;
+  (void) bufsize;
 
-  uint32_t count = 0;
-  while (count < bufsize) {
-    // Consider non-uf2 block write as successful
-    // only break if write_block is busy with flashing (return 0)
-    if (0 == uf2_write_block(lba, buffer, &_wr_state)) break;
+  tud_msc_set_sense(lun, SCSI_SENSE_DATA_PROTECT, 0x27, 0x00);
+  return -1;
+}
+#else
+static int32_t msc_write10(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t* buffer, uint32_t bufsize) {
+  (void) offset;
+
+#if MSC_DATA_LUN
+  if (IS_DATA_LUN(lun)) {
+    uint32_t const block_count = bufsize / 512;
+    return board_data_lun_write(lba, buffer, block_count) ? (int32_t) (block_count * 512) : -1;
+  }
+#endif
 
-    lba++;
-    buffer += 512;
-    count += 512;
+  // host ignored the write protect bit reported by MODE SENSE
+  if (IS_MEASUREMENT_LUN(lun)) {
+    tud_msc_set_sense(lun, SCSI_SENSE_DATA_PROTECT, 0x27, 0x00);
+    return -1;
+  }
+
+  if (!uf2_ready()) {
+    tud_msc_set_sense(lun, SCSI_SENSE_NOT_READY, 0x04, 0x01);
+    return -1;
+  }
+
+  uint32_t const written = _wr_state.numWritten;
+  uint32_t const start_us = TUF2_STATS_US();
+
+  // Consider non-uf2 block write as successful, stops early only if busy with flashing.
+  // Runs of consecutive uf2 blocks are written as a batch
+  uint32_t const count = uf2_write_blocks(lba, buffer, bufsize / 512, &_wr_state) * 512;
+  TUF2_ACCESS_RECORD(lba, count / 512, true);
+
+#if CFG_UF2_STATS
+  // stall lasts from the first busy callback until data is taken
+  uint32_t const now_us = TUF2_STATS_US();
+  TUF2_STATS_INC(write10);
+  if (count == 0) {
+    TUF2_STATS_INC(write_busy);
+    if (!_wr_busy) _wr_busy_us = start_us;
+    _wr_busy = true;
+  } else {
+    TUF2_STATS_ADD(sectors_written, count / 512);
+    TUF2_STATS_MAX(write_stall_max_us, now_us - (_wr_busy ? _wr_busy_us : start_us));
+    TUF2_STATS_MAX(write_cb_max_us, now_us - start_us);
+    _wr_busy = false;
+  }
+#else
+  (void) start_us;
+#endif
+
+#if CFG_UF2_WRITE_NOT_READY_MS
+  if (count == 0 && board_millis) {
+    uint32_t const now_ms = board_millis();
+    if (!_wr_hold) _wr_hold_ms = now_ms;
+    _wr_hold = true;
+
+    // nothing of the command is taken yet: host retries it after a back-off instead of timing out
+    if (offset == 0 && now_ms - _wr_hold_ms >= CFG_UF2_WRITE_NOT_READY_MS) {
+      TUF2_LOG1("Flash busy for %lu ms, not ready\r\n", now_ms - _wr_hold_ms);
+      _wr_hold = false;
+      _wr_not_ready = true;
+      _wr_not_ready_addr = ((UF2_Block const*) buffer)->targetAddr;
+      tud_msc_set_sense(lun, SCSI_SENSE_NOT_READY, 0x04, 0x01);
+      return -1;
+    }
+  } else {
+    _wr_hold = false;
   }
+#endif
+
+  // give the flash task time to free a window instead of being retried right away
+  if (count == 0 && board_flash_write_wait) board_flash_write_wait();
+
+  // re-written blocks and FAT/directory updates do not restart the idle time
+  if (_wr_state.numWritten != written && board_millis) _wr_idle_ms = board_millis();
+
+#if TINYUF2_DISPLAY
+  screen_set_progress(_wr_state.numWritten, _wr_state.numBlocks);
+#endif
+  if (board_status_progress) board_status_progress(_wr_state.numWritten, _wr_state.numBlocks);
 
   return count;
 }
+#endif
 
+// Callback invoked when received READ10 command.
+// Copy disk's data to buffer (up to bufsize) and return number of copied bytes.
+int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize) {
+  TUF2_TRACE_BEGIN(TUF2_TRACE_READ10);
+  int32_t const ret = msc_read10(lun, lba, offset, buffer, bufsize);
+  TUF2_TRACE_END(TUF2_TRACE_READ10);
+  return ret;
+}
+
+// Callback invoked when received WRITE10 command.
+// Process data in buffer to disk's storage and return number of written bytes
+int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t* buffer, uint32_t bufsize) {
+  TUF2_TRACE_BEGIN(TUF2_TRACE_WRITE10);
+  int32_t const ret = msc_write10(lun, lba, offset, buffer, bufsize);
+  TUF2_TRACE_END(TUF2_TRACE_WRITE10);
+  return ret;
+}
+
+#if !CFG_UF2_APP_EXPORT
 // Callback invoked when WRITE10 command is completed (status received and accepted by host).
 void tud_msc_write10_complete_cb(uint8_t lun) {
-  (void) lun;
   static bool first_write = true;
 
+#if MSC_DATA_LUN
+  // write cached sector back once per host command
+  if (IS_DATA_LUN(lun)) {
+    board_data_lun_flush();
+    return;
+  }
+#endif
+  if (lun != LUN_UF2) return;
+
   // abort the DFU, uf2 block failed integrity check
   if (_wr_state.aborted) {
     // aborted and reset
@@ -163,32 +604,48 @@ void tud_msc_write10_complete_cb(uint8_t lun) {
       indicator_set(STATE_WRITING_STARTED);
     }
 
-    // All block of uf2 file is complete --> complete DFU process
-    if (_wr_state.numWritten >= _wr_state.numBlocks) {
-      #if DEBUG_SPEED_TEST
-      uint32_t const wr_byte = _wr_state.numWritten*256;
-      _write_ms = esp_log_timestamp()-_write_ms;
-      printf("written %u bytes in %.02f seconds.\r\n", wr_byte, _write_ms / 1000.0F);
-      printf("Speed : %.02f KB/s\r\n", (wr_byte / 1000.0F) / (_write_ms / 1000.0F));
-      #endif
-
-      TUF2_LOG1("Writing finished\r\n");
-      indicator_set(STATE_WRITING_FINISHED);
-      board_dfu_complete();
-
-      // board_dfu_complete() should not return
-      // getting here is an indicator of error
-      while (1) {}
-    }
+    // All block of uf2 file is complete --> complete DFU process, unless waiting for host to be idle
+    if (!CFG_UF2_IDLE_COMPLETE_MS && dfu_ready()) dfu_complete();
   }
 }
 
+static void dfu_complete(void) {
+  #if DEBUG_SPEED_TEST
+  uint32_t const wr_byte = _wr_state.numWritten*256;
+  _write_ms = esp_log_timestamp()-_write_ms;
+  printf("written %u bytes in %.02f seconds.\r\n", wr_byte, _write_ms / 1000.0F);
+  printf("Speed : %.02f KB/s\r\n", (wr_byte / 1000.0F) / (_write_ms / 1000.0F));
+  #endif
+
+  TUF2_LOG1("Writing finished\r\n");
+  indicator_set(STATE_WRITING_FINISHED);
+  board_dfu_complete();
+
+  // board_dfu_complete() should not return
+  // getting here is an indicator of error
+  while (1) {}
+}
+#endif
+
 // Invoked when received SCSI_CMD_READ_CAPACITY_10 and SCSI_CMD_READ_FORMAT_CAPACITY to determine the disk size
 // Application update block count and block size
 void tud_msc_capacity_cb(uint8_t lun, uint32_t* block_count, uint16_t* block_size) {
+#if MSC_DATA_LUN
+  if (IS_DATA_LUN(lun)) {
+    *block_count = board_data_lun_block_count();
+    *block_size = 512;
+    return;
+  }
+#else
   (void) lun;
+#endif
 
+#if !CFG_UF2_APP_EXPORT
+  // firmware volume may be fitted to its files, the measurement volume always has the full size
+  *block_count = IS_MEASUREMENT_LUN(lun) ? CFG_UF2_NUM_BLOCKS : uf2_block_count();
+#else
   *block_count = CFG_UF2_NUM_BLOCKS;
+#endif
   *block_size = 512;
 }
 
@@ -204,6 +661,26 @@ bool tud_msc_start_stop_cb(uint8_t lun, uint8_t power_condition, bool start, boo
       // load disk storage
     } else {
       // unload disk storage
+#if MSC_DATA_LUN
+      if (IS_DATA_LUN(lun)) board_data_lun_flush();
+#endif
+
+      // eject commits a complete uf2 file without waiting for idle time,
+      // serial number or rollback only session: reset on eject, otherwise board_dfu_complete() does
+#if !CFG_UF2_APP_EXPORT
+      if (lun == LUN_UF2) {
+        // incomplete update: windows written so far still go to flash, a later session may resume it
+        if (_wr_state.numWritten && !_wr_state.aborted && !dfu_ready()) board_flash_flush();
+        if (dfu_ready()) dfu_complete();
+        if ((_wr_state.serialWritten || _wr_state.rolledBack) && !_wr_state.numBlocks) board_reset();
+
+        // scripted updates see a rejected or failed image as failed eject (write error)
+        if (_wr_state.aborted) {
+          tud_msc_set_sense(lun, SCSI_SENSE_MEDIUM_ERROR, 0x0C, 0x00);
+          return false;
+        }
+      }
+#endif
     }
   }
 
@@ -0,0 +1,82 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stddef.h>
+#include "sched.h"
+
+//--------------------------------------------------------------------+
+// MACRO TYPEDEF CONSTANT ENUM DECLARATION
+//--------------------------------------------------------------------+
+
+static tuf2_job_t* _head = NULL;
+static tuf2_job_t* _tail = NULL;
+
+//--------------------------------------------------------------------+
+//
+//--------------------------------------------------------------------+
+
+void tuf2_sched_post(tuf2_job_t* job) {
+  if (job->queued) return;
+
+  job->queued = true;
+  job->next = NULL;
+  if (_tail) {
+    _tail->next = job;
+  } else {
+    _head = job;
+  }
+  _tail = job;
+}
+
+bool tuf2_sched_run(void) {
+  // jobs posted by a step wait for the next run
+  tuf2_job_t* const last = _tail;
+  tuf2_job_t* prev = NULL;
+  tuf2_job_t* job = _head;
+
+  while (job) {
+    bool const more = job->step(job->arg);
+    tuf2_job_t* const next = job->next;
+
+    if (more) {
+      prev = job;
+    } else {
+      // unlink, posting it again from its own step did nothing as it was still queued
+      if (prev) {
+        prev->next = next;
+      } else {
+        _head = next;
+      }
+      if (_tail == job) _tail = prev;
+      job->queued = false;
+      job->next = NULL;
+    }
+
+    if (job == last) break;
+    job = next;
+  }
+
+  return _head != NULL;
+}
@@ -0,0 +1,64 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef TUF2_SCHED_H_
+#define TUF2_SCHED_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Cooperative run-to-completion jobs for ports without an RTOS (CFG_TUSB_OS == OPT_OS_NONE). The main loop
+// calls tuf2_sched_run() between tud_task() calls, which runs one step of every posted job. A step does a
+// bounded amount of work and returns: start a flash erase, poll whether it is done, program one page.
+// Long flash operations then run while USB is serviced, without blocking inside an MSC callback.
+// Not thread-safe, jobs are posted and run from the main loop only.
+//--------------------------------------------------------------------+
+
+// One step of a job, return true while there is more to do. Job is dropped once it returns false
+typedef bool (*tuf2_job_step_t)(void* arg);
+
+typedef struct tuf2_job {
+  tuf2_job_step_t step;
+  void* arg;
+  struct tuf2_job* next;
+  bool queued;
+} tuf2_job_t;
+
+// Queue job, storage is owned by the caller. Posting a job that is still queued does nothing
+void tuf2_sched_post(tuf2_job_t* job);
+
+// Run one step of each queued job in posting order, return true if any job is still queued afterwards
+bool tuf2_sched_run(void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
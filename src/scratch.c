@@ -0,0 +1,86 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "scratch.h"
+
+//--------------------------------------------------------------------+
+// MACRO TYPEDEF CONSTANT ENUM DECLARATION
+//--------------------------------------------------------------------+
+
+#define SCRATCH_STR(x)   #x
+#define SCRATCH_XSTR(x)  SCRATCH_STR(x)
+
+// report arena budget at build time
+#pragma message "tinyuf2 scratch arena: flash " SCRATCH_XSTR(BOARD_FLASH_SCRATCH_SIZE) \
+                ", screen " SCRATCH_XSTR(TUF2_SCREEN_SCRATCH_SIZE) " bytes"
+
+// all allocations are 4-byte aligned
+#define SCRATCH_ALIGN(_x)  (((_x) + 3UL) & ~3UL)
+
+enum {
+  SCRATCH_SIZE = SCRATCH_ALIGN(CFG_TUF2_SCRATCH_SIZE)
+};
+
+_Static_assert(TUF2_SCREEN_SCRATCH_SIZE <= CFG_TUF2_SCRATCH_SIZE, "arena holds the screen strips");
+_Static_assert(BOARD_FLASH_SCRATCH_SIZE <= CFG_TUF2_SCRATCH_SIZE, "arena holds the flash driver buffer");
+
+#if CFG_TUF2_SCRATCH_SIZE
+static uint8_t _arena_buf[SCRATCH_SIZE] __attribute__((aligned(4)));
+static uint8_t* _arena = _arena_buf;
+#else
+static uint8_t* _arena = NULL;
+#endif
+
+static uint32_t _used = 0;
+static uint32_t _peak = 0;
+
+//--------------------------------------------------------------------+
+//
+//--------------------------------------------------------------------+
+
+void* tuf2_scratch_alloc(uint32_t size) {
+  size = SCRATCH_ALIGN(size);
+  if (_arena == NULL || size > SCRATCH_SIZE - _used) {
+    TUF2_LOG1("Scratch: out of space for %lu bytes\r\n", size);
+    return NULL;
+  }
+
+  void* ptr = _arena + _used;
+  _used += size;
+  if (_used > _peak) _peak = _used;
+
+  return ptr;
+}
+
+void tuf2_scratch_free(void* ptr) {
+  if (ptr == NULL) return;
+
+  uint8_t* p = (uint8_t*) ptr;
+  if (_arena <= p && p < _arena + _used) _used = (uint32_t) (p - _arena);
+}
+
+uint32_t tuf2_scratch_peak(void) {
+  return _peak;
+}
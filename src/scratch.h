@@ -0,0 +1,70 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef TUF2_SCRATCH_H_
+#define TUF2_SCRATCH_H_
+
+#include "board_api.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Scratch arena for transient buffers (display frame, flash verify buffer ...)
+// Allocation is LIFO: freeing a buffer also frees everything allocated after it.
+// Not thread-safe, users must not hold scratch at the same time from different tasks.
+//--------------------------------------------------------------------+
+
+// Scratch needed by port's flash driver, set in boards.h
+#ifndef BOARD_FLASH_SCRATCH_SIZE
+#define BOARD_FLASH_SCRATCH_SIZE  0
+#endif
+
+// two RGB565 strips of DISPLAY_STRIP_LINES lines, see screen.c
+#if TINYUF2_DISPLAY
+  #define TUF2_SCREEN_SCRATCH_SIZE  (2 * DISPLAY_STRIP_LINES * DISPLAY_HEIGHT * 2)
+#else
+  #define TUF2_SCREEN_SCRATCH_SIZE  0
+#endif
+
+// Screen is only drawn before MSC is ready (no flash writes yet), arena is sized to the largest user
+#ifndef CFG_TUF2_SCRATCH_SIZE
+#define CFG_TUF2_SCRATCH_SIZE \
+  (TUF2_SCREEN_SCRATCH_SIZE > BOARD_FLASH_SCRATCH_SIZE ? TUF2_SCREEN_SCRATCH_SIZE : BOARD_FLASH_SCRATCH_SIZE)
+#endif
+
+// Return NULL if arena does not have enough space left
+void* tuf2_scratch_alloc(uint32_t size);
+void tuf2_scratch_free(void* ptr);
+
+// Highest number of bytes in use since boot
+uint32_t tuf2_scratch_peak(void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
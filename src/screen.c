@@ -23,6 +23,7 @@
  */
 
 #include "board_api.h"
+#include "scratch.h"
 
 #if TINYUF2_DISPLAY
 
@@ -51,6 +52,7 @@ enum
   COLOR_BLUE   = 8,
   COLOR_AQUA   = 9,
   COLOR_PURPLE = 10,
+  COLOR_DARK_PURPLE = 12,
 };
 
 // 16-bit 565 color from 24-bit 888 format
@@ -74,94 +76,91 @@ const uint16_t palette[] = {
   COL(0x000000), // 15
 };
 
-// TODO only buffer partial screen to save SRAM
-// ESP32s2 can only statically allocated DRAM up to 160KB.
-// the remaining 160KB can only be allocated at runtime as heap.
-//static uint8_t frame_buf[DISPLAY_WIDTH * DISPLAY_HEIGHT];
-static uint8_t* frame_buf;
+// Screen is rendered in strips of DISPLAY_STRIP_LINES lines (display x), each strip holds
+// big-endian RGB565 pixels ready to send. Two strips are borrowed from scratch arena while
+// drawing so one can be sent while the next is rendered.
+#define STRIP_PIXELS  (DISPLAY_STRIP_LINES * DISPLAY_HEIGHT)
+
+_Static_assert(2 * STRIP_PIXELS * 2 <= TUF2_SCREEN_SCRATCH_SIZE, "strips are borrowed from scratch arena");
+
+static uint16_t* strip_buf;
+static int strip_x;
+static int strip_n;
+
+// progress bar below the orange bar, fits the smallest 128 pixel high panels.
+// PROGRESS_Y keeps the partial line 4-byte aligned for DMA
+#define PROGRESS_X  10
+#define PROGRESS_Y  124
+#define PROGRESS_W  (DISPLAY_WIDTH - 2 * PROGRESS_X)
+#define PROGRESS_H  4
+
+// written by msc while flashing, drawn by screen_task()
+static volatile uint32_t _progress_written;
+static volatile uint32_t _progress_total;
+
+// filled width currently drawn, -1 while the bar is not shown
+static int _progress_fill = -1;
+static uint32_t _progress_ms;
 
 extern const uint8_t font8[];
-extern const uint8_t fileLogo[];
-extern const uint8_t pendriveLogo[];
-extern const uint8_t arrowLogo[];
+
+extern const uint16_t splash_lines;
+extern const uint16_t splash_height;
+extern const uint16_t splash_index[];
+extern const uint8_t splash_runs[];
+
+// pixel color in the byte order sent to display controller
+static inline uint16_t strip_color(int color) {
+  uint16_t c = palette[color & 0xf];
+  return (uint16_t) ((c >> 8) | (c << 8));
+}
+
+// first pixel of line x in current strip, NULL if line is not in the strip
+static inline uint16_t* strip_line(int x) {
+  if (x < strip_x || x >= strip_x + strip_n) return NULL;
+  return strip_buf + (x - strip_x) * DISPLAY_HEIGHT;
+}
 
 // print character with font size = 1
 static void printch(int x, int y, int color, const uint8_t *fnt) {
-    for (int i = 0; i < 6; ++i) {
-        uint8_t *p = frame_buf + (x + i) * DISPLAY_HEIGHT + y;
+    uint16_t c = strip_color(color);
+    for (int i = 0; i < 6; ++i, ++fnt) {
+        uint16_t *p = strip_line(x + i);
+        if (!p)
+            continue;
+        p += y;
         uint8_t mask = 0x01;
         for (int j = 0; j < 8; ++j) {
             if (*fnt & mask)
-                *p = color;
+                *p = c;
             p++;
             mask <<= 1;
         }
-        fnt++;
     }
 }
 
 // print character with font size = 4
 static void printch4(int x, int y, int color, const uint8_t *fnt) {
+    uint16_t c = strip_color(color);
     for (int i = 0; i < 6 * 4; ++i) {
-        uint8_t *p = frame_buf + (x + i) * DISPLAY_HEIGHT + y;
-        uint8_t mask = 0x01;
-        for (int j = 0; j < 8; ++j) {
-            for (int k = 0; k < 4; ++k) {
-                if (*fnt & mask)
-                    *p = color;
-                p++;
+        uint16_t *p = strip_line(x + i);
+        if (p) {
+            p += y;
+            uint8_t mask = 0x01;
+            for (int j = 0; j < 8; ++j) {
+                for (int k = 0; k < 4; ++k) {
+                    if (*fnt & mask)
+                        *p = c;
+                    p++;
+                }
+                mask <<= 1;
             }
-            mask <<= 1;
         }
         if ((i & 3) == 3)
             fnt++;
     }
 }
 
-// print icon
-static void printicon(int x, int y, int color, const uint8_t *icon) {
-    int w = *icon++;
-    int h = *icon++;
-    int sz = *icon++;
-
-    uint8_t mask = 0x80;
-    int runlen = 0;
-    int runbit = 0;
-    uint8_t lastb = 0x00;
-
-    for (int i = 0; i < w; ++i) {
-        uint8_t *p = frame_buf + (x + i) * DISPLAY_HEIGHT + y;
-        for (int j = 0; j < h; ++j) {
-            int c = 0;
-            if (mask != 0x80) {
-                if (lastb & mask)
-                    c = 1;
-                mask <<= 1;
-            } else if (runlen) {
-                if (runbit)
-                    c = 1;
-                runlen--;
-            } else {
-                if (sz-- <= 0) {
-                  //TU_LOG1("Screen Panic code = 10");
-                }
-                lastb = *icon++;
-                if (lastb & 0x80) {
-                    runlen = lastb & 63;
-                    runbit = lastb & 0x40;
-                } else {
-                    mask = 0x01;
-                }
-                --j;
-                continue; // restart
-            }
-            if (c)
-                *p = color;
-            p++;
-        }
-    }
-}
-
 // print text with font size = 1
 static void print(int x, int y, int col, const char *text) {
     int x0 = x;
@@ -185,7 +184,8 @@ static void print(int x, int y, int col, const char *text) {
         if (c >= 0x7f)
             c = '?';
         c -= ' ';
-        printch(x, y, col, &font8[c * 6]);
+        if (x + 6 > strip_x && x < strip_x + strip_n)
+            printch(x, y, col, &font8[c * 6]);
         x += 6;
     }
 }
@@ -197,7 +197,10 @@ static void print4 (int x, int y, int color, const char *text)
   {
     char c = *text++;
     c -= ' ';
-    printch4(x, y, color, &font8[c * 6]);
+    if ( x + 6 * 4 > strip_x && x < strip_x + strip_n )
+    {
+      printch4(x, y, color, &font8[c * 6]);
+    }
     x += CHAR4_KERNED_WIDTH;
     if ( x + CHAR4_KERNED_WIDTH > DISPLAY_WIDTH )
     {
@@ -207,45 +210,48 @@ static void print4 (int x, int y, int color, const char *text)
   }
 }
 
-// Send the whole buffer data to display controller
-static void draw_screen (void)
+// Bars, icons and fixed texts of the drag screen from splash.c. Line x past splash_lines
+// repeats the last one, pixels past splash_height are black
+static void drawSplash (void)
 {
-  uint8_t *p = frame_buf;
-  for ( int i = 0; i < DISPLAY_WIDTH; ++i )
+  for ( int x = strip_x; x < strip_x + strip_n; ++x )
   {
-    uint8_t cc[DISPLAY_HEIGHT * 2];
-    uint32_t dst = 0;
-    for ( int j = 0; j < DISPLAY_HEIGHT; ++j )
+    uint16_t* p = strip_line(x);
+    uint8_t const* run = splash_runs + splash_index[(x < splash_lines) ? x : splash_lines - 1];
+    int const h = (splash_height < DISPLAY_HEIGHT) ? splash_height : DISPLAY_HEIGHT;
+
+    for ( int y = 0; y < h; run++ )
     {
-      uint16_t color = palette[*p++ & 0xf];
-      cc[dst++] = color >> 8;
-      cc[dst++] = color & 0xff;
+      uint16_t const c = strip_color(*run >> 4);
+      int n = (*run & 0xf) + 1;
+      if ( n > h - y ) n = h - y;
+      while ( n-- ) p[y++] = c;
     }
 
-    board_display_draw_line(i, (uint16_t*) cc, DISPLAY_HEIGHT);
+    memset(p + h, 0, (DISPLAY_HEIGHT - h) * 2);
   }
 }
 
-// draw color bar
-static void drawBar (int y, int h, int color)
+// draw progress bar, filled part in white
+static void drawProgress (void)
 {
-  for ( int x = 0; x < DISPLAY_WIDTH; ++x )
+  if ( _progress_fill < 0 ) return;
+
+  for ( int x = strip_x; x < strip_x + strip_n; ++x )
   {
-    memset(frame_buf + x * DISPLAY_HEIGHT + y, color, h);
+    if ( x < PROGRESS_X || x >= PROGRESS_X + PROGRESS_W ) continue;
+
+    uint16_t c = strip_color(x < PROGRESS_X + _progress_fill ? COLOR_WHITE : COLOR_DARK_PURPLE);
+    uint16_t* p = strip_line(x) + PROGRESS_Y;
+    for ( int j = 0; j < PROGRESS_H; ++j ) p[j] = c;
   }
 }
 
-// draw drag & drop screen
-void screen_draw_drag (void)
+// render lines of the drag & drop screen that fall in current strip. The static part is
+// generated by tools/gen_splash.py, re-run it when changing the layout
+static void render_drag (void)
 {
-  frame_buf = malloc(DISPLAY_WIDTH * DISPLAY_HEIGHT);
-  if (!frame_buf) return;
-
-  memset(frame_buf, 0, DISPLAY_WIDTH * DISPLAY_HEIGHT);
-
-  drawBar(0, 52, COLOR_GREEN);
-  drawBar(52, 55, COLOR_BLUE);
-  drawBar(107, 14, COLOR_ORANGE);
+  drawSplash();
 
   // Center UF2_PRODUCT_NAME and UF2_VERSION_BASE.
   int name_x = (DISPLAY_WIDTH - CHAR4_KERNED_WIDTH * (int) strlen(DISPLAY_TITLE)) / 2;
@@ -254,20 +260,103 @@ void screen_draw_drag (void)
   int version_x = (DISPLAY_WIDTH - 6 * (int) strlen(UF2_VERSION_BASE)) / 2;
   print(version_x >= 0 ? version_x : 0, 40, COLOR_PURPLE, UF2_VERSION_BASE);
 
-  // TODO the reset should be center as well
-  print(23, 110, 1, "circuitpython.org");
-
 #define DRAG 70
-#define DRAGX 10
-  printicon(DRAGX + 20, DRAG + 5, COLOR_WHITE, fileLogo);
-  printicon(DRAGX + 66, DRAG, COLOR_WHITE, arrowLogo);
-  printicon(DRAGX + 108, DRAG, COLOR_WHITE, pendriveLogo);
-  print(10, DRAG - 12, COLOR_WHITE, "firmware.uf2");
   print(90, DRAG - 12, COLOR_WHITE, UF2_VOLUME_LABEL);
 
-  draw_screen();
+  drawProgress();
+}
+
+// draw drag & drop screen
+void screen_draw_drag (void)
+{
+  uint16_t* bufs = tuf2_scratch_alloc(2 * STRIP_PIXELS * 2);
+  if (!bufs) return;
+
+  bool const async = board_display_draw_lines_async && board_display_wait;
+
+  for ( int x = 0, k = 0; x < DISPLAY_WIDTH; x += DISPLAY_STRIP_LINES, k ^= 1 )
+  {
+    // board may still be sending the other strip while this one is rendered
+    strip_buf = bufs + k * STRIP_PIXELS;
+    strip_x = x;
+    strip_n = DISPLAY_STRIP_LINES;
+    render_drag();
+
+    uint32_t count = DISPLAY_WIDTH - x;
+    if ( count > DISPLAY_STRIP_LINES ) count = DISPLAY_STRIP_LINES;
+
+    if ( async )
+    {
+      if ( x ) board_display_wait();
+      board_display_draw_lines_async(x, strip_buf, count);
+    }
+    else
+    {
+      for ( uint32_t i = 0; i < count; i++ )
+      {
+        board_display_draw_line(x + i, strip_buf + i * DISPLAY_HEIGHT, DISPLAY_HEIGHT);
+      }
+    }
+  }
+
+  if ( async ) board_display_wait();
+
+  tuf2_scratch_free(bufs);
+}
+
+void screen_set_progress (uint32_t written, uint32_t total)
+{
+  _progress_written = written;
+  _progress_total = total;
+}
 
-  free(frame_buf);
+// Redraw changed lines of the progress bar. Renders one line at a time into a static buffer,
+// scratch arena may be in use by flash writes meanwhile
+void screen_task (void)
+{
+  uint32_t const total = _progress_total;
+  if ( !total ) return;
+
+  uint32_t written = _progress_written;
+  if ( written > total ) written = total;
+
+  int const fill = (int) ((uint64_t) written * PROGRESS_W / total);
+  if ( fill == _progress_fill ) return;
+
+  if ( board_millis )
+  {
+    uint32_t const now = board_millis();
+    if ( _progress_fill >= 0 && now - _progress_ms < TINYUF2_DISPLAY_PROGRESS_MS ) return;
+    _progress_ms = now;
+  }
+
+  // whole bar when first shown, afterwards only lines between old and new fill
+  int x0 = 0, x1 = PROGRESS_W;
+  if ( _progress_fill >= 0 )
+  {
+    x0 = (fill < _progress_fill) ? fill : _progress_fill;
+    x1 = (fill < _progress_fill) ? _progress_fill : fill;
+  }
+  _progress_fill = fill;
+
+  static uint16_t line[DISPLAY_HEIGHT] __attribute__ ((aligned(4)));
+  strip_buf = line;
+  strip_n = 1;
+
+  for ( int x = PROGRESS_X + x0; x < PROGRESS_X + x1; x++ )
+  {
+    strip_x = x;
+    render_drag();
+
+    if ( board_display_draw_line_window )
+    {
+      board_display_draw_line_window(x, PROGRESS_Y, line + PROGRESS_Y, PROGRESS_H);
+    }
+    else
+    {
+      board_display_draw_line(x, line, DISPLAY_HEIGHT);
+    }
+  }
 }
 
 #endif
@@ -0,0 +1,99 @@
+// Generated by tools/gen_splash.py from the static part of the drag & drop screen, do not edit
+
+#include <stdint.h>
+
+// lines (display x) stored, later lines repeat the last one
+const uint16_t splash_lines = 137;
+
+// pixels per line, the rest of the line is black
+const uint16_t splash_height = 121;
+
+// offset of each line in splash_runs, identical lines share their runs
+const uint16_t splash_index[] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 9, 19, 29, 41, 0,
+  0, 51, 63, 75, 0, 0, 0, 85, 95, 107, 121, 135, 85, 148, 158, 173,
+  190, 205, 217, 230, 243, 258, 275, 292, 308, 321, 335, 353, 373, 391, 409, 423,
+  438, 453, 468, 483, 497, 509, 522, 539, 555, 0, 0, 0, 569, 581, 135, 593,
+  0, 604, 614, 626, 640, 654, 0, 9, 665, 679, 695, 709, 720, 730, 743, 758,
+  775, 792, 720, 720, 804, 816, 816, 828, 720, 720, 840, 852, 866, 880, 891, 901,
+  911, 923, 935, 947, 959, 0, 0, 969, 969, 0, 0, 0, 980, 135, 135, 980,
+  0, 0, 991, 1002, 1013, 1002, 1024, 1034, 1046, 1060, 1078, 1098, 1114, 1114, 1130, 1130,
+  1114, 1114, 1130, 1130, 1144, 1034, 1034, 1024, 0,
+};
+
+// palette index << 4 | (run length - 1)
+const uint8_t splash_runs[] = {
+  0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8f, 0x8f, 0x86, 0x4d, 0x7f, 0x7f, 0x7f, 0x73, 0x89, 0x10, 0x8f,
+  0x8f, 0x8b, 0x4d, 0x7f, 0x7f, 0x7f, 0x73, 0x87, 0x14, 0x8f, 0x8f, 0x89, 0x4d, 0x7f, 0x7f, 0x7f,
+  0x73, 0x86, 0x10, 0x81, 0x10, 0x8f, 0x8f, 0x8b, 0x4d, 0x7f, 0x7f, 0x7f, 0x73, 0x87, 0x10, 0x8f,
+  0x8f, 0x8d, 0x4d, 0x7f, 0x7f, 0x7f, 0x73, 0x88, 0x10, 0x81, 0x10, 0x8f, 0x8f, 0x89, 0x4d, 0x7f,
+  0x7f, 0x7f, 0x73, 0x86, 0x10, 0x80, 0x13, 0x8f, 0x8f, 0x89, 0x4d, 0x7f, 0x7f, 0x7f, 0x73, 0x8b,
+  0x10, 0x8f, 0x8f, 0x89, 0x4d, 0x7f, 0x7f, 0x7f, 0x73, 0x88, 0x13, 0x8f, 0x8f, 0x89, 0x4d, 0x7f,
+  0x7f, 0x7f, 0x73, 0x89, 0x10, 0x8f, 0x8f, 0x8b, 0x46, 0x11, 0x44, 0x7f, 0x7f, 0x7f, 0x73, 0x88,
+  0x10, 0x8f, 0x8f, 0x8c, 0x45, 0x10, 0x41, 0x10, 0x43, 0x7f, 0x7f, 0x7f, 0x73, 0x89, 0x10, 0x8f,
+  0x8f, 0x8b, 0x45, 0x10, 0x41, 0x10, 0x43, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8f, 0x8f, 0x86, 0x45,
+  0x10, 0x41, 0x10, 0x43, 0x7f, 0x7f, 0x7f, 0x73, 0x88, 0x10, 0x8f, 0x8f, 0x8c, 0x4d, 0x7f, 0x7f,
+  0x7f, 0x73, 0x89, 0x11, 0x8f, 0x86, 0x18, 0x8a, 0x45, 0x10, 0x41, 0x10, 0x43, 0x7f, 0x7f, 0x7f,
+  0x73, 0x88, 0x10, 0x8f, 0x88, 0x10, 0x86, 0x10, 0x8a, 0x43, 0x10, 0x40, 0x13, 0x43, 0x7f, 0x7f,
+  0x7f, 0x73, 0x89, 0x12, 0x8f, 0x85, 0x10, 0x86, 0x10, 0x8a, 0x48, 0x10, 0x43, 0x7f, 0x7f, 0x7f,
+  0x73, 0x8f, 0x8f, 0x82, 0x15, 0x81, 0x10, 0x8a, 0x4d, 0x7f, 0x7f, 0x7f, 0x73, 0x88, 0x12, 0x8f,
+  0x8b, 0x10, 0x81, 0x10, 0x8a, 0x4d, 0x7f, 0x7f, 0x7f, 0x73, 0x8b, 0x10, 0x8f, 0x8a, 0x10, 0x81,
+  0x10, 0x8a, 0x4d, 0x7f, 0x7f, 0x7f, 0x73, 0x89, 0x11, 0x8f, 0x8b, 0x10, 0x81, 0x10, 0x8a, 0x45,
+  0x13, 0x43, 0x7f, 0x7f, 0x7f, 0x73, 0x8b, 0x10, 0x8f, 0x83, 0x10, 0x85, 0x10, 0x81, 0x10, 0x8a,
+  0x46, 0x10, 0x45, 0x7f, 0x7f, 0x7f, 0x73, 0x88, 0x12, 0x8f, 0x84, 0x11, 0x84, 0x10, 0x81, 0x10,
+  0x8a, 0x45, 0x10, 0x46, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8f, 0x80, 0x12, 0x83, 0x10, 0x81, 0x10,
+  0x8a, 0x46, 0x10, 0x45, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x87, 0x1c, 0x82, 0x10, 0x81, 0x10, 0x8a,
+  0x4d, 0x7f, 0x7f, 0x7f, 0x73, 0x89, 0x11, 0x8b, 0x1d, 0x81, 0x10, 0x81, 0x10, 0x8a, 0x4d, 0x7f,
+  0x7f, 0x7f, 0x73, 0x88, 0x10, 0x81, 0x10, 0x8a, 0x1e, 0x80, 0x10, 0x81, 0x10, 0x8a, 0x46, 0x11,
+  0x44, 0x7f, 0x7f, 0x7f, 0x73, 0x88, 0x10, 0x81, 0x10, 0x8a, 0x1d, 0x81, 0x10, 0x81, 0x10, 0x8a,
+  0x45, 0x10, 0x41, 0x10, 0x43, 0x7f, 0x7f, 0x7f, 0x73, 0x88, 0x13, 0x8a, 0x1c, 0x82, 0x10, 0x81,
+  0x10, 0x8a, 0x45, 0x10, 0x41, 0x10, 0x43, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8f, 0x80, 0x12, 0x83,
+  0x10, 0x81, 0x10, 0x8a, 0x45, 0x10, 0x41, 0x10, 0x43, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8f, 0x80,
+  0x11, 0x84, 0x10, 0x81, 0x10, 0x8a, 0x4d, 0x7f, 0x7f, 0x7f, 0x73, 0x88, 0x13, 0x8f, 0x83, 0x10,
+  0x85, 0x10, 0x81, 0x10, 0x8a, 0x4d, 0x7f, 0x7f, 0x7f, 0x73, 0x89, 0x10, 0x8f, 0x8c, 0x10, 0x81,
+  0x10, 0x8a, 0x45, 0x12, 0x44, 0x7f, 0x7f, 0x7f, 0x73, 0x88, 0x10, 0x8f, 0x8d, 0x10, 0x81, 0x10,
+  0x8a, 0x48, 0x10, 0x43, 0x7f, 0x7f, 0x7f, 0x73, 0x89, 0x10, 0x8f, 0x8c, 0x10, 0x81, 0x10, 0x8a,
+  0x48, 0x10, 0x43, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8f, 0x82, 0x15, 0x81, 0x10, 0x8a, 0x45, 0x13,
+  0x43, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8f, 0x82, 0x10, 0x86, 0x10, 0x8a, 0x4d, 0x7f, 0x7f, 0x7f,
+  0x73, 0x89, 0x11, 0x8f, 0x86, 0x10, 0x86, 0x10, 0x8a, 0x4d, 0x7f, 0x7f, 0x7f, 0x73, 0x88, 0x10,
+  0x80, 0x11, 0x8f, 0x85, 0x18, 0x8a, 0x45, 0x10, 0x41, 0x10, 0x43, 0x7f, 0x7f, 0x7f, 0x73, 0x88,
+  0x11, 0x80, 0x10, 0x8f, 0x8f, 0x89, 0x43, 0x10, 0x40, 0x13, 0x43, 0x7f, 0x7f, 0x7f, 0x73, 0x89,
+  0x10, 0x80, 0x10, 0x8f, 0x8f, 0x89, 0x48, 0x10, 0x43, 0x7f, 0x7f, 0x7f, 0x73, 0x8a, 0x11, 0x8f,
+  0x8f, 0x89, 0x45, 0x10, 0x46, 0x7f, 0x7f, 0x7f, 0x73, 0x8a, 0x11, 0x8f, 0x8f, 0x89, 0x43, 0x14,
+  0x44, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8f, 0x8f, 0x86, 0x47, 0x10, 0x44, 0x7f, 0x7f, 0x7f, 0x73,
+  0x88, 0x12, 0x8f, 0x8f, 0x8a, 0x4d, 0x7f, 0x7f, 0x7f, 0x73, 0x8b, 0x10, 0x8f, 0x8f, 0x89, 0x44,
+  0x15, 0x42, 0x7f, 0x7f, 0x7f, 0x73, 0x8b, 0x10, 0x8f, 0x8f, 0x89, 0x44, 0x10, 0x41, 0x10, 0x44,
+  0x7f, 0x7f, 0x7f, 0x73, 0x88, 0x13, 0x8f, 0x8f, 0x89, 0x44, 0x10, 0x41, 0x10, 0x44, 0x7f, 0x7f,
+  0x7f, 0x73, 0x8f, 0x8f, 0x8f, 0x86, 0x45, 0x11, 0x45, 0x7f, 0x7f, 0x7f, 0x73, 0x87, 0x14, 0x8f,
+  0x8f, 0x89, 0x44, 0x12, 0x40, 0x10, 0x43, 0x7f, 0x7f, 0x7f, 0x73, 0x86, 0x10, 0x81, 0x10, 0x8f,
+  0x8f, 0x8b, 0x47, 0x10, 0x40, 0x10, 0x42, 0x7f, 0x7f, 0x7f, 0x73, 0x87, 0x10, 0x8f, 0x8f, 0x8d,
+  0x47, 0x10, 0x40, 0x10, 0x42, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8f, 0x8f, 0x86, 0x44, 0x14, 0x43,
+  0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8a, 0x18, 0x8f, 0x82, 0x4d, 0x7f, 0x7f, 0x7f, 0x73, 0x87, 0x10,
+  0x82, 0x10, 0x8d, 0x18, 0x8f, 0x82, 0x4d, 0x7f, 0x7f, 0x7f, 0x73, 0x86, 0x10, 0x82, 0x11, 0x8d,
+  0x18, 0x8f, 0x82, 0x45, 0x10, 0x46, 0x7f, 0x7f, 0x7f, 0x73, 0x86, 0x10, 0x81, 0x10, 0x80, 0x10,
+  0x8d, 0x18, 0x8f, 0x82, 0x43, 0x14, 0x44, 0x7f, 0x7f, 0x7f, 0x73, 0x87, 0x11, 0x81, 0x10, 0x8d,
+  0x18, 0x8f, 0x82, 0x45, 0x10, 0x41, 0x10, 0x43, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8a, 0x18, 0x8f,
+  0x82, 0x47, 0x10, 0x44, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8a, 0x18, 0x8f, 0x82, 0x43, 0x15, 0x43,
+  0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8a, 0x18, 0x8f, 0x82, 0x45, 0x10, 0x46, 0x7f, 0x7f, 0x7f, 0x73,
+  0x8f, 0x8a, 0x18, 0x8f, 0x82, 0x46, 0x12, 0x43, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8a, 0x18, 0x8f,
+  0x82, 0x46, 0x11, 0x44, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x85, 0x1f, 0x12, 0x8d, 0x45, 0x10, 0x41,
+  0x10, 0x43, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x86, 0x1f, 0x10, 0x8e, 0x45, 0x10, 0x41, 0x10, 0x43,
+  0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x87, 0x1e, 0x8f, 0x46, 0x11, 0x44, 0x7f, 0x7f, 0x7f, 0x73, 0x8f,
+  0x88, 0x1c, 0x8f, 0x80, 0x4d, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x89, 0x1a, 0x8f, 0x81, 0x4d, 0x7f,
+  0x7f, 0x7f, 0x73, 0x8f, 0x8a, 0x18, 0x8f, 0x82, 0x45, 0x13, 0x43, 0x7f, 0x7f, 0x7f, 0x73, 0x8f,
+  0x8b, 0x16, 0x8f, 0x83, 0x45, 0x10, 0x46, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8c, 0x14, 0x8f, 0x84,
+  0x45, 0x10, 0x46, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8d, 0x12, 0x8f, 0x85, 0x46, 0x12, 0x43, 0x7f,
+  0x7f, 0x7f, 0x73, 0x8f, 0x8e, 0x10, 0x8f, 0x86, 0x4d, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8f, 0x8f,
+  0x86, 0x47, 0x11, 0x43, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8f, 0x8f, 0x86, 0x46, 0x11, 0x44, 0x7f,
+  0x7f, 0x7f, 0x73, 0x8f, 0x8f, 0x8f, 0x86, 0x45, 0x13, 0x43, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8f,
+  0x8f, 0x86, 0x46, 0x10, 0x45, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8f, 0x8f, 0x86, 0x45, 0x10, 0x46,
+  0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8a, 0x1f, 0x16, 0x84, 0x4d, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8a,
+  0x10, 0x8f, 0x84, 0x10, 0x84, 0x4d, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x8a, 0x10, 0x8f, 0x84, 0x10,
+  0x84, 0x45, 0x11, 0x45, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x81, 0x19, 0x8f, 0x84, 0x10, 0x84, 0x44,
+  0x10, 0x41, 0x10, 0x40, 0x10, 0x42, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x81, 0x10, 0x87, 0x10, 0x8f,
+  0x84, 0x10, 0x84, 0x44, 0x10, 0x41, 0x10, 0x40, 0x10, 0x42, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x81,
+  0x10, 0x87, 0x10, 0x8f, 0x84, 0x10, 0x84, 0x45, 0x13, 0x43, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x81,
+  0x10, 0x81, 0x12, 0x82, 0x10, 0x8f, 0x84, 0x10, 0x84, 0x4d, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x81,
+  0x10, 0x87, 0x10, 0x8f, 0x84, 0x10, 0x84, 0x4d, 0x7f, 0x7f, 0x7f, 0x73, 0x8f, 0x81, 0x19, 0x8f,
+  0x84, 0x10, 0x84, 0x4d,
+};
@@ -0,0 +1,127 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef TUF2_STATS_H_
+#define TUF2_STATS_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Performance counters of the current boot, rendered as STATS.TXT with CFG_UF2_STATS. Counted by
+// msc, ghostfat and the flash write path of the port (shared cache or its own), times need
+// board_micros(). Counters wrap, each is written by a single task.
+//--------------------------------------------------------------------+
+
+#ifndef CFG_UF2_STATS
+  #define CFG_UF2_STATS  0
+#endif
+
+// regions of sectors read from a GhostFAT volume
+enum {
+  TUF2_STATS_READ_BOOT = 0,   // boot sector and reserved sectors
+  TUF2_STATS_READ_FAT,
+  TUF2_STATS_READ_DIR,        // root directory and subdirectories
+  TUF2_STATS_READ_FILE,       // static and generated files except CURRENT.UF2
+  TUF2_STATS_READ_CURRENT_UF2,// including unused clusters after it
+  TUF2_STATS_READ_OUTSIDE,    // past the end of the volume
+  TUF2_STATS_READ_COUNT
+};
+
+// tasks of an RTOS port, see board_task_info()
+enum {
+  TUF2_STATS_TASK_USBD = 0,
+  TUF2_STATS_TASK_FLASH_WRITE,
+  TUF2_STATS_TASK_READ_AHEAD,
+  TUF2_STATS_TASK_MAIN,       // init, display and log
+  TUF2_STATS_TASK_COUNT
+};
+
+typedef struct {
+  uint32_t read10;            // READ10 commands
+  uint32_t write10;           // WRITE10 commands
+  uint32_t sectors_read[TUF2_STATS_READ_COUNT];
+  uint32_t sectors_written;
+
+  uint32_t write_busy;        // WRITE10 callbacks held off while flash is busy
+  uint32_t write_stall_max_us;// longest time a WRITE10 waited, including busy retries
+  uint32_t write_cb_max_us;   // longest WRITE10 callback that took data, bulk OUT is not re-armed meanwhile
+  uint32_t flush_max_us;      // longest board_flash_flush() at the end of an image
+
+  uint32_t cache_hits;        // writes into the erase unit / window already cached
+  uint32_t cache_misses;      // writes opening another one
+  uint32_t cache_evictions;   // windows submitted before complete to make room for another one
+  uint32_t skipped_bytes;     // compared equal to flash, neither erased nor programmed
+  uint32_t crc_rejected;      // UF2 blocks failing their crc32 extension tag, CFG_UF2_BLOCK_CRC
+
+  uint32_t measurement_cache_hits;   // ota1 reads served by the measurement sector cache
+  uint32_t measurement_cache_misses; // sectors read from ota1 into it
+
+  uint32_t erase_count;       // erase operations, any size
+  uint32_t erase_us;
+  uint32_t program_count;     // program operations
+  uint32_t program_bytes;
+  uint32_t program_us;
+  uint32_t supply_throttles;  // times erase & program were slowed down for a low supply (board_supply_mv())
+
+  // results of the last benchmark (BENCH magic blocks, see uf2.h), KB per second
+  uint32_t bench_usb_kb_s;    // WRITE10 of the benchmark blocks
+  uint32_t bench_erase_kb_s;  // raw flash, measured by board_flash_benchmark()
+  uint32_t bench_program_kb_s;
+  uint32_t bench_read_kb_s;
+
+  // from board_heap_info() when STATS.TXT is read, static RAM is reported at build time (tools/memreport.py)
+  uint32_t heap_size;
+  uint32_t heap_used_max;     // high-water mark since boot
+
+  // from board_task_info() when STATS.TXT is read
+  uint32_t task_run_ms[TUF2_STATS_TASK_COUNT];     // CPU time since boot
+  uint32_t task_stack_free[TUF2_STATS_TASK_COUNT]; // least free stack since start, bytes
+} tuf2_stats_t;
+
+#if CFG_UF2_STATS
+extern tuf2_stats_t tuf2_stats;
+
+  #define TUF2_STATS_ADD(_field, _n)  do { tuf2_stats._field += (_n); } while (0)
+  #define TUF2_STATS_MAX(_field, _v)  do { if ((_v) > tuf2_stats._field) tuf2_stats._field = (_v); } while (0)
+
+  // board_micros() or 0 if the board has none
+  #define TUF2_STATS_US()             (board_micros ? board_micros() : 0)
+#else
+  #define TUF2_STATS_ADD(_field, _n)  do { (void) (_n); } while (0)
+  #define TUF2_STATS_MAX(_field, _v)  do { (void) (_v); } while (0)
+  #define TUF2_STATS_US()             (0)
+#endif
+
+#define TUF2_STATS_INC(_field)        TUF2_STATS_ADD(_field, 1)
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
@@ -6,12 +6,32 @@
 
 function (add_tinyuf2 TARGET)
   target_sources(${TARGET} PUBLIC
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/access.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/compress.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/decompress.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/deflate.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/delta.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/dfu.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/file_container.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/flash_cache.c
     ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/ghostfat.c
     ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/images.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/log_deferred.c
     ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/main.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/measurement_cache.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/measurement_cdc.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/measurement_csv.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/measurement_gz.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/measurement_pack.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/measurement_ring.c
     ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/msc.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/scratch.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/sched.c
     ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/screen.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/splash.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/trace.c
     ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/usb_descriptors.c
+    ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/vendor.c
     ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/board_api.h
     )
   target_include_directories(${TARGET} PUBLIC
@@ -19,3 +39,170 @@ function (add_tinyuf2 TARGET)
     ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/favicon
     )
 endfunction()
+
+# Static RAM and flash report per module and symbol after each build, see tools/memreport.py.
+# MAP is the GNU ld map file of the elf, the report is written next to it as .mem.txt
+function (tinyuf2_add_memreport TARGET ELF MAP)
+  find_package(Python COMPONENTS Interpreter)
+  add_custom_command(TARGET ${TARGET} POST_BUILD
+    COMMAND ${Python_EXECUTABLE} ${CMAKE_CURRENT_FUNCTION_LIST_DIR}/../tools/memreport.py --nm ${CMAKE_NM} ${MAP} ${ELF}
+    VERBATIM)
+endfunction()
+
+# uf2 of len bytes of firmware, payload bytes per 512-byte block
+function (_tinyuf2_uf2_bytes OUT len payload)
+  math(EXPR bytes "(${len} + ${payload} - 1) / ${payload} * 512")
+  set(${OUT} ${bytes} PARENT_SCOPE)
+endfunction()
+
+# Size column of an ESP-IDF partition table: decimal, hex or with K/M suffix
+function (_tinyuf2_partition_size OUT str)
+  string(STRIP "${str}" str)
+  if (str MATCHES "^([0-9]+)[Kk]$")
+    math(EXPR bytes "${CMAKE_MATCH_1} * 1024")
+  elseif (str MATCHES "^([0-9]+)[Mm]$")
+    math(EXPR bytes "${CMAKE_MATCH_1} * 1024 * 1024")
+  else ()
+    math(EXPR bytes "${str}")
+  endif ()
+  set(${OUT} ${bytes} PARENT_SCOPE)
+endfunction()
+
+# GhostFAT geometry for a board, written to uf2_geometry.h in the build directory and used by uf2.h unless board.h
+# sets CFG_UF2_NUM_BLOCKS or CFG_UF2_SECTORS_PER_CLUSTER. Hosts read and scan the whole FAT on mount: the volume
+# gets the smallest FAT of a valid FAT16 (FAT32) volume, 32 clusters away from the limits as the static asserts
+# of ghostfat.c, that holds CURRENT.UF2, an upload of the same size, exported data partitions and the other files.
+#   FLASH_SIZE       CFG_UF2_FLASH_SIZE, largest CURRENT.UF2 (default 4MB)
+#   PARTITION_TABLE  ESP-IDF partition table: CURRENT.UF2 and uploads are sized to its largest ota app partition,
+#                    further ota app partitions and measurement partitions (subtype 0x40) are exported as files
+#   FILES_BYTES      text, html and generated files together (default 64KB)
+#   EXTRA_BYTES      room for more uploads, e.g. CFG_UF2_VOLUME_FIT_EXTRA
+#   PAYLOAD          CFG_UF2_CURRENT_PAYLOAD_SIZE (default 256)
+#   FAT32            CFG_UF2_FAT32 is set
+function (tinyuf2_ghostfat_geometry TARGET)
+  cmake_parse_arguments(PARSE_ARGV 1 ARG "FAT32" "FLASH_SIZE;PARTITION_TABLE;FILES_BYTES;EXTRA_BYTES;PAYLOAD" "")
+  if (NOT DEFINED ARG_FLASH_SIZE)
+    set(ARG_FLASH_SIZE 0x400000)
+  endif ()
+  if (NOT DEFINED ARG_FILES_BYTES)
+    set(ARG_FILES_BYTES 65536)
+  endif ()
+  if (NOT DEFINED ARG_EXTRA_BYTES)
+    set(ARG_EXTRA_BYTES 0)
+  endif ()
+  if (NOT DEFINED ARG_PAYLOAD)
+    set(ARG_PAYLOAD 256)
+  endif ()
+  math(EXPR image "${ARG_FLASH_SIZE}")
+  set(data 0)
+
+  if (DEFINED ARG_PARTITION_TABLE)
+    set(app_max 0)
+    set(app_total 0)
+    file(STRINGS ${ARG_PARTITION_TABLE} lines REGEX "^[^#]")
+    foreach (line IN LISTS lines)
+      string(REPLACE "," ";" cols "${line}")
+      list(LENGTH cols ncols)
+      if (ncols LESS 5)
+        continue()
+      endif ()
+      list(GET cols 1 type)
+      list(GET cols 2 subtype)
+      list(GET cols 4 size)
+      string(STRIP "${type}" type)
+      string(STRIP "${subtype}" subtype)
+      _tinyuf2_partition_size(size "${size}")
+
+      if (type STREQUAL "app" AND subtype MATCHES "^ota_")
+        math(EXPR app_total "${app_total} + ${size}")
+        if (size GREATER app_max)
+          set(app_max ${size})
+        endif ()
+      elseif (type STREQUAL "data" AND subtype STREQUAL "0x40")
+        math(EXPR data "${data} + ${size}")
+      endif ()
+    endforeach ()
+
+    if (app_max GREATER 0)
+      math(EXPR data "${data} + ${app_total} - ${app_max}")
+      if (app_max LESS image)
+        set(image ${app_max})
+      endif ()
+    endif ()
+  endif ()
+
+  # CURRENT.UF2 and an upload by the host, which uses 256 bytes per block
+  _tinyuf2_uf2_bytes(current ${image} ${ARG_PAYLOAD})
+  _tinyuf2_uf2_bytes(upload ${image} 256)
+  math(EXPR other "${data} + ${ARG_FILES_BYTES} + ${ARG_EXTRA_BYTES}")
+
+  if (ARG_FAT32)
+    set(reserved 32)
+    set(entries_per_fat 128)
+    math(EXPR min_clusters "0x10015")
+    math(EXPR max_clusters "0x0FFFFFD5")
+  else ()
+    set(reserved 1)
+    set(entries_per_fat 256)
+    math(EXPR min_clusters "0x1015")
+    math(EXPR max_clusters "0xFFD5")
+  endif ()
+
+  # clusters up to 32KB; at equal FAT size the smaller volume
+  set(best_fat 0)
+  foreach (spc 1 2 4 8 16 32 64)
+    math(EXPR cluster "${spc} * 512")
+    # every directory entry (BPB_ROOT_DIR_ENTRIES) takes at least one cluster
+    math(EXPR clusters "(${current} + ${cluster} - 1) / ${cluster} + (${upload} + ${cluster} - 1) / ${cluster} + \
+                        (${other} + ${cluster} - 1) / ${cluster} + 64")
+    if (ARG_FAT32)
+      math(EXPR clusters "${clusters} + (64 * 32 + ${cluster} - 1) / ${cluster}")
+    endif ()
+    if (clusters LESS min_clusters)
+      set(clusters ${min_clusters})
+    endif ()
+    if (NOT clusters LESS max_clusters)
+      continue()
+    endif ()
+
+    # FAT of ghostfat.c is sized to all sectors of the volume, not just its clusters
+    math(EXPR fat "(${clusters} + 2 + ${entries_per_fat} - 1) / ${entries_per_fat}")
+    while (1)
+      if (ARG_FAT32)
+        math(EXPR total "${reserved} + 2 * ${fat} + ${clusters} * ${spc}")
+      else ()
+        math(EXPR total "${reserved} + 2 * ${fat} + 4 + ${clusters} * ${spc}")
+      endif ()
+      math(EXPR fat_total "((${total} + ${spc} - 1) / ${spc} + ${entries_per_fat} - 1) / ${entries_per_fat}")
+      if (fat_total EQUAL fat)
+        break()
+      endif ()
+      set(fat ${fat_total})
+    endwhile ()
+
+    if (best_fat EQUAL 0 OR fat LESS best_fat)
+      set(best_fat ${fat})
+      set(best_spc ${spc})
+      set(best_total ${total})
+      set(best_clusters ${clusters})
+    endif ()
+  endforeach ()
+
+  if (best_fat EQUAL 0)
+    message(FATAL_ERROR "tinyuf2: no FAT16 geometry holds ${current} + ${upload} + ${other} bytes, use FAT32")
+  endif ()
+  message(STATUS "tinyuf2: GhostFAT ${best_total} sectors, ${best_clusters} clusters of ${best_spc} sectors, \
+${best_fat} sectors per FAT")
+
+  set(dir ${CMAKE_CURRENT_BINARY_DIR}/tinyuf2_geometry)
+  file(GENERATE OUTPUT ${dir}/uf2_geometry.h CONTENT
+"// Generated by tinyuf2_ghostfat_geometry() of src/tinyuf2.cmake
+// ${best_clusters} clusters of ${best_spc} sectors, ${best_fat} sectors per FAT
+#if !defined(CFG_UF2_NUM_BLOCKS) && !defined(CFG_UF2_SECTORS_PER_CLUSTER)
+  #define CFG_UF2_NUM_BLOCKS          (${best_total})
+  #define CFG_UF2_SECTORS_PER_CLUSTER (${best_spc})
+#endif
+")
+  target_include_directories(${TARGET} PUBLIC ${dir})
+  target_compile_definitions(${TARGET} PUBLIC CFG_UF2_GEOMETRY=1)
+endfunction()
@@ -0,0 +1,162 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "board_api.h"
+#include "trace.h"
+
+#if CFG_UF2_TRACE
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+//--------------------------------------------------------------------+
+// MACRO TYPEDEF CONSTANT ENUM DECLARATION
+//--------------------------------------------------------------------+
+
+#if CFG_UF2_TRACE_DEPTH & (CFG_UF2_TRACE_DEPTH - 1)
+  #error "CFG_UF2_TRACE_DEPTH must be a power of 2"
+#endif
+
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__) || defined(__ARM_ARCH_8M_MAIN__)
+  #define TRACE_DWT  1
+  #define DWT_CTRL     (*(volatile uint32_t*) 0xE0001000UL)
+  #define DWT_CYCCNT   (*(volatile uint32_t*) 0xE0001004UL)
+  #define DEMCR        (*(volatile uint32_t*) 0xE000EDFCUL)
+
+  // CMSIS system clock of the port, if any
+  extern uint32_t SystemCoreClock __attribute__ ((weak));
+#else
+  #define TRACE_DWT  0
+#endif
+
+#ifndef CFG_UF2_TRACE_CYCLES_PER_US
+  #ifdef CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+    #define CFG_UF2_TRACE_CYCLES_PER_US  CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+  #else
+    #define CFG_UF2_TRACE_CYCLES_PER_US  0
+  #endif
+#endif
+
+static tuf2_trace_event_t _events[CFG_UF2_TRACE_DEPTH];
+static uint32_t _total;
+static bool _frozen;
+
+#if TRACE_DWT
+static bool _dwt_started;
+#endif
+
+//--------------------------------------------------------------------+
+//
+//--------------------------------------------------------------------+
+
+static inline uint32_t trace_cycles(void) {
+#if defined(__XTENSA__)
+  uint32_t ccount;
+  __asm__ volatile ("rsr %0, ccount" : "=a" (ccount));
+  return ccount;
+#elif TRACE_DWT
+  if (!_dwt_started) {
+    _dwt_started = true;
+    DEMCR |= (1UL << 24); // TRCENA
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= 1UL;      // CYCCNTENA
+  }
+  return DWT_CYCCNT;
+#elif defined(__riscv)
+  uint32_t cycle;
+  __asm__ volatile ("csrr %0, mcycle" : "=r" (cycle));
+  return cycle;
+#else
+  return board_micros ? board_micros() : 0;
+#endif
+}
+
+void tuf2_trace_record(uint8_t id, uint8_t type) {
+  if (_frozen) return;
+
+  uint32_t const cycles = trace_cycles();
+  uint32_t const num = __atomic_fetch_add(&_total, 1, __ATOMIC_RELAXED);
+
+  tuf2_trace_event_t* evt = &_events[num & (CFG_UF2_TRACE_DEPTH - 1)];
+  evt->cycles = cycles;
+  evt->id = id;
+  evt->type = type;
+  evt->ms = (uint16_t) (board_millis ? board_millis() : 0);
+}
+
+static uint32_t trace_cycles_per_us(void) {
+#if TRACE_DWT
+  if (CFG_UF2_TRACE_CYCLES_PER_US == 0 && &SystemCoreClock) return SystemCoreClock / 1000000;
+#elif !defined(__XTENSA__) && !defined(__riscv)
+  if (CFG_UF2_TRACE_CYCLES_PER_US == 0) return 1; // board_micros()
+#endif
+  return CFG_UF2_TRACE_CYCLES_PER_US;
+}
+
+uint32_t tuf2_trace_size(void) {
+  return sizeof(tuf2_trace_header_t) + CFG_UF2_TRACE_DEPTH * sizeof(tuf2_trace_event_t);
+}
+
+void tuf2_trace_read(uint32_t offset, void* dst, uint32_t len) {
+  // events recorded while the host is reading would shift the ring under it
+  _frozen = true;
+
+  uint32_t const total = _total;
+  uint32_t const count = (total < CFG_UF2_TRACE_DEPTH) ? total : CFG_UF2_TRACE_DEPTH;
+
+  tuf2_trace_header_t const header = {
+    .magic = TUF2_TRACE_MAGIC,
+    .cycles_per_us = trace_cycles_per_us(),
+    .total = total,
+    .depth = CFG_UF2_TRACE_DEPTH
+  };
+
+  uint8_t* out = dst;
+  for (uint32_t pos = offset; pos < offset + len; ) {
+    uint32_t n;
+    if (pos < sizeof(header)) {
+      n = sizeof(header) - pos;
+      if (n > offset + len - pos) n = offset + len - pos;
+      memcpy(out, (uint8_t const*) &header + pos, n);
+    } else {
+      uint32_t const i = (pos - sizeof(header)) / sizeof(tuf2_trace_event_t);
+      uint32_t const evt_ofs = (pos - sizeof(header)) % sizeof(tuf2_trace_event_t);
+      n = sizeof(tuf2_trace_event_t) - evt_ofs;
+      if (n > offset + len - pos) n = offset + len - pos;
+
+      if (i < count) {
+        memcpy(out, (uint8_t const*) &_events[(total - count + i) & (CFG_UF2_TRACE_DEPTH - 1)] + evt_ofs, n);
+      } else {
+        memset(out, 0, n);
+      }
+    }
+    out += n;
+    pos += n;
+  }
+}
+
+#endif
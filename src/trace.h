@@ -0,0 +1,128 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef TUF2_TRACE_H_
+#define TUF2_TRACE_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Begin/end trace points with CPU cycle timestamps (CCOUNT on Xtensa, DWT->CYCCNT on Cortex-M3 and
+// up, mcycle on RISC-V) recorded into a RAM ring. Downloaded as TRACE.BIN, recording stops on the
+// first read so that the file stays consistent. tools/trace2chrome.py converts it to Chrome trace
+// format (chrome://tracing, Perfetto). Compiled out unless CFG_UF2_TRACE.
+//--------------------------------------------------------------------+
+
+#ifndef CFG_UF2_TRACE
+#define CFG_UF2_TRACE        0
+#endif
+
+// Trace points and boot stages also drive board_perf_marker(), e.g a debug GPIO watched by a logic
+// analyzer: a register write instead of a timestamp, no download needed. Independent of CFG_UF2_TRACE
+#ifndef CFG_UF2_PERF_MARKER
+#define CFG_UF2_PERF_MARKER  0
+#endif
+
+// number of events kept, power of 2. 8 bytes each
+#ifndef CFG_UF2_TRACE_DEPTH
+#define CFG_UF2_TRACE_DEPTH  1024
+#endif
+
+#define TUF2_TRACE_MAGIC     0x45435254UL // "TRCE"
+
+// Event IDs, keep in sync with tools/trace2chrome.py
+enum {
+  TUF2_TRACE_TUD_TASK = 1,  // tud_task() iteration, superloop ports only
+  TUF2_TRACE_READ10,        // tud_msc_read10_cb()
+  TUF2_TRACE_WRITE10,       // tud_msc_write10_cb()
+  TUF2_TRACE_UF2_WRITE,     // one uf2 block or plain run in uf2_write_blocks()
+  TUF2_TRACE_FLASH_FLUSH,   // write back of a flash cache unit/window
+  TUF2_TRACE_FLASH_COMPARE, // compare cache against flash before writing back
+  TUF2_TRACE_FLASH_ERASE,
+  TUF2_TRACE_FLASH_PROGRAM,
+};
+
+// board_perf_marker() ids besides the trace events: TUF2_MARKER_STAGE + BOOTLOG_* is a pulse at each boot
+// stage, TUF2_MARKER_DETECT spans the UF2 detection window of the espressif 2nd stage bootloader
+#define TUF2_MARKER_DETECT   15
+#define TUF2_MARKER_STAGE    16
+
+// ids a single marker pin follows, bit per id: write window flushes, UF2 detection and boot stages.
+// Overlapping ids of different tasks would merge on one pin
+#ifndef CFG_UF2_PERF_MARKER_IDS
+#define CFG_UF2_PERF_MARKER_IDS  ((1UL << TUF2_TRACE_FLASH_FLUSH) | (1UL << TUF2_MARKER_DETECT) | (0xFFFFUL << TUF2_MARKER_STAGE))
+#endif
+
+enum {
+  TUF2_TRACE_BEGIN_EVT = 1,
+  TUF2_TRACE_END_EVT   = 2,
+};
+
+// TRACE.BIN: header followed by CFG_UF2_TRACE_DEPTH events, oldest first. Unused events are zero
+typedef struct {
+  uint32_t magic;
+  uint32_t cycles_per_us; // 0 if unknown
+  uint32_t total;         // events recorded, older ones than the last CFG_UF2_TRACE_DEPTH are lost
+  uint32_t depth;
+} tuf2_trace_header_t;
+
+typedef struct {
+  uint32_t cycles;
+  uint8_t id;
+  uint8_t type;
+  uint16_t ms;            // board_millis() low bits, resolves cycle counter wrap around
+} tuf2_trace_event_t;
+
+#if CFG_UF2_PERF_MARKER
+  #define TUF2_MARKER(_id, _on)  do { if (board_perf_marker) board_perf_marker(_id, _on); } while (0)
+#else
+  #define TUF2_MARKER(_id, _on)
+#endif
+
+#define TUF2_MARKER_PULSE(_id)   do { TUF2_MARKER(_id, true); TUF2_MARKER(_id, false); } while (0)
+
+#if CFG_UF2_TRACE
+  void tuf2_trace_record(uint8_t id, uint8_t type);
+
+  #define TUF2_TRACE_BEGIN(_id)  do { TUF2_MARKER(_id, true); tuf2_trace_record(_id, TUF2_TRACE_BEGIN_EVT); } while (0)
+  #define TUF2_TRACE_END(_id)    do { tuf2_trace_record(_id, TUF2_TRACE_END_EVT); TUF2_MARKER(_id, false); } while (0)
+#else
+  #define TUF2_TRACE_BEGIN(_id)  TUF2_MARKER(_id, true)
+  #define TUF2_TRACE_END(_id)    TUF2_MARKER(_id, false)
+#endif
+
+// TRACE.BIN content, size is fixed
+uint32_t tuf2_trace_size(void);
+void tuf2_trace_read(uint32_t offset, void* dst, uint32_t len);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
@@ -43,23 +43,250 @@ SOFTWARE.
 // #define UF2_VERSION         "0.0.0"
 
 // The largest flash size that is supported by the board, in bytes, default is 4MB
-// Flash size is constrained by RAM, a 4MB size requires 2kB RAM, see MAX_BLOCKS
+// Flash size is constrained by RAM, a 4MB size requires 2kB RAM, see MAX_BLOCKS (unless CFG_UF2_WRITE_RANGES is used)
 // Largest tested is 256MB, with 0x300000 blocks (1.5GB), 64 sectors per cluster
 #ifndef CFG_UF2_FLASH_SIZE
     #define CFG_UF2_FLASH_SIZE          (4*1024*1024)
 #endif
 
+// Geometry computed by tinyuf2_ghostfat_geometry() of src/tinyuf2.cmake, if the build uses it. Either of
+// CFG_UF2_NUM_BLOCKS and CFG_UF2_SECTORS_PER_CLUSTER set by board.h disables it
+#if defined(CFG_UF2_GEOMETRY) && CFG_UF2_GEOMETRY
+    #include "uf2_geometry.h"
+#endif
+
 // Number of 512-byte blocks in the exposed filesystem, default is just under 32MB
 // The filesystem needs space for the current file, text files, uploaded file, and FAT
 #ifndef CFG_UF2_NUM_BLOCKS
     #define CFG_UF2_NUM_BLOCKS          (0x10109)
 #endif
 
+// Fit the firmware volume to its files at uf2_init: room for an upload of the whole app partition
+// and CFG_UF2_VOLUME_FIT_EXTRA bytes more (e.g. bundles of routed partitions), CFG_UF2_NUM_BLOCKS
+// is the upper limit. The FAT hosts read and scan on every mount shrinks with it.
+// Measurement files grow after uf2_init, they need CFG_UF2_MEASUREMENT_LUN (that volume is not fitted)
+#ifndef CFG_UF2_VOLUME_FIT
+    #define CFG_UF2_VOLUME_FIT          (0)
+#endif
+
+#ifndef CFG_UF2_VOLUME_FIT_EXTRA
+    #define CFG_UF2_VOLUME_FIT_EXTRA    (0)
+#endif
+
 // Sectors per FAT cluster, must be increased proportionally for larger filesystems
 #ifndef CFG_UF2_SECTORS_PER_CLUSTER
     #define CFG_UF2_SECTORS_PER_CLUSTER (1)
 #endif
 
+// Payload bytes per block of the generated CURRENT.UF2, multiple of 4 up to 476. 256 is the most
+// compatible, 476 makes the file about half as large (1.08 instead of 2 bytes per firmware byte)
+#ifndef CFG_UF2_CURRENT_PAYLOAD_SIZE
+    #define CFG_UF2_CURRENT_PAYLOAD_SIZE (256)
+#endif
+
+// Track written blocks as a sorted list of up to this many [start, end) ranges instead of a
+// bitmap of MAX_BLOCKS bits. Blocks arrive nearly always in order so a single range is the norm,
+// RAM is 8 bytes per range regardless of flash size. 0 uses the bitmap
+#ifndef CFG_UF2_WRITE_RANGES
+    #define CFG_UF2_WRITE_RANGES        (0)
+#endif
+
+// Track this many uf2 files written at the same time (e.g app and a bundle copied together), told
+// apart by their numBlocks. Update completes once all of them are written. Another file beyond that
+// stops completion as with a single one. Each takes the written ranges or bitmap above
+#ifndef CFG_UF2_WRITE_SESSIONS
+    #define CFG_UF2_WRITE_SESSIONS      (1)
+#endif
+
+// Complete DFU only once host has not written new uf2 blocks for this many ms after the last one,
+// so that trailing FAT/directory writes finish first. Checked on TEST UNIT READY, SYNCHRONIZE CACHE
+// or eject complete right away. 0 completes as soon as the last block is written
+#ifndef CFG_UF2_IDLE_COMPLETE_MS
+    #define CFG_UF2_IDLE_COMPLETE_MS    (0)
+#endif
+
+// Fail a WRITE10 that busy flash has held off this many ms before any of its data was taken with NOT
+// READY / becoming ready, needs board_millis(). The host backs off and retries it instead of running
+// into its command timeout and resetting the device. TEST UNIT READY reports NOT READY meanwhile until
+// flash takes the block again. 0 holds the command off for as long as flash is busy
+#ifndef CFG_UF2_WRITE_NOT_READY_MS
+    #define CFG_UF2_WRITE_NOT_READY_MS  (0)
+#endif
+
+// Use FAT32 instead of FAT16, lets large volumes keep small clusters (needs at least 65525 clusters)
+#ifndef CFG_UF2_FAT32
+    #define CFG_UF2_FAT32               (0)
+#endif
+
+// Maximum number of generated files in all subdirectories together, each takes 2 bytes of RAM
+#ifndef CFG_UF2_SUBDIR_FILES_MAX
+    #define CFG_UF2_SUBDIR_FILES_MAX    (400)
+#endif
+
+// Keep this many sectors written by the host that are not uf2 blocks (FAT, directories, OS metadata
+// files) in RAM and return them on read, so the host reads back what it wrote instead of the generated
+// volume. Least recently used is replaced first, 512 bytes each. 0 drops such writes
+#ifndef CFG_UF2_WRITE_OVERLAY_SECTORS
+    #define CFG_UF2_WRITE_OVERLAY_SECTORS (0)
+#endif
+
+// Raw .bin files copied to the firmware volume are flashed without a UF2 envelope. A new *.BIN file is
+// found by its root directory entry (start cluster, size) or, written before its metadata, by an app
+// image header at the start of a free cluster. Its data sectors go straight to flash, assuming the host
+// allocated the clusters contiguously (checked against its FAT writes). Names listed in
+// CFG_UF2_RAW_BIN_ROUTES go to another family, e.g. { "NVS     ", 0x51d0e8a3 }, others to the app.
+// Needs CFG_UF2_WRITE_OVERLAY_SECTORS, the host must read back its own directory and FAT
+#ifndef CFG_UF2_RAW_BIN
+    #define CFG_UF2_RAW_BIN             (0)
+#endif
+
+#if CFG_UF2_RAW_BIN && !CFG_UF2_WRITE_OVERLAY_SECTORS
+    #error "CFG_UF2_RAW_BIN needs CFG_UF2_WRITE_OVERLAY_SECTORS"
+#endif
+
+// Build ghostfat and msc into the application (ports/espressif/components/tinyuf2_export) to export
+// measurements while sampling continues. Only the read-only measurement volume is served, as LUN 0:
+// no firmware volume, no uf2 writes, board_* flash and DFU functions are not needed
+#ifndef CFG_UF2_APP_EXPORT
+    #define CFG_UF2_APP_EXPORT          (0)
+#endif
+
+// Export measurement files on a second, read-only LUN instead of the firmware volume. The host
+// caches it as read-only media, firmware writes no longer invalidate it nor scan the measurements
+#if CFG_UF2_APP_EXPORT
+    #undef CFG_UF2_MEASUREMENT_LUN
+    #define CFG_UF2_MEASUREMENT_LUN     (1)
+
+    // firmware volume diagnostics and bootloader RTC memory do not exist in the application
+    #undef CFG_UF2_BOOTLOG
+    #define CFG_UF2_BOOTLOG             (0)
+    #undef CFG_UF2_RETAINED_CACHE
+    #define CFG_UF2_RETAINED_CACHE      (0)
+    #undef CFG_UF2_WEAR
+    #define CFG_UF2_WEAR                (0)
+    #undef CFG_UF2_FILE_CONTAINER
+    #define CFG_UF2_FILE_CONTAINER      (0)
+    #undef CFG_UF2_LKG_SNAPSHOT
+    #define CFG_UF2_LKG_SNAPSHOT        (0)
+#endif
+
+#ifndef CFG_UF2_MEASUREMENT_LUN
+    #define CFG_UF2_MEASUREMENT_LUN     (0)
+#endif
+
+#if CFG_UF2_VOLUME_FIT && !CFG_UF2_MEASUREMENT_LUN
+    #error "CFG_UF2_VOLUME_FIT needs CFG_UF2_MEASUREMENT_LUN"
+#endif
+
+#ifndef UF2_MEASUREMENT_VOLUME_LABEL
+    #define UF2_MEASUREMENT_VOLUME_LABEL "MEASUREMENT"
+#endif
+
+// Accept Erase_Block from the host to clear measurement data
+#ifndef CFG_UF2_MEASUREMENT_ERASE
+    #define CFG_UF2_MEASUREMENT_ERASE   (0)
+#endif
+
+// FAT volume serial numbers derived from board_usb_get_serial(), so that hosts tell several devices
+// on one hub apart instead of caching them as the same volume
+#ifndef CFG_UF2_VOLUME_SERIAL_UNIQUE
+    #define CFG_UF2_VOLUME_SERIAL_UNIQUE  (0)
+#endif
+
+// Replace the end of the volume labels by this many hex digits of the USB serial, 0 keeps them
+#ifndef CFG_UF2_VOLUME_LABEL_SUFFIX
+    #define CFG_UF2_VOLUME_LABEL_SUFFIX   (0)
+#endif
+
+// STATUS.TXT: state of the update (READY, WRITING, DONE, FAILED) and USB serial, for flashing stations
+#ifndef CFG_UF2_STATUS
+    #define CFG_UF2_STATUS              (0)
+#endif
+
+// INFO.JSON: board, serial, partition sizes, app sha256, update state, measurement records and
+// STATS.TXT counters as one fixed size JSON object, for automation that would parse the text files
+#ifndef CFG_UF2_INFO_JSON
+    #define CFG_UF2_INFO_JSON           (0)
+#endif
+
+// CONFIG.TXT: device settings as key=value lines. Written back by the host, in place or as a new file
+// found by its root directory entry, the file is checked in full and stored with one NVS commit, no
+// reset. Keys are serial (12 hex digits) and the uint32 settings of CFG_UF2_CONFIG_U32, e.g.
+// { "interval", 1, 3600 }, : NVS key in "storage" and range. A new file written before its directory
+// entry is only found with CFG_UF2_WRITE_OVERLAY_SECTORS
+#ifndef CFG_UF2_CONFIG
+    #define CFG_UF2_CONFIG              (0)
+#endif
+
+#ifndef CFG_UF2_CONFIG_U32
+    #define CFG_UF2_CONFIG_U32
+#endif
+
+// Units with firmware readback disabled: 0 CURRENT.UF2 and DFU upload read ota0, 1 CURRENT.UF2 blocks
+// have a zero payload (and UF2_FLAG_NOFLASH) generated without flash access, 2 CURRENT.UF2 is empty.
+// DFU upload is empty in both
+#ifndef CFG_UF2_READBACK_PROTECT
+    #define CFG_UF2_READBACK_PROTECT    (0)
+#endif
+
+// CURRENT.BIN next to CURRENT.UF2: the app image bytes only, read like CURRENT.UF2 payloads. Half the
+// transfer of CURRENT.UF2 for backups and audits, left out with CFG_UF2_READBACK_PROTECT
+#ifndef CFG_UF2_CURRENT_BIN
+    #define CFG_UF2_CURRENT_BIN         (0)
+#endif
+
+// FLASH.BIN next to CURRENT.UF2: the whole flash chip from address 0, bootloader, partition table and every
+// partition, for forensic dumps at USB speed. Read by board_flash_chip_read(), the volume needs room for it
+// (UF2_FLASH_BIN of ports/espressif). Left out with CFG_UF2_READBACK_PROTECT
+#ifndef CFG_UF2_FLASH_BIN
+    #define CFG_UF2_FLASH_BIN           (0)
+#endif
+
+// Check the crc32 extension tag of UF2 blocks that carry one (uf2pack.py --crc) with board_crc32() or in
+// software. A corrupt block is dropped before it reaches flash and the image does not complete
+#ifndef CFG_UF2_BLOCK_CRC
+    #define CFG_UF2_BLOCK_CRC           (0)
+#endif
+
+// Accept Verify_Block from the host: ota0 ranges are hashed and compared, results are in VERIFY.TXT
+#ifndef CFG_UF2_VERIFY
+    #define CFG_UF2_VERIFY              (0)
+#endif
+
+// Number of ranges VERIFY.TXT reports, ranges of a longer verify file are dropped
+#ifndef CFG_UF2_VERIFY_RANGES
+    #define CFG_UF2_VERIFY_RANGES       (64)
+#endif
+
+// Expose up to this many measurement data partitions (board_measurement_partition_count()), the ones
+// after the first are raw files MEAS1.BIN.. of their written part in the partitions/ directory
+#ifndef CFG_UF2_MEASUREMENT_PARTITIONS
+    #define CFG_UF2_MEASUREMENT_PARTITIONS  (1)
+#endif
+
+// Render boot stage timestamps recorded through board_bootlog_mark() as BOOTLOG.TXT, see bootlog.h
+#ifndef CFG_UF2_BOOTLOG
+    #define CFG_UF2_BOOTLOG             (0)
+#endif
+
+// Keep serial number and measurement data size across resets in TINYUF2_RETAINED_ATTR memory, so that
+// DFU entry skips NVS and the measurement scan. Checksummed, refreshed on provisioning or routed writes
+#ifndef CFG_UF2_RETAINED_CACHE
+    #define CFG_UF2_RETAINED_CACHE      (0)
+#endif
+
+// Render erase counts per erase unit of the firmware flash from board_flash_wear_read() as WEAR.CSV
+#ifndef CFG_UF2_WEAR
+    #define CFG_UF2_WEAR                (0)
+#endif
+
+// Before an update first erases a part of the app, the port keeps what it held compressed (src/compress.c) in
+// a snapshot partition. A ROLLBACK block with the serial number of the device restores the image from it
+// through board_flash_rollback(), the device resets into it at eject. Needs CFG_UF2_HEATSHRINK
+#ifndef CFG_UF2_LKG_SNAPSHOT
+    #define CFG_UF2_LKG_SNAPSHOT        (0)
+#endif
+
 //--------------------------------------------------------------------+
 //
 //--------------------------------------------------------------------+
@@ -73,18 +300,72 @@ SOFTWARE.
 #define SERIALNUM_MAGIC_START1  0x3EaF393BUL // Randomly selected
 #define SERIALNUM_MAGIC_END     0x3CFD3E32UL // Ditto
 
+#define BENCH_MAGIC_START0      0x0A4E4542UL // "BEN\n"
+#define BENCH_MAGIC_START1      0x7A1C94D5UL // Randomly selected
+#define BENCH_MAGIC_END         0x5B06E1A9UL // Ditto
+
+#define ACK_MAGIC_START0        0x0A4B4341UL // "ACK\n"
+#define ACK_MAGIC_START1        0x6D1F3A27UL // Randomly selected
+#define ACK_MAGIC_END           0x2E94C5B8UL // Ditto
+
+#define ERASE_MAGIC_START0      0x0A415245UL // "ERA\n"
+#define ERASE_MAGIC_START1      0x5C2E71B3UL // Randomly selected
+#define ERASE_MAGIC_END         0x19D4A86FUL // Ditto
+
+#define SIGN_MAGIC_START0       0x0A474953UL // "SIG\n"
+#define SIGN_MAGIC_START1       0x8E3D0C61UL // Randomly selected
+#define SIGN_MAGIC_END          0x47B2F91DUL // Ditto
+
+#define VERIFY_MAGIC_START0     0x0A524556UL // "VER\n"
+#define VERIFY_MAGIC_START1     0xD1726B0EUL // Randomly selected
+#define VERIFY_MAGIC_END        0x3E95C4A7UL // Ditto
+
+#define ROLLBACK_MAGIC_START0   0x0A4C4F52UL // "ROL\n"
+#define ROLLBACK_MAGIC_START1   0x27B9E04DUL // Randomly selected
+#define ROLLBACK_MAGIC_END      0x6A13D85CUL // Ditto
+
 // If set, the block is "comment" and should not be flashed to the device
 #define UF2_FLAG_NOFLASH    0x00000001
+#define UF2_FLAG_FILE_CONTAINER 0x00001000 // payload is part of a file named after it, familyID holds its size
 #define UF2_FLAG_FAMILYID   0x00002000
+#define UF2_FLAG_MD5        0x00004000 // last 24 bytes of data: address, length and MD5 of a flash range
+#define UF2_FLAG_EXTENSION  0x00008000 // extension tags follow the payload, 4 byte aligned
+#define UF2_FLAG_HEATSHRINK 0x00100000 // ENERTY extension: payload is part of a compressed stream, see decompress.h
+#define UF2_FLAG_DELTA      0x00200000 // ENERTY extension: payload is part of a delta stream, see delta.h
+
+// ENERTY extension tag (size 8): crc32 (zlib) of the 32 byte header and the payload, CFG_UF2_BLOCK_CRC
+#define UF2_EXT_CRC32       0x6b2ec1
 
 #define MAX_BLOCKS (CFG_UF2_FLASH_SIZE / 256 + 100)
+
+// Blocks of one uf2 file
 typedef struct {
     uint32_t numBlocks;
     uint32_t numWritten;
 
+#if CFG_UF2_WRITE_RANGES
+    uint8_t rangeCount;
+    struct {
+        uint32_t start;
+        uint32_t end;         // exclusive
+    } written[CFG_UF2_WRITE_RANGES];
+#else
+    uint8_t writtenMask[MAX_BLOCKS / 8 + 1];
+#endif
+} WriteSession;
+
+typedef struct {
+    uint32_t numBlocks;       // of all files, 0xffffffff once there is one too many
+    uint32_t numWritten;
+
     bool aborted;             // aborting update and reset
+    bool serialWritten;       // serial number changed this session, device resets at DFU complete or eject
+    bool rolledBack;          // app restored from the snapshot, device resets at eject
 
-    uint8_t writtenMask[MAX_BLOCKS / 8 + 1];
+    uint32_t resumeAddr;      // flash below this address already holds the image, see board_flash_resume()
+
+    uint8_t sessionCount;
+    WriteSession session[CFG_UF2_WRITE_SESSIONS];
 } WriteState;
 
 typedef struct {
@@ -114,8 +395,116 @@ typedef struct {
     uint32_t magicEnd;
 } SerialNum_Block;
 
+// Throughput benchmark with CFG_UF2_STATS (tools/uf2bench.py): the host copies a file of numBlocks
+// of these, WRITE10 throughput is measured over them. The last one also runs board_flash_benchmark(),
+// results show up in STATS.TXT after the medium change
+typedef struct {
+    uint32_t magicStart0;
+    uint32_t magicStart1;
+    uint32_t blockNo;
+    uint32_t numBlocks;
+    uint32_t magicEnd;
+} Bench_Block;
+
+// Measurement download acknowledge with CFG_UF2_MEASUREMENT_BINARY: the host copies a file holding
+// this block after it has stored NEW.CSV. Records up to timestamp are then left out of NEW.CSV,
+// the watermark is kept in NVS. ACK_TIMESTAMP_ALL acknowledges every record present
+#define ACK_TIMESTAMP_ALL       0xFFFFFFFFUL
+
+typedef struct {
+    uint32_t magicStart0;
+    uint32_t magicStart1;
+    uint32_t timestamp;
+    uint32_t magicEnd;
+} Ack_Block;
+
+// Measurement erase with CFG_UF2_MEASUREMENT_ERASE: the host copies a file holding this block after it
+// has stored the measurement files. Data is erased in the background by board_measurement_erase(),
+// measurement files are empty from then on. serialNumber must be the one of the device, so that
+// the file copied to another module by mistake does not clear it
+typedef struct {
+    uint32_t magicStart0;
+    uint32_t magicStart1;
+    uint8_t serialNumber[6];
+    uint8_t pad0[2];
+    uint32_t magicEnd;
+} Erase_Block;
+
+// Rollback with CFG_UF2_LKG_SNAPSHOT: the host copies a file holding this block (made by
+// tools/uf2pack.py --rollback) to restore the app that was in ota0 before the last update.
+// serialNumber must be the one of the device, as for Erase_Block
+typedef struct {
+    uint32_t magicStart0;
+    uint32_t magicStart1;
+    uint8_t serialNumber[6];
+    uint8_t pad0[2];
+    uint32_t magicEnd;
+} Rollback_Block;
+
+// Signed update with BOARD_UF2_SIGN_PUBKEY: first sector of the uf2 file made by tools/uf2sign.py.
+// signature is ECDSA P-256 (r || s, big endian) over the sha256 of the first imageLen bytes of ota0
+// as flashed, checked by board_flash_verify() before the image is made bootable
+typedef struct {
+    uint32_t magicStart0;
+    uint32_t magicStart1;
+    uint32_t imageLen;
+    uint8_t signature[64];
+    uint32_t magicEnd;
+} Sign_Block;
+
+// Verify-only audit with CFG_UF2_VERIFY: file made by tools/uf2verify.py, one sector per up to 12
+// ranges of ota0 with their sha256. Nothing is written, each range is reported as matching or
+// differing in VERIFY.TXT. blockNo 0 starts a new report
+#define VERIFY_BLOCK_RANGES     12
+
+typedef struct {
+    uint32_t magicStart0;
+    uint32_t magicStart1;
+    uint32_t blockNo;
+    uint32_t count;
+    struct {
+        uint32_t addr;
+        uint32_t len;
+        uint8_t sha256[32];
+    } ranges[VERIFY_BLOCK_RANGES];
+    uint32_t magicEnd;
+} Verify_Block;
+
 void uf2_init(void);
+bool uf2_ready(void);
+
+#if !CFG_UF2_APP_EXPORT
 void uf2_read_block(uint32_t block_no, uint8_t *data);
+void uf2_read_blocks(uint32_t block_no, uint32_t block_count, uint8_t *data);
+void uf2_read_ahead(uint32_t block_no, uint32_t block_count);
+bool uf2_refresh(void);
+
+// Capacity of the firmware volume, CFG_UF2_NUM_BLOCKS unless fitted by CFG_UF2_VOLUME_FIT
+uint32_t uf2_block_count(void);
+#endif
+
+#if CFG_UF2_MEASUREMENT_LUN
+// Read-only measurement volume, same geometry as the firmware one
+void uf2_measurement_read_blocks(uint32_t block_no, uint32_t block_count, uint8_t *data);
+void uf2_measurement_read_ahead(uint32_t block_no, uint32_t block_count);
+bool uf2_measurement_refresh(void);
+#endif
+
+// Size and scan unit of valid measurement data in ota1, scanned on each call
+uint32_t uf2_measurement_data_size(void);
+uint32_t uf2_measurement_unit_size(void);
+
+// Read measurement data as one ordered stream: ota1 as is, or the records of CFG_UF2_MEASUREMENT_RING
+void uf2_measurement_data_read(uint32_t offset, void* buffer, uint32_t len);
+void uf2_measurement_data_read_ahead(uint32_t offset, uint32_t len);
+
+#if CFG_UF2_APP_EXPORT
+// Application appended or rewrote measurement data: drop cached ota1 sectors, the host is told
+// of the medium change on its next TEST UNIT READY
+void uf2_measurement_changed(void);
+#else
 int  uf2_write_block(uint32_t block_no, uint8_t *data, WriteState *state);
+uint32_t uf2_write_blocks(uint32_t block_no, uint8_t *data, uint32_t count, WriteState *state);
+#endif
 
 #endif
@@ -33,6 +33,12 @@ enum {
   ITF_NUM_CDC_DATA,
 #endif
   ITF_NUM_MSC,
+#if CFG_TUD_VENDOR
+  ITF_NUM_VENDOR,
+#endif
+#if CFG_TUD_DFU
+  ITF_NUM_DFU,
+#endif
   ITF_NUM_TOTAL
 };
 
@@ -47,6 +53,12 @@ enum {
   STRID_CDC_DATA,
 #endif
   STRID_MSC,
+#if CFG_TUD_VENDOR
+  STRID_VENDOR,
+#endif
+#if CFG_TUD_DFU
+  STRID_DFU,
+#endif
 };
 
 //--------------------------------------------------------------------+
@@ -55,7 +67,12 @@ enum {
 tusb_desc_device_t TINYUF2_CONST desc_device = {
     .bLength            = sizeof(tusb_desc_device_t),
     .bDescriptorType    = TUSB_DESC_DEVICE,
+#if CFG_TUD_VENDOR
+    // 2.1 for the BOS descriptor
+    .bcdUSB             = 0x0210,
+#else
     .bcdUSB             = 0x0200,
+#endif
 #if CFG_TUD_CDC
     // Use Interface Association Descriptor (IAD) for CDC
     .bDeviceClass       = TUSB_CLASS_MISC,
@@ -87,12 +104,20 @@ uint8_t const* tud_descriptor_device_cb(void) {
 //--------------------------------------------------------------------+
 
 #define CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + TUD_MSC_DESC_LEN + \
-                           CFG_TUD_CDC*TUD_CDC_DESC_LEN + CFG_TUD_VENDOR*TUD_VENDOR_DESC_LEN)
+                           CFG_TUD_CDC*TUD_CDC_DESC_LEN + CFG_TUD_VENDOR*TUD_VENDOR_DESC_LEN + \
+                           CFG_TUD_DFU*TUD_DFU_DESC_LEN(1))
+
+// DFU: download and upload of the app, complete after DFU_DETACH (dfu-util -e)
+#define DFU_ATTRIBUTES    (DFU_ATTR_CAN_DOWNLOAD | DFU_ATTR_CAN_UPLOAD | DFU_ATTR_MANIFESTATION_TOLERANT | DFU_ATTR_WILL_DETACH)
 
 // MSC is mandatory, use endpoint 1
 #define EPNUM_MSC_OUT     0x01
 #define EPNUM_MSC_IN      0x81
 
+// Vendor bulk flashing, clear of both CDC numberings
+#define EPNUM_VENDOR_OUT  0x06
+#define EPNUM_VENDOR_IN   0x86
+
 // Board/Port can force CDC endpoint numbering
 #if defined(BOARD_EPNUM_CDC_OUT) && defined(BOARD_EPNUM_CDC_IN) && defined(BOARD_EPNUM_CDC_NOTIF)
   #define EPNUM_CDC_NOTIF   BOARD_EPNUM_CDC_NOTIF
@@ -113,6 +138,14 @@ uint8_t TINYUF2_CONST desc_configuration[] = {
 #endif
     // Interface number, string index, EP Out & EP In address, EP size
     TUD_MSC_DESCRIPTOR(ITF_NUM_MSC, STRID_MSC, EPNUM_MSC_OUT, EPNUM_MSC_IN, TUD_OPT_HIGH_SPEED ? 512 : 64),
+#if CFG_TUD_VENDOR
+    // Interface number, string index, EP Out & IN address, EP size
+    TUD_VENDOR_DESCRIPTOR(ITF_NUM_VENDOR, STRID_VENDOR, EPNUM_VENDOR_OUT, EPNUM_VENDOR_IN, TUD_OPT_HIGH_SPEED ? 512 : 64),
+#endif
+#if CFG_TUD_DFU
+    // Interface number, alternate count, starting string index, attributes, detach timeout, transfer size
+    TUD_DFU_DESCRIPTOR(ITF_NUM_DFU, 1, STRID_DFU, DFU_ATTRIBUTES, 1000, CFG_TUD_DFU_XFER_BUFSIZE),
+#endif
 };
 
 
@@ -126,6 +159,76 @@ uint8_t const* tud_descriptor_configuration_cb(uint8_t index) {
   return desc_configuration;
 }
 
+#if CFG_TUD_VENDOR
+//--------------------------------------------------------------------+
+// BOS Descriptor
+// MS OS 2.0 descriptor set: Windows binds WinUSB to the vendor flashing interface on first plug-in,
+// no driver installation. Fetched with a vendor request bRequest = VENDOR_REQUEST_MICROSOFT, wIndex 7
+//--------------------------------------------------------------------+
+
+#define VENDOR_REQUEST_MICROSOFT  0x01
+
+#define BOS_TOTAL_LEN       (TUD_BOS_DESC_LEN + TUD_BOS_MICROSOFT_OS_DESC_LEN)
+#define MS_OS_20_DESC_LEN   0xB2
+
+uint8_t TINYUF2_CONST desc_bos[] = {
+    // total length, number of device caps
+    TUD_BOS_DESCRIPTOR(BOS_TOTAL_LEN, 1),
+
+    // Microsoft OS 2.0 descriptor
+    TUD_BOS_MS_OS_20_DESCRIPTOR(MS_OS_20_DESC_LEN, VENDOR_REQUEST_MICROSOFT)
+};
+
+uint8_t const* tud_descriptor_bos_cb(void) {
+  return desc_bos;
+}
+
+uint8_t TINYUF2_CONST desc_ms_os_20[] = {
+    // Set header: length, type, windows version (8.1 and later), total length
+    U16_TO_U8S_LE(0x000A), U16_TO_U8S_LE(MS_OS_20_SET_HEADER_DESCRIPTOR), U32_TO_U8S_LE(0x06030000), U16_TO_U8S_LE(MS_OS_20_DESC_LEN),
+
+    // Configuration subset header: length, type, configuration index, reserved, configuration total length
+    U16_TO_U8S_LE(0x0008), U16_TO_U8S_LE(MS_OS_20_SUBSET_HEADER_CONFIGURATION), 0, 0, U16_TO_U8S_LE(MS_OS_20_DESC_LEN - 0x0A),
+
+    // Function subset header: length, type, first interface, reserved, subset length
+    U16_TO_U8S_LE(0x0008), U16_TO_U8S_LE(MS_OS_20_SUBSET_HEADER_FUNCTION), ITF_NUM_VENDOR, 0, U16_TO_U8S_LE(MS_OS_20_DESC_LEN - 0x0A - 0x08),
+
+    // Compatible ID: length, type, compatible ID, sub compatible ID
+    U16_TO_U8S_LE(0x0014), U16_TO_U8S_LE(MS_OS_20_FEATURE_COMPATBLE_ID), 'W', 'I', 'N', 'U', 'S', 'B', 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+
+    // Registry property: length, type, data type REG_MULTI_SZ, name length, "DeviceInterfaceGUIDs" in UTF-16
+    U16_TO_U8S_LE(MS_OS_20_DESC_LEN - 0x0A - 0x08 - 0x08 - 0x14), U16_TO_U8S_LE(MS_OS_20_FEATURE_REG_PROPERTY),
+    U16_TO_U8S_LE(0x0007), U16_TO_U8S_LE(0x002A),
+    'D', 0x00, 'e', 0x00, 'v', 0x00, 'i', 0x00, 'c', 0x00, 'e', 0x00, 'I', 0x00, 'n', 0x00, 't', 0x00, 'e', 0x00,
+    'r', 0x00, 'f', 0x00, 'a', 0x00, 'c', 0x00, 'e', 0x00, 'G', 0x00, 'U', 0x00, 'I', 0x00, 'D', 0x00, 's', 0x00,
+    0x00, 0x00,
+
+    // data length, interface GUID of the flashing interface, double null terminated
+    U16_TO_U8S_LE(0x0050),
+    '{', 0x00, '4', 0x00, '8', 0x00, 'F', 0x00, '0', 0x00, 'E', 0x00, '1', 0x00, '4', 0x00, 'F', 0x00, '-', 0x00,
+    'D', 0x00, '3', 0x00, '8', 0x00, '4', 0x00, '-', 0x00, '4', 0x00, '4', 0x00, '1', 0x00, '0', 0x00, '-', 0x00,
+    '8', 0x00, '1', 0x00, 'C', 0x00, '8', 0x00, '-', 0x00, '3', 0x00, 'C', 0x00, '3', 0x00, '1', 0x00, '8', 0x00,
+    '8', 0x00, 'F', 0x00, '4', 0x00, 'E', 0x00, '7', 0x00, 'A', 0x00, 'C', 0x00, '}', 0x00,
+    0x00, 0x00, 0x00, 0x00
+};
+
+TU_VERIFY_STATIC(sizeof(desc_ms_os_20) == MS_OS_20_DESC_LEN, "Incorrect size");
+
+// Invoked for vendor control requests, only the MS OS 2.0 descriptor set is answered
+bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const* request) {
+  if (stage != CONTROL_STAGE_SETUP) return true;
+
+  if (request->bmRequestType_bit.type == TUSB_REQ_TYPE_VENDOR && request->bRequest == VENDOR_REQUEST_MICROSOFT &&
+      request->wIndex == 7) {
+    return tud_control_xfer(rhport, request, (void*) (uintptr_t) desc_ms_os_20, MS_OS_20_DESC_LEN);
+  }
+
+  // stall unknown request
+  return false;
+}
+#endif
+
 //--------------------------------------------------------------------+
 // String Descriptors
 //--------------------------------------------------------------------+
@@ -144,6 +247,12 @@ char const* string_desc_arr[] = {
     NULL,
 #endif
     "UF2",                         // 4: MSC Interface
+#if CFG_TUD_VENDOR
+    "TinyUF2 Flash",               // 5: Vendor Interface
+#endif
+#if CFG_TUD_DFU
+    "TinyUF2 DFU",                 // 6: DFU Interface, alt 0 is the app partition
+#endif
 };
 
 static uint16_t _desc_str[48 + 1];
@@ -0,0 +1,220 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "tusb.h"
+#include "vendor.h"
+
+#if CFG_TUD_VENDOR
+
+//--------------------------------------------------------------------+
+// MACRO TYPEDEF CONSTANT ENUM DECLARATION
+//--------------------------------------------------------------------+
+
+// request being collected, followed by data of a WRITE
+static vendor_request_t _req;
+static uint32_t _req_count = 0;
+
+static uint8_t _data[CFG_UF2_VENDOR_CHUNK_MAX] __attribute__((aligned(4)));
+static uint32_t _data_count = 0;
+
+static uint32_t _image_len = 0;
+static bool _begun = false;
+static bool _rejected = false;
+static bool _verified = false;
+
+//--------------------------------------------------------------------+
+//
+//--------------------------------------------------------------------+
+
+// crc32 as zlib, 4 bits at a time
+static uint32_t crc32_update(uint32_t crc, uint8_t const* data, uint32_t len) {
+  static uint32_t const table[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+  };
+
+  crc = ~crc;
+  while (len--) {
+    crc ^= *data++;
+    crc = (crc >> 4) ^ table[crc & 0x0f];
+    crc = (crc >> 4) ^ table[crc & 0x0f];
+  }
+  return ~crc;
+}
+
+static void respond(uint8_t status, uint32_t value) {
+  vendor_response_t const resp = {
+    .magic  = VENDOR_MAGIC,
+    .cmd    = (uint8_t) _req.cmd,
+    .status = status,
+    .value  = value,
+  };
+
+  tud_vendor_write(&resp, sizeof(resp));
+  tud_vendor_write_flush();
+}
+
+static void cmd_begin(void) {
+  if (_req.len == 0 || _req.len > board_flash_size()) {
+    respond(VENDOR_STATUS_BAD_ADDR, 0);
+    return;
+  }
+
+  _image_len = _req.len;
+  _begun = true;
+  _rejected = false;
+  _verified = false;
+
+  indicator_set(STATE_WRITING_STARTED);
+  respond(VENDOR_STATUS_OK, CFG_UF2_VENDOR_CHUNK_MAX);
+}
+
+static void cmd_write(void) {
+  uint32_t const addr = _req.addr;
+  uint32_t const len = _req.len;
+
+  if (!_begun) {
+    respond(VENDOR_STATUS_BAD_REQUEST, 0);
+    return;
+  }
+
+  if (crc32_update(0, _data, len) != _req.crc) {
+    respond(VENDOR_STATUS_BAD_CRC, 0);
+    return;
+  }
+
+  if (addr >= _image_len || len > _image_len - addr) {
+    respond(VENDOR_STATUS_BAD_ADDR, 0);
+    return;
+  }
+
+  // wrong image is rejected before anything is erased, remaining writes are dropped until next BEGIN
+  if (addr == 0 && board_flash_check_image && !board_flash_check_image(0, _data, len)) {
+    TUF2_LOG1("Image rejected\r\n");
+    _rejected = true;
+  }
+  if (_rejected) {
+    respond(VENDOR_STATUS_REJECTED, 0);
+    return;
+  }
+
+  // chunks are sent in ascending order, remaining image follows this one
+  if (board_flash_erase_ahead) board_flash_erase_ahead(addr, _image_len - addr);
+
+  // blocks until a write window is free, USB NAKs further data meanwhile
+  board_flash_write(addr, _data, len);
+  _verified = false;
+
+  respond(VENDOR_STATUS_OK, addr + len);
+}
+
+static void cmd_finish(void) {
+  if (!_begun || _rejected) {
+    respond(VENDOR_STATUS_BAD_REQUEST, 0);
+    return;
+  }
+
+  board_flash_flush();
+
+  bool ok = !board_flash_verify || board_flash_verify();
+
+  uint32_t crc = 0;
+  if (board_flash_crc32) {
+    crc = board_flash_crc32(0, _image_len);
+    if (crc != _req.crc) ok = false;
+  }
+
+  _verified = ok;
+  respond(ok ? VENDOR_STATUS_OK : VENDOR_STATUS_VERIFY_FAIL, crc);
+}
+
+static void cmd_reset(void) {
+  // only boot an image that has been verified
+  if (!_verified) {
+    respond(VENDOR_STATUS_BAD_REQUEST, 0);
+    return;
+  }
+
+  TUF2_LOG1("Writing finished\r\n");
+  indicator_set(STATE_WRITING_FINISHED);
+  board_dfu_complete();
+
+  // board_dfu_complete() should not return
+  while (1) {}
+}
+
+static void process_request(void) {
+  // USB is started before the flash
+  if (!uf2_ready()) {
+    respond(VENDOR_STATUS_NOT_READY, 0);
+    return;
+  }
+
+  switch (_req.cmd) {
+    case VENDOR_CMD_BEGIN : cmd_begin();  break;
+    case VENDOR_CMD_WRITE : cmd_write();  break;
+    case VENDOR_CMD_FINISH: cmd_finish(); break;
+    case VENDOR_CMD_RESET : cmd_reset();  break;
+    default: respond(VENDOR_STATUS_BAD_REQUEST, 0); break;
+  }
+}
+
+//--------------------------------------------------------------------+
+// tinyusb callbacks
+//--------------------------------------------------------------------+
+
+// Invoked when vendor bulk OUT data is received, runs in usbd task
+void tud_vendor_rx_cb(uint8_t itf) {
+  (void) itf;
+
+  while (tud_vendor_available()) {
+    if (_req_count < sizeof(_req)) {
+      _req_count += tud_vendor_read((uint8_t*) &_req + _req_count, sizeof(_req) - _req_count);
+      if (_req_count < sizeof(_req)) continue;
+
+      // out of sync with host: drop what has been received so far, host has to start over
+      if (_req.magic != VENDOR_MAGIC || (_req.cmd == VENDOR_CMD_WRITE && (_req.len == 0 || _req.len > sizeof(_data)))) {
+        while (tud_vendor_available()) (void) tud_vendor_read(_data, sizeof(_data));
+        respond(VENDOR_STATUS_BAD_REQUEST, 0);
+        _req_count = 0;
+        continue;
+      }
+
+      _data_count = 0;
+      if (_req.cmd != VENDOR_CMD_WRITE) {
+        process_request();
+        _req_count = 0;
+      }
+    } else {
+      _data_count += tud_vendor_read(_data + _data_count, _req.len - _data_count);
+      if (_data_count == _req.len) {
+        process_request();
+        _req_count = 0;
+      }
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 ENERTY
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#ifndef TUF2_VENDOR_H_
+#define TUF2_VENDOR_H_
+
+#include "uf2.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Raw image flashing over the vendor bulk interface, without FAT emulation and UF2 envelope.
+// Host sends a 20 byte request, all values little endian: magic, cmd, addr, len, crc32.
+// WRITE is followed by len bytes of image data at addr (offset in the app partition), crc32 is
+// that of the data. Every request is answered by a 12 byte response: magic, cmd, status, value.
+// Host may queue several WRITEs before reading their responses. tools/uf2vendor.py implements
+// the host side.
+//   BEGIN : len = image size, erases ahead. value = maximum WRITE length
+//   WRITE : data is checked and written, image header is checked with the chunk at address 0
+//   FINISH: flush and verify, crc32 = crc32 of the whole image [0, len). value = flash crc32
+//   RESET : complete DFU, boots the new image (no response)
+//--------------------------------------------------------------------+
+
+#define VENDOR_MAGIC          0x42465554UL // "TUFB"
+
+// Largest WRITE payload, one flash write window is a good fit
+#ifndef CFG_UF2_VENDOR_CHUNK_MAX
+  #define CFG_UF2_VENDOR_CHUNK_MAX  4096
+#endif
+
+enum {
+  VENDOR_CMD_BEGIN  = 0x01,
+  VENDOR_CMD_WRITE  = 0x02,
+  VENDOR_CMD_FINISH = 0x03,
+  VENDOR_CMD_RESET  = 0x04,
+};
+
+enum {
+  VENDOR_STATUS_OK = 0,
+  VENDOR_STATUS_BAD_REQUEST,  // unknown command, bad magic or length
+  VENDOR_STATUS_BAD_CRC,      // data does not match its crc32
+  VENDOR_STATUS_BAD_ADDR,     // outside of the app partition
+  VENDOR_STATUS_REJECTED,     // image does not fit this board, see board_flash_check_image()
+  VENDOR_STATUS_VERIFY_FAIL,  // flash does not match written data or image crc32
+  VENDOR_STATUS_NOT_READY,    // tinyuf2 is still starting up, send again
+};
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint32_t cmd;
+  uint32_t addr;
+  uint32_t len;
+  uint32_t crc;
+} vendor_request_t;
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint8_t  cmd;
+  uint8_t  status;
+  uint16_t reserved;
+  uint32_t value;
+} vendor_response_t;
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif
@@ -0,0 +1,179 @@
+#!/usr/bin/env python3
+"""Generate src/splash.c: the static part of the drag & drop screen as run-length encoded lines.
+
+Bars, icons and fixed texts of render_drag() in src/screen.c are rasterized here from the
+bitmaps in src/images.c. Board-specific elements (title, version, volume label) and the progress
+bar are still drawn by the bootloader on top. Re-run after changing either file:
+
+    python3 tools/gen_splash.py
+"""
+
+import os
+import re
+import sys
+
+TOP = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+
+# palette indices, same as screen.c
+COLOR_BLACK = 0
+COLOR_WHITE = 1
+COLOR_ORANGE = 4
+COLOR_GREEN = 7
+COLOR_BLUE = 8
+
+# lines (display x) and pixels per line covered by the splash
+SPLASH_HEIGHT = 121
+
+
+def load_images(path):
+    with open(path) as f:
+        src = f.read()
+    images = {}
+    for name, body in re.findall(r'const uint8_t (\w+)\[\] = \{(.*?)\};', src, re.S):
+        body = re.sub(r'//.*', '', body)
+        images[name] = [int(v, 0) for v in body.replace('\n', ' ').split(',') if v.strip()]
+    return images
+
+
+class Canvas:
+    def __init__(self, width, height):
+        self.width = width
+        self.height = height
+        self.px = [[COLOR_BLACK] * height for _ in range(width)]
+
+    def set(self, x, y, color):
+        if 0 <= x < self.width and 0 <= y < self.height:
+            self.px[x][y] = color
+
+    def bar(self, y, h, color):
+        for x in range(self.width):
+            for j in range(h):
+                self.set(x, y + j, color)
+
+    def printch(self, x, y, color, fnt):
+        for i in range(6):
+            for j in range(8):
+                if fnt[i] & (1 << j):
+                    self.set(x + i, y + j, color)
+
+    def print(self, x, y, color, text, font8):
+        for c in text:
+            c = ord(c)
+            if c < 0x20 or c >= 0x7f:
+                c = ord('?')
+            c -= 0x20
+            self.printch(x, y, color, font8[c * 6:c * 6 + 6])
+            x += 6
+
+    # same decoder as printicon() in screen.c
+    def icon(self, x, y, color, data):
+        w, h = data[0], data[1]
+        data = data[3:]
+        pos = 0
+        mask = 0x80
+        runlen = 0
+        runbit = 0
+        lastb = 0
+        for i in range(w):
+            j = 0
+            while j < h:
+                if mask != 0x80:
+                    c = lastb & mask
+                    mask = (mask << 1) & 0xff
+                elif runlen:
+                    c = runbit
+                    runlen -= 1
+                else:
+                    lastb = data[pos]
+                    pos += 1
+                    if lastb & 0x80:
+                        runlen = lastb & 63
+                        runbit = lastb & 0x40
+                    else:
+                        mask = 0x01
+                    continue
+                if c:
+                    self.set(x + i, y + j, color)
+                j += 1
+
+
+def render(images, width):
+    cv = Canvas(width, SPLASH_HEIGHT)
+    cv.bar(0, 52, COLOR_GREEN)
+    cv.bar(52, 55, COLOR_BLUE)
+    cv.bar(107, 14, COLOR_ORANGE)
+
+    font8 = images['font8']
+    cv.print(23, 110, COLOR_WHITE, 'circuitpython.org', font8)
+
+    drag, dragx = 70, 10
+    cv.icon(dragx + 20, drag + 5, COLOR_WHITE, images['fileLogo'])
+    cv.icon(dragx + 66, drag, COLOR_WHITE, images['arrowLogo'])
+    cv.icon(dragx + 108, drag, COLOR_WHITE, images['pendriveLogo'])
+    cv.print(10, drag - 12, COLOR_WHITE, 'firmware.uf2', font8)
+    return cv
+
+
+# runs of up to 16 pixels: color index in high nibble, length - 1 in low nibble
+def encode_line(line):
+    runs = []
+    y = 0
+    while y < len(line):
+        n = 1
+        while y + n < len(line) and n < 16 and line[y + n] == line[y]:
+            n += 1
+        runs.append((line[y] << 4) | (n - 1))
+        y += n
+    return runs
+
+
+def main():
+    images = load_images(os.path.join(TOP, 'src', 'images.c'))
+
+    cv = render(images, 320)
+    plain = cv.px[0]
+
+    # lines past the last one with icons or text are plain bars, the last line stored is repeated
+    count = max(x for x in range(cv.width) if cv.px[x] != plain) + 2
+
+    runs = []
+    index = []
+    offsets = {}
+    for x in range(count):
+        key = tuple(cv.px[x])
+        if key not in offsets:
+            offsets[key] = len(runs)
+            runs += encode_line(cv.px[x])
+        index.append(offsets[key])
+
+    out = []
+    out.append('// Generated by tools/gen_splash.py from the static part of the drag & drop screen, do not edit')
+    out.append('')
+    out.append('#include <stdint.h>')
+    out.append('')
+    out.append('// lines (display x) stored, later lines repeat the last one')
+    out.append('const uint16_t splash_lines = %d;' % count)
+    out.append('')
+    out.append('// pixels per line, the rest of the line is black')
+    out.append('const uint16_t splash_height = %d;' % SPLASH_HEIGHT)
+    out.append('')
+    out.append('// offset of each line in splash_runs, identical lines share their runs')
+    out.append('const uint16_t splash_index[] = {')
+    for i in range(0, len(index), 16):
+        out.append('  ' + ', '.join(str(v) for v in index[i:i + 16]) + ',')
+    out.append('};')
+    out.append('')
+    out.append('// palette index << 4 | (run length - 1)')
+    out.append('const uint8_t splash_runs[] = {')
+    for i in range(0, len(runs), 16):
+        out.append('  ' + ', '.join('0x%02x' % v for v in runs[i:i + 16]) + ',')
+    out.append('};')
+
+    with open(os.path.join(TOP, 'src', 'splash.c'), 'w') as f:
+        f.write('\n'.join(out) + '\n')
+
+    print('%d lines, %d unique, %d bytes of runs' % (count, len(offsets), len(runs)))
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+"""
+Convert measurement records to the packed ota1 format (CFG_UF2_MEASUREMENT_PACKED) and back, see
+src/measurement_pack.h. Reference encoder for the application and test data for the bootloader.
+
+    python3 tools/measurement_pack.py encode MEASDAT.BIN ota1.bin
+    python3 tools/measurement_pack.py decode ota1.bin records.bin
+
+Input records are MEASDAT.BIN (header is skipped) or a raw record array, 32-bit timestamp and three
+CT values of --ct-bytes each, little endian.
+"""
+import argparse
+import struct
+import sys
+import zlib
+
+MAGIC = 0x4B41504D
+BIN_MAGIC = 0x5441444D
+SECTOR_SIZE = 4096
+TAG_END = 0xFF
+
+# bytes per size code
+CODE_LEN = (0, 1, 2, 4)
+
+
+def record_format(ct_bytes):
+    return '<I3' + {1: 'b', 2: 'h', 4: 'i'}[ct_bytes]
+
+
+def header_format(ct_bytes):
+    return '<IIHHI' + record_format(ct_bytes)[1:]
+
+
+def zigzag(v):
+    v &= 0xFFFFFFFF
+    v = v - (1 << 32) if v & 0x80000000 else v
+    return ((v << 1) ^ (v >> 31)) & 0xFFFFFFFF
+
+
+def unzigzag(v):
+    return (v >> 1) ^ -(v & 1)
+
+
+def code_of(v):
+    return 0 if v == 0 else 1 if v < 0x100 else 2 if v < 0x10000 else 3
+
+
+def wrap(v, bits):
+    v &= (1 << bits) - 1
+    return v - (1 << bits) if v >> (bits - 1) else v
+
+
+def read_records(path, ct_bytes):
+    with open(path, 'rb') as f:
+        data = f.read()
+    fmt = record_format(ct_bytes)
+    size = struct.calcsize(fmt)
+    if len(data) >= 4 and struct.unpack_from('<I', data)[0] == BIN_MAGIC:
+        data = data[struct.unpack_from('<H', data, 4)[0]:]
+    return [struct.unpack_from(fmt, data, i) for i in range(0, len(data) - size + 1, size)]
+
+
+def entry(prev, rec, interval, ct_bits):
+    dt = (rec[0] - prev[0]) & 0xFFFFFFFF
+    values = [zigzag(dt - interval)] + [zigzag(wrap(rec[i] - prev[i], ct_bits)) for i in range(1, 4)]
+    tag = 0
+    payload = b''
+    for c, v in enumerate(values):
+        code = code_of(v)
+        tag |= code << (2 * c)
+        payload += v.to_bytes(4, 'little')[:CODE_LEN[code]]
+    return tag, bytes([tag]) + payload, dt
+
+
+def encode(records, ct_bytes, close_last):
+    hfmt = header_format(ct_bytes)
+    hsize = struct.calcsize(hfmt)
+    payload_max = SECTOR_SIZE - hsize
+    ct_bits = 8 * ct_bytes
+    blocks = []
+
+    i = 0
+    while i < len(records):
+        first = records[i]
+        prev, interval, payload, count = first, 0, b'', 1
+        i += 1
+        while i < len(records):
+            tag, e, dt = entry(prev, records[i], interval, ct_bits)
+            if tag == TAG_END or len(payload) + len(e) > payload_max:
+                break
+            payload += e
+            prev, interval = records[i], dt
+            count += 1
+            i += 1
+
+        is_open = not close_last and i == len(records)
+        crc = zlib.crc32(b''.join(struct.pack(record_format(ct_bytes), *r) for r in records[i - count:i]))
+        hdr = struct.pack(hfmt, MAGIC, i - count, 0xFFFF if is_open else count,
+                          0xFFFF if is_open else len(payload), 0xFFFFFFFF if is_open else crc, *first)
+        blocks.append((hdr + payload).ljust(SECTOR_SIZE, b'\xff'))
+    return b''.join(blocks)
+
+
+def decode(image, ct_bytes):
+    hfmt = header_format(ct_bytes)
+    hsize = struct.calcsize(hfmt)
+    ct_bits = 8 * ct_bytes
+    records = []
+
+    for base in range(0, len(image) - SECTOR_SIZE + 1, SECTOR_SIZE):
+        magic, first_index, count, size, crc, *rec = struct.unpack_from(hfmt, image, base)
+        if magic != MAGIC:
+            break
+        if first_index != len(records):
+            sys.exit('error: block at 0x%x starts at record %d, expected %d' % (base, first_index, len(records)))
+        payload = image[base + hsize:base + (hsize + size if size != 0xFFFF else SECTOR_SIZE)]
+        records.append(tuple(rec))
+        pos, interval = 0, 0
+        while pos < len(payload) and (count == 0xFFFF or len(records) - first_index < count):
+            tag = payload[pos]
+            if tag == TAG_END:
+                break
+            pos += 1
+            values = []
+            for c in range(4):
+                n = CODE_LEN[(tag >> (2 * c)) & 3]
+                values.append(unzigzag(int.from_bytes(payload[pos:pos + n], 'little')))
+                pos += n
+            interval = (interval + values[0]) & 0xFFFFFFFF
+            rec = [(rec[0] + interval) & 0xFFFFFFFF] + [wrap(rec[i] + values[i], ct_bits) for i in range(1, 4)]
+            records.append(tuple(rec))
+        if count != 0xFFFF:
+            data = b''.join(struct.pack(record_format(ct_bytes), *r) for r in records[first_index:])
+            if zlib.crc32(data) != crc:
+                print('warning: block at 0x%x fails its crc32' % base, file=sys.stderr)
+    return records
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('command', choices=('encode', 'decode'))
+    parser.add_argument('input')
+    parser.add_argument('output')
+    parser.add_argument('--ct-bytes', type=int, choices=(1, 2, 4), default=2,
+                        help='size of CFG_UF2_MEASUREMENT_CT_TYPE (default: %(default)s)')
+    parser.add_argument('--open', action='store_true', help='leave the last block open like a running writer')
+    args = parser.parse_args()
+
+    fmt = record_format(args.ct_bytes)
+    if args.command == 'encode':
+        records = read_records(args.input, args.ct_bytes)
+        image = encode(records, args.ct_bytes, not args.open)
+        with open(args.output, 'wb') as f:
+            f.write(image)
+        raw = len(records) * struct.calcsize(fmt)
+        print('%d records, %d bytes raw, %d blocks of %d bytes (%.1fx)' %
+              (len(records), raw, len(image) // SECTOR_SIZE, SECTOR_SIZE, raw / len(image) if image else 0))
+    else:
+        with open(args.input, 'rb') as f:
+            records = decode(f.read(), args.ct_bytes)
+        with open(args.output, 'wb') as f:
+            f.write(b''.join(struct.pack(fmt, *r) for r in records))
+        print('%d records' % len(records))
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""
+Incrementally sync measurement data of a device in tinyuf2 over CDC (CFG_UF2_MEASUREMENT_CDC),
+see src/measurement_cdc.h for the protocol. Data is appended to a local file, only units after
+its current end are downloaded. Needs pyserial.
+"""
+import argparse
+import struct
+import sys
+import zlib
+
+try:
+    import serial
+except ImportError:
+    sys.exit('error: pyserial is required (pip install pyserial)')
+
+MAGIC = 0x4344434D
+
+CMD_INFO = 0x01
+CMD_FIND = 0x02
+CMD_READ = 0x03
+
+STATUS = ['ok', 'bad request', 'bad range', 'not ready']
+
+
+def request(port, cmd, arg0=0, arg1=0):
+    port.write(struct.pack('<4I', MAGIC, cmd, arg0, arg1))
+
+
+def response(port, cmd):
+    hdr = port.read(16)
+    if len(hdr) != 16:
+        sys.exit('error: timeout')
+    magic, rcmd, status, _, index, length = struct.unpack('<IBBHII', hdr)
+    if magic != MAGIC or rcmd != cmd:
+        sys.exit('error: unexpected response %s' % hdr.hex())
+    data = port.read(length)
+    crc = port.read(4)
+    if len(data) != length or len(crc) != 4 or struct.unpack('<I', crc)[0] != zlib.crc32(data):
+        return None
+    if status:
+        sys.exit('error: %s' % (STATUS[status] if status < len(STATUS) else 'status %d' % status))
+    return index, data
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('port', help='serial port of the device, e.g. /dev/ttyACM0')
+    parser.add_argument('output', help='local data file, appended to')
+    parser.add_argument('--since', type=int, help='overwrite output with records from this unix timestamp on, '
+                        'such a file can not be synced incrementally')
+    args = parser.parse_args()
+
+    with serial.Serial(args.port, 115200, timeout=5) as port:
+        port.reset_input_buffer()
+
+        request(port, CMD_INFO)
+        _, info = response(port, CMD_INFO)
+        unit_size, unit_count, first_ts, last_ts = struct.unpack('<4I', info)
+
+        with open(args.output, 'ab+') as f:
+            f.seek(0, 2)
+            if args.since is not None:
+                request(port, CMD_FIND, args.since)
+                start = response(port, CMD_FIND)[0]
+                f.truncate(0)
+            else:
+                start = f.tell() // unit_size
+                f.truncate(start * unit_size)  # drop a partial unit from an earlier interrupted sync
+
+            # a corrupted chunk ends the sync, running again resumes after the last good one
+            index = start
+            request(port, CMD_READ, index)
+            while True:
+                chunk = response(port, CMD_READ)
+                if chunk is None:
+                    sys.exit('error: corrupted chunk at unit %d, run again to resume' % index)
+                if not chunk[1]:
+                    break
+                if chunk[0] != index:
+                    sys.exit('error: chunk at unit %d, expected %d' % (chunk[0], index))
+                f.write(chunk[1])
+                index += len(chunk[1]) // unit_size
+
+    print('%s: %d new units of %d bytes, %d on device (timestamps %d..%d)' %
+          (args.output, index - start, unit_size, unit_count, first_ts, last_ts))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+"""
+Static RAM and flash budget of a tinyuf2 build: per module from the GNU ld map file, per symbol from
+nm of the elf. Run after every build by tinyuf2_add_memreport() in src/tinyuf2.cmake and by
+`make memreport`; totals and the largest RAM consumers are printed, the full report is written to
+<elf>.mem.txt. Heap use at runtime is in STATS.TXT (CFG_UF2_STATS).
+
+    python3 tools/memreport.py --nm arm-none-eabi-nm -o tinyuf2.mem.txt tinyuf2.elf.map tinyuf2.elf
+"""
+import argparse
+import collections
+import os
+import re
+import subprocess
+import sys
+
+# input section name prefixes: in RAM only, in RAM with initial value in flash, in flash only
+RAM_ONLY = ('.bss', '.sbss', 'COMMON', '.noinit', '.ext_ram.bss', '.dram0.bss')
+RAM_FLASH = ('.data', '.sdata', '.dram', '.iram', '.ramfunc', '.tdata')
+FLASH_ONLY = ('.text', '.literal', '.rodata', '.srodata', '.flash', '.isr_vector', '.vectors', '.init', '.fini',
+              '.ARM.exidx', '.ARM.extab', '.eh_frame', '.gcc_except_table', '.preinit_array', '.init_array',
+              '.fini_array')
+
+# nm symbol types
+NM_RAM_ONLY = 'bBsS'
+NM_RAM_FLASH = 'dDgG'
+NM_FLASH_ONLY = 'tTrR'
+
+SECTION_RE = re.compile(r'^ (\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$')
+WRAPPED_RE = re.compile(r'^ (\S+)$')
+CONTINUED_RE = re.compile(r'^\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$')
+
+
+def kind_of(name):
+    # most specific first: .dram0.bss is bss although it starts like .dram
+    for prefixes, kind in ((RAM_ONLY, 'bss'), (RAM_FLASH, 'data'), (FLASH_ONLY, 'text')):
+        if name.startswith(prefixes):
+            return kind
+    return None
+
+
+def module_of(path):
+    # lib.a(member.o) -> lib.a(member), dir/file.c.obj -> file.c
+    m = re.match(r'(.*?)\((.*)\)$', path)
+    if m:
+        return '%s(%s)' % (os.path.basename(m.group(1)), re.sub(r'\.(obj|o)$', '', m.group(2)))
+    return re.sub(r'\.(obj|o)$', '', os.path.basename(path))
+
+
+def parse_map(path):
+    modules = collections.defaultdict(lambda: collections.Counter())
+    with open(path, errors='replace') as f:
+        lines = f.read().splitlines()
+
+    try:
+        start = next(i for i, line in enumerate(lines) if line.startswith('Linker script and memory map'))
+    except StopIteration:
+        sys.exit('error: %s is not a GNU ld map file' % path)
+
+    i = start
+    while i < len(lines):
+        line = lines[i]
+        i += 1
+
+        m = SECTION_RE.match(line)
+        if m:
+            name, size, obj = m.group(1), int(m.group(3), 16), m.group(4)
+        else:
+            # long section names are wrapped, address, size and file follow on the next line
+            m = WRAPPED_RE.match(line)
+            c = CONTINUED_RE.match(lines[i]) if m and i < len(lines) else None
+            if not c:
+                continue
+            name, size, obj = m.group(1), int(c.group(2), 16), c.group(3)
+            i += 1
+
+        kind = kind_of(name)
+        if kind and size and not obj.startswith(('load address', '*fill*')):
+            modules[module_of(obj.strip())][kind] += size
+
+    return modules
+
+
+def parse_nm(nm, elf):
+    try:
+        out = subprocess.run([nm, '--print-size', '--size-sort', elf], check=True, capture_output=True,
+                             text=True).stdout
+    except (OSError, subprocess.CalledProcessError) as e:
+        print('warning: no symbols, %s failed: %s' % (nm, e), file=sys.stderr)
+        return []
+
+    symbols = []
+    for line in out.splitlines():
+        fields = line.split(None, 3)
+        if len(fields) != 4:
+            continue
+        size, t, name = int(fields[1], 16), fields[2], fields[3]
+        kind = 'bss' if t in NM_RAM_ONLY else 'data' if t in NM_RAM_FLASH else 'text' if t in NM_FLASH_ONLY else None
+        if kind:
+            symbols.append((name, kind, size))
+    return symbols
+
+
+def ram(c):
+    return c['bss'] + c['data']
+
+
+def flash(c):
+    return c['text'] + c['data']
+
+
+# rows of (name, ram, flash), share is of the column the table is sorted by
+def table(title, rows, top, col):
+    out = ['', title]
+    out.append('%8s %8s %8s  %s' % ('ram', 'flash', 'share', 'name'))
+    total = sum(r[col] for r in rows) or 1
+    for row in rows[:top]:
+        out.append('%8d %8d %7.1f%%  %s' % (row[1], row[2], 100.0 * row[col] / total, row[0]))
+    if len(rows) > top:
+        out.append('%8s %8s %8s  ... %d more' % ('', '', '', len(rows) - top))
+    return out
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('map', help='GNU ld map file')
+    parser.add_argument('elf', nargs='?', help='elf for the per symbol tables')
+    parser.add_argument('--nm', default='nm', help='nm of the toolchain (default: %(default)s)')
+    parser.add_argument('-o', '--output', help='full report, default <map without .map>.mem.txt')
+    parser.add_argument('--top', type=int, default=40, help='rows per table in the full report')
+    parser.add_argument('--summary', type=int, default=10, help='RAM modules printed, 0 for none')
+    args = parser.parse_args()
+
+    modules = parse_map(args.map)
+    total = collections.Counter()
+    for c in modules.values():
+        total.update(c)
+
+    report = ['RAM %d bytes (data %d, bss %d), flash %d bytes (text %d, data %d)' %
+              (ram(total), total['data'], total['bss'], flash(total), total['text'], total['data'])]
+
+    by_ram = sorted(((m, ram(c), flash(c)) for m, c in modules.items()), key=lambda r: (-r[1], -r[2], r[0]))
+    by_flash = sorted(by_ram, key=lambda r: (-r[2], -r[1], r[0]))
+    ram_modules = table('RAM by module', [r for r in by_ram if r[1]], args.top, 1)
+    report += ram_modules
+    report += table('flash by module', [r for r in by_flash if r[2]], args.top, 2)
+
+    if args.elf:
+        symbols = parse_nm(args.nm, args.elf)
+        rows = [(n, s if k != 'text' else 0, s if k != 'bss' else 0) for n, k, s in symbols]
+        report += table('RAM by symbol', sorted([r for r in rows if r[1]], key=lambda r: (-r[1], r[0])), args.top, 1)
+        report += table('flash by symbol', sorted([r for r in rows if r[2]], key=lambda r: (-r[2], r[0])), args.top, 2)
+
+    output = args.output or re.sub(r'(\.elf)?\.map$', '', args.map) + '.mem.txt'
+    with open(output, 'w') as f:
+        f.write('\n'.join(report) + '\n')
+
+    print(report[0])
+    if args.summary:
+        # title and header of the module table, then the largest ones
+        print('\n'.join(ram_modules[1:3 + args.summary]))
+    print('memory report: %s' % output)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -3,33 +3,33 @@ import serial
 import time
 
 
+def touch(port, hold=0.5):
+    """
+    Opens port at 1200 bps and closes it again after hold seconds, the application resets into UF2
+    mode. Raises serial.SerialException if the port can not be opened.
+    """
+    ser = serial.Serial(port, 1200)
+    try:
+        # Wait for a moment before closing the port
+        time.sleep(hold)
+    finally:
+        ser.close()
+
+
 @click.command()
 @click.argument('port', default='/dev/ttyACM0')
 def connect_serial(port):
     """
     Connects to a specified port at 1200 bps, waits for a moment, and then disconnects.
     """
-    baud_rate = 1200
-
     try:
-        # Initialize serial connection
-        set = serial.Serial(port, baud_rate)
-
-        # Check if the port is open
-        if set.is_open:
-            print(f"Connected to {port} at {baud_rate} bps.")
-
-        # Wait for a moment before closing the port
-        time.sleep(0.5)
+        touch(port)
+        print(f"Connected to {port} at 1200 bps.")
+        print(f"Disconnected from {port}.")
 
     except serial.SerialException as e:
         print(f"Error: {e}")
 
-    finally:
-        # Close the serial connection
-        set.close()
-        print(f"Disconnected from {port}.")
-
 
 if __name__ == '__main__':
     connect_serial()
@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+"""
+Convert TRACE.BIN of tinyuf2 (CFG_UF2_TRACE, see src/trace.h) to Chrome trace format JSON, open
+it with chrome://tracing or https://ui.perfetto.dev. USB and flash events are shown as separate
+tracks so that their interleaving is visible.
+
+    python3 tools/trace2chrome.py /media/user/ENERTY/TRACE.BIN trace.json
+"""
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = 0x45435254
+
+# id: (name, track), same order as the enum in src/trace.h
+EVENTS = {
+    1: ('tud_task', 'usb'),
+    2: ('read10', 'usb'),
+    3: ('write10', 'usb'),
+    4: ('uf2_write', 'usb'),
+    5: ('flush', 'flash'),
+    6: ('compare', 'flash'),
+    7: ('erase', 'flash'),
+    8: ('program', 'flash'),
+}
+
+TRACKS = {'usb': 1, 'flash': 2}
+
+BEGIN = 1
+END = 2
+
+
+def load(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    if len(data) < 16:
+        sys.exit('error: %s is too short' % path)
+
+    magic, cycles_per_us, total, depth = struct.unpack_from('<4I', data)
+    if magic != MAGIC:
+        sys.exit('error: %s is not a trace (magic 0x%08x)' % (path, magic))
+
+    count = min(total, depth)
+    events = [struct.unpack_from('<IBBH', data, 16 + 8 * i) for i in range(count)]
+    return cycles_per_us, total, events
+
+
+def convert(cycles_per_us, events):
+    out = []
+    now = 0
+    prev = None
+    for cycles, evt_id, evt_type, ms in events:
+        if prev is not None:
+            delta = (cycles - prev[0]) & 0xffffffff
+            # cycle counter may have wrapped in a long gap, the millisecond stamp tells how often
+            delta_ms = (ms - prev[1]) & 0xffff
+            if delta_ms:
+                wraps = round((delta_ms * 1000 * cycles_per_us - delta) / 2 ** 32)
+                delta += max(wraps, 0) << 32
+            now += delta
+        prev = (cycles, ms)
+
+        name, track = EVENTS.get(evt_id, ('event %d' % evt_id, 'usb'))
+        if evt_type not in (BEGIN, END):
+            continue
+        out.append({
+            'name': name,
+            'ph': 'B' if evt_type == BEGIN else 'E',
+            'ts': now / cycles_per_us,
+            'pid': 1,
+            'tid': TRACKS[track],
+        })
+
+    meta = [{'name': 'thread_name', 'ph': 'M', 'pid': 1, 'tid': tid, 'args': {'name': track}}
+            for track, tid in TRACKS.items()]
+    return meta + out
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Convert tinyuf2 TRACE.BIN to Chrome trace JSON')
+    parser.add_argument('trace', help='TRACE.BIN copied from the device')
+    parser.add_argument('output', help='JSON file to write')
+    parser.add_argument('--mhz', type=float, default=0,
+                        help='cycles per microsecond, if the device does not know its clock')
+    args = parser.parse_args()
+
+    cycles_per_us, total, events = load(args.trace)
+    if args.mhz:
+        cycles_per_us = args.mhz
+    if not cycles_per_us:
+        sys.exit('error: clock is unknown, pass --mhz')
+
+    with open(args.output, 'w') as f:
+        json.dump({'traceEvents': convert(cycles_per_us, events), 'displayTimeUnit': 'ns'}, f)
+
+    lost = total - len(events)
+    print('%d events%s' % (len(events), (', %d older ones lost' % lost) if lost else ''))
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,35 @@
+#!/usr/bin/env python3
+"""
+Write a benchmark file for tinyuf2 (CFG_UF2_STATS, see Bench_Block in src/uf2.h). Copying it to the
+drive measures USB write throughput over its blocks and raw erase, program and read throughput of a
+scratch flash region. The drive is re-mounted afterwards, results are at the end of STATS.TXT:
+
+    python3 tools/uf2bench.py bench.uf2
+    cp bench.uf2 /media/user/ENERTY/ && sync
+"""
+import argparse
+import struct
+import sys
+
+BENCH_MAGIC_START0 = 0x0A4E4542
+BENCH_MAGIC_START1 = 0x7A1C94D5
+BENCH_MAGIC_END = 0x5B06E1A9
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Write a tinyuf2 throughput benchmark file')
+    parser.add_argument('output', help='file to write, copy it to the drive')
+    parser.add_argument('--size', type=int, default=1024, help='size in KB (default 1024)')
+    args = parser.parse_args()
+
+    num_blocks = max(args.size * 2, 2)
+    with open(args.output, 'wb') as f:
+        for i in range(num_blocks):
+            block = struct.pack('<5I', BENCH_MAGIC_START0, BENCH_MAGIC_START1, i, num_blocks, BENCH_MAGIC_END)
+            f.write(block.ljust(512, b'\x00'))
+
+    print('%d blocks' % num_blocks)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+"""
+Combine UF2 files of several families (app, measurement data, ffat, nvs ...) into one file,
+for boards defining BOARD_UF2_ROUTES. Blocks are renumbered across the whole file so tinyuf2
+only completes the update once every partition is written. Blocks of the app (--app family)
+are placed first, they carry the image check and the resume journal of block 0.
+
+A plain .bin can be given as FAMILY:FILE.bin and is written from partition offset 0.
+Boards defining BOARD_UF2_STAGE_FAMILY also take tinyuf2.bin itself this way (bundle), it is staged
+during the transfer and installed last.
+"""
+import argparse
+import struct
+import sys
+
+UF2_MAGIC_START0 = 0x0A324655
+UF2_MAGIC_START1 = 0x9E5D5157
+UF2_MAGIC_END = 0x0AB16F30
+
+UF2_FLAG_NOFLASH = 0x00000001
+UF2_FLAG_FAMILYID = 0x00002000
+
+PAYLOAD_SIZE = 256
+
+
+def read_uf2(path, buf):
+    blocks = []
+    for ptr in range(0, len(buf), 512):
+        block = bytearray(buf[ptr:ptr + 512])
+        start0, start1, flags = struct.unpack('<3I', block[:12])
+        if start0 != UF2_MAGIC_START0 or start1 != UF2_MAGIC_START1 or (flags & UF2_FLAG_NOFLASH):
+            continue
+        if not flags & UF2_FLAG_FAMILYID:
+            sys.exit('error: %s has blocks without family ID' % path)
+        blocks.append(block)
+    if not blocks:
+        sys.exit('error: %s has no uf2 blocks' % path)
+    return blocks
+
+
+def read_bin(buf, family):
+    blocks = []
+    for addr in range(0, len(buf), PAYLOAD_SIZE):
+        chunk = buf[addr:addr + PAYLOAD_SIZE]
+        hdr = struct.pack('<8I', UF2_MAGIC_START0, UF2_MAGIC_START1, UF2_FLAG_FAMILYID,
+                          addr, len(chunk), 0, 0, family)
+        blocks.append(bytearray(hdr + chunk.ljust(476, b'\x00') + struct.pack('<I', UF2_MAGIC_END)))
+    return blocks
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('inputs', nargs='+', help='FILE.uf2 or FAMILY:FILE.bin')
+    parser.add_argument('-o', '--output', required=True, help='combined .uf2 file')
+    parser.add_argument('-a', '--app', type=lambda x: int(x, 0), required=True, help='UF2 family ID of the app')
+    args = parser.parse_args()
+
+    app, others = [], []
+    for arg in args.inputs:
+        family, sep, path = arg.partition(':')
+        if not sep or not path.endswith('.bin'):
+            family, path = None, arg
+        with open(path, 'rb') as f:
+            buf = f.read()
+        blocks = read_bin(buf, int(family, 0)) if family else read_uf2(path, buf)
+        for block in blocks:
+            (app if struct.unpack_from('<I', block, 28)[0] == args.app else others).append(block)
+
+    if not app:
+        sys.exit('error: no blocks of app family 0x%08x' % args.app)
+
+    blocks = app + others
+    out = bytearray()
+    for i, block in enumerate(blocks):
+        struct.pack_into('<II', block, 20, i, len(blocks))
+        out += block
+
+    with open(args.output, 'wb') as f:
+        f.write(out)
+
+    families = sorted({struct.unpack_from('<I', b, 28)[0] for b in blocks})
+    print('%s: %d blocks, families %s' % (args.output, len(blocks), ' '.join('0x%08x' % f for f in families)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,217 @@
+#!/usr/bin/env python3
+"""
+Convert a firmware (.bin or .uf2) into a compressed UF2 file for tinyuf2 built with CFG_UF2_HEATSHRINK.
+
+Payloads of all blocks form one heatshrink (LZSS) stream of the whole image, blocks carry
+UF2_FLAG_HEATSHRINK and the target address of the image start. Window and lookahead bits
+must match CFG_UF2_HEATSHRINK_WINDOW_BITS and CFG_UF2_HEATSHRINK_LOOKAHEAD_BITS.
+
+With --carray the stream is written as C array for the self-update app instead, behind a
+decompress_image_t header (see src/decompress.h) with the image length and MD5.
+"""
+import argparse
+import hashlib
+import struct
+import sys
+
+UF2_MAGIC_START0 = 0x0A324655
+UF2_MAGIC_START1 = 0x9E5D5157
+UF2_MAGIC_END = 0x0AB16F30
+
+UF2_FLAG_NOFLASH = 0x00000001
+UF2_FLAG_FAMILYID = 0x00002000
+UF2_FLAG_HEATSHRINK = 0x00100000
+
+PAYLOAD_SIZE = 476
+
+IMAGE_MAGIC = 0x31555348  # HSU1
+
+# candidate positions checked per match search, higher compresses slightly better but slower
+MAX_CANDIDATES = 16
+
+
+class BitWriter:
+    def __init__(self):
+        self.out = bytearray()
+        self.acc = 0
+        self.count = 0
+
+    def write(self, value, bits):
+        self.acc = (self.acc << bits) | value
+        self.count += bits
+        while self.count >= 8:
+            self.count -= 8
+            self.out.append((self.acc >> self.count) & 0xff)
+        self.acc &= (1 << self.count) - 1
+
+    def finish(self):
+        # padding is shorter than any token, decoder ignores it
+        if self.count:
+            self.out.append((self.acc << (8 - self.count)) & 0xff)
+            self.count = 0
+        return bytes(self.out)
+
+
+def compress(data, window_bits, lookahead_bits):
+    window = 1 << window_bits
+    max_len = 1 << lookahead_bits
+    # back-reference is only shorter than literals for 2+ bytes
+    min_len = 2 if 1 + window_bits + lookahead_bits < 2 * 9 else 3
+
+    bw = BitWriter()
+    recent = {}  # 2-byte prefix -> positions, most recent last
+    pos = 0
+    n = len(data)
+
+    def remember(p):
+        if p + 1 < n:
+            lst = recent.setdefault(data[p:p + 2], [])
+            lst.append(p)
+            if len(lst) > 4 * MAX_CANDIDATES:
+                del lst[:-MAX_CANDIDATES]
+
+    while pos < n:
+        best_len = 0
+        best_off = 0
+        for cand in reversed(recent.get(data[pos:pos + 2], [])[-MAX_CANDIDATES:]):
+            off = pos - cand
+            if off > window:
+                break
+            length = 0
+            while length < max_len and pos + length < n and data[cand + length] == data[pos + length]:
+                length += 1
+            if length > best_len:
+                best_len, best_off = length, off
+                if length == max_len:
+                    break
+
+        if best_len >= min_len:
+            bw.write(0, 1)
+            bw.write(best_off - 1, window_bits)
+            bw.write(best_len - 1, lookahead_bits)
+            for p in range(pos, pos + best_len):
+                remember(p)
+            pos += best_len
+        else:
+            bw.write(1, 1)
+            bw.write(data[pos], 8)
+            remember(pos)
+            pos += 1
+
+    return bw.finish()
+
+
+def decompress(stream, window_bits, lookahead_bits):
+    # reference decoder, used to check the output before writing it
+    bits = ''.join(f'{b:08b}' for b in stream)
+    out = bytearray()
+    i = 0
+    while True:
+        if i >= len(bits):
+            break
+        if bits[i] == '1':
+            if i + 9 > len(bits):
+                break
+            out.append(int(bits[i + 1:i + 9], 2))
+            i += 9
+        else:
+            if i + 1 + window_bits + lookahead_bits > len(bits):
+                break
+            off = int(bits[i + 1:i + 1 + window_bits], 2) + 1
+            count = int(bits[i + 1 + window_bits:i + 1 + window_bits + lookahead_bits], 2) + 1
+            for _ in range(count):
+                out.append(out[-off] if off <= len(out) else 0)
+            i += 1 + window_bits + lookahead_bits
+    return bytes(out)
+
+
+def read_uf2(buf, family):
+    # contiguous image of all flashable blocks of the family
+    chunks = {}
+    for ptr in range(0, len(buf), 512):
+        block = buf[ptr:ptr + 512]
+        start0, start1, flags, addr, size, _, _, fam = struct.unpack('<8I', block[:32])
+        if start0 != UF2_MAGIC_START0 or start1 != UF2_MAGIC_START1 or (flags & UF2_FLAG_NOFLASH):
+            continue
+        if (flags & UF2_FLAG_FAMILYID) and fam != family:
+            continue
+        if flags & UF2_FLAG_HEATSHRINK:
+            sys.exit('error: file is already compressed')
+        chunks[addr] = block[32:32 + size]
+
+    if not chunks:
+        sys.exit('error: no blocks of family 0x%08x' % family)
+
+    base = min(chunks)
+    image = bytearray()
+    for addr in sorted(chunks):
+        if addr != base + len(image):
+            sys.exit('error: image is not contiguous at 0x%08x' % addr)
+        image += chunks[addr]
+    return base, bytes(image)
+
+
+def write_uf2(stream, base, family):
+    num_blocks = (len(stream) + PAYLOAD_SIZE - 1) // PAYLOAD_SIZE
+    out = bytearray()
+    for i in range(num_blocks):
+        chunk = stream[i * PAYLOAD_SIZE:(i + 1) * PAYLOAD_SIZE]
+        hdr = struct.pack('<8I', UF2_MAGIC_START0, UF2_MAGIC_START1, UF2_FLAG_FAMILYID | UF2_FLAG_HEATSHRINK,
+                          base, len(chunk), i, num_blocks, family)
+        out += hdr + chunk.ljust(476, b'\x00') + struct.pack('<I', UF2_MAGIC_END)
+    return bytes(out)
+
+
+def write_carray(stream, image, window_bits, lookahead_bits):
+    data = struct.pack('<IIBBH16s', IMAGE_MAGIC, len(image), window_bits, lookahead_bits, 0,
+                       hashlib.md5(image).digest()) + stream
+    lines = ['const unsigned long bindata_len = %d;' % len(data),
+             'const unsigned char bindata[] __attribute__((aligned(16))) = {']
+    for i in range(0, len(data), 16):
+        lines.append('  ' + ', '.join('0x%02x' % b for b in data[i:i + 16]) + ',')
+    lines.append('};')
+    return ('\n'.join(lines) + '\n').encode()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('input', help='firmware .bin or .uf2')
+    parser.add_argument('-o', '--output', required=True, help='compressed .uf2 file')
+    parser.add_argument('-f', '--family', type=lambda x: int(x, 0), help='UF2 family ID, required without --carray')
+    parser.add_argument('--carray', action='store_true', help='write a C array for the self-update app')
+    parser.add_argument('-b', '--base', type=lambda x: int(x, 0), default=0, help='target address of a .bin image')
+    parser.add_argument('--window-bits', type=int, default=11)
+    parser.add_argument('--lookahead-bits', type=int, default=4)
+    args = parser.parse_args()
+    if args.family is None and not args.carray:
+        parser.error('--family is required')
+
+    with open(args.input, 'rb') as f:
+        buf = f.read()
+
+    if struct.unpack('<I', buf[:4])[0] == UF2_MAGIC_START0:
+        base, image = read_uf2(buf, args.family)
+    else:
+        base, image = args.base, buf
+
+    stream = compress(image, args.window_bits, args.lookahead_bits)
+    if decompress(stream, args.window_bits, args.lookahead_bits) != image:
+        sys.exit('error: compressed stream does not decode to the image')
+
+    if args.carray:
+        with open(args.output, 'wb') as f:
+            f.write(write_carray(stream, image, args.window_bits, args.lookahead_bits))
+        print('%s: %d bytes image, %d bytes stream (%.1f%%)' %
+              (args.output, len(image), len(stream), 100.0 * len(stream) / max(len(image), 1)))
+        return
+
+    uf2 = write_uf2(stream, base, args.family)
+    with open(args.output, 'wb') as f:
+        f.write(uf2)
+
+    print('%s: %d bytes image, %d bytes stream (%.1f%%), %d blocks' %
+          (args.output, len(image), len(stream), 100.0 * len(stream) / max(len(image), 1), len(uf2) // 512))
+
+
+if __name__ == '__main__':
+    main()
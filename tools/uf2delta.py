@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+"""
+Create a delta UF2 file that patches the firmware currently in flash (base) into a new one,
+for tinyuf2 built with CFG_UF2_DELTA. See src/delta.h for the stream format.
+
+The device patches flash in place: at any point, addresses below the output position hold
+the new image and the others still the old one. Copies are only taken from regions that
+hold the wanted data under this model, everything else is sent as literal data.
+"""
+import argparse
+import bisect
+import struct
+import sys
+import zlib
+
+UF2_MAGIC_START0 = 0x0A324655
+UF2_MAGIC_START1 = 0x9E5D5157
+UF2_MAGIC_END = 0x0AB16F30
+
+UF2_FLAG_FAMILYID = 0x00002000
+UF2_FLAG_DELTA = 0x00200000
+
+DELTA_MAGIC = b'DLT1'
+DELTA_OP_COPY = 0x01
+DELTA_OP_DATA = 0x02
+
+PAYLOAD_SIZE = 476
+OP_LEN_MAX = 0xffff
+
+# shortest copy from another address worth its 7 byte op, and shortest in-place run
+MIN_MOVE = 12
+MIN_KEEP = 8
+KEY_LEN = 8
+MAX_CANDIDATES = 8
+
+
+def encode(old, new):
+    stream = bytearray(DELTA_MAGIC + struct.pack('<III', len(old), zlib.crc32(old), len(new)))
+    literal = bytearray()
+
+    def flush_literal():
+        for i in range(0, len(literal), OP_LEN_MAX):
+            chunk = literal[i:i + OP_LEN_MAX]
+            stream.extend(struct.pack('<BH', DELTA_OP_DATA, len(chunk)) + chunk)
+        literal.clear()
+
+    def copy(src, length):
+        flush_literal()
+        while length:
+            count = min(length, OP_LEN_MAX)
+            stream.extend(struct.pack('<BIH', DELTA_OP_COPY, src, count))
+            src += count
+            length -= count
+
+    old_index = {}
+    for s in range(len(old) - KEY_LEN + 1):
+        old_index.setdefault(old[s:s + KEY_LEN], []).append(s)
+    new_index = {}
+    indexed = 0  # new[] positions below this are in new_index
+
+    d = 0
+    while d < len(new):
+        # unchanged at the same address, costs nothing on the device
+        keep = 0
+        while d + keep < len(new) and d + keep < len(old) and new[d + keep] == old[d + keep]:
+            keep += 1
+        if keep >= MIN_KEEP or (keep and d + keep == len(new)):
+            copy(d, keep)
+            d += keep
+            continue
+
+        # both new data already written (ending before d) and old data not yet overwritten (from d on)
+        while indexed + KEY_LEN <= d:
+            new_index.setdefault(new[indexed:indexed + KEY_LEN], []).append(indexed)
+            indexed += 1
+
+        key = new[d:d + KEY_LEN]
+        old_cands = old_index.get(key, [])
+        first = bisect.bisect_left(old_cands, d)
+        candidates = [(old, s, len(new) - d) for s in old_cands[first:first + MAX_CANDIDATES]]
+        # new data must be copied from before d only, the rest is not written yet
+        candidates += [(new, s, min(len(new) - d, d - s)) for s in new_index.get(key, [])[-MAX_CANDIDATES:]]
+
+        best_len, best_src = 0, 0
+        for buf, s, limit in candidates:
+            length = 0
+            while length < limit and s + length < len(buf) and buf[s + length] == new[d + length]:
+                length += 1
+            if length > best_len:
+                best_len, best_src = length, s
+
+        if best_len >= MIN_MOVE:
+            copy(best_src, best_len)
+            d += best_len
+        else:
+            literal.append(new[d])
+            d += 1
+
+    flush_literal()
+    return bytes(stream)
+
+
+def apply(old, stream):
+    # reference device model, used to check the output before writing it
+    flash = bytearray(old)
+    _, _, _, new_len = struct.unpack_from('<4sIII', stream, 0)
+    if new_len > len(flash):
+        flash.extend(b'\xff' * (new_len - len(flash)))
+    pos, i = 0, 16
+    while pos < new_len:
+        op = stream[i]
+        if op == DELTA_OP_COPY:
+            src, count = struct.unpack_from('<IH', stream, i + 1)
+            i += 7
+            for k in range(count):
+                flash[pos + k] = flash[src + k]
+        else:
+            count = struct.unpack_from('<H', stream, i + 1)[0]
+            flash[pos:pos + count] = stream[i + 3:i + 3 + count]
+            i += 3 + count
+        pos += count
+    return bytes(flash[:new_len])
+
+
+def write_uf2(stream, base, family):
+    num_blocks = (len(stream) + PAYLOAD_SIZE - 1) // PAYLOAD_SIZE
+    out = bytearray()
+    for i in range(num_blocks):
+        chunk = stream[i * PAYLOAD_SIZE:(i + 1) * PAYLOAD_SIZE]
+        hdr = struct.pack('<8I', UF2_MAGIC_START0, UF2_MAGIC_START1, UF2_FLAG_FAMILYID | UF2_FLAG_DELTA,
+                          base, len(chunk), i, num_blocks, family)
+        out += hdr + chunk.ljust(476, b'\x00') + struct.pack('<I', UF2_MAGIC_END)
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('base', help='firmware .bin currently on the device')
+    parser.add_argument('new', help='new firmware .bin')
+    parser.add_argument('-o', '--output', required=True, help='delta .uf2 file')
+    parser.add_argument('-f', '--family', type=lambda x: int(x, 0), required=True, help='UF2 family ID')
+    parser.add_argument('-b', '--base-addr', type=lambda x: int(x, 0), default=0, help='target address of the images')
+    args = parser.parse_args()
+
+    with open(args.base, 'rb') as f:
+        old = f.read()
+    with open(args.new, 'rb') as f:
+        new = f.read()
+
+    stream = encode(old, new)
+    if apply(old, stream) != new:
+        sys.exit('error: delta does not reproduce the new image')
+
+    uf2 = write_uf2(stream, args.base_addr, args.family)
+    with open(args.output, 'wb') as f:
+        f.write(uf2)
+
+    print('%s: %d bytes image, %d bytes delta (%.1f%%), %d blocks' %
+          (args.output, len(new), len(stream), 100.0 * len(stream) / max(len(new), 1), len(uf2) // 512))
+
+
+if __name__ == '__main__':
+    main()
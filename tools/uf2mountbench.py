@@ -0,0 +1,239 @@
+#!/usr/bin/env python3
+"""
+Reboot-to-mount latency and throughput of tinyuf2 on a real host. Each run resets the application into
+UF2 mode with the 1200 bps touch of touch1200.py, then timestamps from the moment the port is closed:
+
+  enum   UF2 device with --vid/--pid is on the bus (Linux sysfs, or pyusb elsewhere)
+  scsi   its block device reports a non-zero size (Linux only)
+  mount  INFO_UF2.TXT is visible in --mount, the host automounts the drive
+
+then reads CURRENT.UF2 and MEASDAT.CSV (whichever exist) and copies --uf2, usually the application
+itself, which brings the device back for the next run. One CSV row per run with the OS of the host,
+rows of several hosts appended to one file give the per-OS distributions of 'summary'.
+
+    python3 tools/uf2mountbench.py run /dev/ttyACM0 /media/user/ENERTY --uf2 app.uf2 \\
+        --vid 0403 --pid 80da --runs 20 --csv mount.csv
+    python3 tools/uf2mountbench.py summary mount.csv
+
+Needs pyserial and click (touch1200.py), optionally pyusb for enum outside Linux.
+"""
+import argparse
+import csv
+import glob
+import os
+import platform
+import statistics
+import sys
+import time
+
+POLL_S = 0.005
+READ_CHUNK = 64 * 1024
+
+FIELDS = ['os', 'host', 'run', 'enum_ms', 'scsi_ms', 'mount_ms',
+          'current_uf2_ms', 'current_uf2_kbs', 'measdat_csv_ms', 'measdat_csv_kbs',
+          'write_ms', 'write_kbs', 'app_ms']
+
+
+def sysfs_device(vid, pid):
+    """sysfs directory of the USB device vid:pid, None if not there"""
+    for path in glob.glob('/sys/bus/usb/devices/*/idVendor'):
+        dev = os.path.dirname(path)
+        try:
+            with open(path) as f, open(os.path.join(dev, 'idProduct')) as g:
+                if int(f.read(), 16) == vid and int(g.read(), 16) == pid:
+                    return dev
+        except (OSError, ValueError):
+            continue
+    return None
+
+
+def usb_present(vid, pid):
+    if os.path.isdir('/sys/bus/usb/devices'):
+        return sysfs_device(vid, pid) is not None
+    try:
+        import usb.core
+    except ImportError:
+        return None
+    return usb.core.find(idVendor=vid, idProduct=pid) is not None
+
+
+def scsi_ready(vid, pid):
+    """True once the mass storage LUN of vid:pid has a medium, None where this can not be seen"""
+    if not os.path.isdir('/sys/bus/usb/devices'):
+        return None
+    dev = sysfs_device(vid, pid)
+    if dev is None:
+        return False
+    for path in glob.glob(os.path.join(dev, '*', 'host*', 'target*', '*', 'block', '*', 'size')):
+        try:
+            with open(path) as f:
+                if int(f.read()) > 0:
+                    return True
+        except (OSError, ValueError):
+            continue
+    return False
+
+
+def port_present(port):
+    from serial.tools import list_ports
+    return any(p.device == port for p in list_ports.comports())
+
+
+def wait_for(predicate, t0, timeout):
+    """ms from t0 until predicate() is true, None if it is unknown or timed out"""
+    while time.monotonic() - t0 < timeout:
+        state = predicate()
+        if state is None:
+            return None
+        if state:
+            return (time.monotonic() - t0) * 1000
+        time.sleep(POLL_S)
+    return None
+
+
+def drop_cache(fd):
+    # the drive was just mounted, but a host that kept pages of an earlier mount must not serve them
+    if hasattr(os, 'posix_fadvise'):
+        os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_DONTNEED)
+
+
+def timed_read(path):
+    """(ms, KB/s) reading path, (None, None) if it does not exist"""
+    if not os.path.isfile(path):
+        return None, None
+    size = 0
+    with open(path, 'rb', buffering=0) as f:
+        drop_cache(f.fileno())
+        t0 = time.monotonic()
+        while True:
+            chunk = f.read(READ_CHUNK)
+            if not chunk:
+                break
+            size += len(chunk)
+        dt = time.monotonic() - t0
+    return dt * 1000, (size / 1024 / dt if dt else None)
+
+
+def timed_write(src, mount):
+    """(ms, KB/s) copying src to the drive, until the host has flushed it"""
+    with open(src, 'rb') as f:
+        data = f.read()
+    t0 = time.monotonic()
+    with open(os.path.join(mount, os.path.basename(src)), 'wb', buffering=0) as f:
+        for i in range(0, len(data), READ_CHUNK):
+            f.write(data[i:i + READ_CHUNK])
+        os.fsync(f.fileno())
+    dt = time.monotonic() - t0
+    return dt * 1000, len(data) / 1024 / dt
+
+
+def one_run(args, run, touch):
+    row = {'os': platform.system(), 'host': platform.node(), 'run': run}
+    usb = args.vid is not None and args.pid is not None
+
+    # UF2 and application may share vid:pid, then the device has to leave the bus first
+    if usb and usb_present(args.vid, args.pid):
+        touch(args.port)
+        t0 = time.monotonic()
+        wait_for(lambda: not usb_present(args.vid, args.pid), t0, args.timeout)
+    else:
+        touch(args.port)
+        t0 = time.monotonic()
+
+    if usb:
+        row['enum_ms'] = wait_for(lambda: usb_present(args.vid, args.pid), t0, args.timeout)
+        row['scsi_ms'] = wait_for(lambda: scsi_ready(args.vid, args.pid), t0, args.timeout)
+    row['mount_ms'] = wait_for(lambda: os.path.isfile(os.path.join(args.mount, 'INFO_UF2.TXT')), t0, args.timeout)
+    if row['mount_ms'] is None:
+        sys.exit('error: %s did not show INFO_UF2.TXT within %ds' % (args.mount, args.timeout))
+
+    row['current_uf2_ms'], row['current_uf2_kbs'] = timed_read(os.path.join(args.mount, 'CURRENT.UF2'))
+    row['measdat_csv_ms'], row['measdat_csv_kbs'] = timed_read(os.path.join(args.mount, 'MEASDAT.CSV'))
+
+    if args.uf2:
+        row['write_ms'], row['write_kbs'] = timed_write(args.uf2, args.mount)
+        # application is back once the volume is gone and its CDC port is there, UF2 mode may have a CDC
+        # port of the same name (CFG_UF2_MEASUREMENT_CDC)
+        t1 = time.monotonic()
+        info = os.path.join(args.mount, 'INFO_UF2.TXT')
+        app_ms = None
+        if wait_for(lambda: not os.path.isfile(info), t1, args.timeout) is not None:
+            app_ms = wait_for(lambda: port_present(args.port), t1, args.timeout)
+        row['app_ms'] = app_ms
+        if app_ms is None:
+            sys.exit('error: %s did not come back within %ds' % (args.port, args.timeout))
+        time.sleep(args.settle)
+    return row
+
+
+def fmt(value):
+    return '' if value is None else ('%.1f' % value if isinstance(value, float) else str(value))
+
+
+def cmd_run(args):
+    try:
+        from touch1200 import touch
+    except ImportError:
+        sys.exit('error: pyserial and click are required (pip install pyserial click)')
+
+    if args.runs > 1 and not args.uf2:
+        sys.exit('error: more than one run needs --uf2 to leave UF2 mode again')
+
+    new = not os.path.exists(args.csv) or os.path.getsize(args.csv) == 0
+    with open(args.csv, 'a', newline='') as f:
+        out = csv.DictWriter(f, FIELDS)
+        if new:
+            out.writeheader()
+        for run in range(args.runs):
+            row = one_run(args, run, touch)
+            out.writerow({k: fmt(row.get(k)) for k in FIELDS})
+            f.flush()
+            print(' '.join('%s=%s' % (k, fmt(row[k])) for k in FIELDS[2:] if row.get(k) is not None))
+    return 0
+
+
+def cmd_summary(args):
+    groups = {}
+    for path in args.csv:
+        with open(path, newline='') as f:
+            for row in csv.DictReader(f):
+                groups.setdefault(row['os'], []).append(row)
+
+    for name, rows in sorted(groups.items()):
+        print('%s: %d runs' % (name, len(rows)))
+        print('  %-16s %6s %9s %9s %9s %9s' % ('', 'n', 'min', 'median', 'p90', 'max'))
+        for field in FIELDS[3:]:
+            values = sorted(float(r[field]) for r in rows if r.get(field))
+            if not values:
+                continue
+            p90 = values[min(len(values) - 1, int(0.9 * len(values)))]
+            print('  %-16s %6d %9.1f %9.1f %9.1f %9.1f' %
+                  (field, len(values), values[0], statistics.median(values), p90, values[-1]))
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest='command', required=True)
+
+    run = sub.add_parser('run', help='measure runs, append them to --csv')
+    run.add_argument('port', help='CDC port of the application, e.g. /dev/ttyACM0 or COM5')
+    run.add_argument('mount', help='mount point or drive of the UF2 volume, e.g. /media/user/ENERTY or E:\\')
+    run.add_argument('--uf2', help='file copied to the drive at the end of each run, e.g. the application')
+    run.add_argument('--vid', type=lambda x: int(x, 16), help='USB vendor id of UF2 mode (hex)')
+    run.add_argument('--pid', type=lambda x: int(x, 16), help='USB product id of UF2 mode (hex)')
+    run.add_argument('--runs', type=int, default=1, help='number of runs (default 1)')
+    run.add_argument('--csv', default='mountbench.csv', help='results, appended to (default mountbench.csv)')
+    run.add_argument('--timeout', type=int, default=30, help='seconds to wait for each stage (default 30)')
+    run.add_argument('--settle', type=float, default=2.0,
+                     help='seconds the application runs before the next reset (default 2)')
+
+    summary = sub.add_parser('summary', help='latency and throughput distributions per OS')
+    summary.add_argument('csv', nargs='+', help='results of one or more hosts')
+
+    args = parser.parse_args()
+    return cmd_run(args) if args.command == 'run' else cmd_summary(args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,355 @@
+#!/usr/bin/env python3
+"""
+Pack ESP-IDF build outputs into UF2 files for tinyuf2, or write them straight to the drive. Host
+library behind the other uf2*.py tools: plain blocks with 476 byte payloads, compressed
+(uf2compress.py), delta (uf2delta.py), MD5 skip blocks for images that are mostly on the device
+already, bundles of other partitions (BOARD_UF2_ROUTES) and tinyuf2 itself (BOARD_UF2_STAGE_FAMILY),
+files for the ffat partition (CFG_UF2_FILE_CONTAINER), optionally signed (uf2sign.py). Sizes are
+checked against the partition table .csv.
+
+    python3 tools/uf2pack.py --build build -o firmware.uf2
+    python3 tools/uf2pack.py --app app.bin --partitions partitions-16MB.csv --compress --write /media/ENERTYMBOOT
+    python3 tools/uf2pack.py --build build --delta old.bin --bundle nvs=nvs.bin --tinyuf2 tinyuf2.bin -o bundle.uf2
+    python3 tools/uf2pack.py --build build --file www/index.html=dist/index.html -o bundle.uf2
+    python3 tools/uf2pack.py --rollback A0123456789 --write /media/ENERTYMBOOT
+
+With --write there is no intermediate file: sectors go to NEW.UF2 on the drive in 64KB page aligned
+writes that bypass the page cache (O_DIRECT, F_NOCACHE on macOS), followed by a single sync.
+"""
+import argparse
+import hashlib
+import json
+import mmap
+import os
+import struct
+import sys
+import zlib
+
+UF2_MAGIC_START0 = 0x0A324655
+UF2_MAGIC_START1 = 0x9E5D5157
+UF2_MAGIC_END = 0x0AB16F30
+
+UF2_FLAG_FILE_CONTAINER = 0x00001000
+UF2_FLAG_FAMILYID = 0x00002000
+UF2_FLAG_MD5 = 0x00004000
+UF2_FLAG_EXTENSION = 0x00008000
+UF2_FLAG_HEATSHRINK = 0x00100000
+UF2_FLAG_DELTA = 0x00200000
+
+# Rollback_Block of src/uf2.h, CFG_UF2_LKG_SNAPSHOT
+ROLLBACK_MAGIC_START0 = 0x0A4C4F52
+ROLLBACK_MAGIC_START1 = 0x27B9E04D
+ROLLBACK_MAGIC_END = 0x6A13D85C
+
+PAYLOAD_SIZE = 476
+# MD5 blocks keep the last 24 bytes for address, length and MD5 of their range
+MD5_PAYLOAD_SIZE = 448
+MD5_RANGE_SIZE = 4096
+# --crc: UF2_EXT_CRC32 tag after the payload, checked by tinyuf2 built with CFG_UF2_BLOCK_CRC
+UF2_EXT_CRC32 = 0x6b2ec1
+CRC_PAYLOAD_SIZE = PAYLOAD_SIZE - 8
+
+FAMILIES = {'ESP32S2': 0xbfdd4eee, 'ESP32S3': 0xc47e5767}
+
+# BOARD_UF2_ROUTES and BOARD_UF2_STAGE_FAMILY of boards/enerty_module_m/board.h
+ROUTES = {('app', 'ota_1'): 0x2f1e7a51, ('data', 'fat'): 0x9c3b47d2, ('data', 'nvs'): 0x51d0e8a3}
+STAGE_FAMILY = 0x7c4e19b3
+
+WRITE_CHUNK = 64 * 1024
+
+
+class Partition:
+    def __init__(self, name, ptype, subtype, offset, size):
+        self.name, self.type, self.subtype, self.offset, self.size = name, ptype, subtype, offset, size
+
+
+def parse_int(text):
+    text = text.strip()
+    scale = {'K': 1024, 'M': 1024 * 1024}.get(text[-1:].upper(), 1)
+    return int(text[:-1] if scale > 1 else text, 0) * scale
+
+
+def read_partitions(path):
+    # ESP-IDF partition table csv, empty offsets follow the previous partition like gen_esp32part.py
+    parts = []
+    offset = 0x9000
+    with open(path) as f:
+        for line in f:
+            line = line.split('#', 1)[0].strip()
+            if not line:
+                continue
+            fields = [x.strip() for x in line.split(',')]
+            name, ptype, subtype = fields[0], fields[1].lower(), fields[2].lower()
+            align = 0x10000 if ptype == 'app' else 0x1000
+            start = parse_int(fields[3]) if fields[3] else (offset + align - 1) // align * align
+            size = parse_int(fields[4])
+            parts.append(Partition(name, ptype, subtype, start, size))
+            offset = start + size
+    return parts
+
+
+def find_partition(parts, name=None, ptype=None, subtype=None):
+    for p in parts:
+        if (name is None or p.name == name) and (ptype is None or p.type == ptype) and \
+           (subtype is None or p.subtype == subtype):
+            return p
+    return None
+
+
+def read_build(build_dir):
+    # app image and partition table csv of an ESP-IDF build directory
+    with open(os.path.join(build_dir, 'flasher_args.json')) as f:
+        app = os.path.join(build_dir, json.load(f)['app']['file'])
+
+    csv = None
+    try:
+        with open(os.path.join(build_dir, 'project_description.json')) as f:
+            project = json.load(f)['project_path']
+        with open(os.path.join(build_dir, 'config', 'sdkconfig.json')) as f:
+            csv = os.path.join(project, json.load(f)['PARTITION_TABLE_FILENAME'])
+    except (OSError, KeyError, ValueError):
+        pass
+    return app, csv
+
+
+def uf2_block(flags, addr, payload, family):
+    # block number and count are filled in by number_blocks()
+    hdr = struct.pack('<8I', UF2_MAGIC_START0, UF2_MAGIC_START1, flags | UF2_FLAG_FAMILYID,
+                      addr, len(payload), 0, 0, family)
+    return bytearray(hdr + payload.ljust(476, b'\x00') + struct.pack('<I', UF2_MAGIC_END))
+
+
+def plain_blocks(image, family, base=0, size=PAYLOAD_SIZE):
+    for addr in range(0, len(image), size):
+        yield uf2_block(0, base + addr, image[addr:addr + size], family)
+
+
+def file_blocks(name, data):
+    # file container: familyID holds the file size, the NUL terminated name follows the payload
+    path = name.encode() + b'\x00'
+    size = (PAYLOAD_SIZE - len(path)) // 4 * 4
+    if size <= 0:
+        sys.exit('error: file name %s is too long' % name)
+    for addr in range(0, max(len(data), 1), size):
+        payload = data[addr:addr + size]
+        hdr = struct.pack('<8I', UF2_MAGIC_START0, UF2_MAGIC_START1, UF2_FLAG_FILE_CONTAINER,
+                          addr, len(payload), 0, 0, len(data))
+        yield bytearray(hdr + (payload + path).ljust(476, b'\x00') + struct.pack('<I', UF2_MAGIC_END))
+
+
+def md5_blocks(image, family, base=0):
+    # payloads never cross a range, the whole range is skipped if the device already holds it
+    for start in range(0, len(image), MD5_RANGE_SIZE):
+        data = image[start:start + MD5_RANGE_SIZE]
+        info = struct.pack('<II', base + start, len(data)) + hashlib.md5(data).digest()
+        for addr in range(0, len(data), MD5_PAYLOAD_SIZE):
+            block = uf2_block(UF2_FLAG_MD5, base + start + addr, data[addr:addr + MD5_PAYLOAD_SIZE], family)
+            block[32 + 476 - 24:32 + 476] = info
+            yield block
+
+
+def stream_blocks(stream, flags, family, base=0, size=PAYLOAD_SIZE):
+    for pos in range(0, len(stream), size):
+        yield uf2_block(flags, base, stream[pos:pos + size], family)
+
+
+def compressed_blocks(image, family, window_bits=11, lookahead_bits=4, size=PAYLOAD_SIZE):
+    import uf2compress
+    stream = uf2compress.compress(image, window_bits, lookahead_bits)
+    if uf2compress.decompress(stream, window_bits, lookahead_bits) != image:
+        sys.exit('error: compressed stream does not decode to the image')
+    return stream_blocks(stream, UF2_FLAG_HEATSHRINK, family, size=size)
+
+
+def delta_blocks(old, image, family, size=PAYLOAD_SIZE):
+    import uf2delta
+    stream = uf2delta.encode(old, image)
+    if uf2delta.apply(old, stream) != image:
+        sys.exit('error: delta does not reproduce the new image')
+    return stream_blocks(stream, UF2_FLAG_DELTA, family, size=size)
+
+
+def number_blocks(blocks):
+    # one block count over the whole file: app stream first (block 0 carries the image check),
+    # tinyuf2 completes the update once every block of every family is written
+    blocks = list(blocks)
+    for i, block in enumerate(blocks):
+        struct.pack_into('<II', block, 20, i, len(blocks))
+    return blocks
+
+
+def add_crc(blocks):
+    # after number_blocks(): the crc covers the whole header, block number and count included. The name
+    # of a file container block takes the place of the tag
+    for block in blocks:
+        flags, = struct.unpack_from('<I', block, 8)
+        if flags & UF2_FLAG_FILE_CONTAINER:
+            continue
+        size, = struct.unpack_from('<I', block, 16)
+        struct.pack_into('<I', block, 8, flags | UF2_FLAG_EXTENSION)
+        tag = 32 + (size + 3) // 4 * 4
+        struct.pack_into('<II', block, tag, 8 | UF2_EXT_CRC32 << 8, zlib.crc32(block[:32 + size]))
+    return blocks
+
+
+def write_file(path, sectors):
+    with open(path, 'wb') as f:
+        for sector in sectors:
+            f.write(sector)
+
+
+def write_direct(path, sectors):
+    # page aligned buffer and whole sectors as O_DIRECT needs, filesystems without it get a plain write
+    flags = os.O_WRONLY | os.O_CREAT | os.O_TRUNC | getattr(os, 'O_BINARY', 0)
+    try:
+        fd = os.open(path, flags | getattr(os, 'O_DIRECT', 0), 0o644)
+    except OSError:
+        fd = os.open(path, flags, 0o644)
+    try:
+        if sys.platform == 'darwin':
+            import fcntl
+            fcntl.fcntl(fd, fcntl.F_NOCACHE, 1)
+        buf = mmap.mmap(-1, WRITE_CHUNK)
+        fill = 0
+        for sector in sectors:
+            buf[fill:fill + 512] = sector
+            fill += 512
+            if fill == WRITE_CHUNK:
+                os.write(fd, buf)
+                fill = 0
+        if fill:
+            os.write(fd, memoryview(buf)[:fill])
+        os.fsync(fd)
+    finally:
+        os.close(fd)
+
+
+def rollback_sector(serial):
+    # serial as in INFO_UF2.TXT: hardware identifier character followed by 10 hex digits
+    if len(serial) != 11:
+        sys.exit('error: serial number %s is not 11 characters' % serial)
+    try:
+        sn = bytes([ord(serial[0])]) + bytes.fromhex(serial[1:])
+    except ValueError:
+        sys.exit('error: serial number %s is not a character and 10 hex digits' % serial)
+    sector = bytearray(512)
+    struct.pack_into('<II6s2xI', sector, 0, ROLLBACK_MAGIC_START0, ROLLBACK_MAGIC_START1, sn, ROLLBACK_MAGIC_END)
+    return sector
+
+
+def check_fit(what, length, size):
+    if length > size:
+        sys.exit('error: %s is %d bytes, its partition only %d' % (what, length, size))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--build', help='ESP-IDF build directory of the app')
+    parser.add_argument('--app', help='app .bin, instead of the one of --build')
+    parser.add_argument('--partitions', help='partition table .csv, default: the one of --build')
+    parser.add_argument('-f', '--family', default='ESP32S2', help='UF2 family of the app (default: %(default)s)')
+    fmt = parser.add_mutually_exclusive_group()
+    fmt.add_argument('--compress', action='store_true', help='heatshrink stream, CFG_UF2_HEATSHRINK')
+    fmt.add_argument('--delta', metavar='OLD.bin', help='delta from the app on the device, CFG_UF2_DELTA')
+    fmt.add_argument('--md5', action='store_true', help='MD5 blocks, ranges already on the device are skipped')
+    parser.add_argument('--bundle', action='append', default=[], metavar='NAME=FILE.bin',
+                        help='image of another partition, routed by its type and subtype')
+    parser.add_argument('--file', action='append', default=[], metavar='NAME=FILE',
+                        help='file written into the ffat partition as NAME, CFG_UF2_FILE_CONTAINER')
+    parser.add_argument('--tinyuf2', metavar='FILE.bin', help='tinyuf2 installed after the app, BOARD_UF2_STAGE_FAMILY')
+    parser.add_argument('--sign', metavar='KEY.pem', help='prepend a Sign_Block, BOARD_UF2_SIGN_PUBKEY')
+    parser.add_argument('--crc', action='store_true', help='crc32 tag in every block, CFG_UF2_BLOCK_CRC')
+    parser.add_argument('--rollback', metavar='SERIAL',
+                        help='only a rollback block for the device with this serial number, CFG_UF2_LKG_SNAPSHOT')
+    out = parser.add_mutually_exclusive_group(required=True)
+    out.add_argument('-o', '--output', help='.uf2 file to write')
+    out.add_argument('--write', metavar='MOUNT', help='mounted tinyuf2 drive, written as NEW.UF2')
+    args = parser.parse_args()
+
+    if args.rollback:
+        path = os.path.join(args.write, 'NEW.UF2') if args.write else args.output
+        (write_direct if args.write else write_file)(path, [rollback_sector(args.rollback)])
+        print('%s: rollback of %s' % (path, args.rollback))
+        return
+
+    app, csv = read_build(args.build) if args.build else (None, None)
+    app = args.app or app
+    csv = args.partitions or csv
+    if not app:
+        parser.error('--build or --app is required')
+    family = FAMILIES.get(args.family.upper()) or int(args.family, 0)
+
+    with open(app, 'rb') as f:
+        image = f.read()
+
+    parts = read_partitions(csv) if csv else []
+    if parts:
+        ota0 = find_partition(parts, ptype='app', subtype='ota_0') or find_partition(parts, ptype='app', subtype='factory')
+        size = ota0.size
+        if args.tinyuf2:
+            # staged in the last factory-size region of ota_0
+            factory = find_partition(parts, ptype='app', subtype='factory')
+            size -= factory.size if factory else 0
+        check_fit(os.path.basename(app), len(image), size)
+    elif args.bundle or args.tinyuf2:
+        parser.error('--bundle and --tinyuf2 need the partition table')
+    if args.crc and args.md5:
+        parser.error('--crc has no room in MD5 blocks')
+    payload_size = CRC_PAYLOAD_SIZE if args.crc else PAYLOAD_SIZE
+
+    if args.compress:
+        blocks = list(compressed_blocks(image, family, size=payload_size))
+    elif args.delta:
+        with open(args.delta, 'rb') as f:
+            blocks = list(delta_blocks(f.read(), image, family, size=payload_size))
+    elif args.md5:
+        blocks = list(md5_blocks(image, family))
+    else:
+        blocks = list(plain_blocks(image, family, size=payload_size))
+
+    for arg in args.bundle:
+        name, sep, path = arg.partition('=')
+        part = find_partition(parts, name)
+        if not sep or part is None:
+            sys.exit('error: no partition %s in %s' % (name, csv))
+        route = ROUTES.get((part.type, part.subtype))
+        if route is None:
+            sys.exit('error: partition %s (%s, %s) has no route' % (name, part.type, part.subtype))
+        with open(path, 'rb') as f:
+            data = f.read()
+        check_fit(path, len(data), part.size)
+        blocks += plain_blocks(data, route, size=payload_size)
+
+    if args.tinyuf2:
+        with open(args.tinyuf2, 'rb') as f:
+            data = f.read()
+        factory = find_partition(parts, ptype='app', subtype='factory')
+        check_fit(args.tinyuf2, len(data), factory.size if factory else 0)
+        blocks += plain_blocks(data, STAGE_FAMILY, size=payload_size)
+
+    for arg in args.file:
+        name, sep, path = arg.partition('=')
+        if not sep or not name:
+            sys.exit('error: --file needs NAME=FILE, got %s' % arg)
+        with open(path, 'rb') as f:
+            blocks += file_blocks(name, f.read())
+
+    sectors = number_blocks(blocks)
+    if args.crc:
+        add_crc(sectors)
+    if args.sign:
+        import uf2sign
+        sectors.insert(0, uf2sign.sign_block(uf2sign.load_key(args.sign), image))
+
+    if args.write:
+        path = os.path.join(args.write, 'NEW.UF2')
+        write_direct(path, sectors)
+    else:
+        path = args.output
+        write_file(path, sectors)
+
+    print('%s: %d bytes app, %d blocks (%d KB)' % (path, len(image), len(blocks), len(sectors) // 2))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+"""
+Sign a UF2 file for tinyuf2 built with BOARD_UF2_SIGN_PUBKEY: a Sign_Block (see src/uf2.h) holding
+the ECDSA P-256 signature of the firmware .bin is prepended to the UF2 file. The UF2 file may be
+plain, compressed (uf2compress.py) or a delta (uf2delta.py), the signature is always over the
+image as it ends up in flash. Needs the cryptography package.
+
+    python3 tools/uf2sign.py keygen key.pem
+    python3 tools/uf2sign.py pubkey key.pem        # BOARD_UF2_SIGN_PUBKEY for board.h
+    python3 tools/uf2sign.py sign key.pem firmware.bin firmware.uf2 -o firmware-signed.uf2
+"""
+import argparse
+import struct
+import sys
+
+try:
+    from cryptography.hazmat.primitives import hashes, serialization
+    from cryptography.hazmat.primitives.asymmetric import ec
+    from cryptography.hazmat.primitives.asymmetric.utils import decode_dss_signature
+except ImportError:
+    sys.exit('error: cryptography is required (pip install cryptography)')
+
+SIGN_MAGIC_START0 = 0x0A474953
+SIGN_MAGIC_START1 = 0x8E3D0C61
+SIGN_MAGIC_END = 0x47B2F91D
+
+UF2_MAGIC_START0 = 0x0A324655
+
+
+def load_key(path):
+    with open(path, 'rb') as f:
+        key = serialization.load_pem_private_key(f.read(), password=None)
+    if not isinstance(key, ec.EllipticCurvePrivateKey) or key.curve.name != 'secp256r1':
+        sys.exit('error: %s is not a P-256 key' % path)
+    return key
+
+
+def pubkey_bytes(key):
+    # uncompressed point without its 0x04 prefix, the format of micro-ecc
+    return key.public_key().public_bytes(serialization.Encoding.X962, serialization.PublicFormat.UncompressedPoint)[1:]
+
+
+def sign_block(key, image):
+    r, s = decode_dss_signature(key.sign(image, ec.ECDSA(hashes.SHA256())))
+    sig = r.to_bytes(32, 'big') + s.to_bytes(32, 'big')
+    block = struct.pack('<III', SIGN_MAGIC_START0, SIGN_MAGIC_START1, len(image)) + sig
+    block += struct.pack('<I', SIGN_MAGIC_END)
+    return block.ljust(512, b'\x00')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('command', choices=('keygen', 'pubkey', 'sign'))
+    parser.add_argument('key', help='private key .pem')
+    parser.add_argument('image', nargs='?', help='firmware .bin as written to ota0')
+    parser.add_argument('uf2', nargs='?', help='UF2 file of the image')
+    parser.add_argument('-o', '--output', help='signed .uf2 file')
+    args = parser.parse_args()
+
+    if args.command == 'keygen':
+        key = ec.generate_private_key(ec.SECP256R1())
+        with open(args.key, 'wb') as f:
+            f.write(key.private_bytes(serialization.Encoding.PEM, serialization.PrivateFormat.PKCS8,
+                                      serialization.NoEncryption()))
+        print('%s: new P-256 key, keep it out of the repository' % args.key)
+        return
+
+    key = load_key(args.key)
+    if args.command == 'pubkey':
+        pub = pubkey_bytes(key)
+        rows = [', '.join('0x%02x' % b for b in pub[i:i + 16]) for i in range(0, len(pub), 16)]
+        print('#define BOARD_UF2_SIGN_PUBKEY { \\\n  ' + ', \\\n  '.join(rows) + ' }')
+        return
+
+    if not args.image or not args.uf2 or not args.output:
+        sys.exit('error: sign needs image, uf2 and --output')
+
+    with open(args.image, 'rb') as f:
+        image = f.read()
+    with open(args.uf2, 'rb') as f:
+        uf2 = f.read()
+    if len(uf2) < 512 or struct.unpack_from('<I', uf2)[0] != UF2_MAGIC_START0:
+        sys.exit('error: %s is not a UF2 file' % args.uf2)
+
+    with open(args.output, 'wb') as f:
+        f.write(sign_block(key, image) + uf2)
+    print('%s: %d bytes image signed, %d blocks' % (args.output, len(image), len(uf2) // 512))
+
+
+if __name__ == '__main__':
+    main()
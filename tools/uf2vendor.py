@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+"""
+Flash a firmware .bin over the tinyuf2 vendor bulk interface (CFG_TUD_VENDOR), see src/vendor.h
+for the protocol. Needs pyusb. Several WRITE requests are kept in flight so the bus stays busy.
+On Windows WinUSB is bound to the interface automatically (MS OS 2.0 descriptors), no driver setup.
+"""
+import argparse
+import struct
+import sys
+import zlib
+
+try:
+    import usb.core
+    import usb.util
+except ImportError:
+    sys.exit('error: pyusb is required (pip install pyusb)')
+
+VENDOR_MAGIC = 0x42465554
+
+CMD_BEGIN = 0x01
+CMD_WRITE = 0x02
+CMD_FINISH = 0x03
+CMD_RESET = 0x04
+
+STATUS = ['ok', 'bad request', 'bad crc', 'bad address', 'image rejected', 'verify failed', 'not ready']
+
+IN_FLIGHT = 4
+TIMEOUT_MS = 5000
+
+
+class Device:
+    def __init__(self, dev):
+        self.dev = dev
+        for itf in dev.get_active_configuration():
+            if itf.bInterfaceClass == 0xff:
+                break
+        else:
+            sys.exit('error: device has no vendor interface')
+        if dev.is_kernel_driver_active(itf.bInterfaceNumber):
+            dev.detach_kernel_driver(itf.bInterfaceNumber)
+        usb.util.claim_interface(dev, itf.bInterfaceNumber)
+        match_dir = lambda d: lambda ep: usb.util.endpoint_direction(ep.bEndpointAddress) == d
+        self.ep_out = usb.util.find_descriptor(itf, custom_match=match_dir(usb.util.ENDPOINT_OUT))
+        self.ep_in = usb.util.find_descriptor(itf, custom_match=match_dir(usb.util.ENDPOINT_IN))
+
+    def send(self, cmd, addr=0, length=0, crc=0, data=b''):
+        self.ep_out.write(struct.pack('<5I', VENDOR_MAGIC, cmd, addr, length, crc) + data, TIMEOUT_MS)
+
+    def response(self, cmd):
+        buf = bytes(self.ep_in.read(12, TIMEOUT_MS))
+        magic, rcmd, status, _, value = struct.unpack('<IBBHI', buf)
+        if magic != VENDOR_MAGIC or rcmd != cmd:
+            sys.exit('error: unexpected response %s' % buf.hex())
+        if status:
+            sys.exit('error: %s' % (STATUS[status] if status < len(STATUS) else 'status %d' % status))
+        return value
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('image', help='firmware .bin of the app partition')
+    parser.add_argument('--vid', type=lambda x: int(x, 0), default=0x0403, help='USB vendor ID')
+    parser.add_argument('--pid', type=lambda x: int(x, 0), default=0x80da, help='USB product ID')
+    parser.add_argument('--serial', help='USB serial number, to pick one of several devices')
+    parser.add_argument('--no-reset', action='store_true', help='do not boot the new image')
+    args = parser.parse_args()
+
+    with open(args.image, 'rb') as f:
+        image = f.read()
+
+    match = (lambda d: d.serial_number == args.serial) if args.serial else None
+    dev = usb.core.find(idVendor=args.vid, idProduct=args.pid, custom_match=match)
+    if dev is None:
+        sys.exit('error: device not found')
+    dev = Device(dev)
+
+    dev.send(CMD_BEGIN, length=len(image))
+    chunk = dev.response(CMD_BEGIN)
+
+    pending = 0
+    for addr in range(0, len(image), chunk):
+        data = image[addr:addr + chunk]
+        dev.send(CMD_WRITE, addr, len(data), zlib.crc32(data), data)
+        pending += 1
+        if pending == IN_FLIGHT:
+            dev.response(CMD_WRITE)
+            pending -= 1
+    for _ in range(pending):
+        dev.response(CMD_WRITE)
+
+    dev.send(CMD_FINISH, length=len(image), crc=zlib.crc32(image))
+    dev.response(CMD_FINISH)
+    print('%s: %d bytes written and verified' % (args.image, len(image)))
+
+    if not args.no_reset:
+        dev.send(CMD_RESET)
+
+
+if __name__ == '__main__':
+    main()
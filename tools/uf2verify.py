@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+"""
+Make a verify-only file for tinyuf2 built with CFG_UF2_VERIFY: Verify_Block sectors (see src/uf2.h)
+with the sha256 of ranges of the firmware .bin. Copied to the drive, nothing is written, each range
+of ota0 is reported as OK or DIFFERS in VERIFY.TXT. Read it back with 'check'.
+
+    python3 tools/uf2verify.py make firmware.bin verify.uf2 [--range-size 0x10000]
+    python3 tools/uf2verify.py check /media/UF2BOOT/VERIFY.TXT
+"""
+import argparse
+import hashlib
+import struct
+import sys
+
+VERIFY_MAGIC_START0 = 0x0A524556
+VERIFY_MAGIC_START1 = 0xD1726B0E
+VERIFY_MAGIC_END = 0x3E95C4A7
+
+BLOCK_RANGES = 12
+MAX_RANGES = 64
+
+
+def verify_blocks(image, range_size):
+    ranges = [(addr, image[addr:addr + range_size]) for addr in range(0, len(image), range_size)]
+    blocks = []
+    for n in range(0, len(ranges), BLOCK_RANGES):
+        chunk = ranges[n:n + BLOCK_RANGES]
+        block = struct.pack('<IIII', VERIFY_MAGIC_START0, VERIFY_MAGIC_START1, n // BLOCK_RANGES, len(chunk))
+        for addr, data in chunk:
+            block += struct.pack('<II', addr, len(data)) + hashlib.sha256(data).digest()
+        block = block.ljust(16 + 40 * BLOCK_RANGES, b'\x00') + struct.pack('<I', VERIFY_MAGIC_END)
+        blocks.append(block.ljust(512, b'\x00'))
+    return blocks, len(ranges)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('command', choices=('make', 'check'))
+    parser.add_argument('input', help='firmware .bin as written to ota0, or VERIFY.TXT')
+    parser.add_argument('output', nargs='?', help='verify file to write')
+    parser.add_argument('--range-size', type=lambda x: int(x, 0), default=0x10000,
+                        help='bytes per range (default: 0x%(default)x)')
+    args = parser.parse_args()
+
+    if args.command == 'check':
+        with open(args.input) as f:
+            lines = f.read().splitlines()
+        total = lines[-1].split()[-1] if len(lines) > 1 else 'MISSING'
+        for line in lines[1:-1]:
+            if line.split()[-1] != 'OK':
+                print(line)
+        print('total: %s' % total)
+        return 0 if total == 'OK' else 1
+
+    if not args.output:
+        sys.exit('error: make needs an output file')
+    with open(args.input, 'rb') as f:
+        image = f.read()
+
+    blocks, count = verify_blocks(image, args.range_size)
+    if count > MAX_RANGES:
+        print('warning: %d ranges, more than CFG_UF2_VERIFY_RANGES default of %d' % (count, MAX_RANGES),
+              file=sys.stderr)
+    with open(args.output, 'wb') as f:
+        f.write(b''.join(blocks))
+    print('%s: %d ranges of 0x%x bytes, %d blocks' % (args.output, count, args.range_size, len(blocks)))
+
+
+if __name__ == '__main__':
+    sys.exit(main())